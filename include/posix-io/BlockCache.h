@@ -0,0 +1,359 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_BLOCK_CACHE_H_
+#define POSIX_IO_BLOCK_CACHE_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+#include "posix-io/BlockRequest.h"
+
+// ----------------------------------------------------------------------------
+
+#if !defined(OS_INTEGER_BLOCK_CACHE_RUN_MAX)
+#define OS_INTEGER_BLOCK_CACHE_RUN_MAX  (16)
+#endif
+
+// The number of prefetch requests that can be in progress.
+#if !defined(OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX)
+#define OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX  (2)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Write-back cache of the blocks of another block device, with
+     * a fixed number of block buffers.
+     *
+     * The cache is itself a block device, and is passed to mount()
+     * instead of the cached device; file systems reach it with
+     * BlockDevice::getBlockCache() to pin metadata blocks in memory.
+     *
+     * Replacement uses the 2Q policy: blocks read for the first time
+     * enter a FIFO queue, and only blocks requested again after they
+     * were evicted from it (remembered in a queue of ghost entries
+     * without data) are promoted to the main LRU queue. A single scan
+     * of a large file does not flush the frequently used blocks.
+     *
+     * Written blocks are kept dirty until evicted, flushed, or the
+     * file system is synced or unmounted; consecutive dirty blocks
+     * are written with a single vectored request. Consecutive missing
+     * blocks are also read with a single request.
+     *
+     * Prefetched blocks are read with asynchronous requests
+     * (BlockDevice::submit()); the blocks stay pinned until the
+     * request completes, and accessing them waits for it.
+     *
+     * The cache is not thread safe.
+     */
+    class BlockCache : public BlockDevice
+    {
+    public:
+
+      /**
+       * The geometry of `device` must be already known.
+       */
+      BlockCache (BlockDevice* device, std::size_t capacity);
+      BlockCache (const BlockCache&) = delete;
+
+      virtual
+      ~BlockCache ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Get the buffer of a block, and keep it in the cache until
+       * unpin() is called. Calls can be nested.
+       *
+       * @param read false if the block will be entirely overwritten,
+       * to skip reading it from the device.
+       * @return The block buffer, or nullptr and errno (ENOBUFS if
+       * all buffers are pinned).
+       */
+      void*
+      pin (blockNumber_t block, bool read = true);
+
+      /**
+       * @param dirty true if the buffer was modified.
+       */
+      void
+      unpin (blockNumber_t block, bool dirty = false);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      virtual BlockCache*
+      getBlockCache (void) override;
+
+      BlockDevice*
+      getDevice (void) const;
+
+      std::size_t
+      getCapacity (void) const;
+
+      std::size_t
+      getHits (void) const;
+
+      std::size_t
+      getMisses (void) const;
+
+      /**
+       * The number of write requests sent to the device, each with
+       * a run of consecutive blocks.
+       */
+      std::size_t
+      getWriteRequests (void) const;
+
+      std::size_t
+      getWrittenBlocks (void) const;
+
+      void
+      resetStatistics (void);
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count)
+          override;
+
+      virtual int
+      do_flush (void) override;
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count) override;
+
+      /**
+       * Start reading the missing blocks into the cache, at most half
+       * of the capacity, without waiting; prefetched blocks enter the
+       * FIFO queue, so they do not evict the frequently used ones.
+       */
+      virtual int
+      do_prefetch (blockNumber_t block, std::size_t count) override;
+
+    private:
+
+      using queue_t = std::uint8_t;
+      enum Queue
+        : queue_t
+          { FREE = 0,
+        // First access, FIFO.
+        IN = 1,
+        // Accessed again after eviction from IN, LRU.
+        MAIN = 2,
+        // Recently evicted from IN, without data.
+        GHOST = 3,
+        QUEUES = 4
+      };
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Entry
+      {
+        std::uint8_t* data;
+
+        // Links in the hash bucket chain and in the queue.
+        std::size_t nextInBucket;
+        std::size_t newer;
+        std::size_t older;
+
+        blockNumber_t block;
+        std::uint16_t pins;
+        queue_t queue;
+        bool dirty;
+        // Being read by a prefetch request.
+        bool pending;
+      };
+
+      struct Prefetch
+      {
+        BlockRequest request;
+        struct iovec* iov;
+        blockNumber_t block;
+        std::size_t count;
+        bool busy;
+      };
+
+      struct List
+      {
+        std::size_t newest;
+        std::size_t oldest;
+        std::size_t count;
+      };
+
+#pragma GCC diagnostic pop
+
+      std::size_t
+      find (blockNumber_t block) const;
+
+      std::size_t
+      findResident (blockNumber_t block) const;
+
+      std::size_t
+      lookup (blockNumber_t block);
+
+      std::size_t
+      allocate (blockNumber_t block);
+
+      std::size_t
+      findVictim (void);
+
+      std::size_t
+      allocateRun (blockNumber_t block, std::size_t count);
+
+      ssize_t
+      loadRun (blockNumber_t block, std::size_t count);
+
+      std::size_t
+      freePrefetch (void) const;
+
+      void
+      finishPrefetch (std::size_t slot);
+
+      void
+      reapPrefetches (bool wait);
+
+      void
+      release (std::size_t index);
+
+      void
+      touch (std::size_t index);
+
+      int
+      writeBack (std::size_t index);
+
+      void
+      hashInsert (std::size_t index);
+
+      void
+      hashRemove (std::size_t index);
+
+      void
+      unlinkQueue (std::size_t index);
+
+      void
+      linkNewest (std::size_t index, Queue queue);
+
+      std::size_t
+      bucketOf (blockNumber_t block) const;
+
+    private:
+
+      BlockDevice* fDevice;
+
+      std::size_t fCapacity;
+      std::size_t fInMax;
+      std::size_t fGhostMax;
+      std::size_t fRunMax;
+
+      std::uint8_t* fStorage;
+      Entry* fEntriesArray;
+      std::size_t fEntriesCount;
+
+      std::size_t* fBucketsArray;
+      std::size_t fBucketsMask;
+
+      // Buffers not owned by any entry.
+      std::uint8_t** fFreeBuffersArray;
+      std::size_t fFreeBuffersCount;
+
+      struct iovec* fIovArray;
+
+      Prefetch* fPrefetchArray;
+
+      List fLists[QUEUES];
+
+      std::size_t fHits;
+      std::size_t fMisses;
+      std::size_t fWriteRequests;
+      std::size_t fWrittenBlocks;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline BlockDevice*
+    BlockCache::getDevice (void) const
+    {
+      return fDevice;
+    }
+
+    inline std::size_t
+    BlockCache::getCapacity (void) const
+    {
+      return fCapacity;
+    }
+
+    inline std::size_t
+    BlockCache::getHits (void) const
+    {
+      return fHits;
+    }
+
+    inline std::size_t
+    BlockCache::getMisses (void) const
+    {
+      return fMisses;
+    }
+
+    inline std::size_t
+    BlockCache::getWriteRequests (void) const
+    {
+      return fWriteRequests;
+    }
+
+    inline std::size_t
+    BlockCache::getWrittenBlocks (void) const
+    {
+      return fWrittenBlocks;
+    }
+
+    inline std::size_t
+    BlockCache::bucketOf (blockNumber_t block) const
+    {
+      // Fibonacci hashing, consecutive blocks go to distinct buckets.
+      return static_cast<std::size_t> (block * 2654435761u) & fBucketsMask;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_BLOCK_CACHE_H_ */
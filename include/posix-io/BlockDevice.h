@@ -28,17 +28,225 @@
 #ifndef POSIX_IO_BLOCK_DEVICE_H_
 #define POSIX_IO_BLOCK_DEVICE_H_
 
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+
+// Needed for ssize_t
+#include <sys/types.h>
+
+// ----------------------------------------------------------------------------
+
+struct iovec;
+
 namespace os
 {
   namespace posix
   {
+    // ------------------------------------------------------------------------
+
+    class BlockCache;
+    class BlockRequest;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Base class for block devices, accessed in units of fixed size
+     * blocks (sectors). All transfers are expressed as a block number
+     * and a number of blocks; the buffers of the vectored functions
+     * must have lengths multiple of the block size.
+     *
+     * The default implementations of the transfer functions fail
+     * with ENOSYS; derived classes set the geometry and implement
+     * at least do_read() and do_write().
+     */
     class BlockDevice
     {
     public:
-      BlockDevice () = default;
 
+      using blockNumber_t = std::uint32_t;
+
+      // ----------------------------------------------------------------------
+
+      BlockDevice ();
+      BlockDevice (const BlockDevice&) = delete;
+
+      virtual
+      ~BlockDevice ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * @return The number of blocks transferred, or -1 and errno.
+       */
+      ssize_t
+      read (void* buf, blockNumber_t block, std::size_t count);
+
+      ssize_t
+      write (const void* buf, blockNumber_t block, std::size_t count);
+
+      ssize_t
+      readv (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      ssize_t
+      writev (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      /**
+       * Commit the written blocks to the persistent storage.
+       */
+      int
+      flush (void);
+
+      /**
+       * Inform the device that the blocks content is no longer needed
+       * (TRIM); the content of discarded blocks is undefined.
+       */
+      int
+      discard (blockNumber_t block, std::size_t count);
+
+      /**
+       * Inform the device that the blocks will be read soon, such that
+       * it can start reading them into its cache. The range is clipped
+       * to the device size.
+       */
+      int
+      prefetch (blockNumber_t block, std::size_t count);
+
+      /**
+       * Start an asynchronous transfer; the request completes later,
+       * or even before returning.
+       *
+       * @return 0 if the request was started, or -1 and errno; the
+       * invalid requests are also completed with the error.
+       */
+      int
+      submit (BlockRequest* request);
+
+      /**
+       * Submit the request and wait for it to complete.
+       *
+       * @return Same as BlockRequest::wait().
+       */
+      ssize_t
+      execute (BlockRequest* request);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      std::size_t
+      getBlockSize (void) const;
+
+      blockNumber_t
+      getBlocksCount (void) const;
+
+      /**
+       * The preferred transfer granularity, in blocks (for example
+       * the erase block of a flash device); transfers aligned to it,
+       * and multiple of it, are the most efficient.
+       */
+      std::size_t
+      getAlignment (void) const;
+
+      /**
+       * @return The cache, if the device is accessed through one,
+       * such that file systems can pin their metadata blocks;
+       * otherwise nullptr.
+       */
+      virtual BlockCache*
+      getBlockCache (void);
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count);
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count);
+
+      // The default vectored implementations call do_read()/do_write()
+      // for each buffer.
+
+      virtual ssize_t
+      do_readv (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      virtual ssize_t
+      do_writev (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      virtual int
+      do_flush (void);
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count);
+
+      virtual int
+      do_prefetch (blockNumber_t block, std::size_t count);
+
+      /**
+       * Start the transfer and return without waiting for it; the
+       * driver calls BlockRequest::complete() when done. Return -1
+       * only if the request was not started (and not completed).
+       *
+       * The default implementation executes the request synchronously,
+       * with do_readv(), do_writev() or do_flush(). Drivers that
+       * override it can implement do_read() and do_write() with
+       * execute().
+       */
+      virtual int
+      do_submit (BlockRequest* request);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      void
+      setGeometry (std::size_t blockSize, blockNumber_t blocksCount,
+                   std::size_t alignment = 1);
+
+      /**
+       * For devices stacked on another device: move the request
+       * `offset` blocks further and pass it to the do_submit() of
+       * `device`, without validating it again.
+       */
+      int
+      forwardRequest (BlockDevice* device, BlockRequest* request,
+                      blockNumber_t offset);
+
+    private:
+
+      ssize_t
+      checkVector (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      std::size_t fBlockSize;
+      std::size_t fAlignment;
+      blockNumber_t fBlocksCount;
     };
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    BlockDevice::getBlockSize (void) const
+    {
+      return fBlockSize;
+    }
+
+    inline BlockDevice::blockNumber_t
+    BlockDevice::getBlocksCount (void) const
+    {
+      return fBlocksCount;
+    }
+
+    inline std::size_t
+    BlockDevice::getAlignment (void) const
+    {
+      return fAlignment;
+    }
+
   } /* namespace posix */
 } /* namespace os */
 
+// ----------------------------------------------------------------------------
+
 #endif /* POSIX_IO_BLOCK_DEVICE_H_ */
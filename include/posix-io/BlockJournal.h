@@ -0,0 +1,309 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_BLOCK_JOURNAL_H_
+#define POSIX_IO_BLOCK_JOURNAL_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    /**
+     * Write-ahead journal of metadata blocks, for file systems
+     * that update their metadata in place on a block device.
+     *
+     * The journal uses a region of the device: a header block
+     * followed by the log. The file system writes its metadata blocks
+     * with write(), which only keeps their new images in memory, and
+     * reads them back with read(). commit() makes the staged blocks a
+     * transaction: the images are written to the log, the header
+     * records them with their checksum, and after a flush the images
+     * are written home. A transaction interrupted before the header is
+     * on the device is ignored; one interrupted later is written home
+     * again by attach(), at the next mount, by reading the log once.
+     *
+     * Several operations are committed together: the file system
+     * brackets each operation with begin() and end(), and commits
+     * when end() says so, once every `group` changing operations.
+     * The flush that makes the log durable and the one that makes the
+     * home blocks durable before the log is reused are shared by all
+     * the operations of the group; the latter is delayed to the next
+     * commit.
+     *
+     * Blocks written directly to the device, like file data, must be
+     * announced with release(), such that older images of them are
+     * not written over the new content.
+     *
+     * There are no locks, the file system calls it with its own lock
+     * held.
+     */
+    class BlockJournal
+    {
+    public:
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+      /**
+       * @param blocks The largest transaction, in blocks.
+       * @param group The number of changing operations committed
+       * together.
+       */
+      BlockJournal (std::size_t blocks, std::size_t group = 1);
+      BlockJournal (const BlockJournal&) = delete;
+
+      ~BlockJournal ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Create an empty journal in the region [start, start+count)
+       * of the device.
+       *
+       * @return 0, or -1 and errno.
+       */
+      static int
+      format (BlockDevice* device, blockNumber_t start, blockNumber_t count);
+
+      /**
+       * Use the journal in the region; a committed transaction left
+       * by a crash is written home first.
+       *
+       * @return 0, or -1 and errno (EINVAL if there is no journal
+       * in the region).
+       */
+      int
+      attach (BlockDevice* device, blockNumber_t start, blockNumber_t count);
+
+      /**
+       * Commit the staged blocks and leave the journal empty.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      detach (void);
+
+      bool
+      isAttached (void) const;
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Stage the new content of blocks; when the transaction is full,
+       * the staged blocks are committed first.
+       *
+       * @return The number of blocks, or -1 and errno.
+       */
+      ssize_t
+      write (const void* buf, blockNumber_t block, std::size_t count);
+
+      /**
+       * Read blocks from the device, with their staged content.
+       *
+       * @return The number of blocks, or -1 and errno.
+       */
+      ssize_t
+      read (void* buf, blockNumber_t block, std::size_t count);
+
+      /**
+       * The blocks are about to be written directly to the device:
+       * their staged images are dropped, and if the last transaction
+       * has them, the log is emptied.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      release (blockNumber_t block, std::size_t count);
+
+      /**
+       * Write the staged blocks as one transaction.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      commit (void);
+
+      /**
+       * Start an operation of the file system.
+       */
+      void
+      begin (void);
+
+      /**
+       * End an operation of the file system.
+       *
+       * @return true if the file system should commit now: the
+       * group is complete, or more than half of the room is used.
+       */
+      bool
+      end (void);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * The largest transaction, in blocks, as limited by the region.
+       */
+      std::size_t
+      getCapacity (void) const;
+
+      /**
+       * The number of staged blocks.
+       */
+      std::size_t
+      getStaged (void) const;
+
+      std::size_t
+      getCommits (void) const;
+
+      /**
+       * The number of device flushes requested by the journal.
+       */
+      std::size_t
+      getFlushes (void) const;
+
+      /**
+       * The number of blocks written home by the last attach().
+       */
+      std::size_t
+      getReplayed (void) const;
+
+      // ----------------------------------------------------------------------
+
+    private:
+
+      /**
+       * Write the header; `count` 0 means empty.
+       */
+      int
+      writeHeader (std::size_t count, std::uint32_t crc);
+
+      /**
+       * Flush the home blocks of the last transaction, if not yet
+       * done.
+       */
+      int
+      checkpoint (void);
+
+      int
+      flush (void);
+
+      std::size_t
+      find (blockNumber_t block) const;
+
+      BlockDevice* fDevice;
+      blockNumber_t fStart;
+      blockNumber_t fCount;
+      std::size_t fBlockSize;
+
+      std::size_t fBlocks;
+      std::size_t fGroup;
+      std::size_t fCapacity;
+
+      // The staged blocks, with their images.
+      blockNumber_t* fStagedBlocks;
+      std::uint8_t* fImages;
+      std::size_t fStaged;
+
+      // The blocks of the last transaction, still in the log.
+      blockNumber_t* fLoggedBlocks;
+      std::size_t fLogged;
+      // The home blocks of the last transaction are not flushed.
+      bool fUnflushed;
+
+      // The header block.
+      std::uint8_t* fHeader;
+      std::uint32_t fSequence;
+
+      std::size_t fOperations;
+      std::size_t fWritesAtBegin;
+      std::size_t fWrites;
+
+      std::size_t fCommits;
+      std::size_t fFlushes;
+      std::size_t fReplayed;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline bool
+    BlockJournal::isAttached (void) const
+    {
+      return fDevice != nullptr;
+    }
+
+    inline std::size_t
+    BlockJournal::getCapacity (void) const
+    {
+      return fCapacity;
+    }
+
+    inline std::size_t
+    BlockJournal::getStaged (void) const
+    {
+      return fStaged;
+    }
+
+    inline std::size_t
+    BlockJournal::getCommits (void) const
+    {
+      return fCommits;
+    }
+
+    inline std::size_t
+    BlockJournal::getFlushes (void) const
+    {
+      return fFlushes;
+    }
+
+    inline std::size_t
+    BlockJournal::getReplayed (void) const
+    {
+      return fReplayed;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_BLOCK_JOURNAL_H_ */
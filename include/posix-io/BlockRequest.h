@@ -0,0 +1,234 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_BLOCK_REQUEST_H_
+#define POSIX_IO_BLOCK_REQUEST_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+#include "posix/sys/uio.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * An asynchronous block device transfer, submitted with
+     * BlockDevice::submit().
+     *
+     * The request object and the buffers must remain valid until the
+     * request completes. Completion is reported by an optional
+     * callback, called from the driver context (possibly an interrupt
+     * handler), and can be polled with isDone() or waited for with
+     * wait().
+     */
+    class BlockRequest
+    {
+    public:
+
+      using operation_t = unsigned int;
+      enum Operation
+        : operation_t
+          { READ = 0,
+        WRITE = 1,
+        FLUSH = 2
+      };
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+      /**
+       * Called when the request completes, before isDone() becomes
+       * true; it must not reuse the request if some thread waits
+       * for it.
+       */
+      using callback_t = void (*) (BlockRequest* request, void* arg);
+
+      // ----------------------------------------------------------------------
+
+      BlockRequest ();
+      BlockRequest (const BlockRequest&) = delete;
+
+      ~BlockRequest ();
+
+      // ----------------------------------------------------------------------
+
+      void
+      prepareRead (void* buf, blockNumber_t block, std::size_t count);
+
+      void
+      prepareReadv (const struct iovec* iov, int iovcnt, blockNumber_t block);
+
+      void
+      prepareWrite (const void* buf, blockNumber_t block, std::size_t count);
+
+      void
+      prepareWritev (const struct iovec* iov, int iovcnt,
+                     blockNumber_t block);
+
+      void
+      prepareFlush (void);
+
+      void
+      setCallback (callback_t callback, void* arg);
+
+      bool
+      isDone (void) const;
+
+      /**
+       * Wait for the request to complete, yielding the CPU with
+       * schedulerYield().
+       *
+       * @return The number of blocks transferred (0 for FLUSH), or
+       * -1 and errno.
+       */
+      ssize_t
+      wait (void);
+
+      // ----------------------------------------------------------------------
+      // For drivers.
+
+      /**
+       * Store the result, call the callback and mark the request done.
+       *
+       * @param error The errno value if `result` is -1.
+       */
+      void
+      complete (ssize_t result, int error = 0);
+
+      Operation
+      getOperation (void) const;
+
+      const struct iovec*
+      getIov (void) const;
+
+      int
+      getIovcnt (void) const;
+
+      blockNumber_t
+      getBlock (void) const;
+
+      /**
+       * The total number of blocks, set by BlockDevice::submit().
+       */
+      std::size_t
+      getCount (void) const;
+
+      ssize_t
+      getResult (void) const;
+
+      int
+      getError (void) const;
+
+    private:
+
+      friend class BlockDevice;
+
+      void
+      prepare (Operation operation, const struct iovec* iov, int iovcnt,
+               blockNumber_t block);
+
+      // Used by the single buffer variants.
+      struct iovec fIov;
+
+      const struct iovec* fIovPtr;
+      int fIovcnt;
+      blockNumber_t fBlock;
+      std::size_t fCount;
+
+      callback_t fCallback;
+      void* fArg;
+
+      ssize_t fResult;
+      int fError;
+      Operation fOperation;
+      std::atomic<bool> fDone;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline bool
+    BlockRequest::isDone (void) const
+    {
+      return fDone.load (std::memory_order_acquire);
+    }
+
+    inline BlockRequest::Operation
+    BlockRequest::getOperation (void) const
+    {
+      return fOperation;
+    }
+
+    inline const struct iovec*
+    BlockRequest::getIov (void) const
+    {
+      return fIovPtr;
+    }
+
+    inline int
+    BlockRequest::getIovcnt (void) const
+    {
+      return fIovcnt;
+    }
+
+    inline BlockRequest::blockNumber_t
+    BlockRequest::getBlock (void) const
+    {
+      return fBlock;
+    }
+
+    inline std::size_t
+    BlockRequest::getCount (void) const
+    {
+      return fCount;
+    }
+
+    inline ssize_t
+    BlockRequest::getResult (void) const
+    {
+      return fResult;
+    }
+
+    inline int
+    BlockRequest::getError (void) const
+    {
+      return fError;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_BLOCK_REQUEST_H_ */
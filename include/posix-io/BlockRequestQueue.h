@@ -0,0 +1,281 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_BLOCK_REQUEST_QUEUE_H_
+#define POSIX_IO_BLOCK_REQUEST_QUEUE_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+#if !defined(OS_INTEGER_BLOCK_QUEUE_RUN_MAX)
+#define OS_INTEGER_BLOCK_QUEUE_RUN_MAX  (16)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Queue of block writes in front of another block device, shared
+     * by all threads writing to it.
+     *
+     * While the queue is plugged, writes are copied to the queue,
+     * kept sorted by block number; a block written again while
+     * queued is overwritten in place. When the last plug is removed,
+     * or the queue is full, the writes are dispatched in elevator
+     * order (ascending block numbers, starting after the last block
+     * dispatched and wrapping around), with consecutive blocks
+     * merged into a single vectored request.
+     *
+     * Reads are not queued; queued writes overlapping a read are
+     * dispatched first. Without plugs, writes go directly to the
+     * device.
+     *
+     * All device accesses are serialised by a lock.
+     */
+    class BlockRequestQueue : public BlockDevice
+    {
+    public:
+
+      /**
+       * The geometry of `device` must be already known.
+       *
+       * @param capacity The number of blocks the queue can hold.
+       */
+      BlockRequestQueue (BlockDevice* device, std::size_t capacity);
+      BlockRequestQueue (const BlockRequestQueue&) = delete;
+
+      virtual
+      ~BlockRequestQueue ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Hold the writes in the queue, for example during a burst of
+       * small writes. Calls can be nested, also from different
+       * threads.
+       */
+      void
+      plug (void);
+
+      /**
+       * Remove a plug; the last one dispatches the queued writes.
+       */
+      int
+      unplug (void);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      BlockDevice*
+      getDevice (void) const;
+
+      std::size_t
+      getCapacity (void) const;
+
+      /**
+       * The number of blocks currently queued.
+       */
+      std::size_t
+      getDepth (void) const;
+
+      std::size_t
+      getMaxDepth (void) const;
+
+      /**
+       * The number of blocks written into the queue.
+       */
+      std::size_t
+      getQueuedBlocks (void) const;
+
+      /**
+       * The number of queued blocks overwritten before dispatch.
+       */
+      std::size_t
+      getAbsorbedBlocks (void) const;
+
+      /**
+       * The number of blocks dispatched together with the previous
+       * block, in the same request.
+       */
+      std::size_t
+      getMergedBlocks (void) const;
+
+      /**
+       * The number of write requests sent to the device.
+       */
+      std::size_t
+      getDispatches (void) const;
+
+      void
+      resetStatistics (void);
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count)
+          override;
+
+      virtual int
+      do_flush (void) override;
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count) override;
+
+      virtual int
+      do_prefetch (blockNumber_t block, std::size_t count) override;
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Request
+      {
+        std::uint8_t* data;
+        blockNumber_t block;
+      };
+
+#pragma GCC diagnostic pop
+
+      int
+      dispatch (void);
+
+      std::size_t
+      lowerBound (blockNumber_t block) const;
+
+      bool
+      overlaps (blockNumber_t block, std::size_t count) const;
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+    private:
+
+      BlockDevice* fDevice;
+
+      std::size_t fCapacity;
+      std::size_t fRunMax;
+
+      std::uint8_t* fStorage;
+
+      // Sorted by block number.
+      Request* fRequestsArray;
+      std::size_t fRequestsCount;
+
+      std::uint8_t** fFreeBuffersArray;
+      std::size_t fFreeBuffersCount;
+
+      struct iovec* fIovArray;
+
+      // The block after the last one dispatched.
+      blockNumber_t fHead;
+
+      std::size_t fPlugs;
+      std::atomic_flag fLock;
+
+      std::size_t fMaxDepth;
+      std::size_t fQueuedBlocks;
+      std::size_t fAbsorbedBlocks;
+      std::size_t fMergedBlocks;
+      std::size_t fDispatches;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline BlockDevice*
+    BlockRequestQueue::getDevice (void) const
+    {
+      return fDevice;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getCapacity (void) const
+    {
+      return fCapacity;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getDepth (void) const
+    {
+      return fRequestsCount;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getMaxDepth (void) const
+    {
+      return fMaxDepth;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getQueuedBlocks (void) const
+    {
+      return fQueuedBlocks;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getAbsorbedBlocks (void) const
+    {
+      return fAbsorbedBlocks;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getMergedBlocks (void) const
+    {
+      return fMergedBlocks;
+    }
+
+    inline std::size_t
+    BlockRequestQueue::getDispatches (void) const
+    {
+      return fDispatches;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_BLOCK_REQUEST_QUEUE_H_ */
@@ -74,6 +74,18 @@ namespace os
       virtual bool
       matchName (const char* name) const;
 
+      /**
+       * Devices that override matchName() to accept more than the
+       * exact getName() (like a pattern) should also override this
+       * to return true; they are not hashed by the CharDevicesRegistry
+       * and are matched sequentially, after the exact names. Devices
+       * that do not are still matched by matchName(), but only after
+       * all the exact names and the patterns were tried, so an exact
+       * name of another device takes precedence over their aliases.
+       */
+      virtual bool
+      hasNamePattern (void) const;
+
       const char*
       getName (void) const;
 
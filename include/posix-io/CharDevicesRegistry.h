@@ -31,6 +31,7 @@
 // ----------------------------------------------------------------------------
 
 #include <cstddef>
+#include <cstdint>
 #include <cassert>
 
 // ----------------------------------------------------------------------------
@@ -78,6 +79,18 @@ namespace os
       static std::size_t sfSize;
 
       static CharDevice** sfRegistryArray;
+
+      // Index of the exact device names, kept alongside the registry
+      // array: the hash of each name and the bucket chains, as indices
+      // in the registry array.
+      static std::uint32_t* sfHashesArray;
+      static std::size_t* sfNextArray;
+      static std::size_t* sfBucketsArray;
+      static std::size_t sfBucketsMask;
+
+      // Devices with name patterns, matched sequentially.
+      static CharDevice** sfPatternsArray;
+      static std::size_t sfPatternsCount;
     };
 
     // ------------------------------------------------------------------------
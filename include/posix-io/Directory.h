@@ -30,7 +30,9 @@
 
 // ----------------------------------------------------------------------------
 
+#include "posix-io/IO.h"
 #include "posix-io/FileSystem.h"
+#include "posix-io/path.h"
 
 #include "posix/dirent.h"
 
@@ -49,15 +51,37 @@ namespace os
     Directory*
     opendir (const char* dirname);
 
+    /**
+     * Identify the directory of the *at() functions.
+     *
+     * If `path` can be resolved relative to the directory referred
+     * by `fildes`, return `path` and the directory in `*dir`. Otherwise
+     * (absolute path, AT_FDCWD, `..` components, file systems mounted
+     * below the directory) return in `*dir` nullptr and the path to
+     * be processed by the regular functions, possibly built in `buf`.
+     *
+     * @return the path, or nullptr and errno.
+     */
+    const char*
+    resolveAtPath (int fildes, const char* path, Directory** dir, char* buf,
+                   std::size_t size);
+
     // ------------------------------------------------------------------------
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpadded"
 
-    class Directory
+    class Directory : public IO
     {
       friend class FileSystem;
 
+      friend Directory*
+      opendir (const char* dirname);
+
+      friend const char*
+      resolveAtPath (int fildes, const char* path, Directory** dir,
+                     char* buf, std::size_t size);
+
     public:
 
       Directory (void);
@@ -71,12 +95,40 @@ namespace os
       struct dirent *
       read (void);
 
+      /**
+       * Read the next entry and its status, as stat() would return it,
+       * without looking up the name again when the file system has
+       * the status at hand.
+       *
+       * @return the entry, or nullptr at the end (errno 0) or on error.
+       */
+      struct dirent *
+      read_plus (struct stat* buf);
+
+      /**
+       * Read as many of the next entries as fit in `buf`, packed as
+       * posix_getdents() returns them.
+       *
+       * @return the number of bytes used, 0 at the end, or -1 and
+       * errno (EINVAL if the next entry does not fit).
+       */
+      ssize_t
+      read_batch (void* buf, std::size_t size);
+
       void
       rewind (void);
 
       int
       close (void);
 
+      /**
+       * Get a file descriptor referring to this directory, for the
+       * *at() functions; allocated at the first call and freed by
+       * close().
+       */
+      int
+      dirfd (void);
+
       // ----------------------------------------------------------------------
       // Support functions.
 
@@ -89,6 +141,26 @@ namespace os
       FileSystem*
       getFileSystem (void) const;
 
+      /**
+       * File system specific node handle, or nullptr; see File::getNode().
+       */
+      void*
+      getNode (void) const;
+
+      /**
+       * The normalized absolute path, without the trailing `/`
+       * (except for the root), or an empty string if too long.
+       */
+      const char*
+      getPath (void) const;
+
+      /**
+       * The path relative to the file system (mount point prefix
+       * removed), as passed to do_vopen(), without the trailing `/`.
+       */
+      const char*
+      getAdjustedPath (void) const;
+
     protected:
 
       // ----------------------------------------------------------------------
@@ -103,11 +175,31 @@ namespace os
       virtual struct dirent*
       do_read (void);
 
+      /**
+       * By default, do_read() and the status of the name, relative to
+       * this directory.
+       */
+      virtual struct dirent*
+      do_read_plus (struct stat* buf);
+
+      /**
+       * By default, do_read() while there is room for an entry with
+       * the longest name, of an unknown type.
+       */
+      virtual ssize_t
+      do_read_batch (void* buf, std::size_t size);
+
       virtual void
       do_rewind (void);
 
       virtual int
-      do_close (void);
+      do_close (void) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_release (void) override;
 
       // ----------------------------------------------------------------------
       // Support functions.
@@ -115,10 +207,37 @@ namespace os
       void
       setFileSystem (FileSystem* fileSystem);
 
+      void
+      setNode (void* node);
+
+      void
+      setPath (const char* path, const char* adjustedPath);
+
+      bool
+      hasMountsBelow (void);
+
+      /**
+       * Append an entry to a read_batch() buffer.
+       *
+       * @return the length of the record, or 0 if it does not fit.
+       */
+      static std::size_t
+      packEntry (void* buf, std::size_t size, ino_t ino, unsigned char type,
+                 const char* name);
+
     private:
 
       FileSystem* fFileSystem;
+      void* fNode;
       struct dirent fDirEntry;
+
+      // Cached MountManager::hasMountsBelow(), valid while the
+      // mount table generation does not change.
+      unsigned int fMountsGeneration;
+      bool fMountsBelow;
+
+      std::size_t fAdjustedOffset;
+      char fPath[OS_INTEGER_PATH_MAX];
     };
 
 #pragma GCC diagnostic pop
@@ -137,6 +256,30 @@ namespace os
       return fFileSystem;
     }
 
+    inline void
+    Directory::setNode (void* node)
+    {
+      fNode = node;
+    }
+
+    inline void*
+    Directory::getNode (void) const
+    {
+      return fNode;
+    }
+
+    inline const char*
+    Directory::getPath (void) const
+    {
+      return fPath;
+    }
+
+    inline const char*
+    Directory::getAdjustedPath (void) const
+    {
+      return &fPath[fAdjustedOffset];
+    }
+
     inline struct dirent*
     Directory::getDirEntry (void)
     {
@@ -0,0 +1,275 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_DIRECTORY_INDEX_H_
+#define POSIX_IO_DIRECTORY_INDEX_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Bounded hash index of the names of large directories, for file
+     * systems that otherwise search their directories linearly.
+     *
+     * A directory, identified by a file system specific key (for
+     * example its first cluster), is indexed as a whole: the file
+     * system adds all its names after begin(), with the hash of the
+     * name (normalised as the file system compares names) and a
+     * value locating the entry, then calls commit(). The names
+     * are not stored, the file system checks each entry returned by
+     * lookup(); a complete index also answers that a name is not there.
+     *
+     * The file system keeps an indexed directory up to date with
+     * insert() and remove(), and calls drop() when it changes it by
+     * other means. When the entries are exhausted, the least recently
+     * used directories are dropped; a directory larger than the index
+     * is not indexed.
+     *
+     * There are no locks, the file system calls it with its own lock
+     * held; an index must not be shared by several file systems.
+     */
+    class DirectoryIndex
+    {
+    public:
+
+      /**
+       * @param entries The number of names.
+       * @param directories The number of directories.
+       */
+      DirectoryIndex (std::size_t entries, std::size_t directories = 8);
+      DirectoryIndex (const DirectoryIndex&) = delete;
+
+      ~DirectoryIndex ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Start indexing the directory `dir`, replacing the previous
+       * index, if any.
+       */
+      void
+      begin (std::uint32_t dir);
+
+      /**
+       * Add a name to the directory being indexed.
+       *
+       * @return false if the index is full; the directory is dropped.
+       */
+      bool
+      add (std::uint32_t dir, std::uint32_t hash, std::uint32_t value);
+
+      /**
+       * End indexing the directory.
+       *
+       * @param hint A value kept with the directory, for the file
+       * system (for example where to look for free entries).
+       */
+      void
+      commit (std::uint32_t dir, std::uint32_t hint = 0);
+
+      /**
+       * @return true if the directory is completely indexed.
+       */
+      bool
+      isIndexed (std::uint32_t dir);
+
+      /**
+       * Iterate the values of the names with the given hash, in an
+       * indexed directory; `*cursor` must be 0 for the first call.
+       *
+       * @return false when there are no more values.
+       */
+      bool
+      lookup (std::uint32_t dir, std::uint32_t hash, std::size_t* cursor,
+              std::uint32_t* value);
+
+      /**
+       * Add a name to an indexed directory; if the index is full,
+       * the directory is dropped. Ignored if the directory is not
+       * indexed.
+       */
+      void
+      insert (std::uint32_t dir, std::uint32_t hash, std::uint32_t value);
+
+      /**
+       * Remove a name of an indexed directory, if present.
+       */
+      void
+      remove (std::uint32_t dir, std::uint32_t hash, std::uint32_t value);
+
+      /**
+       * Forget the directory.
+       */
+      void
+      drop (std::uint32_t dir);
+
+      void
+      clear (void);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * @return The hint of an indexed directory, 0 if not indexed.
+       */
+      std::uint32_t
+      getHint (std::uint32_t dir) const;
+
+      void
+      setHint (std::uint32_t dir, std::uint32_t hint);
+
+      std::size_t
+      getSize (void) const;
+
+      /**
+       * The number of names in the index.
+       */
+      std::size_t
+      getUsed (void) const;
+
+      /**
+       * The number of lookups and of the values they returned.
+       */
+      std::size_t
+      getLookups (void) const;
+
+      std::size_t
+      getCandidates (void) const;
+
+      // ----------------------------------------------------------------------
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Entry
+      {
+        std::uint32_t hash;
+        std::uint32_t value;
+        // The directory slot.
+        std::uint32_t slot;
+        // Links in the hash bucket chain and in the directory list;
+        // the free entries are linked by `nextInBucket`.
+        std::uint32_t nextInBucket;
+        std::uint32_t nextInDir;
+        std::uint32_t prevInDir;
+      };
+
+      struct Slot
+      {
+        std::uint32_t key;
+        std::uint32_t hint;
+        std::uint32_t first;
+        std::uint32_t count;
+        std::uint32_t stamp;
+        // 0 free, 1 being indexed, 2 indexed.
+        std::uint8_t state;
+      };
+
+#pragma GCC diagnostic pop
+
+      std::size_t
+      findSlot (std::uint32_t dir) const;
+
+      std::uint32_t
+      bucketOf (std::uint32_t hash, std::size_t slot) const;
+
+      /**
+       * @return A free entry, possibly by dropping the least recently
+       * used directories other than `slot`, or noEntry.
+       */
+      std::uint32_t
+      allocate (std::size_t slot);
+
+      void
+      link (std::size_t slot, std::uint32_t hash, std::uint32_t value,
+            std::uint32_t index);
+
+      void
+      unlink (std::uint32_t index);
+
+      void
+      release (std::size_t slot);
+
+      Entry* fEntries;
+      std::size_t fSize;
+      std::uint32_t* fBuckets;
+      std::uint32_t fBucketsMask;
+      std::uint32_t fFree;
+      std::size_t fUsed;
+
+      Slot* fSlots;
+      std::size_t fSlotsCount;
+      std::uint32_t fStamp;
+
+      std::size_t fLookups;
+      std::size_t fCandidates;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    DirectoryIndex::getSize (void) const
+    {
+      return fSize;
+    }
+
+    inline std::size_t
+    DirectoryIndex::getUsed (void) const
+    {
+      return fUsed;
+    }
+
+    inline std::size_t
+    DirectoryIndex::getLookups (void) const
+    {
+      return fLookups;
+    }
+
+    inline std::size_t
+    DirectoryIndex::getCandidates (void) const
+    {
+      return fCandidates;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_DIRECTORY_INDEX_H_ */
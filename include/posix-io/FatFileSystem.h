@@ -0,0 +1,973 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_FAT_FILE_SYSTEM_H_
+#define POSIX_IO_FAT_FILE_SYSTEM_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/BlockDevice.h"
+#include "posix-io/BlockJournal.h"
+#include "posix-io/DirectoryIndex.h"
+#include "posix-io/NodeCache.h"
+#include "posix-io/PageCache.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+// The number of FAT sectors kept in memory.
+#if !defined(OS_INTEGER_FAT_WINDOW_SECTORS)
+#define OS_INTEGER_FAT_WINDOW_SECTORS  (4)
+#endif
+
+// The number of runs of consecutive clusters remembered by an open file.
+#if !defined(OS_INTEGER_FAT_FILE_RUNS)
+#define OS_INTEGER_FAT_FILE_RUNS  (8)
+#endif
+
+// The longest name returned by readdir(), in UTF-8 bytes; longer
+// names are returned as their short (8.3) alias.
+#if !defined(OS_INTEGER_FAT_NAME_MAX)
+#define OS_INTEGER_FAT_NAME_MAX  (255)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class FatFile;
+    class FatDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * FAT12, FAT16 and FAT32 file system, with long (VFAT) names
+     * stored as UTF-16 and presented as UTF-8.
+     *
+     * A window of OS_INTEGER_FAT_WINDOW_SECTORS consecutive FAT
+     * sectors is kept in memory, and written to all FAT copies when
+     * it moves or at sync. The free clusters are tracked in a bitmap
+     * built at mount, one bit per cluster, such that allocations do
+     * not read the FAT; clusters are allocated after the previous
+     * one of the file when possible, to keep files contiguous.
+     *
+     * Each open file remembers its clusters as a map of runs of
+     * consecutive clusters, plus the last position, so seeking
+     * does not walk the chain from the start again.
+     *
+     * fallocate() extends the chain of a file in one go; the clusters
+     * reserved with FALLOC_FL_KEEP_SIZE are freed at close, as the
+     * directory entry has no room to record them.
+     *
+     * Directories are searched linearly, unless a DirectoryIndex is
+     * given; then a directory is indexed when first searched, and
+     * the following lookups, creations and removals in it only read
+     * the entries with the same name hash.
+     *
+     * With a NodeCache, the directory entries looked up or created
+     * recently are kept in memory, such that stat(), open() and the
+     * path walks through recently used directories do not search the
+     * directories again; open files keep their node referenced, and
+     * fstat() does not read the device.
+     *
+     * If formatted with a journal and mounted with a BlockJournal,
+     * the FAT and directory sectors are written through the journal,
+     * and an interrupted update is completed at the next mount, so the
+     * volume never needs a check; file data is written directly.
+     * The changes of `group` operations are committed together, at
+     * sync() and fsync(), or when an operation does not fit; the
+     * clusters freed since the last commit are not reused before the
+     * next one.
+     *
+     * If a PageCache is constructed, with pages of a multiple of the
+     * sector size and no larger than a cluster, the file data is
+     * read and written through it, such that all opens of a file
+     * share the pages read; written pages are written back at fsync(),
+     * close(), sync(), before a journal commit, or when half of the
+     * pages are dirty.
+     *
+     * A file can be opened more than once, also for writing; the
+     * opens share the size and the cluster chain, and the data through
+     * the pages or the device, such that the writes through one are
+     * read through the others without fsync(). Open files cannot be
+     * removed, renamed or truncated by path, and open directories
+     * cannot be removed (EBUSY).
+     *
+     * The file system is thread safe, all operations are serialised
+     * by a lock.
+     */
+    class FatFileSystem : public FileSystem
+    {
+      friend class FatFile;
+      friend class FatDirectory;
+
+    public:
+
+      using type_t = unsigned int;
+      enum Type
+        : type_t
+          { NONE = 0,
+        FAT12 = 12,
+        FAT16 = 16,
+        FAT32 = 32
+      };
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * @param filesPool A pool of FatFile objects.
+       * @param dirsPool A pool of FatDirectory objects.
+       * @param index An optional index of the names of large
+       * directories, for this file system only.
+       * @param journal An optional journal, used if the volume has
+       * one; for this file system only.
+       * @param nodes An optional cache of the recently used directory
+       * entries, for this file system only.
+       */
+      FatFileSystem (Pool* filesPool, Pool* dirsPool,
+                     DirectoryIndex* index = nullptr,
+                     BlockJournal* journal = nullptr,
+                     NodeCache* nodes = nullptr);
+      FatFileSystem (const FatFileSystem&) = delete;
+
+      virtual
+      ~FatFileSystem ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Create an empty file system on the entire device. The FAT type
+       * follows from the device size (FAT12 up to 4 MiB, FAT16 up to
+       * 512 MiB, FAT32 above) and from the number of clusters.
+       *
+       * @param sectorsPerCluster A power of 2, or 0 to choose the
+       * smallest one suitable for the type.
+       * @param journalSectors The largest transaction of a metadata
+       * journal, kept in the reserved sectors, or 0 for none.
+       * @return 0, or -1 and errno.
+       */
+      static int
+      format (BlockDevice* device, std::size_t sectorsPerCluster = 0,
+              std::size_t journalSectors = 0);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      Type
+      getType (void) const;
+
+      std::size_t
+      getClusterSize (void) const;
+
+      std::uint32_t
+      getClustersCount (void) const;
+
+      std::uint32_t
+      getFreeClusters (void) const;
+
+      /**
+       * The number of FAT entries read, to follow cluster chains or
+       * to allocate clusters.
+       */
+      std::size_t
+      getFatLookups (void) const;
+
+      /**
+       * The number of times the FAT window was loaded.
+       */
+      std::size_t
+      getFatLoads (void) const;
+
+      DirectoryIndex*
+      getDirectoryIndex (void) const;
+
+      BlockJournal*
+      getJournal (void) const;
+
+      NodeCache*
+      getNodeCache (void) const;
+
+      /**
+       * @return true if the mounted volume uses the journal.
+       */
+      bool
+      isJournaled (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual void
+      do_sync (void) override;
+
+      virtual int
+      do_statat (Directory* dir, const char* path, struct stat* buf)
+          override;
+
+      virtual int
+      do_mkdirat (Directory* dir, const char* path, mode_t mode) override;
+
+      virtual int
+      do_unlinkat (Directory* dir, const char* path, int flag) override;
+
+      virtual int
+      do_renameat (Directory* olddir, const char* existing, Directory* newdir,
+                   const char* _new) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+      virtual int
+      do_unmount (unsigned int flags) override;
+
+    private:
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      // A position in a directory, with the cluster holding it.
+      struct Position
+      {
+        std::uint32_t dir;
+        std::uint32_t index;
+        std::uint32_t cluster;
+        std::uint32_t clusterIndex;
+      };
+
+      // A directory entry found by a search.
+      struct Entry
+      {
+        // Where the short entry is, on the device.
+        blockNumber_t sector;
+        std::size_t offset;
+        // The indices of the first (long name) and of the short
+        // entries in the directory.
+        std::uint32_t first;
+        std::uint32_t index;
+        std::uint8_t raw[32];
+        // The long name if it fits, otherwise the short one.
+        char name[OS_INTEGER_FAT_NAME_MAX + 1];
+        char shortName[13];
+      };
+
+#pragma GCC diagnostic pop
+
+      // ----------------------------------------------------------------------
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+      // Sectors.
+
+      blockNumber_t
+      clusterSector (std::uint32_t cluster) const;
+
+      std::uint8_t*
+      loadSector (blockNumber_t sector);
+
+      /**
+       * Take the buffer for a sector that will be entirely written,
+       * without reading it.
+       */
+      std::uint8_t*
+      claimSector (blockNumber_t sector);
+
+      int
+      flushSector (void);
+
+      /**
+       * Read sectors, as changed by the journal if any.
+       */
+      ssize_t
+      readSectors (void* buf, blockNumber_t sector, std::size_t count);
+
+      /**
+       * Write metadata sectors, through the journal if any.
+       */
+      ssize_t
+      writeSectors (const void* buf, blockNumber_t sector, std::size_t count);
+
+      /**
+       * Transfer whole sectors between the device and `buf`, keeping
+       * the sector buffer coherent; a null `src` writes zeros.
+       */
+      int
+      transferSectors (blockNumber_t sector, std::size_t count,
+                       const void* src, void* dst);
+
+      // FAT.
+
+      std::uint8_t*
+      fatByte (std::size_t offset);
+
+      int
+      flushWindow (void);
+
+      /**
+       * Get the FAT entry of `cluster`: the next cluster, an end of
+       * chain value (isEnd()), or 0 for free clusters.
+       */
+      int
+      getFat (std::uint32_t cluster, std::uint32_t* value);
+
+      int
+      setFat (std::uint32_t cluster, std::uint32_t value);
+
+      bool
+      isEnd (std::uint32_t value) const;
+
+      bool
+      isValid (std::uint32_t cluster) const;
+
+      std::uint32_t
+      endOfChain (void) const;
+
+      bool
+      isFree (std::uint32_t cluster) const;
+
+      void
+      markCluster (std::uint32_t cluster, bool used);
+
+      /**
+       * Search the bitmap for a free cluster, from the hint.
+       *
+       * @return The cluster, or 0.
+       */
+      std::uint32_t
+      findFree (void) const;
+
+      /**
+       * Allocate a cluster, after `previous` if possible, and link it.
+       *
+       * @return The cluster, or 0 and errno (ENOSPC).
+       */
+      std::uint32_t
+      allocateCluster (std::uint32_t previous);
+
+      int
+      freeChain (std::uint32_t cluster);
+
+      int
+      syncFsInfo (void);
+
+      /**
+       * Write the changed entries of the open files to the buffer.
+       */
+      int
+      syncEntries (void);
+
+      /**
+       * Write back the cached pages of the open files.
+       */
+      int
+      writePages (void);
+
+      int
+      flushAll (void);
+
+      /**
+       * Write the cached sectors to the journal and commit them;
+       * then the clusters freed before can be reused.
+       */
+      int
+      commitJournal (void);
+
+      // Directories.
+
+      std::uint32_t
+      rootDir (void) const;
+
+      /**
+       * The entry at `pos`, in the sector buffer.
+       *
+       * @return The entry, or nullptr and errno (ENOENT past the end,
+       * ENOSPC if the directory cannot grow).
+       */
+      std::uint8_t*
+      entryAt (Position* pos, bool extend);
+
+      /**
+       * The next used entry, with its name assembled.
+       *
+       * @return 1, 0 at the end, or -1 and errno.
+       */
+      int
+      nextEntry (Position* pos, Entry* entry);
+
+      /**
+       * Find a name in a directory, in the node cache if any.
+       */
+      int
+      findEntry (std::uint32_t dir, const char* name, std::size_t len,
+                 Entry* entry);
+
+      int
+      searchEntry (std::uint32_t dir, const char* name, std::size_t len,
+                   Entry* entry);
+
+      void
+      cacheNode (std::uint32_t dir, const Entry* entry);
+
+      /**
+       * Copy the entry changed in the sector buffer to its node,
+       * if cached.
+       */
+      void
+      updateNode (blockNumber_t sector, std::size_t offset);
+
+      /**
+       * Walk all but the last component of `path`, from the root.
+       * `*len` is 0 if `path` is the root.
+       */
+      int
+      resolve (const char* path, std::uint32_t* dir, const char** name,
+               std::size_t* len);
+
+      /**
+       * Like above, from the `start` directory, skipping the `.`
+       * components; `*len` is 0 if `path` is `start` itself.
+       */
+      int
+      resolve (std::uint32_t start, const char* path, std::uint32_t* dir,
+               const char** name, std::size_t* len);
+
+      /**
+       * Find the entry referred by `path`; for the root, `entry->sector`
+       * is 0 and `entry->raw` is an empty directory entry.
+       */
+      int
+      findPath (const char* path, Entry* entry);
+
+      int
+      findPath (std::uint32_t start, const char* path, Entry* entry);
+
+      /**
+       * Find the entry of a directory other than the root, in its
+       * parent.
+       */
+      int
+      findDirectory (std::uint32_t dir, Entry* entry);
+
+      /**
+       * Create the entries for `name`, using `proto` for everything
+       * but the name.
+       */
+      int
+      createEntry (std::uint32_t dir, const char* name, std::size_t len,
+                   const std::uint8_t* proto, Entry* entry);
+
+      int
+      deleteEntry (std::uint32_t dir, const Entry* entry);
+
+      /**
+       * Add the names of the entry to the directory being indexed.
+       *
+       * @return false if the index is full.
+       */
+      bool
+      indexEntry (std::uint32_t dir, const Entry* entry);
+
+      /**
+       * @return 1 if used, 0 if not, or -1 and errno.
+       */
+      int
+      shortNameExists (std::uint32_t dir, const std::uint8_t* shortName);
+
+      int
+      isEmpty (std::uint32_t dir);
+
+      std::uint32_t
+      parentOf (std::uint32_t dir);
+
+      std::uint32_t
+      firstCluster (const std::uint8_t* raw) const;
+
+      /**
+       * The directory referred by a directory entry, with 0 (as in
+       * `..`) meaning the root.
+       */
+      std::uint32_t
+      dirOf (const std::uint8_t* raw) const;
+
+      ino_t
+      inodeOf (const Entry* entry) const;
+
+      ino_t
+      inodeAt (blockNumber_t sector, std::size_t offset) const;
+
+      /**
+       * Whether the file data goes through the PageCache.
+       */
+      bool
+      cachesPages (void) const;
+
+      void
+      setFirstCluster (std::uint8_t* raw, std::uint32_t cluster) const;
+
+      void
+      fillStat (const Entry* entry, struct stat* buf) const;
+
+      /**
+       * Whether a file is open on the entry, and if so, if for
+       * writing.
+       */
+      bool
+      isOpen (const Entry* entry, const FatFile* except, bool* writing);
+
+      /**
+       * @return A file open on the entry, other than `except`, or
+       * nullptr.
+       */
+      FatFile*
+      findOpen (const Entry* entry, const FatFile* except);
+
+      bool
+      isDirectoryOpen (std::uint32_t dir);
+
+      /**
+       * The directory cluster of a directory opened on this file
+       * system; it cannot be removed while open.
+       */
+      std::uint32_t
+      startOf (Directory* dir) const;
+
+      // The implementations of the path functions, relative to the
+      // `start` directory, with the lock taken.
+
+      int
+      removeFrom (std::uint32_t start, const char* path, bool directory);
+
+      int
+      mkdirFrom (std::uint32_t start, const char* path);
+
+      int
+      renameFrom (std::uint32_t oldStart, const char* existing,
+                  std::uint32_t newStart, const char* _new);
+
+      // ----------------------------------------------------------------------
+
+      Type fType;
+
+      std::size_t fSectorSize;
+      std::size_t fSectorsPerCluster;
+      std::size_t fClusterSize;
+      blockNumber_t fFatStart;
+      blockNumber_t fFatSectors;
+      std::size_t fFatsCount;
+      // With mirroring disabled (FAT32), the only FAT used.
+      std::size_t fActiveFat;
+      bool fMirrored;
+      blockNumber_t fRootStart;
+      std::uint32_t fRootEntries;
+      std::uint32_t fRootCluster;
+      blockNumber_t fDataStart;
+      std::uint32_t fClustersCount;
+      blockNumber_t fFsInfoSector;
+
+      // The FAT window, sectors relative to the FAT start.
+      std::uint8_t* fWindow;
+      blockNumber_t fWindowStart;
+      blockNumber_t fWindowCount;
+      bool fWindowDirty;
+
+      // The buffer for directory entries and partial data sectors.
+      std::uint8_t* fBuffer;
+      blockNumber_t fBufferSector;
+      bool fBufferDirty;
+
+      // One bit per cluster, set when used.
+      std::uint32_t* fBitmap;
+      std::uint32_t fFreeClusters;
+      std::uint32_t fNextFree;
+
+      std::size_t fFatLookups;
+      std::size_t fFatLoads;
+
+      DirectoryIndex* fIndex;
+
+      NodeCache* fNodes;
+
+      BlockJournal* fJournal;
+      // With the journal, one bit per cluster freed since the last
+      // commit, still marked used in the bitmap.
+      std::uint32_t* fPending;
+      std::uint32_t fPendingClusters;
+
+      // Long names are assembled here, 20 entries of 13 characters.
+      std::uint16_t fLongName[260];
+
+      std::atomic_flag fLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class FatFile : public File
+    {
+      friend class FatFileSystem;
+
+    public:
+
+      FatFile ();
+      FatFile (const FatFile&) = delete;
+
+      virtual
+      ~FatFile ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_vopenat (Directory* dir, const char* path, int oflag,
+                  std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fallocate (int mode, off_t offset, off_t len) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_readahead (off_t offset, std::size_t length) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+      // Consecutive clusters, starting with the `index` cluster of
+      // the file.
+      struct Run
+      {
+        std::uint32_t index;
+        std::uint32_t cluster;
+        std::uint32_t count;
+      };
+
+      FatFileSystem*
+      getFatFileSystem (void) const;
+
+      /**
+       * Open `path`, relative to the `start` directory, with the
+       * lock taken.
+       */
+      int
+      open (std::uint32_t start, const char* path, int oflag,
+            std::va_list args);
+
+      /**
+       * The cluster holding the `index` cluster of the file; when
+       * writing, the chain is extended up to it.
+       *
+       * @return The cluster, or 0 and errno.
+       */
+      std::uint32_t
+      clusterAt (std::uint32_t index, bool extend);
+
+      void
+      forgetClusters (void);
+
+      /**
+       * Copy `nbyte` bytes at `offset` from `src` to the file, or
+       * from the file to `dst`; if both are null, write zeros.
+       *
+       * @return The number of bytes, or -1 and errno.
+       */
+      ssize_t
+      transfer (std::size_t offset, const void* src, void* dst,
+                std::size_t nbyte);
+
+      /**
+       * Like transfer(), without the page cache.
+       */
+      ssize_t
+      transferDirect (std::size_t offset, const void* src, void* dst,
+                      std::size_t nbyte);
+
+      /**
+       * Like transfer(), through the page cache; the pages that
+       * cannot be cached are transferred directly.
+       */
+      ssize_t
+      transferPages (std::size_t offset, const void* src, void* dst,
+                     std::size_t nbyte);
+
+      /**
+       * Read the page content from the device; the bytes past the
+       * size are zeros.
+       */
+      int
+      fillPage (PageCache::Page* page);
+
+      /**
+       * Write the dirty pages of the file to the device.
+       */
+      int
+      writeBack (void);
+
+      ino_t
+      inode (void) const;
+
+      void
+      record (std::uint32_t index, std::uint32_t cluster);
+
+      int
+      resize (std::size_t length);
+
+      /**
+       * Free the clusters after those needed for `length` bytes.
+       */
+      int
+      trimChain (std::size_t length);
+
+      int
+      syncEntry (void);
+
+      /**
+       * Copy the first cluster, the size and the state of the entry
+       * to the other opens of the file; if the chain was shortened,
+       * they also forget their cluster maps.
+       */
+      void
+      share (bool shortened);
+
+      // The short directory entry.
+      blockNumber_t fEntrySector;
+      std::size_t fEntryOffset;
+
+      std::uint32_t fFirstCluster;
+      std::size_t fSize;
+      off_t fOffset;
+      int fFlags;
+      bool fEntryDirty;
+      // Clusters allocated beyond the size by fallocate() with
+      // FALLOC_FL_KEEP_SIZE, freed at close.
+      bool fReserved;
+
+      Run fRuns[OS_INTEGER_FAT_FILE_RUNS];
+      std::size_t fRunsCount;
+      // The clusters [0, fMapped) are in the runs.
+      std::uint32_t fMapped;
+      // The last cluster looked up beyond the runs.
+      std::uint32_t fHintIndex;
+      std::uint32_t fHintCluster;
+    };
+
+    class FatDirectory : public Directory
+    {
+      friend class FatFileSystem;
+
+    public:
+
+      FatDirectory ();
+      FatDirectory (const FatDirectory&) = delete;
+
+      virtual
+      ~FatDirectory ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual struct dirent*
+      do_read_plus (struct stat* buf) override;
+
+      virtual ssize_t
+      do_read_batch (void* buf, std::size_t size) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      FatFileSystem*
+      getFatFileSystem (void) const;
+
+      // The directory cluster and the next entry.
+      std::uint32_t fDir;
+      std::uint32_t fIndex;
+      std::uint32_t fCluster;
+      std::uint32_t fClusterIndex;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline FatFileSystem::Type
+    FatFileSystem::getType (void) const
+    {
+      return fType;
+    }
+
+    inline std::size_t
+    FatFileSystem::getClusterSize (void) const
+    {
+      return fClusterSize;
+    }
+
+    inline std::uint32_t
+    FatFileSystem::getClustersCount (void) const
+    {
+      return fClustersCount;
+    }
+
+    inline std::uint32_t
+    FatFileSystem::getFreeClusters (void) const
+    {
+      return fFreeClusters;
+    }
+
+    inline std::size_t
+    FatFileSystem::getFatLookups (void) const
+    {
+      return fFatLookups;
+    }
+
+    inline std::size_t
+    FatFileSystem::getFatLoads (void) const
+    {
+      return fFatLoads;
+    }
+
+    inline DirectoryIndex*
+    FatFileSystem::getDirectoryIndex (void) const
+    {
+      return fIndex;
+    }
+
+    inline BlockJournal*
+    FatFileSystem::getJournal (void) const
+    {
+      return fJournal;
+    }
+
+    inline NodeCache*
+    FatFileSystem::getNodeCache (void) const
+    {
+      return fNodes;
+    }
+
+    inline bool
+    FatFileSystem::isJournaled (void) const
+    {
+      return (fJournal != nullptr) && fJournal->isAttached ();
+    }
+
+    inline FatFileSystem*
+    FatFile::getFatFileSystem (void) const
+    {
+      return static_cast<FatFileSystem*> (getFileSystem ());
+    }
+
+    inline FatFileSystem*
+    FatDirectory::getFatFileSystem (void) const
+    {
+      return static_cast<FatFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_FAT_FILE_SYSTEM_H_ */
@@ -36,6 +36,18 @@
 
 // ----------------------------------------------------------------------------
 
+// The first and the largest read-ahead windows, in bytes.
+
+#if !defined(OS_INTEGER_FILE_READAHEAD_MIN)
+#define OS_INTEGER_FILE_READAHEAD_MIN  (2 * 1024)
+#endif
+
+#if !defined(OS_INTEGER_FILE_READAHEAD_MAX)
+#define OS_INTEGER_FILE_READAHEAD_MAX  (32 * 1024)
+#endif
+
+// ----------------------------------------------------------------------------
+
 namespace os
 {
   namespace posix
@@ -43,6 +55,7 @@ namespace os
     // ------------------------------------------------------------------------
 
     class FileSystem;
+    class Directory;
     class Pool;
 
     // ------------------------------------------------------------------------
@@ -78,12 +91,61 @@ namespace os
       int
       fsync (void);
 
+      /**
+       * Advise the expected access pattern, as posix_fadvise();
+       * POSIX_FADV_SEQUENTIAL starts with the largest read-ahead
+       * window, POSIX_FADV_RANDOM disables read-ahead and
+       * POSIX_FADV_WILLNEED reads the range ahead immediately.
+       *
+       * @return 0, or an error number (errno is not set).
+       */
+      int
+      fadvise (off_t offset, off_t len, int advice);
+
+      /**
+       * Allocate the storage of the range in advance, as fallocate().
+       * With FALLOC_FL_KEEP_SIZE the size does not change and the
+       * space is kept for the next writes; otherwise the file grows
+       * to at least `offset + len` bytes, the new ones reading as
+       * zeros.
+       *
+       * @return 0, or -1 and errno (EOPNOTSUPP if the file system
+       * cannot allocate in advance).
+       */
+      int
+      fallocate (int mode, off_t offset, off_t len);
+
+      /**
+       * As posix_fallocate(): fallocate() with mode 0, falling back
+       * to writing zeros past the end of the file if the file system
+       * cannot allocate in advance.
+       *
+       * @return 0, or an error number (errno is not set).
+       */
+      int
+      preallocate (off_t offset, off_t len);
+
       // ----------------------------------------------------------------------
       // Support functions.
 
       FileSystem*
       getFileSystem (void) const;
 
+      /**
+       * File system specific node handle, or nullptr. When the path was
+       * found in the PathCache, it is set before do_vopen(), such
+       * that the implementation can skip the path walk; do_vopen()
+       * may set it, to be cached for the next open.
+       */
+      void*
+      getNode (void) const;
+
+      /**
+       * The size of the current read-ahead window, in bytes.
+       */
+      std::size_t
+      getReadAheadWindow (void) const;
+
     protected:
 
       // ----------------------------------------------------------------------
@@ -95,6 +157,19 @@ namespace os
       virtual int
       do_vopen (const char* path, int oflag, std::va_list args) = 0;
 
+      /**
+       * Open relative to a directory of the same file system, with
+       * `path` relative and without `..` components. The default
+       * implementation appends `path` to the directory path and
+       * calls do_vopen(); override it to look up the name in the
+       * directory node.
+       *
+       * return 0 if success or -1 & errno
+       */
+      virtual int
+      do_vopenat (Directory* dir, const char* path, int oflag,
+                  std::va_list args);
+
       virtual off_t
       do_lseek (off_t offset, int whence);
 
@@ -104,18 +179,68 @@ namespace os
       virtual int
       do_fsync (void);
 
+      /**
+       * Reserve the storage of the range, preferably contiguous,
+       * with `mode` 0 or FALLOC_FL_KEEP_SIZE and the arguments
+       * checked. The default implementation fails with EOPNOTSUPP.
+       */
+      virtual int
+      do_fallocate (int mode, off_t offset, off_t len);
+
       virtual void
       do_release (void) override;
 
+      /**
+       * Start reading the given file range into the block cache,
+       * without waiting for it; called by readAhead(). The default
+       * implementation does nothing; file systems map the range to
+       * device blocks and call BlockDevice::prefetch().
+       */
+      virtual void
+      do_readahead (off_t offset, std::size_t length);
+
       // ----------------------------------------------------------------------
       // Support functions.
 
       void
       setFileSystem (FileSystem* fileSystem);
 
+      void
+      setNode (void* node);
+
+      /**
+       * Called by the do_read() implementations before reading
+       * `nbyte` bytes at `offset`. Sequential reads open a read-ahead
+       * window that doubles each time the reader enters it, up to
+       * OS_INTEGER_FILE_READAHEAD_MAX; other reads halve it.
+       */
+      void
+      readAhead (off_t offset, std::size_t nbyte);
+
     private:
 
+      void
+      resetReadAhead (void);
+
+      /**
+       * Write zeros from the end of the file up to `length` bytes,
+       * keeping the file offset.
+       *
+       * @return 0, or an error number.
+       */
+      int
+      growWithZeros (off_t length);
+
       FileSystem* fFileSystem;
+      void* fNode;
+
+      // The offset where the next sequential read is expected.
+      off_t fReadAheadNext;
+      // The last window sent to do_readahead(), [start, end).
+      off_t fReadAheadStart;
+      off_t fReadAheadEnd;
+      std::size_t fReadAheadSize;
+      int fAdvice;
     };
 
     // ------------------------------------------------------------------------
@@ -138,6 +263,24 @@ namespace os
       return fFileSystem;
     }
 
+    inline void
+    File::setNode (void* node)
+    {
+      fNode = node;
+    }
+
+    inline void*
+    File::getNode (void) const
+    {
+      return fNode;
+    }
+
+    inline std::size_t
+    File::getReadAheadWindow (void) const
+    {
+      return fReadAheadSize;
+    }
+
   } /* namespace posix */
 } /* namespace os */
 
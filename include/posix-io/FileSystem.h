@@ -31,6 +31,8 @@
 // ----------------------------------------------------------------------------
 
 #include <cstdarg>
+#include <cstddef>
+#include <atomic>
 #include <sys/stat.h>
 #include <utime.h>
 
@@ -60,6 +62,12 @@ namespace os
     void
     sync (void);
 
+    int
+    chdir (const char* path);
+
+    char*
+    getcwd (char* buf, std::size_t size);
+
     // ----------------------------------------------------------------------
     // ----- Non-io, file functions -----
 
@@ -81,6 +89,21 @@ namespace os
     int
     utime (const char* path, const struct utimbuf* times);
 
+    // ----------------------------------------------------------------------
+    // ----- Functions relative to a directory file descriptor -----
+
+    int
+    fstatat (int fildes, const char* path, struct stat* buf, int flag);
+
+    int
+    mkdirat (int fildes, const char* path, mode_t mode);
+
+    int
+    unlinkat (int fildes, const char* path, int flag);
+
+    int
+    renameat (int oldfd, const char* existing, int newfd, const char* _new);
+
     // ------------------------------------------------------------------------
 
     class FileSystem
@@ -91,6 +114,8 @@ namespace os
       friend class Directory;
       friend class MountManager;
       friend class IO;
+      // Calls the functions of the file systems it stacks.
+      friend class OverlayFileSystem;
 
       friend int
       mkdir (const char* path, mode_t mode);
@@ -119,6 +144,18 @@ namespace os
       friend int
       utime (const char* path, const struct utimbuf* times);
 
+      friend int
+      fstatat (int fildes, const char* path, struct stat* buf, int flag);
+
+      friend int
+      mkdirat (int fildes, const char* path, mode_t mode);
+
+      friend int
+      unlinkat (int fildes, const char* path, int flag);
+
+      friend int
+      renameat (int oldfd, const char* existing, int newfd, const char* _new);
+
       // ----------------------------------------------------------------------
 
     public:
@@ -132,10 +169,19 @@ namespace os
       // ----------------------------------------------------------------------
 
       IO*
-      open (const char* path, int oflag, std::va_list args);
+      open (const char* path, int oflag, std::va_list args,
+            void* node = nullptr);
 
       Directory*
-      opendir (const char* dirpath);
+      opendir (const char* dirpath, void* node = nullptr);
+
+      /**
+       * Open a file relative to a directory of this file system;
+       * `path` must be relative and must not have `..` components.
+       */
+      IO*
+      openat (Directory* dir, const char* path, int oflag,
+              std::va_list args);
 
       // ----------------------------------------------------------------------
       // Support functions.
@@ -149,6 +195,25 @@ namespace os
       Pool*
       getDirsPool (void) const;
 
+      /**
+       * Account for an operation in progress, such that umount()
+       * waits for it to complete before unmounting.
+       *
+       * @return false if the file system is not mounted, or is
+       * being unmounted; otherwise true, and release() must follow.
+       */
+      bool
+      acquire (void);
+
+      void
+      release (void);
+
+      unsigned int
+      getInFlight (void) const;
+
+      bool
+      isMounted (void) const;
+
     protected:
 
       // ----------------------------------------------------------------------
@@ -199,9 +264,37 @@ namespace os
       virtual int
       do_rmdir (const char* path);
 
+      /**
+       * The default implementation flushes the block device (and its
+       * cache, if any); file systems that override it should call it
+       * after writing their own data.
+       */
       virtual void
       do_sync (void);
 
+      // Relative to a directory of this file system, with `path`
+      // relative and without `..` components. The default
+      // implementations append `path` to the directory path and call
+      // the functions above; file systems able to look up a name in
+      // the directory node should override them, to avoid walking
+      // the entire path.
+
+      virtual int
+      do_statat (Directory* dir, const char* path, struct stat* buf);
+
+      virtual int
+      do_mkdirat (Directory* dir, const char* path, mode_t mode);
+
+      /**
+       * @param flag 0 or AT_REMOVEDIR.
+       */
+      virtual int
+      do_unlinkat (Directory* dir, const char* path, int flag);
+
+      virtual int
+      do_renameat (Directory* olddir, const char* existing, Directory* newdir,
+                   const char* _new);
+
       virtual int
       do_mount (unsigned int flags);
 
@@ -214,6 +307,9 @@ namespace os
       void
       setBlockDevice (BlockDevice* blockDevice);
 
+      void
+      setMounted (bool mounted);
+
     public:
 
       const char*
@@ -225,6 +321,9 @@ namespace os
       Pool* fDirsPool;
 
       BlockDevice* fBlockDevice;
+
+      std::atomic<unsigned int> fInFlight;
+      std::atomic<bool> fMounted;
     };
 
     inline Pool*
@@ -251,6 +350,30 @@ namespace os
       return fBlockDevice;
     }
 
+    inline void
+    FileSystem::release (void)
+    {
+      fInFlight.fetch_sub (1);
+    }
+
+    inline unsigned int
+    FileSystem::getInFlight (void) const
+    {
+      return fInFlight.load ();
+    }
+
+    inline bool
+    FileSystem::isMounted (void) const
+    {
+      return fMounted.load ();
+    }
+
+    inline void
+    FileSystem::setMounted (bool mounted)
+    {
+      fMounted.store (mounted);
+    }
+
   } /* namespace posix */
 } /* namespace os */
 
@@ -0,0 +1,590 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_FLASH_FILE_SYSTEM_H_
+#define POSIX_IO_FLASH_FILE_SYSTEM_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/BlockDevice.h"
+
+#include <atomic>
+#include <ctime>
+
+// ----------------------------------------------------------------------------
+
+#if !defined(OS_INTEGER_FLASHFS_NAME_MAX)
+#define OS_INTEGER_FLASHFS_NAME_MAX  (31)
+#endif
+
+// The segment size, in blocks, used by format() when the device does
+// not report an erase block larger than one block.
+#if !defined(OS_INTEGER_FLASHFS_SEGMENT_BLOCKS)
+#define OS_INTEGER_FLASHFS_SEGMENT_BLOCKS  (16)
+#endif
+
+// The number of blocks moved by the garbage collector after each
+// write, when the free segments run low.
+#if !defined(OS_INTEGER_FLASHFS_GC_STEP)
+#define OS_INTEGER_FLASHFS_GC_STEP  (4)
+#endif
+
+// The difference of erase counts that makes the garbage collector
+// move the content of the least erased segment.
+#if !defined(OS_INTEGER_FLASHFS_WEAR_DELTA)
+#define OS_INTEGER_FLASHFS_WEAR_DELTA  (8)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class FlashFile;
+    class FlashDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Log-structured file system for raw flash partitions.
+     *
+     * The device is divided into segments (erase blocks); each one
+     * starts with a header block with its erase count. Blocks are
+     * only appended to the current segment, and never rewritten
+     * before the segment is erased. Each block holds a chunk of a
+     * file, or an object header (name, parent, size), tagged with the
+     * object, the chunk number, a sequence number and a CRC; the
+     * newest valid copy of a chunk wins, such that a write cut by a
+     * power loss leaves the previous copy in place.
+     *
+     * Mount scans all the blocks to rebuild the maps in RAM; the RAM
+     * used is fixed by the device size (about 14 bytes per block)
+     * and by the number of objects given to the constructor. The
+     * last chunk written is buffered in RAM; fsync() writes it and
+     * the object header, two blocks at most, and the size in the
+     * header is the commit point: chunks written after it beyond the
+     * committed size are dropped at mount.
+     *
+     * The garbage collector moves the live blocks out of the segment
+     * with the most reclaimable space, a few blocks after each
+     * write when the free segments run low, such that writers are
+     * delayed by at most one segment when the space is exhausted.
+     * New segments are taken from the least erased ones, and the
+     * content of segments left behind by the erase count is moved
+     * (static wear leveling). Two segments are kept free for the
+     * garbage collector, and data is refused (ENOSPC) one segment
+     * earlier, such that files can still be removed.
+     *
+     * Open files cannot be removed, and open directories cannot be
+     * removed (EBUSY).
+     */
+    class FlashFileSystem : public FileSystem
+    {
+      friend class FlashFile;
+      friend class FlashDirectory;
+
+    public:
+
+      /**
+       * @param filesPool A pool of FlashFile objects.
+       * @param dirsPool A pool of FlashDirectory objects.
+       * @param objectsCount The maximum number of files and
+       * directories, not including the root; must be the same each
+       * time the file system is mounted.
+       */
+      FlashFileSystem (Pool* filesPool, Pool* dirsPool,
+                       std::size_t objectsCount);
+      FlashFileSystem (const FlashFileSystem&) = delete;
+
+      virtual
+      ~FlashFileSystem ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Erase the device and write the segment headers.
+       *
+       * @param segmentBlocks The blocks per segment, or 0 for the
+       * device alignment (or OS_INTEGER_FLASHFS_SEGMENT_BLOCKS if it
+       * is 1).
+       * @return 0, or -1 and errno.
+       */
+      static int
+      format (BlockDevice* device, std::size_t segmentBlocks = 0);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      std::size_t
+      getSegmentsCount (void) const;
+
+      std::size_t
+      getFreeSegments (void) const;
+
+      /**
+       * The number of blocks in use, including the segment headers.
+       */
+      std::size_t
+      getLiveBlocks (void) const;
+
+      /**
+       * The number of blocks moved by the garbage collector.
+       */
+      std::size_t
+      getMovedBlocks (void) const;
+
+      std::uint32_t
+      getMinErases (void) const;
+
+      std::uint32_t
+      getMaxErases (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual void
+      do_sync (void) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+      virtual int
+      do_unmount (unsigned int flags) override;
+
+    private:
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Object
+      {
+        std::time_t mtime;
+        std::uint32_t parent;
+        std::uint32_t size;
+        // The newest header block.
+        std::uint32_t header;
+        // All the blocks on the device, live or not.
+        std::uint32_t blocks;
+        std::uint32_t opens;
+        // Only while mounting, from the header.
+        std::uint32_t replaced;
+        std::uint16_t mode;
+        std::uint8_t type;
+        // The header differs from the object.
+        bool dirty;
+        char name[OS_INTEGER_FLASHFS_NAME_MAX + 1];
+      };
+
+      struct Segment
+      {
+        std::uint32_t erases;
+        // The next block to write, relative to the segment.
+        std::uint32_t used;
+        std::uint32_t live;
+        std::uint8_t state;
+      };
+
+#pragma GCC diagnostic pop
+
+      // Where a block belongs; ino 0 for none.
+      struct Owner
+      {
+        std::uint32_t ino;
+        std::uint32_t chunk;
+      };
+
+      // ----------------------------------------------------------------------
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+      // Objects.
+
+      Object*
+      objectOf (std::uint32_t ino);
+
+      std::uint32_t
+      inoOf (const Object* object) const;
+
+      std::uint32_t
+      lookup (std::uint32_t dir, const char* name, std::size_t len);
+
+      /**
+       * Walk all but the last component of `path`. `*len` is 0 if
+       * `path` is the root.
+       */
+      int
+      resolve (const char* path, std::uint32_t* dir, const char** name,
+               std::size_t* len);
+
+      /**
+       * @return The object, or 0 and errno.
+       */
+      std::uint32_t
+      find (const char* path);
+
+      std::uint32_t
+      create (std::uint32_t dir, const char* name, std::size_t len,
+              std::uint8_t type, mode_t mode);
+
+      int
+      remove (std::uint32_t ino);
+
+      bool
+      hasChildren (std::uint32_t dir);
+
+      bool
+      isDirectoryOpen (std::uint32_t dir);
+
+      void
+      fillStat (std::uint32_t ino, struct stat* buf);
+
+      int
+      removeFrom (const char* path, bool directory);
+
+      // Chunks.
+
+      std::size_t
+      chunksOf (std::size_t size) const;
+
+      int
+      loadPending (std::uint32_t ino, std::uint32_t chunk);
+
+      int
+      flushPending (void);
+
+      int
+      readChunk (std::uint32_t ino, std::uint32_t chunk, std::size_t offset,
+                 void* buf, std::size_t nbyte);
+
+      int
+      writeChunk (std::uint32_t ino, std::uint32_t chunk, std::size_t offset,
+                  const void* buf, std::size_t nbyte);
+
+      int
+      resize (std::uint32_t ino, std::size_t size);
+
+      /**
+       * Write the object header, after its buffered chunk.
+       *
+       * @param replaced An object removed by the same operation
+       * (rename), or 0.
+       */
+      int
+      writeHeader (std::uint32_t ino, std::uint32_t replaced = 0);
+
+      int
+      commit (std::uint32_t ino);
+
+      // Blocks.
+
+      int
+      allocateBlock (bool moving, blockNumber_t* block);
+
+      /**
+       * Write an allocated block, with the payload in fBuffer, and
+       * map it in place of the previous copy.
+       */
+      int
+      writeBlock (blockNumber_t block, std::uint32_t ino,
+                  std::uint32_t chunk);
+
+      int
+      readBlock (blockNumber_t block);
+
+      bool
+      checkBlock (void) const;
+
+      blockNumber_t
+      findBlock (std::uint32_t ino, std::uint32_t chunk) const;
+
+      void
+      mapBlock (blockNumber_t block, std::uint32_t ino, std::uint32_t chunk);
+
+      void
+      killBlock (blockNumber_t block);
+
+      bool
+      isLive (blockNumber_t block) const;
+
+      // Segments.
+
+      int
+      eraseSegment (std::size_t segment);
+
+      void
+      reclaim (std::uint32_t ino);
+
+      /**
+       * Collect the segments with the blocks of a removed object,
+       * until its number can be reused.
+       *
+       * @return The free object, or nullptr and errno.
+       */
+      Object*
+      purge (void);
+
+      std::size_t
+      chooseVictim (void);
+
+      /**
+       * Move up to `count` live blocks out of the victim, and erase it
+       * when empty.
+       *
+       * @return 1 if a segment was erased, 0, or -1 and errno (ENOSPC
+       * if no segment has reclaimable space).
+       */
+      int
+      collect (std::size_t count);
+
+      int
+      collectStep (void);
+
+      int
+      syncAll (void);
+
+      // ----------------------------------------------------------------------
+
+      Object* fObjects;
+      std::size_t fObjectsCount;
+
+      std::size_t fBlockSize;
+      std::size_t fPayloadSize;
+      std::size_t fSegmentBlocks;
+      std::size_t fSegmentsCount;
+
+      // Per block.
+      Owner* fOwners;
+      std::uint32_t* fNext;
+      std::uint32_t* fLiveBits;
+      std::uint32_t* fBuckets;
+      std::size_t fBucketsMask;
+
+      Segment* fSegments;
+      std::size_t fFreeSegments;
+      std::size_t fHead;
+      std::size_t fVictim;
+      std::size_t fVictimCursor;
+      // Live blocks, without the segment headers.
+      std::size_t fLive;
+      std::size_t fMoved;
+
+      std::uint64_t fSequence;
+
+      // The I/O buffer, a block with its tag.
+      std::uint8_t* fBuffer;
+
+      // The last chunk written.
+      std::uint8_t* fPending;
+      std::uint32_t fPendingIno;
+      std::uint32_t fPendingChunk;
+      bool fPendingDirty;
+
+      std::atomic_flag fLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class FlashFile : public File
+    {
+      friend class FlashFileSystem;
+
+    public:
+
+      FlashFile ();
+      FlashFile (const FlashFile&) = delete;
+
+      virtual
+      ~FlashFile ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      FlashFileSystem*
+      getFlashFileSystem (void) const;
+
+      std::uint32_t fIno;
+      off_t fOffset;
+      int fFlags;
+    };
+
+    class FlashDirectory : public Directory
+    {
+      friend class FlashFileSystem;
+
+    public:
+
+      FlashDirectory ();
+      FlashDirectory (const FlashDirectory&) = delete;
+
+      virtual
+      ~FlashDirectory ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual struct dirent*
+      do_read_plus (struct stat* buf) override;
+
+      virtual ssize_t
+      do_read_batch (void* buf, std::size_t size) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      FlashFileSystem*
+      getFlashFileSystem (void) const;
+
+      std::uint32_t fIno;
+      // The next object to check.
+      std::size_t fCursor;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    FlashFileSystem::getSegmentsCount (void) const
+    {
+      return fSegmentsCount;
+    }
+
+    inline std::size_t
+    FlashFileSystem::getFreeSegments (void) const
+    {
+      return fFreeSegments;
+    }
+
+    inline std::size_t
+    FlashFileSystem::getMovedBlocks (void) const
+    {
+      return fMoved;
+    }
+
+    inline FlashFileSystem*
+    FlashFile::getFlashFileSystem (void) const
+    {
+      return static_cast<FlashFileSystem*> (getFileSystem ());
+    }
+
+    inline FlashFileSystem*
+    FlashDirectory::getFlashFileSystem (void) const
+    {
+      return static_cast<FlashFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_FLASH_FILE_SYSTEM_H_ */
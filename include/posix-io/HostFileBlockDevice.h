@@ -0,0 +1,112 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_HOST_FILE_BLOCK_DEVICE_H_
+#define POSIX_IO_HOST_FILE_BLOCK_DEVICE_H_
+
+// Only for hosted (POSIX) environments, to build and test file systems.
+#if !defined(__ARM_EABI__)
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Block device stored in a file (disk image) of the host, accessed
+     * with pread()/pwrite().
+     */
+    class HostFileBlockDevice : public BlockDevice
+    {
+    public:
+
+      HostFileBlockDevice (std::size_t blockSize = 512);
+      HostFileBlockDevice (const HostFileBlockDevice&) = delete;
+
+      virtual
+      ~HostFileBlockDevice ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Open the image file, creating it if needed. If `blocksCount`
+       * is not 0, the file is extended to the given size, otherwise
+       * the size of the existing file is used.
+       */
+      int
+      open (const char* path, blockNumber_t blocksCount = 0);
+
+      int
+      close (void);
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count)
+          override;
+
+      virtual ssize_t
+      do_readv (const struct iovec* iov, int iovcnt, blockNumber_t block)
+          override;
+
+      virtual ssize_t
+      do_writev (const struct iovec* iov, int iovcnt, blockNumber_t block)
+          override;
+
+      virtual int
+      do_flush (void) override;
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count) override;
+
+    private:
+
+      std::size_t fFileBlockSize;
+      int fFileDescriptor;
+    };
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* !defined(__ARM_EABI__) */
+
+#endif /* POSIX_IO_HOST_FILE_BLOCK_DEVICE_H_ */
@@ -0,0 +1,290 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_HOST_FILE_SYSTEM_H_
+#define POSIX_IO_HOST_FILE_SYSTEM_H_
+
+// Only for hosted (POSIX) environments, to test and benchmark the
+// library with real files.
+#if !defined(__ARM_EABI__)
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/BlockDevice.h"
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class HostFile;
+    class HostDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * File system passing the calls to a directory of the host, with
+     * the host system calls, relative to a descriptor of the directory
+     * opened by mount(); the *at() functions use the descriptors of
+     * the host directories.
+     *
+     * It needs no block device; mount() sets a device without storage,
+     * as required by the FileSystem functions.
+     */
+    class HostFileSystem : public FileSystem
+    {
+      friend class HostFile;
+      friend class HostDirectory;
+
+    public:
+
+      /**
+       * @param filesPool A pool of HostFile objects.
+       * @param dirsPool A pool of HostDirectory objects.
+       * @param root The path of the host directory, valid while mounted.
+       */
+      HostFileSystem (Pool* filesPool, Pool* dirsPool, const char* root);
+      HostFileSystem (const HostFileSystem&) = delete;
+
+      virtual
+      ~HostFileSystem ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      const char*
+      getRoot (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual void
+      do_sync (void) override;
+
+      virtual int
+      do_statat (Directory* dir, const char* path, struct stat* buf) override;
+
+      virtual int
+      do_mkdirat (Directory* dir, const char* path, mode_t mode) override;
+
+      virtual int
+      do_unlinkat (Directory* dir, const char* path, int flag) override;
+
+      virtual int
+      do_renameat (Directory* olddir, const char* existing, Directory* newdir,
+                   const char* _new) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+      virtual int
+      do_unmount (unsigned int flags) override;
+
+    private:
+
+      const char* fRoot;
+      // The host descriptor of the root directory, -1 if not mounted.
+      int fRootDescriptor;
+
+      BlockDevice fDevice;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class HostFile : public File
+    {
+      friend class HostFileSystem;
+
+    public:
+
+      HostFile ();
+      HostFile (const HostFile&) = delete;
+
+      virtual
+      ~HostFile ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_vopenat (Directory* dir, const char* path, int oflag,
+                  std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_writev (const struct iovec* iov, int iovcnt) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fallocate (int mode, off_t offset, off_t len) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_readahead (off_t offset, std::size_t length) override;
+
+    private:
+
+      int
+      openRelative (int dirfd, const char* path, int oflag,
+                    std::va_list args);
+
+      // The host descriptor.
+      int fDescriptor;
+    };
+
+    class HostDirectory : public Directory
+    {
+      friend class HostFileSystem;
+
+    public:
+
+      HostDirectory ();
+      HostDirectory (const HostDirectory&) = delete;
+
+      virtual
+      ~HostDirectory ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * The host descriptor of the directory.
+       */
+      int
+      getDescriptor (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      HostFileSystem*
+      getHostFileSystem (void) const;
+
+      // The host directory stream.
+      DIR* fStream;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline const char*
+    HostFileSystem::getRoot (void) const
+    {
+      return fRoot;
+    }
+
+    inline HostFileSystem*
+    HostDirectory::getHostFileSystem (void) const
+    {
+      return static_cast<HostFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* !defined(__ARM_EABI__) */
+
+#endif /* POSIX_IO_HOST_FILE_SYSTEM_H_ */
@@ -59,6 +59,12 @@ namespace os
     IO*
     vopen (const char* path, int oflag, std::va_list args);
 
+    IO*
+    openat (int fildes, const char* path, int oflag, ...);
+
+    IO*
+    vopenat (int fildes, const char* path, int oflag, std::va_list args);
+
     // ------------------------------------------------------------------------
 
     class IO
@@ -71,6 +77,9 @@ namespace os
       friend IO*
       vopen (const char* path, int oflag, std::va_list args);
 
+      friend IO*
+      vopenat (int fildes, const char* path, int oflag, std::va_list args);
+
       // ----------------------------------------------------------------------
 
     public:
@@ -82,7 +91,8 @@ namespace os
         NOTSET = 1 << 0,
         DEVICE = 1 << 1,
         FILE = 1 << 2,
-        SOCKET = 1 << 3
+        SOCKET = 1 << 3,
+        DIRECTORY = 1 << 4
       };
 
       // ----------------------------------------------------------------------
@@ -30,6 +30,7 @@
 
 #include <cstddef>
 #include <cassert>
+#include <atomic>
 
 // ----------------------------------------------------------------------------
 
@@ -40,9 +41,32 @@ namespace os
     // ------------------------------------------------------------------------
 
     class FileSystem;
+    class BlockDevice;
 
     // ------------------------------------------------------------------------
 
+    /**
+     * Called while waiting for other threads, by mount()/umount()
+     * and by the block request queues.
+     * The default implementation returns immediately (busy wait);
+     * in multi-threaded environments redefine it to yield the CPU.
+     */
+    void
+    schedulerYield (void);
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * The mount table is published as an immutable snapshot, replaced
+     * as a whole by mount()/umount()/setRoot(), such that lookups
+     * from multiple threads need no locks. The old snapshot is
+     * reclaimed only after all the lookups that might still use it
+     * complete (RCU style, with two alternating reader counters).
+     *
+     * Changes to the mount table are serialised between them, and
+     * umount() waits for the operations in progress on the file system
+     * (see FileSystem::acquire()) to complete.
+     */
     class MountManager
     {
     public:
@@ -57,16 +81,45 @@ namespace os
       static FileSystem*
       identifyFileSystem (const char** path1, const char** path2 = nullptr);
 
+      /**
+       * Like identifyFileSystem(), but also acquire the file system
+       * (see FileSystem::acquire()), atomically with the lookup.
+       *
+       * @return The file system, to be released after use, or nullptr.
+       */
+      static FileSystem*
+      acquireFileSystem (const char** path1, const char** path2 = nullptr);
+
+      /**
+       * @return The acquired file system mounted in the slot,
+       * to be released after use, or nullptr.
+       */
+      static FileSystem*
+      acquireFileSystem (std::size_t index);
+
+      /**
+       * @return 0, or -1 and errno, for example if do_mount() did not
+       * recognise the device contents; the file system is then not
+       * mounted.
+       */
       static int
       setRoot (FileSystem* fs, BlockDevice* blockDevice, unsigned int flags);
 
       static FileSystem*
       getRoot (void);
 
+      /**
+       * @return 0, or -1 and errno (EBUSY if the path is already used,
+       * or the error of do_mount()).
+       */
       static int
       mount (FileSystem* fs, const char* path, BlockDevice* blockDevice,
              unsigned int flags);
 
+      /**
+       * Must not be called while holding the file system acquired,
+       * it would wait forever.
+       */
       static int
       umount (const char* path, int unsigned flags);
 
@@ -79,14 +132,91 @@ namespace os
       static const char*
       getPath (std::size_t index);
 
+      static bool
+      hasMountsBelow (const char* path);
+
+      static unsigned int
+      getGeneration (void);
+
+    private:
+
+      // The mount paths are compiled into a character prefix tree,
+      // rebuilt by mount()/umount(), such that identifyFileSystem()
+      // finds the longest matching mount point in a single pass
+      // over the path, regardless of the order of the mount table.
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct TrieNode
+      {
+        // Index of the first child and of the next sibling, or 0.
+        std::size_t firstChild;
+        std::size_t nextSibling;
+        // Index in the mount table plus 1, or 0 if not a mount point.
+        std::size_t mountIndex;
+        char ch;
+      };
+
+#pragma GCC diagnostic pop
+
+      // An immutable copy of the mount table, used by the lookups.
+      struct Table
+      {
+        FileSystem* root;
+        FileSystem** fileSystems;
+        const char** paths;
+        TrieNode* trie;
+      };
+
+      static Table*
+      buildTable (void);
+
+      static void
+      deleteTable (Table* table);
+
+      static void
+      publish (Table* table);
+
+      static FileSystem*
+      findFileSystem (const Table* table, const char** path1,
+                      const char** path2);
+
+      static unsigned int
+      enterReader (void);
+
+      static void
+      exitReader (unsigned int index);
+
+      static void
+      waitReaders (void);
+
+      static void
+      lockWriter (void);
+
+      static void
+      unlockWriter (void);
+
     private:
 
       static std::size_t sfSize;
 
+      // The master copy, changed only with the writer lock held.
       static FileSystem* sfRoot;
       static FileSystem** sfFileSystemsArray;
       static const char** sfPathsArray;
 
+      static std::atomic<Table*> sfTable;
+
+      // Readers count themselves in the counter selected by the
+      // epoch parity.
+      static std::atomic<unsigned int> sfEpoch;
+      static std::atomic<unsigned int> sfReaders[2];
+
+      static std::atomic_flag sfWriterLock;
+
+      // Incremented each time the mount table changes.
+      static std::atomic<unsigned int> sfGeneration;
     };
 
     inline std::size_t
@@ -95,24 +225,10 @@ namespace os
       return sfSize;
     }
 
-    inline FileSystem*
-    MountManager::getFileSystem (std::size_t index)
-    {
-      assert(index < sfSize);
-      return sfFileSystemsArray[index];
-    }
-
-    inline const char*
-    MountManager::getPath (std::size_t index)
-    {
-      assert(index < sfSize);
-      return sfPathsArray[index];
-    }
-
-    inline FileSystem*
-    MountManager::getRoot (void)
+    inline unsigned int
+    MountManager::getGeneration (void)
     {
-      return sfRoot;
+      return sfGeneration.load ();
     }
 
   } /* namespace posix */
@@ -0,0 +1,260 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef POSIX_IO_NODE_CACHE_H_
+#define POSIX_IO_NODE_CACHE_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Bounded cache of the nodes (files and directories) recently
+     * looked up, for file systems that keep their metadata only on
+     * the device.
+     *
+     * A node is identified by its inode number, and is found by name
+     * in its directory, identified by a file system specific key,
+     * with up to two hashes of its names (for example a long name and
+     * its short alias), normalised as the file system compares names.
+     * The names are not stored, the file system checks the node data
+     * returned by lookup(). Each node holds a fixed size of file
+     * system data, such as the directory entry, such that stat() or
+     * open() of a recently used node does not read the device.
+     *
+     * Open files reference their node with acquire(); referenced nodes
+     * are never recycled, the others are recycled in least recently
+     * used order. The file system updates the data of the nodes it
+     * changes, and calls remove() and drop() when nodes disappear.
+     *
+     * There are no locks, the file system calls it with its own lock
+     * held; a cache must not be shared by several file systems.
+     */
+    class NodeCache
+    {
+    public:
+
+      /**
+       * @param nodes The number of nodes.
+       */
+      NodeCache (std::size_t nodes);
+      NodeCache (const NodeCache&) = delete;
+
+      ~NodeCache ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Called by the file system using the cache, with the size of
+       * its node data; the data is allocated once.
+       */
+      void
+      setDataSize (std::size_t size);
+
+      /**
+       * Iterate the data of the nodes of `dir` with the given name
+       * hash; `*cursor` must be 0 for the first call.
+       *
+       * @return false when there are no more nodes.
+       */
+      bool
+      lookup (std::uint32_t dir, std::uint32_t hash, std::size_t* cursor,
+              void** data);
+
+      /**
+       * Count a hit on the node returned by lookup(), and make it
+       * the most recently used.
+       */
+      void
+      use (void* data);
+
+      /**
+       * @return The data of the node, or nullptr if not cached.
+       */
+      void*
+      find (ino_t id);
+
+      /**
+       * Add a node, replacing the node with the same id, if any.
+       *
+       * @param alias A second name hash, or the same as `hash`.
+       * @return The node data, to be filled by the file system, or
+       * nullptr if all nodes are referenced.
+       */
+      void*
+      add (ino_t id, std::uint32_t dir, std::uint32_t hash,
+           std::uint32_t alias);
+
+      /**
+       * Reference the node, if cached, such that it is not recycled.
+       *
+       * @return true if the node is cached.
+       */
+      bool
+      acquire (ino_t id);
+
+      void
+      release (ino_t id);
+
+      /**
+       * Forget the node, referenced or not.
+       */
+      void
+      remove (ino_t id);
+
+      /**
+       * Forget the nodes of the directory.
+       */
+      void
+      drop (std::uint32_t dir);
+
+      void
+      clear (void);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      std::size_t
+      getSize (void) const;
+
+      std::size_t
+      getUsed (void) const;
+
+      /**
+       * The number of nodes used from the cache, and added to it.
+       */
+      std::size_t
+      getHits (void) const;
+
+      std::size_t
+      getMisses (void) const;
+
+      // ----------------------------------------------------------------------
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Node
+      {
+        ino_t id;
+        std::uint32_t dir;
+        // The name hashes; the same if there is no alias.
+        std::uint32_t hash[2];
+        std::uint32_t refs;
+        bool used;
+
+        // Links in the bucket chains of the two names and of the
+        // id, and in the LRU list.
+        std::uint32_t next[3];
+        std::uint32_t newer;
+        std::uint32_t older;
+      };
+
+#pragma GCC diagnostic pop
+
+      std::uint32_t
+      indexOf (const void* data) const;
+
+      std::uint32_t
+      findNode (ino_t id) const;
+
+      std::uint32_t
+      nameBucket (std::uint32_t dir, std::uint32_t hash) const;
+
+      std::uint32_t
+      idBucket (ino_t id) const;
+
+      void
+      unlink (std::uint32_t index);
+
+      void
+      unlinkLru (std::uint32_t index);
+
+      void
+      linkMru (std::uint32_t index);
+
+      Node* fNodes;
+      std::size_t fSize;
+      std::uint8_t* fData;
+      std::size_t fStride;
+
+      // The name buckets, followed by the id buckets.
+      std::uint32_t* fBuckets;
+      std::uint32_t fBucketsMask;
+
+      // Most and least recently used nodes.
+      std::uint32_t fMru;
+      std::uint32_t fLru;
+
+      std::size_t fUsed;
+      std::size_t fHits;
+      std::size_t fMisses;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    NodeCache::getSize (void) const
+    {
+      return fSize;
+    }
+
+    inline std::size_t
+    NodeCache::getUsed (void) const
+    {
+      return fUsed;
+    }
+
+    inline std::size_t
+    NodeCache::getHits (void) const
+    {
+      return fHits;
+    }
+
+    inline std::size_t
+    NodeCache::getMisses (void) const
+    {
+      return fMisses;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_NODE_CACHE_H_ */
@@ -0,0 +1,450 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_OVERLAY_FILE_SYSTEM_H_
+#define POSIX_IO_OVERLAY_FILE_SYSTEM_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/path.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class OverlayFile;
+    class OverlayDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * File system presenting a read-only lower file system (for
+     * example the factory defaults in a RomFileSystem) with the
+     * changes kept in a writable upper file system.
+     *
+     * Both file systems must be mounted (anywhere), and stay mounted
+     * while the overlay is; the overlay is mounted with no block
+     * device, and uses the device of the upper file system. They must
+     * not be changed directly while the overlay is mounted.
+     *
+     * A path is looked up first in the upper file system, and, only
+     * if not there, in the lower one. A file of the lower file system
+     * is copied to the upper one when first opened for writing or
+     * changed, together with the missing parent directories. Removing
+     * a name also present in the lower file system creates a whiteout,
+     * a `.wh.<name>` file in the upper directory, and a directory
+     * created over a whiteout is marked opaque with a `.wh..wh..opq`
+     * file, such that the lower content is hidden; names starting
+     * with `.wh.` are reserved. Directories present in the lower file
+     * system cannot be renamed (EXDEV).
+     *
+     * The files and directories of the layers are opened from their
+     * own pools, one for each open file, and up to one from each
+     * layer for each open directory. A file opened for reading from
+     * the lower file system is not affected by a later copy up.
+     */
+    class OverlayFileSystem : public FileSystem
+    {
+      friend class OverlayFile;
+      friend class OverlayDirectory;
+
+    public:
+
+      /**
+       * @param filesPool A pool of OverlayFile objects.
+       * @param dirsPool A pool of OverlayDirectory objects.
+       * @param lower The read-only file system.
+       * @param upper The file system where the changes are written.
+       */
+      OverlayFileSystem (Pool* filesPool, Pool* dirsPool, FileSystem* lower,
+                         FileSystem* upper);
+      OverlayFileSystem (const OverlayFileSystem&) = delete;
+
+      virtual
+      ~OverlayFileSystem ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      FileSystem*
+      getLower (void) const;
+
+      FileSystem*
+      getUpper (void) const;
+
+      /**
+       * The number of files copied from the lower file system.
+       */
+      std::size_t
+      getCopyUps (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual void
+      do_sync (void) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+    private:
+
+      // Where a path was found.
+      enum Layer
+      {
+        UPPER = 1, LOWER = 2
+      };
+
+      /**
+       * Acquire the layers and lock the overlay.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      enter (void);
+
+      void
+      leave (void);
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+      /**
+       * Find `path`, in the upper file system, then in the lower one.
+       *
+       * @return UPPER or LOWER, with the status in `*buf`, or -1 and
+       * errno.
+       */
+      int
+      locate (const char* path, struct stat* buf);
+
+      /**
+       * Check that no parent directory of `path` in the upper file
+       * system hides the lower file system (whiteout, opaque
+       * directory or not a directory).
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      checkParents (const char* path);
+
+      /**
+       * @return true if `path` exists in the lower file system, and
+       * no parent directory hides it.
+       */
+      bool
+      inLower (const char* path, struct stat* buf);
+
+      /**
+       * @return true if `path` is a directory in the upper file
+       * system merged with a lower one.
+       */
+      bool
+      isMerged (const char* path);
+
+      bool
+      isWhiteout (const char* path);
+
+      /**
+       * Create the marker `name` in the upper file system.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      createMarker (const char* name);
+
+      int
+      createWhiteout (const char* path);
+
+      /**
+       * Create in the upper file system the parent directories
+       * of `path` present only in the lower one.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      copyUpParents (const char* path);
+
+      /**
+       * Copy a lower file or directory to the upper file system,
+       * with its parent directories; the file content only if `data`.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      copyUp (const char* path, const struct stat* st, bool data);
+
+      /**
+       * @return 0 if the merged directory has no entries, or -1 and
+       * errno (ENOTEMPTY).
+       */
+      int
+      checkEmpty (const char* path);
+
+      /**
+       * Remove the whiteouts and the opaque marker of an upper
+       * directory.
+       */
+      int
+      removeMarkers (const char* path);
+
+      /**
+       * Open a file, copying it up if opened for writing.
+       *
+       * @return The file of the layer, or nullptr and errno.
+       */
+      File*
+      openFile (const char* path, int oflag, std::va_list args);
+
+      /**
+       * Open the upper and the lower directories, the missing ones
+       * set to nullptr.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      openDirectory (const char* path, Directory** upper, Directory** lower);
+
+      /**
+       * @return true if the `name` of the lower directory `path`
+       * is present in the upper directory, or removed.
+       */
+      bool
+      isShadowed (const char* path, const char* name);
+
+      FileSystem* fLower;
+      FileSystem* fUpper;
+      std::size_t fCopyUps;
+      // The upper file system was changed, its PathCache entries
+      // must be invalidated by leave().
+      bool fChanged;
+
+      std::atomic_flag fLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class OverlayFile : public File
+    {
+      friend class OverlayFileSystem;
+
+    public:
+
+      OverlayFile ();
+      OverlayFile (const OverlayFile&) = delete;
+
+      virtual
+      ~OverlayFile ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * The file of the layer it was opened from.
+       */
+      File*
+      getLayerFile (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fallocate (int mode, off_t offset, off_t len) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+    private:
+
+      OverlayFileSystem*
+      getOverlayFileSystem (void) const;
+
+      File* fFile;
+    };
+
+    /**
+     * The upper directory is listed first, then the names of the
+     * lower directory not present in the upper one and not removed,
+     * each looked up in the upper file system as read; the entries
+     * are not buffered.
+     */
+    class OverlayDirectory : public Directory
+    {
+      friend class OverlayFileSystem;
+
+    public:
+
+      OverlayDirectory ();
+      OverlayDirectory (const OverlayDirectory&) = delete;
+
+      virtual
+      ~OverlayDirectory ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      OverlayFileSystem*
+      getOverlayFileSystem (void) const;
+
+      Directory* fUpper;
+      Directory* fLower;
+      // The upper directory was read to the end.
+      bool fUpperDone;
+      // The path of the directory, for the lookups in the upper
+      // file system.
+      char fDirPath[OS_INTEGER_PATH_MAX];
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline FileSystem*
+    OverlayFileSystem::getLower (void) const
+    {
+      return fLower;
+    }
+
+    inline FileSystem*
+    OverlayFileSystem::getUpper (void) const
+    {
+      return fUpper;
+    }
+
+    inline std::size_t
+    OverlayFileSystem::getCopyUps (void) const
+    {
+      return fCopyUps;
+    }
+
+    inline File*
+    OverlayFile::getLayerFile (void) const
+    {
+      return fFile;
+    }
+
+    inline OverlayFileSystem*
+    OverlayFile::getOverlayFileSystem (void) const
+    {
+      return static_cast<OverlayFileSystem*> (getFileSystem ());
+    }
+
+    inline OverlayFileSystem*
+    OverlayDirectory::getOverlayFileSystem (void) const
+    {
+      return static_cast<OverlayFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_OVERLAY_FILE_SYSTEM_H_ */
@@ -0,0 +1,269 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef POSIX_IO_PAGE_CACHE_H_
+#define POSIX_IO_PAGE_CACHE_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <sys/types.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class FileSystem;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Bounded cache of file data pages, shared by all file systems.
+     *
+     * Pages are keyed by the file system, the node (the inode number
+     * reported by stat()) and the page index in the file, such that
+     * all opens of the same file share the same pages, and a file
+     * opened again finds its data still in memory.
+     *
+     * Pages are referenced while the file system copies data in or out
+     * of them; written pages remain dirty until the file system writes
+     * them back, usually on fsync() or close(). Clean, unreferenced
+     * pages are recycled in least recently used order, such that the
+     * total memory used is the budget given to the constructor.
+     *
+     * The file system is responsible for dropping the pages of a node
+     * when the node is removed or truncated, and all its pages when
+     * it is mounted and unmounted.
+     *
+     * If no cache is constructed, nothing is cached.
+     */
+    class PageCache
+    {
+    public:
+
+      PageCache (std::size_t pages, std::size_t pageSize);
+      PageCache (const PageCache&) = delete;
+
+      ~PageCache ();
+
+      // ----------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Page
+      {
+        std::uint8_t* data;
+
+        // The owner; nullptr if the page is free.
+        FileSystem* fs;
+        ino_t node;
+        std::uint32_t index;
+
+        std::uint32_t refs;
+        bool dirty;
+
+        // Links in the hash bucket chain and in the LRU list.
+        std::size_t nextInBucket;
+        std::size_t newer;
+        std::size_t older;
+      };
+
+#pragma GCC diagnostic pop
+
+      /**
+       * @return The referenced page, or nullptr if not cached.
+       */
+      static Page*
+      find (FileSystem* fs, ino_t node, std::uint32_t index);
+
+      /**
+       * Take a free page, or recycle the least recently used clean and
+       * unreferenced one, for a page not cached. The content is
+       * undefined, the caller must fill it.
+       *
+       * @return The referenced page, or nullptr if all pages are
+       * referenced or dirty.
+       */
+      static Page*
+      grab (FileSystem* fs, ino_t node, std::uint32_t index);
+
+      static void
+      release (Page* page);
+
+      /**
+       * Release and drop a page whose content could not be filled.
+       */
+      static void
+      discard (Page* page);
+
+      static void
+      markDirty (Page* page);
+
+      static void
+      markClean (Page* page);
+
+      /**
+       * Iterate the dirty pages of a node; `*cursor` must be 0 at
+       * the first call. The page is returned referenced.
+       *
+       * @return false when there are no more dirty pages.
+       */
+      static bool
+      nextDirty (FileSystem* fs, ino_t node, std::size_t* cursor,
+                 Page** page);
+
+      /**
+       * Drop the pages of a node starting at `from`, dirty or not.
+       */
+      static void
+      invalidate (FileSystem* fs, ino_t node, std::uint32_t from = 0);
+
+      /**
+       * Drop all pages of `fs`, dirty or not.
+       */
+      static void
+      invalidate (FileSystem* fs);
+
+      // ----------------------------------------------------------------------
+
+      static std::size_t
+      getSize (void);
+
+      static std::size_t
+      getPageSize (void);
+
+      static std::size_t
+      getUsed (void);
+
+      static std::size_t
+      getDirty (void);
+
+      static std::size_t
+      getHits (void);
+
+      static std::size_t
+      getMisses (void);
+
+      // ----------------------------------------------------------------------
+
+    private:
+
+      static std::size_t
+      lookup (FileSystem* fs, ino_t node, std::uint32_t index);
+
+      static void
+      remove (std::size_t index);
+
+      static void
+      unlinkLru (std::size_t index);
+
+      static void
+      linkMru (std::size_t index);
+
+      static std::size_t
+      bucketOf (FileSystem* fs, ino_t node, std::uint32_t index);
+
+      static void
+      lock (void);
+
+      static void
+      unlock (void);
+
+    private:
+
+      static std::size_t sfSize;
+      static std::size_t sfPageSize;
+      static std::size_t sfBucketsMask;
+
+      static Page* sfPagesArray;
+      static std::uint8_t* sfData;
+      static std::size_t* sfBucketsArray;
+
+      // Most and least recently used pages.
+      static std::size_t sfMru;
+      static std::size_t sfLru;
+
+      static std::size_t sfUsed;
+      static std::size_t sfDirty;
+      static std::size_t sfHits;
+      static std::size_t sfMisses;
+
+      // Several file systems share the pages.
+      static std::atomic_flag sfLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    PageCache::getSize (void)
+    {
+      return sfSize;
+    }
+
+    inline std::size_t
+    PageCache::getPageSize (void)
+    {
+      return sfPageSize;
+    }
+
+    inline std::size_t
+    PageCache::getUsed (void)
+    {
+      return sfUsed;
+    }
+
+    inline std::size_t
+    PageCache::getDirty (void)
+    {
+      return sfDirty;
+    }
+
+    inline std::size_t
+    PageCache::getHits (void)
+    {
+      return sfHits;
+    }
+
+    inline std::size_t
+    PageCache::getMisses (void)
+    {
+      return sfMisses;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_PAGE_CACHE_H_ */
@@ -0,0 +1,208 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_PARTITION_BLOCK_DEVICE_H_
+#define POSIX_IO_PARTITION_BLOCK_DEVICE_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * A range of blocks of another block device, usually a partition,
+     * that can be mounted on its own.
+     *
+     * All transfers are translated and forwarded to the parent device,
+     * such that partitions of the same device share its cache and
+     * request queue when the parent is a BlockCache or a
+     * BlockRequestQueue.
+     */
+    class PartitionBlockDevice : public BlockDevice
+    {
+    public:
+
+      PartitionBlockDevice ();
+      PartitionBlockDevice (const PartitionBlockDevice&) = delete;
+
+      virtual
+      ~PartitionBlockDevice ();
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * Read the partition table of `device`, either GPT (the primary
+       * or, if damaged, the backup one) or MBR, including the logical
+       * partitions in an extended partition, and configure up to
+       * `count` partitions, in table order.
+       *
+       * @return The number of partitions configured, or -1 and errno
+       * (ENODEV if there is no valid partition table).
+       */
+      static int
+      scan (BlockDevice* device, PartitionBlockDevice* partitions,
+            std::size_t count);
+
+      /**
+       * @return 0, or -1 and errno (EINVAL if the range does not fit
+       * in the parent).
+       */
+      int
+      configure (BlockDevice* parent, blockNumber_t first,
+                 blockNumber_t count);
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      BlockDevice*
+      getParent (void) const;
+
+      blockNumber_t
+      getFirstBlock (void) const;
+
+      /**
+       * The MBR partition type (system id), 0 for GPT partitions.
+       */
+      std::uint8_t
+      getType (void) const;
+
+      /**
+       * The GPT partition type GUID, as stored on disk; all zeros
+       * for MBR partitions.
+       */
+      const std::uint8_t*
+      getTypeGuid (void) const;
+
+      /**
+       * The GPT partition name, non-ASCII characters replaced by '?';
+       * empty for MBR partitions.
+       */
+      const char*
+      getName (void) const;
+
+      /**
+       * The block numbers of the parent cache are not those of the
+       * partition, so metadata blocks cannot be pinned through it.
+       */
+      virtual BlockCache*
+      getBlockCache (void) override;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count)
+          override;
+
+      virtual ssize_t
+      do_readv (const struct iovec* iov, int iovcnt, blockNumber_t block)
+          override;
+
+      virtual ssize_t
+      do_writev (const struct iovec* iov, int iovcnt, blockNumber_t block)
+          override;
+
+      virtual int
+      do_flush (void) override;
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count) override;
+
+      virtual int
+      do_prefetch (blockNumber_t block, std::size_t count) override;
+
+      virtual int
+      do_submit (BlockRequest* request) override;
+
+    private:
+
+      static int
+      scanGpt (BlockDevice* device, std::uint8_t* buf, blockNumber_t lba,
+               PartitionBlockDevice* partitions, std::size_t count);
+
+      static int
+      scanMbr (BlockDevice* device, std::uint8_t* buf,
+               PartitionBlockDevice* partitions, std::size_t count);
+
+      BlockDevice* fParent;
+      blockNumber_t fFirstBlock;
+
+      std::uint8_t fTypeGuid[16];
+      char fName[37];
+      std::uint8_t fType;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline BlockDevice*
+    PartitionBlockDevice::getParent (void) const
+    {
+      return fParent;
+    }
+
+    inline BlockDevice::blockNumber_t
+    PartitionBlockDevice::getFirstBlock (void) const
+    {
+      return fFirstBlock;
+    }
+
+    inline std::uint8_t
+    PartitionBlockDevice::getType (void) const
+    {
+      return fType;
+    }
+
+    inline const std::uint8_t*
+    PartitionBlockDevice::getTypeGuid (void) const
+    {
+      return fTypeGuid;
+    }
+
+    inline const char*
+    PartitionBlockDevice::getName (void) const
+    {
+      return fName;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_PARTITION_BLOCK_DEVICE_H_ */
@@ -0,0 +1,310 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_PATH_CACHE_H_
+#define POSIX_IO_PATH_CACHE_H_
+
+// ----------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+// ----------------------------------------------------------------------------
+
+#if !defined(OS_INTEGER_PATH_CACHE_NAME_MAX)
+#define OS_INTEGER_PATH_CACHE_NAME_MAX  (64)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class FileSystem;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Bounded cache of resolved paths, shared by all file systems.
+     *
+     * Each entry maps a full path to the file system that serves it,
+     * the offset of the file system relative path (mount point prefix
+     * removed) and an optional file system specific node handle, such
+     * that repeated open()/stat()/opendir() calls skip the device and
+     * mount point identification, and the file system can skip its own
+     * path walk. Negative entries remember paths that do not exist.
+     *
+     * Entries are recycled in least recently used order. The layer
+     * functions invalidate the entries affected by rename(), unlink(),
+     * rmdir(), mount() and umount(); file systems that invalidate node
+     * handles by other means must call invalidate() themselves.
+     *
+     * The cache is optional: if none is constructed, all lookups
+     * miss and the paths are always resolved by the MountManager.
+     * All functions may be called from several threads; the entries
+     * are protected by a spin lock, held only while the cache itself
+     * is searched or changed. Lookups and additions do not wait for
+     * it: if another thread holds it, the lookup misses and the path
+     * is resolved by the lock-free MountManager lookup, and the
+     * addition is skipped; only the invalidations wait.
+     *
+     * An operation may find a path missing while another thread
+     * creates it or mounts over it, and add its outcome only after the
+     * invalidation. To not keep such stale entries, each invalidation
+     * increments a generation; resolve() returns the generation seen
+     * before the operation, and the outcome is added only if no
+     * invalidation ran since. The functions that change a path
+     * invalidate it, and add their own outcome with the generation
+     * returned by the invalidation.
+     */
+    class PathCache
+    {
+    public:
+
+      PathCache (std::size_t size);
+      PathCache (const PathCache&) = delete;
+
+      ~PathCache ();
+
+      // ----------------------------------------------------------------------
+
+      using result_t = unsigned int;
+      enum Result
+        : result_t
+          { MISS = 0,
+        FOUND = 1,
+        NOT_FOUND = 2
+      };
+
+      /**
+       * @return MISS if the path is not cached, FOUND with the file
+       * system, the adjusted path and the node handle, or NOT_FOUND
+       * with the file system and the adjusted path, if the path is
+       * known not to exist.
+       */
+      static Result
+      lookup (const char* path, FileSystem** fs, const char** adjustedPath,
+              void** node);
+
+      /**
+       * Like lookup(), but on MISS identify the file system with the
+       * MountManager; `*fs` may be nullptr if there is none.
+       * The file system is returned acquired (see
+       * FileSystem::acquire()), and must be released after use.
+       * `*generation` is the generation before the lookup, to be
+       * passed to add(), addNegative() or update().
+       */
+      static Result
+      resolve (const char* path, FileSystem** fs, const char** adjustedPath,
+               void** node, std::uint32_t* generation);
+
+      /**
+       * Remember that `path` is served by `fs` as `adjustedPath`, with
+       * an optional node handle; a null `node` does not overwrite a
+       * node handle already cached. Nothing is added if the cache
+       * was invalidated after `generation`.
+       */
+      static void
+      add (const char* path, FileSystem* fs, const char* adjustedPath,
+           void* node, std::uint32_t generation);
+
+      /**
+       * Remember that `path`, served by `fs`, does not exist, unless
+       * the cache was invalidated after `generation`.
+       */
+      static void
+      addNegative (const char* path, FileSystem* fs, const char* adjustedPath,
+                   std::uint32_t generation);
+
+      /**
+       * Record the outcome of an operation on an existing path: add
+       * the path if `ret` is 0, add a negative entry if it failed
+       * with ENOENT.
+       */
+      static void
+      update (const char* path, FileSystem* fs, const char* adjustedPath,
+              void* node, int ret, std::uint32_t generation);
+
+      /**
+       * Remove the entry of `path`, if any.
+       *
+       * @return The new generation.
+       */
+      static std::uint32_t
+      invalidate (const char* path);
+
+      /**
+       * Remove the entry of `path` and of all paths below it.
+       *
+       * @return The new generation.
+       */
+      static std::uint32_t
+      invalidatePrefix (const char* path);
+
+      /**
+       * Remove all entries referring to `fs`.
+       */
+      static void
+      invalidate (FileSystem* fs);
+
+      static void
+      clear (void);
+
+      // ----------------------------------------------------------------------
+
+      static std::size_t
+      getSize (void);
+
+      static std::size_t
+      getHits (void);
+
+      static std::size_t
+      getMisses (void);
+
+      static std::uint32_t
+      getGeneration (void);
+
+      // ----------------------------------------------------------------------
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Entry
+      {
+        // The file system; nullptr if the entry is free.
+        FileSystem* fs;
+        void* node;
+
+        // Links in the hash bucket chain and in the LRU list.
+        std::size_t nextInBucket;
+        std::size_t newer;
+        std::size_t older;
+
+        std::uint32_t hash;
+        std::uint16_t length;
+        std::uint16_t prefix;
+        bool negative;
+
+        char path[OS_INTEGER_PATH_CACHE_NAME_MAX];
+      };
+
+#pragma GCC diagnostic pop
+
+      static std::size_t
+      find (const char* path, std::uint32_t hash, std::size_t length);
+
+      static std::size_t
+      insert (const char* path, std::uint32_t hash, std::size_t length);
+
+      static void
+      remove (std::size_t index);
+
+      static void
+      unlinkLru (std::size_t index);
+
+      static void
+      linkMru (std::size_t index);
+
+      static std::size_t
+      bucketOf (std::uint32_t hash);
+
+      static void
+      lock (void);
+
+      static bool
+      tryLock (void);
+
+      static void
+      unlock (void);
+
+    private:
+
+      static std::size_t sfSize;
+      static std::size_t sfBucketsMask;
+
+      static Entry* sfEntriesArray;
+      static std::size_t* sfBucketsArray;
+
+      // Most and least recently used entries.
+      static std::size_t sfMru;
+      static std::size_t sfLru;
+
+      static std::size_t sfHits;
+      static std::size_t sfMisses;
+
+      // Lookups change the LRU list too.
+      static std::atomic_flag sfLock;
+
+      // Incremented with the lock held, read without it by resolve().
+      static std::atomic<std::uint32_t> sfGeneration;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    PathCache::getSize (void)
+    {
+      return sfSize;
+    }
+
+    inline std::size_t
+    PathCache::getHits (void)
+    {
+      return sfHits;
+    }
+
+    inline std::size_t
+    PathCache::getMisses (void)
+    {
+      return sfMisses;
+    }
+
+    inline std::uint32_t
+    PathCache::getGeneration (void)
+    {
+      return sfGeneration.load ();
+    }
+
+    inline std::size_t
+    PathCache::bucketOf (std::uint32_t hash)
+    {
+      return hash & sfBucketsMask;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_PATH_CACHE_H_ */
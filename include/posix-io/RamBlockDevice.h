@@ -0,0 +1,101 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_RAM_BLOCK_DEVICE_H_
+#define POSIX_IO_RAM_BLOCK_DEVICE_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/BlockDevice.h"
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Block device stored in RAM, either in a user provided area
+     * or dynamically allocated by the constructor.
+     */
+    class RamBlockDevice : public BlockDevice
+    {
+    public:
+
+      RamBlockDevice (std::size_t blockSize, blockNumber_t blocksCount);
+
+      RamBlockDevice (void* storage, std::size_t blockSize,
+                      blockNumber_t blocksCount);
+
+      RamBlockDevice (const RamBlockDevice&) = delete;
+
+      virtual
+      ~RamBlockDevice ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      std::uint8_t*
+      getStorage (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual ssize_t
+      do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+      virtual ssize_t
+      do_write (const void* buf, blockNumber_t block, std::size_t count)
+          override;
+
+      virtual int
+      do_discard (blockNumber_t block, std::size_t count) override;
+
+    private:
+
+      std::uint8_t* fStorage;
+      bool fAllocated;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline std::uint8_t*
+    RamBlockDevice::getStorage (void) const
+    {
+      return fStorage;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_RAM_BLOCK_DEVICE_H_ */
@@ -0,0 +1,434 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_ROM_FILE_SYSTEM_H_
+#define POSIX_IO_ROM_FILE_SYSTEM_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/BlockDevice.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+// The number of decompressed blocks kept in memory.
+#if !defined(OS_INTEGER_ROMFS_CACHE_BLOCKS)
+#define OS_INTEGER_ROMFS_CACHE_BLOCKS  (2)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class RamBlockDevice;
+    class RomFile;
+    class RomDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Read-only file system for static content, stored in an image
+     * built on the host by RomImageBuilder.
+     *
+     * The image is either memory mapped (for example in the internal
+     * flash), and passed to the constructor, or read from the block
+     * device passed to mount(); a memory mapped image is presented
+     * as a RamBlockDevice of 1 byte blocks, whatever device was given
+     * to mount(). The nodes of each directory are
+     * consecutive and sorted by name, such that a path component is
+     * looked up by a binary search.
+     *
+     * Files may be compressed in blocks, each one in the LZ4 block
+     * format, with the last OS_INTEGER_ROMFS_CACHE_BLOCKS
+     * decompressed blocks kept in memory. The data of the files not
+     * compressed in a memory mapped image is accessed in place:
+     * reading them is a memcpy(), and RomFile::getAddress() gives
+     * direct access to it (execute in place).
+     *
+     * All the functions changing the content fail with EROFS.
+     */
+    class RomFileSystem : public FileSystem
+    {
+      friend class RomFile;
+      friend class RomDirectory;
+
+    public:
+
+      // The image format, all numbers little endian: a header, the
+      // nodes (the root first), the names, and the file data.
+      static constexpr std::uint32_t IMAGE_MAGIC = 0x53464D52; // "RMFS"
+      static constexpr std::uint32_t IMAGE_VERSION = 1;
+      static constexpr std::size_t HEADER_SIZE = 32;
+      static constexpr std::size_t NODE_SIZE = 32;
+      // The file data is in blocks, each one compressed or not, after
+      // a table with the offsets of the blocks and of the end.
+      static constexpr std::uint16_t NODE_COMPRESSED = 1;
+
+      // ----------------------------------------------------------------------
+
+      /**
+       * @param filesPool A pool of RomFile objects.
+       * @param dirsPool A pool of RomDirectory objects.
+       * @param image The memory mapped image, or nullptr to read it
+       * from the block device passed to mount().
+       */
+      RomFileSystem (Pool* filesPool, Pool* dirsPool, const void* image =
+                         nullptr);
+      RomFileSystem (const RomFileSystem&) = delete;
+
+      virtual
+      ~RomFileSystem ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * The size of the compression blocks, 0 if not mounted.
+       */
+      std::size_t
+      getBlockSize (void) const;
+
+      /**
+       * The number of compressed blocks read from the cache, and
+       * decompressed.
+       */
+      std::size_t
+      getCacheHits (void) const;
+
+      std::size_t
+      getCacheMisses (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+      virtual int
+      do_unmount (unsigned int flags) override;
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      // A node, as decoded from the image.
+      struct Node
+      {
+        std::uint32_t mode;
+        std::uint32_t size;
+        std::uint32_t mtime;
+        std::uint32_t name;
+        std::uint16_t nameLength;
+        std::uint16_t flags;
+        // Directories: the first child and the number of children.
+        // Files: the offset of the data, or of the blocks table.
+        std::uint32_t first;
+        std::uint32_t count;
+      };
+
+      struct CacheEntry
+      {
+        std::uint8_t* data;
+        // The file by its first node, 0 if the entry is not used.
+        std::uint32_t file;
+        std::uint32_t block;
+        std::uint32_t stamp;
+      };
+
+#pragma GCC diagnostic pop
+
+      // ----------------------------------------------------------------------
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+      /**
+       * @return A pointer to `nbyte` bytes of the image at `offset`,
+       * if the image is memory mapped, otherwise nullptr.
+       */
+      const std::uint8_t*
+      mapped (std::uint32_t offset, std::size_t nbyte) const;
+
+      /**
+       * Copy `nbyte` bytes of the image at `offset`.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      readImage (std::uint32_t offset, void* buf, std::size_t nbyte);
+
+      int
+      readNode (std::uint32_t index, Node* node);
+
+      /**
+       * Binary search of `name` in the directory `dir`.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      lookup (const Node* dir, const char* name, std::size_t len,
+              std::uint32_t* index, Node* node);
+
+      int
+      find (const char* path, std::uint32_t* index, Node* node);
+
+      void
+      fillStat (std::uint32_t index, const Node* node, struct stat* buf);
+
+      /**
+       * Copy `nbyte` bytes at `offset` from a file.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      readData (std::uint32_t index, const Node* node, std::size_t offset,
+                void* buf, std::size_t nbyte);
+
+      /**
+       * @return The decompressed block, or nullptr and errno.
+       */
+      const std::uint8_t*
+      loadBlock (std::uint32_t index, const Node* node, std::uint32_t block);
+
+      const std::uint8_t* fImage;
+      // The device presenting the memory mapped image.
+      RamBlockDevice* fImageDevice;
+      std::uint32_t fImageSize;
+      std::uint32_t fNodesCount;
+      std::uint32_t fNodesOffset;
+      std::size_t fBlockSize;
+
+      CacheEntry fCache[OS_INTEGER_ROMFS_CACHE_BLOCKS];
+      std::uint32_t fStamp;
+      std::size_t fCacheHits;
+      std::size_t fCacheMisses;
+
+      // The compressed block, and a block of the device, when the
+      // image is not memory mapped.
+      std::uint8_t* fCompressed;
+      std::uint8_t* fDeviceBlock;
+
+      std::atomic_flag fLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class RomFile : public File
+    {
+      friend class RomFileSystem;
+
+    public:
+
+      RomFile ();
+      RomFile (const RomFile&) = delete;
+
+      virtual
+      ~RomFile ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      /**
+       * The file data in the memory mapped image, or nullptr if the
+       * file is compressed or the image is read from a block device.
+       */
+      const void*
+      getAddress (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      RomFileSystem*
+      getRomFileSystem (void) const;
+
+      RomFileSystem::Node fNode;
+      std::uint32_t fIndex;
+      const std::uint8_t* fAddress;
+      off_t fOffset;
+    };
+
+    class RomDirectory : public Directory
+    {
+      friend class RomFileSystem;
+
+    public:
+
+      RomDirectory ();
+      RomDirectory (const RomDirectory&) = delete;
+
+      virtual
+      ~RomDirectory ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual struct dirent*
+      do_read_plus (struct stat* buf) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      RomFileSystem*
+      getRomFileSystem (void) const;
+
+      // The children of the directory, and the next one.
+      std::uint32_t fFirst;
+      std::uint32_t fCount;
+      std::uint32_t fCursor;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline std::size_t
+    RomFileSystem::getBlockSize (void) const
+    {
+      return fBlockSize;
+    }
+
+    inline std::size_t
+    RomFileSystem::getCacheHits (void) const
+    {
+      return fCacheHits;
+    }
+
+    inline std::size_t
+    RomFileSystem::getCacheMisses (void) const
+    {
+      return fCacheMisses;
+    }
+
+    inline const void*
+    RomFile::getAddress (void) const
+    {
+      return fAddress;
+    }
+
+    inline RomFileSystem*
+    RomFile::getRomFileSystem (void) const
+    {
+      return static_cast<RomFileSystem*> (getFileSystem ());
+    }
+
+    inline RomFileSystem*
+    RomDirectory::getRomFileSystem (void) const
+    {
+      return static_cast<RomFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_ROM_FILE_SYSTEM_H_ */
@@ -0,0 +1,167 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_ROM_IMAGE_BUILDER_H_
+#define POSIX_IO_ROM_IMAGE_BUILDER_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Build an image for RomFileSystem, meant to run on the host,
+     * for example in a tool walking a directory tree, with the result
+     * linked in the application or written to a partition.
+     *
+     * The missing parent directories are added as needed. Files are
+     * compressed in blocks, each one stored as it is if it does not
+     * get smaller; a file with no compressible block is stored as it
+     * is, such that it can be accessed in place.
+     */
+    class RomImageBuilder
+    {
+    public:
+
+      /**
+       * @param blockSize The size of the compression blocks, a power
+       * of 2 between 64 and 65536; larger blocks compress better, but
+       * take more RAM in the file system cache.
+       */
+      RomImageBuilder (std::size_t blockSize = 4096);
+      RomImageBuilder (const RomImageBuilder&) = delete;
+
+      ~RomImageBuilder ();
+
+      /**
+       * @return 0, or -1 and errno (EEXIST, ENOTDIR, EINVAL,
+       * ENAMETOOLONG).
+       */
+      int
+      addDirectory (const char* path, mode_t mode = 0755,
+                    std::time_t mtime = 0);
+
+      /**
+       * Add a file, with a copy of the content.
+       *
+       * @return 0, or -1 and errno (EEXIST, ENOTDIR, EINVAL,
+       * ENAMETOOLONG).
+       */
+      int
+      addFile (const char* path, const void* data, std::size_t size,
+               bool compress = true, mode_t mode = 0644,
+               std::time_t mtime = 0);
+
+      /**
+       * Build the image from the entries added so far.
+       *
+       * @return 0, or -1 and errno (EFBIG if larger than 4 GiB).
+       */
+      int
+      build (void);
+
+      const std::uint8_t*
+      getImage (void) const;
+
+      std::size_t
+      getImageSize (void) const;
+
+    private:
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Entry
+      {
+        std::string name;
+        std::size_t parent;
+        std::vector<std::size_t> children;
+        std::uint32_t mode;
+        std::uint32_t mtime;
+        bool compress;
+        std::vector<std::uint8_t> data;
+      };
+
+#pragma GCC diagnostic pop
+
+      /**
+       * Add an entry, and its missing parents.
+       *
+       * @return The new entry, or 0 and errno.
+       */
+      std::size_t
+      add (const char* path, std::uint32_t mode, std::time_t mtime);
+
+      std::size_t
+      child (std::size_t dir, const std::string& name) const;
+
+      /**
+       * Append the data of a file to the image.
+       *
+       * @return The offset of the data, and the flags of the node.
+       */
+      std::size_t
+      appendData (const Entry& entry, std::uint16_t* flags);
+
+      std::size_t fBlockSize;
+      std::vector<Entry> fEntries;
+      std::vector<std::uint8_t> fImage;
+    };
+
+    // ------------------------------------------------------------------------
+
+    inline const std::uint8_t*
+    RomImageBuilder::getImage (void) const
+    {
+      return fImage.data ();
+    }
+
+    inline std::size_t
+    RomImageBuilder::getImageSize (void) const
+    {
+      return fImage.size ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_ROM_IMAGE_BUILDER_H_ */
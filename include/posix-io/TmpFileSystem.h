@@ -0,0 +1,530 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_TMP_FILE_SYSTEM_H_
+#define POSIX_IO_TMP_FILE_SYSTEM_H_
+
+// ----------------------------------------------------------------------------
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/BlockDevice.h"
+
+#include <atomic>
+#include <ctime>
+
+// ----------------------------------------------------------------------------
+
+// The longest name of a file or directory.
+#if !defined(OS_INTEGER_TMPFS_NAME_MAX)
+#define OS_INTEGER_TMPFS_NAME_MAX  (31)
+#endif
+
+// The number of extents (runs of consecutive arena blocks) of a file.
+#if !defined(OS_INTEGER_TMPFS_EXTENTS)
+#define OS_INTEGER_TMPFS_EXTENTS  (4)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    class RamBlockDevice;
+    class TmpFile;
+    class TmpDirectory;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * File system keeping everything in RAM, for scratch files and
+     * as a reference for measuring the upper layers.
+     *
+     * The file data is stored in the blocks of a dedicated
+     * RamBlockDevice (the arena), accessed directly, in up to
+     * OS_INTEGER_TMPFS_EXTENTS runs of consecutive blocks per file;
+     * a file growing past its last extent is moved to a single
+     * larger one; fallocate() reserves the blocks in advance, kept
+     * beyond the size until the file is truncated. The nodes are
+     * kept in a fixed table, and the directory entries in a hash
+     * table keyed by the parent node and the name, such that
+     * looking up a path component does not scan the directory.
+     *
+     * The contents are lost when the file system is mounted again;
+     * the block device passed to mount() is replaced by the arena.
+     * The access times are only changed by utime().
+     *
+     * The file system is thread safe, all operations are serialised
+     * by a lock.
+     */
+    class TmpFileSystem : public FileSystem
+    {
+      friend class TmpFile;
+      friend class TmpDirectory;
+
+    public:
+
+      /**
+       * @param filesPool A pool of TmpFile objects.
+       * @param dirsPool A pool of TmpDirectory objects.
+       * @param arena The device holding the file data.
+       * @param nodesCount The maximum number of files and directories,
+       * including the root directory.
+       */
+      TmpFileSystem (Pool* filesPool, Pool* dirsPool, RamBlockDevice* arena,
+                     std::size_t nodesCount);
+
+      TmpFileSystem (const TmpFileSystem&) = delete;
+
+      virtual
+      ~TmpFileSystem ();
+
+      // ----------------------------------------------------------------------
+      // Support functions.
+
+      RamBlockDevice*
+      getArena (void) const;
+
+      std::size_t
+      getFreeBlocks (void) const;
+
+      std::size_t
+      getFreeNodes (void) const;
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_chmod (const char* path, mode_t mode) override;
+
+      virtual int
+      do_stat (const char* path, struct stat* buf) override;
+
+      virtual int
+      do_truncate (const char* path, off_t length) override;
+
+      virtual int
+      do_rename (const char* existing, const char* _new) override;
+
+      virtual int
+      do_unlink (const char* path) override;
+
+      virtual int
+      do_utime (const char* path, const struct utimbuf* times) override;
+
+      virtual int
+      do_mkdir (const char* path, mode_t mode) override;
+
+      virtual int
+      do_rmdir (const char* path) override;
+
+      virtual void
+      do_sync (void) override;
+
+      virtual int
+      do_statat (Directory* dir, const char* path, struct stat* buf)
+          override;
+
+      virtual int
+      do_mkdirat (Directory* dir, const char* path, mode_t mode) override;
+
+      virtual int
+      do_unlinkat (Directory* dir, const char* path, int flag) override;
+
+      virtual int
+      do_renameat (Directory* olddir, const char* existing, Directory* newdir,
+                   const char* _new) override;
+
+      virtual int
+      do_mount (unsigned int flags) override;
+
+      virtual int
+      do_unmount (unsigned int flags) override;
+
+    private:
+
+      using blockNumber_t = BlockDevice::blockNumber_t;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+      struct Extent
+      {
+        blockNumber_t block;
+        blockNumber_t count;
+      };
+
+      struct Node
+      {
+        // The parent directory; the root is its own parent.
+        std::size_t parent;
+        // Next node in the same hash bucket, or in the free list.
+        std::size_t hashNext;
+        // The entries of a directory, newest first.
+        std::size_t firstChild;
+        std::size_t nextSibling;
+        std::size_t prevSibling;
+
+        off_t size;
+        std::time_t atime;
+        std::time_t mtime;
+        std::time_t ctime;
+
+        std::uint32_t hash;
+        // 0 for free nodes.
+        mode_t mode;
+        // Open files and directory streams.
+        unsigned int opens;
+        // Removed while open, freed by the last close.
+        bool unlinked;
+
+        std::size_t extentsCount;
+        Extent extents[OS_INTEGER_TMPFS_EXTENTS];
+
+        char name[OS_INTEGER_TMPFS_NAME_MAX + 1];
+      };
+
+#pragma GCC diagnostic pop
+
+      // ----------------------------------------------------------------------
+
+      void
+      lock (void);
+
+      void
+      unlock (void);
+
+      void
+      format (void);
+
+      std::size_t
+      indexOf (void* node) const;
+
+      /**
+       * Walk all but the last component of `path`, from `start`.
+       * `*len` is 0 if `path` has no components, and `*parent` is
+       * then the node itself.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      resolve (std::size_t start, const char* path, std::size_t* parent,
+               const char** name, std::size_t* len) const;
+
+      /**
+       * @return The node referred by `path`, or noEntry and errno.
+       */
+      std::size_t
+      find (std::size_t start, const char* path) const;
+
+      std::size_t
+      lookup (std::size_t dir, const char* name, std::size_t len) const;
+
+      std::size_t
+      create (std::size_t dir, const char* name, std::size_t len,
+              mode_t mode);
+
+      void
+      attach (std::size_t dir, std::size_t node);
+
+      void
+      detach (std::size_t node);
+
+      /**
+       * Remove the directory entry; the node is freed now, or by
+       * the last close if open.
+       */
+      void
+      remove (std::size_t node);
+
+      void
+      closeNode (std::size_t node);
+
+      void
+      freeNode (std::size_t node);
+
+      void
+      fillStat (std::size_t node, struct stat* buf) const;
+
+      /**
+       * The node of a directory opened on this file system.
+       *
+       * @return 0, or -1 and errno.
+       */
+      int
+      startOf (Directory* dir, std::size_t* start) const;
+
+      // The implementations of the path functions, relative to the
+      // `start` directory, with the lock taken.
+
+      int
+      statFrom (std::size_t start, const char* path, struct stat* buf);
+
+      int
+      mkdirFrom (std::size_t start, const char* path, mode_t mode);
+
+      int
+      unlinkFrom (std::size_t start, const char* path, bool directory);
+
+      int
+      renameFrom (std::size_t oldstart, const char* existing,
+                  std::size_t newstart, const char* _new);
+
+      // Data.
+
+      std::size_t
+      capacity (const Node* node) const;
+
+      /**
+       * Make room for `length` bytes, as far as possible.
+       *
+       * @return The new capacity, in bytes.
+       */
+      std::size_t
+      reserve (Node* node, std::size_t length);
+
+      /**
+       * Free the blocks beyond `length` bytes.
+       */
+      void
+      trim (Node* node, std::size_t length);
+
+      int
+      resize (Node* node, off_t length);
+
+      bool
+      relocate (Node* node, blockNumber_t blocks);
+
+      /**
+       * Copy `nbyte` bytes at `offset` from `src` to the file, or
+       * from the file to `dst`; if both are null, clear them. The
+       * range must be within the capacity.
+       */
+      void
+      transfer (const Node* node, std::size_t offset, const void* src,
+                void* dst, std::size_t nbyte) const;
+
+      // Arena blocks.
+
+      bool
+      isFree (blockNumber_t block) const;
+
+      void
+      markBlocks (blockNumber_t block, blockNumber_t count, bool used);
+
+      /**
+       * Find the first run of `count` free blocks, or else the
+       * longest one.
+       */
+      blockNumber_t
+      findBlocks (blockNumber_t count, blockNumber_t* found) const;
+
+      // ----------------------------------------------------------------------
+
+      RamBlockDevice* fArena;
+      std::uint8_t* fStorage;
+      std::size_t fBlockSize;
+      blockNumber_t fBlocksCount;
+      blockNumber_t fFreeBlocks;
+      // One bit per block, set when used.
+      std::uint32_t* fBitmap;
+
+      Node* fNodes;
+      std::size_t fNodesCount;
+      std::size_t fFreeNodes;
+      std::size_t fFreeList;
+
+      std::size_t* fBuckets;
+      std::size_t fBucketsMask;
+
+      std::atomic_flag fLock;
+    };
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+    class TmpFile : public File
+    {
+      friend class TmpFileSystem;
+
+    public:
+
+      TmpFile ();
+      TmpFile (const TmpFile&) = delete;
+
+      virtual
+      ~TmpFile ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual int
+      do_vopen (const char* path, int oflag, std::va_list args) override;
+
+      virtual int
+      do_vopenat (Directory* dir, const char* path, int oflag,
+                  std::va_list args) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual ssize_t
+      do_read (void* buf, std::size_t nbyte) override;
+
+      virtual ssize_t
+      do_write (const void* buf, std::size_t nbyte) override;
+
+      virtual off_t
+      do_lseek (off_t offset, int whence) override;
+
+      virtual int
+      do_ftruncate (off_t length) override;
+
+      virtual int
+      do_fsync (void) override;
+
+      virtual int
+      do_fallocate (int mode, off_t offset, off_t len) override;
+
+      virtual int
+      do_fstat (struct stat* buf) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      TmpFileSystem*
+      getTmpFileSystem (void) const;
+
+      int
+      open (std::size_t start, const char* path, int oflag,
+            std::va_list args);
+
+      std::size_t fIndex;
+      off_t fOffset;
+      int fFlags;
+    };
+
+    class TmpDirectory : public Directory
+    {
+      friend class TmpFileSystem;
+
+    public:
+
+      TmpDirectory ();
+      TmpDirectory (const TmpDirectory&) = delete;
+
+      virtual
+      ~TmpDirectory ();
+
+    protected:
+
+      // ----------------------------------------------------------------------
+      // Implementations.
+
+      virtual Directory*
+      do_vopen (const char* dirname) override;
+
+      virtual struct dirent*
+      do_read (void) override;
+
+      virtual struct dirent*
+      do_read_plus (struct stat* buf) override;
+
+      virtual ssize_t
+      do_read_batch (void* buf, std::size_t size) override;
+
+      virtual void
+      do_rewind (void) override;
+
+      virtual int
+      do_close (void) override;
+
+      virtual void
+      do_release (void) override;
+
+    private:
+
+      TmpFileSystem*
+      getTmpFileSystem (void) const;
+
+      std::size_t fIndex;
+      // The next entry to return.
+      std::size_t fCursor;
+    };
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    inline RamBlockDevice*
+    TmpFileSystem::getArena (void) const
+    {
+      return fArena;
+    }
+
+    inline std::size_t
+    TmpFileSystem::getFreeBlocks (void) const
+    {
+      return fFreeBlocks;
+    }
+
+    inline std::size_t
+    TmpFileSystem::getFreeNodes (void) const
+    {
+      return fFreeNodes;
+    }
+
+    inline TmpFileSystem*
+    TmpFile::getTmpFileSystem (void) const
+    {
+      return static_cast<TmpFileSystem*> (getFileSystem ());
+    }
+
+    inline TmpFileSystem*
+    TmpDirectory::getTmpFileSystem (void) const
+    {
+      return static_cast<TmpFileSystem*> (getFileSystem ());
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_TMP_FILE_SYSTEM_H_ */
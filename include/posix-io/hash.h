@@ -0,0 +1,111 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_HASH_H_
+#define POSIX_IO_HASH_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * 32-bit FNV-1a hash of a string. If `length` is not null, the
+     * string length is also returned, to avoid a separate strlen().
+     */
+    inline std::uint32_t
+    hashString (const char* str, std::size_t* length = nullptr)
+    {
+      std::uint32_t hash = 2166136261u;
+      const char* p = str;
+      for (; *p != '\0'; ++p)
+        {
+          hash ^= static_cast<std::uint8_t> (*p);
+          hash *= 16777619u;
+        }
+
+      if (length != nullptr)
+        {
+          *length = static_cast<std::size_t> (p - str);
+        }
+      return hash;
+    }
+
+    /**
+     * 32-bit FNV-1a hash of a buffer of known length.
+     */
+    inline std::uint32_t
+    hashBuffer (const char* buf, std::size_t length)
+    {
+      std::uint32_t hash = 2166136261u;
+      for (std::size_t i = 0; i < length; ++i)
+        {
+          hash ^= static_cast<std::uint8_t> (buf[i]);
+          hash *= 16777619u;
+        }
+      return hash;
+    }
+
+    /**
+     * CRC-32 (IEEE 802.3, as used by GPT, zlib, PNG); pass the
+     * previous result as `crc` to continue over several buffers.
+     * A 16 entries table keeps it small.
+     */
+    inline std::uint32_t
+    crc32 (const void* buf, std::size_t length, std::uint32_t crc = 0)
+    {
+      static const std::uint32_t table[16] =
+        { 0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u,
+            0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu, 0xEDB88320u, 0xF00F9344u,
+            0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u,
+            0xBDBDF21Cu };
+
+      auto* p = static_cast<const std::uint8_t*> (buf);
+      crc = ~crc;
+      for (std::size_t i = 0; i < length; ++i)
+        {
+          crc ^= p[i];
+          crc = (crc >> 4) ^ table[crc & 0x0F];
+          crc = (crc >> 4) ^ table[crc & 0x0F];
+        }
+      return ~crc;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_HASH_H_ */
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_LZ4_H_
+#define POSIX_IO_LZ4_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+
+#include <sys/types.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Compress a buffer in the LZ4 block format (no frame), with a
+     * single pass greedy search. Meant for the tools building images
+     * on the host; it uses 16 KiB of stack for the hash table.
+     *
+     * @return The compressed size, or 0 if it does not fit in
+     * `capacity` bytes (the data should then be stored as it is).
+     */
+    std::size_t
+    lz4Compress (const void* src, std::size_t length, void* dst,
+                 std::size_t capacity);
+
+    /**
+     * Decompress a buffer in the LZ4 block format. Damaged input is
+     * detected and never read or written out of the buffers.
+     *
+     * @return The decompressed size, or -1 if the input is damaged or
+     * it does not fit in `capacity` bytes.
+     */
+    ssize_t
+    lz4Decompress (const void* src, std::size_t length, void* dst,
+                   std::size_t capacity);
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_LZ4_H_ */
@@ -63,9 +63,19 @@ extern "C"
   int __attribute__((weak, alias ("__posix_connect")))
   connect (int socket, const struct sockaddr* address, socklen_t address_len);
 
+  int __attribute__((weak, alias ("__posix_dirfd")))
+  dirfd (DIR* dirp);
+
   int __attribute__((weak, alias ("__posix_execve")))
   _execve (const char* path, char* const argv[], char* const envp[]);
 
+  int __attribute__((weak, alias ("__posix_fallocate")))
+  fallocate (int fildes, int mode, off_t offset, off_t len);
+
+  DIR*
+  __attribute__((weak, alias ("__posix_fdopendir")))
+  fdopendir (int fildes);
+
   int __attribute__((weak, alias ("__posix_fcntl")))
   fcntl (int fildes, int cmd, ...);
 
@@ -75,6 +85,9 @@ extern "C"
   int __attribute__((weak, alias ("__posix_fstat")))
   _fstat (int fildes, struct stat* buf);
 
+  int __attribute__((weak, alias ("__posix_fstatat")))
+  fstatat (int fildes, const char* path, struct stat* buf, int flag);
+
   int __attribute__((weak, alias ("__posix_ftruncate")))
   ftruncate (int fildes, off_t length);
 
@@ -122,13 +135,28 @@ extern "C"
   int __attribute__((weak, alias ("__posix_mkdir")))
   mkdir (const char* path, mode_t mode);
 
+  int __attribute__((weak, alias ("__posix_mkdirat")))
+  mkdirat (int fildes, const char* path, mode_t mode);
+
   int __attribute__((weak, alias ("__posix_open")))
   _open (const char* path, int oflag, ...);
 
+  int __attribute__((weak, alias ("__posix_openat")))
+  openat (int fildes, const char* path, int oflag, ...);
+
   DIR*
   __attribute__((weak, alias ("__posix_opendir")))
   opendir (const char* dirname);
 
+  int __attribute__((weak, alias ("__posix_posix_fadvise")))
+  posix_fadvise (int fildes, off_t offset, off_t len, int advice);
+
+  int __attribute__((weak, alias ("__posix_posix_fallocate")))
+  posix_fallocate (int fildes, off_t offset, off_t len);
+
+  ssize_t __attribute__((weak, alias ("__posix_posix_getdents")))
+  posix_getdents (int fildes, void* buf, size_t nbyte, int flags);
+
   int __attribute__((weak, alias ("__posix_raise")))
   raise (int sig);
 
@@ -139,6 +167,10 @@ extern "C"
   __attribute__((weak, alias ("__posix_readdir")))
   readdir (DIR* dirp);
 
+  struct dirent*
+  __attribute__((weak, alias ("__posix_readdir_plus")))
+  readdir_plus (DIR* dirp, struct stat* buf);
+
   int __attribute__((weak, alias ("__posix_readdir_r")))
   readdir_r (DIR* dirp, struct dirent* entry, struct dirent** result);
 
@@ -158,6 +190,9 @@ extern "C"
   int __attribute__((weak, alias ("__posix_rename")))
   rename (const char* oldfn, const char* newfn);
 
+  int __attribute__((weak, alias ("__posix_renameat")))
+  renameat (int oldfd, const char* oldfn, int newfd, const char* newfn);
+
   void __attribute__((weak, alias ("__posix_rewinddir")))
   rewinddir (DIR* dirp);
 
@@ -217,6 +252,9 @@ extern "C"
   int __attribute__((weak, alias ("__posix_unlink")))
   _unlink (const char* name);
 
+  int __attribute__((weak, alias ("__posix_unlinkat")))
+  unlinkat (int fildes, const char* name, int flag);
+
   int __attribute__((weak, alias ("__posix_utime")))
   utime (const char* path, const struct utimbuf* times);
 
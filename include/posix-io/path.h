@@ -0,0 +1,102 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef POSIX_IO_PATH_H_
+#define POSIX_IO_PATH_H_
+
+// ----------------------------------------------------------------------------
+
+#include <cstddef>
+
+// ----------------------------------------------------------------------------
+
+#if !defined(OS_INTEGER_PATH_MAX)
+#define OS_INTEGER_PATH_MAX  (256)
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * Make `path` absolute, relative to the current directory, and
+     * remove the `.` and `..` components and the repeated `/`, in a
+     * single pass, without allocations. A trailing `/` is preserved.
+     *
+     * @return `path` itself, if already absolute and normalized,
+     * otherwise `buf`, or nullptr and errno (ENAMETOOLONG).
+     */
+    const char*
+    normalizePath (const char* path, char* buf, std::size_t size);
+
+    /**
+     * Append the relative `path` to the normalized directory path
+     * `dirpath`, removing the `.` and `..` components and the repeated
+     * `/`, like normalizePath(). A trailing `/` is preserved.
+     *
+     * @return `buf`, or nullptr and errno (ENAMETOOLONG).
+     */
+    const char*
+    joinPath (const char* dirpath, const char* path, char* buf,
+              std::size_t size);
+
+    /**
+     * Get the storage of the current directory, OS_INTEGER_PATH_MAX
+     * bytes, holding a normalized absolute path; an empty string is
+     * the root directory.
+     *
+     * The default implementation returns a single static buffer, the
+     * current directory of the whole process, like on POSIX systems;
+     * redefine it to return a thread specific buffer if each thread
+     * needs its own. The buffer is changed by chdir() and read by
+     * normalizePath() and getcwd() only with the current directory
+     * lock held; others must hold it too, otherwise they can see a
+     * path partly rewritten by a concurrent chdir().
+     */
+    char*
+    getCurrentDirectoryBuffer (void);
+
+    /**
+     * Spin lock protecting the content of the current directory
+     * buffer; held only while the path is copied.
+     */
+    void
+    lockCurrentDirectory (void);
+
+    void
+    unlockCurrentDirectory (void);
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* POSIX_IO_PATH_H_ */
@@ -40,10 +40,14 @@
 #define __posix_close close
 #define __posix_closedir closedir
 #define __posix_connect connect
+#define __posix_dirfd dirfd
 #define __posix_execve execve
+#define __posix_fallocate fallocate
+#define __posix_fdopendir fdopendir
 #define __posix_fcntl fcntl
 #define __posix_fork fork
 #define __posix_fstat fstat
+#define __posix_fstatat fstatat
 #define __posix_ftruncate ftruncate
 #define __posix_fsync fsync
 #define __posix_getcwd getcwd
@@ -59,17 +63,24 @@
 #define __posix_listen listen
 #define __posix_lseek lseek
 #define __posix_mkdir mkdir
+#define __posix_mkdirat mkdirat
 #define __posix_open open
+#define __posix_openat openat
 #define __posix_opendir opendir
+#define __posix_posix_fadvise posix_fadvise
+#define __posix_posix_fallocate posix_fallocate
+#define __posix_posix_getdents posix_getdents
 #define __posix_raise raise
 #define __posix_read read
 #define __posix_readdir readdir
+#define __posix_readdir_plus readdir_plus
 #define __posix_readdir_r readdir_r
 #define __posix_readlink readlink
 #define __posix_recv recv
 #define __posix_recvfrom recvfrom
 #define __posix_recvmsg recvmsg
 #define __posix_rename rename
+#define __posix_renameat renameat
 #define __posix_rewinddir rewinddir
 #define __posix_rmdir rmdir
 #define __posix_select select
@@ -88,6 +99,7 @@
 #define __posix_times times
 #define __posix_truncate truncate
 #define __posix_unlink unlink
+#define __posix_unlinkat unlinkat
 #define __posix_utime utime
 #define __posix_wait wait
 #define __posix_write write
@@ -35,6 +35,37 @@
 #include "posix/dirent.h"
 #include "posix/sys/socket.h"
 
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+// The *at() functions definitions, if not provided by the system headers.
+
+#if !defined(AT_FDCWD)
+#define AT_FDCWD (-2)
+#endif
+
+#if !defined(AT_REMOVEDIR)
+#define AT_REMOVEDIR (8)
+#endif
+
+// The posix_fadvise() advices, if not provided by the system headers.
+
+#if !defined(POSIX_FADV_NORMAL)
+#define POSIX_FADV_NORMAL (0)
+#define POSIX_FADV_RANDOM (1)
+#define POSIX_FADV_SEQUENTIAL (2)
+#define POSIX_FADV_WILLNEED (3)
+#define POSIX_FADV_DONTNEED (4)
+#define POSIX_FADV_NOREUSE (5)
+#endif
+
+// The fallocate() modes, if not provided by the system headers.
+
+#if !defined(FALLOC_FL_KEEP_SIZE)
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+
 // ----------------------------------------------------------------------------
 
 #ifdef __cplusplus
@@ -93,9 +124,32 @@ extern "C"
   __posix_connect (int socket, const struct sockaddr* address,
                    socklen_t address_len);
 
+  int __attribute__((weak))
+  __posix_dirfd (DIR* dirp);
+
   int __attribute__((weak))
   __posix_execve (const char* path, char* const argv[], char* const envp[]);
 
+  /**
+   * @brief Allocate the storage of a file range in advance.
+   *
+   * @headerfile <fcntl.h>
+   *
+   * @param [in] fildes An open file descriptor.
+   * @param [in] mode 0, or FALLOC_FL_KEEP_SIZE to not change the size.
+   * @param [in] offset The start of the file range.
+   * @param [in] len The length of the range.
+   *
+   * @return 0, or -1 and errno (EOPNOTSUPP if the file system
+   * cannot allocate in advance).
+   */
+  int __attribute__((weak))
+  __posix_fallocate (int fildes, int mode, off_t offset, off_t len);
+
+  DIR*
+  __attribute__((weak))
+  __posix_fdopendir (int fildes);
+
   int __attribute__((weak))
   __posix_fcntl (int fildes, int cmd, ...);
 
@@ -105,6 +159,9 @@ extern "C"
   int __attribute__((weak))
   __posix_fstat (int fildes, struct stat* buf);
 
+  int __attribute__((weak))
+  __posix_fstatat (int fildes, const char* path, struct stat* buf, int flag);
+
   int __attribute__((weak))
   __posix_ftruncate (int fildes, off_t length);
 
@@ -166,6 +223,9 @@ extern "C"
   int __attribute__((weak))
   __posix_mkdir (const char* path, mode_t mode);
 
+  int __attribute__((weak))
+  __posix_mkdirat (int fildes, const char* path, mode_t mode);
+
   /**
    * @brief Open file relative to directory file descriptor.
    *
@@ -184,10 +244,76 @@ extern "C"
   int __attribute__((weak))
   __posix_open (const char* path, int oflag, ...);
 
+  /**
+   * @brief Open file relative to directory file descriptor.
+   *
+   * @headerfile <fcntl.h>
+   *
+   * @param [in] fildes A directory file descriptor, or AT_FDCWD.
+   * @param [in] path The _path_ argument points to a pathname naming the file;
+   * if relative, it is resolved relative to the directory associated
+   * with _fildes_ instead of the current directory.
+   * @param [in] oflag Same as for `open()`.
+   *
+   * @return Same as for `open()`.
+   */
+  int __attribute__((weak))
+  __posix_openat (int fildes, const char* path, int oflag, ...);
+
   DIR*
   __attribute__((weak))
   __posix_opendir (const char* dirname);
 
+  /**
+   * @brief Advise on the expected access pattern of a file.
+   *
+   * @headerfile <fcntl.h>
+   *
+   * @param [in] fildes An open file descriptor.
+   * @param [in] offset The start of the file range.
+   * @param [in] len The length of the range, 0 up to the end of the file.
+   * @param [in] advice One of the POSIX_FADV_* values.
+   *
+   * @return 0, or an error number (errno is not set).
+   */
+  int __attribute__((weak))
+  __posix_posix_fadvise (int fildes, off_t offset, off_t len, int advice);
+
+  /**
+   * @brief Allocate the storage of a file range, growing the file.
+   *
+   * @headerfile <fcntl.h>
+   *
+   * If the file system cannot allocate in advance, the file is
+   * grown by writing zeros past its end.
+   *
+   * @param [in] fildes An open file descriptor.
+   * @param [in] offset The start of the file range.
+   * @param [in] len The length of the range.
+   *
+   * @return 0, or an error number (errno is not set).
+   */
+  int __attribute__((weak))
+  __posix_posix_fallocate (int fildes, off_t offset, off_t len);
+
+  /**
+   * @brief Read directory entries in bulk.
+   *
+   * @headerfile <dirent.h>
+   *
+   * @param [in] fildes A file descriptor of a directory, as
+   * returned by dirfd().
+   * @param [out] buf The entries, as struct posix_dent records of
+   * d_reclen bytes each.
+   * @param [in] nbyte The size of the buffer.
+   * @param [in] flags 0.
+   *
+   * @return the number of bytes used, 0 at the end, or -1 and errno
+   * (EINVAL if the next entry does not fit).
+   */
+  ssize_t __attribute__((weak))
+  __posix_posix_getdents (int fildes, void* buf, size_t nbyte, int flags);
+
   int __attribute__((weak))
   __posix_raise (int sig);
 
@@ -198,6 +324,25 @@ extern "C"
   __attribute__((weak))
   __posix_readdir (DIR* dirp);
 
+  /**
+   * @brief Read a directory entry and its status.
+   *
+   * @headerfile <dirent.h>
+   *
+   * As readdir() followed by stat() of the name, but the file
+   * systems that have the status at hand do not look up the name
+   * again.
+   *
+   * @param [in] dirp A directory stream.
+   * @param [out] buf The status of the entry.
+   *
+   * @return the entry, or nullptr at the end (errno 0) or on error
+   * (errno set).
+   */
+  struct dirent*
+  __attribute__((weak))
+  __posix_readdir_plus (DIR* dirp, struct stat* buf);
+
   int __attribute__((weak))
   __posix_readdir_r (DIR* dirp, struct dirent* entry, struct dirent** result);
 
@@ -217,6 +362,10 @@ extern "C"
   int __attribute__((weak))
   __posix_rename (const char* oldfn, const char* newfn);
 
+  int __attribute__((weak))
+  __posix_renameat (int oldfd, const char* oldfn, int newfd,
+                    const char* newfn);
+
   void __attribute__((weak))
   __posix_rewinddir (DIR* dirp);
 
@@ -274,6 +423,9 @@ extern "C"
   int __attribute__((weak))
   __posix_unlink (const char* name);
 
+  int __attribute__((weak))
+  __posix_unlinkat (int fildes, const char* name, int flag);
+
   int __attribute__((weak))
   __posix_utime (const char* path, const struct utimbuf* times);
 
@@ -88,4 +88,59 @@ extern "C"
 
 #endif /* __ARM_EABI__ */
 
+// ----------------------------------------------------------------------------
+
+// Not yet, or not at all, in the system headers.
+
+#if !defined(DT_UNKNOWN)
+#define DT_UNKNOWN  (0)
+#define DT_DIR  (4)
+#define DT_REG  (8)
+#endif
+
+// POSIX.1-2024, in the GNU C library since 2.41; define it for other
+// system headers that already have them.
+#if !defined(OS_HAS_POSIX_DENT) && defined(__GLIBC__) \
+    && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 41)))
+#define OS_HAS_POSIX_DENT
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if !defined(OS_HAS_POSIX_DENT)
+
+  typedef unsigned short reclen_t;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+
+  // Packed in the buffer, each one d_reclen bytes long.
+  struct posix_dent
+  {
+    ino_t d_ino;
+    reclen_t d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  };
+
+#pragma GCC diagnostic pop
+
+  ssize_t
+  posix_getdents (int fildes, void* buf, size_t nbyte, int flags);
+
+#endif /* !defined(OS_HAS_POSIX_DENT) */
+
+  struct stat;
+
+  // Not standard, readdir() and the status of the entry.
+  struct dirent*
+  readdir_plus (DIR* dirp, struct stat* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* POSIX_IO_DIRENT_H_ */
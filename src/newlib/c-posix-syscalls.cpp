@@ -98,6 +98,33 @@ __posix_open (const char* path, int oflag, ...)
   return io->getFileDescriptor ();
 }
 
+/**
+ * @details
+ *
+ * The `openat()` function shall be equivalent to the `open()` function
+ * except in the case where _path_ specifies a relative path. In this
+ * case the file to be opened is determined relative to the directory
+ * associated with the file descriptor _fildes_ instead of the current
+ * working directory.
+ */
+int
+__posix_openat (int fildes, const char* path, int oflag, ...)
+{
+  va_list args;
+  va_start(args, oflag);
+  auto* const io = os::posix::vopenat (fildes, path, oflag, args);
+  va_end(args);
+
+  if (io == nullptr)
+    {
+      // Return POSIX style error indicator.
+      return -1;
+    }
+
+  // Return non-negative POSIX file descriptor.
+  return io->getFileDescriptor ();
+}
+
 int
 __posix_close (int fildes)
 {
@@ -295,6 +322,64 @@ __posix_fsync (int fildes)
   return static_cast<os::posix::File*> (io)->fsync ();
 }
 
+int
+__posix_posix_fadvise (int fildes, off_t offset, off_t len, int advice)
+{
+  // Returns the error number, errno is not set.
+  auto* const io = os::posix::FileDescriptorsManager::getIo (fildes);
+  if (io == nullptr)
+    {
+      return EBADF;
+    }
+
+  // Works only on files.
+  if ((io->getType () & os::posix::IO::Type::FILE) == 0)
+    {
+      return ESPIPE; // Not a file.
+    }
+
+  return static_cast<os::posix::File*> (io)->fadvise (offset, len, advice);
+}
+
+int
+__posix_fallocate (int fildes, int mode, off_t offset, off_t len)
+{
+  auto* const io = os::posix::FileDescriptorsManager::getIo (fildes);
+  if (io == nullptr)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+  // Works only on files.
+  if ((io->getType () & os::posix::IO::Type::FILE) == 0)
+    {
+      errno = ESPIPE; // Not a file.
+      return -1;
+    }
+
+  return static_cast<os::posix::File*> (io)->fallocate (mode, offset, len);
+}
+
+int
+__posix_posix_fallocate (int fildes, off_t offset, off_t len)
+{
+  // Returns the error number, errno is not set.
+  auto* const io = os::posix::FileDescriptorsManager::getIo (fildes);
+  if (io == nullptr)
+    {
+      return EBADF;
+    }
+
+  // Works only on files.
+  if ((io->getType () & os::posix::IO::Type::FILE) == 0)
+    {
+      return ESPIPE; // Not a file.
+    }
+
+  return static_cast<os::posix::File*> (io)->preallocate (offset, len);
+}
+
 // ----------------------------------------------------------------------------
 // ----- POSIX File functions -----
 
@@ -334,6 +419,24 @@ __posix_utime (const char* path, const struct utimbuf* times)
   return os::posix::utime (path, times);
 }
 
+int
+__posix_fstatat (int fildes, const char* path, struct stat* buf, int flag)
+{
+  return os::posix::fstatat (fildes, path, buf, flag);
+}
+
+int
+__posix_renameat (int oldfd, const char* oldfn, int newfd, const char* newfn)
+{
+  return os::posix::renameat (oldfd, oldfn, newfd, newfn);
+}
+
+int
+__posix_unlinkat (int fildes, const char* name, int flag)
+{
+  return os::posix::unlinkat (fildes, name, flag);
+}
+
 // ----------------------------------------------------------------------------
 // ----- POSIX FileSystem functions -----
 
@@ -343,6 +446,12 @@ __posix_mkdir (const char* path, mode_t mode)
   return os::posix::mkdir (path, mode);
 }
 
+int
+__posix_mkdirat (int fildes, const char* path, mode_t mode)
+{
+  return os::posix::mkdirat (fildes, path, mode);
+}
+
 int
 __posix_rmdir (const char* path)
 {
@@ -355,6 +464,18 @@ __posix_sync (void)
   return os::posix::sync ();
 }
 
+int
+__posix_chdir (const char* path)
+{
+  return os::posix::chdir (path);
+}
+
+char*
+__posix_getcwd (char* buf, size_t size)
+{
+  return os::posix::getcwd (buf, size);
+}
+
 // ----------------------------------------------------------------------------
 // ----- Directories functions -----
 
@@ -376,6 +497,43 @@ __posix_readdir (DIR* dirp)
   return dir->read ();
 }
 
+struct dirent*
+__posix_readdir_plus (DIR* dirp, struct stat* buf)
+{
+  auto* const dir = reinterpret_cast<os::posix::Directory*> (dirp);
+  if (dir == nullptr)
+    {
+      errno = ENOENT;
+      return nullptr;
+    }
+  return dir->read_plus (buf);
+}
+
+ssize_t
+__posix_posix_getdents (int fildes, void* buf, size_t nbyte, int flags)
+{
+  auto* const io = os::posix::FileDescriptorsManager::getIo (fildes);
+  if (io == nullptr)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+  if (io->getType () != os::posix::IO::Type::DIRECTORY)
+    {
+      errno = ENOTDIR;
+      return -1;
+    }
+
+  if (flags != 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  return static_cast<os::posix::Directory*> (io)->read_batch (buf, nbyte);
+}
+
 #if 0
 int
 __posix_readdir_r (DIR* dirp, struct dirent* entry, struct dirent** result)
@@ -409,6 +567,35 @@ __posix_closedir (DIR* dirp)
   return dir->close ();
 }
 
+int
+__posix_dirfd (DIR* dirp)
+{
+  auto* const dir = reinterpret_cast<os::posix::Directory*> (dirp);
+  if (dir == nullptr)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  return dir->dirfd ();
+}
+
+DIR*
+__posix_fdopendir (int fildes)
+{
+  auto* const io = os::posix::FileDescriptorsManager::getIo (fildes);
+  if (io == nullptr)
+    {
+      errno = EBADF;
+      return nullptr;
+    }
+  if (io->getType () != os::posix::IO::Type::DIRECTORY)
+    {
+      errno = ENOTDIR;
+      return nullptr;
+    }
+  return reinterpret_cast<DIR*> (static_cast<os::posix::Directory*> (io));
+}
+
 // ----------------------------------------------------------------------------
 // Socket functions
 
@@ -697,20 +884,6 @@ __posix_times (struct tms* buf)
   return ((clock_t) -1);
 }
 
-int
-__posix_chdir (const char* path)
-{
-  errno = ENOSYS; // Not implemented
-  return -1;
-}
-
-char*
-__posix_getcwd (char* buf, size_t size)
-{
-  errno = ENOSYS; // Not implemented
-  return nullptr;
-}
-
 // ----------------------------------------------------------------------------
 // Unavailable in non-Unix embedded environments.
 
@@ -0,0 +1,901 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockCache.h"
+
+#include "posix/sys/uio.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the bucket chains and of the queues.
+    static constexpr std::size_t noEntry = ~static_cast<std::size_t> (0);
+
+    // ------------------------------------------------------------------------
+
+    BlockCache::BlockCache (BlockDevice* device, std::size_t capacity)
+    {
+      assert(device != nullptr);
+      assert(capacity > 0);
+
+      std::size_t blockSize = device->getBlockSize ();
+      assert(blockSize > 0);
+
+      fDevice = device;
+      setGeometry (blockSize, device->getBlocksCount (),
+                   device->getAlignment ());
+
+      fCapacity = capacity;
+      fInMax = (capacity / 4 > 0) ? capacity / 4 : 1;
+      fGhostMax = (capacity / 2 > 0) ? capacity / 2 : 1;
+      fRunMax =
+          (capacity < OS_INTEGER_BLOCK_CACHE_RUN_MAX) ?
+              capacity : OS_INTEGER_BLOCK_CACHE_RUN_MAX;
+
+      // Ghost entries have no buffer; there are always enough entries
+      // for all buffers and all ghosts.
+      fEntriesCount = capacity + fGhostMax;
+
+      fStorage = new std::uint8_t[capacity * blockSize];
+      fEntriesArray = new Entry[fEntriesCount];
+      fFreeBuffersArray = new std::uint8_t*[capacity];
+      fIovArray = new struct iovec[fRunMax];
+
+      fPrefetchArray = new Prefetch[OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX];
+      for (std::size_t i = 0; i < OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX; ++i)
+        {
+          fPrefetchArray[i].iov = new struct iovec[fRunMax];
+          fPrefetchArray[i].block = 0;
+          fPrefetchArray[i].count = 0;
+          fPrefetchArray[i].busy = false;
+        }
+
+      for (std::size_t i = 0; i < capacity; ++i)
+        {
+          fFreeBuffersArray[i] = &fStorage[i * blockSize];
+        }
+      fFreeBuffersCount = capacity;
+
+      // Use a power of 2 number of buckets, at least as many as entries.
+      std::size_t buckets = 1;
+      while (buckets < fEntriesCount)
+        {
+          buckets <<= 1;
+        }
+      fBucketsMask = buckets - 1;
+      fBucketsArray = new std::size_t[buckets];
+
+      for (std::size_t i = 0; i < buckets; ++i)
+        {
+          fBucketsArray[i] = noEntry;
+        }
+
+      for (std::size_t q = 0; q < QUEUES; ++q)
+        {
+          fLists[q].newest = noEntry;
+          fLists[q].oldest = noEntry;
+          fLists[q].count = 0;
+        }
+
+      for (std::size_t i = 0; i < fEntriesCount; ++i)
+        {
+          auto& entry = fEntriesArray[i];
+          entry.data = nullptr;
+          entry.nextInBucket = noEntry;
+          entry.block = 0;
+          entry.pins = 0;
+          entry.dirty = false;
+          entry.pending = false;
+          linkNewest (i, FREE);
+        }
+
+      resetStatistics ();
+    }
+
+    BlockCache::~BlockCache ()
+    {
+      // Do not lose the dirty blocks.
+      do_flush ();
+
+      // The device must not write into freed buffers.
+      reapPrefetches (true);
+
+      for (std::size_t i = 0; i < OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX; ++i)
+        {
+          delete[] fPrefetchArray[i].iov;
+        }
+      delete[] fPrefetchArray;
+
+      delete[] fIovArray;
+      delete[] fFreeBuffersArray;
+      delete[] fBucketsArray;
+      delete[] fEntriesArray;
+      delete[] fStorage;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void*
+    BlockCache::pin (blockNumber_t block, bool read)
+    {
+      if (block >= getBlocksCount ())
+        {
+          errno = EINVAL;
+          return nullptr;
+        }
+
+      reapPrefetches (false);
+
+      std::size_t index = lookup (block);
+      if (index != noEntry)
+        {
+          ++fHits;
+          touch (index);
+        }
+      else
+        {
+          ++fMisses;
+          index = allocate (block);
+          if (index == noEntry)
+            {
+              return nullptr;
+            }
+
+          auto& entry = fEntriesArray[index];
+          if (read)
+            {
+              if (fDevice->read (entry.data, block, 1) < 0)
+                {
+                  release (index);
+                  return nullptr;
+                }
+            }
+          else
+            {
+              std::memset (entry.data, 0, getBlockSize ());
+            }
+        }
+
+      auto& entry = fEntriesArray[index];
+      ++entry.pins;
+      return entry.data;
+    }
+
+    void
+    BlockCache::unpin (blockNumber_t block, bool dirty)
+    {
+      std::size_t index = findResident (block);
+      assert(index != noEntry);
+
+      auto& entry = fEntriesArray[index];
+      assert(entry.pins > 0);
+
+      --entry.pins;
+      if (dirty)
+        {
+          entry.dirty = true;
+        }
+    }
+
+    BlockCache*
+    BlockCache::getBlockCache (void)
+    {
+      return this;
+    }
+
+    void
+    BlockCache::resetStatistics (void)
+    {
+      fHits = 0;
+      fMisses = 0;
+      fWriteRequests = 0;
+      fWrittenBlocks = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    BlockCache::do_read (void* buf, blockNumber_t block, std::size_t count)
+    {
+      auto* p = static_cast<std::uint8_t*> (buf);
+      std::size_t blockSize = getBlockSize ();
+
+      reapPrefetches (false);
+
+      std::size_t i = 0;
+      while (i < count)
+        {
+          std::size_t index = lookup (block + i);
+          if (index != noEntry)
+            {
+              ++fHits;
+              touch (index);
+              std::memcpy (&p[i * blockSize], fEntriesArray[index].data,
+                           blockSize);
+              ++i;
+              continue;
+            }
+
+          ssize_t ret = loadRun (block + i, count - i);
+          if (ret < 0)
+            {
+              return (i > 0) ? static_cast<ssize_t> (i) : -1;
+            }
+
+          std::size_t n = static_cast<std::size_t> (ret);
+          for (std::size_t j = 0; j < n; ++j)
+            {
+              std::size_t k = findResident (block + i + j);
+              std::memcpy (&p[(i + j) * blockSize], fEntriesArray[k].data,
+                           blockSize);
+            }
+
+          fMisses += n;
+          i += n;
+        }
+
+      return static_cast<ssize_t> (count);
+    }
+
+    ssize_t
+    BlockCache::do_write (const void* buf, blockNumber_t block,
+                          std::size_t count)
+    {
+      auto* p = static_cast<const std::uint8_t*> (buf);
+      std::size_t blockSize = getBlockSize ();
+
+      reapPrefetches (false);
+
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          // A pending prefetch would overwrite the new content.
+          std::size_t index = lookup (block + i);
+          if (index != noEntry)
+            {
+              ++fHits;
+              touch (index);
+            }
+          else
+            {
+              // The block is entirely overwritten, no need to read it.
+              ++fMisses;
+              index = allocate (block + i);
+              if (index == noEntry)
+                {
+                  return (i > 0) ? static_cast<ssize_t> (i) : -1;
+                }
+            }
+
+          auto& entry = fEntriesArray[index];
+          std::memcpy (entry.data, &p[i * blockSize], blockSize);
+          entry.dirty = true;
+        }
+
+      return static_cast<ssize_t> (count);
+    }
+
+    int
+    BlockCache::do_flush (void)
+    {
+      reapPrefetches (false);
+
+      for (std::size_t i = 0; i < fEntriesCount; ++i)
+        {
+          auto& entry = fEntriesArray[i];
+          if (entry.dirty && (entry.queue != FREE) && (entry.queue != GHOST))
+            {
+              if (writeBack (i) < 0)
+                {
+                  return -1;
+                }
+            }
+        }
+
+      return fDevice->flush ();
+    }
+
+    int
+    BlockCache::do_discard (blockNumber_t block, std::size_t count)
+    {
+      reapPrefetches (true);
+
+      if (count > fEntriesCount)
+        {
+          // Cheaper to check all entries than all blocks.
+          for (std::size_t i = 0; i < fEntriesCount; ++i)
+            {
+              auto& entry = fEntriesArray[i];
+              if ((entry.queue == IN || entry.queue == MAIN)
+                  && (entry.block >= block) && (entry.block - block < count))
+                {
+                  entry.dirty = false;
+                  if (entry.pins == 0)
+                    {
+                      release (i);
+                    }
+                }
+            }
+        }
+      else
+        {
+          for (std::size_t i = 0; i < count; ++i)
+            {
+              std::size_t index = findResident (block + i);
+              if (index != noEntry)
+                {
+                  fEntriesArray[index].dirty = false;
+                  if (fEntriesArray[index].pins == 0)
+                    {
+                      release (index);
+                    }
+                }
+            }
+        }
+
+      return fDevice->discard (block, count);
+    }
+
+    int
+    BlockCache::do_prefetch (blockNumber_t block, std::size_t count)
+    {
+      std::size_t limit = (fCapacity / 2 > 0) ? fCapacity / 2 : 1;
+      if (count > limit)
+        {
+          count = limit;
+        }
+
+      reapPrefetches (false);
+
+      std::size_t i = 0;
+      while (i < count)
+        {
+          if (findResident (block + i) != noEntry)
+            {
+              ++i;
+              continue;
+            }
+
+          std::size_t slot = freePrefetch ();
+          if (slot == noEntry)
+            {
+              // Maybe some completed meanwhile.
+              reapPrefetches (false);
+              slot = freePrefetch ();
+            }
+          if (slot == noEntry)
+            {
+              // Enough requests in progress; only a hint, do not wait.
+              break;
+            }
+
+          std::size_t n = allocateRun (block + i, count - i);
+          if (n == 0)
+            {
+              break;
+            }
+
+          auto& prefetch = fPrefetchArray[slot];
+          for (std::size_t j = 0; j < n; ++j)
+            {
+              auto& entry = fEntriesArray[findResident (block + i + j)];
+              entry.pending = true;
+              prefetch.iov[j].iov_base = entry.data;
+              prefetch.iov[j].iov_len = getBlockSize ();
+            }
+
+          prefetch.block = static_cast<blockNumber_t> (block + i);
+          prefetch.count = n;
+          prefetch.busy = true;
+          prefetch.request.prepareReadv (prefetch.iov, static_cast<int> (n),
+                                         prefetch.block);
+
+          // Errors complete the request, and are handled when reaped.
+          fDevice->submit (&prefetch.request);
+
+          i += n;
+        }
+
+      errno = 0;
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    BlockCache::find (blockNumber_t block) const
+    {
+      std::size_t index = fBucketsArray[bucketOf (block)];
+      while (index != noEntry)
+        {
+          if (fEntriesArray[index].block == block)
+            {
+              return index;
+            }
+          index = fEntriesArray[index].nextInBucket;
+        }
+      return noEntry;
+    }
+
+    std::size_t
+    BlockCache::findResident (blockNumber_t block) const
+    {
+      std::size_t index = find (block);
+      if ((index != noEntry) && (fEntriesArray[index].queue == GHOST))
+        {
+          return noEntry;
+        }
+      return index;
+    }
+
+    /**
+     * Like findResident(), but wait for the block if it is being
+     * prefetched; a failed prefetch leaves the block missing.
+     */
+    std::size_t
+    BlockCache::lookup (blockNumber_t block)
+    {
+      std::size_t index = findResident (block);
+      if ((index == noEntry) || !fEntriesArray[index].pending)
+        {
+          return index;
+        }
+
+      for (std::size_t slot = 0; slot < OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX;
+          ++slot)
+        {
+          auto& prefetch = fPrefetchArray[slot];
+          if (prefetch.busy && (block >= prefetch.block)
+              && (block - prefetch.block < prefetch.count))
+            {
+              finishPrefetch (slot);
+              break;
+            }
+        }
+
+      return findResident (block);
+    }
+
+    /**
+     * Get an entry with a buffer for a block not in the cache,
+     * evicting the oldest unpinned block if needed. The content
+     * of the buffer is undefined.
+     */
+    std::size_t
+    BlockCache::allocate (blockNumber_t block)
+    {
+      std::uint8_t* data;
+
+      if (fFreeBuffersCount > 0)
+        {
+          data = fFreeBuffersArray[--fFreeBuffersCount];
+        }
+      else
+        {
+          std::size_t victim = findVictim ();
+          if (victim == noEntry)
+            {
+              errno = ENOBUFS;
+              return noEntry;
+            }
+
+          auto& entry = fEntriesArray[victim];
+          if (entry.dirty && (writeBack (victim) < 0))
+            {
+              return noEntry;
+            }
+
+          data = entry.data;
+          entry.data = nullptr;
+
+          Queue queue = static_cast<Queue> (entry.queue);
+          unlinkQueue (victim);
+
+          if (queue == IN)
+            {
+              // Remember it for a while, to detect a second access.
+              if (fLists[GHOST].count >= fGhostMax)
+                {
+                  std::size_t oldest = fLists[GHOST].oldest;
+                  unlinkQueue (oldest);
+                  hashRemove (oldest);
+                  linkNewest (oldest, FREE);
+                }
+              linkNewest (victim, GHOST);
+            }
+          else
+            {
+              hashRemove (victim);
+              linkNewest (victim, FREE);
+            }
+        }
+
+      std::size_t index = find (block);
+      Queue queue;
+      if (index != noEntry)
+        {
+          // Ghost hit, the block is frequently used.
+          unlinkQueue (index);
+          queue = MAIN;
+        }
+      else
+        {
+          index = fLists[FREE].oldest;
+          assert(index != noEntry);
+
+          unlinkQueue (index);
+          fEntriesArray[index].block = block;
+          hashInsert (index);
+          queue = IN;
+        }
+
+      auto& entry = fEntriesArray[index];
+      entry.data = data;
+      entry.pins = 0;
+      entry.dirty = false;
+      linkNewest (index, queue);
+
+      return index;
+    }
+
+    /**
+     * Allocate buffers for a run of consecutive missing blocks,
+     * starting with `block`, pinned such that they are not evicted
+     * by the next allocations.
+     *
+     * @return The number of blocks, 0 and errno if none.
+     */
+    std::size_t
+    BlockCache::allocateRun (blockNumber_t block, std::size_t count)
+    {
+      std::size_t n = 0;
+      while ((n < count) && (n < fRunMax))
+        {
+          if ((n > 0) && (findResident (block + n) != noEntry))
+            {
+              break;
+            }
+          std::size_t k = allocate (block + n);
+          if (k == noEntry)
+            {
+              break;
+            }
+          ++fEntriesArray[k].pins;
+          ++n;
+        }
+      return n;
+    }
+
+    /**
+     * Read a run of consecutive missing blocks, starting with `block`,
+     * with a single request.
+     *
+     * @return The number of blocks read, or -1 and errno.
+     */
+    ssize_t
+    BlockCache::loadRun (blockNumber_t block, std::size_t count)
+    {
+      std::size_t n = allocateRun (block, count);
+      if (n == 0)
+        {
+          return -1;
+        }
+
+      // Allocations may write back dirty blocks using the vector,
+      // so fill it only now.
+      for (std::size_t j = 0; j < n; ++j)
+        {
+          auto& entry = fEntriesArray[findResident (block + j)];
+          fIovArray[j].iov_base = entry.data;
+          fIovArray[j].iov_len = getBlockSize ();
+        }
+
+      ssize_t ret = fDevice->readv (fIovArray, static_cast<int> (n), block);
+      for (std::size_t j = 0; j < n; ++j)
+        {
+          std::size_t k = findResident (block + j);
+          --fEntriesArray[k].pins;
+          if ((ret < 0) || (j >= static_cast<std::size_t> (ret)))
+            {
+              release (k);
+            }
+        }
+
+      if (ret <= 0)
+        {
+          return -1;
+        }
+      return ret;
+    }
+
+    /**
+     * Wait for a prefetch request, then make its blocks available,
+     * or drop them if the request failed.
+     */
+    void
+    BlockCache::finishPrefetch (std::size_t slot)
+    {
+      auto& prefetch = fPrefetchArray[slot];
+      int err = errno;
+      ssize_t ret = prefetch.request.wait ();
+
+      for (std::size_t j = 0; j < prefetch.count; ++j)
+        {
+          std::size_t k = findResident (
+              static_cast<blockNumber_t> (prefetch.block + j));
+          auto& entry = fEntriesArray[k];
+          entry.pending = false;
+          --entry.pins;
+          if ((ret < 0) || (j >= static_cast<std::size_t> (ret)))
+            {
+              release (k);
+            }
+        }
+
+      prefetch.busy = false;
+
+      // The errors are reported when the blocks are read again.
+      errno = err;
+    }
+
+    std::size_t
+    BlockCache::freePrefetch (void) const
+    {
+      for (std::size_t slot = 0; slot < OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX;
+          ++slot)
+        {
+          if (!fPrefetchArray[slot].busy)
+            {
+              return slot;
+            }
+        }
+      return noEntry;
+    }
+
+    /**
+     * Finish the completed prefetch requests, or all of them.
+     */
+    void
+    BlockCache::reapPrefetches (bool wait)
+    {
+      for (std::size_t slot = 0; slot < OS_INTEGER_BLOCK_CACHE_PREFETCH_MAX;
+          ++slot)
+        {
+          auto& prefetch = fPrefetchArray[slot];
+          if (prefetch.busy && (wait || prefetch.request.isDone ()))
+            {
+              finishPrefetch (slot);
+            }
+        }
+    }
+
+    /**
+     * Evict from the FIFO queue while it is above its share of the
+     * cache, otherwise from the main queue; pinned blocks are skipped.
+     */
+    std::size_t
+    BlockCache::findVictim (void)
+    {
+      Queue order[2];
+      if (fLists[IN].count > fInMax)
+        {
+          order[0] = IN;
+          order[1] = MAIN;
+        }
+      else
+        {
+          order[0] = MAIN;
+          order[1] = IN;
+        }
+
+      for (std::size_t q = 0; q < 2; ++q)
+        {
+          std::size_t index = fLists[order[q]].oldest;
+          while (index != noEntry)
+            {
+              if (fEntriesArray[index].pins == 0)
+                {
+                  return index;
+                }
+              index = fEntriesArray[index].newer;
+            }
+        }
+
+      return noEntry;
+    }
+
+    /**
+     * Return the buffer of an entry whose content is not valid.
+     */
+    void
+    BlockCache::release (std::size_t index)
+    {
+      auto& entry = fEntriesArray[index];
+
+      unlinkQueue (index);
+      hashRemove (index);
+
+      fFreeBuffersArray[fFreeBuffersCount++] = entry.data;
+      entry.data = nullptr;
+      entry.dirty = false;
+
+      linkNewest (index, FREE);
+    }
+
+    void
+    BlockCache::touch (std::size_t index)
+    {
+      // The FIFO queue ignores repeated accesses.
+      if (fEntriesArray[index].queue == MAIN)
+        {
+          unlinkQueue (index);
+          linkNewest (index, MAIN);
+        }
+    }
+
+    /**
+     * Write a dirty block together with the dirty blocks adjacent
+     * to it, in a single request.
+     */
+    int
+    BlockCache::writeBack (std::size_t index)
+    {
+      blockNumber_t first = fEntriesArray[index].block;
+      std::size_t before = 0;
+      while ((first > 0) && (before + 1 < fRunMax))
+        {
+          std::size_t k = findResident (first - 1);
+          if ((k == noEntry) || !fEntriesArray[k].dirty)
+            {
+              break;
+            }
+          --first;
+          ++before;
+        }
+
+      std::size_t n = 0;
+      while (n < fRunMax)
+        {
+          std::size_t k = findResident (
+              static_cast<blockNumber_t> (first + n));
+          if ((k == noEntry) || !fEntriesArray[k].dirty)
+            {
+              break;
+            }
+          fIovArray[n].iov_base = fEntriesArray[k].data;
+          fIovArray[n].iov_len = getBlockSize ();
+          ++n;
+        }
+
+      if (fDevice->writev (fIovArray, static_cast<int> (n), first) < 0)
+        {
+          return -1;
+        }
+
+      for (std::size_t i = 0; i < n; ++i)
+        {
+          std::size_t k = findResident (
+              static_cast<blockNumber_t> (first + i));
+          fEntriesArray[k].dirty = false;
+        }
+
+      ++fWriteRequests;
+      fWrittenBlocks += n;
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    BlockCache::hashInsert (std::size_t index)
+    {
+      auto& entry = fEntriesArray[index];
+      std::size_t bucket = bucketOf (entry.block);
+
+      entry.nextInBucket = fBucketsArray[bucket];
+      fBucketsArray[bucket] = index;
+    }
+
+    void
+    BlockCache::hashRemove (std::size_t index)
+    {
+      auto& entry = fEntriesArray[index];
+
+      std::size_t* link = &fBucketsArray[bucketOf (entry.block)];
+      while (*link != index)
+        {
+          assert(*link != noEntry);
+          link = &fEntriesArray[*link].nextInBucket;
+        }
+      *link = entry.nextInBucket;
+      entry.nextInBucket = noEntry;
+    }
+
+    void
+    BlockCache::unlinkQueue (std::size_t index)
+    {
+      auto& entry = fEntriesArray[index];
+      auto& list = fLists[entry.queue];
+
+      if (entry.newer != noEntry)
+        {
+          fEntriesArray[entry.newer].older = entry.older;
+        }
+      else
+        {
+          list.newest = entry.older;
+        }
+
+      if (entry.older != noEntry)
+        {
+          fEntriesArray[entry.older].newer = entry.newer;
+        }
+      else
+        {
+          list.oldest = entry.newer;
+        }
+
+      entry.newer = noEntry;
+      entry.older = noEntry;
+      --list.count;
+    }
+
+    void
+    BlockCache::linkNewest (std::size_t index, Queue queue)
+    {
+      auto& entry = fEntriesArray[index];
+      auto& list = fLists[queue];
+
+      entry.queue = queue;
+      entry.newer = noEntry;
+      entry.older = list.newest;
+
+      if (list.newest != noEntry)
+        {
+          fEntriesArray[list.newest].newer = index;
+        }
+      list.newest = index;
+
+      if (list.oldest == noEntry)
+        {
+          list.oldest = index;
+        }
+      ++list.count;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,447 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockDevice.h"
+#include "posix-io/BlockRequest.h"
+
+#include "posix/sys/uio.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    BlockDevice::BlockDevice ()
+    {
+      fBlockSize = 0;
+      fAlignment = 1;
+      fBlocksCount = 0;
+    }
+
+    BlockDevice::~BlockDevice ()
+    {
+      fBlocksCount = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    BlockDevice::setGeometry (std::size_t blockSize, blockNumber_t blocksCount,
+                              std::size_t alignment)
+    {
+      fBlockSize = blockSize;
+      fBlocksCount = blocksCount;
+      fAlignment = (alignment > 0) ? alignment : 1;
+    }
+
+    int
+    BlockDevice::forwardRequest (BlockDevice* device, BlockRequest* request,
+                                 blockNumber_t offset)
+    {
+      request->fBlock += offset;
+      return device->do_submit (request);
+    }
+
+    BlockCache*
+    BlockDevice::getBlockCache (void)
+    {
+      return nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    BlockDevice::read (void* buf, blockNumber_t block, std::size_t count)
+    {
+      if (buf == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if ((block > fBlocksCount) || (count > fBlocksCount - block))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      errno = 0;
+
+      if (count == 0)
+        {
+          return 0; // Nothing to do.
+        }
+
+      // Execute the implementation specific code.
+      return do_read (buf, block, count);
+    }
+
+    ssize_t
+    BlockDevice::write (const void* buf, blockNumber_t block, std::size_t count)
+    {
+      if (buf == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if ((block > fBlocksCount) || (count > fBlocksCount - block))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      errno = 0;
+
+      if (count == 0)
+        {
+          return 0; // Nothing to do.
+        }
+
+      // Execute the implementation specific code.
+      return do_write (buf, block, count);
+    }
+
+    ssize_t
+    BlockDevice::readv (const struct iovec* iov, int iovcnt, blockNumber_t block)
+    {
+      if (checkVector (iov, iovcnt, block) < 0)
+        {
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      return do_readv (iov, iovcnt, block);
+    }
+
+    ssize_t
+    BlockDevice::writev (const struct iovec* iov, int iovcnt,
+                         blockNumber_t block)
+    {
+      if (checkVector (iov, iovcnt, block) < 0)
+        {
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      return do_writev (iov, iovcnt, block);
+    }
+
+    int
+    BlockDevice::flush (void)
+    {
+      errno = 0;
+
+      // Execute the implementation specific code.
+      return do_flush ();
+    }
+
+    int
+    BlockDevice::discard (blockNumber_t block, std::size_t count)
+    {
+      if ((block > fBlocksCount) || (count > fBlocksCount - block))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      errno = 0;
+
+      if (count == 0)
+        {
+          return 0; // Nothing to do.
+        }
+
+      // Execute the implementation specific code.
+      return do_discard (block, count);
+    }
+
+    int
+    BlockDevice::prefetch (blockNumber_t block, std::size_t count)
+    {
+      errno = 0;
+
+      if (block >= fBlocksCount)
+        {
+          return 0; // Nothing to do.
+        }
+
+      if (count > fBlocksCount - block)
+        {
+          count = fBlocksCount - block;
+        }
+
+      if (count == 0)
+        {
+          return 0; // Nothing to do.
+        }
+
+      // Execute the implementation specific code.
+      return do_prefetch (block, count);
+    }
+
+    int
+    BlockDevice::submit (BlockRequest* request)
+    {
+      assert(request != nullptr);
+      assert(request->isDone ());
+
+      errno = 0;
+
+      if (request->fOperation != BlockRequest::FLUSH)
+        {
+          if (request->fIovPtr == &request->fIov)
+            {
+              // Single buffer, the count was given in blocks.
+              request->fIov.iov_len = request->fCount * fBlockSize;
+            }
+
+          ssize_t total = checkVector (request->fIovPtr, request->fIovcnt,
+                                       request->fBlock);
+          if (total < 0)
+            {
+              int err = errno;
+              request->complete (-1, err);
+              errno = err;
+              return -1;
+            }
+
+          request->fCount = static_cast<std::size_t> (total);
+          if (total == 0)
+            {
+              request->complete (0);
+              return 0; // Nothing to do.
+            }
+        }
+
+      request->fDone.store (false);
+
+      // Execute the implementation specific code.
+      if (do_submit (request) < 0)
+        {
+          int err = errno;
+          request->complete (-1, err);
+          errno = err;
+          return -1;
+        }
+      return 0;
+    }
+
+    ssize_t
+    BlockDevice::execute (BlockRequest* request)
+    {
+      if (submit (request) < 0)
+        {
+          return -1;
+        }
+      return request->wait ();
+    }
+
+    /**
+     * All buffers must be multiple of the block size, and the total
+     * must fit in the device.
+     *
+     * @return The total number of blocks, or -1 and errno.
+     */
+    ssize_t
+    BlockDevice::checkVector (const struct iovec* iov, int iovcnt,
+                              blockNumber_t block)
+    {
+      if (iov == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if ((iovcnt <= 0) || (fBlockSize == 0))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      std::size_t total = 0;
+      for (int i = 0; i < iovcnt; ++i)
+        {
+          if ((iov[i].iov_base == nullptr) || (iov[i].iov_len % fBlockSize != 0))
+            {
+              errno = EINVAL;
+              return -1;
+            }
+          total += iov[i].iov_len / fBlockSize;
+        }
+
+      if ((block > fBlocksCount) || (total > fBlocksCount - block))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      return static_cast<ssize_t> (total);
+    }
+
+    // ------------------------------------------------------------------------
+    // Default implementations; overwrite them with real code.
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    ssize_t
+    BlockDevice::do_read (void* buf, blockNumber_t block, std::size_t count)
+    {
+      errno = ENOSYS; // Not implemented
+      return -1;
+    }
+
+    ssize_t
+    BlockDevice::do_write (const void* buf, blockNumber_t block,
+                           std::size_t count)
+    {
+      errno = ENOSYS; // Not implemented
+      return -1;
+    }
+
+    int
+    BlockDevice::do_discard (blockNumber_t block, std::size_t count)
+    {
+      // Discarding is only a hint, ignoring it is ok.
+      return 0;
+    }
+
+    int
+    BlockDevice::do_prefetch (blockNumber_t block, std::size_t count)
+    {
+      // Without a cache there is nowhere to keep the blocks.
+      return 0;
+    }
+
+#pragma GCC diagnostic pop
+
+    int
+    BlockDevice::do_submit (BlockRequest* request)
+    {
+      ssize_t ret;
+      switch (request->getOperation ())
+        {
+        case BlockRequest::READ:
+          ret = do_readv (request->getIov (), request->getIovcnt (),
+                          request->getBlock ());
+          break;
+
+        case BlockRequest::WRITE:
+          ret = do_writev (request->getIov (), request->getIovcnt (),
+                           request->getBlock ());
+          break;
+
+        default:
+          ret = do_flush ();
+          break;
+        }
+
+      request->complete (ret, errno);
+      return 0;
+    }
+
+    ssize_t
+    BlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                           blockNumber_t block)
+    {
+      ssize_t total = 0;
+      for (int i = 0; i < iovcnt; ++i)
+        {
+          auto count = iov[i].iov_len / fBlockSize;
+          if (count == 0)
+            {
+              continue;
+            }
+
+          ssize_t ret = do_read (iov[i].iov_base, block, count);
+          if (ret < 0)
+            {
+              return (total > 0) ? total : -1;
+            }
+          total += ret;
+          block += static_cast<blockNumber_t> (ret);
+          if (static_cast<std::size_t> (ret) < count)
+            {
+              // Short transfer, stop.
+              break;
+            }
+        }
+      return total;
+    }
+
+    ssize_t
+    BlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                            blockNumber_t block)
+    {
+      ssize_t total = 0;
+      for (int i = 0; i < iovcnt; ++i)
+        {
+          auto count = iov[i].iov_len / fBlockSize;
+          if (count == 0)
+            {
+              continue;
+            }
+
+          ssize_t ret = do_write (iov[i].iov_base, block, count);
+          if (ret < 0)
+            {
+              return (total > 0) ? total : -1;
+            }
+          total += ret;
+          block += static_cast<blockNumber_t> (ret);
+          if (static_cast<std::size_t> (ret) < count)
+            {
+              // Short transfer, stop.
+              break;
+            }
+        }
+      return total;
+    }
+
+    int
+    BlockDevice::do_flush (void)
+    {
+      // Nothing cached, nothing to do.
+      return 0;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
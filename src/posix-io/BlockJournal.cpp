@@ -0,0 +1,579 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockJournal.h"
+#include "posix-io/hash.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // The header block: magic, version, region size, number of blocks
+    // in the log, sequence, checksum of the images, checksum of the
+    // header, then the home block numbers.
+    static constexpr std::uint32_t journalMagic = 0x4A4F4950; // "PIOJ"
+    static constexpr std::uint32_t journalVersion = 1;
+    static constexpr std::size_t headerSize = 32;
+
+    static inline std::uint32_t
+    get32 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint32_t> (p[0])
+          | (static_cast<std::uint32_t> (p[1]) << 8)
+          | (static_cast<std::uint32_t> (p[2]) << 16)
+          | (static_cast<std::uint32_t> (p[3]) << 24);
+    }
+
+    static inline void
+    put32 (std::uint8_t* p, std::uint32_t value)
+    {
+      p[0] = static_cast<std::uint8_t> (value);
+      p[1] = static_cast<std::uint8_t> (value >> 8);
+      p[2] = static_cast<std::uint8_t> (value >> 16);
+      p[3] = static_cast<std::uint8_t> (value >> 24);
+    }
+
+    // The checksum of the header, without its own field.
+    static std::uint32_t
+    headerCrc (const std::uint8_t* header, std::size_t count)
+    {
+      std::uint32_t crc = crc32 (header, 24);
+      return crc32 (header + headerSize, count * 4, crc);
+    }
+
+    static void
+    buildHeader (std::uint8_t* header, std::size_t blockSize,
+                 BlockDevice::blockNumber_t regionCount, std::size_t count,
+                 std::uint32_t sequence, std::uint32_t crc,
+                 const BlockDevice::blockNumber_t* blocks)
+    {
+      std::memset (header, 0, blockSize);
+      put32 (&header[0], journalMagic);
+      put32 (&header[4], journalVersion);
+      put32 (&header[8], regionCount);
+      put32 (&header[12], static_cast<std::uint32_t> (count));
+      put32 (&header[16], sequence);
+      put32 (&header[20], crc);
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          put32 (&header[headerSize + i * 4], blocks[i]);
+        }
+      put32 (&header[24], headerCrc (header, count));
+    }
+
+    // The blocks a header can list.
+    static inline std::size_t
+    headerBlocks (std::size_t blockSize)
+    {
+      return (blockSize - headerSize) / 4;
+    }
+
+    // ------------------------------------------------------------------------
+
+    BlockJournal::BlockJournal (std::size_t blocks, std::size_t group)
+    {
+      assert(blocks > 0);
+      assert(group > 0);
+
+      fDevice = nullptr;
+      fStart = 0;
+      fCount = 0;
+      fBlockSize = 0;
+
+      fBlocks = blocks;
+      fGroup = group;
+      fCapacity = 0;
+
+      fStagedBlocks = new blockNumber_t[blocks];
+      fImages = nullptr;
+      fStaged = 0;
+
+      fLoggedBlocks = new blockNumber_t[blocks];
+      fLogged = 0;
+      fUnflushed = false;
+
+      fHeader = nullptr;
+      fSequence = 0;
+
+      fOperations = 0;
+      fWritesAtBegin = 0;
+      fWrites = 0;
+
+      fCommits = 0;
+      fFlushes = 0;
+      fReplayed = 0;
+    }
+
+    BlockJournal::~BlockJournal ()
+    {
+      delete[] fHeader;
+      delete[] fImages;
+      delete[] fLoggedBlocks;
+      delete[] fStagedBlocks;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    BlockJournal::format (BlockDevice* device, blockNumber_t start,
+                          blockNumber_t count)
+    {
+      assert(device != nullptr);
+
+      std::size_t bs = device->getBlockSize ();
+      if ((bs < headerSize + 4) || (count < 2)
+          || (start > device->getBlocksCount ())
+          || (count > device->getBlocksCount () - start))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* header = new std::uint8_t[bs];
+      buildHeader (header, bs, count, 0, 0, 0, nullptr);
+      int ret = 0;
+      if (device->write (header, start, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          ret = -1;
+        }
+      delete[] header;
+
+      if ((ret == 0) && (device->flush () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    int
+    BlockJournal::attach (BlockDevice* device, blockNumber_t start,
+                          blockNumber_t count)
+    {
+      assert(device != nullptr);
+
+      if (fDevice != nullptr)
+        {
+          errno = EBUSY;
+          return -1;
+        }
+
+      std::size_t bs = device->getBlockSize ();
+      if ((bs < headerSize + 4) || (count < 2)
+          || (start > device->getBlocksCount ())
+          || (count > device->getBlocksCount () - start))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* header = new std::uint8_t[bs];
+      if (device->read (header, start, 1) != 1)
+        {
+          delete[] header;
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+
+      if ((get32 (&header[0]) != journalMagic)
+          || (get32 (&header[4]) != journalVersion)
+          || (get32 (&header[8]) != count))
+        {
+          delete[] header;
+          errno = EINVAL;
+          return -1;
+        }
+
+      // A header is written only after the home blocks of the previous
+      // transaction are on the device; if its write was interrupted,
+      // there is nothing to replay.
+      std::size_t logged = get32 (&header[12]);
+      bool intact = (logged <= count - 1) && (logged <= headerBlocks (bs))
+          && (get32 (&header[24]) == headerCrc (header, logged));
+      if (!intact)
+        {
+          logged = 0;
+        }
+
+      fCapacity = fBlocks;
+      if (fCapacity > count - 1)
+        {
+          fCapacity = count - 1;
+        }
+      if (fCapacity > headerBlocks (bs))
+        {
+          fCapacity = headerBlocks (bs);
+        }
+
+      delete[] fImages;
+      fImages = new std::uint8_t[((logged > fCapacity) ? logged : fCapacity)
+          * bs];
+      delete[] fHeader;
+      fHeader = header;
+
+      fDevice = device;
+      fStart = start;
+      fCount = count;
+      fBlockSize = bs;
+      fSequence = get32 (&header[16]);
+      fStaged = 0;
+      fLogged = 0;
+      fUnflushed = false;
+      fOperations = 0;
+      fReplayed = 0;
+
+      if (intact && (logged == 0))
+        {
+          return 0;
+        }
+
+      // A transaction was interrupted; if the log is complete, write
+      // it home again. Then the log is emptied.
+      int ret = 0;
+      if (logged != 0)
+        {
+          if (device->read (fImages, start + 1, logged)
+              != static_cast<ssize_t> (logged))
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              ret = -1;
+            }
+          else if (crc32 (fImages, logged * bs) == get32 (&header[20]))
+            {
+              for (std::size_t i = 0; (i < logged) && (ret == 0); ++i)
+                {
+                  if (device->write (fImages + i * bs,
+                                     get32 (&header[headerSize + i * 4]), 1)
+                      != 1)
+                    {
+                      if (errno == 0)
+                        {
+                          errno = EIO;
+                        }
+                      ret = -1;
+                    }
+                }
+              fReplayed = logged;
+            }
+        }
+
+      if ((ret < 0) || (flush () < 0) || (writeHeader (0, 0) < 0)
+          || (flush () < 0))
+        {
+          fDevice = nullptr;
+          return -1;
+        }
+      return 0;
+    }
+
+    int
+    BlockJournal::detach (void)
+    {
+      if (fDevice == nullptr)
+        {
+          return 0;
+        }
+
+      int ret = commit ();
+      if ((ret == 0) && (fLogged != 0))
+        {
+          if ((checkpoint () < 0) || (writeHeader (0, 0) < 0)
+              || (flush () < 0))
+            {
+              ret = -1;
+            }
+        }
+
+      // If not empty, the log is written home at the next attach().
+      fDevice = nullptr;
+      fStaged = 0;
+      fLogged = 0;
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    BlockJournal::write (const void* buf, blockNumber_t block,
+                         std::size_t count)
+    {
+      if (fDevice == nullptr)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* p = static_cast<const std::uint8_t*> (buf);
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          auto b = static_cast<blockNumber_t> (block + i);
+          std::size_t index = find (b);
+          if (index == fStaged)
+            {
+              if ((fStaged == fCapacity) && (commit () < 0))
+                {
+                  return -1;
+                }
+              index = fStaged++;
+              fStagedBlocks[index] = b;
+            }
+          std::memcpy (fImages + index * fBlockSize, p + i * fBlockSize,
+                       fBlockSize);
+        }
+      ++fWrites;
+      return static_cast<ssize_t> (count);
+    }
+
+    ssize_t
+    BlockJournal::read (void* buf, blockNumber_t block, std::size_t count)
+    {
+      if (fDevice == nullptr)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (fDevice->read (buf, block, count) != static_cast<ssize_t> (count))
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+
+      auto* p = static_cast<std::uint8_t*> (buf);
+      for (std::size_t i = 0; i < fStaged; ++i)
+        {
+          blockNumber_t b = fStagedBlocks[i];
+          if ((b >= block) && (b - block < count))
+            {
+              std::memcpy (p + (b - block) * fBlockSize,
+                           fImages + i * fBlockSize, fBlockSize);
+            }
+        }
+      return static_cast<ssize_t> (count);
+    }
+
+    int
+    BlockJournal::release (blockNumber_t block, std::size_t count)
+    {
+      if (fDevice == nullptr)
+        {
+          return 0;
+        }
+
+      for (std::size_t i = 0; i < fStaged;)
+        {
+          blockNumber_t b = fStagedBlocks[i];
+          if ((b >= block) && (b - block < count))
+            {
+              // Replace it by the last one.
+              --fStaged;
+              if (i != fStaged)
+                {
+                  fStagedBlocks[i] = fStagedBlocks[fStaged];
+                  std::memcpy (fImages + i * fBlockSize,
+                               fImages + fStaged * fBlockSize, fBlockSize);
+                }
+            }
+          else
+            {
+              ++i;
+            }
+        }
+
+      bool logged = false;
+      for (std::size_t i = 0; (i < fLogged) && !logged; ++i)
+        {
+          blockNumber_t b = fLoggedBlocks[i];
+          logged = (b >= block) && (b - block < count);
+        }
+      if (logged)
+        {
+          // The log must not be written over the new content.
+          if ((checkpoint () < 0) || (writeHeader (0, 0) < 0)
+              || (flush () < 0))
+            {
+              return -1;
+            }
+          fLogged = 0;
+        }
+      return 0;
+    }
+
+    int
+    BlockJournal::commit (void)
+    {
+      if (fDevice == nullptr)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      if (fStaged == 0)
+        {
+          return 0;
+        }
+
+      // The log is about to be reused, the home blocks of the
+      // previous transaction must be on the device.
+      if (checkpoint () < 0)
+        {
+          return -1;
+        }
+
+      if (fDevice->write (fImages, fStart + 1, fStaged)
+          != static_cast<ssize_t> (fStaged))
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+      ++fSequence;
+      if ((writeHeader (fStaged, crc32 (fImages, fStaged * fBlockSize)) < 0)
+          || (flush () < 0))
+        {
+          return -1;
+        }
+
+      // Committed; now the home blocks.
+      std::memcpy (fLoggedBlocks, fStagedBlocks,
+                   fStaged * sizeof(blockNumber_t));
+      fLogged = fStaged;
+      fUnflushed = true;
+      fStaged = 0;
+      fOperations = 0;
+      ++fCommits;
+
+      for (std::size_t i = 0; i < fLogged; ++i)
+        {
+          if (fDevice->write (fImages + i * fBlockSize, fLoggedBlocks[i], 1)
+              != 1)
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              return -1;
+            }
+        }
+      return 0;
+    }
+
+    void
+    BlockJournal::begin (void)
+    {
+      fWritesAtBegin = fWrites;
+    }
+
+    bool
+    BlockJournal::end (void)
+    {
+      if (fWrites != fWritesAtBegin)
+        {
+          ++fOperations;
+          fWritesAtBegin = fWrites;
+        }
+      return (fStaged != 0)
+          && ((fOperations >= fGroup) || (fStaged * 2 > fCapacity));
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    BlockJournal::writeHeader (std::size_t count, std::uint32_t crc)
+    {
+      buildHeader (fHeader, fBlockSize, fCount, count, fSequence, crc,
+                   fStagedBlocks);
+      if (fDevice->write (fHeader, fStart, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+      return 0;
+    }
+
+    int
+    BlockJournal::checkpoint (void)
+    {
+      if (fUnflushed)
+        {
+          if (flush () < 0)
+            {
+              return -1;
+            }
+          fUnflushed = false;
+        }
+      return 0;
+    }
+
+    int
+    BlockJournal::flush (void)
+    {
+      ++fFlushes;
+      return fDevice->flush ();
+    }
+
+    std::size_t
+    BlockJournal::find (blockNumber_t block) const
+    {
+      for (std::size_t i = 0; i < fStaged; ++i)
+        {
+          if (fStagedBlocks[i] == block)
+            {
+              return i;
+            }
+        }
+      return fStaged;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,166 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockRequest.h"
+#include "posix-io/MountManager.h"
+
+#include <cassert>
+#include <cerrno>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    BlockRequest::BlockRequest ()
+    {
+      fIov.iov_base = nullptr;
+      fIov.iov_len = 0;
+      fIovPtr = nullptr;
+      fIovcnt = 0;
+      fBlock = 0;
+      fCount = 0;
+      fCallback = nullptr;
+      fArg = nullptr;
+      fResult = 0;
+      fError = 0;
+      fOperation = READ;
+
+      // Nothing to wait for.
+      fDone.store (true);
+    }
+
+    BlockRequest::~BlockRequest ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    BlockRequest::prepareRead (void* buf, blockNumber_t block,
+                               std::size_t count)
+    {
+      // The length in bytes is set when submitted, when the block
+      // size is known.
+      fIov.iov_base = buf;
+      fIov.iov_len = 0;
+      prepare (READ, &fIov, 1, block);
+      fCount = count;
+    }
+
+    void
+    BlockRequest::prepareReadv (const struct iovec* iov, int iovcnt,
+                                blockNumber_t block)
+    {
+      prepare (READ, iov, iovcnt, block);
+    }
+
+    void
+    BlockRequest::prepareWrite (const void* buf, blockNumber_t block,
+                                std::size_t count)
+    {
+      fIov.iov_base = const_cast<void*> (buf);
+      fIov.iov_len = 0;
+      prepare (WRITE, &fIov, 1, block);
+      fCount = count;
+    }
+
+    void
+    BlockRequest::prepareWritev (const struct iovec* iov, int iovcnt,
+                                 blockNumber_t block)
+    {
+      prepare (WRITE, iov, iovcnt, block);
+    }
+
+    void
+    BlockRequest::prepareFlush (void)
+    {
+      prepare (FLUSH, nullptr, 0, 0);
+    }
+
+    void
+    BlockRequest::setCallback (callback_t callback, void* arg)
+    {
+      fCallback = callback;
+      fArg = arg;
+    }
+
+    ssize_t
+    BlockRequest::wait (void)
+    {
+      while (!isDone ())
+        {
+          schedulerYield ();
+        }
+
+      if (fResult < 0)
+        {
+          errno = fError;
+        }
+      return fResult;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    BlockRequest::complete (ssize_t result, int error)
+    {
+      fResult = result;
+      fError = (result < 0) ? error : 0;
+
+      if (fCallback != nullptr)
+        {
+          fCallback (this, fArg);
+        }
+
+      fDone.store (true, std::memory_order_release);
+    }
+
+    void
+    BlockRequest::prepare (Operation operation, const struct iovec* iov,
+                           int iovcnt, blockNumber_t block)
+    {
+      // Preparing a request still in progress is a bug.
+      assert(isDone ());
+
+      fOperation = operation;
+      fIovPtr = iov;
+      fIovcnt = iovcnt;
+      fBlock = block;
+      fCount = 0;
+      fResult = 0;
+      fError = 0;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
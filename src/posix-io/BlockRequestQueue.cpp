@@ -0,0 +1,396 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockRequestQueue.h"
+#include "posix-io/MountManager.h"
+
+#include "posix/sys/uio.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    BlockRequestQueue::BlockRequestQueue (BlockDevice* device,
+                                          std::size_t capacity)
+    {
+      assert(device != nullptr);
+      assert(capacity > 0);
+
+      std::size_t blockSize = device->getBlockSize ();
+      assert(blockSize > 0);
+
+      fDevice = device;
+      setGeometry (blockSize, device->getBlocksCount (),
+                   device->getAlignment ());
+
+      fCapacity = capacity;
+      fRunMax =
+          (capacity < OS_INTEGER_BLOCK_QUEUE_RUN_MAX) ?
+              capacity : OS_INTEGER_BLOCK_QUEUE_RUN_MAX;
+
+      fStorage = new std::uint8_t[capacity * blockSize];
+      fRequestsArray = new Request[capacity];
+      fRequestsCount = 0;
+      fFreeBuffersArray = new std::uint8_t*[capacity];
+      fIovArray = new struct iovec[fRunMax];
+
+      for (std::size_t i = 0; i < capacity; ++i)
+        {
+          fFreeBuffersArray[i] = &fStorage[i * blockSize];
+        }
+      fFreeBuffersCount = capacity;
+
+      fHead = 0;
+      fPlugs = 0;
+      fLock.clear ();
+
+      resetStatistics ();
+    }
+
+    BlockRequestQueue::~BlockRequestQueue ()
+    {
+      // Do not lose the queued writes.
+      lock ();
+      dispatch ();
+      unlock ();
+
+      delete[] fIovArray;
+      delete[] fFreeBuffersArray;
+      delete[] fRequestsArray;
+      delete[] fStorage;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    BlockRequestQueue::plug (void)
+    {
+      lock ();
+      ++fPlugs;
+      unlock ();
+    }
+
+    int
+    BlockRequestQueue::unplug (void)
+    {
+      errno = 0;
+      int ret = 0;
+
+      lock ();
+      assert(fPlugs > 0);
+      if (--fPlugs == 0)
+        {
+          ret = dispatch ();
+        }
+      unlock ();
+
+      return ret;
+    }
+
+    void
+    BlockRequestQueue::resetStatistics (void)
+    {
+      fMaxDepth = fRequestsCount;
+      fQueuedBlocks = 0;
+      fAbsorbedBlocks = 0;
+      fMergedBlocks = 0;
+      fDispatches = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    BlockRequestQueue::do_read (void* buf, blockNumber_t block,
+                                std::size_t count)
+    {
+      lock ();
+
+      // Queued writes are more recent than the device content.
+      if (overlaps (block, count) && (dispatch () < 0))
+        {
+          unlock ();
+          return -1;
+        }
+
+      ssize_t ret = fDevice->read (buf, block, count);
+
+      unlock ();
+      return ret;
+    }
+
+    ssize_t
+    BlockRequestQueue::do_write (const void* buf, blockNumber_t block,
+                                 std::size_t count)
+    {
+      lock ();
+
+      if ((fPlugs == 0) || (count > fCapacity))
+        {
+          // Not worth queueing; keep the order with the queued writes.
+          if (dispatch () < 0)
+            {
+              unlock ();
+              return -1;
+            }
+
+          ssize_t ret = fDevice->write (buf, block, count);
+          if (ret > 0)
+            {
+              ++fDispatches;
+            }
+
+          unlock ();
+          return ret;
+        }
+
+      auto* p = static_cast<const std::uint8_t*> (buf);
+      std::size_t blockSize = getBlockSize ();
+
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          blockNumber_t b = static_cast<blockNumber_t> (block + i);
+          std::size_t index = lowerBound (b);
+
+          ++fQueuedBlocks;
+          if ((index < fRequestsCount) && (fRequestsArray[index].block == b))
+            {
+              // Already queued, the old content was never written.
+              std::memcpy (fRequestsArray[index].data, &p[i * blockSize],
+                           blockSize);
+              ++fAbsorbedBlocks;
+              continue;
+            }
+
+          if (fFreeBuffersCount == 0)
+            {
+              // Queue full, make room.
+              if (dispatch () < 0)
+                {
+                  unlock ();
+                  return (i > 0) ? static_cast<ssize_t> (i) : -1;
+                }
+              index = 0;
+            }
+
+          std::memmove (&fRequestsArray[index + 1], &fRequestsArray[index],
+                        (fRequestsCount - index) * sizeof(Request));
+          ++fRequestsCount;
+
+          auto& request = fRequestsArray[index];
+          request.block = b;
+          request.data = fFreeBuffersArray[--fFreeBuffersCount];
+          std::memcpy (request.data, &p[i * blockSize], blockSize);
+
+          if (fRequestsCount > fMaxDepth)
+            {
+              fMaxDepth = fRequestsCount;
+            }
+        }
+
+      unlock ();
+      return static_cast<ssize_t> (count);
+    }
+
+    int
+    BlockRequestQueue::do_flush (void)
+    {
+      lock ();
+
+      int ret = dispatch ();
+      if (ret == 0)
+        {
+          ret = fDevice->flush ();
+        }
+
+      unlock ();
+      return ret;
+    }
+
+    int
+    BlockRequestQueue::do_discard (blockNumber_t block, std::size_t count)
+    {
+      lock ();
+
+      // Drop the queued writes of the discarded blocks.
+      std::size_t first = lowerBound (block);
+      std::size_t last = first;
+      while ((last < fRequestsCount)
+          && (fRequestsArray[last].block - block < count))
+        {
+          fFreeBuffersArray[fFreeBuffersCount++] = fRequestsArray[last].data;
+          ++last;
+        }
+
+      std::memmove (&fRequestsArray[first], &fRequestsArray[last],
+                    (fRequestsCount - last) * sizeof(Request));
+      fRequestsCount -= (last - first);
+
+      int ret = fDevice->discard (block, count);
+
+      unlock ();
+      return ret;
+    }
+
+    int
+    BlockRequestQueue::do_prefetch (blockNumber_t block, std::size_t count)
+    {
+      lock ();
+      int ret = fDevice->prefetch (block, count);
+      unlock ();
+
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Write all queued blocks, in ascending order starting from the
+     * head position (C-SCAN), with runs of consecutive blocks in
+     * single requests. Called with the lock taken.
+     *
+     * On error, the blocks not written remain queued.
+     */
+    int
+    BlockRequestQueue::dispatch (void)
+    {
+      if (fRequestsCount == 0)
+        {
+          return 0;
+        }
+
+      std::size_t start = lowerBound (fHead);
+      std::size_t blockSize = getBlockSize ();
+      int ret = 0;
+
+      for (std::size_t pass = 0; (pass < 2) && (ret == 0); ++pass)
+        {
+          std::size_t i = (pass == 0) ? start : 0;
+          std::size_t end = (pass == 0) ? fRequestsCount : start;
+
+          while (i < end)
+            {
+              std::size_t n = 0;
+              blockNumber_t first = fRequestsArray[i].block;
+              while ((i + n < end) && (n < fRunMax)
+                  && (fRequestsArray[i + n].block == first + n))
+                {
+                  fIovArray[n].iov_base = fRequestsArray[i + n].data;
+                  fIovArray[n].iov_len = blockSize;
+                  ++n;
+                }
+
+              if (fDevice->writev (fIovArray, static_cast<int> (n), first)
+                  < 0)
+                {
+                  ret = -1;
+                  break;
+                }
+
+              ++fDispatches;
+              fMergedBlocks += n - 1;
+              fHead = static_cast<blockNumber_t> (first + n);
+
+              // Mark as done.
+              for (std::size_t j = 0; j < n; ++j)
+                {
+                  fFreeBuffersArray[fFreeBuffersCount++] =
+                      fRequestsArray[i + j].data;
+                  fRequestsArray[i + j].data = nullptr;
+                }
+              i += n;
+            }
+        }
+
+      // Remove the written blocks, keeping the others sorted.
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < fRequestsCount; ++i)
+        {
+          if (fRequestsArray[i].data != nullptr)
+            {
+              fRequestsArray[count++] = fRequestsArray[i];
+            }
+        }
+      fRequestsCount = count;
+
+      return ret;
+    }
+
+    std::size_t
+    BlockRequestQueue::lowerBound (blockNumber_t block) const
+    {
+      std::size_t low = 0;
+      std::size_t high = fRequestsCount;
+      while (low < high)
+        {
+          std::size_t mid = low + (high - low) / 2;
+          if (fRequestsArray[mid].block < block)
+            {
+              low = mid + 1;
+            }
+          else
+            {
+              high = mid;
+            }
+        }
+      return low;
+    }
+
+    bool
+    BlockRequestQueue::overlaps (blockNumber_t block, std::size_t count) const
+    {
+      std::size_t index = lowerBound (block);
+      return (index < fRequestsCount)
+          && (fRequestsArray[index].block - block < count);
+    }
+
+    void
+    BlockRequestQueue::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    BlockRequestQueue::unlock (void)
+    {
+      fLock.clear (std::memory_order_release);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -84,6 +84,12 @@ namespace os
       return (std::strcmp (name, fName) == 0);
     }
 
+    bool
+    CharDevice::hasNamePattern (void) const
+    {
+      return false;
+    }
+
     int
     CharDevice::do_isatty (void)
     {
@@ -27,6 +27,7 @@
 
 #include "posix-io/CharDevicesRegistry.h"
 #include "posix-io/CharDevice.h"
+#include "posix-io/hash.h"
 #include <cmsis-plus/diag/trace.h>
 
 #include <cassert>
@@ -41,10 +42,27 @@ namespace os
   {
     // ------------------------------------------------------------------------
 
+    // Marker for the end of the bucket chains.
+    static constexpr std::size_t noDevice = ~static_cast<std::size_t> (0);
+
+    // The prefix is a string literal, no need for strlen().
+    static constexpr std::size_t devicePrefixLength =
+        sizeof(OS_STRING_POSIX_DEVICE_PREFIX) - 1;
+
+    // ------------------------------------------------------------------------
+
     std::size_t CharDevicesRegistry::sfSize;
 
     CharDevice** CharDevicesRegistry::sfRegistryArray;
 
+    std::uint32_t* CharDevicesRegistry::sfHashesArray;
+    std::size_t* CharDevicesRegistry::sfNextArray;
+    std::size_t* CharDevicesRegistry::sfBucketsArray;
+    std::size_t CharDevicesRegistry::sfBucketsMask;
+
+    CharDevice** CharDevicesRegistry::sfPatternsArray;
+    std::size_t CharDevicesRegistry::sfPatternsCount;
+
     // ------------------------------------------------------------------------
 
     CharDevicesRegistry::CharDevicesRegistry (std::size_t size)
@@ -53,16 +71,42 @@ namespace os
 
       sfSize = size;
       sfRegistryArray = new CharDevice*[size];
+      sfHashesArray = new std::uint32_t[size];
+      sfNextArray = new std::size_t[size];
+      sfPatternsArray = new CharDevice*[size];
+      sfPatternsCount = 0;
 
       for (std::size_t i = 0; i < size; ++i)
         {
           sfRegistryArray[i] = nullptr;
+          sfHashesArray[i] = 0;
+          sfNextArray[i] = noDevice;
+          sfPatternsArray[i] = nullptr;
+        }
+
+      // Use a power of 2 number of buckets, at least as many as devices.
+      std::size_t buckets = 1;
+      while (buckets < size)
+        {
+          buckets <<= 1;
+        }
+      sfBucketsMask = buckets - 1;
+      sfBucketsArray = new std::size_t[buckets];
+
+      for (std::size_t i = 0; i < buckets; ++i)
+        {
+          sfBucketsArray[i] = noDevice;
         }
     }
 
     CharDevicesRegistry::~CharDevicesRegistry ()
     {
       delete[] sfRegistryArray;
+      delete[] sfHashesArray;
+      delete[] sfNextArray;
+      delete[] sfBucketsArray;
+      delete[] sfPatternsArray;
+      sfPatternsCount = 0;
       sfSize = 0;
     }
 
@@ -95,6 +139,20 @@ namespace os
           if (sfRegistryArray[i] == nullptr)
             {
               sfRegistryArray[i] = device;
+
+              if (device->hasNamePattern ())
+                {
+                  sfPatternsArray[sfPatternsCount++] = device;
+                }
+              else
+                {
+                  // Link it in the bucket of the name hash.
+                  auto hash = hashString (device->getName ());
+                  auto& bucket = sfBucketsArray[hash & sfBucketsMask];
+                  sfHashesArray[i] = hash;
+                  sfNextArray[i] = bucket;
+                  bucket = i;
+                }
               return;
             }
         }
@@ -110,6 +168,33 @@ namespace os
         {
           if (sfRegistryArray[i] == device)
             {
+              if (device->hasNamePattern ())
+                {
+                  for (std::size_t j = 0; j < sfPatternsCount; ++j)
+                    {
+                      if (sfPatternsArray[j] == device)
+                        {
+                          sfPatternsArray[j] =
+                              sfPatternsArray[--sfPatternsCount];
+                          sfPatternsArray[sfPatternsCount] = nullptr;
+                          break;
+                        }
+                    }
+                }
+              else
+                {
+                  // Unlink it from the bucket chain.
+                  auto* link = &sfBucketsArray[sfHashesArray[i]
+                      & sfBucketsMask];
+                  while (*link != i)
+                    {
+                      assert(*link != noDevice);
+                      link = &sfNextArray[*link];
+                    }
+                  *link = sfNextArray[i];
+                  sfNextArray[i] = noDevice;
+                }
+
               sfRegistryArray[i] = nullptr;
               return;
             }
@@ -119,6 +204,11 @@ namespace os
     }
 
     /**
+     * Exact names are found in the hash index; only if none matches,
+     * the devices with name patterns are tried, in order, and then
+     * matchName() of all devices, for those overriding it without
+     * hasNamePattern().
+     *
      * return pointer to device or nullptr if not found.
      */
     CharDevice*
@@ -126,21 +216,43 @@ namespace os
     {
       assert(path != nullptr);
 
-      auto prefix = CharDevice::getDevicePrefix ();
-      if (std::strncmp (prefix, path, std::strlen (prefix)) != 0)
+      if (std::strncmp (CharDevice::getDevicePrefix (), path,
+                        devicePrefixLength) != 0)
         {
           // The device prefix does not match, not a device.
           return nullptr;
         }
 
       // The prefix was identified; try to match the rest of the path.
-      auto name = path + std::strlen (prefix);
+      auto name = path + devicePrefixLength;
+
+      auto hash = hashString (name);
+      auto index = sfBucketsArray[hash & sfBucketsMask];
+      while (index != noDevice)
+        {
+          if ((sfHashesArray[index] == hash)
+              && (std::strcmp (sfRegistryArray[index]->getName (), name) == 0))
+            {
+              return sfRegistryArray[index];
+            }
+          index = sfNextArray[index];
+        }
+
+      for (std::size_t i = 0; i < sfPatternsCount; ++i)
+        {
+          if (sfPatternsArray[i]->matchName (name))
+            {
+              // Return the first device that matches the path.
+              return sfPatternsArray[i];
+            }
+        }
+
       for (std::size_t i = 0; i < sfSize; ++i)
         {
-          if (sfRegistryArray[i] != nullptr
+          if ((sfRegistryArray[i] != nullptr)
               && sfRegistryArray[i]->matchName (name))
             {
-              // Return the first device that matches the path.
+              // An alias, slower than the exact name.
               return sfRegistryArray[i];
             }
         }
@@ -26,12 +26,17 @@
  */
 
 #include "posix-io/Directory.h"
+#include "posix-io/FileDescriptorsManager.h"
 #include "posix-io/FileSystem.h"
 #include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
 #include "posix-io/Pool.h"
+#include "posix-io/path.h"
 
 #include <cerrno>
+#include <cstddef>
 #include <cassert>
+#include <cstring>
 
 // ----------------------------------------------------------------------------
 
@@ -56,11 +61,27 @@ namespace os
           return nullptr;
         }
 
+      char normalized[OS_INTEGER_PATH_MAX];
+      dirname = normalizePath (dirname, normalized, sizeof(normalized));
+      if (dirname == nullptr)
+        {
+          return nullptr;
+        }
+
       errno = 0;
 
-      auto adjusted_dirname = dirname;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_dirname);
+      const char* adjusted_dirname;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (dirname, &fs, &adjusted_dirname, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return nullptr;
+        }
 
       // The manager will return null if there are no file systems
       // registered, no need to check this condition separately.
@@ -72,19 +93,90 @@ namespace os
 
       // Use the file system implementation to open the directory, using
       // the adjusted path (mount point prefix removed).
-      return fs->opendir (adjusted_dirname);
+      auto* const dir = fs->opendir (adjusted_dirname, node);
+      PathCache::update (dirname, fs, adjusted_dirname,
+                         (dir != nullptr) ? dir->getNode () : nullptr,
+                         (dir != nullptr) ? 0 : -1, generation);
+      fs->release ();
+      if (dir != nullptr)
+        {
+          // Remembered for the *at() functions.
+          dir->setPath (dirname, adjusted_dirname);
+        }
+      return dir;
+    }
+
+    const char*
+    resolveAtPath (int fildes, const char* path, Directory** dir, char* buf,
+                   std::size_t size)
+    {
+      *dir = nullptr;
+
+      if ((*path == '/') || (fildes == AT_FDCWD))
+        {
+          return path;
+        }
+
+      auto* const io = FileDescriptorsManager::getIo (fildes);
+      if (io == nullptr)
+        {
+          errno = EBADF;
+          return nullptr;
+        }
+
+      if (io->getType () != IO::Type::DIRECTORY)
+        {
+          errno = ENOTDIR;
+          return nullptr;
+        }
+
+      auto* const d = static_cast<Directory*> (io);
+      if (*d->getPath () == '\0')
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+
+      // Only descending paths, inside the same file system, can be
+      // resolved relative to the directory node.
+      bool descending = true;
+      for (const char* p = path; *p != '\0'; ++p)
+        {
+          if ((p[0] == '.') && (p[1] == '.') && ((p == path) || (p[-1] == '/'))
+              && ((p[2] == '\0') || (p[2] == '/')))
+            {
+              descending = false;
+              break;
+            }
+        }
+
+      if (descending && !d->hasMountsBelow ())
+        {
+          *dir = d;
+          return path;
+        }
+
+      return joinPath (d->getPath (), path, buf, size);
     }
 
     // ------------------------------------------------------------------------
 
     Directory::Directory (void)
     {
+      fType = Type::DIRECTORY;
+
       fFileSystem = nullptr;
+      fNode = nullptr;
+      fMountsGeneration = 0;
+      fMountsBelow = true;
+      fAdjustedOffset = 0;
+      fPath[0] = '\0';
     }
 
     Directory::~Directory ()
     {
       fFileSystem = nullptr;
+      fNode = nullptr;
     }
 
     // ------------------------------------------------------------------------
@@ -99,6 +191,45 @@ namespace os
       return do_read ();
     }
 
+    struct dirent*
+    Directory::read_plus (struct stat* buf)
+    {
+      assert(fFileSystem != nullptr);
+      errno = 0;
+
+      if (buf == nullptr)
+        {
+          errno = EFAULT;
+          return nullptr;
+        }
+
+      if ((fPath[0] != '\0') && hasMountsBelow ())
+        {
+          // The names of the mount points are resolved by path,
+          // as stat() does.
+          return Directory::do_read_plus (buf);
+        }
+
+      // Execute the implementation specific code.
+      return do_read_plus (buf);
+    }
+
+    ssize_t
+    Directory::read_batch (void* buf, std::size_t size)
+    {
+      assert(fFileSystem != nullptr);
+      errno = 0;
+
+      if (buf == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      // Execute the implementation specific code.
+      return do_read_batch (buf, size);
+    }
+
     void
     Directory::rewind (void)
     {
@@ -117,14 +248,98 @@ namespace os
 
       // Execute the implementation specific code.
       int ret = do_close ();
-      auto* const pool = fFileSystem->getDirsPool ();
-      if (pool != nullptr)
+
+      // If dirfd() was used, remove it from the file descriptors registry.
+      if (getFileDescriptor () != noFileDescriptor)
         {
-          pool->release (this);
+          FileDescriptorsManager::free (getFileDescriptor ());
         }
+
+      do_release ();
       return ret;
     }
 
+    int
+    Directory::dirfd (void)
+    {
+      assert(fFileSystem != nullptr);
+      errno = 0;
+
+      if (getFileDescriptor () == noFileDescriptor)
+        {
+          // Unlike files, a failure does not close the directory.
+          return FileDescriptorsManager::alloc (this);
+        }
+
+      return getFileDescriptor ();
+    }
+
+    std::size_t
+    Directory::packEntry (void* buf, std::size_t size, ino_t ino,
+                          unsigned char type, const char* name)
+    {
+      constexpr std::size_t align = alignof(struct posix_dent);
+      std::size_t len = offsetof(struct posix_dent, d_name)
+          + std::strlen (name) + 1;
+      len = (len + align - 1) & ~(align - 1);
+      if (len > size)
+        {
+          return 0;
+        }
+
+      // The system structure may have more members, like d_off.
+      std::memset (buf, 0, offsetof(struct posix_dent, d_name));
+      auto* const dent = static_cast<struct posix_dent*> (buf);
+      dent->d_ino = ino;
+      dent->d_reclen = static_cast<reclen_t> (len);
+      dent->d_type = type;
+      std::strcpy (dent->d_name, name);
+      return len;
+    }
+
+    void
+    Directory::setPath (const char* path, const char* adjustedPath)
+    {
+      // Store it without the trailing '/', except for the root.
+      auto len = std::strlen (path);
+      if ((len > 1) && (path[len - 1] == '/'))
+        {
+          --len;
+        }
+
+      if (len >= sizeof(fPath))
+        {
+          // Too long, the *at() functions will fail.
+          fPath[0] = '\0';
+          fAdjustedOffset = 0;
+          return;
+        }
+
+      std::memcpy (fPath, path, len);
+      fPath[len] = '\0';
+
+      fAdjustedOffset = static_cast<std::size_t> (adjustedPath - path);
+      if (fAdjustedOffset > len)
+        {
+          fAdjustedOffset = len;
+        }
+
+      // Force the check at first use.
+      fMountsGeneration = MountManager::getGeneration () - 1;
+    }
+
+    bool
+    Directory::hasMountsBelow (void)
+    {
+      auto generation = MountManager::getGeneration ();
+      if (fMountsGeneration != generation)
+        {
+          fMountsBelow = MountManager::hasMountsBelow (fPath);
+          fMountsGeneration = generation;
+        }
+      return fMountsBelow;
+    }
+
     // ------------------------------------------------------------------------
     // Default implementations; overwrite them with real code.
 
@@ -138,6 +353,73 @@ namespace os
       return nullptr;
     }
 
+    struct dirent*
+    Directory::do_read_plus (struct stat* buf)
+    {
+      assert(fFileSystem != nullptr);
+
+      auto* const entry = do_read ();
+      if (entry == nullptr)
+        {
+          return nullptr;
+        }
+
+      int ret;
+      if (fPath[0] == '\0')
+        {
+          // Too long, as for the *at() functions.
+          errno = ENAMETOOLONG;
+          ret = -1;
+        }
+      else if (!hasMountsBelow () && (std::strcmp (entry->d_name, "..") != 0))
+        {
+          // As fstatat() relative to this directory.
+          ret = fFileSystem->do_statat (this, entry->d_name, buf);
+        }
+      else
+        {
+          // Possibly in another file system.
+          char joined[OS_INTEGER_PATH_MAX];
+          const char* path = joinPath (fPath, entry->d_name, joined,
+                                       sizeof(joined));
+          ret = (path != nullptr) ? os::posix::stat (path, buf) : -1;
+        }
+      return (ret == 0) ? entry : nullptr;
+    }
+
+    ssize_t
+    Directory::do_read_batch (void* buf, std::size_t size)
+    {
+      // An entry is not given back once read, so stop before
+      // reading one that might not fit.
+      constexpr std::size_t longest = (offsetof(struct posix_dent, d_name)
+          + sizeof(fDirEntry.d_name) + alignof(struct posix_dent) - 1)
+          & ~(alignof(struct posix_dent) - 1);
+      if (size < longest)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* p = static_cast<char*> (buf);
+      std::size_t used = 0;
+      while (size - used >= longest)
+        {
+          auto* const entry = do_read ();
+          if (entry == nullptr)
+            {
+              if (errno != 0)
+                {
+                  return (used != 0) ? static_cast<ssize_t> (used) : -1;
+                }
+              break;
+            }
+          used += packEntry (p + used, size - used, entry->d_ino, DT_UNKNOWN,
+                             entry->d_name);
+        }
+      return static_cast<ssize_t> (used);
+    }
+
     void
     Directory::do_rewind (void)
     {
@@ -152,6 +434,27 @@ namespace os
       return 0;
     }
 
+    int
+    Directory::do_fstat (struct stat* buf)
+    {
+      assert(fFileSystem != nullptr);
+
+      return fFileSystem->do_statat (this, ".", buf);
+    }
+
+    void
+    Directory::do_release (void)
+    {
+      // Return the object to the pool it was acquired from.
+      auto* const pool = fFileSystem->getDirsPool ();
+      if (pool != nullptr)
+        {
+          pool->release (this);
+        }
+      fNode = nullptr;
+      fPath[0] = '\0';
+    }
+
   } /* namespace posix */
 } /* namespace os */
 
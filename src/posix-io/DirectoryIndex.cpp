@@ -0,0 +1,423 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/DirectoryIndex.h"
+
+#include <cassert>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the chains and lists.
+    static constexpr std::uint32_t noEntry = ~static_cast<std::uint32_t> (0);
+
+    // The states of the directory slots.
+    static constexpr std::uint8_t slotFree = 0;
+    static constexpr std::uint8_t slotIndexing = 1;
+    static constexpr std::uint8_t slotIndexed = 2;
+
+    // ------------------------------------------------------------------------
+
+    DirectoryIndex::DirectoryIndex (std::size_t entries,
+                                    std::size_t directories)
+    {
+      assert(entries > 0);
+      assert(entries < noEntry);
+      assert(directories > 0);
+
+      fEntries = new Entry[entries];
+      fSize = entries;
+
+      std::size_t buckets = 1;
+      while (buckets < entries)
+        {
+          buckets <<= 1;
+        }
+      fBuckets = new std::uint32_t[buckets];
+      fBucketsMask = static_cast<std::uint32_t> (buckets - 1);
+
+      fSlots = new Slot[directories];
+      fSlotsCount = directories;
+
+      fLookups = 0;
+      fCandidates = 0;
+
+      clear ();
+    }
+
+    DirectoryIndex::~DirectoryIndex ()
+    {
+      delete[] fSlots;
+      delete[] fBuckets;
+      delete[] fEntries;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    DirectoryIndex::begin (std::uint32_t dir)
+    {
+      std::size_t slot = findSlot (dir);
+      if (slot < fSlotsCount)
+        {
+          release (slot);
+        }
+      else
+        {
+          // A free slot, or the least recently used one.
+          slot = 0;
+          for (std::size_t i = 0; i < fSlotsCount; ++i)
+            {
+              if (fSlots[i].state == slotFree)
+                {
+                  slot = i;
+                  break;
+                }
+              if (fSlots[i].stamp < fSlots[slot].stamp)
+                {
+                  slot = i;
+                }
+            }
+          release (slot);
+        }
+
+      Slot* s = &fSlots[slot];
+      s->key = dir;
+      s->hint = 0;
+      s->stamp = ++fStamp;
+      s->state = slotIndexing;
+    }
+
+    bool
+    DirectoryIndex::add (std::uint32_t dir, std::uint32_t hash,
+                         std::uint32_t value)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot >= fSlotsCount) || (fSlots[slot].state != slotIndexing))
+        {
+          return false;
+        }
+
+      std::uint32_t index = allocate (slot);
+      if (index == noEntry)
+        {
+          // Larger than the entire index.
+          release (slot);
+          return false;
+        }
+
+      link (slot, hash, value, index);
+      return true;
+    }
+
+    void
+    DirectoryIndex::commit (std::uint32_t dir, std::uint32_t hint)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot < fSlotsCount) && (fSlots[slot].state == slotIndexing))
+        {
+          fSlots[slot].state = slotIndexed;
+          fSlots[slot].hint = hint;
+        }
+    }
+
+    bool
+    DirectoryIndex::isIndexed (std::uint32_t dir)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot >= fSlotsCount) || (fSlots[slot].state != slotIndexed))
+        {
+          return false;
+        }
+
+      fSlots[slot].stamp = ++fStamp;
+      return true;
+    }
+
+    bool
+    DirectoryIndex::lookup (std::uint32_t dir, std::uint32_t hash,
+                            std::size_t* cursor, std::uint32_t* value)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot >= fSlotsCount) || (fSlots[slot].state != slotIndexed))
+        {
+          return false;
+        }
+
+      std::uint32_t index;
+      if (*cursor == 0)
+        {
+          ++fLookups;
+          index = fBuckets[bucketOf (hash, slot)];
+        }
+      else
+        {
+          index = fEntries[*cursor - 1].nextInBucket;
+        }
+
+      for (; index != noEntry; index = fEntries[index].nextInBucket)
+        {
+          const Entry* e = &fEntries[index];
+          if ((e->hash == hash) && (e->slot == slot))
+            {
+              *cursor = static_cast<std::size_t> (index) + 1;
+              *value = e->value;
+              ++fCandidates;
+              return true;
+            }
+        }
+      return false;
+    }
+
+    void
+    DirectoryIndex::insert (std::uint32_t dir, std::uint32_t hash,
+                            std::uint32_t value)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot >= fSlotsCount) || (fSlots[slot].state != slotIndexed))
+        {
+          return;
+        }
+
+      std::uint32_t index = allocate (slot);
+      if (index == noEntry)
+        {
+          release (slot);
+          return;
+        }
+
+      link (slot, hash, value, index);
+    }
+
+    void
+    DirectoryIndex::remove (std::uint32_t dir, std::uint32_t hash,
+                            std::uint32_t value)
+    {
+      std::size_t slot = findSlot (dir);
+      if (slot >= fSlotsCount)
+        {
+          return;
+        }
+
+      for (std::uint32_t index = fBuckets[bucketOf (hash, slot)];
+          index != noEntry; index = fEntries[index].nextInBucket)
+        {
+          const Entry* e = &fEntries[index];
+          if ((e->hash == hash) && (e->value == value) && (e->slot == slot))
+            {
+              unlink (index);
+              return;
+            }
+        }
+    }
+
+    void
+    DirectoryIndex::drop (std::uint32_t dir)
+    {
+      std::size_t slot = findSlot (dir);
+      if (slot < fSlotsCount)
+        {
+          release (slot);
+        }
+    }
+
+    void
+    DirectoryIndex::clear (void)
+    {
+      for (std::size_t i = 0; i <= fBucketsMask; ++i)
+        {
+          fBuckets[i] = noEntry;
+        }
+
+      for (std::size_t i = 0; i < fSize; ++i)
+        {
+          fEntries[i].nextInBucket =
+              (i + 1 < fSize) ? static_cast<std::uint32_t> (i + 1) : noEntry;
+        }
+      fFree = 0;
+      fUsed = 0;
+
+      for (std::size_t i = 0; i < fSlotsCount; ++i)
+        {
+          fSlots[i].first = noEntry;
+          fSlots[i].count = 0;
+          fSlots[i].stamp = 0;
+          fSlots[i].state = slotFree;
+        }
+      fStamp = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::uint32_t
+    DirectoryIndex::getHint (std::uint32_t dir) const
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot >= fSlotsCount) || (fSlots[slot].state != slotIndexed))
+        {
+          return 0;
+        }
+      return fSlots[slot].hint;
+    }
+
+    void
+    DirectoryIndex::setHint (std::uint32_t dir, std::uint32_t hint)
+    {
+      std::size_t slot = findSlot (dir);
+      if ((slot < fSlotsCount) && (fSlots[slot].state == slotIndexed))
+        {
+          fSlots[slot].hint = hint;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    DirectoryIndex::findSlot (std::uint32_t dir) const
+    {
+      for (std::size_t i = 0; i < fSlotsCount; ++i)
+        {
+          if ((fSlots[i].state != slotFree) && (fSlots[i].key == dir))
+            {
+              return i;
+            }
+        }
+      return fSlotsCount;
+    }
+
+    std::uint32_t
+    DirectoryIndex::bucketOf (std::uint32_t hash, std::size_t slot) const
+    {
+      return (hash ^ (static_cast<std::uint32_t> (slot + 1) * 0x9E3779B1u))
+          & fBucketsMask;
+    }
+
+    std::uint32_t
+    DirectoryIndex::allocate (std::size_t slot)
+    {
+      while (fFree == noEntry)
+        {
+          // Make room by dropping the least recently used directory.
+          std::size_t victim = fSlotsCount;
+          for (std::size_t i = 0; i < fSlotsCount; ++i)
+            {
+              if ((i != slot) && (fSlots[i].state != slotFree)
+                  && ((victim == fSlotsCount)
+                      || (fSlots[i].stamp < fSlots[victim].stamp)))
+                {
+                  victim = i;
+                }
+            }
+          if (victim == fSlotsCount)
+            {
+              return noEntry;
+            }
+          release (victim);
+        }
+
+      std::uint32_t index = fFree;
+      fFree = fEntries[index].nextInBucket;
+      ++fUsed;
+      return index;
+    }
+
+    void
+    DirectoryIndex::link (std::size_t slot, std::uint32_t hash,
+                          std::uint32_t value, std::uint32_t index)
+    {
+      Entry* e = &fEntries[index];
+      e->hash = hash;
+      e->value = value;
+      e->slot = static_cast<std::uint32_t> (slot);
+
+      std::uint32_t bucket = bucketOf (hash, slot);
+      e->nextInBucket = fBuckets[bucket];
+      fBuckets[bucket] = index;
+
+      Slot* s = &fSlots[slot];
+      e->prevInDir = noEntry;
+      e->nextInDir = s->first;
+      if (s->first != noEntry)
+        {
+          fEntries[s->first].prevInDir = index;
+        }
+      s->first = index;
+      ++s->count;
+    }
+
+    void
+    DirectoryIndex::unlink (std::uint32_t index)
+    {
+      Entry* e = &fEntries[index];
+
+      std::uint32_t* link = &fBuckets[bucketOf (e->hash, e->slot)];
+      while (*link != index)
+        {
+          link = &fEntries[*link].nextInBucket;
+        }
+      *link = e->nextInBucket;
+
+      Slot* s = &fSlots[e->slot];
+      if (e->prevInDir != noEntry)
+        {
+          fEntries[e->prevInDir].nextInDir = e->nextInDir;
+        }
+      else
+        {
+          s->first = e->nextInDir;
+        }
+      if (e->nextInDir != noEntry)
+        {
+          fEntries[e->nextInDir].prevInDir = e->prevInDir;
+        }
+      --s->count;
+
+      e->nextInBucket = fFree;
+      fFree = index;
+      --fUsed;
+    }
+
+    void
+    DirectoryIndex::release (std::size_t slot)
+    {
+      Slot* s = &fSlots[slot];
+      while (s->first != noEntry)
+        {
+          unlink (s->first);
+        }
+      s->state = slotFree;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,4378 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/Pool.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Directory entry attributes.
+    static constexpr std::uint8_t attrReadOnly = 0x01;
+    static constexpr std::uint8_t attrVolumeId = 0x08;
+    static constexpr std::uint8_t attrDirectory = 0x10;
+    static constexpr std::uint8_t attrArchive = 0x20;
+    static constexpr std::uint8_t attrLongName = 0x0F;
+
+    // NTRes bits, for short names stored in lower case.
+    static constexpr std::uint8_t lowerBase = 0x08;
+    static constexpr std::uint8_t lowerExt = 0x10;
+
+    static constexpr std::uint8_t entryFree = 0xE5;
+    static constexpr std::size_t entrySize = 32;
+
+    // Characters of a long name entry, and their offsets.
+    static constexpr std::size_t longChars = 13;
+    static const std::uint8_t longOffsets[longChars] =
+      { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+    // A directory has at most 65536 entries.
+    static constexpr std::uint32_t dirEntriesMax = 65536;
+
+    static constexpr std::uint32_t noSector = ~static_cast<std::uint32_t> (0);
+
+    // 1980-01-01, the FAT epoch.
+    static constexpr std::time_t fatEpoch = 315532800;
+
+    static inline std::uint16_t
+    get16 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint16_t> (p[0] | (p[1] << 8));
+    }
+
+    static inline std::uint32_t
+    get32 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint32_t> (p[0])
+          | (static_cast<std::uint32_t> (p[1]) << 8)
+          | (static_cast<std::uint32_t> (p[2]) << 16)
+          | (static_cast<std::uint32_t> (p[3]) << 24);
+    }
+
+    static inline void
+    put16 (std::uint8_t* p, std::uint32_t value)
+    {
+      p[0] = static_cast<std::uint8_t> (value);
+      p[1] = static_cast<std::uint8_t> (value >> 8);
+    }
+
+    static inline void
+    put32 (std::uint8_t* p, std::uint32_t value)
+    {
+      put16 (p, value);
+      put16 (p + 2, value >> 16);
+    }
+
+    static inline bool
+    isPowerOf2 (std::size_t n)
+    {
+      return (n != 0) && ((n & (n - 1)) == 0);
+    }
+
+    static inline char
+    toUpper (char c)
+    {
+      return ((c >= 'a') && (c <= 'z')) ? static_cast<char> (c - 'a' + 'A') : c;
+    }
+
+    static inline char
+    toLower (char c)
+    {
+      return ((c >= 'A') && (c <= 'Z')) ? static_cast<char> (c - 'A' + 'a') : c;
+    }
+
+    static bool
+    sameName (const char* name, const char* other, std::size_t len)
+    {
+      if (std::strlen (other) != len)
+        {
+          return false;
+        }
+      for (std::size_t i = 0; i < len; ++i)
+        {
+          if (toUpper (name[i]) != toUpper (other[i]))
+            {
+              return false;
+            }
+        }
+      return true;
+    }
+
+    // FNV-1a of the name folded as sameName() compares it.
+    static std::uint32_t
+    hashName (const char* name, std::size_t len)
+    {
+      std::uint32_t hash = 2166136261u;
+      for (std::size_t i = 0; i < len; ++i)
+        {
+          hash ^= static_cast<std::uint8_t> (toUpper (name[i]));
+          hash *= 16777619u;
+        }
+      return hash;
+    }
+
+    static std::uint8_t
+    checksum (const std::uint8_t* shortName)
+    {
+      std::uint8_t sum = 0;
+      for (std::size_t i = 0; i < 11; ++i)
+        {
+          sum = static_cast<std::uint8_t> (((sum & 1) << 7) + (sum >> 1)
+              + shortName[i]);
+        }
+      return sum;
+    }
+
+    // Characters valid in short names, besides letters and digits.
+    static bool
+    isShortChar (char c)
+    {
+      if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))
+          || ((c >= '0') && (c <= '9')))
+        {
+          return true;
+        }
+      return (c != '\0') && (std::strchr ("!#$%&'()-@^_`{}~", c) != nullptr);
+    }
+
+    /**
+     * Convert UTF-8 to UTF-16.
+     *
+     * @return The number of UTF-16 units, or -1 if invalid.
+     */
+    // The 8.3 name of a short entry, with a dot, in the case given
+    // by the NTRes bits.
+    static void
+    shortNameOf (const std::uint8_t* e, char* s)
+    {
+      for (std::size_t i = 0; (i < 8) && (e[i] != ' '); ++i)
+        {
+          char c = static_cast<char> (((i == 0) && (e[0] == 0x05)) ?
+              entryFree : e[i]);
+          *s++ = ((e[12] & lowerBase) != 0) ? toLower (c) : c;
+        }
+      if (e[8] != ' ')
+        {
+          *s++ = '.';
+          for (std::size_t i = 8; (i < 11) && (e[i] != ' '); ++i)
+            {
+              char c = static_cast<char> (e[i]);
+              *s++ = ((e[12] & lowerExt) != 0) ? toLower (c) : c;
+            }
+        }
+      *s = '\0';
+    }
+
+    static int
+    toUtf16 (const char* name, std::size_t len, std::uint16_t* out,
+             std::size_t max)
+    {
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < len;)
+        {
+          auto c = static_cast<std::uint8_t> (name[i]);
+          std::uint32_t cp;
+          std::size_t extra;
+          if (c < 0x80)
+            {
+              cp = c;
+              extra = 0;
+            }
+          else if ((c & 0xE0) == 0xC0)
+            {
+              cp = c & 0x1F;
+              extra = 1;
+            }
+          else if ((c & 0xF0) == 0xE0)
+            {
+              cp = c & 0x0F;
+              extra = 2;
+            }
+          else if ((c & 0xF8) == 0xF0)
+            {
+              cp = c & 0x07;
+              extra = 3;
+            }
+          else
+            {
+              return -1;
+            }
+          if (i + extra >= len)
+            {
+              return -1;
+            }
+          for (std::size_t j = 1; j <= extra; ++j)
+            {
+              auto cc = static_cast<std::uint8_t> (name[i + j]);
+              if ((cc & 0xC0) != 0x80)
+                {
+                  return -1;
+                }
+              cp = (cp << 6) | (cc & 0x3F);
+            }
+          i += extra + 1;
+
+          if (cp >= 0x10000)
+            {
+              if (n + 2 > max)
+                {
+                  return -1;
+                }
+              cp -= 0x10000;
+              out[n++] = static_cast<std::uint16_t> (0xD800 + (cp >> 10));
+              out[n++] = static_cast<std::uint16_t> (0xDC00 + (cp & 0x3FF));
+            }
+          else
+            {
+              if (n + 1 > max)
+                {
+                  return -1;
+                }
+              out[n++] = static_cast<std::uint16_t> (cp);
+            }
+        }
+      return static_cast<int> (n);
+    }
+
+    /**
+     * Convert UTF-16 to UTF-8, with a terminator.
+     *
+     * @return false if it does not fit.
+     */
+    static bool
+    toUtf8 (const std::uint16_t* in, std::size_t n, char* out, std::size_t max)
+    {
+      std::size_t len = 0;
+      for (std::size_t i = 0; i < n; ++i)
+        {
+          std::uint32_t cp = in[i];
+          if ((cp >= 0xD800) && (cp < 0xDC00) && (i + 1 < n)
+              && (in[i + 1] >= 0xDC00) && (in[i + 1] < 0xE000))
+            {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (in[i + 1] - 0xDC00);
+              ++i;
+            }
+
+          char buf[4];
+          std::size_t k;
+          if (cp < 0x80)
+            {
+              buf[0] = static_cast<char> (cp);
+              k = 1;
+            }
+          else if (cp < 0x800)
+            {
+              buf[0] = static_cast<char> (0xC0 | (cp >> 6));
+              buf[1] = static_cast<char> (0x80 | (cp & 0x3F));
+              k = 2;
+            }
+          else if (cp < 0x10000)
+            {
+              buf[0] = static_cast<char> (0xE0 | (cp >> 12));
+              buf[1] = static_cast<char> (0x80 | ((cp >> 6) & 0x3F));
+              buf[2] = static_cast<char> (0x80 | (cp & 0x3F));
+              k = 3;
+            }
+          else
+            {
+              buf[0] = static_cast<char> (0xF0 | (cp >> 18));
+              buf[1] = static_cast<char> (0x80 | ((cp >> 12) & 0x3F));
+              buf[2] = static_cast<char> (0x80 | ((cp >> 6) & 0x3F));
+              buf[3] = static_cast<char> (0x80 | (cp & 0x3F));
+              k = 4;
+            }
+          if (len + k >= max)
+            {
+              return false;
+            }
+          std::memcpy (out + len, buf, k);
+          len += k;
+        }
+      out[len] = '\0';
+      return true;
+    }
+
+    // Days since 1970-01-01 to and from the civil date.
+
+    static std::int32_t
+    daysFromCivil (std::int32_t y, std::uint32_t m, std::uint32_t d)
+    {
+      y -= (m <= 2) ? 1 : 0;
+      std::int32_t era = y / 400;
+      auto yoe = static_cast<std::uint32_t> (y - era * 400);
+      std::uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+      std::uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      return era * 146097 + static_cast<std::int32_t> (doe) - 719468;
+    }
+
+    static void
+    civilFromDays (std::int32_t z, std::int32_t* y, std::uint32_t* m,
+                   std::uint32_t* d)
+    {
+      z += 719468;
+      std::int32_t era = z / 146097;
+      auto doe = static_cast<std::uint32_t> (z - era * 146097);
+      std::uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096)
+          / 365;
+      std::uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      std::uint32_t mp = (5 * doy + 2) / 153;
+      *d = doy - (153 * mp + 2) / 5 + 1;
+      *m = (mp < 10) ? mp + 3 : mp - 9;
+      *y = static_cast<std::int32_t> (yoe) + era * 400 + ((*m <= 2) ? 1 : 0);
+    }
+
+    static void
+    toFatTime (std::time_t t, std::uint8_t* date, std::uint8_t* time)
+    {
+      if (t < fatEpoch)
+        {
+          t = fatEpoch;
+        }
+      auto days = static_cast<std::int32_t> (t / 86400);
+      auto secs = static_cast<std::uint32_t> (t % 86400);
+
+      std::int32_t y;
+      std::uint32_t m;
+      std::uint32_t d;
+      civilFromDays (days, &y, &m, &d);
+      if (y > 2107)
+        {
+          y = 2107;
+          m = 12;
+          d = 31;
+          secs = 86399;
+        }
+
+      put16 (date, (static_cast<std::uint32_t> (y - 1980) << 9) | (m << 5) | d);
+      if (time != nullptr)
+        {
+          put16 (time,
+                 ((secs / 3600) << 11) | (((secs / 60) % 60) << 5)
+                     | ((secs % 60) / 2));
+        }
+    }
+
+    static std::time_t
+    fromFatTime (const std::uint8_t* date, const std::uint8_t* time)
+    {
+      std::uint32_t dv = get16 (date);
+      std::uint32_t m = (dv >> 5) & 0x0F;
+      std::uint32_t d = dv & 0x1F;
+      if ((m == 0) || (d == 0))
+        {
+          // Not set.
+          return 0;
+        }
+      std::time_t t = static_cast<std::time_t> (daysFromCivil (
+          static_cast<std::int32_t> (1980 + (dv >> 9)), m, d)) * 86400;
+      if (time != nullptr)
+        {
+          std::uint32_t tv = get16 (time);
+          t += (tv >> 11) * 3600 + ((tv >> 5) & 0x3F) * 60 + (tv & 0x1F) * 2;
+        }
+      return t;
+    }
+
+    static void
+    stampEntry (std::uint8_t* raw, bool created)
+    {
+      std::time_t now = std::time (nullptr);
+      if (created)
+        {
+          raw[13] = 0;
+          toFatTime (now, &raw[16], &raw[14]);
+        }
+      toFatTime (now, &raw[24], &raw[22]);
+      toFatTime (now, &raw[18], nullptr);
+    }
+
+    // ------------------------------------------------------------------------
+
+    FatFileSystem::FatFileSystem (Pool* filesPool, Pool* dirsPool,
+                                  DirectoryIndex* index,
+                                  BlockJournal* journal, NodeCache* nodes) :
+        FileSystem (filesPool, dirsPool)
+    {
+      fType = NONE;
+
+      fSectorSize = 0;
+      fSectorsPerCluster = 0;
+      fClusterSize = 0;
+      fFatStart = 0;
+      fFatSectors = 0;
+      fFatsCount = 0;
+      fActiveFat = 0;
+      fMirrored = true;
+      fRootStart = 0;
+      fRootEntries = 0;
+      fRootCluster = 0;
+      fDataStart = 0;
+      fClustersCount = 0;
+      fFsInfoSector = 0;
+
+      fWindow = nullptr;
+      fWindowStart = noSector;
+      fWindowCount = 0;
+      fWindowDirty = false;
+
+      fBuffer = nullptr;
+      fBufferSector = noSector;
+      fBufferDirty = false;
+
+      fBitmap = nullptr;
+      fFreeClusters = 0;
+      fNextFree = 2;
+
+      fFatLookups = 0;
+      fFatLoads = 0;
+
+      fIndex = index;
+
+      fNodes = nodes;
+      if (nodes != nullptr)
+        {
+          nodes->setDataSize (sizeof(Entry));
+        }
+
+      fJournal = journal;
+      fPending = nullptr;
+      fPendingClusters = 0;
+
+      fLock.clear ();
+    }
+
+    FatFileSystem::~FatFileSystem ()
+    {
+      delete[] fPending;
+      delete[] fBitmap;
+      delete[] fBuffer;
+      delete[] fWindow;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FatFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      lock ();
+      Entry entry;
+      int ret = findPath (path, &entry);
+      if ((ret == 0) && (entry.sector != 0))
+        {
+          std::uint8_t* raw = loadSector (entry.sector);
+          if (raw == nullptr)
+            {
+              ret = -1;
+            }
+          else
+            {
+              raw += entry.offset;
+              if ((mode & S_IWUSR) != 0)
+                {
+                  raw[11] = static_cast<std::uint8_t> (raw[11] & ~attrReadOnly);
+                }
+              else
+                {
+                  raw[11] |= attrReadOnly;
+                }
+              fBufferDirty = true;
+              updateNode (entry.sector, entry.offset);
+            }
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      lock ();
+      Entry entry;
+      int ret = findPath (path, &entry);
+      if (ret == 0)
+        {
+          fillStat (&entry, buf);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_truncate (const char* path, off_t length)
+    {
+      if (length < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      lock ();
+      Entry entry;
+      int ret = findPath (path, &entry);
+      if (ret == 0)
+        {
+          bool writing;
+          if ((entry.raw[11] & attrDirectory) != 0)
+            {
+              errno = EISDIR;
+              ret = -1;
+            }
+          else if ((entry.raw[11] & attrReadOnly) != 0)
+            {
+              errno = EACCES;
+              ret = -1;
+            }
+          else if (isOpen (&entry, nullptr, &writing))
+            {
+              errno = EBUSY;
+              ret = -1;
+            }
+          else
+            {
+              // A temporary file object, to reuse its resize().
+              FatFile file;
+              file.setFileSystem (this);
+              file.fEntrySector = entry.sector;
+              file.fEntryOffset = entry.offset;
+              file.fFirstCluster = firstCluster (entry.raw);
+              file.fSize = get32 (&entry.raw[28]);
+              ret = file.resize (static_cast<std::size_t> (length));
+              if (file.syncEntry () < 0)
+                {
+                  ret = -1;
+                }
+            }
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      lock ();
+      int ret = renameFrom (rootDir (), existing, rootDir (), _new);
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_unlink (const char* path)
+    {
+      lock ();
+      int ret = removeFrom (rootDir (), path, false);
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      lock ();
+      Entry entry;
+      int ret = findPath (path, &entry);
+      if ((ret == 0) && (entry.sector != 0))
+        {
+          std::uint8_t* raw = loadSector (entry.sector);
+          if (raw == nullptr)
+            {
+              ret = -1;
+            }
+          else
+            {
+              raw += entry.offset;
+              toFatTime (times->modtime, &raw[24], &raw[22]);
+              toFatTime (times->actime, &raw[18], nullptr);
+              fBufferDirty = true;
+              updateNode (entry.sector, entry.offset);
+            }
+        }
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    FatFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      lock ();
+      int ret = mkdirFrom (rootDir (), path);
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic pop
+
+    int
+    FatFileSystem::do_rmdir (const char* path)
+    {
+      lock ();
+      int ret = removeFrom (rootDir (), path, true);
+      unlock ();
+      return ret;
+    }
+
+    void
+    FatFileSystem::do_sync (void)
+    {
+      lock ();
+      if ((flushAll () == 0) && isJournaled ())
+        {
+          commitJournal ();
+        }
+      unlock ();
+
+      FileSystem::do_sync ();
+    }
+
+    int
+    FatFileSystem::do_statat (Directory* dir, const char* path,
+                              struct stat* buf)
+    {
+      lock ();
+      Entry entry;
+      int ret = findPath (startOf (dir), path, &entry);
+      if (ret == 0)
+        {
+          fillStat (&entry, buf);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_mkdirat (Directory* dir, const char* path, mode_t mode)
+    {
+      (void) mode;
+
+      lock ();
+      int ret = mkdirFrom (startOf (dir), path);
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_unlinkat (Directory* dir, const char* path, int flag)
+    {
+      lock ();
+      int ret = removeFrom (startOf (dir), path, (flag & AT_REMOVEDIR) != 0);
+      unlock ();
+      return ret;
+    }
+
+    int
+    FatFileSystem::do_renameat (Directory* olddir, const char* existing,
+                                Directory* newdir, const char* _new)
+    {
+      lock ();
+      int ret = renameFrom (startOf (olddir), existing, startOf (newdir),
+                            _new);
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    FatFileSystem::do_mount (unsigned int flags)
+    {
+      auto* device = getBlockDevice ();
+      if (device == nullptr)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      lock ();
+
+      fType = NONE;
+      if (fIndex != nullptr)
+        {
+          fIndex->clear ();
+        }
+      if (fNodes != nullptr)
+        {
+          fNodes->clear ();
+        }
+      PageCache::invalidate (this);
+      delete[] fPending;
+      delete[] fBitmap;
+      delete[] fBuffer;
+      delete[] fWindow;
+      fPending = nullptr;
+      fPendingClusters = 0;
+      fBitmap = nullptr;
+      fWindow = nullptr;
+
+      fSectorSize = device->getBlockSize ();
+      fBuffer = new std::uint8_t[fSectorSize];
+      fBufferSector = noSector;
+      fBufferDirty = false;
+
+      const std::uint8_t* boot = loadSector (0);
+      if (boot == nullptr)
+        {
+          unlock ();
+          return -1;
+        }
+
+      std::size_t bytesPerSector = get16 (&boot[11]);
+      std::size_t sectorsPerCluster = boot[13];
+      std::size_t reserved = get16 (&boot[14]);
+      std::size_t fats = boot[16];
+      std::uint32_t rootEntries = get16 (&boot[17]);
+      std::uint32_t sectors = get16 (&boot[19]);
+      if (sectors == 0)
+        {
+          sectors = get32 (&boot[32]);
+        }
+      std::uint32_t fatSectors = get16 (&boot[22]);
+      if (fatSectors == 0)
+        {
+          fatSectors = get32 (&boot[36]);
+        }
+
+      if ((boot[510] != 0x55) || (boot[511] != 0xAA)
+          || (bytesPerSector != fSectorSize) || !isPowerOf2 (sectorsPerCluster)
+          || (reserved == 0) || (fats == 0) || (fatSectors == 0)
+          || (sectors > device->getBlocksCount ()))
+        {
+          unlock ();
+
+          errno = EINVAL;
+          return -1;
+        }
+
+      std::uint32_t rootSectors = static_cast<std::uint32_t> ((rootEntries
+          * entrySize + fSectorSize - 1) / fSectorSize);
+      std::uint64_t dataStart = reserved
+          + static_cast<std::uint64_t> (fats) * fatSectors + rootSectors;
+      if (dataStart >= sectors)
+        {
+          unlock ();
+
+          errno = EINVAL;
+          return -1;
+        }
+
+      std::uint32_t clusters = static_cast<std::uint32_t> ((sectors - dataStart)
+          / sectorsPerCluster);
+      Type type = (clusters < 4085) ? FAT12 : (clusters < 65525) ? FAT16 : FAT32;
+
+      // The FAT must hold all the clusters.
+      std::uint64_t fatBytes = (type == FAT12) ?
+          (static_cast<std::uint64_t> (clusters + 2) * 3 + 1) / 2 :
+          static_cast<std::uint64_t> (clusters + 2) * (type / 8);
+      bool valid = (fatBytes
+          <= static_cast<std::uint64_t> (fatSectors) * fSectorSize);
+      if (type == FAT32)
+        {
+          std::uint32_t rootCluster = get32 (&boot[44]);
+          valid = valid && (rootEntries == 0) && (get16 (&boot[22]) == 0)
+              && (rootCluster >= 2) && (rootCluster < clusters + 2);
+
+          std::uint32_t ext = get16 (&boot[40]);
+          fMirrored = (ext & 0x80) == 0;
+          fActiveFat = fMirrored ? 0 : (ext & 0x0F);
+          valid = valid && (fActiveFat < fats);
+
+          fRootCluster = rootCluster;
+          fRootEntries = 0;
+          fFsInfoSector = get16 (&boot[48]);
+          if ((fFsInfoSector == 0) || (fFsInfoSector >= reserved))
+            {
+              fFsInfoSector = 0;
+            }
+        }
+      else
+        {
+          valid = valid && (rootEntries != 0);
+
+          fMirrored = true;
+          fActiveFat = 0;
+          fRootCluster = 0;
+          fRootEntries = rootEntries;
+          fFsInfoSector = 0;
+        }
+
+      if (!valid)
+        {
+          unlock ();
+
+          errno = EINVAL;
+          return -1;
+        }
+
+      fSectorsPerCluster = sectorsPerCluster;
+      fClusterSize = sectorsPerCluster * fSectorSize;
+      fFatStart = static_cast<blockNumber_t> (reserved);
+      fFatSectors = fatSectors;
+      fFatsCount = fats;
+      fRootStart = static_cast<blockNumber_t> (reserved + fats * fatSectors);
+      fDataStart = static_cast<blockNumber_t> (dataStart);
+      fClustersCount = clusters;
+
+      fWindowCount = fatSectors;
+      if (fWindowCount > OS_INTEGER_FAT_WINDOW_SECTORS)
+        {
+          fWindowCount = OS_INTEGER_FAT_WINDOW_SECTORS;
+        }
+      fWindow = new std::uint8_t[fWindowCount * fSectorSize];
+      fWindowStart = noSector;
+      fWindowDirty = false;
+
+      // The journal, if any, is after the boot sectors; an interrupted
+      // update is completed before reading the FAT.
+      std::size_t bootSectors = (type == FAT32) ? 32 : 1;
+      if ((fJournal != nullptr) && (reserved > bootSectors + 1))
+        {
+          int e = errno;
+          if (fJournal->attach (
+              device, static_cast<blockNumber_t> (bootSectors),
+              static_cast<blockNumber_t> (reserved - bootSectors)) < 0)
+            {
+              if (errno != EINVAL)
+                {
+                  unlock ();
+                  return -1;
+                }
+              // Not journaled.
+              errno = e;
+            }
+        }
+
+      // Build the free clusters bitmap; this is the only full scan
+      // of the FAT.
+      fType = type;
+      std::size_t words = (clusters + 2 + 31) / 32;
+      fBitmap = new std::uint32_t[words];
+      std::memset (fBitmap, 0, words * sizeof(std::uint32_t));
+      fBitmap[0] = 3;
+      fFreeClusters = 0;
+      for (std::uint32_t c = 2; c < clusters + 2; ++c)
+        {
+          std::uint32_t value;
+          if (getFat (c, &value) < 0)
+            {
+              fType = NONE;
+              if (isJournaled ())
+                {
+                  fJournal->detach ();
+                }
+              unlock ();
+              return -1;
+            }
+          if (value != 0)
+            {
+              fBitmap[c / 32] |= (1u << (c % 32));
+            }
+          else
+            {
+              ++fFreeClusters;
+            }
+        }
+      // Unused bits beyond the last cluster look used.
+      for (std::uint32_t c = clusters + 2; c < words * 32; ++c)
+        {
+          fBitmap[c / 32] |= (1u << (c % 32));
+        }
+      fNextFree = 2;
+      fFatLookups = 0;
+      fFatLoads = 0;
+
+      if (isJournaled ())
+        {
+          fPending = new std::uint32_t[words];
+          std::memset (fPending, 0, words * sizeof(std::uint32_t));
+        }
+
+      unlock ();
+      return 0;
+    }
+
+    int
+    FatFileSystem::do_unmount (unsigned int flags)
+    {
+      lock ();
+      int ret = flushAll ();
+      if (isJournaled () && (fJournal->detach () < 0))
+        {
+          ret = -1;
+        }
+      fType = NONE;
+      if (fIndex != nullptr)
+        {
+          fIndex->clear ();
+        }
+      if (fNodes != nullptr)
+        {
+          fNodes->clear ();
+        }
+      PageCache::invalidate (this);
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    int
+    FatFileSystem::format (BlockDevice* device, std::size_t sectorsPerCluster,
+                           std::size_t journalSectors)
+    {
+      assert(device != nullptr);
+
+      std::size_t bps = device->getBlockSize ();
+      std::uint32_t sectors = device->getBlocksCount ();
+      if ((bps < 512) || (bps > 4096) || !isPowerOf2 (bps)
+          || ((sectorsPerCluster != 0)
+              && (!isPowerOf2 (sectorsPerCluster) || (sectorsPerCluster > 128))))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      std::uint64_t bytes = static_cast<std::uint64_t> (sectors) * bps;
+      Type preferred =
+          (bytes <= 4 * 1024 * 1024) ? FAT12 :
+          (bytes <= 512 * 1024 * 1024) ? FAT16 : FAT32;
+
+      // The journal header and log follow the boot sectors.
+      std::uint32_t journal = (journalSectors != 0) ?
+          static_cast<std::uint32_t> (journalSectors + 1) : 0;
+
+      // Find the layout: the smallest clusters that keep the count
+      // within the limits of the type.
+      Type type = NONE;
+      std::size_t spc = 0;
+      std::uint32_t reserved = 0;
+      std::uint32_t rootSectors = 0;
+      std::uint32_t fatSectors = 0;
+      std::uint32_t clusters = 0;
+      for (int t = 0; (t < 3) && (type == NONE); ++t)
+        {
+          Type candidate = (t == 0) ? FAT12 : (t == 1) ? FAT16 : FAT32;
+          if ((sectorsPerCluster == 0) && (candidate != preferred))
+            {
+              continue;
+            }
+          std::uint32_t min = (candidate == FAT12) ? 1 :
+                              (candidate == FAT16) ? 4085 : 65525;
+          std::uint32_t max = (candidate == FAT12) ? 4084 :
+                              (candidate == FAT16) ? 65524 : 0x0FFFFFF5;
+
+          for (std::size_t s = (sectorsPerCluster != 0) ? sectorsPerCluster : 1;
+              (s <= 128) && (s * bps <= 32 * 1024); s *= 2)
+            {
+              std::uint32_t rsvd = ((candidate == FAT32) ? 32 : 1) + journal;
+              std::uint32_t root = (candidate == FAT32) ?
+                  0 : static_cast<std::uint32_t> ((512 * entrySize) / bps);
+              std::uint32_t fat = 1;
+              std::uint32_t count = 0;
+              for (;;)
+                {
+                  std::uint64_t used = rsvd + 2ull * fat + root;
+                  if (used >= sectors)
+                    {
+                      count = 0;
+                      break;
+                    }
+                  count = static_cast<std::uint32_t> ((sectors - used) / s);
+                  std::uint64_t need = (candidate == FAT12) ?
+                      (static_cast<std::uint64_t> (count + 2) * 3 + 1) / 2 :
+                      static_cast<std::uint64_t> (count + 2) * (candidate / 8);
+                  auto needSectors = static_cast<std::uint32_t> ((need + bps - 1)
+                      / bps);
+                  if (needSectors <= fat)
+                    {
+                      break;
+                    }
+                  fat = needSectors;
+                }
+
+              if ((count >= min) && (count <= max))
+                {
+                  type = candidate;
+                  spc = s;
+                  reserved = rsvd;
+                  rootSectors = root;
+                  fatSectors = fat;
+                  clusters = count;
+                  break;
+                }
+              if ((count < min) || (sectorsPerCluster != 0))
+                {
+                  // Larger clusters would be even fewer.
+                  break;
+                }
+            }
+        }
+
+      if (type == NONE)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* buf = new std::uint8_t[bps];
+      int ret = 0;
+      auto put = [&](std::uint32_t sector) -> void
+        {
+          if ((ret == 0) && (device->write (buf, sector, 1) != 1))
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              ret = -1;
+            }
+        };
+
+      // Clear the reserved area, the FATs and the root directory.
+      std::uint32_t dataStart = reserved + 2 * fatSectors + rootSectors;
+      std::uint32_t clear = dataStart + ((type == FAT32) ?
+          static_cast<std::uint32_t> (spc) : 0);
+      std::memset (buf, 0, bps);
+      for (std::uint32_t s = 0; s < clear; ++s)
+        {
+          put (s);
+        }
+
+      // The first FAT entries: the media, the end of chain marker,
+      // and the root directory on FAT32.
+      for (std::uint32_t f = 0; f < 2; ++f)
+        {
+          std::memset (buf, 0, bps);
+          if (type == FAT12)
+            {
+              buf[0] = 0xF8;
+              buf[1] = 0xFF;
+              buf[2] = 0xFF;
+            }
+          else if (type == FAT16)
+            {
+              put32 (buf, 0xFFFFFFF8);
+            }
+          else
+            {
+              put32 (buf, 0x0FFFFFF8);
+              put32 (buf + 4, 0x0FFFFFFF);
+              put32 (buf + 8, 0x0FFFFFFF);
+            }
+          put (reserved + f * fatSectors);
+        }
+
+      // The boot sector.
+      std::memset (buf, 0, bps);
+      buf[0] = 0xEB;
+      buf[1] = (type == FAT32) ? 0x58 : 0x3C;
+      buf[2] = 0x90;
+      std::memcpy (&buf[3], "MSWIN4.1", 8);
+      put16 (&buf[11], static_cast<std::uint32_t> (bps));
+      buf[13] = static_cast<std::uint8_t> (spc);
+      put16 (&buf[14], reserved);
+      buf[16] = 2;
+      put16 (&buf[17], (type == FAT32) ? 0 : 512);
+      if ((type != FAT32) && (sectors < 65536))
+        {
+          put16 (&buf[19], sectors);
+        }
+      else
+        {
+          put32 (&buf[32], sectors);
+        }
+      buf[21] = 0xF8;
+      put16 (&buf[24], 63);
+      put16 (&buf[26], 255);
+
+      std::uint32_t serial = static_cast<std::uint32_t> (std::time (nullptr));
+      std::size_t ext;
+      if (type == FAT32)
+        {
+          put32 (&buf[36], fatSectors);
+          put32 (&buf[44], 2);
+          put16 (&buf[48], 1);
+          put16 (&buf[50], 6);
+          ext = 64;
+        }
+      else
+        {
+          put16 (&buf[22], fatSectors);
+          ext = 36;
+        }
+      buf[ext] = 0x80;
+      buf[ext + 2] = 0x29;
+      put32 (&buf[ext + 3], serial);
+      std::memcpy (&buf[ext + 7], "NO NAME    ", 11);
+      std::memcpy (&buf[ext + 18],
+                   (type == FAT12) ? "FAT12   " :
+                   (type == FAT16) ? "FAT16   " : "FAT32   ",
+                   8);
+      buf[510] = 0x55;
+      buf[511] = 0xAA;
+      put (0);
+
+      if (type == FAT32)
+        {
+          // The backup boot sector, and the FSInfo with its backup.
+          put (6);
+
+          std::memset (buf, 0, bps);
+          put32 (&buf[0], 0x41615252);
+          put32 (&buf[484], 0x61417272);
+          put32 (&buf[488], clusters - 1);
+          put32 (&buf[492], 3);
+          put32 (&buf[508], 0xAA550000);
+          put (1);
+          put (7);
+        }
+
+      delete[] buf;
+
+      if ((ret == 0) && (journal != 0)
+          && (BlockJournal::format (device, reserved - journal, journal) < 0))
+        {
+          ret = -1;
+        }
+
+      if ((ret == 0) && (device->flush () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    FatFileSystem::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+
+      if (isJournaled ())
+        {
+          fJournal->begin ();
+        }
+    }
+
+    void
+    FatFileSystem::unlock (void)
+    {
+      if (isJournaled ())
+        {
+          // The operation is complete, its sectors are staged, with
+          // the entries of the files it changed; a failed commit is
+          // reported by the next sync.
+          int e = errno;
+          if ((fType != NONE) && (syncEntries () == 0) && (flushSector () == 0)
+              && (flushWindow () == 0) && fJournal->end ())
+            {
+              commitJournal ();
+            }
+          errno = e;
+        }
+
+      fLock.clear (std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+
+    FatFileSystem::blockNumber_t
+    FatFileSystem::clusterSector (std::uint32_t cluster) const
+    {
+      return fDataStart
+          + static_cast<blockNumber_t> ((cluster - 2) * fSectorsPerCluster);
+    }
+
+    std::uint8_t*
+    FatFileSystem::loadSector (blockNumber_t sector)
+    {
+      if (sector == fBufferSector)
+        {
+          return fBuffer;
+        }
+
+      if (flushSector () < 0)
+        {
+          return nullptr;
+        }
+
+      fBufferSector = noSector;
+      if (readSectors (fBuffer, sector, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return nullptr;
+        }
+      fBufferSector = sector;
+      return fBuffer;
+    }
+
+    std::uint8_t*
+    FatFileSystem::claimSector (blockNumber_t sector)
+    {
+      if (sector != fBufferSector)
+        {
+          if (flushSector () < 0)
+            {
+              return nullptr;
+            }
+          fBufferSector = sector;
+        }
+      return fBuffer;
+    }
+
+    int
+    FatFileSystem::flushSector (void)
+    {
+      if (fBufferDirty)
+        {
+          if (writeSectors (fBuffer, fBufferSector, 1) != 1)
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              return -1;
+            }
+          fBufferDirty = false;
+        }
+      return 0;
+    }
+
+    ssize_t
+    FatFileSystem::readSectors (void* buf, blockNumber_t sector,
+                                std::size_t count)
+    {
+      if (isJournaled ())
+        {
+          return fJournal->read (buf, sector, count);
+        }
+      return getBlockDevice ()->read (buf, sector, count);
+    }
+
+    ssize_t
+    FatFileSystem::writeSectors (const void* buf, blockNumber_t sector,
+                                 std::size_t count)
+    {
+      if (isJournaled ())
+        {
+          return fJournal->write (buf, sector, count);
+        }
+      return getBlockDevice ()->write (buf, sector, count);
+    }
+
+    int
+    FatFileSystem::transferSectors (blockNumber_t sector, std::size_t count,
+                                    const void* src, void* dst)
+    {
+      if ((src == nullptr) && (dst == nullptr) && isJournaled ())
+        {
+          // Zeros, directly; the sectors are not referenced before
+          // the commit, and would only fill the journal.
+          if ((flushSector () < 0) || (fJournal->release (sector, count) < 0))
+            {
+              return -1;
+            }
+          fBufferSector = noSector;
+          std::memset (fBuffer, 0, fSectorSize);
+          for (std::size_t i = 0; i < count; ++i)
+            {
+              if (getBlockDevice ()->write (
+                  fBuffer, static_cast<blockNumber_t> (sector + i), 1) != 1)
+                {
+                  if (errno == 0)
+                    {
+                      errno = EIO;
+                    }
+                  return -1;
+                }
+            }
+          return 0;
+        }
+
+      if ((src == nullptr) && (dst == nullptr))
+        {
+          // Zeros, through the buffer.
+          for (std::size_t i = 0; i < count; ++i)
+            {
+              std::uint8_t* b = claimSector (
+                  static_cast<blockNumber_t> (sector + i));
+              if (b == nullptr)
+                {
+                  return -1;
+                }
+              std::memset (b, 0, fSectorSize);
+              fBufferDirty = true;
+            }
+          return 0;
+        }
+
+      bool overlaps = (fBufferSector != noSector) && (fBufferSector >= sector)
+          && (fBufferSector < sector + count);
+      if (overlaps)
+        {
+          if (dst != nullptr)
+            {
+              // The device must have the buffer content.
+              if (flushSector () < 0)
+                {
+                  return -1;
+                }
+            }
+          else
+            {
+              // Overwritten.
+              fBufferDirty = false;
+              fBufferSector = noSector;
+            }
+        }
+
+      if ((src != nullptr) && isJournaled ()
+          && (fJournal->release (sector, count) < 0))
+        {
+          return -1;
+        }
+
+      ssize_t ret =
+          (dst != nullptr) ? readSectors (dst, sector, count) :
+              getBlockDevice ()->write (src, sector, count);
+      if (ret != static_cast<ssize_t> (count))
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::uint8_t*
+    FatFileSystem::fatByte (std::size_t offset)
+    {
+      auto sector = static_cast<blockNumber_t> (offset / fSectorSize);
+      if ((fWindowStart == noSector) || (sector < fWindowStart)
+          || (sector >= fWindowStart + fWindowCount))
+        {
+          if (flushWindow () < 0)
+            {
+              return nullptr;
+            }
+
+          blockNumber_t start = sector;
+          if (start + fWindowCount > fFatSectors)
+            {
+              start = fFatSectors - fWindowCount;
+            }
+
+          fWindowStart = noSector;
+          if (readSectors (
+              fWindow, fFatStart + fActiveFat * fFatSectors + start,
+              fWindowCount) != static_cast<ssize_t> (fWindowCount))
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              return nullptr;
+            }
+          fWindowStart = start;
+          ++fFatLoads;
+        }
+
+      return &fWindow[offset - fWindowStart * fSectorSize];
+    }
+
+    int
+    FatFileSystem::flushWindow (void)
+    {
+      if (!fWindowDirty)
+        {
+          return 0;
+        }
+
+      for (std::size_t i = 0; i < fFatsCount; ++i)
+        {
+          if (!fMirrored && (i != fActiveFat))
+            {
+              continue;
+            }
+          if (writeSectors (
+              fWindow, fFatStart + i * fFatSectors + fWindowStart,
+              fWindowCount) != static_cast<ssize_t> (fWindowCount))
+            {
+              if (errno == 0)
+                {
+                  errno = EIO;
+                }
+              return -1;
+            }
+        }
+      fWindowDirty = false;
+      return 0;
+    }
+
+    int
+    FatFileSystem::getFat (std::uint32_t cluster, std::uint32_t* value)
+    {
+      ++fFatLookups;
+
+      const std::uint8_t* p;
+      switch (fType)
+        {
+        case FAT12:
+          {
+            std::size_t offset = cluster + cluster / 2;
+            if ((p = fatByte (offset)) == nullptr)
+              {
+                return -1;
+              }
+            std::uint32_t v = *p;
+            // Possibly in the next sector.
+            if ((p = fatByte (offset + 1)) == nullptr)
+              {
+                return -1;
+              }
+            v |= static_cast<std::uint32_t> (*p) << 8;
+            *value = ((cluster & 1) != 0) ? (v >> 4) : (v & 0x0FFF);
+          }
+          break;
+
+        case FAT16:
+          if ((p = fatByte (cluster * 2)) == nullptr)
+            {
+              return -1;
+            }
+          *value = get16 (p);
+          break;
+
+        default:
+          if ((p = fatByte (cluster * 4)) == nullptr)
+            {
+              return -1;
+            }
+          *value = get32 (p) & 0x0FFFFFFF;
+          break;
+        }
+      return 0;
+    }
+
+    int
+    FatFileSystem::setFat (std::uint32_t cluster, std::uint32_t value)
+    {
+      std::uint8_t* p;
+      switch (fType)
+        {
+        case FAT12:
+          {
+            std::size_t offset = cluster + cluster / 2;
+            if ((p = fatByte (offset)) == nullptr)
+              {
+                return -1;
+              }
+            if ((cluster & 1) != 0)
+              {
+                *p = static_cast<std::uint8_t> ((*p & 0x0F) | (value << 4));
+              }
+            else
+              {
+                *p = static_cast<std::uint8_t> (value);
+              }
+            fWindowDirty = true;
+
+            if ((p = fatByte (offset + 1)) == nullptr)
+              {
+                return -1;
+              }
+            if ((cluster & 1) != 0)
+              {
+                *p = static_cast<std::uint8_t> (value >> 4);
+              }
+            else
+              {
+                *p = static_cast<std::uint8_t> ((*p & 0xF0)
+                    | ((value >> 8) & 0x0F));
+              }
+          }
+          break;
+
+        case FAT16:
+          if ((p = fatByte (cluster * 2)) == nullptr)
+            {
+              return -1;
+            }
+          put16 (p, value);
+          break;
+
+        default:
+          if ((p = fatByte (cluster * 4)) == nullptr)
+            {
+              return -1;
+            }
+          // The upper 4 bits are reserved, keep them.
+          put32 (p, (get32 (p) & 0xF0000000) | (value & 0x0FFFFFFF));
+          break;
+        }
+      fWindowDirty = true;
+
+      markCluster (cluster, value != 0);
+      return 0;
+    }
+
+    bool
+    FatFileSystem::isEnd (std::uint32_t value) const
+    {
+      return value >= ((fType == FAT12) ? 0x0FF8u :
+                       (fType == FAT16) ? 0xFFF8u : 0x0FFFFFF8u);
+    }
+
+    bool
+    FatFileSystem::isValid (std::uint32_t cluster) const
+    {
+      return (cluster >= 2) && (cluster < fClustersCount + 2);
+    }
+
+    std::uint32_t
+    FatFileSystem::endOfChain (void) const
+    {
+      return (fType == FAT12) ? 0x0FFFu : (fType == FAT16) ? 0xFFFFu : 0x0FFFFFFFu;
+    }
+
+    bool
+    FatFileSystem::isFree (std::uint32_t cluster) const
+    {
+      return (fBitmap[cluster / 32] & (1u << (cluster % 32))) == 0;
+    }
+
+    void
+    FatFileSystem::markCluster (std::uint32_t cluster, bool used)
+    {
+      if (isFree (cluster) == !used)
+        {
+          return;
+        }
+      if (used)
+        {
+          fBitmap[cluster / 32] |= (1u << (cluster % 32));
+          --fFreeClusters;
+        }
+      else if (fPending != nullptr)
+        {
+          // Free, but the FAT on the device may still have it in a
+          // chain until the next commit.
+          if ((fPending[cluster / 32] & (1u << (cluster % 32))) == 0)
+            {
+              fPending[cluster / 32] |= (1u << (cluster % 32));
+              ++fPendingClusters;
+              ++fFreeClusters;
+            }
+        }
+      else
+        {
+          fBitmap[cluster / 32] &= ~(1u << (cluster % 32));
+          ++fFreeClusters;
+          if (cluster < fNextFree)
+            {
+              fNextFree = cluster;
+            }
+        }
+    }
+
+    std::uint32_t
+    FatFileSystem::allocateCluster (std::uint32_t previous)
+    {
+      std::uint32_t cluster = 0;
+      if ((previous != 0) && isValid (previous + 1) && isFree (previous + 1))
+        {
+          // Keep the file contiguous.
+          cluster = previous + 1;
+        }
+      else
+        {
+          cluster = findFree ();
+          if ((cluster == 0) && (fPendingClusters != 0))
+            {
+              // Only clusters freed since the last commit are left;
+              // commit, even in the middle of the operation.
+              if (commitJournal () < 0)
+                {
+                  return 0;
+                }
+              cluster = findFree ();
+            }
+        }
+
+      if (cluster == 0)
+        {
+          errno = ENOSPC;
+          return 0;
+        }
+
+      if ((setFat (cluster, endOfChain ()) < 0)
+          || ((previous != 0) && (setFat (previous, cluster) < 0)))
+        {
+          return 0;
+        }
+      fNextFree = cluster + 1;
+      return cluster;
+    }
+
+    std::uint32_t
+    FatFileSystem::findFree (void) const
+    {
+      if (fFreeClusters == fPendingClusters)
+        {
+          return 0;
+        }
+
+      // Search the bitmap a word at a time, from the hint.
+      std::uint32_t words = (fClustersCount + 2 + 31) / 32;
+      std::uint32_t start = isValid (fNextFree) ? fNextFree / 32 : 0;
+      for (std::uint32_t i = 0; i < words; ++i)
+        {
+          std::uint32_t w = (start + i) % words;
+          if (fBitmap[w] != ~0u)
+            {
+              std::uint32_t bit = 0;
+              while ((fBitmap[w] & (1u << bit)) != 0)
+                {
+                  ++bit;
+                }
+              return w * 32 + bit;
+            }
+        }
+      return 0;
+    }
+
+    int
+    FatFileSystem::freeChain (std::uint32_t cluster)
+    {
+      // At most all the clusters, in case the chain has a loop.
+      for (std::uint32_t n = 0; isValid (cluster) && (n < fClustersCount); ++n)
+        {
+          std::uint32_t next;
+          if ((getFat (cluster, &next) < 0) || (setFat (cluster, 0) < 0))
+            {
+              return -1;
+            }
+          cluster = next;
+        }
+      return 0;
+    }
+
+    int
+    FatFileSystem::syncFsInfo (void)
+    {
+      if ((fType != FAT32) || (fFsInfoSector == 0))
+        {
+          return 0;
+        }
+
+      std::uint8_t* b = loadSector (fFsInfoSector);
+      if (b == nullptr)
+        {
+          return -1;
+        }
+      if ((get32 (&b[0]) == 0x41615252) && (get32 (&b[484]) == 0x61417272)
+          && ((get32 (&b[488]) != fFreeClusters)
+              || (get32 (&b[492]) != fNextFree)))
+        {
+          put32 (&b[488], fFreeClusters);
+          put32 (&b[492], fNextFree);
+          fBufferDirty = true;
+        }
+      return 0;
+    }
+
+    int
+    FatFileSystem::flushAll (void)
+    {
+      if (fType == NONE)
+        {
+          return 0;
+        }
+
+      int ret = writePages ();
+      if ((syncEntries () < 0) || (syncFsInfo () < 0) || (flushSector () < 0)
+          || (flushWindow () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    int
+    FatFileSystem::writePages (void)
+    {
+      if (!cachesPages ())
+        {
+          return 0;
+        }
+
+      int ret = 0;
+      auto* pool = getFilesPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (pool->getFlag (i))
+            {
+              auto* file = static_cast<FatFile*> (pool->getObject (i));
+              if ((file->getFileSystem () == this) && (file->fEntrySector != 0)
+                  && (file->writeBack () < 0))
+                {
+                  ret = -1;
+                }
+            }
+        }
+      return ret;
+    }
+
+    int
+    FatFileSystem::syncEntries (void)
+    {
+      int ret = 0;
+      auto* pool = getFilesPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (pool->getFlag (i))
+            {
+              auto* file = static_cast<FatFile*> (pool->getObject (i));
+              if ((file->getFileSystem () == this) && (file->fEntrySector != 0)
+                  && file->fEntryDirty && (file->syncEntry () < 0))
+                {
+                  ret = -1;
+                }
+            }
+        }
+      return ret;
+    }
+
+    int
+    FatFileSystem::commitJournal (void)
+    {
+      // The data first, such that the committed sizes never cover
+      // stale clusters.
+      if ((writePages () < 0) || (flushSector () < 0) || (flushWindow () < 0)
+          || (fJournal->commit () < 0))
+        {
+          return -1;
+        }
+
+      // The freed clusters are free on the device too.
+      if (fPendingClusters != 0)
+        {
+          std::uint32_t words = (fClustersCount + 2 + 31) / 32;
+          for (std::uint32_t w = 0; w < words; ++w)
+            {
+              if (fPending[w] != 0)
+                {
+                  fBitmap[w] &= ~fPending[w];
+                  fPending[w] = 0;
+                  if (w * 32 < fNextFree)
+                    {
+                      fNextFree = w * 32;
+                    }
+                }
+            }
+          fPendingClusters = 0;
+        }
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::uint32_t
+    FatFileSystem::rootDir (void) const
+    {
+      return fRootCluster;
+    }
+
+    std::uint8_t*
+    FatFileSystem::entryAt (Position* pos, bool extend)
+    {
+      std::size_t perSector = fSectorSize / entrySize;
+      blockNumber_t sector;
+      if (pos->dir == 0)
+        {
+          // The fixed root directory of FAT12/16.
+          if (pos->index >= fRootEntries)
+            {
+              errno = extend ? ENOSPC : ENOENT;
+              return nullptr;
+            }
+          sector = fRootStart
+              + static_cast<blockNumber_t> (pos->index / perSector);
+        }
+      else
+        {
+          if (pos->index >= dirEntriesMax)
+            {
+              errno = extend ? ENOSPC : ENOENT;
+              return nullptr;
+            }
+
+          std::size_t perCluster = fClusterSize / entrySize;
+          auto k = static_cast<std::uint32_t> (pos->index / perCluster);
+          if ((pos->cluster == 0) || (k < pos->clusterIndex))
+            {
+              pos->cluster = pos->dir;
+              pos->clusterIndex = 0;
+            }
+          while (pos->clusterIndex < k)
+            {
+              std::uint32_t next;
+              if (getFat (pos->cluster, &next) < 0)
+                {
+                  return nullptr;
+                }
+              if (isEnd (next))
+                {
+                  if (!extend)
+                    {
+                      errno = ENOENT;
+                      return nullptr;
+                    }
+                  next = allocateCluster (pos->cluster);
+                  if ((next == 0)
+                      || (transferSectors (clusterSector (next),
+                                           fSectorsPerCluster, nullptr, nullptr)
+                          < 0))
+                    {
+                      return nullptr;
+                    }
+                }
+              else if (!isValid (next))
+                {
+                  errno = EIO;
+                  return nullptr;
+                }
+              pos->cluster = next;
+              ++pos->clusterIndex;
+            }
+          sector = clusterSector (pos->cluster)
+              + static_cast<blockNumber_t> ((pos->index % perCluster)
+                  / perSector);
+        }
+
+      std::uint8_t* b = loadSector (sector);
+      if (b == nullptr)
+        {
+          return nullptr;
+        }
+      return b + (pos->index % perSector) * entrySize;
+    }
+
+    int
+    FatFileSystem::nextEntry (Position* pos, Entry* entry)
+    {
+      // The long name entries seen so far.
+      bool haveLong = false;
+      std::size_t expected = 0;
+      std::uint8_t sum = 0;
+      std::uint32_t first = 0;
+      std::size_t longLen = 0;
+
+      for (;;)
+        {
+          std::uint8_t* e = entryAt (pos, false);
+          if (e == nullptr)
+            {
+              return (errno == ENOENT) ? 0 : -1;
+            }
+          if (e[0] == 0)
+            {
+              // The end of the directory; stay here.
+              return 0;
+            }
+
+          std::uint32_t index = pos->index++;
+          if (e[0] == entryFree)
+            {
+              haveLong = false;
+              continue;
+            }
+
+          if ((e[11] & 0x3F) == attrLongName)
+            {
+              std::size_t ord = e[0] & 0x1F;
+              if ((e[0] & 0x40) != 0)
+                {
+                  haveLong = (ord != 0) && (ord <= 20);
+                  expected = ord;
+                  sum = e[13];
+                  first = index;
+                  longLen = ord * longChars;
+                }
+              if (!haveLong || (ord != expected) || (e[13] != sum))
+                {
+                  haveLong = false;
+                  continue;
+                }
+              for (std::size_t j = 0; j < longChars; ++j)
+                {
+                  std::uint16_t c = get16 (&e[longOffsets[j]]);
+                  std::size_t at = (ord - 1) * longChars + j;
+                  fLongName[at] = c;
+                  if ((c == 0) && (at < longLen))
+                    {
+                      longLen = at;
+                    }
+                }
+              --expected;
+              continue;
+            }
+
+          if ((e[11] & attrVolumeId) != 0)
+            {
+              haveLong = false;
+              continue;
+            }
+
+          // A short entry, the file.
+          entry->sector = fBufferSector;
+          entry->offset = static_cast<std::size_t> (e - fBuffer);
+          entry->index = index;
+          std::memcpy (entry->raw, e, entrySize);
+
+          shortNameOf (e, entry->shortName);
+
+          if (haveLong && (expected == 0) && (checksum (e) == sum)
+              && toUtf8 (fLongName, longLen, entry->name, sizeof(entry->name)))
+            {
+              entry->first = first;
+            }
+          else
+            {
+              std::strcpy (entry->name, entry->shortName);
+              entry->first = index;
+            }
+          return 1;
+        }
+    }
+
+    int
+    FatFileSystem::findEntry (std::uint32_t dir, const char* name,
+                              std::size_t len, Entry* entry)
+    {
+      if (fNodes == nullptr)
+        {
+          return searchEntry (dir, name, len, entry);
+        }
+
+      std::size_t cursor = 0;
+      void* data;
+      while (fNodes->lookup (dir, hashName (name, len), &cursor, &data))
+        {
+          auto* node = static_cast<Entry*> (data);
+          if (sameName (name, node->name, len)
+              || sameName (name, node->shortName, len))
+            {
+              fNodes->use (data);
+              std::memcpy (entry, node, sizeof(Entry));
+              return 0;
+            }
+        }
+
+      if (searchEntry (dir, name, len, entry) < 0)
+        {
+          return -1;
+        }
+      cacheNode (dir, entry);
+      return 0;
+    }
+
+    void
+    FatFileSystem::cacheNode (std::uint32_t dir, const Entry* entry)
+    {
+      if (fNodes == nullptr)
+        {
+          return;
+        }
+      void* data = fNodes->add (
+          inodeOf (entry), dir,
+          hashName (entry->name, std::strlen (entry->name)),
+          hashName (entry->shortName, std::strlen (entry->shortName)));
+      if (data != nullptr)
+        {
+          std::memcpy (data, entry, sizeof(Entry));
+        }
+    }
+
+    void
+    FatFileSystem::updateNode (blockNumber_t sector, std::size_t offset)
+    {
+      if (fNodes == nullptr)
+        {
+          return;
+        }
+      assert(sector == fBufferSector);
+      void* data = fNodes->find (inodeAt (sector, offset));
+      if (data != nullptr)
+        {
+          std::memcpy (static_cast<Entry*> (data)->raw, fBuffer + offset,
+                       entrySize);
+        }
+    }
+
+    int
+    FatFileSystem::searchEntry (std::uint32_t dir, const char* name,
+                                std::size_t len, Entry* entry)
+    {
+      if ((fIndex != nullptr) && fIndex->isIndexed (dir))
+        {
+          // Only the entries with the same hash; a stale value
+          // no longer starts an entry.
+          std::uint32_t hash = hashName (name, len);
+          std::size_t cursor = 0;
+          std::uint32_t value;
+          while (fIndex->lookup (dir, hash, &cursor, &value))
+            {
+              Position pos =
+                { dir, value, 0, 0 };
+              int ret = nextEntry (&pos, entry);
+              if (ret < 0)
+                {
+                  return -1;
+                }
+              if ((ret > 0) && (entry->first == value)
+                  && (sameName (name, entry->name, len)
+                      || sameName (name, entry->shortName, len)))
+                {
+                  return 0;
+                }
+            }
+          errno = ENOENT;
+          return -1;
+        }
+
+      // Search linearly, indexing the entire directory on the way.
+      bool indexing = (fIndex != nullptr);
+      if (indexing)
+        {
+          fIndex->begin (dir);
+        }
+
+      Position pos =
+        { dir, 0, 0, 0 };
+      Entry other;
+      Entry* e = entry;
+      bool found = false;
+      // The first hole, where to look for free entries.
+      std::uint32_t end = 0;
+      std::uint32_t hint = dirEntriesMax;
+      int ret;
+      while ((ret = nextEntry (&pos, e)) > 0)
+        {
+          if ((e->first != end) && (hint == dirEntriesMax))
+            {
+              hint = end;
+            }
+          end = e->index + 1;
+
+          if (indexing)
+            {
+              indexing = indexEntry (dir, e);
+            }
+          if (!found
+              && (sameName (name, e->name, len)
+                  || sameName (name, e->shortName, len)))
+            {
+              // Keep it, continue in the other entry.
+              found = true;
+              e = &other;
+            }
+          if (found && !indexing)
+            {
+              return 0;
+            }
+        }
+      if (ret < 0)
+        {
+          if (indexing)
+            {
+              fIndex->drop (dir);
+            }
+          return -1;
+        }
+
+      if (indexing)
+        {
+          fIndex->commit (dir, (hint < pos.index) ? hint : pos.index);
+        }
+      if (found)
+        {
+          return 0;
+        }
+      errno = ENOENT;
+      return -1;
+    }
+
+    int
+    FatFileSystem::resolve (const char* path, std::uint32_t* dir,
+                            const char** name, std::size_t* len)
+    {
+      return resolve (rootDir (), path, dir, name, len);
+    }
+
+    int
+    FatFileSystem::resolve (std::uint32_t start, const char* path,
+                            std::uint32_t* dir, const char** name,
+                            std::size_t* len)
+    {
+      std::uint32_t current = start;
+      for (;;)
+        {
+          while (*path == '/')
+            {
+              ++path;
+            }
+          const char* end = path;
+          while ((*end != '\0') && (*end != '/'))
+            {
+              ++end;
+            }
+          auto n = static_cast<std::size_t> (end - path);
+          if (n > OS_INTEGER_FAT_NAME_MAX)
+            {
+              errno = ENAMETOOLONG;
+              return -1;
+            }
+
+          // The root has no `.` entry, do not search for it.
+          bool dot = (n == 1) && (*path == '.');
+
+          const char* next = end;
+          while (*next == '/')
+            {
+              ++next;
+            }
+          if (*next == '\0')
+            {
+              // The last component, possibly empty for `start`.
+              *dir = current;
+              *name = path;
+              *len = dot ? 0 : n;
+              return 0;
+            }
+
+          if (!dot)
+            {
+              Entry entry;
+              if (findEntry (current, path, n, &entry) < 0)
+                {
+                  return -1;
+                }
+              if ((entry.raw[11] & attrDirectory) == 0)
+                {
+                  errno = ENOTDIR;
+                  return -1;
+                }
+              current = dirOf (entry.raw);
+            }
+          path = next;
+        }
+    }
+
+    int
+    FatFileSystem::findPath (const char* path, Entry* entry)
+    {
+      return findPath (rootDir (), path, entry);
+    }
+
+    int
+    FatFileSystem::findPath (std::uint32_t start, const char* path,
+                             Entry* entry)
+    {
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      if (resolve (start, path, &dir, &name, &len) < 0)
+        {
+          return -1;
+        }
+
+      if (len != 0)
+        {
+          return findEntry (dir, name, len, entry);
+        }
+      if (dir != rootDir ())
+        {
+          return findDirectory (dir, entry);
+        }
+
+      // The root has no entry.
+      std::memset (entry, 0, sizeof(*entry));
+      entry->raw[11] = attrDirectory;
+      setFirstCluster (entry->raw, fRootCluster);
+      entry->name[0] = '/';
+      return 0;
+    }
+
+    int
+    FatFileSystem::createEntry (std::uint32_t dir, const char* name,
+                                std::size_t len, const std::uint8_t* proto,
+                                Entry* entry)
+    {
+      for (std::size_t i = 0; i < len; ++i)
+        {
+          auto c = static_cast<std::uint8_t> (name[i]);
+          if ((c < 0x20) || (std::strchr ("\"*/:<>?\\|", c) != nullptr))
+            {
+              errno = EINVAL;
+              return -1;
+            }
+        }
+
+      // Try a short name, possibly with the lower case bits.
+      std::uint8_t shortName[11];
+      std::memset (shortName, ' ', sizeof(shortName));
+      std::uint8_t caseBits = 0;
+      bool fits = true;
+      {
+        const char* dot = static_cast<const char*> (std::memchr (name, '.',
+                                                                 len));
+        std::size_t baseLen = (dot != nullptr) ? (dot - name) : len;
+        std::size_t extLen = (dot != nullptr) ? (len - baseLen - 1) : 0;
+        if ((baseLen == 0) || (baseLen > 8) || (extLen > 3)
+            || ((dot != nullptr) && (extLen == 0))
+            || ((dot != nullptr)
+                && (std::memchr (dot + 1, '.', extLen) != nullptr)))
+          {
+            fits = false;
+          }
+        for (int part = 0; fits && (part < 2); ++part)
+          {
+            const char* p = (part == 0) ? name : dot + 1;
+            std::size_t n = (part == 0) ? baseLen : extLen;
+            bool upper = false;
+            bool lower = false;
+            for (std::size_t i = 0; i < n; ++i)
+              {
+                if (!isShortChar (p[i]))
+                  {
+                    fits = false;
+                    break;
+                  }
+                upper = upper || ((p[i] >= 'A') && (p[i] <= 'Z'));
+                lower = lower || ((p[i] >= 'a') && (p[i] <= 'z'));
+                shortName[((part == 0) ? 0 : 8) + i] =
+                    static_cast<std::uint8_t> (toUpper (p[i]));
+              }
+            if (upper && lower)
+              {
+                // Mixed case needs a long name.
+                fits = false;
+              }
+            else if (lower)
+              {
+                caseBits |= (part == 0) ? lowerBase : lowerExt;
+              }
+          }
+      }
+
+      std::size_t count = 1;
+      int units = 0;
+      if (!fits)
+        {
+          units = toUtf16 (name, len, fLongName,
+                           sizeof(fLongName) / sizeof(fLongName[0]));
+          if ((units <= 0) || (units > 255))
+            {
+              errno = (units < 0) ? EINVAL : ENAMETOOLONG;
+              return -1;
+            }
+          count += (static_cast<std::size_t> (units) + longChars - 1)
+              / longChars;
+
+          // The short alias: the first characters of the base name
+          // and of the extension, upper case, with a "~N" suffix.
+          std::memset (shortName, ' ', sizeof(shortName));
+          caseBits = 0;
+          const char* dot = nullptr;
+          for (std::size_t i = 0; i < len; ++i)
+            {
+              if (name[i] == '.')
+                {
+                  dot = name + i;
+                }
+            }
+          std::size_t baseLen = (dot != nullptr) ? (dot - name) : len;
+          char base[8];
+          std::size_t b = 0;
+          for (std::size_t i = 0; (i < baseLen) && (b < 8); ++i)
+            {
+              char c = name[i];
+              if ((c == ' ') || (c == '.'))
+                {
+                  continue;
+                }
+              base[b++] = isShortChar (c) ? toUpper (c) : '_';
+            }
+          std::size_t e = 0;
+          if (dot != nullptr)
+            {
+              for (const char* p = dot + 1; (p < name + len) && (e < 3); ++p)
+                {
+                  if (*p == ' ')
+                    {
+                      continue;
+                    }
+                  shortName[8 + e++] = static_cast<std::uint8_t> (
+                      isShortChar (*p) ? toUpper (*p) : '_');
+                }
+            }
+          if (b == 0)
+            {
+              // For example ".profile".
+              base[b++] = '_';
+            }
+
+          bool found = false;
+          for (std::uint32_t n = 1; (n < 1000000) && !found; ++n)
+            {
+              char suffix[8];
+              std::size_t s = 0;
+              for (std::uint32_t v = n; v != 0; v /= 10)
+                {
+                  suffix[s++] = static_cast<char> ('0' + v % 10);
+                }
+              suffix[s++] = '~';
+              std::size_t keep = (b + s > 8) ? 8 - s : b;
+              std::memcpy (shortName, base, keep);
+              for (std::size_t i = 0; i < s; ++i)
+                {
+                  shortName[keep + i] =
+                      static_cast<std::uint8_t> (suffix[s - 1 - i]);
+                }
+              for (std::size_t i = keep + s; i < 8; ++i)
+                {
+                  shortName[i] = ' ';
+                }
+              int exists = shortNameExists (dir, shortName);
+              if (exists < 0)
+                {
+                  return -1;
+                }
+              found = (exists == 0);
+            }
+          if (!found)
+            {
+              errno = EEXIST;
+              return -1;
+            }
+        }
+
+      // Find `count` consecutive free entries, growing the directory
+      // if needed.
+      // In an indexed directory, start where the first hole was.
+      std::uint32_t from = (fIndex != nullptr) ? fIndex->getHint (dir) : 0;
+      Position pos =
+        { dir, 0, 0, 0 };
+      std::uint32_t start = 0;
+      std::size_t run = 0;
+      std::uint32_t i = from;
+      while (run < count)
+        {
+          pos.index = i;
+          std::uint8_t* e = entryAt (&pos, true);
+          if (e == nullptr)
+            {
+              if ((errno != ENOSPC) || (from == 0))
+                {
+                  return -1;
+                }
+              // Full from the hint on, try the holes before it.
+              from = 0;
+              i = 0;
+              run = 0;
+              continue;
+            }
+          if ((e[0] == 0) || (e[0] == entryFree))
+            {
+              if (run == 0)
+                {
+                  start = i;
+                }
+              ++run;
+            }
+          else
+            {
+              run = 0;
+            }
+          ++i;
+        }
+
+      if (!fits)
+        {
+          // The buffer was used by the searches.
+          toUtf16 (name, len, fLongName,
+                   sizeof(fLongName) / sizeof(fLongName[0]));
+        }
+
+      std::uint8_t sum = checksum (shortName);
+      for (std::size_t k = 0; k < count; ++k)
+        {
+          pos.index = static_cast<std::uint32_t> (start + k);
+          std::uint8_t* e = entryAt (&pos, false);
+          if (e == nullptr)
+            {
+              return -1;
+            }
+
+          if (k + 1 < count)
+            {
+              // Long name entries, the last part first.
+              std::size_t ord = count - 1 - k;
+              std::memset (e, 0, entrySize);
+              e[0] = static_cast<std::uint8_t> (ord | ((k == 0) ? 0x40 : 0));
+              e[11] = attrLongName;
+              e[13] = sum;
+              for (std::size_t j = 0; j < longChars; ++j)
+                {
+                  std::size_t at = (ord - 1) * longChars + j;
+                  std::uint16_t c =
+                      (at < static_cast<std::size_t> (units)) ? fLongName[at] :
+                      (at == static_cast<std::size_t> (units)) ? 0 : 0xFFFF;
+                  put16 (&e[longOffsets[j]], c);
+                }
+            }
+          else
+            {
+              std::memcpy (e, proto, entrySize);
+              std::memcpy (e, shortName, sizeof(shortName));
+              e[12] = caseBits;
+
+              entry->sector = fBufferSector;
+              entry->offset = static_cast<std::size_t> (e - fBuffer);
+              entry->first = start;
+              entry->index = pos.index;
+              std::memcpy (entry->raw, e, entrySize);
+            }
+          fBufferDirty = true;
+        }
+
+      std::memcpy (entry->name, name, len);
+      entry->name[len] = '\0';
+      shortNameOf (entry->raw, entry->shortName);
+
+      if (fIndex != nullptr)
+        {
+          fIndex->insert (dir, hashName (name, len), start);
+          std::uint32_t hash = hashName (entry->shortName,
+                                         std::strlen (entry->shortName));
+          if (hash != hashName (name, len))
+            {
+              fIndex->insert (dir, hash, start);
+            }
+          if (fIndex->getHint (dir) == start)
+            {
+              fIndex->setHint (dir, static_cast<std::uint32_t> (start + count));
+            }
+        }
+      cacheNode (dir, entry);
+      return 0;
+    }
+
+    int
+    FatFileSystem::deleteEntry (std::uint32_t dir, const Entry* entry)
+    {
+      Position pos =
+        { dir, 0, 0, 0 };
+      for (std::uint32_t i = entry->first; i <= entry->index; ++i)
+        {
+          pos.index = i;
+          std::uint8_t* e = entryAt (&pos, false);
+          if (e == nullptr)
+            {
+              return -1;
+            }
+          e[0] = entryFree;
+          fBufferDirty = true;
+        }
+
+      // The position may be reused by another file.
+      PageCache::invalidate (this, inodeOf (entry));
+      if (fNodes != nullptr)
+        {
+          fNodes->remove (inodeOf (entry));
+          if (((entry->raw[11] & attrDirectory) != 0)
+              && (firstCluster (entry->raw) != 0))
+            {
+              fNodes->drop (firstCluster (entry->raw));
+            }
+        }
+
+      if (fIndex != nullptr)
+        {
+          std::uint32_t hash = hashName (entry->name, std::strlen (entry->name));
+          fIndex->remove (dir, hash, entry->first);
+          std::uint32_t other = hashName (entry->shortName,
+                                          std::strlen (entry->shortName));
+          if (other != hash)
+            {
+              fIndex->remove (dir, other, entry->first);
+            }
+          if (entry->first < fIndex->getHint (dir))
+            {
+              fIndex->setHint (dir, entry->first);
+            }
+          if (((entry->raw[11] & attrDirectory) != 0)
+              && (firstCluster (entry->raw) != 0))
+            {
+              fIndex->drop (firstCluster (entry->raw));
+            }
+        }
+      return 0;
+    }
+
+    bool
+    FatFileSystem::indexEntry (std::uint32_t dir, const Entry* entry)
+    {
+      std::uint32_t hash = hashName (entry->name, std::strlen (entry->name));
+      if (!fIndex->add (dir, hash, entry->first))
+        {
+          return false;
+        }
+      std::uint32_t other = hashName (entry->shortName,
+                                      std::strlen (entry->shortName));
+      return (other == hash) || fIndex->add (dir, other, entry->first);
+    }
+
+    int
+    FatFileSystem::shortNameExists (std::uint32_t dir,
+                                    const std::uint8_t* shortName)
+    {
+      Entry entry;
+      if ((fIndex != nullptr) && fIndex->isIndexed (dir))
+        {
+          std::uint8_t e[entrySize];
+          std::memcpy (e, shortName, 11);
+          e[12] = 0;
+          char s[13];
+          shortNameOf (e, s);
+
+          std::size_t cursor = 0;
+          std::uint32_t value;
+          while (fIndex->lookup (dir, hashName (s, std::strlen (s)), &cursor,
+                                 &value))
+            {
+              Position pos =
+                { dir, value, 0, 0 };
+              int ret = nextEntry (&pos, &entry);
+              if (ret < 0)
+                {
+                  return -1;
+                }
+              if ((ret > 0) && (entry.first == value)
+                  && (std::memcmp (entry.raw, shortName, 11) == 0))
+                {
+                  return 1;
+                }
+            }
+          return 0;
+        }
+
+      Position pos =
+        { dir, 0, 0, 0 };
+      int ret;
+      while ((ret = nextEntry (&pos, &entry)) > 0)
+        {
+          if (std::memcmp (entry.raw, shortName, 11) == 0)
+            {
+              return 1;
+            }
+        }
+      return ret;
+    }
+
+    int
+    FatFileSystem::isEmpty (std::uint32_t dir)
+    {
+      Position pos =
+        { dir, 0, 0, 0 };
+      Entry entry;
+      int ret;
+      while ((ret = nextEntry (&pos, &entry)) > 0)
+        {
+          if ((std::strcmp (entry.name, ".") != 0)
+              && (std::strcmp (entry.name, "..") != 0))
+            {
+              return 0;
+            }
+        }
+      return (ret == 0) ? 1 : -1;
+    }
+
+    int
+    FatFileSystem::findDirectory (std::uint32_t dir, Entry* entry)
+    {
+      std::uint32_t parent = parentOf (dir);
+      if ((parent == 0) && (parent != rootDir ()))
+        {
+          // Not a valid directory.
+          errno = EIO;
+          return -1;
+        }
+
+      Position pos =
+        { parent, 0, 0, 0 };
+      int ret;
+      while ((ret = nextEntry (&pos, entry)) > 0)
+        {
+          // `.` and `..` in the parent refer to other directories.
+          if (((entry->raw[11] & attrDirectory) != 0)
+              && (dirOf (entry->raw) == dir))
+            {
+              return 0;
+            }
+        }
+      if (ret == 0)
+        {
+          errno = EIO;
+        }
+      return -1;
+    }
+
+    std::uint32_t
+    FatFileSystem::parentOf (std::uint32_t dir)
+    {
+      Position pos =
+        { dir, 1, 0, 0 };
+      const std::uint8_t* e = entryAt (&pos, false);
+      if ((e == nullptr) || (e[0] != '.') || (e[1] != '.'))
+        {
+          // Not a valid directory.
+          return 0;
+        }
+      return dirOf (e);
+    }
+
+    std::uint32_t
+    FatFileSystem::firstCluster (const std::uint8_t* raw) const
+    {
+      std::uint32_t cluster = get16 (&raw[26]);
+      if (fType == FAT32)
+        {
+          cluster |= static_cast<std::uint32_t> (get16 (&raw[20])) << 16;
+        }
+      return cluster;
+    }
+
+    void
+    FatFileSystem::setFirstCluster (std::uint8_t* raw,
+                                    std::uint32_t cluster) const
+    {
+      put16 (&raw[26], cluster);
+      put16 (&raw[20], (fType == FAT32) ? (cluster >> 16) : 0);
+    }
+
+    std::uint32_t
+    FatFileSystem::dirOf (const std::uint8_t* raw) const
+    {
+      std::uint32_t cluster = firstCluster (raw);
+      return (cluster == 0) ? rootDir () : cluster;
+    }
+
+    ino_t
+    FatFileSystem::inodeOf (const Entry* entry) const
+    {
+      return inodeAt (entry->sector, entry->offset);
+    }
+
+    ino_t
+    FatFileSystem::inodeAt (blockNumber_t sector, std::size_t offset) const
+    {
+      // The position of the entry on the device; 1 for the root.
+      return static_cast<ino_t> (sector * (fSectorSize / entrySize)
+          + offset / entrySize + 1);
+    }
+
+    bool
+    FatFileSystem::cachesPages (void) const
+    {
+      std::size_t pageSize = PageCache::getPageSize ();
+      return (fType != NONE) && (PageCache::getSize () != 0)
+          && (pageSize % fSectorSize == 0)
+          && (fClusterSize % pageSize == 0);
+    }
+
+    void
+    FatFileSystem::fillStat (const Entry* entry, struct stat* buf) const
+    {
+      std::memset (buf, 0, sizeof(*buf));
+
+      const std::uint8_t* raw = entry->raw;
+      mode_t mode = ((raw[11] & attrReadOnly) != 0) ? 0555 : 0777;
+      if ((raw[11] & attrDirectory) != 0)
+        {
+          buf->st_mode = S_IFDIR | mode;
+        }
+      else
+        {
+          buf->st_mode = S_IFREG | (mode & 0666);
+          buf->st_size = static_cast<off_t> (get32 (&raw[28]));
+        }
+      buf->st_ino = inodeOf (entry);
+      buf->st_nlink = 1;
+      buf->st_blksize = static_cast<blksize_t> (fClusterSize);
+      buf->st_blocks = static_cast<blkcnt_t> ((buf->st_size + fClusterSize - 1)
+          / fClusterSize * (fClusterSize / 512));
+      buf->st_mtime = fromFatTime (&raw[24], &raw[22]);
+      buf->st_atime = fromFatTime (&raw[18], nullptr);
+      buf->st_ctime = fromFatTime (&raw[16], &raw[14]);
+    }
+
+    bool
+    FatFileSystem::isOpen (const Entry* entry, const FatFile* except,
+                           bool* writing)
+    {
+      bool found = false;
+      *writing = false;
+
+      auto* pool = getFilesPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (!pool->getFlag (i))
+            {
+              continue;
+            }
+          auto* file = static_cast<FatFile*> (pool->getObject (i));
+          if ((file != except) && (file->getFileSystem () == this)
+              && (file->fEntrySector == entry->sector)
+              && (file->fEntryOffset == entry->offset))
+            {
+              found = true;
+              if ((file->fFlags & O_ACCMODE) != O_RDONLY)
+                {
+                  *writing = true;
+                }
+            }
+        }
+      return found;
+    }
+
+    FatFile*
+    FatFileSystem::findOpen (const Entry* entry, const FatFile* except)
+    {
+      auto* pool = getFilesPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (!pool->getFlag (i))
+            {
+              continue;
+            }
+          auto* file = static_cast<FatFile*> (pool->getObject (i));
+          if ((file != except) && (file->getFileSystem () == this)
+              && (file->fEntrySector == entry->sector)
+              && (file->fEntryOffset == entry->offset))
+            {
+              return file;
+            }
+        }
+      return nullptr;
+    }
+
+    bool
+    FatFileSystem::isDirectoryOpen (std::uint32_t dir)
+    {
+      auto* pool = getDirsPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (!pool->getFlag (i))
+            {
+              continue;
+            }
+          auto* d = static_cast<FatDirectory*> (pool->getObject (i));
+          if ((d->getFileSystem () == this) && (d->fDir == dir))
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+
+    std::uint32_t
+    FatFileSystem::startOf (Directory* dir) const
+    {
+      return static_cast<FatDirectory*> (dir)->fDir;
+    }
+
+    int
+    FatFileSystem::removeFrom (std::uint32_t start, const char* path,
+                               bool directory)
+    {
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      Entry entry;
+      bool writing;
+      if (resolve (start, path, &dir, &name, &len) < 0)
+        {
+          return -1;
+        }
+      if (len == 0)
+        {
+          errno = directory ? EBUSY : EISDIR;
+          return -1;
+        }
+      if (findEntry (dir, name, len, &entry) < 0)
+        {
+          return -1;
+        }
+
+      if ((entry.raw[11] & attrDirectory) != 0)
+        {
+          if (!directory)
+            {
+              errno = EISDIR;
+              return -1;
+            }
+          int empty = isEmpty (dirOf (entry.raw));
+          if (empty <= 0)
+            {
+              if (empty == 0)
+                {
+                  errno = ENOTEMPTY;
+                }
+              return -1;
+            }
+          if (isDirectoryOpen (dirOf (entry.raw)))
+            {
+              errno = EBUSY;
+              return -1;
+            }
+        }
+      else
+        {
+          if (directory)
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if (isOpen (&entry, nullptr, &writing))
+            {
+              errno = EBUSY;
+              return -1;
+            }
+        }
+
+      if ((deleteEntry (dir, &entry) < 0)
+          || (freeChain (firstCluster (entry.raw)) < 0))
+        {
+          return -1;
+        }
+      return 0;
+    }
+
+    int
+    FatFileSystem::mkdirFrom (std::uint32_t start, const char* path)
+    {
+      int ret = -1;
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      Entry entry;
+      if (resolve (start, path, &dir, &name, &len) < 0)
+        {
+          ;
+        }
+      else if ((len == 0) || (findEntry (dir, name, len, &entry) == 0))
+        {
+          errno = EEXIST;
+        }
+      else if (errno != ENOENT)
+        {
+          ;
+        }
+      else
+        {
+          std::uint32_t cluster = allocateCluster (0);
+          // The cluster may have been a removed directory.
+          if ((cluster != 0) && (fIndex != nullptr))
+            {
+              fIndex->drop (cluster);
+            }
+          if ((cluster != 0) && (fNodes != nullptr))
+            {
+              fNodes->drop (cluster);
+            }
+          if (cluster != 0)
+            {
+              std::uint8_t proto[entrySize];
+              std::memset (proto, 0, sizeof(proto));
+              proto[11] = attrDirectory;
+              stampEntry (proto, true);
+              setFirstCluster (proto, cluster);
+
+              std::uint8_t* raw;
+              if ((transferSectors (clusterSector (cluster),
+                                    fSectorsPerCluster, nullptr, nullptr) == 0)
+                  && ((raw = loadSector (clusterSector (cluster))) != nullptr))
+                {
+                  // `.` and `..`.
+                  std::memcpy (raw, proto, entrySize);
+                  std::memset (raw, ' ', 11);
+                  raw[0] = '.';
+                  std::memcpy (raw + entrySize, raw, entrySize);
+                  raw[entrySize + 1] = '.';
+                  setFirstCluster (raw + entrySize,
+                                   (dir == rootDir ()) ? 0 : dir);
+                  fBufferDirty = true;
+
+                  ret = createEntry (dir, name, len, proto, &entry);
+                }
+              if (ret < 0)
+                {
+                  int err = errno;
+                  freeChain (cluster);
+                  errno = err;
+                }
+            }
+        }
+
+      return ret;
+    }
+
+    int
+    FatFileSystem::renameFrom (std::uint32_t oldStart, const char* existing,
+                               std::uint32_t newStart, const char* _new)
+    {
+      int ret = -1;
+      std::uint32_t oldDir;
+      const char* oldName;
+      std::size_t oldLen;
+      std::uint32_t newDir;
+      const char* newName;
+      std::size_t newLen;
+      Entry from;
+      Entry to;
+      Entry created;
+      bool writing;
+      int empty;
+
+      if ((resolve (oldStart, existing, &oldDir, &oldName, &oldLen) < 0)
+          || (resolve (newStart, _new, &newDir, &newName, &newLen) < 0))
+        {
+          ;
+        }
+      else if ((oldLen == 0) || (newLen == 0))
+        {
+          // The root.
+          errno = EBUSY;
+        }
+      else if (findEntry (oldDir, oldName, oldLen, &from) < 0)
+        {
+          ;
+        }
+      else if (isOpen (&from, nullptr, &writing))
+        {
+          errno = EBUSY;
+        }
+      else
+        {
+          bool isDir = (from.raw[11] & attrDirectory) != 0;
+          std::uint32_t cluster = firstCluster (from.raw);
+
+          ret = 0;
+          if (isDir)
+            {
+              // Not into itself.
+              for (std::uint32_t d = newDir; d != rootDir ();
+                  d = parentOf (d))
+                {
+                  if ((d == cluster) || (d == 0))
+                    {
+                      errno = (d == 0) ? EIO : EINVAL;
+                      ret = -1;
+                      break;
+                    }
+                }
+            }
+
+          if (ret == 0)
+            {
+              if (findEntry (newDir, newName, newLen, &to) == 0)
+                {
+                  bool toDir = (to.raw[11] & attrDirectory) != 0;
+                  if ((to.sector == from.sector) && (to.offset == from.offset))
+                    {
+                      // The same file, possibly a different case.
+                      if (std::strlen (from.name) == newLen
+                          && std::strncmp (from.name, newName, newLen) == 0)
+                        {
+                          return 0;
+                        }
+                    }
+                  else if (isDir && !toDir)
+                    {
+                      errno = ENOTDIR;
+                      ret = -1;
+                    }
+                  else if (!isDir && toDir)
+                    {
+                      errno = EISDIR;
+                      ret = -1;
+                    }
+                  else if (toDir && ((empty = isEmpty (dirOf (to.raw))) != 1))
+                    {
+                      if (empty == 0)
+                        {
+                          errno = ENOTEMPTY;
+                        }
+                      ret = -1;
+                    }
+                  else if (toDir && isDirectoryOpen (dirOf (to.raw)))
+                    {
+                      errno = EBUSY;
+                      ret = -1;
+                    }
+                  else if (!toDir && isOpen (&to, nullptr, &writing))
+                    {
+                      errno = EBUSY;
+                      ret = -1;
+                    }
+                  else if ((deleteEntry (newDir, &to) < 0)
+                      || (freeChain (firstCluster (to.raw)) < 0))
+                    {
+                      ret = -1;
+                    }
+                }
+              else if (errno != ENOENT)
+                {
+                  ret = -1;
+                }
+            }
+
+          // Create the new name first, such that the file is not lost
+          // if there is no space for it.
+          if ((ret == 0)
+              && ((createEntry (newDir, newName, newLen, from.raw, &created)
+                  < 0) || (deleteEntry (oldDir, &from) < 0)))
+            {
+              ret = -1;
+            }
+
+          if ((ret == 0) && isDir && (oldDir != newDir))
+            {
+              // Update `..`, the second entry.
+              Position pos =
+                { cluster, 1, 0, 0 };
+              std::uint8_t* raw = entryAt (&pos, false);
+              if (raw == nullptr)
+                {
+                  ret = -1;
+                }
+              else
+                {
+                  setFirstCluster (raw, (newDir == rootDir ()) ? 0 : newDir);
+                  fBufferDirty = true;
+                  updateNode (fBufferSector,
+                              static_cast<std::size_t> (raw - fBuffer));
+                }
+            }
+        }
+
+      return ret;
+    }
+
+    // ========================================================================
+
+    FatFile::FatFile ()
+    {
+      fEntrySector = 0;
+      fEntryOffset = 0;
+      fFirstCluster = 0;
+      fSize = 0;
+      fOffset = 0;
+      fFlags = 0;
+      fEntryDirty = false;
+      fReserved = false;
+
+      forgetClusters ();
+    }
+
+    FatFile::~FatFile ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FatFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = open (fs->rootDir (), path, oflag, args);
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FatFile::do_vopenat (Directory* dir, const char* path, int oflag,
+                         std::va_list args)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = open (fs->startOf (dir), path, oflag, args);
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FatFile::open (std::uint32_t start, const char* path, int oflag,
+                   std::va_list args)
+    {
+      auto* fs = getFatFileSystem ();
+
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      FatFileSystem::Entry entry;
+      bool write = (oflag & O_ACCMODE) != O_RDONLY;
+
+      int ret = fs->resolve (start, path, &dir, &name, &len);
+      if (ret < 0)
+        {
+          ;
+        }
+      else if (len == 0)
+        {
+          errno = EISDIR;
+          ret = -1;
+        }
+      else if (fs->findEntry (dir, name, len, &entry) < 0)
+        {
+          if ((errno == ENOENT) && ((oflag & O_CREAT) != 0))
+            {
+              auto mode = static_cast<mode_t> (va_arg(args, int));
+
+              std::uint8_t proto[entrySize];
+              std::memset (proto, 0, sizeof(proto));
+              proto[11] = static_cast<std::uint8_t> (attrArchive
+                  | (((mode & S_IWUSR) == 0) ? attrReadOnly : 0));
+              stampEntry (proto, true);
+              ret = fs->createEntry (dir, name, len, proto, &entry);
+            }
+          else
+            {
+              ret = -1;
+            }
+        }
+      else if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+        {
+          errno = EEXIST;
+          ret = -1;
+        }
+      else if ((entry.raw[11] & attrDirectory) != 0)
+        {
+          errno = EISDIR;
+          ret = -1;
+        }
+      else if (write && ((entry.raw[11] & attrReadOnly) != 0))
+        {
+          errno = EACCES;
+          ret = -1;
+        }
+
+      if (ret == 0)
+        {
+          fEntrySector = entry.sector;
+          fEntryOffset = entry.offset;
+          fFirstCluster = fs->firstCluster (entry.raw);
+          fSize = get32 (&entry.raw[28]);
+          fOffset = 0;
+          fFlags = oflag;
+          fEntryDirty = false;
+          fReserved = false;
+          forgetClusters ();
+
+          // Already open, possibly changed and not yet in the entry.
+          FatFile* other = fs->findOpen (&entry, this);
+          if (other != nullptr)
+            {
+              fFirstCluster = other->fFirstCluster;
+              fSize = other->fSize;
+              fEntryDirty = other->fEntryDirty;
+            }
+
+          if (((oflag & O_TRUNC) != 0) && write && (fSize != 0))
+            {
+              ret = resize (0);
+              if (ret < 0)
+                {
+                  fEntrySector = 0;
+                }
+            }
+          if ((ret == 0) && (fs->fNodes != nullptr))
+            {
+              // Shared with the other opens, not recycled until closed.
+              fs->fNodes->acquire (inode ());
+            }
+        }
+
+      return ret;
+    }
+
+    int
+    FatFile::do_close (void)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          return 0;
+        }
+
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = writeBack ();
+      if (fReserved && (trimChain (fSize) < 0))
+        {
+          // The chain is longer than the size, still valid.
+          ret = -1;
+        }
+      if ((fEntryDirty && (syncEntry () < 0)) || (fs->flushSector () < 0)
+          || (fs->flushWindow () < 0))
+        {
+          ret = -1;
+        }
+      fReserved = false;
+      fs->unlock ();
+      return ret;
+    }
+
+    ssize_t
+    FatFile::do_read (void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_WRONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      readAhead (fOffset, nbyte);
+
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      ssize_t ret = 0;
+      if (fOffset < static_cast<off_t> (fSize))
+        {
+          std::size_t n = fSize - static_cast<std::size_t> (fOffset);
+          if (n > nbyte)
+            {
+              n = nbyte;
+            }
+          ret = transfer (static_cast<std::size_t> (fOffset), nullptr, buf, n);
+          if (ret > 0)
+            {
+              fOffset += ret;
+            }
+        }
+      fs->unlock ();
+
+      return ret;
+    }
+
+    ssize_t
+    FatFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      if (nbyte == 0)
+        {
+          return 0;
+        }
+
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      if ((fFlags & O_APPEND) != 0)
+        {
+          fOffset = static_cast<off_t> (fSize);
+        }
+
+      // Files are limited to 4 GiB - 1.
+      auto offset = static_cast<std::uint64_t> (fOffset);
+      if (offset + nbyte > 0xFFFFFFFFu)
+        {
+          if (offset >= 0xFFFFFFFFu)
+            {
+              fs->unlock ();
+
+              errno = EFBIG;
+              return -1;
+            }
+          nbyte = static_cast<std::size_t> (0xFFFFFFFFu - offset);
+        }
+
+      ssize_t ret = 0;
+      if (offset > fSize)
+        {
+          // The gap reads back as zeros.
+          ret = transfer (fSize, nullptr, nullptr,
+                          static_cast<std::size_t> (offset) - fSize);
+          if (ret > 0)
+            {
+              fSize += static_cast<std::size_t> (ret);
+              fEntryDirty = true;
+            }
+          ret = (fSize == offset) ? 0 : -1;
+        }
+
+      if (ret == 0)
+        {
+          ret = transfer (static_cast<std::size_t> (offset), buf, nullptr,
+                          nbyte);
+          if (ret > 0)
+            {
+              fOffset += ret;
+              if (static_cast<std::size_t> (fOffset) > fSize)
+                {
+                  fSize = static_cast<std::size_t> (fOffset);
+                }
+              fEntryDirty = true;
+            }
+        }
+      share (false);
+      fs->unlock ();
+
+      return ret;
+    }
+
+    off_t
+    FatFile::do_lseek (off_t offset, int whence)
+    {
+      off_t base;
+      switch (whence)
+        {
+        case SEEK_SET:
+          base = 0;
+          break;
+
+        case SEEK_CUR:
+          base = fOffset;
+          break;
+
+        case SEEK_END:
+          {
+            auto* fs = getFatFileSystem ();
+
+            fs->lock ();
+            base = static_cast<off_t> (fSize);
+            fs->unlock ();
+          }
+          break;
+
+        default:
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (base + offset < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      fOffset = base + offset;
+      return fOffset;
+    }
+
+    int
+    FatFile::do_ftruncate (off_t length)
+    {
+      if (((fFlags & O_ACCMODE) == O_RDONLY) || (length < 0))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = resize (static_cast<std::size_t> (length));
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FatFile::do_fallocate (int mode, off_t offset, off_t len)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      // Files are limited to 4 GiB - 1.
+      auto end = static_cast<std::uint64_t> (offset + len);
+      if (end > 0xFFFFFFFFu)
+        {
+          errno = EFBIG;
+          return -1;
+        }
+
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+
+      // Extend the chain in one go, such that the clusters are
+      // allocated after each other, if possible.
+      int ret = 0;
+      auto count = static_cast<std::uint32_t> ((end + fs->fClusterSize - 1)
+          / fs->fClusterSize);
+      if (clusterAt (count - 1, true) == 0)
+        {
+          // No space, give back what was allocated.
+          int err = errno;
+          trimChain (fSize);
+          fReserved = false;
+          errno = err;
+          ret = -1;
+        }
+      else if ((mode & FALLOC_FL_KEEP_SIZE) != 0)
+        {
+          fReserved = true;
+        }
+      else if (end > fSize)
+        {
+          // The clusters exist, only clear them.
+          ssize_t n = transfer (fSize, nullptr, nullptr,
+                                static_cast<std::size_t> (end) - fSize);
+          if (n > 0)
+            {
+              fSize += static_cast<std::size_t> (n);
+              fEntryDirty = true;
+            }
+          ret = (fSize == end) ? 0 : -1;
+        }
+      share (false);
+
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FatFile::do_fsync (void)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = 0;
+      if ((writeBack () < 0) || (fEntryDirty && (syncEntry () < 0))
+          || (fs->flushSector () < 0) || (fs->flushWindow () < 0))
+        {
+          ret = -1;
+        }
+
+      // A commit flushes the device, the file data included.
+      bool flushed = false;
+      if ((ret == 0) && fs->isJournaled ())
+        {
+          std::size_t commits = fs->fJournal->getCommits ();
+          if (fs->commitJournal () < 0)
+            {
+              ret = -1;
+            }
+          flushed = (fs->fJournal->getCommits () != commits);
+        }
+      fs->unlock ();
+
+      if ((ret == 0) && !flushed && (fs->getBlockDevice ()->flush () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    int
+    FatFile::do_fstat (struct stat* buf)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      int ret = -1;
+      void* node = nullptr;
+      if (fs->fNodes != nullptr)
+        {
+          // Referenced while open.
+          node = fs->fNodes->find (inode ());
+        }
+      const std::uint8_t* raw;
+      if (node != nullptr)
+        {
+          fs->fillStat (static_cast<FatFileSystem::Entry*> (node), buf);
+          buf->st_size = static_cast<off_t> (fSize);
+          ret = 0;
+        }
+      else if ((raw = fs->loadSector (fEntrySector)) != nullptr)
+        {
+          FatFileSystem::Entry entry;
+          entry.sector = fEntrySector;
+          entry.offset = fEntryOffset;
+          std::memcpy (entry.raw, raw + fEntryOffset, entrySize);
+          fs->fillStat (&entry, buf);
+          // Possibly not yet in the entry.
+          buf->st_size = static_cast<off_t> (fSize);
+          ret = 0;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    void
+    FatFile::do_readahead (off_t offset, std::size_t length)
+    {
+      auto* fs = getFatFileSystem ();
+      auto* device = fs->getBlockDevice ();
+
+      fs->lock ();
+      if (offset < static_cast<off_t> (fSize))
+        {
+          auto start = static_cast<std::size_t> (offset);
+          std::size_t end = start + length;
+          if (end > fSize)
+            {
+              end = fSize;
+            }
+
+          // Prefetch the clusters, merged in contiguous ranges.
+          auto first = static_cast<std::uint32_t> (start / fs->fClusterSize);
+          auto last = static_cast<std::uint32_t> ((end - 1) / fs->fClusterSize);
+          std::uint32_t runStart = 0;
+          std::uint32_t runCount = 0;
+          for (std::uint32_t k = first; k <= last; ++k)
+            {
+              std::uint32_t c = clusterAt (k, false);
+              if (c == 0)
+                {
+                  break;
+                }
+              if ((runCount != 0) && (c == runStart + runCount))
+                {
+                  ++runCount;
+                  continue;
+                }
+              if (runCount != 0)
+                {
+                  device->prefetch (fs->clusterSector (runStart),
+                                    runCount * fs->fSectorsPerCluster);
+                }
+              runStart = c;
+              runCount = 1;
+            }
+          if (runCount != 0)
+            {
+              device->prefetch (fs->clusterSector (runStart),
+                                runCount * fs->fSectorsPerCluster);
+            }
+        }
+      fs->unlock ();
+    }
+
+    void
+    FatFile::do_release (void)
+    {
+      auto* fs = getFatFileSystem ();
+      if ((fEntrySector != 0) && (fs->fNodes != nullptr))
+        {
+          fs->lock ();
+          fs->fNodes->release (inode ());
+          fs->unlock ();
+        }
+
+      fEntrySector = 0;
+      fEntryOffset = 0;
+      fFirstCluster = 0;
+      fSize = 0;
+      fOffset = 0;
+      fFlags = 0;
+      fEntryDirty = false;
+      fReserved = false;
+      forgetClusters ();
+
+      File::do_release ();
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    FatFile::forgetClusters (void)
+    {
+      fRunsCount = 0;
+      fMapped = 0;
+      fHintIndex = 0;
+      fHintCluster = 0;
+    }
+
+    void
+    FatFile::record (std::uint32_t index, std::uint32_t cluster)
+    {
+      if (index != fMapped)
+        {
+          // Beyond the map, which is full.
+          return;
+        }
+
+      if (fRunsCount != 0)
+        {
+          Run* last = &fRuns[fRunsCount - 1];
+          if (last->cluster + last->count == cluster)
+            {
+              ++last->count;
+              ++fMapped;
+              return;
+            }
+        }
+      if (fRunsCount < OS_INTEGER_FAT_FILE_RUNS)
+        {
+          fRuns[fRunsCount].index = index;
+          fRuns[fRunsCount].cluster = cluster;
+          fRuns[fRunsCount].count = 1;
+          ++fRunsCount;
+          ++fMapped;
+        }
+    }
+
+    std::uint32_t
+    FatFile::clusterAt (std::uint32_t index, bool extend)
+    {
+      auto* fs = getFatFileSystem ();
+
+      if (index < fMapped)
+        {
+          // In the map, no FAT access.
+          std::size_t lo = 0;
+          std::size_t hi = fRunsCount;
+          while (hi - lo > 1)
+            {
+              std::size_t mid = (lo + hi) / 2;
+              if (fRuns[mid].index <= index)
+                {
+                  lo = mid;
+                }
+              else
+                {
+                  hi = mid;
+                }
+            }
+          return fRuns[lo].cluster + (index - fRuns[lo].index);
+        }
+
+      if (fFirstCluster == 0)
+        {
+          if (!extend)
+            {
+              errno = EIO;
+              return 0;
+            }
+          fFirstCluster = fs->allocateCluster (0);
+          if (fFirstCluster == 0)
+            {
+              return 0;
+            }
+          fEntryDirty = true;
+          // The others must not allocate another one.
+          share (false);
+        }
+
+      // Continue from the closest known cluster.
+      std::uint32_t k;
+      std::uint32_t cluster;
+      if ((fHintCluster != 0) && (fHintIndex >= fMapped)
+          && (fHintIndex <= index))
+        {
+          k = fHintIndex;
+          cluster = fHintCluster;
+        }
+      else if (fMapped != 0)
+        {
+          const Run* last = &fRuns[fRunsCount - 1];
+          k = fMapped - 1;
+          cluster = last->cluster + last->count - 1;
+        }
+      else
+        {
+          k = 0;
+          cluster = fFirstCluster;
+          record (0, cluster);
+        }
+
+      while (k < index)
+        {
+          std::uint32_t next;
+          if (fs->getFat (cluster, &next) < 0)
+            {
+              return 0;
+            }
+          if (fs->isEnd (next))
+            {
+              if (!extend)
+                {
+                  // Shorter than the size.
+                  errno = EIO;
+                  return 0;
+                }
+              next = fs->allocateCluster (cluster);
+              if (next == 0)
+                {
+                  return 0;
+                }
+            }
+          else if (!fs->isValid (next))
+            {
+              errno = EIO;
+              return 0;
+            }
+          ++k;
+          cluster = next;
+          record (k, cluster);
+        }
+
+      fHintIndex = k;
+      fHintCluster = cluster;
+      return cluster;
+    }
+
+    ssize_t
+    FatFile::transfer (std::size_t offset, const void* src, void* dst,
+                       std::size_t nbyte)
+    {
+      if (((src != nullptr) || (dst != nullptr))
+          && getFatFileSystem ()->cachesPages ())
+        {
+          return transferPages (offset, src, dst, nbyte);
+        }
+      return transferDirect (offset, src, dst, nbyte);
+    }
+
+    ssize_t
+    FatFile::transferDirect (std::size_t offset, const void* src, void* dst,
+                             std::size_t nbyte)
+    {
+      auto* fs = getFatFileSystem ();
+      std::size_t clusterSize = fs->fClusterSize;
+      std::size_t sectorSize = fs->fSectorSize;
+      bool writing = (dst == nullptr);
+      auto* in = static_cast<const std::uint8_t*> (src);
+      auto* out = static_cast<std::uint8_t*> (dst);
+
+      std::size_t done = 0;
+      bool failed = false;
+      while ((done < nbyte) && !failed)
+        {
+          std::size_t at = offset + done;
+          auto k = static_cast<std::uint32_t> (at / clusterSize);
+          std::uint32_t cluster = clusterAt (k, writing);
+          if (cluster == 0)
+            {
+              break;
+            }
+
+          // Merge the following clusters, if contiguous.
+          std::size_t inCluster = at % clusterSize;
+          std::size_t span = clusterSize - inCluster;
+          std::uint32_t count = 1;
+          while ((done + span < nbyte)
+              && (clusterAt (k + count, writing) == cluster + count))
+            {
+              span += clusterSize;
+              ++count;
+            }
+          if (span > nbyte - done)
+            {
+              span = nbyte - done;
+            }
+
+          blockNumber_t sector = fs->clusterSector (cluster)
+              + static_cast<blockNumber_t> (inCluster / sectorSize);
+          std::size_t inSector = inCluster % sectorSize;
+          while (span > 0)
+            {
+              std::size_t n;
+              if ((inSector != 0) || (span < sectorSize))
+                {
+                  // Part of a sector, through the buffer.
+                  n = sectorSize - inSector;
+                  if (n > span)
+                    {
+                      n = span;
+                    }
+                  std::uint8_t* b = fs->loadSector (sector);
+                  if (b == nullptr)
+                    {
+                      failed = true;
+                      break;
+                    }
+                  if (!writing)
+                    {
+                      std::memcpy (out + done, b + inSector, n);
+                    }
+                  else
+                    {
+                      if (in != nullptr)
+                        {
+                          std::memcpy (b + inSector, in + done, n);
+                        }
+                      else
+                        {
+                          std::memset (b + inSector, 0, n);
+                        }
+                      fs->fBufferDirty = true;
+                    }
+                  ++sector;
+                  inSector = 0;
+                }
+              else
+                {
+                  // Whole sectors, directly.
+                  std::size_t sectors = span / sectorSize;
+                  n = sectors * sectorSize;
+                  if (fs->transferSectors (
+                      sector, sectors,
+                      (writing && (in != nullptr)) ? in + done : nullptr,
+                      writing ? nullptr : out + done) < 0)
+                    {
+                      failed = true;
+                      break;
+                    }
+                  sector += static_cast<blockNumber_t> (sectors);
+                }
+              done += n;
+              span -= n;
+            }
+        }
+
+      if ((done == 0) && (nbyte != 0))
+        {
+          return -1;
+        }
+      return static_cast<ssize_t> (done);
+    }
+
+    ssize_t
+    FatFile::transferPages (std::size_t offset, const void* src, void* dst,
+                            std::size_t nbyte)
+    {
+      auto* fs = getFatFileSystem ();
+      std::size_t pageSize = PageCache::getPageSize ();
+      ino_t node = inode ();
+      bool writing = (dst == nullptr);
+      auto* in = static_cast<const std::uint8_t*> (src);
+      auto* out = static_cast<std::uint8_t*> (dst);
+
+      std::size_t done = 0;
+      while (done < nbyte)
+        {
+          std::size_t at = offset + done;
+          auto index = static_cast<std::uint32_t> (at / pageSize);
+          std::size_t inPage = at % pageSize;
+          std::size_t n = pageSize - inPage;
+          if (n > nbyte - done)
+            {
+              n = nbyte - done;
+            }
+
+          if (writing
+              && (clusterAt (static_cast<std::uint32_t> (at / fs->fClusterSize),
+                             true) == 0))
+            {
+              break;
+            }
+
+          PageCache::Page* page = PageCache::find (fs, node, index);
+          if (page == nullptr)
+            {
+              if (writing
+                  && (PageCache::getDirty () * 2 >= PageCache::getSize ())
+                  && (writeBack () < 0))
+                {
+                  break;
+                }
+              page = PageCache::grab (fs, node, index);
+              if ((page != nullptr) && (!writing || (n != pageSize))
+                  && (fillPage (page) < 0))
+                {
+                  PageCache::discard (page);
+                  break;
+                }
+            }
+
+          if (page == nullptr)
+            {
+              // No room in the cache, directly.
+              ssize_t ret = transferDirect (at, writing ? in + done : nullptr,
+                                            writing ? nullptr : out + done, n);
+              if (ret > 0)
+                {
+                  done += static_cast<std::size_t> (ret);
+                }
+              if (ret != static_cast<ssize_t> (n))
+                {
+                  break;
+                }
+              continue;
+            }
+
+          if (writing)
+            {
+              std::memcpy (page->data + inPage, in + done, n);
+              PageCache::markDirty (page);
+            }
+          else
+            {
+              std::memcpy (out + done, page->data + inPage, n);
+            }
+          PageCache::release (page);
+          done += n;
+        }
+
+      if ((done == 0) && (nbyte != 0))
+        {
+          return -1;
+        }
+      return static_cast<ssize_t> (done);
+    }
+
+    int
+    FatFile::fillPage (PageCache::Page* page)
+    {
+      auto* fs = getFatFileSystem ();
+      std::size_t pageSize = PageCache::getPageSize ();
+      std::size_t start = page->index * pageSize;
+
+      std::size_t valid = 0;
+      if (fSize > start)
+        {
+          valid = fSize - start;
+          if (valid > pageSize)
+            {
+              valid = pageSize;
+            }
+
+          std::uint32_t cluster = clusterAt (
+              static_cast<std::uint32_t> (start / fs->fClusterSize), false);
+          if (cluster == 0)
+            {
+              return -1;
+            }
+          blockNumber_t sector = fs->clusterSector (cluster)
+              + static_cast<blockNumber_t> ((start % fs->fClusterSize)
+                  / fs->fSectorSize);
+          if (fs->transferSectors (
+              sector, (valid + fs->fSectorSize - 1) / fs->fSectorSize,
+              nullptr, page->data) < 0)
+            {
+              return -1;
+            }
+        }
+      std::memset (page->data + valid, 0, pageSize - valid);
+      return 0;
+    }
+
+    int
+    FatFile::writeBack (void)
+    {
+      auto* fs = getFatFileSystem ();
+      if (!fs->cachesPages ())
+        {
+          return 0;
+        }
+
+      std::size_t pageSize = PageCache::getPageSize ();
+      ino_t node = inode ();
+
+      int ret = 0;
+      std::size_t cursor = 0;
+      PageCache::Page* page;
+      while (PageCache::nextDirty (fs, node, &cursor, &page))
+        {
+          // The clusters were allocated when the page was written.
+          std::size_t start = page->index * pageSize;
+          std::uint32_t cluster = clusterAt (
+              static_cast<std::uint32_t> (start / fs->fClusterSize), false);
+          blockNumber_t sector = fs->clusterSector (cluster)
+              + static_cast<blockNumber_t> ((start % fs->fClusterSize)
+                  / fs->fSectorSize);
+          if ((cluster == 0)
+              || (fs->transferSectors (sector, pageSize / fs->fSectorSize,
+                                       page->data, nullptr) < 0))
+            {
+              ret = -1;
+            }
+          else
+            {
+              PageCache::markClean (page);
+            }
+          PageCache::release (page);
+        }
+      return ret;
+    }
+
+    ino_t
+    FatFile::inode (void) const
+    {
+      return getFatFileSystem ()->inodeAt (fEntrySector, fEntryOffset);
+    }
+
+    int
+    FatFile::resize (std::size_t length)
+    {
+      if (length > 0xFFFFFFFFu)
+        {
+          errno = EFBIG;
+          return -1;
+        }
+
+      int ret = 0;
+      if (length > fSize)
+        {
+          ssize_t n = transfer (fSize, nullptr, nullptr, length - fSize);
+          if (n != static_cast<ssize_t> (length - fSize))
+            {
+              // No space, give back what was allocated.
+              int err = errno;
+              trimChain (fSize);
+              errno = err;
+              return -1;
+            }
+        }
+      else
+        {
+          auto* fs = getFatFileSystem ();
+          if (fs->cachesPages ())
+            {
+              // The pages past the end are dropped, the rest of the
+              // last one cleared, to read back as zeros when extended.
+              std::size_t pageSize = PageCache::getPageSize ();
+              auto last = static_cast<std::uint32_t> (length / pageSize);
+              std::size_t inPage = length % pageSize;
+              PageCache::invalidate (fs, inode (),
+                                     (inPage != 0) ? last + 1 : last);
+              PageCache::Page* page;
+              if ((inPage != 0)
+                  && ((page = PageCache::find (fs, inode (), last)) != nullptr))
+                {
+                  std::memset (page->data + inPage, 0, pageSize - inPage);
+                  PageCache::release (page);
+                }
+            }
+          ret = trimChain (length);
+        }
+
+      fSize = length;
+      fEntryDirty = true;
+      share (false);
+      return ret;
+    }
+
+    int
+    FatFile::trimChain (std::size_t length)
+    {
+      auto* fs = getFatFileSystem ();
+      auto keep = static_cast<std::uint32_t> ((length + fs->fClusterSize - 1)
+          / fs->fClusterSize);
+
+      int ret = 0;
+      if (fFirstCluster == 0)
+        {
+          ;
+        }
+      else if (keep == 0)
+        {
+          ret = fs->freeChain (fFirstCluster);
+          fFirstCluster = 0;
+          fEntryDirty = true;
+        }
+      else
+        {
+          std::uint32_t last = clusterAt (keep - 1, false);
+          std::uint32_t next;
+          if ((last == 0) || (fs->getFat (last, &next) < 0))
+            {
+              ret = -1;
+            }
+          else if (!fs->isEnd (next))
+            {
+              if ((fs->setFat (last, fs->endOfChain ()) < 0)
+                  || (fs->freeChain (next) < 0))
+                {
+                  ret = -1;
+                }
+            }
+        }
+
+      // The maps may refer to freed clusters.
+      forgetClusters ();
+      share (true);
+      return ret;
+    }
+
+    int
+    FatFile::syncEntry (void)
+    {
+      auto* fs = getFatFileSystem ();
+
+      std::uint8_t* raw = fs->loadSector (fEntrySector);
+      if (raw == nullptr)
+        {
+          return -1;
+        }
+      raw += fEntryOffset;
+      fs->setFirstCluster (raw, fFirstCluster);
+      put32 (&raw[28], static_cast<std::uint32_t> (fSize));
+      raw[11] |= attrArchive;
+      stampEntry (raw, false);
+      fs->fBufferDirty = true;
+      fs->updateNode (fEntrySector, fEntryOffset);
+
+      fEntryDirty = false;
+      share (false);
+      return 0;
+    }
+
+    void
+    FatFile::share (bool shortened)
+    {
+      auto* fs = getFatFileSystem ();
+      auto* pool = fs->getFilesPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (!pool->getFlag (i))
+            {
+              continue;
+            }
+          auto* file = static_cast<FatFile*> (pool->getObject (i));
+          if ((file != this) && (file->getFileSystem () == fs)
+              && (file->fEntrySector == fEntrySector)
+              && (file->fEntryOffset == fEntryOffset))
+            {
+              file->fFirstCluster = fFirstCluster;
+              file->fSize = fSize;
+              file->fEntryDirty = fEntryDirty;
+              if (shortened)
+                {
+                  file->forgetClusters ();
+                }
+            }
+        }
+    }
+
+    // ========================================================================
+
+    FatDirectory::FatDirectory ()
+    {
+      fDir = 0;
+      fIndex = 0;
+      fCluster = 0;
+      fClusterIndex = 0;
+    }
+
+    FatDirectory::~FatDirectory ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    FatDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      Directory* ret = nullptr;
+      FatFileSystem::Entry entry;
+      if (fs->findPath (dirname, &entry) < 0)
+        {
+          ;
+        }
+      else if ((entry.raw[11] & attrDirectory) == 0)
+        {
+          errno = ENOTDIR;
+        }
+      else
+        {
+          fDir = fs->dirOf (entry.raw);
+          fIndex = 0;
+          fCluster = 0;
+          fClusterIndex = 0;
+          ret = this;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    struct dirent*
+    FatDirectory::do_read (void)
+    {
+      // The same, without the status.
+      return do_read_plus (nullptr);
+    }
+
+    struct dirent*
+    FatDirectory::do_read_plus (struct stat* buf)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      FatFileSystem::Position pos =
+        { fDir, fIndex, fCluster, fClusterIndex };
+      FatFileSystem::Entry entry;
+      struct dirent* ret = nullptr;
+      while (fs->nextEntry (&pos, &entry) > 0)
+        {
+          if ((std::strcmp (entry.name, ".") == 0)
+              || (std::strcmp (entry.name, "..") == 0))
+            {
+              continue;
+            }
+          ret = getDirEntry ();
+          ret->d_ino = fs->inodeOf (&entry);
+          std::strcpy (ret->d_name, entry.name);
+          if (buf != nullptr)
+            {
+              // The entry just read, as do_stat() would find it.
+              fs->fillStat (&entry, buf);
+            }
+          break;
+        }
+      fIndex = pos.index;
+      fCluster = pos.cluster;
+      fClusterIndex = pos.clusterIndex;
+      fs->unlock ();
+      return ret;
+    }
+
+    ssize_t
+    FatDirectory::do_read_batch (void* buf, std::size_t size)
+    {
+      auto* fs = getFatFileSystem ();
+
+      fs->lock ();
+      FatFileSystem::Position pos =
+        { fDir, fIndex, fCluster, fClusterIndex };
+      FatFileSystem::Entry entry;
+      auto* p = static_cast<char*> (buf);
+      std::size_t used = 0;
+      int ret;
+      while ((ret = fs->nextEntry (&pos, &entry)) > 0)
+        {
+          if ((std::strcmp (entry.name, ".") == 0)
+              || (std::strcmp (entry.name, "..") == 0))
+            {
+              continue;
+            }
+          unsigned char type =
+              ((entry.raw[11] & attrDirectory) != 0) ? DT_DIR : DT_REG;
+          std::size_t len = packEntry (p + used, size - used,
+                                       fs->inodeOf (&entry), type,
+                                       entry.name);
+          if (len == 0)
+            {
+              // Read again by the next call.
+              break;
+            }
+          used += len;
+          fIndex = pos.index;
+          fCluster = pos.cluster;
+          fClusterIndex = pos.clusterIndex;
+        }
+      if (ret == 0)
+        {
+          // The end, possibly after some free entries.
+          fIndex = pos.index;
+          fCluster = pos.cluster;
+          fClusterIndex = pos.clusterIndex;
+        }
+      fs->unlock ();
+
+      if (used != 0)
+        {
+          return static_cast<ssize_t> (used);
+        }
+      if (ret > 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      return ret;
+    }
+
+    void
+    FatDirectory::do_rewind (void)
+    {
+      fIndex = 0;
+      fCluster = 0;
+      fClusterIndex = 0;
+    }
+
+    void
+    FatDirectory::do_release (void)
+    {
+      fDir = 0;
+      fIndex = 0;
+      fCluster = 0;
+      fClusterIndex = 0;
+
+      Directory::do_release ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -26,11 +26,14 @@
  */
 
 #include "posix-io/File.h"
+#include "posix-io/Directory.h"
 #include "posix-io/FileSystem.h"
 #include "posix-io/MountManager.h"
 #include "posix-io/Pool.h"
+#include "posix-io/path.h"
 
 #include <cerrno>
+#include <sys/stat.h>
 
 // ----------------------------------------------------------------------------
 
@@ -58,11 +61,15 @@ namespace os
     {
       fType = Type::FILE;
       fFileSystem = nullptr;
+      fNode = nullptr;
+
+      resetReadAhead ();
     }
 
     File::~File ()
     {
       fFileSystem = nullptr;
+      fNode = nullptr;
     }
 
     // ------------------------------------------------------------------------
@@ -80,7 +87,11 @@ namespace os
               pool->release (this);
             }
           setFileSystem (nullptr);
+          setNode (nullptr);
         }
+
+      // The next open starts with a clean access history.
+      resetReadAhead ();
     }
 
     // ------------------------------------------------------------------------
@@ -118,6 +129,206 @@ namespace os
       return do_fsync ();
     }
 
+    int
+    File::fadvise (off_t offset, off_t len, int advice)
+    {
+      if ((offset < 0) || (len < 0))
+        {
+          return EINVAL;
+        }
+
+      switch (advice)
+        {
+        case POSIX_FADV_NORMAL:
+        case POSIX_FADV_SEQUENTIAL:
+        case POSIX_FADV_RANDOM:
+          // Start a new access pattern.
+          resetReadAhead ();
+          fAdvice = advice;
+          break;
+
+        case POSIX_FADV_WILLNEED:
+          do_readahead (
+              offset,
+              (len == 0) ?
+                  OS_INTEGER_FILE_READAHEAD_MAX :
+                  static_cast<std::size_t> (len));
+          break;
+
+        case POSIX_FADV_DONTNEED:
+        case POSIX_FADV_NOREUSE:
+          // Accepted, the cache replacement already favours
+          // blocks used more than once.
+          break;
+
+        default:
+          return EINVAL;
+        }
+
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * The window is sent to do_readahead() ahead of the reader, and
+     * the next one when the reader enters it, such that the device
+     * is already busy with the next blocks while the current ones
+     * are consumed from the cache.
+     */
+    void
+    File::readAhead (off_t offset, std::size_t nbyte)
+    {
+      if (fAdvice == POSIX_FADV_RANDOM)
+        {
+          return;
+        }
+
+      off_t end = offset + static_cast<off_t> (nbyte);
+      bool sequential = (offset == fReadAheadNext);
+      fReadAheadNext = end;
+
+      if (!sequential)
+        {
+          // Random access, shrink the window and forget it.
+          fReadAheadSize /= 2;
+          fReadAheadStart = 0;
+          fReadAheadEnd = 0;
+          return;
+        }
+
+      off_t start;
+      if ((fReadAheadEnd == 0) || (end > fReadAheadEnd))
+        {
+          // No window, or the reader outran it; start after this read.
+          start = end;
+        }
+      else if (end > fReadAheadStart)
+        {
+          // The reader entered the last window, issue the next one.
+          start = fReadAheadEnd;
+        }
+      else
+        {
+          return;
+        }
+
+      if (fReadAheadSize == 0)
+        {
+          fReadAheadSize =
+              (fAdvice == POSIX_FADV_SEQUENTIAL) ?
+                  OS_INTEGER_FILE_READAHEAD_MAX :
+                  OS_INTEGER_FILE_READAHEAD_MIN;
+        }
+      else if (fReadAheadSize < OS_INTEGER_FILE_READAHEAD_MAX)
+        {
+          fReadAheadSize *= 2;
+          if (fReadAheadSize > OS_INTEGER_FILE_READAHEAD_MAX)
+            {
+              fReadAheadSize = OS_INTEGER_FILE_READAHEAD_MAX;
+            }
+        }
+
+      fReadAheadStart = start;
+      fReadAheadEnd = start + static_cast<off_t> (fReadAheadSize);
+
+      do_readahead (start, fReadAheadSize);
+    }
+
+    int
+    File::fallocate (int mode, off_t offset, off_t len)
+    {
+      if ((offset < 0) || (len <= 0))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      if ((mode & ~FALLOC_FL_KEEP_SIZE) != 0)
+        {
+          errno = EOPNOTSUPP;
+          return -1;
+        }
+      if (offset + len < offset)
+        {
+          errno = EFBIG;
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      return do_fallocate (mode, offset, len);
+    }
+
+    int
+    File::preallocate (off_t offset, off_t len)
+    {
+      int err = errno;
+      int ret = 0;
+      if (fallocate (0, offset, len) < 0)
+        {
+          ret = (errno == EOPNOTSUPP) ? growWithZeros (offset + len) : errno;
+        }
+
+      errno = err;
+      return ret;
+    }
+
+    int
+    File::growWithZeros (off_t length)
+    {
+      struct stat st;
+      if (fstat (&st) < 0)
+        {
+          return errno;
+        }
+      if (st.st_size >= length)
+        {
+          return 0;
+        }
+
+      off_t offset = lseek (0, SEEK_CUR);
+      if ((offset < 0) || (lseek (st.st_size, SEEK_SET) < 0))
+        {
+          return errno;
+        }
+
+      static const char zeros[512] =
+        { 0 };
+      int ret = 0;
+      for (off_t size = st.st_size; size < length;)
+        {
+          std::size_t n = sizeof(zeros);
+          if (static_cast<off_t> (n) > length - size)
+            {
+              n = static_cast<std::size_t> (length - size);
+            }
+          ssize_t written = write (zeros, n);
+          if (written <= 0)
+            {
+              ret = (written < 0) ? errno : ENOSPC;
+              break;
+            }
+          size += written;
+        }
+
+      if ((lseek (offset, SEEK_SET) < 0) && (ret == 0))
+        {
+          ret = errno;
+        }
+      return ret;
+    }
+
+    void
+    File::resetReadAhead (void)
+    {
+      fReadAheadNext = 0;
+      fReadAheadStart = 0;
+      fReadAheadEnd = 0;
+      fReadAheadSize = 0;
+      fAdvice = POSIX_FADV_NORMAL;
+    }
+
     // ------------------------------------------------------------------------
 
 #pragma GCC diagnostic push
@@ -137,6 +348,19 @@ namespace os
       return -1;
     }
 
+    int
+    File::do_fallocate (int mode, off_t offset, off_t len)
+    {
+      errno = EOPNOTSUPP; // Not supported
+      return -1;
+    }
+
+    void
+    File::do_readahead (off_t offset, std::size_t length)
+    {
+      ;
+    }
+
 #pragma GCC diagnostic pop
 
     int
@@ -146,6 +370,20 @@ namespace os
       return -1;
     }
 
+    int
+    File::do_vopenat (Directory* dir, const char* path, int oflag,
+                      std::va_list args)
+    {
+      char joined[OS_INTEGER_PATH_MAX];
+      path = joinPath (dir->getAdjustedPath (), path, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      return do_vopen (path, oflag, args);
+    }
+
   } /* namespace posix */
 } /* namespace os */
 
@@ -27,13 +27,17 @@
 
 #include "posix-io/IO.h"
 #include "posix-io/FileSystem.h"
+#include "posix-io/BlockDevice.h"
 #include "posix-io/File.h"
 #include "posix-io/Directory.h"
 #include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
 #include "posix-io/Pool.h"
+#include "posix-io/path.h"
 
 #include <cerrno>
 #include <cassert>
+#include <cstring>
 
 // ----------------------------------------------------------------------------
 
@@ -58,9 +62,19 @@ namespace os
           return -1;
         }
 
-      auto adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      // A negative entry is expected, the path is being created.
+      PathCache::resolve (path, &fs, &adjusted_path, &node, &generation);
 
       if (fs == nullptr)
         {
@@ -72,7 +86,15 @@ namespace os
       errno = 0;
 
       // Execute the implementation specific code.
-      return fs->do_mkdir (adjusted_path, mode);
+      int ret = fs->do_mkdir (adjusted_path, mode);
+      if (ret == 0)
+        {
+          // Possibly remembered as missing, also by other threads.
+          PathCache::add (path, fs, adjusted_path, nullptr,
+                          PathCache::invalidate (path));
+        }
+      fs->release ();
+      return ret;
     }
 
     int
@@ -90,9 +112,25 @@ namespace os
           return -1;
         }
 
-      auto adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -104,7 +142,15 @@ namespace os
       errno = 0;
 
       // Execute the implementation specific code.
-      return fs->do_rmdir (adjusted_path);
+      int ret = fs->do_rmdir (adjusted_path);
+      if (ret == 0)
+        {
+          // Drop everything below and remember it is gone.
+          PathCache::addNegative (path, fs, adjusted_path,
+                                  PathCache::invalidatePrefix (path));
+        }
+      fs->release ();
+      return ret;
     }
 
     void
@@ -115,14 +161,113 @@ namespace os
       // Enumerate all mounted file systems and sync them.
       for (std::size_t i = 0; i < MountManager::getSize (); ++i)
         {
-          auto fs = MountManager::getFileSystem (i);
+          auto fs = MountManager::acquireFileSystem (i);
           if (fs != nullptr)
             {
               fs->do_sync ();
+              fs->release ();
             }
         }
     }
 
+    /**
+     * The current directory is kept normalized, such that relative
+     * paths are resolved by normalizePath() in the same single pass.
+     */
+    int
+    chdir (const char* path)
+    {
+      if (path == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if (*path == '\0')
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      struct stat buf;
+      if (os::posix::stat (path, &buf) == 0)
+        {
+          if (!S_ISDIR(buf.st_mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+        }
+      else if (errno != ENOSYS)
+        {
+          // If the file system cannot tell, trust the caller.
+          return -1;
+        }
+
+      // Store it without the trailing '/', except for the root; built
+      // aside, as `path` may be the current directory itself.
+      char dir[OS_INTEGER_PATH_MAX];
+      auto len = std::strlen (path);
+      if ((len > 1) && (path[len - 1] == '/'))
+        {
+          --len;
+        }
+      if (len >= sizeof(dir))
+        {
+          errno = ENAMETOOLONG;
+          return -1;
+        }
+      std::memcpy (dir, path, len);
+      dir[len] = '\0';
+
+      // Other threads may be reading it.
+      lockCurrentDirectory ();
+      std::memcpy (getCurrentDirectoryBuffer (), dir, len + 1);
+      unlockCurrentDirectory ();
+
+      errno = 0;
+      return 0;
+    }
+
+    char*
+    getcwd (char* buf, std::size_t size)
+    {
+      if ((buf == nullptr) || (size == 0))
+        {
+          errno = EINVAL;
+          return nullptr;
+        }
+
+      lockCurrentDirectory ();
+      const char* cwd = getCurrentDirectoryBuffer ();
+      if (*cwd == '\0')
+        {
+          // Not set, the root.
+          cwd = "/";
+        }
+
+      auto len = std::strlen (cwd);
+      if (len + 1 > size)
+        {
+          unlockCurrentDirectory ();
+          errno = ERANGE;
+          return nullptr;
+        }
+
+      std::memcpy (buf, cwd, len + 1);
+      unlockCurrentDirectory ();
+
+      errno = 0;
+      return buf;
+    }
+
     // ------------------------------------------------------------------------
     // Functions related to files, other than IO. The implementations is
     // specific to each FileSystem.
@@ -142,9 +287,25 @@ namespace os
           return -1;
         }
 
-      const char* adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -152,7 +313,10 @@ namespace os
           return -1;
         }
 
-      return fs->chmod (adjusted_path, mode);
+      int ret = fs->chmod (adjusted_path, mode);
+      PathCache::update (path, fs, adjusted_path, node, ret, generation);
+      fs->release ();
+      return ret;
     }
 
     int
@@ -170,9 +334,25 @@ namespace os
           return -1;
         }
 
-      const char* adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -180,7 +360,10 @@ namespace os
           return -1;
         }
 
-      return fs->stat (adjusted_path, buf);
+      int ret = fs->stat (adjusted_path, buf);
+      PathCache::update (path, fs, adjusted_path, node, ret, generation);
+      fs->release ();
+      return ret;
     }
 
     int
@@ -198,9 +381,25 @@ namespace os
           return -1;
         }
 
-      const char* adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -210,11 +409,15 @@ namespace os
 
       if (length < 0)
         {
+          fs->release ();
           errno = EINVAL;
           return -1;
         }
 
-      return fs->truncate (adjusted_path, length);
+      int ret = fs->truncate (adjusted_path, length);
+      PathCache::update (path, fs, adjusted_path, node, ret, generation);
+      fs->release ();
+      return ret;
     }
 
     int
@@ -232,9 +435,24 @@ namespace os
           return -1;
         }
 
+      char normalized_existing[OS_INTEGER_PATH_MAX];
+      existing = normalizePath (existing, normalized_existing,
+                                sizeof(normalized_existing));
+      if (existing == nullptr)
+        {
+          return -1;
+        }
+
+      char normalized_new[OS_INTEGER_PATH_MAX];
+      _new = normalizePath (_new, normalized_new, sizeof(normalized_new));
+      if (_new == nullptr)
+        {
+          return -1;
+        }
+
       auto adjusted_existing = existing;
       auto adjusted_new = _new;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
+      auto* const fs = os::posix::MountManager::acquireFileSystem (
           &adjusted_existing, &adjusted_new);
 
       if (fs == nullptr)
@@ -243,7 +461,16 @@ namespace os
           return -1;
         }
 
-      return fs->rename (adjusted_existing, adjusted_new);
+      int ret = fs->rename (adjusted_existing, adjusted_new);
+      if (ret == 0)
+        {
+          // Both trees changed, including negative entries below
+          // the new name.
+          PathCache::invalidatePrefix (existing);
+          PathCache::invalidatePrefix (_new);
+        }
+      fs->release ();
+      return ret;
     }
 
     int
@@ -261,9 +488,25 @@ namespace os
           return -1;
         }
 
-      auto adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -271,7 +514,18 @@ namespace os
           return -1;
         }
 
-      return fs->unlink (adjusted_path);
+      int ret = fs->unlink (adjusted_path);
+      if (ret == 0)
+        {
+          PathCache::addNegative (path, fs, adjusted_path,
+                                  PathCache::invalidate (path));
+        }
+      else
+        {
+          PathCache::update (path, fs, adjusted_path, node, ret, generation);
+        }
+      fs->release ();
+      return ret;
     }
 
     int
@@ -289,9 +543,25 @@ namespace os
           return -1;
         }
 
-      auto adjusted_path = path;
-      auto* const fs = os::posix::MountManager::identifyFileSystem (
-          &adjusted_path);
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      const char* adjusted_path;
+      FileSystem* fs;
+      void* node;
+      std::uint32_t generation;
+      if (PathCache::resolve (path, &fs, &adjusted_path, &node,
+                              &generation)
+          == PathCache::NOT_FOUND)
+        {
+          fs->release ();
+          errno = ENOENT;
+          return -1;
+        }
 
       if (fs == nullptr)
         {
@@ -299,7 +569,265 @@ namespace os
           return -1;
         }
 
-      return fs->utime (adjusted_path, times);
+      int ret = fs->utime (adjusted_path, times);
+      PathCache::update (path, fs, adjusted_path, node, ret, generation);
+      fs->release ();
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+    // Functions relative to a directory file descriptor. When the path
+    // can be resolved relative to the directory node, the path is not
+    // walked again from the root, and the mount table is not searched.
+
+    /**
+     * Invalidate the cached entries at and below a path changed
+     * relative to a directory. If the absolute path cannot be built,
+     * forget all the file system entries.
+     */
+    static void
+    invalidateAt (Directory* dir, const char* path)
+    {
+      int err = errno;
+
+      char joined[OS_INTEGER_PATH_MAX];
+      if (joinPath (dir->getPath (), path, joined, sizeof(joined)) != nullptr)
+        {
+          PathCache::invalidatePrefix (joined);
+        }
+      else
+        {
+          PathCache::invalidate (dir->getFileSystem ());
+        }
+
+      errno = err;
+    }
+
+    int
+    fstatat (int fildes, const char* path, struct stat* buf, int flag)
+    {
+      if ((path == nullptr) || (buf == nullptr))
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if (*path == '\0')
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      // There are no symbolic links, AT_SYMLINK_NOFOLLOW is irrelevant.
+      (void) flag;
+
+      Directory* dir;
+      char joined[OS_INTEGER_PATH_MAX];
+      path = resolveAtPath (fildes, path, &dir, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      if (dir == nullptr)
+        {
+          return os::posix::stat (path, buf);
+        }
+
+      auto* const fs = dir->getFileSystem ();
+      if (!fs->acquire ())
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      int ret = fs->do_statat (dir, path, buf);
+      fs->release ();
+      return ret;
+    }
+
+    int
+    mkdirat (int fildes, const char* path, mode_t mode)
+    {
+      if (path == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if (*path == '\0')
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      Directory* dir;
+      char joined[OS_INTEGER_PATH_MAX];
+      path = resolveAtPath (fildes, path, &dir, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      if (dir == nullptr)
+        {
+          return os::posix::mkdir (path, mode);
+        }
+
+      auto* const fs = dir->getFileSystem ();
+      if (!fs->acquire ())
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      int ret = fs->do_mkdirat (dir, path, mode);
+      if (ret == 0)
+        {
+          // Possibly remembered as missing.
+          invalidateAt (dir, path);
+        }
+      fs->release ();
+      return ret;
+    }
+
+    int
+    unlinkat (int fildes, const char* path, int flag)
+    {
+      if (path == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if (*path == '\0')
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      if ((flag & ~AT_REMOVEDIR) != 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      Directory* dir;
+      char joined[OS_INTEGER_PATH_MAX];
+      path = resolveAtPath (fildes, path, &dir, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      if (dir == nullptr)
+        {
+          if ((flag & AT_REMOVEDIR) != 0)
+            {
+              return os::posix::rmdir (path);
+            }
+          return os::posix::unlink (path);
+        }
+
+      auto* const fs = dir->getFileSystem ();
+      if (!fs->acquire ())
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      errno = 0;
+
+      // Execute the implementation specific code.
+      int ret = fs->do_unlinkat (dir, path, flag);
+      if (ret == 0)
+        {
+          invalidateAt (dir, path);
+        }
+      fs->release ();
+      return ret;
+    }
+
+    int
+    renameat (int oldfd, const char* existing, int newfd, const char* _new)
+    {
+      if ((existing == nullptr) || (_new == nullptr))
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if ((*existing == '\0') || (*_new == '\0'))
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      Directory* olddir;
+      char joined_existing[OS_INTEGER_PATH_MAX];
+      existing = resolveAtPath (oldfd, existing, &olddir, joined_existing,
+                                sizeof(joined_existing));
+      if (existing == nullptr)
+        {
+          return -1;
+        }
+
+      Directory* newdir;
+      char joined_new[OS_INTEGER_PATH_MAX];
+      _new = resolveAtPath (newfd, _new, &newdir, joined_new,
+                            sizeof(joined_new));
+      if (_new == nullptr)
+        {
+          return -1;
+        }
+
+      if ((olddir != nullptr) && (newdir != nullptr)
+          && (olddir->getFileSystem () == newdir->getFileSystem ()))
+        {
+          auto* const fs = olddir->getFileSystem ();
+          if (!fs->acquire ())
+            {
+              errno = EBADF;
+              return -1;
+            }
+
+          errno = 0;
+
+          // Execute the implementation specific code.
+          int ret = fs->do_renameat (olddir, existing, newdir, _new);
+          if (ret == 0)
+            {
+              invalidateAt (olddir, existing);
+              invalidateAt (newdir, _new);
+            }
+          fs->release ();
+          return ret;
+        }
+
+      // Different file systems, or paths not relative to directories;
+      // use absolute paths.
+      if ((olddir != nullptr)
+          && (joinPath (olddir->getPath (), existing, joined_existing,
+                        sizeof(joined_existing)) == nullptr))
+        {
+          return -1;
+        }
+      if ((newdir != nullptr)
+          && (joinPath (newdir->getPath (), _new, joined_new,
+                        sizeof(joined_new)) == nullptr))
+        {
+          return -1;
+        }
+
+      return os::posix::rename (
+          (olddir != nullptr) ? joined_existing : existing,
+          (newdir != nullptr) ? joined_new : _new);
     }
 
     // ------------------------------------------------------------------------
@@ -309,6 +837,8 @@ namespace os
       fFilesPool = filesPool;
       fDirsPool = dirsPool;
       fBlockDevice = nullptr;
+      fInFlight = 0;
+      fMounted = false;
     }
 
     FileSystem::~FileSystem ()
@@ -318,8 +848,28 @@ namespace os
 
     // ------------------------------------------------------------------------
 
+    /**
+     * The counter is incremented before checking the mount state, and
+     * umount() clears the state before waiting for the counter, so
+     * either the operation is rejected or umount() waits for it.
+     */
+    bool
+    FileSystem::acquire (void)
+    {
+      fInFlight.fetch_add (1);
+      if (!fMounted.load ())
+        {
+          fInFlight.fetch_sub (1);
+          return false;
+        }
+      return true;
+    }
+
+    // ------------------------------------------------------------------------
+
     IO*
-    FileSystem::open (const char* path, int oflag, std::va_list args)
+    FileSystem::open (const char* path, int oflag, std::va_list args,
+                      void* node)
     {
       if (fBlockDevice == nullptr)
         {
@@ -329,19 +879,32 @@ namespace os
 
       // Get a File object from the pool.
       auto* const file = static_cast<File*> (fFilesPool->aquire ());
+      if (file == nullptr)
+        {
+          errno = ENFILE;
+          return nullptr;
+        }
 
       // Associate the file with this file system (used, for example,
       // to reach the pools at close).
       file->setFileSystem (this);
 
+      // The node handle, if known from the path cache.
+      file->setNode (node);
+
       // Execute the file specific implementation code.
-      file->do_vopen (path, oflag, args);
+      if (file->do_vopen (path, oflag, args) < 0)
+        {
+          // Open failed, return the object to the pool.
+          file->do_release ();
+          return nullptr;
+        }
 
       return file;
     }
 
     Directory*
-    FileSystem::opendir (const char* dirpath)
+    FileSystem::opendir (const char* dirpath, void* node)
     {
       if (fBlockDevice == nullptr)
         {
@@ -351,17 +914,64 @@ namespace os
 
       // Get a Directory object from the pool.
       auto* const dir = static_cast<Directory*> (fDirsPool->aquire ());
+      if (dir == nullptr)
+        {
+          errno = ENFILE;
+          return nullptr;
+        }
 
       // Associate the dir with this file system (used, for example,
       // to reach the pools at close).
       dir->setFileSystem (this);
 
+      // The node handle, if known from the path cache.
+      dir->setNode (node);
+
       // Execute the dir specific implementation code.
-      dir->do_vopen (dirpath);
+      if (dir->do_vopen (dirpath) == nullptr)
+        {
+          // Open failed, return the object to the pool.
+          dir->setFileSystem (nullptr);
+          dir->setNode (nullptr);
+          fDirsPool->release (dir);
+          return nullptr;
+        }
 
       return dir;
     }
 
+    IO*
+    FileSystem::openat (Directory* dir, const char* path, int oflag,
+                        std::va_list args)
+    {
+      if (fBlockDevice == nullptr)
+        {
+          errno = EBADF;
+          return nullptr;
+        }
+
+      // Get a File object from the pool.
+      auto* const file = static_cast<File*> (fFilesPool->aquire ());
+      if (file == nullptr)
+        {
+          errno = ENFILE;
+          return nullptr;
+        }
+
+      file->setFileSystem (this);
+      file->setNode (nullptr);
+
+      // Execute the file specific implementation code.
+      if (file->do_vopenat (dir, path, oflag, args) < 0)
+        {
+          // Open failed, return the object to the pool.
+          file->do_release ();
+          return nullptr;
+        }
+
+      return file;
+    }
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
@@ -495,9 +1105,87 @@ namespace os
     void
     FileSystem::do_sync (void)
     {
-      errno = ENOSYS; // Not implemented
+      if (fBlockDevice == nullptr)
+        {
+          errno = ENOSYS; // Not implemented
+          return;
+        }
+
+      // Write the cached blocks.
+      fBlockDevice->flush ();
     }
 
+#pragma GCC diagnostic pop
+
+    int
+    FileSystem::do_statat (Directory* dir, const char* path, struct stat* buf)
+    {
+      char joined[OS_INTEGER_PATH_MAX];
+      path = joinPath (dir->getAdjustedPath (), path, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      return do_stat (path, buf);
+    }
+
+    int
+    FileSystem::do_mkdirat (Directory* dir, const char* path, mode_t mode)
+    {
+      char joined[OS_INTEGER_PATH_MAX];
+      path = joinPath (dir->getAdjustedPath (), path, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      return do_mkdir (path, mode);
+    }
+
+    int
+    FileSystem::do_unlinkat (Directory* dir, const char* path, int flag)
+    {
+      char joined[OS_INTEGER_PATH_MAX];
+      path = joinPath (dir->getAdjustedPath (), path, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return -1;
+        }
+
+      if ((flag & AT_REMOVEDIR) != 0)
+        {
+          return do_rmdir (path);
+        }
+      return do_unlink (path);
+    }
+
+    int
+    FileSystem::do_renameat (Directory* olddir, const char* existing,
+                             Directory* newdir, const char* _new)
+    {
+      char joined_existing[OS_INTEGER_PATH_MAX];
+      existing = joinPath (olddir->getAdjustedPath (), existing,
+                           joined_existing, sizeof(joined_existing));
+      if (existing == nullptr)
+        {
+          return -1;
+        }
+
+      char joined_new[OS_INTEGER_PATH_MAX];
+      _new = joinPath (newdir->getAdjustedPath (), _new, joined_new,
+                       sizeof(joined_new));
+      if (_new == nullptr)
+        {
+          return -1;
+        }
+
+      return do_rename (existing, _new);
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
     int
     FileSystem::do_mount (unsigned int flags)
     {
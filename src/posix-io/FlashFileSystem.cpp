@@ -0,0 +1,2327 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FlashFileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/Pool.h"
+#include "posix-io/hash.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    static constexpr std::uint32_t blockMagic = 0x424C4653; // "FSLB"
+    static constexpr std::uint32_t segmentMagic = 0x534C4653; // "FSLS"
+    static constexpr std::uint32_t version = 1;
+
+    // The tag at the end of each block: magic, ino, chunk, reserved,
+    // sequence (64 bits), CRC of the block up to it, reserved.
+    static constexpr std::size_t tagSize = 32;
+    static constexpr std::size_t tagCrc = 24;
+
+    // The header payload: type, name length, mode, parent, size, mtime,
+    // replaced object, name.
+    static constexpr std::size_t headerName = 20;
+
+    static constexpr std::uint32_t noBlock = ~static_cast<std::uint32_t> (0);
+    static constexpr std::size_t noSegment = ~static_cast<std::size_t> (0);
+
+    static constexpr std::uint32_t rootIno = 1;
+    static constexpr std::uint32_t firstIno = 2;
+
+    // Object types.
+    static constexpr std::uint8_t typeNone = 0;
+    static constexpr std::uint8_t typeFile = 1;
+    static constexpr std::uint8_t typeDirectory = 2;
+    // Removed, kept until all its blocks are erased.
+    static constexpr std::uint8_t typeDeleted = 3;
+
+    // Segment states.
+    static constexpr std::uint8_t segmentFree = 0;
+    static constexpr std::uint8_t segmentHead = 1;
+    static constexpr std::uint8_t segmentFull = 2;
+
+    // Free segments kept for the garbage collector: one for the moves
+    // of a collection, and one more to restart the collection after a
+    // power loss, since the end of the segment written at that time
+    // cannot be used until it is erased.
+    static constexpr std::size_t reserveSegments = 2;
+
+    static constexpr mode_t permissionBits = 07777;
+
+    static inline std::uint32_t
+    get32 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint32_t> (p[0])
+          | (static_cast<std::uint32_t> (p[1]) << 8)
+          | (static_cast<std::uint32_t> (p[2]) << 16)
+          | (static_cast<std::uint32_t> (p[3]) << 24);
+    }
+
+    static inline void
+    put32 (std::uint8_t* p, std::uint32_t value)
+    {
+      p[0] = static_cast<std::uint8_t> (value);
+      p[1] = static_cast<std::uint8_t> (value >> 8);
+      p[2] = static_cast<std::uint8_t> (value >> 16);
+      p[3] = static_cast<std::uint8_t> (value >> 24);
+    }
+
+    static inline std::size_t
+    bucketOf (std::uint32_t ino, std::uint32_t chunk, std::size_t mask)
+    {
+      return ((ino * 0x9E3779B1u) ^ (chunk * 0x85EBCA6Bu)) & mask;
+    }
+
+    static void
+    makeSegmentHeader (std::uint8_t* buf, std::size_t blockSize,
+                       std::size_t segmentBlocks, std::size_t segmentsCount,
+                       std::uint32_t erases)
+    {
+      std::memset (buf, 0, blockSize);
+      put32 (&buf[0], segmentMagic);
+      put32 (&buf[4], version);
+      put32 (&buf[8], static_cast<std::uint32_t> (segmentBlocks));
+      put32 (&buf[12], static_cast<std::uint32_t> (segmentsCount));
+      put32 (&buf[16], erases);
+      put32 (&buf[20], crc32 (buf, 20));
+    }
+
+    static bool
+    checkSegmentHeader (const std::uint8_t* buf)
+    {
+      return (get32 (&buf[0]) == segmentMagic) && (get32 (&buf[4]) == version)
+          && (get32 (&buf[20]) == crc32 (buf, 20));
+    }
+
+    // An erased block reads as all ones (flash) or all zeros.
+    static bool
+    isErased (const std::uint8_t* buf, std::size_t size)
+    {
+      for (std::size_t i = 1; i < size; ++i)
+        {
+          if (buf[i] != buf[0])
+            {
+              return false;
+            }
+        }
+      return (buf[0] == 0x00) || (buf[0] == 0xFF);
+    }
+
+    // ------------------------------------------------------------------------
+
+    FlashFileSystem::FlashFileSystem (Pool* filesPool, Pool* dirsPool,
+                                      std::size_t objectsCount) :
+        FileSystem (filesPool, dirsPool)
+    {
+      assert(objectsCount > 0);
+
+      fObjects = new Object[objectsCount];
+      fObjectsCount = objectsCount;
+
+      fBlockSize = 0;
+      fPayloadSize = 0;
+      fSegmentBlocks = 0;
+      fSegmentsCount = 0;
+
+      fOwners = nullptr;
+      fNext = nullptr;
+      fLiveBits = nullptr;
+      fBuckets = nullptr;
+      fBucketsMask = 0;
+
+      fSegments = nullptr;
+      fFreeSegments = 0;
+      fHead = noSegment;
+      fVictim = noSegment;
+      fVictimCursor = 0;
+      fLive = 0;
+      fMoved = 0;
+
+      fSequence = 0;
+
+      fBuffer = nullptr;
+      fPending = nullptr;
+      fPendingIno = 0;
+      fPendingChunk = 0;
+      fPendingDirty = false;
+
+      fLock.clear ();
+    }
+
+    FlashFileSystem::~FlashFileSystem ()
+    {
+      delete[] fPending;
+      delete[] fBuffer;
+      delete[] fSegments;
+      delete[] fBuckets;
+      delete[] fLiveBits;
+      delete[] fNext;
+      delete[] fOwners;
+      delete[] fObjects;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    FlashFileSystem::getLiveBlocks (void) const
+    {
+      return fLive + fSegmentsCount;
+    }
+
+    std::uint32_t
+    FlashFileSystem::getMinErases (void) const
+    {
+      std::uint32_t min = ~0u;
+      for (std::size_t s = 0; s < fSegmentsCount; ++s)
+        {
+          if (fSegments[s].erases < min)
+            {
+              min = fSegments[s].erases;
+            }
+        }
+      return (fSegmentsCount != 0) ? min : 0;
+    }
+
+    std::uint32_t
+    FlashFileSystem::getMaxErases (void) const
+    {
+      std::uint32_t max = 0;
+      for (std::size_t s = 0; s < fSegmentsCount; ++s)
+        {
+          if (fSegments[s].erases > max)
+            {
+              max = fSegments[s].erases;
+            }
+        }
+      return max;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FlashFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      lock ();
+      int ret = -1;
+      std::uint32_t ino = find (path);
+      if (ino == rootIno)
+        {
+          ret = 0;
+        }
+      else if (ino != 0)
+        {
+          Object* object = objectOf (ino);
+          object->mode = static_cast<std::uint16_t> ((object->mode
+              & ~permissionBits) | (mode & permissionBits));
+          ret = writeHeader (ino);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      lock ();
+      int ret = -1;
+      std::uint32_t ino = find (path);
+      if (ino != 0)
+        {
+          fillStat (ino, buf);
+          ret = 0;
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_truncate (const char* path, off_t length)
+    {
+      if (length < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      lock ();
+      int ret = -1;
+      std::uint32_t ino = find (path);
+      if (ino == 0)
+        {
+          ;
+        }
+      else if ((ino == rootIno) || (objectOf (ino)->type != typeFile))
+        {
+          errno = EISDIR;
+        }
+      else
+        {
+          ret = resize (ino, static_cast<std::size_t> (length));
+          if (ret == 0)
+            {
+              ret = commit (ino);
+            }
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      lock ();
+
+      int ret = -1;
+      std::uint32_t oldDir;
+      const char* oldName;
+      std::size_t oldLen;
+      std::uint32_t newDir;
+      const char* newName;
+      std::size_t newLen;
+      std::uint32_t ino = 0;
+
+      if ((resolve (existing, &oldDir, &oldName, &oldLen) < 0)
+          || (resolve (_new, &newDir, &newName, &newLen) < 0))
+        {
+          ;
+        }
+      else if ((oldLen == 0) || (newLen == 0))
+        {
+          // The root.
+          errno = EBUSY;
+        }
+      else if ((ino = lookup (oldDir, oldName, oldLen)) == 0)
+        {
+          errno = ENOENT;
+        }
+      else
+        {
+          Object* object = objectOf (ino);
+          std::uint32_t target = lookup (newDir, newName, newLen);
+          Object* victim = objectOf (target);
+
+          ret = 0;
+          if (object->type == typeDirectory)
+            {
+              // Not into itself.
+              for (std::uint32_t d = newDir; d != rootIno;
+                  d = objectOf (d)->parent)
+                {
+                  if (d == ino)
+                    {
+                      errno = EINVAL;
+                      ret = -1;
+                      break;
+                    }
+                }
+            }
+
+          if ((ret < 0) || (target == ino))
+            {
+              ;
+            }
+          else if (target == 0)
+            {
+              ;
+            }
+          else if ((object->type == typeDirectory)
+              && (victim->type != typeDirectory))
+            {
+              errno = ENOTDIR;
+              ret = -1;
+            }
+          else if ((object->type != typeDirectory)
+              && (victim->type == typeDirectory))
+            {
+              errno = EISDIR;
+              ret = -1;
+            }
+          else if (hasChildren (target))
+            {
+              errno = ENOTEMPTY;
+              ret = -1;
+            }
+          else if ((victim->opens != 0) || isDirectoryOpen (target))
+            {
+              errno = EBUSY;
+              ret = -1;
+            }
+
+          if ((ret == 0) && (target != ino))
+            {
+              std::uint32_t parent = object->parent;
+              char name[OS_INTEGER_FLASHFS_NAME_MAX + 1];
+              std::strcpy (name, object->name);
+
+              object->parent = newDir;
+              std::memcpy (object->name, newName, newLen);
+              object->name[newLen] = '\0';
+
+              // The header names the replaced object, such that the
+              // rename is atomic even if its removal is not written.
+              ret = writeHeader (ino, target);
+              if (ret < 0)
+                {
+                  object->parent = parent;
+                  std::strcpy (object->name, name);
+                }
+              else if (target != 0)
+                {
+                  ret = remove (target);
+                }
+            }
+        }
+
+      if (ret == 0)
+        {
+          collectStep ();
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_unlink (const char* path)
+    {
+      lock ();
+      int ret = removeFrom (path, false);
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      lock ();
+      int ret = -1;
+      std::uint32_t ino = find (path);
+      if (ino == rootIno)
+        {
+          ret = 0;
+        }
+      else if (ino != 0)
+        {
+          objectOf (ino)->mtime = times->modtime;
+          ret = writeHeader (ino);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      lock ();
+      int ret = -1;
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      if (resolve (path, &dir, &name, &len) < 0)
+        {
+          ;
+        }
+      else if ((len == 0) || (lookup (dir, name, len) != 0))
+        {
+          errno = EEXIST;
+        }
+      else if (create (dir, name, len, typeDirectory, mode) != 0)
+        {
+          ret = 0;
+          collectStep ();
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_rmdir (const char* path)
+    {
+      lock ();
+      int ret = removeFrom (path, true);
+      unlock ();
+      return ret;
+    }
+
+    void
+    FlashFileSystem::do_sync (void)
+    {
+      lock ();
+      syncAll ();
+      unlock ();
+
+      FileSystem::do_sync ();
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    FlashFileSystem::do_mount (unsigned int flags)
+    {
+      auto* device = getBlockDevice ();
+      if (device == nullptr)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      lock ();
+
+      delete[] fPending;
+      delete[] fBuffer;
+      delete[] fSegments;
+      delete[] fBuckets;
+      delete[] fLiveBits;
+      delete[] fNext;
+      delete[] fOwners;
+      fPending = nullptr;
+      fSegments = nullptr;
+      fBuckets = nullptr;
+      fLiveBits = nullptr;
+      fNext = nullptr;
+      fOwners = nullptr;
+      fSegmentsCount = 0;
+
+      fBlockSize = device->getBlockSize ();
+      fPayloadSize = fBlockSize - tagSize;
+      fBuffer = new std::uint8_t[fBlockSize];
+
+      // The geometry is in the header of any segment; the first one
+      // may be in the middle of an erase.
+      bool found = false;
+      blockNumber_t first = 0;
+      if (fBlockSize >= 128)
+        {
+          for (; first < device->getBlocksCount (); ++first)
+            {
+              if (readBlock (first) < 0)
+                {
+                  break;
+                }
+              if (checkSegmentHeader (fBuffer))
+                {
+                  found = true;
+                  break;
+                }
+            }
+        }
+
+      std::size_t segmentBlocks = found ? get32 (&fBuffer[8]) : 0;
+      std::size_t segmentsCount = found ? get32 (&fBuffer[12]) : 0;
+      if (!found || (segmentBlocks < 2)
+          || (segmentsCount < reserveSegments + 2)
+          || ((first % segmentBlocks) != 0)
+          || (segmentBlocks * segmentsCount > device->getBlocksCount ()))
+        {
+          fBlockSize = 0;
+          unlock ();
+
+          errno = EINVAL;
+          return -1;
+        }
+
+      fSegmentBlocks = segmentBlocks;
+      fSegmentsCount = segmentsCount;
+      std::size_t blocks = segmentBlocks * segmentsCount;
+
+      fOwners = new Owner[blocks];
+      std::memset (fOwners, 0, blocks * sizeof(Owner));
+      fNext = new std::uint32_t[blocks];
+      fLiveBits = new std::uint32_t[(blocks + 31) / 32];
+      std::memset (fLiveBits, 0, ((blocks + 31) / 32) * sizeof(std::uint32_t));
+      std::size_t buckets = 1;
+      while (buckets < blocks / 2)
+        {
+          buckets <<= 1;
+        }
+      fBuckets = new std::uint32_t[buckets];
+      for (std::size_t i = 0; i < buckets; ++i)
+        {
+          fBuckets[i] = noBlock;
+        }
+      fBucketsMask = buckets - 1;
+      fSegments = new Segment[segmentsCount];
+      fPending = new std::uint8_t[fPayloadSize];
+      fPendingIno = 0;
+      fPendingDirty = false;
+
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          Object* object = &fObjects[i];
+          std::memset (object, 0, sizeof(*object));
+          object->header = noBlock;
+        }
+
+      fFreeSegments = 0;
+      fHead = noSegment;
+      fVictim = noSegment;
+      fLive = 0;
+      fMoved = 0;
+      fSequence = 0;
+
+      // The sequence of each block, only while scanning.
+      auto* sequences = new std::uint64_t[blocks];
+      int ret = 0;
+      std::uint32_t maxErases = 0;
+      for (std::size_t s = 0; (s < segmentsCount) && (ret == 0); ++s)
+        {
+          Segment* segment = &fSegments[s];
+          auto base = static_cast<blockNumber_t> (s * segmentBlocks);
+          segment->live = 0;
+          segment->state = segmentFull;
+
+          if ((ret = readBlock (base)) < 0)
+            {
+              break;
+            }
+          if (!checkSegmentHeader (fBuffer))
+            {
+              // Interrupted erase, do it again.
+              segment->erases = ~0u;
+              segment->used = static_cast<std::uint32_t> (segmentBlocks);
+              continue;
+            }
+          segment->erases = get32 (&fBuffer[16]);
+          if (segment->erases > maxErases)
+            {
+              maxErases = segment->erases;
+            }
+
+          std::size_t i;
+          for (i = 1; i < segmentBlocks; ++i)
+            {
+              auto block = static_cast<blockNumber_t> (base + i);
+              if ((ret = readBlock (block)) < 0)
+                {
+                  break;
+                }
+              if (!checkBlock ())
+                {
+                  // The end of the log in this segment, possibly a
+                  // block cut by a power loss.
+                  break;
+                }
+
+              const std::uint8_t* tag = fBuffer + fPayloadSize;
+              std::uint32_t ino = get32 (&tag[4]);
+              std::uint32_t chunk = get32 (&tag[8]);
+              std::uint64_t sequence = get32 (&tag[16])
+                  | (static_cast<std::uint64_t> (get32 (&tag[20])) << 32);
+              sequences[block] = sequence;
+              if (sequence >= fSequence)
+                {
+                  fSequence = sequence + 1;
+                }
+
+              Object* object = objectOf (ino);
+              if (object == nullptr)
+                {
+                  continue;
+                }
+              fOwners[block].ino = ino;
+              fOwners[block].chunk = chunk;
+              ++object->blocks;
+
+              blockNumber_t previous = findBlock (ino, chunk);
+              if ((previous != noBlock) && (sequences[previous] > sequence))
+                {
+                  // An older copy.
+                  continue;
+                }
+
+              if (previous != noBlock)
+                {
+                  killBlock (previous);
+                }
+              std::size_t bucket = bucketOf (ino, chunk, fBucketsMask);
+              fNext[block] = fBuckets[bucket];
+              fBuckets[bucket] = block;
+              fLiveBits[block / 32] |= (1u << (block % 32));
+              ++segment->live;
+              ++fLive;
+
+              if (chunk == 0)
+                {
+                  std::size_t len = fBuffer[1];
+                  if (len > OS_INTEGER_FLASHFS_NAME_MAX)
+                    {
+                      len = OS_INTEGER_FLASHFS_NAME_MAX;
+                    }
+                  object->type = fBuffer[0];
+                  object->mode = static_cast<std::uint16_t> (fBuffer[2]
+                      | (fBuffer[3] << 8));
+                  object->parent = get32 (&fBuffer[4]);
+                  object->size = get32 (&fBuffer[8]);
+                  object->mtime = static_cast<std::time_t> (get32 (&fBuffer[12]));
+                  object->replaced = get32 (&fBuffer[16]);
+                  std::memcpy (object->name, &fBuffer[headerName], len);
+                  object->name[len] = '\0';
+                  object->header = block;
+                }
+            }
+
+          segment->used = static_cast<std::uint32_t> (i);
+          if ((i == 1) && (ret == 0) && isErased (fBuffer, fBlockSize))
+            {
+              // Only the header, the rest is erased.
+              segment->state = segmentFree;
+              ++fFreeSegments;
+            }
+        }
+
+      if (ret == 0)
+        {
+          // A rename that replaced an object is complete even if the
+          // removal of the replaced object was not written.
+          for (std::size_t i = 0; i < fObjectsCount; ++i)
+            {
+              Object* object = &fObjects[i];
+              // The number of a replaced object is not reused while
+              // a header names it, so this is the replaced one.
+              Object* victim = objectOf (object->replaced);
+              if ((object->header != noBlock) && (victim != nullptr)
+                  && (victim->header != noBlock)
+                  && (victim->type != typeDeleted))
+                {
+                  victim->type = typeDeleted;
+                  victim->dirty = true;
+                }
+            }
+
+          for (std::size_t i = 0; i < fObjectsCount; ++i)
+            {
+              Object* object = &fObjects[i];
+              if ((object->blocks != 0) && (object->header == noBlock))
+                {
+                  // Chunks without a header.
+                  object->type = typeDeleted;
+                }
+              if (object->type != typeFile)
+                {
+                  object->size = 0;
+                }
+            }
+
+          // Drop the chunks beyond the committed sizes, and those of
+          // the removed objects.
+          for (std::size_t block = 0; block < blocks; ++block)
+            {
+              auto b = static_cast<blockNumber_t> (block);
+              if (isLive (b) && (fOwners[b].chunk != 0))
+                {
+                  Object* object = objectOf (fOwners[b].ino);
+                  if ((object->type != typeFile)
+                      || (fOwners[b].chunk > chunksOf (object->size)))
+                    {
+                      killBlock (b);
+                    }
+                }
+            }
+        }
+      delete[] sequences;
+
+      // Complete the interrupted erases.
+      for (std::size_t s = 0; (s < segmentsCount) && (ret == 0); ++s)
+        {
+          if (fSegments[s].erases == ~0u)
+            {
+              fSegments[s].erases = maxErases;
+              ret = eraseSegment (s);
+            }
+        }
+
+      for (std::size_t i = 0; (i < fObjectsCount) && (ret == 0); ++i)
+        {
+          Object* object = &fObjects[i];
+          if (object->type == typeDeleted)
+            {
+              if (object->dirty)
+                {
+                  ret = writeHeader (inoOf (object));
+                }
+              reclaim (inoOf (object));
+            }
+        }
+
+      if (ret < 0)
+        {
+          fSegmentsCount = 0;
+          fBlockSize = 0;
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    FlashFileSystem::do_unmount (unsigned int flags)
+    {
+      lock ();
+      int ret = syncAll ();
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    int
+    FlashFileSystem::format (BlockDevice* device, std::size_t segmentBlocks)
+    {
+      assert(device != nullptr);
+
+      std::size_t blockSize = device->getBlockSize ();
+      if (segmentBlocks == 0)
+        {
+          segmentBlocks = device->getAlignment ();
+          if (segmentBlocks <= 1)
+            {
+              segmentBlocks = OS_INTEGER_FLASHFS_SEGMENT_BLOCKS;
+            }
+        }
+      std::size_t segmentsCount = device->getBlocksCount () / segmentBlocks;
+      if ((blockSize < 128) || (segmentBlocks < 2)
+          || (segmentsCount < reserveSegments + 2))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* buf = new std::uint8_t[blockSize];
+      int ret = 0;
+      for (std::size_t s = 0; (s < segmentsCount) && (ret == 0); ++s)
+        {
+          auto base = static_cast<BlockDevice::blockNumber_t> (s
+              * segmentBlocks);
+          if ((device->discard (base, segmentBlocks) < 0) && (errno != ENOSYS))
+            {
+              ret = -1;
+              break;
+            }
+          makeSegmentHeader (buf, blockSize, segmentBlocks, segmentsCount, 0);
+          if (device->write (buf, base, 1) != 1)
+            {
+              ret = -1;
+            }
+        }
+      delete[] buf;
+
+      if ((ret == 0) && (device->flush () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    FlashFileSystem::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    FlashFileSystem::unlock (void)
+    {
+      fLock.clear (std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+
+    FlashFileSystem::Object*
+    FlashFileSystem::objectOf (std::uint32_t ino)
+    {
+      if ((ino < firstIno) || (ino - firstIno >= fObjectsCount))
+        {
+          return nullptr;
+        }
+      return &fObjects[ino - firstIno];
+    }
+
+    std::uint32_t
+    FlashFileSystem::inoOf (const Object* object) const
+    {
+      return static_cast<std::uint32_t> (object - fObjects) + firstIno;
+    }
+
+    std::uint32_t
+    FlashFileSystem::lookup (std::uint32_t dir, const char* name,
+                             std::size_t len)
+    {
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          const Object* object = &fObjects[i];
+          if (((object->type == typeFile) || (object->type == typeDirectory))
+              && (object->parent == dir)
+              && (std::strncmp (object->name, name, len) == 0)
+              && (object->name[len] == '\0'))
+            {
+              return inoOf (object);
+            }
+        }
+      return 0;
+    }
+
+    int
+    FlashFileSystem::resolve (const char* path, std::uint32_t* dir,
+                              const char** name, std::size_t* len)
+    {
+      std::uint32_t current = rootIno;
+      for (;;)
+        {
+          while (*path == '/')
+            {
+              ++path;
+            }
+          const char* end = path;
+          while ((*end != '\0') && (*end != '/'))
+            {
+              ++end;
+            }
+          auto n = static_cast<std::size_t> (end - path);
+          if (n > OS_INTEGER_FLASHFS_NAME_MAX)
+            {
+              errno = ENAMETOOLONG;
+              return -1;
+            }
+
+          const char* next = end;
+          while (*next == '/')
+            {
+              ++next;
+            }
+          if (*next == '\0')
+            {
+              *dir = current;
+              *name = path;
+              *len = n;
+              return 0;
+            }
+
+          std::uint32_t ino = lookup (current, path, n);
+          if (ino == 0)
+            {
+              errno = ENOENT;
+              return -1;
+            }
+          if (objectOf (ino)->type != typeDirectory)
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          current = ino;
+          path = next;
+        }
+    }
+
+    std::uint32_t
+    FlashFileSystem::find (const char* path)
+    {
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      if (resolve (path, &dir, &name, &len) < 0)
+        {
+          return 0;
+        }
+      if (len == 0)
+        {
+          return rootIno;
+        }
+      std::uint32_t ino = lookup (dir, name, len);
+      if (ino == 0)
+        {
+          errno = ENOENT;
+        }
+      return ino;
+    }
+
+    std::uint32_t
+    FlashFileSystem::create (std::uint32_t dir, const char* name,
+                             std::size_t len, std::uint8_t type, mode_t mode)
+    {
+      Object* object = nullptr;
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          if (fObjects[i].type == typeNone)
+            {
+              object = &fObjects[i];
+              break;
+            }
+        }
+      if (object == nullptr)
+        {
+          // All taken, possibly by removed objects waiting for the
+          // garbage collector, which may not run on a device with
+          // plenty of free segments.
+          object = purge ();
+          if (object == nullptr)
+            {
+              return 0;
+            }
+        }
+
+      // Rewrite the header naming this number as replaced by a
+      // rename, otherwise the new object would be removed at mount.
+      int ret = 0;
+      for (std::size_t j = 0; (j < fObjectsCount) && (ret == 0); ++j)
+        {
+          if ((fObjects[j].replaced == inoOf (object))
+              && (fObjects[j].type != typeNone))
+            {
+              ret = writeHeader (inoOf (&fObjects[j]));
+            }
+        }
+      if (ret < 0)
+        {
+          return 0;
+        }
+
+      object->type = type;
+      object->mode = static_cast<std::uint16_t> (mode & permissionBits);
+      object->parent = dir;
+      object->size = 0;
+      object->mtime = std::time (nullptr);
+      object->opens = 0;
+      std::memcpy (object->name, name, len);
+      object->name[len] = '\0';
+
+      std::uint32_t ino = inoOf (object);
+      if (writeHeader (ino) < 0)
+        {
+          object->type = (object->blocks != 0) ? typeDeleted : typeNone;
+          return 0;
+        }
+      return ino;
+    }
+
+    int
+    FlashFileSystem::remove (std::uint32_t ino)
+    {
+      Object* object = objectOf (ino);
+      std::uint8_t type = object->type;
+
+      if (fPendingIno == ino)
+        {
+          fPendingIno = 0;
+          fPendingDirty = false;
+        }
+
+      // The removal must be on the device before the chunks can be
+      // erased, otherwise older copies could come back.
+      object->type = typeDeleted;
+      if (writeHeader (ino) < 0)
+        {
+          object->type = type;
+          return -1;
+        }
+
+      for (std::uint32_t chunk = 1; chunk <= chunksOf (object->size); ++chunk)
+        {
+          blockNumber_t block = findBlock (ino, chunk);
+          if (block != noBlock)
+            {
+              killBlock (block);
+            }
+        }
+      object->size = 0;
+
+      reclaim (ino);
+      return 0;
+    }
+
+    bool
+    FlashFileSystem::hasChildren (std::uint32_t dir)
+    {
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          const Object* object = &fObjects[i];
+          if (((object->type == typeFile) || (object->type == typeDirectory))
+              && (object->parent == dir))
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+
+    bool
+    FlashFileSystem::isDirectoryOpen (std::uint32_t dir)
+    {
+      auto* pool = getDirsPool ();
+      for (std::size_t i = 0; i < pool->getSize (); ++i)
+        {
+          if (!pool->getFlag (i))
+            {
+              continue;
+            }
+          auto* d = static_cast<FlashDirectory*> (pool->getObject (i));
+          if ((d->getFileSystem () == this) && (d->fIno == dir))
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+
+    void
+    FlashFileSystem::fillStat (std::uint32_t ino, struct stat* buf)
+    {
+      std::memset (buf, 0, sizeof(*buf));
+      buf->st_ino = static_cast<ino_t> (ino);
+      buf->st_nlink = 1;
+      buf->st_blksize = static_cast<blksize_t> (fPayloadSize);
+
+      const Object* object = objectOf (ino);
+      if (object == nullptr)
+        {
+          buf->st_mode = S_IFDIR | 0777;
+          return;
+        }
+
+      buf->st_mode = ((object->type == typeDirectory) ? S_IFDIR : S_IFREG)
+          | (object->mode & permissionBits);
+      buf->st_size = static_cast<off_t> (object->size);
+      buf->st_blocks = static_cast<blkcnt_t> (chunksOf (object->size)
+          * fBlockSize / 512);
+      buf->st_atime = buf->st_mtime = buf->st_ctime = object->mtime;
+    }
+
+    int
+    FlashFileSystem::removeFrom (const char* path, bool directory)
+    {
+      std::uint32_t ino = find (path);
+      if (ino == 0)
+        {
+          return -1;
+        }
+      if (ino == rootIno)
+        {
+          errno = directory ? EBUSY : EISDIR;
+          return -1;
+        }
+
+      const Object* object = objectOf (ino);
+      if (object->type == typeDirectory)
+        {
+          if (!directory)
+            {
+              errno = EISDIR;
+              return -1;
+            }
+          if (hasChildren (ino))
+            {
+              errno = ENOTEMPTY;
+              return -1;
+            }
+          if (isDirectoryOpen (ino))
+            {
+              errno = EBUSY;
+              return -1;
+            }
+        }
+      else
+        {
+          if (directory)
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if (object->opens != 0)
+            {
+              errno = EBUSY;
+              return -1;
+            }
+        }
+
+      int ret = remove (ino);
+      if (ret == 0)
+        {
+          collectStep ();
+        }
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    FlashFileSystem::chunksOf (std::size_t size) const
+    {
+      return (size + fPayloadSize - 1) / fPayloadSize;
+    }
+
+    int
+    FlashFileSystem::loadPending (std::uint32_t ino, std::uint32_t chunk)
+    {
+      if ((fPendingIno == ino) && (fPendingChunk == chunk))
+        {
+          return 0;
+        }
+      if (flushPending () < 0)
+        {
+          return -1;
+        }
+
+      fPendingIno = 0;
+      blockNumber_t block = findBlock (ino, chunk + 1);
+      if (block == noBlock)
+        {
+          std::memset (fPending, 0, fPayloadSize);
+        }
+      else
+        {
+          if (readBlock (block) < 0)
+            {
+              return -1;
+            }
+          std::memcpy (fPending, fBuffer, fPayloadSize);
+        }
+      fPendingIno = ino;
+      fPendingChunk = chunk;
+      return 0;
+    }
+
+    int
+    FlashFileSystem::flushPending (void)
+    {
+      if (!fPendingDirty)
+        {
+          return 0;
+        }
+
+      // Keep a segment for the headers, such that files can still be
+      // removed when the data fills the device.
+      if ((findBlock (fPendingIno, fPendingChunk + 1) == noBlock)
+          && (fLive + 1
+              > (fSegmentsCount - reserveSegments - 1) * (fSegmentBlocks - 1)))
+        {
+          errno = ENOSPC;
+          return -1;
+        }
+
+      blockNumber_t block;
+      if (allocateBlock (false, &block) < 0)
+        {
+          return -1;
+        }
+      std::memcpy (fBuffer, fPending, fPayloadSize);
+      if (writeBlock (block, fPendingIno, fPendingChunk + 1) < 0)
+        {
+          return -1;
+        }
+      fPendingDirty = false;
+      return 0;
+    }
+
+    int
+    FlashFileSystem::readChunk (std::uint32_t ino, std::uint32_t chunk,
+                                std::size_t offset, void* buf,
+                                std::size_t nbyte)
+    {
+      if ((fPendingIno == ino) && (fPendingChunk == chunk))
+        {
+          std::memcpy (buf, fPending + offset, nbyte);
+          return 0;
+        }
+
+      blockNumber_t block = findBlock (ino, chunk + 1);
+      if (block == noBlock)
+        {
+          // Never written.
+          std::memset (buf, 0, nbyte);
+          return 0;
+        }
+      if (readBlock (block) < 0)
+        {
+          return -1;
+        }
+      std::memcpy (buf, fBuffer + offset, nbyte);
+      return 0;
+    }
+
+    int
+    FlashFileSystem::writeChunk (std::uint32_t ino, std::uint32_t chunk,
+                                 std::size_t offset, const void* buf,
+                                 std::size_t nbyte)
+    {
+      if ((nbyte == fPayloadSize)
+          && ((fPendingIno != ino) || (fPendingChunk != chunk)))
+        {
+          // Entirely replaced, no need to read it.
+          if (flushPending () < 0)
+            {
+              return -1;
+            }
+          fPendingIno = ino;
+          fPendingChunk = chunk;
+        }
+      else if (loadPending (ino, chunk) < 0)
+        {
+          return -1;
+        }
+
+      if (buf != nullptr)
+        {
+          std::memcpy (fPending + offset, buf, nbyte);
+        }
+      else
+        {
+          std::memset (fPending + offset, 0, nbyte);
+        }
+      fPendingDirty = true;
+      return 0;
+    }
+
+    int
+    FlashFileSystem::resize (std::uint32_t ino, std::size_t size)
+    {
+      if (size > 0xFFFFFFFFu)
+        {
+          errno = EFBIG;
+          return -1;
+        }
+
+      Object* object = objectOf (ino);
+      std::size_t old = object->size;
+      std::size_t oldChunks = chunksOf (old);
+      std::size_t newChunks = chunksOf (size);
+
+      if (size > old)
+        {
+          // Write the new chunks, such that no older copy of them can
+          // come back at mount.
+          for (std::size_t k = oldChunks; k < newChunks; ++k)
+            {
+              if (writeChunk (ino, static_cast<std::uint32_t> (k), 0, nullptr,
+                              fPayloadSize) < 0)
+                {
+                  return -1;
+                }
+              object->size = static_cast<std::uint32_t> (
+                  ((k + 1) * fPayloadSize < size) ?
+                      (k + 1) * fPayloadSize : size);
+            }
+          object->size = static_cast<std::uint32_t> (size);
+        }
+      else if (size < old)
+        {
+          if ((size % fPayloadSize) != 0)
+            {
+              // The end of the last chunk must read as zeros.
+              std::size_t offset = size % fPayloadSize;
+              if (writeChunk (ino, static_cast<std::uint32_t> (newChunks - 1),
+                              offset, nullptr, fPayloadSize - offset) < 0)
+                {
+                  return -1;
+                }
+            }
+          if ((fPendingIno == ino) && (fPendingChunk >= newChunks))
+            {
+              fPendingIno = 0;
+              fPendingDirty = false;
+            }
+
+          // The new size must be on the device before the chunks can
+          // be erased.
+          object->size = static_cast<std::uint32_t> (size);
+          object->mtime = std::time (nullptr);
+          if (writeHeader (ino) < 0)
+            {
+              object->size = static_cast<std::uint32_t> (old);
+              return -1;
+            }
+          for (std::size_t k = newChunks; k < oldChunks; ++k)
+            {
+              blockNumber_t block = findBlock (
+                  ino, static_cast<std::uint32_t> (k + 1));
+              if (block != noBlock)
+                {
+                  killBlock (block);
+                }
+            }
+        }
+
+      object->mtime = std::time (nullptr);
+      object->dirty = true;
+      return 0;
+    }
+
+    int
+    FlashFileSystem::writeHeader (std::uint32_t ino, std::uint32_t replaced)
+    {
+      if ((fPendingIno == ino) && (flushPending () < 0))
+        {
+          return -1;
+        }
+
+      blockNumber_t block;
+      if (allocateBlock (false, &block) < 0)
+        {
+          return -1;
+        }
+
+      Object* object = objectOf (ino);
+      std::size_t len = std::strlen (object->name);
+      std::memset (fBuffer, 0, fPayloadSize);
+      fBuffer[0] = object->type;
+      fBuffer[1] = static_cast<std::uint8_t> (len);
+      fBuffer[2] = static_cast<std::uint8_t> (object->mode);
+      fBuffer[3] = static_cast<std::uint8_t> (object->mode >> 8);
+      put32 (&fBuffer[4], object->parent);
+      put32 (&fBuffer[8], object->size);
+      put32 (&fBuffer[12], static_cast<std::uint32_t> (object->mtime));
+      put32 (&fBuffer[16], replaced);
+      std::memcpy (&fBuffer[headerName], object->name, len);
+
+      if (writeBlock (block, ino, 0) < 0)
+        {
+          return -1;
+        }
+      object->replaced = replaced;
+      object->dirty = false;
+      return 0;
+    }
+
+    int
+    FlashFileSystem::commit (std::uint32_t ino)
+    {
+      if ((fPendingIno == ino) && (flushPending () < 0))
+        {
+          return -1;
+        }
+      if (objectOf (ino)->dirty)
+        {
+          return writeHeader (ino);
+        }
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FlashFileSystem::allocateBlock (bool moving, blockNumber_t* block)
+    {
+      for (;;)
+        {
+          if (fHead != noSegment)
+            {
+              Segment* segment = &fSegments[fHead];
+              if (segment->used < fSegmentBlocks)
+                {
+                  *block = static_cast<blockNumber_t> (fHead * fSegmentBlocks
+                      + segment->used++);
+                  return 0;
+                }
+              segment->state = segmentFull;
+              fHead = noSegment;
+            }
+
+          // The garbage collector can also use the reserve.
+          if (fFreeSegments > (moving ? 0 : reserveSegments))
+            {
+              // The least erased one.
+              std::size_t best = noSegment;
+              for (std::size_t s = 0; s < fSegmentsCount; ++s)
+                {
+                  if ((fSegments[s].state == segmentFree)
+                      && ((best == noSegment)
+                          || (fSegments[s].erases < fSegments[best].erases)))
+                    {
+                      best = s;
+                    }
+                }
+              fSegments[best].state = segmentHead;
+              --fFreeSegments;
+              fHead = best;
+              continue;
+            }
+
+          if (moving)
+            {
+              errno = ENOSPC;
+              return -1;
+            }
+
+          // Out of space, complete a collection.
+          if (collect (~static_cast<std::size_t> (0)) < 0)
+            {
+              return -1;
+            }
+        }
+    }
+
+    int
+    FlashFileSystem::writeBlock (blockNumber_t block, std::uint32_t ino,
+                                 std::uint32_t chunk)
+    {
+      std::uint8_t* tag = fBuffer + fPayloadSize;
+      std::memset (tag, 0, tagSize);
+      put32 (&tag[0], blockMagic);
+      put32 (&tag[4], ino);
+      put32 (&tag[8], chunk);
+      put32 (&tag[16], static_cast<std::uint32_t> (fSequence));
+      put32 (&tag[20], static_cast<std::uint32_t> (fSequence >> 32));
+      put32 (&tag[tagCrc], crc32 (fBuffer, fPayloadSize + tagCrc));
+      ++fSequence;
+
+      // Even if the write fails, the block is used.
+      fOwners[block].ino = ino;
+      fOwners[block].chunk = chunk;
+      ++objectOf (ino)->blocks;
+
+      if (getBlockDevice ()->write (fBuffer, block, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+
+      mapBlock (block, ino, chunk);
+      return 0;
+    }
+
+    int
+    FlashFileSystem::readBlock (blockNumber_t block)
+    {
+      if (getBlockDevice ()->read (fBuffer, block, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+      return 0;
+    }
+
+    bool
+    FlashFileSystem::checkBlock (void) const
+    {
+      const std::uint8_t* tag = fBuffer + fPayloadSize;
+      return (get32 (&tag[0]) == blockMagic)
+          && (get32 (&tag[tagCrc]) == crc32 (fBuffer, fPayloadSize + tagCrc));
+    }
+
+    FlashFileSystem::blockNumber_t
+    FlashFileSystem::findBlock (std::uint32_t ino, std::uint32_t chunk) const
+    {
+      for (blockNumber_t block = fBuckets[bucketOf (ino, chunk, fBucketsMask)];
+          block != noBlock; block = fNext[block])
+        {
+          if ((fOwners[block].ino == ino) && (fOwners[block].chunk == chunk))
+            {
+              return block;
+            }
+        }
+      return noBlock;
+    }
+
+    void
+    FlashFileSystem::mapBlock (blockNumber_t block, std::uint32_t ino,
+                               std::uint32_t chunk)
+    {
+      blockNumber_t previous = findBlock (ino, chunk);
+      if (previous != noBlock)
+        {
+          killBlock (previous);
+        }
+
+      std::size_t bucket = bucketOf (ino, chunk, fBucketsMask);
+      fNext[block] = fBuckets[bucket];
+      fBuckets[bucket] = block;
+      fLiveBits[block / 32] |= (1u << (block % 32));
+      ++fSegments[block / fSegmentBlocks].live;
+      ++fLive;
+
+      if (chunk == 0)
+        {
+          objectOf (ino)->header = block;
+        }
+    }
+
+    void
+    FlashFileSystem::killBlock (blockNumber_t block)
+    {
+      const Owner* owner = &fOwners[block];
+      std::uint32_t* link = &fBuckets[bucketOf (owner->ino, owner->chunk,
+                                                fBucketsMask)];
+      while (*link != block)
+        {
+          link = &fNext[*link];
+        }
+      *link = fNext[block];
+
+      fLiveBits[block / 32] &= ~(1u << (block % 32));
+      --fSegments[block / fSegmentBlocks].live;
+      --fLive;
+    }
+
+    bool
+    FlashFileSystem::isLive (blockNumber_t block) const
+    {
+      return (fLiveBits[block / 32] & (1u << (block % 32))) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FlashFileSystem::eraseSegment (std::size_t segment)
+    {
+      auto* device = getBlockDevice ();
+      Segment* seg = &fSegments[segment];
+      auto base = static_cast<blockNumber_t> (segment * fSegmentBlocks);
+
+      if ((device->discard (base, fSegmentBlocks) < 0) && (errno != ENOSYS))
+        {
+          return -1;
+        }
+      makeSegmentHeader (fBuffer, fBlockSize, fSegmentBlocks, fSegmentsCount,
+                         seg->erases + 1);
+      if (device->write (fBuffer, base, 1) != 1)
+        {
+          if (errno == 0)
+            {
+              errno = EIO;
+            }
+          return -1;
+        }
+
+      bool removed = false;
+      for (std::size_t i = 1; i < fSegmentBlocks; ++i)
+        {
+          Owner* owner = &fOwners[base + i];
+          Object* object = objectOf (owner->ino);
+          if (object != nullptr)
+            {
+              --object->blocks;
+              removed = removed || (object->type == typeDeleted);
+            }
+          owner->ino = 0;
+          owner->chunk = 0;
+        }
+
+      if (seg->state == segmentHead)
+        {
+          fHead = noSegment;
+        }
+      ++seg->erases;
+      seg->used = 1;
+      seg->live = 0;
+      if (seg->state != segmentFree)
+        {
+          seg->state = segmentFree;
+          ++fFreeSegments;
+        }
+
+      if (removed)
+        {
+          for (std::size_t i = 0; i < fObjectsCount; ++i)
+            {
+              if (fObjects[i].type == typeDeleted)
+                {
+                  reclaim (inoOf (&fObjects[i]));
+                }
+            }
+        }
+      return 0;
+    }
+
+    void
+    FlashFileSystem::reclaim (std::uint32_t ino)
+    {
+      Object* object = objectOf (ino);
+      if ((object->blocks == 1) && (object->header != noBlock)
+          && isLive (object->header))
+        {
+          // Only the removal record is left, nothing to hide any more.
+          killBlock (object->header);
+        }
+      if (object->blocks == 0)
+        {
+          object->type = typeNone;
+          object->header = noBlock;
+          object->dirty = false;
+        }
+    }
+
+    FlashFileSystem::Object*
+    FlashFileSystem::purge (void)
+    {
+      std::size_t blocks = fSegmentBlocks * fSegmentsCount;
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          Object* object = &fObjects[i];
+          std::uint32_t ino = inoOf (object);
+          while (object->type == typeDeleted)
+            {
+              // A collection in progress is completed first.
+              if (fVictim == noSegment)
+                {
+                  // The removal record is erased last, once it is no
+                  // longer live, otherwise it would only be moved.
+                  for (std::size_t block = 0; block < blocks; ++block)
+                    {
+                      auto b = static_cast<blockNumber_t> (block);
+                      if (fOwners[b].ino == ino)
+                        {
+                          fVictim = block / fSegmentBlocks;
+                          if ((b != object->header) || !isLive (b))
+                            {
+                              break;
+                            }
+                        }
+                    }
+                  if (fVictim == noSegment)
+                    {
+                      errno = ENOSPC;
+                      return nullptr;
+                    }
+                  if (fVictim == fHead)
+                    {
+                      fSegments[fHead].state = segmentFull;
+                      fHead = noSegment;
+                    }
+                  fVictimCursor = 1;
+                }
+              if (collect (~static_cast<std::size_t> (0)) < 0)
+                {
+                  return nullptr;
+                }
+            }
+          if (object->type == typeNone)
+            {
+              return object;
+            }
+        }
+
+      errno = ENOSPC;
+      return nullptr;
+    }
+
+    std::size_t
+    FlashFileSystem::chooseVictim (void)
+    {
+      std::size_t usable = fSegmentBlocks - 1;
+      std::size_t best = noSegment;
+      std::size_t coldest = noSegment;
+      std::uint32_t maxErases = 0;
+      for (std::size_t s = 0; s < fSegmentsCount; ++s)
+        {
+          const Segment* seg = &fSegments[s];
+          if (seg->erases > maxErases)
+            {
+              maxErases = seg->erases;
+            }
+          if (seg->state != segmentFull)
+            {
+              continue;
+            }
+          if ((coldest == noSegment)
+              || (seg->erases < fSegments[coldest].erases))
+            {
+              coldest = s;
+            }
+          if ((seg->live < usable)
+              && ((best == noSegment) || (seg->live < fSegments[best].live)
+                  || ((seg->live == fSegments[best].live)
+                      && (seg->erases < fSegments[best].erases))))
+            {
+              best = s;
+            }
+        }
+
+      // Static wear leveling: move the content of a segment left
+      // behind, if there is room for all of it.
+      if ((coldest != noSegment) && (fFreeSegments > reserveSegments)
+          && (fSegments[coldest].erases + OS_INTEGER_FLASHFS_WEAR_DELTA
+              < maxErases))
+        {
+          return coldest;
+        }
+      return best;
+    }
+
+    int
+    FlashFileSystem::collect (std::size_t count)
+    {
+      if (fVictim == noSegment)
+        {
+          fVictim = chooseVictim ();
+          if (fVictim == noSegment)
+            {
+              errno = ENOSPC;
+              return -1;
+            }
+          fVictimCursor = 1;
+        }
+
+      Segment* seg = &fSegments[fVictim];
+      auto base = static_cast<blockNumber_t> (fVictim * fSegmentBlocks);
+      while ((fVictimCursor < seg->used) && (count > 0))
+        {
+          auto block = static_cast<blockNumber_t> (base + fVictimCursor);
+          if (!isLive (block))
+            {
+              ++fVictimCursor;
+              continue;
+            }
+
+          blockNumber_t moved;
+          if ((readBlock (block) < 0) || (allocateBlock (true, &moved) < 0))
+            {
+              return -1;
+            }
+          if (writeBlock (moved, fOwners[block].ino, fOwners[block].chunk) < 0)
+            {
+              return -1;
+            }
+          ++fMoved;
+          ++fVictimCursor;
+          --count;
+        }
+
+      if (fVictimCursor < seg->used)
+        {
+          return 0;
+        }
+
+      std::size_t victim = fVictim;
+      fVictim = noSegment;
+      if (eraseSegment (victim) < 0)
+        {
+          return -1;
+        }
+      return 1;
+    }
+
+    int
+    FlashFileSystem::collectStep (void)
+    {
+      if (fFreeSegments > reserveSegments + 1)
+        {
+          return 0;
+        }
+
+      // Do not take the reserve for a step, it must be enough for the
+      // writers to complete the collection when they need it.
+      std::size_t count = OS_INTEGER_FLASHFS_GC_STEP;
+      std::size_t room =
+          (fHead != noSegment) ? fSegmentBlocks - fSegments[fHead].used : 0;
+      if ((fFreeSegments <= reserveSegments) && (room < count))
+        {
+          count = room;
+        }
+      return collect (count);
+    }
+
+    int
+    FlashFileSystem::syncAll (void)
+    {
+      if (fSegmentsCount == 0)
+        {
+          return 0;
+        }
+
+      int ret = flushPending ();
+      for (std::size_t i = 0; i < fObjectsCount; ++i)
+        {
+          Object* object = &fObjects[i];
+          if (object->dirty && (writeHeader (inoOf (object)) < 0))
+            {
+              ret = -1;
+            }
+        }
+      return ret;
+    }
+
+    // ========================================================================
+
+    FlashFile::FlashFile ()
+    {
+      fIno = 0;
+      fOffset = 0;
+      fFlags = 0;
+    }
+
+    FlashFile::~FlashFile ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    FlashFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+
+      std::uint32_t dir;
+      const char* name;
+      std::size_t len;
+      std::uint32_t ino = 0;
+      int ret = fs->resolve (path, &dir, &name, &len);
+      if (ret < 0)
+        {
+          ;
+        }
+      else if (len == 0)
+        {
+          errno = EISDIR;
+          ret = -1;
+        }
+      else if ((ino = fs->lookup (dir, name, len)) == 0)
+        {
+          if ((oflag & O_CREAT) != 0)
+            {
+              auto mode = static_cast<mode_t> (va_arg(args, int));
+              ino = fs->create (dir, name, len, typeFile, mode);
+              ret = (ino != 0) ? 0 : -1;
+            }
+          else
+            {
+              errno = ENOENT;
+              ret = -1;
+            }
+        }
+      else if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+        {
+          errno = EEXIST;
+          ret = -1;
+        }
+      else if (fs->objectOf (ino)->type != typeFile)
+        {
+          errno = EISDIR;
+          ret = -1;
+        }
+      else if (((oflag & O_TRUNC) != 0) && ((oflag & O_ACCMODE) != O_RDONLY))
+        {
+          ret = fs->resize (ino, 0);
+        }
+
+      if (ret == 0)
+        {
+          ++fs->objectOf (ino)->opens;
+          fIno = ino;
+          fOffset = 0;
+          fFlags = oflag;
+        }
+
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FlashFile::do_close (void)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      int ret = 0;
+      if ((fFlags & O_ACCMODE) != O_RDONLY)
+        {
+          ret = fs->commit (fIno);
+        }
+      --fs->objectOf (fIno)->opens;
+      fs->unlock ();
+      return ret;
+    }
+
+    ssize_t
+    FlashFile::do_read (void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_WRONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      std::size_t size = fs->objectOf (fIno)->size;
+      std::size_t done = 0;
+      if (static_cast<std::size_t> (fOffset) < size)
+        {
+          if (nbyte > size - static_cast<std::size_t> (fOffset))
+            {
+              nbyte = size - static_cast<std::size_t> (fOffset);
+            }
+          while (done < nbyte)
+            {
+              std::size_t at = static_cast<std::size_t> (fOffset) + done;
+              std::size_t offset = at % fs->fPayloadSize;
+              std::size_t n = fs->fPayloadSize - offset;
+              if (n > nbyte - done)
+                {
+                  n = nbyte - done;
+                }
+              if (fs->readChunk (
+                  fIno, static_cast<std::uint32_t> (at / fs->fPayloadSize),
+                  offset, static_cast<std::uint8_t*> (buf) + done, n) < 0)
+                {
+                  break;
+                }
+              done += n;
+            }
+        }
+      fOffset += static_cast<off_t> (done);
+      fs->unlock ();
+
+      if ((done == 0) && (nbyte != 0))
+        {
+          return -1;
+        }
+      return static_cast<ssize_t> (done);
+    }
+
+    ssize_t
+    FlashFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      if (nbyte == 0)
+        {
+          return 0;
+        }
+
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      auto* object = fs->objectOf (fIno);
+      if ((fFlags & O_APPEND) != 0)
+        {
+          fOffset = static_cast<off_t> (object->size);
+        }
+
+      auto offset = static_cast<std::uint64_t> (fOffset);
+      if (offset + nbyte > 0xFFFFFFFFu)
+        {
+          if (offset >= 0xFFFFFFFFu)
+            {
+              fs->unlock ();
+
+              errno = EFBIG;
+              return -1;
+            }
+          nbyte = static_cast<std::size_t> (0xFFFFFFFFu - offset);
+        }
+
+      std::size_t done = 0;
+      if ((offset <= object->size)
+          || (fs->resize (fIno, static_cast<std::size_t> (offset)) == 0))
+        {
+          while (done < nbyte)
+            {
+              std::size_t at = static_cast<std::size_t> (offset) + done;
+              std::size_t in = at % fs->fPayloadSize;
+              std::size_t n = fs->fPayloadSize - in;
+              if (n > nbyte - done)
+                {
+                  n = nbyte - done;
+                }
+              if (fs->writeChunk (
+                  fIno, static_cast<std::uint32_t> (at / fs->fPayloadSize), in,
+                  static_cast<const std::uint8_t*> (buf) + done, n) < 0)
+                {
+                  break;
+                }
+              done += n;
+              if (at + n > object->size)
+                {
+                  object->size = static_cast<std::uint32_t> (at + n);
+                }
+            }
+        }
+
+      if (done != 0)
+        {
+          object->mtime = std::time (nullptr);
+          object->dirty = true;
+          fOffset += static_cast<off_t> (done);
+          fs->collectStep ();
+        }
+      fs->unlock ();
+
+      if (done == 0)
+        {
+          return -1;
+        }
+      return static_cast<ssize_t> (done);
+    }
+
+    off_t
+    FlashFile::do_lseek (off_t offset, int whence)
+    {
+      off_t base;
+      switch (whence)
+        {
+        case SEEK_SET:
+          base = 0;
+          break;
+
+        case SEEK_CUR:
+          base = fOffset;
+          break;
+
+        case SEEK_END:
+          {
+            auto* fs = getFlashFileSystem ();
+
+            fs->lock ();
+            base = static_cast<off_t> (fs->objectOf (fIno)->size);
+            fs->unlock ();
+          }
+          break;
+
+        default:
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (base + offset < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      fOffset = base + offset;
+      return fOffset;
+    }
+
+    int
+    FlashFile::do_ftruncate (off_t length)
+    {
+      if (((fFlags & O_ACCMODE) == O_RDONLY) || (length < 0))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      int ret = fs->resize (fIno, static_cast<std::size_t> (length));
+      if (ret == 0)
+        {
+          fs->collectStep ();
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    FlashFile::do_fsync (void)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      int ret = fs->commit (fIno);
+      fs->unlock ();
+
+      if ((ret == 0) && (fs->getBlockDevice ()->flush () < 0))
+        {
+          ret = -1;
+        }
+      return ret;
+    }
+
+    int
+    FlashFile::do_fstat (struct stat* buf)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      fs->fillStat (fIno, buf);
+      fs->unlock ();
+      return 0;
+    }
+
+    void
+    FlashFile::do_release (void)
+    {
+      fIno = 0;
+      fOffset = 0;
+      fFlags = 0;
+
+      File::do_release ();
+    }
+
+    // ========================================================================
+
+    FlashDirectory::FlashDirectory ()
+    {
+      fIno = 0;
+      fCursor = 0;
+    }
+
+    FlashDirectory::~FlashDirectory ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    FlashDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      Directory* ret = nullptr;
+      std::uint32_t ino = fs->find (dirname);
+      if (ino == 0)
+        {
+          ;
+        }
+      else if ((ino != rootIno)
+          && (fs->objectOf (ino)->type != typeDirectory))
+        {
+          errno = ENOTDIR;
+        }
+      else
+        {
+          fIno = ino;
+          fCursor = 0;
+          ret = this;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    struct dirent*
+    FlashDirectory::do_read (void)
+    {
+      // The same, without the status.
+      return do_read_plus (nullptr);
+    }
+
+    struct dirent*
+    FlashDirectory::do_read_plus (struct stat* buf)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      struct dirent* ret = nullptr;
+      while (fCursor < fs->fObjectsCount)
+        {
+          const auto* object = &fs->fObjects[fCursor++];
+          if (((object->type == typeFile) || (object->type == typeDirectory))
+              && (object->parent == fIno))
+            {
+              ret = getDirEntry ();
+              ret->d_ino = static_cast<ino_t> (fs->inoOf (object));
+              std::strcpy (ret->d_name, object->name);
+              if (buf != nullptr)
+                {
+                  fs->fillStat (fs->inoOf (object), buf);
+                }
+              break;
+            }
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    ssize_t
+    FlashDirectory::do_read_batch (void* buf, std::size_t size)
+    {
+      auto* fs = getFlashFileSystem ();
+
+      fs->lock ();
+      auto* p = static_cast<char*> (buf);
+      std::size_t used = 0;
+      bool full = false;
+      for (; fCursor < fs->fObjectsCount; ++fCursor)
+        {
+          const auto* object = &fs->fObjects[fCursor];
+          if (((object->type == typeFile) || (object->type == typeDirectory))
+              && (object->parent == fIno))
+            {
+              std::size_t len = packEntry (
+                  p + used, size - used,
+                  static_cast<ino_t> (fs->inoOf (object)),
+                  (object->type == typeDirectory) ? DT_DIR : DT_REG,
+                  object->name);
+              if (len == 0)
+                {
+                  full = (used == 0);
+                  break;
+                }
+              used += len;
+            }
+        }
+      fs->unlock ();
+
+      if (full)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      return static_cast<ssize_t> (used);
+    }
+
+    void
+    FlashDirectory::do_rewind (void)
+    {
+      fCursor = 0;
+    }
+
+    void
+    FlashDirectory::do_release (void)
+    {
+      fIno = 0;
+      fCursor = 0;
+
+      Directory::do_release ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,294 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(__ARM_EABI__)
+
+#include "posix-io/HostFileBlockDevice.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    HostFileBlockDevice::HostFileBlockDevice (std::size_t blockSize)
+    {
+      fFileBlockSize = blockSize;
+      fFileDescriptor = -1;
+    }
+
+    HostFileBlockDevice::~HostFileBlockDevice ()
+    {
+      close ();
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    HostFileBlockDevice::open (const char* path, blockNumber_t blocksCount)
+    {
+      if (path == nullptr)
+        {
+          errno = EFAULT;
+          return -1;
+        }
+
+      if (fFileDescriptor >= 0)
+        {
+          errno = EBUSY;
+          return -1;
+        }
+
+      int fd = ::open (path, O_RDWR | O_CREAT, 0644);
+      if (fd < 0)
+        {
+          return -1;
+        }
+
+      struct stat st;
+      if (::fstat (fd, &st) < 0)
+        {
+          int err = errno;
+          ::close (fd);
+          errno = err;
+          return -1;
+        }
+
+      if (blocksCount != 0)
+        {
+          off_t size = static_cast<off_t> (blocksCount)
+              * static_cast<off_t> (fFileBlockSize);
+          if ((st.st_size < size) && (::ftruncate (fd, size) < 0))
+            {
+              int err = errno;
+              ::close (fd);
+              errno = err;
+              return -1;
+            }
+        }
+      else
+        {
+          blocksCount = static_cast<blockNumber_t> (
+              static_cast<std::size_t> (st.st_size) / fFileBlockSize);
+        }
+
+      fFileDescriptor = fd;
+      setGeometry (fFileBlockSize, blocksCount,
+                   static_cast<std::size_t> (st.st_blksize) / fFileBlockSize);
+
+      errno = 0;
+      return 0;
+    }
+
+    int
+    HostFileBlockDevice::close (void)
+    {
+      if (fFileDescriptor < 0)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      int ret = ::close (fFileDescriptor);
+      fFileDescriptor = -1;
+      setGeometry (fFileBlockSize, 0);
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    HostFileBlockDevice::do_read (void* buf, blockNumber_t block,
+                                  std::size_t count)
+    {
+      auto* p = static_cast<char*> (buf);
+      std::size_t remaining = count * fFileBlockSize;
+      off_t offset = static_cast<off_t> (block)
+          * static_cast<off_t> (fFileBlockSize);
+
+      while (remaining > 0)
+        {
+          ssize_t ret = ::pread (fFileDescriptor, p, remaining, offset);
+          if (ret < 0)
+            {
+              if (errno == EINTR)
+                {
+                  continue;
+                }
+              return -1;
+            }
+          if (ret == 0)
+            {
+              // Past the end of the file.
+              errno = EIO;
+              return -1;
+            }
+          p += ret;
+          offset += ret;
+          remaining -= static_cast<std::size_t> (ret);
+        }
+
+      return static_cast<ssize_t> (count);
+    }
+
+    ssize_t
+    HostFileBlockDevice::do_write (const void* buf, blockNumber_t block,
+                                   std::size_t count)
+    {
+      auto* p = static_cast<const char*> (buf);
+      std::size_t remaining = count * fFileBlockSize;
+      off_t offset = static_cast<off_t> (block)
+          * static_cast<off_t> (fFileBlockSize);
+
+      while (remaining > 0)
+        {
+          ssize_t ret = ::pwrite (fFileDescriptor, p, remaining, offset);
+          if (ret < 0)
+            {
+              if (errno == EINTR)
+                {
+                  continue;
+                }
+              return -1;
+            }
+          p += ret;
+          offset += ret;
+          remaining -= static_cast<std::size_t> (ret);
+        }
+
+      return static_cast<ssize_t> (count);
+    }
+
+#if defined(__linux__)
+
+    /**
+     * A single system call for all buffers; partial transfers are
+     * completed by the base class, buffer by buffer.
+     */
+    ssize_t
+    HostFileBlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                                   blockNumber_t block)
+    {
+      std::size_t total = 0;
+      for (int i = 0; i < iovcnt; ++i)
+        {
+          total += iov[i].iov_len;
+        }
+
+      ssize_t ret = ::preadv (
+          fFileDescriptor, iov, iovcnt,
+          static_cast<off_t> (block) * static_cast<off_t> (fFileBlockSize));
+      if ((ret >= 0) && (static_cast<std::size_t> (ret) == total))
+        {
+          return static_cast<ssize_t> (total / fFileBlockSize);
+        }
+      return BlockDevice::do_readv (iov, iovcnt, block);
+    }
+
+    ssize_t
+    HostFileBlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                                    blockNumber_t block)
+    {
+      std::size_t total = 0;
+      for (int i = 0; i < iovcnt; ++i)
+        {
+          total += iov[i].iov_len;
+        }
+
+      ssize_t ret = ::pwritev (
+          fFileDescriptor, iov, iovcnt,
+          static_cast<off_t> (block) * static_cast<off_t> (fFileBlockSize));
+      if ((ret >= 0) && (static_cast<std::size_t> (ret) == total))
+        {
+          return static_cast<ssize_t> (total / fFileBlockSize);
+        }
+      return BlockDevice::do_writev (iov, iovcnt, block);
+    }
+
+#else
+
+    ssize_t
+    HostFileBlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                                   blockNumber_t block)
+    {
+      return BlockDevice::do_readv (iov, iovcnt, block);
+    }
+
+    ssize_t
+    HostFileBlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                                    blockNumber_t block)
+    {
+      return BlockDevice::do_writev (iov, iovcnt, block);
+    }
+
+#endif /* defined(__linux__) */
+
+    int
+    HostFileBlockDevice::do_flush (void)
+    {
+#if defined(__linux__)
+      return ::fdatasync (fFileDescriptor);
+#else
+      return ::fsync (fFileDescriptor);
+#endif
+    }
+
+    int
+    HostFileBlockDevice::do_discard (blockNumber_t block, std::size_t count)
+    {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+      // Deallocate the blocks, they read back as zeros.
+      if (::fallocate (
+          fFileDescriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+          static_cast<off_t> (block) * static_cast<off_t> (fFileBlockSize),
+          static_cast<off_t> (count) * static_cast<off_t> (fFileBlockSize))
+          == 0)
+        {
+          return 0;
+        }
+      // Not supported by the host file system, ignore.
+      errno = 0;
+      return 0;
+#else
+      return BlockDevice::do_discard (block, count);
+#endif
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* !defined(__ARM_EABI__) */
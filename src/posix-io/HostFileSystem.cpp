@@ -0,0 +1,464 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(__ARM_EABI__)
+
+#include "posix-io/HostFileSystem.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <utime.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    /**
+     * The adjusted paths are absolute; the host calls use them
+     * relative to the root descriptor.
+     */
+    static const char*
+    relative (const char* path)
+    {
+      while (*path == '/')
+        {
+          ++path;
+        }
+      return (*path == '\0') ? "." : path;
+    }
+
+    static int
+    descriptorOf (Directory* dir)
+    {
+      return static_cast<HostDirectory*> (dir)->getDescriptor ();
+    }
+
+    // ------------------------------------------------------------------------
+
+    HostFileSystem::HostFileSystem (Pool* filesPool, Pool* dirsPool,
+                                    const char* root) :
+        FileSystem (filesPool, dirsPool)
+    {
+      assert(root != nullptr);
+
+      fRoot = root;
+      fRootDescriptor = -1;
+    }
+
+    HostFileSystem::~HostFileSystem ()
+    {
+      if (fRootDescriptor >= 0)
+        {
+          ::close (fRootDescriptor);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    HostFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      return ::fchmodat (fRootDescriptor, relative (path), mode, 0);
+    }
+
+    int
+    HostFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      return ::fstatat (fRootDescriptor, relative (path), buf, 0);
+    }
+
+    int
+    HostFileSystem::do_truncate (const char* path, off_t length)
+    {
+      int fd = ::openat (fRootDescriptor, relative (path),
+                         O_WRONLY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          return -1;
+        }
+
+      int ret = ::ftruncate (fd, length);
+
+      int err = errno;
+      ::close (fd);
+      errno = err;
+      return ret;
+    }
+
+    int
+    HostFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      return ::renameat (fRootDescriptor, relative (existing), fRootDescriptor,
+                         relative (_new));
+    }
+
+    int
+    HostFileSystem::do_unlink (const char* path)
+    {
+      return ::unlinkat (fRootDescriptor, relative (path), 0);
+    }
+
+    int
+    HostFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      if (times == nullptr)
+        {
+          return ::utimensat (fRootDescriptor, relative (path), nullptr, 0);
+        }
+
+      struct timespec ts[2];
+      ts[0].tv_sec = times->actime;
+      ts[0].tv_nsec = 0;
+      ts[1].tv_sec = times->modtime;
+      ts[1].tv_nsec = 0;
+      return ::utimensat (fRootDescriptor, relative (path), ts, 0);
+    }
+
+    int
+    HostFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      return ::mkdirat (fRootDescriptor, relative (path), mode);
+    }
+
+    int
+    HostFileSystem::do_rmdir (const char* path)
+    {
+      return ::unlinkat (fRootDescriptor, relative (path), AT_REMOVEDIR);
+    }
+
+    void
+    HostFileSystem::do_sync (void)
+    {
+      if (fRootDescriptor < 0)
+        {
+          return;
+        }
+
+#if defined(__linux__)
+      // Only the host file system of the directory.
+      ::syncfs (fRootDescriptor);
+#else
+      ::sync ();
+#endif
+    }
+
+    int
+    HostFileSystem::do_statat (Directory* dir, const char* path,
+                               struct stat* buf)
+    {
+      return ::fstatat (descriptorOf (dir), path, buf, 0);
+    }
+
+    int
+    HostFileSystem::do_mkdirat (Directory* dir, const char* path, mode_t mode)
+    {
+      return ::mkdirat (descriptorOf (dir), path, mode);
+    }
+
+    int
+    HostFileSystem::do_unlinkat (Directory* dir, const char* path, int flag)
+    {
+      return ::unlinkat (descriptorOf (dir), path,
+                         ((flag & AT_REMOVEDIR) != 0) ? AT_REMOVEDIR : 0);
+    }
+
+    int
+    HostFileSystem::do_renameat (Directory* olddir, const char* existing,
+                                 Directory* newdir, const char* _new)
+    {
+      return ::renameat (descriptorOf (olddir), existing, descriptorOf (newdir),
+                         _new);
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    HostFileSystem::do_mount (unsigned int flags)
+    {
+      int fd = ::open (fRoot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          return -1;
+        }
+
+      if (fRootDescriptor >= 0)
+        {
+          ::close (fRootDescriptor);
+        }
+      fRootDescriptor = fd;
+
+      setBlockDevice (&fDevice);
+      return 0;
+    }
+
+    int
+    HostFileSystem::do_unmount (unsigned int flags)
+    {
+      if (fRootDescriptor >= 0)
+        {
+          ::close (fRootDescriptor);
+          fRootDescriptor = -1;
+        }
+      return 0;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    HostFile::HostFile ()
+    {
+      fDescriptor = -1;
+    }
+
+    HostFile::~HostFile ()
+    {
+      if (fDescriptor >= 0)
+        {
+          ::close (fDescriptor);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    HostFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = static_cast<HostFileSystem*> (getFileSystem ());
+      return openRelative (fs->fRootDescriptor, relative (path), oflag, args);
+    }
+
+    int
+    HostFile::do_vopenat (Directory* dir, const char* path, int oflag,
+                          std::va_list args)
+    {
+      return openRelative (descriptorOf (dir), path, oflag, args);
+    }
+
+    int
+    HostFile::do_close (void)
+    {
+      int ret = ::close (fDescriptor);
+      fDescriptor = -1;
+      return ret;
+    }
+
+    ssize_t
+    HostFile::do_read (void* buf, std::size_t nbyte)
+    {
+      return ::read (fDescriptor, buf, nbyte);
+    }
+
+    ssize_t
+    HostFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      return ::write (fDescriptor, buf, nbyte);
+    }
+
+    ssize_t
+    HostFile::do_writev (const struct iovec* iov, int iovcnt)
+    {
+      return ::writev (fDescriptor, iov, iovcnt);
+    }
+
+    off_t
+    HostFile::do_lseek (off_t offset, int whence)
+    {
+      return ::lseek (fDescriptor, offset, whence);
+    }
+
+    int
+    HostFile::do_ftruncate (off_t length)
+    {
+      return ::ftruncate (fDescriptor, length);
+    }
+
+    int
+    HostFile::do_fsync (void)
+    {
+      return ::fsync (fDescriptor);
+    }
+
+    int
+    HostFile::do_fallocate (int mode, off_t offset, off_t len)
+    {
+#if defined(__linux__)
+      return ::fallocate (fDescriptor, mode, offset, len);
+#else
+      if (mode != 0)
+        {
+          errno = EOPNOTSUPP;
+          return -1;
+        }
+      int err = ::posix_fallocate (fDescriptor, offset, len);
+      if (err != 0)
+        {
+          errno = err;
+          return -1;
+        }
+      return 0;
+#endif
+    }
+
+    int
+    HostFile::do_fstat (struct stat* buf)
+    {
+      return ::fstat (fDescriptor, buf);
+    }
+
+    void
+    HostFile::do_readahead (off_t offset, std::size_t length)
+    {
+      // The host reads ahead by itself; pass explicit requests.
+      ::posix_fadvise (fDescriptor, offset, static_cast<off_t> (length),
+                       POSIX_FADV_WILLNEED);
+    }
+
+    int
+    HostFile::openRelative (int dirfd, const char* path, int oflag,
+                            std::va_list args)
+    {
+      mode_t mode = 0;
+      if ((oflag & O_CREAT) != 0)
+        {
+          mode = static_cast<mode_t> (va_arg(args, int));
+        }
+
+      fDescriptor = ::openat (dirfd, path, oflag | O_CLOEXEC, mode);
+      return (fDescriptor < 0) ? -1 : 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    HostDirectory::HostDirectory ()
+    {
+      fStream = nullptr;
+    }
+
+    HostDirectory::~HostDirectory ()
+    {
+      if (fStream != nullptr)
+        {
+          ::closedir (fStream);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    HostDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getHostFileSystem ();
+
+      int fd = ::openat (fs->fRootDescriptor, relative (dirname),
+                         O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          return nullptr;
+        }
+
+      fStream = ::fdopendir (fd);
+      if (fStream == nullptr)
+        {
+          int err = errno;
+          ::close (fd);
+          errno = err;
+          return nullptr;
+        }
+      return this;
+    }
+
+    struct dirent*
+    HostDirectory::do_read (void)
+    {
+      struct dirent* entry;
+      do
+        {
+          entry = ::readdir (fStream);
+          if (entry == nullptr)
+            {
+              return nullptr;
+            }
+        }
+      // Like the other file systems, do not list `.` and `..`.
+      while ((std::strcmp (entry->d_name, ".") == 0)
+          || (std::strcmp (entry->d_name, "..") == 0));
+
+      auto* const ret = getDirEntry ();
+      ret->d_ino = entry->d_ino;
+      std::strncpy (ret->d_name, entry->d_name, sizeof(ret->d_name) - 1);
+      ret->d_name[sizeof(ret->d_name) - 1] = '\0';
+      return ret;
+    }
+
+    void
+    HostDirectory::do_rewind (void)
+    {
+      ::rewinddir (fStream);
+    }
+
+    int
+    HostDirectory::do_close (void)
+    {
+      int ret = ::closedir (fStream);
+      fStream = nullptr;
+      return ret;
+    }
+
+    void
+    HostDirectory::do_release (void)
+    {
+      // If the open failed.
+      fStream = nullptr;
+
+      Directory::do_release ();
+    }
+
+    int
+    HostDirectory::getDescriptor (void) const
+    {
+      return ::dirfd (fStream);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
+
+#endif /* !defined(__ARM_EABI__) */
@@ -29,17 +29,21 @@
 #include "posix-io/IO.h"
 #include "posix-io/CharDevice.h"
 #include "posix-io/CharDevicesRegistry.h"
+#include "posix-io/Directory.h"
 #include "posix-io/File.h"
 #include "posix-io/FileSystem.h"
 #include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
 #include "posix-io/Pool.h"
 #include "posix-io/NetStack.h"
+#include "posix-io/path.h"
 
 #include "posix/sys/uio.h"
 
 #include <cassert>
 #include <cerrno>
 #include <cstdarg>
+#include <fcntl.h>
 
 // ----------------------------------------------------------------------------
 
@@ -85,8 +89,36 @@ namespace os
           return nullptr;
         }
 
+      // Make the path absolute and normalized, once for all layers.
+      char normalized[OS_INTEGER_PATH_MAX];
+      path = normalizePath (path, normalized, sizeof(normalized));
+      if (path == nullptr)
+        {
+          return nullptr;
+        }
+
       errno = 0;
 
+#if defined(O_DIRECTORY)
+      if ((oflag & O_DIRECTORY) != 0)
+        {
+          // A directory descriptor, for the *at() functions.
+          auto* const dir = opendir (path);
+          if (dir == nullptr)
+            {
+              return nullptr;
+            }
+          if (dir->dirfd () < 0)
+            {
+              int err = errno;
+              dir->close ();
+              errno = err;
+              return nullptr;
+            }
+          return dir;
+        }
+#endif
+
       // First check if path is a device.
       os::posix::IO* io = os::posix::CharDevicesRegistry::identifyDevice (path);
       if (io != nullptr)
@@ -102,9 +134,19 @@ namespace os
         }
       else
         {
-          auto adjusted_path = path;
-          auto* const fs = os::posix::MountManager::identifyFileSystem (
-              &adjusted_path);
+          const char* adjusted_path;
+          FileSystem* fs;
+          void* node;
+          std::uint32_t generation;
+          if ((PathCache::resolve (path, &fs, &adjusted_path, &node,
+                                   &generation)
+              == PathCache::NOT_FOUND) && ((oflag & O_CREAT) == 0))
+            {
+              // Known not to exist, and not to be created.
+              fs->release ();
+              errno = ENOENT;
+              return nullptr;
+            }
 
           // The manager will return null if there are no file systems
           // registered, no need to check this condition separately.
@@ -116,7 +158,18 @@ namespace os
 
           // Use the file system implementation to open the file, using
           // the adjusted path (mount point prefix removed).
-          io = fs->open (adjusted_path, oflag, args);
+          io = fs->open (adjusted_path, oflag, args, node);
+          if ((io != nullptr) && ((oflag & O_CREAT) != 0))
+            {
+              // Possibly created, and remembered as missing, also by
+              // other threads.
+              generation = PathCache::invalidate (path);
+            }
+          PathCache::update (
+              path, fs, adjusted_path,
+              (io != nullptr) ? static_cast<File*> (io)->getNode () : nullptr,
+              (io != nullptr) ? 0 : -1, generation);
+          fs->release ();
           if (io == nullptr)
             {
               // Open failed.
@@ -129,6 +182,100 @@ namespace os
       return io->allocFileDescriptor ();
     }
 
+    IO*
+    openat (int fildes, const char* path, int oflag, ...)
+    {
+      // Forward to the variadic version of the function.
+      std::va_list args;
+      va_start(args, oflag);
+      IO* const ret = vopenat (fildes, path, oflag, args);
+      va_end(args);
+
+      return ret;
+    }
+
+    /**
+     * If `path` is relative to a directory descriptor, the file is
+     * opened by the directory's file system, without identifying the
+     * file system and walking the path again.
+     */
+    IO*
+    vopenat (int fildes, const char* path, int oflag, std::va_list args)
+    {
+      if (path == nullptr)
+        {
+          errno = EFAULT;
+          return nullptr;
+        }
+
+      if (*path == '\0')
+        {
+          errno = ENOENT;
+          return nullptr;
+        }
+
+      Directory* dir;
+      char joined[OS_INTEGER_PATH_MAX];
+      path = resolveAtPath (fildes, path, &dir, joined, sizeof(joined));
+      if (path == nullptr)
+        {
+          return nullptr;
+        }
+
+#if defined(O_DIRECTORY)
+      if ((dir != nullptr) && ((oflag & O_DIRECTORY) != 0))
+        {
+          // Directories are opened by absolute path.
+          path = joinPath (dir->getPath (), path, joined, sizeof(joined));
+          if (path == nullptr)
+            {
+              return nullptr;
+            }
+          dir = nullptr;
+        }
+#endif
+
+      if (dir == nullptr)
+        {
+          return vopen (path, oflag, args);
+        }
+
+      auto* const fs = dir->getFileSystem ();
+      if (!fs->acquire ())
+        {
+          errno = EBADF;
+          return nullptr;
+        }
+
+      errno = 0;
+
+      auto* const io = fs->openat (dir, path, oflag, args);
+      fs->release ();
+      if (io == nullptr)
+        {
+          // Open failed.
+          return nullptr;
+        }
+
+      if ((oflag & O_CREAT) != 0)
+        {
+          // Possibly remembered as missing.
+          if (joinPath (dir->getPath (), path, joined, sizeof(joined))
+              != nullptr)
+            {
+              PathCache::invalidate (joined);
+            }
+          else
+            {
+              PathCache::invalidate (fs);
+            }
+          errno = 0;
+        }
+
+      // If successful, allocate a file descriptor.
+      return io->allocFileDescriptor ();
+    }
+
     // ------------------------------------------------------------------------
 
     IO*
@@ -26,7 +26,9 @@
  */
 
 #include "posix-io/FileSystem.h"
+#include "posix-io/BlockDevice.h"
 #include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
 
 #include <cerrno>
 #include <cstring>
@@ -45,6 +47,23 @@ namespace os
     FileSystem** MountManager::sfFileSystemsArray;
     const char** MountManager::sfPathsArray;
 
+    std::atomic<MountManager::Table*> MountManager::sfTable;
+
+    std::atomic<unsigned int> MountManager::sfEpoch;
+    std::atomic<unsigned int> MountManager::sfReaders[2];
+
+    std::atomic_flag MountManager::sfWriterLock = ATOMIC_FLAG_INIT;
+
+    std::atomic<unsigned int> MountManager::sfGeneration;
+
+    // ------------------------------------------------------------------------
+
+    void __attribute__((weak))
+    schedulerYield (void)
+    {
+      return;
+    }
+
     // ------------------------------------------------------------------------
 
     MountManager::MountManager (std::size_t size)
@@ -60,10 +79,14 @@ namespace os
           sfFileSystemsArray[i] = nullptr;
           sfPathsArray[i] = nullptr;
         }
+
+      publish (buildTable ());
     }
 
     MountManager::~MountManager ()
     {
+      deleteTable (sfTable.exchange (nullptr));
+
       delete[] sfFileSystemsArray;
       delete[] sfPathsArray;
       sfSize = 0;
@@ -71,15 +94,249 @@ namespace os
 
     // ------------------------------------------------------------------------
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
-
     FileSystem*
     MountManager::identifyFileSystem (const char** path1, const char** path2)
     {
       assert(path1 != nullptr);
       assert(*path1 != nullptr);
 
+      auto reader = enterReader ();
+      auto* const fs = findFileSystem (sfTable.load (), path1, path2);
+      exitReader (reader);
+
+      return fs;
+    }
+
+    FileSystem*
+    MountManager::acquireFileSystem (const char** path1, const char** path2)
+    {
+      assert(path1 != nullptr);
+      assert(*path1 != nullptr);
+
+      auto reader = enterReader ();
+      auto* fs = findFileSystem (sfTable.load (), path1, path2);
+      if ((fs != nullptr) && !fs->acquire ())
+        {
+          // Being unmounted.
+          fs = nullptr;
+        }
+      exitReader (reader);
+
+      return fs;
+    }
+
+    FileSystem*
+    MountManager::acquireFileSystem (std::size_t index)
+    {
+      assert(index < sfSize);
+
+      auto reader = enterReader ();
+      auto* const table = sfTable.load ();
+      auto* fs = (table != nullptr) ? table->fileSystems[index] : nullptr;
+      if ((fs != nullptr) && !fs->acquire ())
+        {
+          fs = nullptr;
+        }
+      exitReader (reader);
+
+      return fs;
+    }
+
+    FileSystem*
+    MountManager::getRoot (void)
+    {
+      auto reader = enterReader ();
+      auto* const table = sfTable.load ();
+      auto* const fs = (table != nullptr) ? table->root : nullptr;
+      exitReader (reader);
+
+      return fs;
+    }
+
+    FileSystem*
+    MountManager::getFileSystem (std::size_t index)
+    {
+      assert(index < sfSize);
+
+      auto reader = enterReader ();
+      auto* const table = sfTable.load ();
+      auto* const fs = (table != nullptr) ? table->fileSystems[index] : nullptr;
+      exitReader (reader);
+
+      return fs;
+    }
+
+    const char*
+    MountManager::getPath (std::size_t index)
+    {
+      assert(index < sfSize);
+
+      auto reader = enterReader ();
+      auto* const table = sfTable.load ();
+      auto* const path = (table != nullptr) ? table->paths[index] : nullptr;
+      exitReader (reader);
+
+      return path;
+    }
+
+    /**
+     * Find the file system with the longest mount path that is a prefix
+     * of `*path1`. The prefix tree is walked once, one character at a
+     * time, remembering the last node that terminates a mount path;
+     * there is no strlen()/strncmp() per mount point.
+     */
+    FileSystem*
+    MountManager::findFileSystem (const Table* table, const char** path1,
+                                  const char** path2)
+    {
+      if (table == nullptr)
+        {
+          // No manager.
+          return nullptr;
+        }
+
+      const TrieNode* const trie = table->trie;
+
+      std::size_t matchIndex = 0;
+      std::size_t matchLen = 0;
+
+      std::size_t node = 0;
+      for (const char* p = *path1; *p != '\0'; ++p)
+        {
+          std::size_t child = trie[node].firstChild;
+          while ((child != 0) && (trie[child].ch != *p))
+            {
+              child = trie[child].nextSibling;
+            }
+
+          if (child == 0)
+            {
+              // No mount path continues with this character.
+              break;
+            }
+
+          node = child;
+          if (trie[node].mountIndex != 0)
+            {
+              matchIndex = trie[node].mountIndex;
+              matchLen = static_cast<std::size_t> (p - *path1) + 1;
+            }
+        }
+
+      if (matchIndex != 0)
+        {
+          // Adjust paths to skip over prefix, but keep '/'.
+          *path1 = (*path1 + matchLen - 1);
+          if ((path2 != nullptr) && (*path2 != nullptr))
+            {
+              *path2 = (*path2 + matchLen - 1);
+            }
+
+          return table->fileSystems[matchIndex - 1];
+        }
+
+      // If root file system defined, return it, otherwise nullptr.
+      return table->root;
+    }
+
+    /**
+     * Check if any file system is mounted below the normalized
+     * absolute folder `path`, i.e. if paths relative to the folder
+     * may cross into other file systems. The prefix tree is walked
+     * along `path`; any node below it belongs to a longer mount path.
+     */
+    bool
+    MountManager::hasMountsBelow (const char* path)
+    {
+      assert(path != nullptr);
+
+      auto reader = enterReader ();
+      auto* const table = sfTable.load ();
+      if (table == nullptr)
+        {
+          exitReader (reader);
+          return false;
+        }
+      const TrieNode* const trie = table->trie;
+
+      bool ret = false;
+      std::size_t node = 0;
+      for (const char* p = path;; ++p)
+        {
+          char ch = *p;
+          if (ch == '\0')
+            {
+              if ((p > path) && (p[-1] == '/'))
+                {
+                  ret = (trie[node].firstChild != 0);
+                  break;
+                }
+              // Match the folder itself, with the trailing separator.
+              ch = '/';
+            }
+
+          std::size_t child = trie[node].firstChild;
+          while ((child != 0) && (trie[child].ch != ch))
+            {
+              child = trie[child].nextSibling;
+            }
+
+          if (child == 0)
+            {
+              // No mount path continues with this character.
+              break;
+            }
+
+          node = child;
+          if (*p == '\0')
+            {
+              ret = (trie[node].firstChild != 0);
+              break;
+            }
+        }
+
+      exitReader (reader);
+      return ret;
+    }
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Copy the master mount table and compile all mount paths into a
+     * new prefix tree. Called only when the mount table changes, so
+     * the cost is not relevant.
+     */
+    MountManager::Table*
+    MountManager::buildTable (void)
+    {
+      auto* const table = new Table;
+
+      table->root = sfRoot;
+      table->fileSystems = new FileSystem*[sfSize];
+      table->paths = new const char*[sfSize];
+
+      // The tree cannot have more nodes than the total number of
+      // characters, plus the root node.
+      std::size_t count = 1;
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          table->fileSystems[i] = sfFileSystemsArray[i];
+          table->paths[i] = sfPathsArray[i];
+          if (sfPathsArray[i] != nullptr)
+            {
+              count += std::strlen (sfPathsArray[i]);
+            }
+        }
+
+      TrieNode* const trie = new TrieNode[count];
+      table->trie = trie;
+
+      trie[0].firstChild = 0;
+      trie[0].nextSibling = 0;
+      trie[0].mountIndex = 0;
+      trie[0].ch = '\0';
+      std::size_t trieSize = 1;
+
       for (std::size_t i = 0; i < sfSize; ++i)
         {
           if (sfPathsArray[i] == nullptr)
@@ -87,33 +344,116 @@ namespace os
               continue;
             }
 
-          auto len = std::strlen (sfPathsArray[i]);
-
-          // Check if path1 starts with the mounted path.
-          if (std::strncmp (sfPathsArray[i], *path1, len) == 0)
+          std::size_t node = 0;
+          for (const char* p = sfPathsArray[i]; *p != '\0'; ++p)
             {
-              // If so, adjust paths to skip over prefix, but keep '/'.
-              *path1 = (*path1 + len - 1);
-              if ((path2 != nullptr) && (*path2 != nullptr))
+              std::size_t child = trie[node].firstChild;
+              while ((child != 0) && (trie[child].ch != *p))
                 {
-                  *path2 = (*path2 + len - 1);
+                  child = trie[child].nextSibling;
                 }
 
-              return sfFileSystemsArray[i];
+              if (child == 0)
+                {
+                  // Add a new node as the first child.
+                  child = trieSize++;
+                  trie[child].firstChild = 0;
+                  trie[child].nextSibling = trie[node].firstChild;
+                  trie[child].mountIndex = 0;
+                  trie[child].ch = *p;
+                  trie[node].firstChild = child;
+                }
+              node = child;
             }
+
+          trie[node].mountIndex = i + 1;
+        }
+
+      return table;
+    }
+
+    void
+    MountManager::deleteTable (Table* table)
+    {
+      if (table != nullptr)
+        {
+          delete[] table->fileSystems;
+          delete[] table->paths;
+          delete[] table->trie;
+          delete table;
         }
+    }
+
+    /**
+     * Make the new table visible to the lookups, then wait for the
+     * lookups that might have seen the old table, and reclaim it.
+     */
+    void
+    MountManager::publish (Table* table)
+    {
+      auto* const old = sfTable.exchange (table);
+      ++sfGeneration;
 
-      // If root file system defined, return it.
-      if (sfRoot != nullptr)
+      if (old != nullptr)
         {
-          return sfRoot;
+          waitReaders ();
+          deleteTable (old);
         }
+    }
+
+    // ------------------------------------------------------------------------
 
-      // Not found.
-      return nullptr;
+    unsigned int
+    MountManager::enterReader (void)
+    {
+      // The table pointer must be loaded only after being counted.
+      unsigned int index = sfEpoch.load () & 1;
+      sfReaders[index].fetch_add (1);
+      return index;
     }
 
-#pragma GCC diagnostic pop
+    void
+    MountManager::exitReader (unsigned int index)
+    {
+      sfReaders[index].fetch_sub (1);
+    }
+
+    /**
+     * Wait for all readers that may have loaded the previous table.
+     * Each flip of the epoch directs new readers to the other counter,
+     * so the counter waited for can only decrease; after two flips
+     * both counters have been drained once. New readers, counted
+     * after the table was replaced, load the new table.
+     */
+    void
+    MountManager::waitReaders (void)
+    {
+      for (int i = 0; i < 2; ++i)
+        {
+          unsigned int index = sfEpoch.fetch_add (1) & 1;
+          while (sfReaders[index].load () != 0)
+            {
+              schedulerYield ();
+            }
+        }
+    }
+
+    void
+    MountManager::lockWriter (void)
+    {
+      while (sfWriterLock.test_and_set ())
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    MountManager::unlockWriter (void)
+    {
+      sfWriterLock.clear ();
+    }
+
+    // ------------------------------------------------------------------------
 
     int
     MountManager::setRoot (FileSystem* fs, BlockDevice* blockDevice,
@@ -122,10 +462,28 @@ namespace os
       assert(fs != nullptr);
       errno = 0;
 
-      sfRoot = fs;
+      lockWriter ();
 
       fs->setBlockDevice (blockDevice);
-      return fs->do_mount (flags);
+      int ret = fs->do_mount (flags);
+      if (ret < 0)
+        {
+          // For example no valid file system on the device.
+          fs->setBlockDevice (nullptr);
+          unlockWriter ();
+          return ret;
+        }
+      fs->setMounted (true);
+
+      sfRoot = fs;
+      publish (buildTable ());
+
+      unlockWriter ();
+
+      // All cached paths may now resolve differently.
+      PathCache::clear ();
+
+      return ret;
     }
 
     int
@@ -139,12 +497,16 @@ namespace os
 
       errno = 0;
 
+      lockWriter ();
+
       for (std::size_t i = 0; i < sfSize; ++i)
         {
           if (sfPathsArray[i] != nullptr)
             {
               if (std::strcmp (sfPathsArray[i], path) == 0)
                 {
+                  unlockWriter ();
+
                   // Folder already mounted.
                   errno = EBUSY;
                   return -1;
@@ -157,42 +519,93 @@ namespace os
           if (sfFileSystemsArray[i] == nullptr)
             {
               fs->setBlockDevice (blockDevice);
-              fs->do_mount (flags);
+              if (fs->do_mount (flags) < 0)
+                {
+                  fs->setBlockDevice (nullptr);
+                  unlockWriter ();
+                  return -1;
+                }
+              fs->setMounted (true);
 
               sfFileSystemsArray[i] = fs;
               sfPathsArray[i] = path;
 
+              publish (buildTable ());
+
+              unlockWriter ();
+
+              // Paths below the mount point no longer resolve to
+              // the parent file system.
+              PathCache::invalidatePrefix (path);
               return 0;
             }
         }
 
+      unlockWriter ();
+
       // The meaning is actually 'array size exceeded', but could
       // not find a better match.
       errno = ENOENT;
       return -1;
     }
 
+    /**
+     * The file system is first removed from the table, such that new
+     * operations no longer find it, then the operations in progress
+     * are allowed to complete, and only then it is synced and
+     * unmounted.
+     */
     int
     MountManager::umount (const char* path, unsigned int flags)
     {
       assert(path != nullptr);
       errno = 0;
 
+      lockWriter ();
+
       for (std::size_t i = 0; i < sfSize; ++i)
         {
           if (sfPathsArray[i] != nullptr && strcmp (path, sfPathsArray[i]) == 0)
             {
-              sfFileSystemsArray[i]->do_sync ();
-              sfFileSystemsArray[i]->do_unmount (flags);
-              sfFileSystemsArray[i]->setBlockDevice (nullptr);
+              auto* const fs = sfFileSystemsArray[i];
+
+              // Fail new acquire() calls, including those from
+              // lookups still using the old table.
+              fs->setMounted (false);
 
               sfFileSystemsArray[i] = nullptr;
               sfPathsArray[i] = nullptr;
 
+              publish (buildTable ());
+
+              unlockWriter ();
+
+              // Wait for the operations in progress.
+              while (fs->getInFlight () != 0)
+                {
+                  schedulerYield ();
+                }
+
+              PathCache::invalidate (fs);
+
+              fs->do_sync ();
+              fs->do_unmount (flags);
+
+              // Write the blocks left dirty in the cache, if any,
+              // including those written by do_unmount().
+              auto* blockDevice = fs->getBlockDevice ();
+              if (blockDevice != nullptr)
+                {
+                  blockDevice->flush ();
+                }
+              fs->setBlockDevice (nullptr);
+
               return 0;
             }
         }
 
+      unlockWriter ();
+
       // The requested directory is not in the mount table.
       errno = EINVAL;
       return -1;
@@ -0,0 +1,409 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "posix-io/NodeCache.h"
+
+#include <cassert>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the chains and lists.
+    static constexpr std::uint32_t noEntry = ~static_cast<std::uint32_t> (0);
+
+    // The cursor after the last node.
+    static constexpr std::size_t noCursor = ~static_cast<std::size_t> (0);
+
+    // ------------------------------------------------------------------------
+
+    NodeCache::NodeCache (std::size_t nodes)
+    {
+      assert(nodes > 0);
+      // The name chains link (node, name) pairs.
+      assert(nodes < noEntry / 2);
+
+      fNodes = new Node[nodes];
+      fSize = nodes;
+      fData = nullptr;
+      fStride = 0;
+
+      std::size_t buckets = 1;
+      while (buckets < nodes)
+        {
+          buckets <<= 1;
+        }
+      fBuckets = new std::uint32_t[2 * buckets];
+      fBucketsMask = static_cast<std::uint32_t> (buckets - 1);
+
+      fHits = 0;
+      fMisses = 0;
+
+      clear ();
+    }
+
+    NodeCache::~NodeCache ()
+    {
+      delete[] fData;
+      delete[] fBuckets;
+      delete[] fNodes;
+    }
+
+    // ------------------------------------------------------------------------
+
+    void
+    NodeCache::setDataSize (std::size_t size)
+    {
+      if (fData == nullptr)
+        {
+          // Aligned for any member of the node data.
+          fStride = (size + alignof(std::max_align_t) - 1)
+              / alignof(std::max_align_t) * alignof(std::max_align_t);
+          std::size_t words = (fSize * fStride + sizeof(std::max_align_t) - 1)
+              / sizeof(std::max_align_t);
+          fData = reinterpret_cast<std::uint8_t*> (new std::max_align_t[words]);
+        }
+      assert(size <= fStride);
+    }
+
+    bool
+    NodeCache::lookup (std::uint32_t dir, std::uint32_t hash,
+                       std::size_t* cursor, void** data)
+    {
+      if (*cursor == noCursor)
+        {
+          return false;
+        }
+
+      std::uint32_t slot =
+          (*cursor == 0) ? fBuckets[nameBucket (dir, hash)] :
+              static_cast<std::uint32_t> (*cursor - 1);
+      while (slot != noEntry)
+        {
+          Node* node = &fNodes[slot / 2];
+          std::uint32_t next = node->next[slot % 2];
+          if ((node->dir == dir) && (node->hash[slot % 2] == hash))
+            {
+              *data = fData + (slot / 2) * fStride;
+              *cursor = (next == noEntry) ? noCursor : next + 1u;
+              return true;
+            }
+          slot = next;
+        }
+
+      *cursor = noCursor;
+      return false;
+    }
+
+    void
+    NodeCache::use (void* data)
+    {
+      std::uint32_t index = indexOf (data);
+      unlinkLru (index);
+      linkMru (index);
+      ++fHits;
+    }
+
+    void*
+    NodeCache::find (ino_t id)
+    {
+      std::uint32_t index = findNode (id);
+      if (index == noEntry)
+        {
+          return nullptr;
+        }
+      return fData + index * fStride;
+    }
+
+    void*
+    NodeCache::add (ino_t id, std::uint32_t dir, std::uint32_t hash,
+                    std::uint32_t alias)
+    {
+      assert(fData != nullptr);
+
+      std::uint32_t index = findNode (id);
+      std::uint32_t refs = 0;
+      if (index != noEntry)
+        {
+          // Possibly under other names.
+          refs = fNodes[index].refs;
+          unlink (index);
+        }
+      else
+        {
+          // The least recently used node not referenced; the free
+          // nodes are the oldest.
+          index = fLru;
+          while ((index != noEntry) && (fNodes[index].refs != 0))
+            {
+              index = fNodes[index].newer;
+            }
+          if (index == noEntry)
+            {
+              return nullptr;
+            }
+          if (fNodes[index].used)
+            {
+              unlink (index);
+            }
+        }
+
+      Node* node = &fNodes[index];
+      node->id = id;
+      node->dir = dir;
+      node->hash[0] = hash;
+      node->hash[1] = alias;
+      node->refs = refs;
+      node->used = true;
+
+      std::uint32_t* head = &fBuckets[nameBucket (dir, hash)];
+      node->next[0] = *head;
+      *head = 2 * index;
+      if (alias != hash)
+        {
+          head = &fBuckets[nameBucket (dir, alias)];
+          node->next[1] = *head;
+          *head = 2 * index + 1;
+        }
+      else
+        {
+          node->next[1] = noEntry;
+        }
+      head = &fBuckets[idBucket (id)];
+      node->next[2] = *head;
+      *head = index;
+      ++fUsed;
+
+      unlinkLru (index);
+      linkMru (index);
+      ++fMisses;
+
+      return fData + index * fStride;
+    }
+
+    bool
+    NodeCache::acquire (ino_t id)
+    {
+      std::uint32_t index = findNode (id);
+      if (index == noEntry)
+        {
+          return false;
+        }
+      ++fNodes[index].refs;
+      return true;
+    }
+
+    void
+    NodeCache::release (ino_t id)
+    {
+      std::uint32_t index = findNode (id);
+      if ((index != noEntry) && (fNodes[index].refs > 0))
+        {
+          --fNodes[index].refs;
+        }
+    }
+
+    void
+    NodeCache::remove (ino_t id)
+    {
+      std::uint32_t index = findNode (id);
+      if (index == noEntry)
+        {
+          return;
+        }
+
+      unlink (index);
+      fNodes[index].refs = 0;
+
+      // To be the first reused.
+      if (index != fLru)
+        {
+          unlinkLru (index);
+          fNodes[index].older = noEntry;
+          fNodes[index].newer = fLru;
+          fNodes[fLru].older = index;
+          fLru = index;
+        }
+    }
+
+    void
+    NodeCache::drop (std::uint32_t dir)
+    {
+      for (std::size_t i = 0; i < fSize; ++i)
+        {
+          if (fNodes[i].used && (fNodes[i].dir == dir))
+            {
+              remove (fNodes[i].id);
+            }
+        }
+    }
+
+    void
+    NodeCache::clear (void)
+    {
+      for (std::uint32_t i = 0; i <= 2 * fBucketsMask + 1; ++i)
+        {
+          fBuckets[i] = noEntry;
+        }
+
+      // All nodes are free and linked in the LRU list.
+      auto size = static_cast<std::uint32_t> (fSize);
+      for (std::uint32_t i = 0; i < size; ++i)
+        {
+          fNodes[i].used = false;
+          fNodes[i].refs = 0;
+          fNodes[i].newer = (i > 0) ? i - 1 : noEntry;
+          fNodes[i].older = (i + 1 < size) ? i + 1 : noEntry;
+        }
+      fMru = 0;
+      fLru = size - 1;
+      fUsed = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::uint32_t
+    NodeCache::indexOf (const void* data) const
+    {
+      auto offset = static_cast<std::size_t> (static_cast<const std::uint8_t*> (
+          data) - fData);
+      assert(offset % fStride == 0);
+      return static_cast<std::uint32_t> (offset / fStride);
+    }
+
+    std::uint32_t
+    NodeCache::findNode (ino_t id) const
+    {
+      std::uint32_t index = fBuckets[idBucket (id)];
+      while ((index != noEntry) && (fNodes[index].id != id))
+        {
+          index = fNodes[index].next[2];
+        }
+      return index;
+    }
+
+    std::uint32_t
+    NodeCache::nameBucket (std::uint32_t dir, std::uint32_t hash) const
+    {
+      return (hash ^ (dir * 2654435761u)) & fBucketsMask;
+    }
+
+    std::uint32_t
+    NodeCache::idBucket (ino_t id) const
+    {
+      auto key = static_cast<std::uint64_t> (id);
+      auto hash = static_cast<std::uint32_t> (key ^ (key >> 32)) * 2654435761u;
+      return fBucketsMask + 1 + ((hash >> 8) & fBucketsMask);
+    }
+
+    /**
+     * Unlink the node from its chains; it remains in the LRU list.
+     */
+    void
+    NodeCache::unlink (std::uint32_t index)
+    {
+      Node* node = &fNodes[index];
+
+      for (std::uint32_t k = 0; k < 2; ++k)
+        {
+          if ((k == 1) && (node->hash[1] == node->hash[0]))
+            {
+              break;
+            }
+          std::uint32_t* link =
+              &fBuckets[nameBucket (node->dir, node->hash[k])];
+          while (*link != 2 * index + k)
+            {
+              assert(*link != noEntry);
+              link = &fNodes[*link / 2].next[*link % 2];
+            }
+          *link = node->next[k];
+        }
+
+      std::uint32_t* link = &fBuckets[idBucket (node->id)];
+      while (*link != index)
+        {
+          assert(*link != noEntry);
+          link = &fNodes[*link].next[2];
+        }
+      *link = node->next[2];
+
+      node->used = false;
+      --fUsed;
+    }
+
+    void
+    NodeCache::unlinkLru (std::uint32_t index)
+    {
+      Node* node = &fNodes[index];
+
+      if (node->newer != noEntry)
+        {
+          fNodes[node->newer].older = node->older;
+        }
+      else
+        {
+          fMru = node->older;
+        }
+
+      if (node->older != noEntry)
+        {
+          fNodes[node->older].newer = node->newer;
+        }
+      else
+        {
+          fLru = node->newer;
+        }
+    }
+
+    void
+    NodeCache::linkMru (std::uint32_t index)
+    {
+      Node* node = &fNodes[index];
+
+      node->newer = noEntry;
+      node->older = fMru;
+      if (fMru != noEntry)
+        {
+          fNodes[fMru].newer = index;
+        }
+      fMru = index;
+
+      if (fLru == noEntry)
+        {
+          fLru = index;
+        }
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
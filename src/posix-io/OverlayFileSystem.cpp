@@ -0,0 +1,1375 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/OverlayFileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // The prefix of the whiteouts, `.wh.<name>`, reserved.
+    static const char whiteoutPrefix[] = ".wh.";
+    static constexpr std::size_t whiteoutPrefixLength = sizeof(whiteoutPrefix)
+        - 1;
+
+    // The marker of the opaque directories.
+    static const char opaqueName[] = ".wh..wh..opq";
+
+    static constexpr mode_t permissionBits = 07777;
+
+    static inline bool
+    isReservedName (const char* name)
+    {
+      return std::strncmp (name, whiteoutPrefix, whiteoutPrefixLength) == 0;
+    }
+
+    static bool
+    isReservedPath (const char* path)
+    {
+      for (const char* p = path; *p != '\0'; ++p)
+        {
+          if (((p == path) || (p[-1] == '/')) && isReservedName (p))
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+
+    /**
+     * Copy the path without the trailing `/`, except for the root.
+     */
+    static const char*
+    trimPath (const char* path, char* buf, std::size_t size)
+    {
+      auto len = std::strlen (path);
+      while ((len > 1) && (path[len - 1] == '/'))
+        {
+          --len;
+        }
+      if (len == 0)
+        {
+          return "/";
+        }
+      if (len >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, path, len);
+      buf[len] = '\0';
+      return buf;
+    }
+
+    static const char*
+    joinName (const char* dir, const char* name, char* buf, std::size_t size)
+    {
+      auto dirlen = std::strlen (dir);
+      if ((dirlen == 1) && (dir[0] == '/'))
+        {
+          dirlen = 0;
+        }
+      auto namelen = std::strlen (name);
+      if (dirlen + 1 + namelen >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, dir, dirlen);
+      buf[dirlen] = '/';
+      std::memcpy (&buf[dirlen + 1], name, namelen + 1);
+      return buf;
+    }
+
+    static const char*
+    parentOf (const char* path, char* buf, std::size_t size)
+    {
+      const char* last = std::strrchr (path, '/');
+      if ((last == nullptr) || (last == path))
+        {
+          return "/";
+        }
+      auto len = static_cast<std::size_t> (last - path);
+      if (len >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, path, len);
+      buf[len] = '\0';
+      return buf;
+    }
+
+    /**
+     * The whiteout of `path`, `.wh.<name>` in the same directory.
+     */
+    static const char*
+    whiteoutOf (const char* path, char* buf, std::size_t size)
+    {
+      const char* last = std::strrchr (path, '/');
+      auto dirlen = (last == nullptr) ? 0 : static_cast<std::size_t> (last
+          - path + 1);
+      const char* name = &path[dirlen];
+      auto namelen = std::strlen (name);
+      if (dirlen + whiteoutPrefixLength + namelen >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, path, dirlen);
+      std::memcpy (&buf[dirlen], whiteoutPrefix, whiteoutPrefixLength);
+      std::memcpy (&buf[dirlen + whiteoutPrefixLength], name, namelen + 1);
+      return buf;
+    }
+
+    static File*
+    openIn (FileSystem* fs, const char* path, int oflag, ...)
+    {
+      std::va_list args;
+      va_start(args, oflag);
+      auto* const io = fs->open (path, oflag, args);
+      va_end(args);
+      return static_cast<File*> (io);
+    }
+
+    // ------------------------------------------------------------------------
+
+    OverlayFileSystem::OverlayFileSystem (Pool* filesPool, Pool* dirsPool,
+                                          FileSystem* lower,
+                                          FileSystem* upper) :
+        FileSystem (filesPool, dirsPool)
+    {
+      assert(lower != nullptr);
+      assert(upper != nullptr);
+      assert(lower != upper);
+
+      fLower = lower;
+      fUpper = upper;
+      fCopyUps = 0;
+      fChanged = false;
+
+      fLock.clear ();
+    }
+
+    OverlayFileSystem::~OverlayFileSystem ()
+    {
+      fLower = nullptr;
+      fUpper = nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    OverlayFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      int layer = locate (path, &st);
+      if (layer > 0)
+        {
+          fChanged = true;
+          if ((layer == UPPER) || (copyUp (path, &st, true) == 0))
+            {
+              ret = fUpper->chmod (path, mode);
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = (locate (path, buf) > 0) ? 0 : -1;
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_truncate (const char* path, off_t length)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      int layer = locate (path, &st);
+      if ((layer > 0) && S_ISDIR(st.st_mode))
+        {
+          errno = EISDIR;
+        }
+      else if (layer > 0)
+        {
+          fChanged = true;
+          if ((layer == UPPER) || (copyUp (path, &st, length > 0) == 0))
+            {
+              ret = fUpper->truncate (path, length);
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    /**
+     * A file of the lower file system is copied up and renamed in the
+     * upper one, and a whiteout hides the old name.
+     */
+    int
+    OverlayFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      char trimmed_existing[OS_INTEGER_PATH_MAX];
+      existing = trimPath (existing, trimmed_existing,
+                           sizeof(trimmed_existing));
+      char trimmed_new[OS_INTEGER_PATH_MAX];
+      _new = trimPath (_new, trimmed_new, sizeof(trimmed_new));
+      if ((existing == nullptr) || (_new == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      struct stat new_st;
+      char parent[OS_INTEGER_PATH_MAX];
+      char whiteout[OS_INTEGER_PATH_MAX];
+      int layer = locate (existing, &st);
+      int new_layer = -1;
+      if (layer < 0)
+        {
+          ;
+        }
+      else if (isReservedPath (_new))
+        {
+          errno = EINVAL;
+        }
+      else if (std::strcmp (existing, _new) == 0)
+        {
+          ret = 0;
+        }
+      else if (S_ISDIR(st.st_mode)
+          && ((layer == LOWER) || isMerged (existing)))
+        {
+          // The lower content would have to be moved too.
+          errno = EXDEV;
+        }
+      else if ((new_layer = locate (_new, &new_st)) > 0)
+        {
+          if (S_ISDIR(new_st.st_mode)
+              && ((new_layer == LOWER) || isMerged (_new)))
+            {
+              errno = EXDEV;
+            }
+          else
+            {
+              new_layer = 0;
+            }
+        }
+      else if (errno == ENOENT)
+        {
+          const char* dir = parentOf (_new, parent, sizeof(parent));
+          if ((dir != nullptr) && (locate (dir, &new_st) > 0))
+            {
+              if (S_ISDIR(new_st.st_mode))
+                {
+                  new_layer = 0;
+                }
+              else
+                {
+                  errno = ENOTDIR;
+                }
+            }
+        }
+
+      if ((layer > 0) && (ret < 0) && (new_layer == 0))
+        {
+          fChanged = true;
+          if (((layer == UPPER) || (copyUp (existing, &st, true) == 0))
+              && (copyUpParents (_new) == 0))
+            {
+              // A whiteout of the new name is replaced; for a directory
+              // the lower content stays hidden.
+              bool removed = isWhiteout (_new)
+                  && (fUpper->unlink (
+                      whiteoutOf (_new, whiteout, sizeof(whiteout))) == 0);
+
+              ret = fUpper->rename (existing, _new);
+              if (ret == 0)
+                {
+                  if (removed && S_ISDIR(st.st_mode)
+                      && (joinName (_new, opaqueName, whiteout,
+                                    sizeof(whiteout)) != nullptr))
+                    {
+                      ret = createMarker (whiteout);
+                    }
+                  if ((ret == 0) && inLower (existing, &st))
+                    {
+                      ret = createWhiteout (existing);
+                    }
+                }
+              else if (removed)
+                {
+                  int err = errno;
+                  createWhiteout (_new);
+                  errno = err;
+                }
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_unlink (const char* path)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      int layer = locate (path, &st);
+      if ((layer > 0) && S_ISDIR(st.st_mode))
+        {
+          errno = EISDIR;
+        }
+      else if (layer == UPPER)
+        {
+          fChanged = true;
+          ret = fUpper->unlink (path);
+          if ((ret == 0) && inLower (path, &st))
+            {
+              ret = createWhiteout (path);
+            }
+        }
+      else if (layer == LOWER)
+        {
+          fChanged = true;
+          if (copyUpParents (path) == 0)
+            {
+              ret = createWhiteout (path);
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      int layer = locate (path, &st);
+      if (layer > 0)
+        {
+          fChanged = true;
+          if ((layer == UPPER) || (copyUp (path, &st, true) == 0))
+            {
+              ret = fUpper->utime (path, times);
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      char parent[OS_INTEGER_PATH_MAX];
+      char marker[OS_INTEGER_PATH_MAX];
+      const char* dir;
+      if (locate (path, &st) > 0)
+        {
+          errno = EEXIST;
+        }
+      else if (errno != ENOENT)
+        {
+          ;
+        }
+      else if (isReservedPath (path))
+        {
+          errno = EINVAL;
+        }
+      else if (((dir = parentOf (path, parent, sizeof(parent))) != nullptr)
+          && (locate (dir, &st) > 0))
+        {
+          fChanged = true;
+          if (!S_ISDIR(st.st_mode))
+            {
+              errno = ENOTDIR;
+            }
+          else if (copyUpParents (path) == 0)
+            {
+              bool removed = isWhiteout (path)
+                  && (fUpper->unlink (
+                      whiteoutOf (path, marker, sizeof(marker))) == 0);
+
+              ret = fUpper->do_mkdir (path, mode);
+              if ((ret == 0) && removed)
+                {
+                  // Do not show the content of the removed directory.
+                  ret = createMarker (
+                      joinName (path, opaqueName, marker, sizeof(marker)));
+                }
+              else if (removed)
+                {
+                  int err = errno;
+                  createWhiteout (path);
+                  errno = err;
+                }
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::do_rmdir (const char* path)
+    {
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (enter () < 0))
+        {
+          return -1;
+        }
+
+      int ret = -1;
+      struct stat st;
+      int layer = locate (path, &st);
+      if (layer < 0)
+        {
+          ;
+        }
+      else if (!S_ISDIR(st.st_mode))
+        {
+          errno = ENOTDIR;
+        }
+      else if (path[1] == '\0')
+        {
+          errno = EBUSY;
+        }
+      else if (checkEmpty (path) == 0)
+        {
+          fChanged = true;
+          if (layer == UPPER)
+            {
+              if ((removeMarkers (path) == 0)
+                  && (fUpper->do_rmdir (path) == 0))
+                {
+                  ret = inLower (path, &st) ? createWhiteout (path) : 0;
+                }
+            }
+          else if (copyUpParents (path) == 0)
+            {
+              ret = createWhiteout (path);
+            }
+        }
+
+      leave ();
+      return ret;
+    }
+
+    void
+    OverlayFileSystem::do_sync (void)
+    {
+      if (enter () < 0)
+        {
+          return;
+        }
+
+      fUpper->do_sync ();
+
+      leave ();
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    OverlayFileSystem::do_mount (unsigned int flags)
+    {
+      if (!fLower->isMounted () || !fUpper->isMounted ())
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      // The file system functions require a device; the changes
+      // are written to this one.
+      setBlockDevice (fUpper->getBlockDevice ());
+      return 0;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    int
+    OverlayFileSystem::enter (void)
+    {
+      if (!fUpper->acquire ())
+        {
+          errno = EIO;
+          return -1;
+        }
+      if (!fLower->acquire ())
+        {
+          fUpper->release ();
+          errno = EIO;
+          return -1;
+        }
+
+      lock ();
+      return 0;
+    }
+
+    void
+    OverlayFileSystem::leave (void)
+    {
+      int err = errno;
+
+      if (fChanged)
+        {
+          // The nodes of the upper file system may have been removed.
+          PathCache::invalidate (fUpper);
+          fChanged = false;
+        }
+
+      unlock ();
+
+      fLower->release ();
+      fUpper->release ();
+
+      errno = err;
+    }
+
+    void
+    OverlayFileSystem::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    OverlayFileSystem::unlock (void)
+    {
+      fLock.clear (std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * A path found in the upper file system is not looked up in the
+     * lower one.
+     */
+    int
+    OverlayFileSystem::locate (const char* path, struct stat* buf)
+    {
+      if (isReservedPath (path))
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      if (fUpper->stat (path, buf) == 0)
+        {
+          return UPPER;
+        }
+      if (errno != ENOENT)
+        {
+          return -1;
+        }
+
+      if (checkParents (path) < 0)
+        {
+          return -1;
+        }
+      if (isWhiteout (path))
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      if (fLower->stat (path, buf) == 0)
+        {
+          return LOWER;
+        }
+      return -1;
+    }
+
+    /**
+     * The parents are checked from the root down, up to the first
+     * one not present in the upper file system, since nothing below
+     * it can be either.
+     */
+    int
+    OverlayFileSystem::checkParents (const char* path)
+    {
+      char prefix[OS_INTEGER_PATH_MAX];
+      char marker[OS_INTEGER_PATH_MAX];
+      struct stat st;
+
+      for (const char* p = std::strchr (path + 1, '/'); p != nullptr;
+          p = std::strchr (p + 1, '/'))
+        {
+          auto len = static_cast<std::size_t> (p - path);
+          std::memcpy (prefix, path, len);
+          prefix[len] = '\0';
+
+          if (fUpper->stat (prefix, &st) < 0)
+            {
+              if (isWhiteout (prefix))
+                {
+                  errno = ENOENT;
+                  return -1;
+                }
+              return 0;
+            }
+          if (!S_ISDIR(st.st_mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if ((joinName (prefix, opaqueName, marker, sizeof(marker))
+              != nullptr) && (fUpper->stat (marker, &st) == 0))
+            {
+              errno = ENOENT;
+              return -1;
+            }
+        }
+      return 0;
+    }
+
+    bool
+    OverlayFileSystem::inLower (const char* path, struct stat* buf)
+    {
+      return (checkParents (path) == 0) && (fLower->stat (path, buf) == 0);
+    }
+
+    bool
+    OverlayFileSystem::isMerged (const char* path)
+    {
+      char marker[OS_INTEGER_PATH_MAX];
+      struct stat st;
+      if ((joinName (path, opaqueName, marker, sizeof(marker)) == nullptr)
+          || (fUpper->stat (marker, &st) == 0))
+        {
+          return false;
+        }
+
+      return inLower (path, &st) && S_ISDIR(st.st_mode);
+    }
+
+    bool
+    OverlayFileSystem::isWhiteout (const char* path)
+    {
+      char whiteout[OS_INTEGER_PATH_MAX];
+      struct stat st;
+      return (path[1] != '\0')
+          && (whiteoutOf (path, whiteout, sizeof(whiteout)) != nullptr)
+          && (fUpper->stat (whiteout, &st) == 0);
+    }
+
+    int
+    OverlayFileSystem::createMarker (const char* name)
+    {
+      if (name == nullptr)
+        {
+          return -1;
+        }
+
+      auto* const file = openIn (fUpper, name, O_WRONLY | O_CREAT | O_TRUNC,
+                                 0);
+      if (file == nullptr)
+        {
+          return -1;
+        }
+      return file->close ();
+    }
+
+    int
+    OverlayFileSystem::createWhiteout (const char* path)
+    {
+      char whiteout[OS_INTEGER_PATH_MAX];
+      return createMarker (whiteoutOf (path, whiteout, sizeof(whiteout)));
+    }
+
+    int
+    OverlayFileSystem::copyUpParents (const char* path)
+    {
+      char prefix[OS_INTEGER_PATH_MAX];
+      struct stat st;
+
+      for (const char* p = std::strchr (path + 1, '/'); p != nullptr;
+          p = std::strchr (p + 1, '/'))
+        {
+          auto len = static_cast<std::size_t> (p - path);
+          std::memcpy (prefix, path, len);
+          prefix[len] = '\0';
+
+          if (fUpper->stat (prefix, &st) == 0)
+            {
+              if (!S_ISDIR(st.st_mode))
+                {
+                  errno = ENOTDIR;
+                  return -1;
+                }
+              continue;
+            }
+          if ((errno != ENOENT) || (fLower->stat (prefix, &st) < 0))
+            {
+              return -1;
+            }
+          if (!S_ISDIR(st.st_mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if (fUpper->do_mkdir (prefix, st.st_mode & permissionBits) < 0)
+            {
+              return -1;
+            }
+        }
+      return 0;
+    }
+
+    int
+    OverlayFileSystem::copyUp (const char* path, const struct stat* st,
+                               bool data)
+    {
+      if (copyUpParents (path) < 0)
+        {
+          return -1;
+        }
+
+      if (S_ISDIR(st->st_mode))
+        {
+          // The lower content stays visible through it.
+          return fUpper->do_mkdir (path, st->st_mode & permissionBits);
+        }
+
+      File* src = nullptr;
+      if (data)
+        {
+          src = openIn (fLower, path, O_RDONLY);
+          if (src == nullptr)
+            {
+              return -1;
+            }
+        }
+
+      auto* const dst = openIn (fUpper, path, O_WRONLY | O_CREAT | O_TRUNC,
+                                st->st_mode & permissionBits);
+      if (dst == nullptr)
+        {
+          if (src != nullptr)
+            {
+              int err = errno;
+              src->close ();
+              errno = err;
+            }
+          return -1;
+        }
+
+      int ret = 0;
+      if (src != nullptr)
+        {
+          char buf[256];
+          for (;;)
+            {
+              ssize_t n = src->read (buf, sizeof(buf));
+              if (n <= 0)
+                {
+                  ret = static_cast<int> (n);
+                  break;
+                }
+              ssize_t w = dst->write (buf, static_cast<std::size_t> (n));
+              if (w != n)
+                {
+                  if (w >= 0)
+                    {
+                      errno = ENOSPC;
+                    }
+                  ret = -1;
+                  break;
+                }
+            }
+
+          int err = errno;
+          src->close ();
+          errno = err;
+        }
+
+      if ((dst->close () < 0) && (ret == 0))
+        {
+          ret = -1;
+        }
+
+      if (ret == 0)
+        {
+          // Keep the original times, if the upper file system can.
+          struct utimbuf times;
+          times.actime = st->st_atime;
+          times.modtime = st->st_mtime;
+          fUpper->utime (path, &times);
+          ++fCopyUps;
+        }
+      else
+        {
+          int err = errno;
+          fUpper->unlink (path);
+          errno = err;
+        }
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::checkEmpty (const char* path)
+    {
+      Directory* upper;
+      Directory* lower;
+      if (openDirectory (path, &upper, &lower) < 0)
+        {
+          return -1;
+        }
+
+      int ret = 0;
+      struct dirent* entry;
+      if (upper != nullptr)
+        {
+          while ((entry = upper->read ()) != nullptr)
+            {
+              if (!isReservedName (entry->d_name))
+                {
+                  ret = -1;
+                  break;
+                }
+            }
+        }
+      if ((ret == 0) && (lower != nullptr))
+        {
+          while ((entry = lower->read ()) != nullptr)
+            {
+              if (!isReservedName (entry->d_name)
+                  && ((upper == nullptr) || !isShadowed (path, entry->d_name)))
+                {
+                  ret = -1;
+                  break;
+                }
+            }
+        }
+
+      if (upper != nullptr)
+        {
+          upper->close ();
+        }
+      if (lower != nullptr)
+        {
+          lower->close ();
+        }
+
+      if (ret < 0)
+        {
+          errno = ENOTEMPTY;
+        }
+      return ret;
+    }
+
+    int
+    OverlayFileSystem::removeMarkers (const char* path)
+    {
+      auto* const dir = fUpper->opendir (path);
+      if (dir == nullptr)
+        {
+          return -1;
+        }
+
+      // Restart the listing after each removal.
+      char name[OS_INTEGER_PATH_MAX];
+      int ret = 0;
+      bool found;
+      do
+        {
+          found = false;
+          dir->rewind ();
+          struct dirent* entry;
+          while ((entry = dir->read ()) != nullptr)
+            {
+              if (isReservedName (entry->d_name))
+                {
+                  found = true;
+                  if ((joinName (path, entry->d_name, name, sizeof(name))
+                      == nullptr) || (fUpper->unlink (name) < 0))
+                    {
+                      ret = -1;
+                    }
+                  break;
+                }
+            }
+        }
+      while (found && (ret == 0));
+
+      int err = errno;
+      dir->close ();
+      errno = err;
+      return ret;
+    }
+
+    File*
+    OverlayFileSystem::openFile (const char* path, int oflag,
+                                 std::va_list args)
+    {
+      struct stat st;
+      int layer = locate (path, &st);
+      if (layer > 0)
+        {
+          if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+            {
+              errno = EEXIST;
+              return nullptr;
+            }
+
+          if (layer == LOWER)
+            {
+              if (((oflag & O_ACCMODE) == O_RDONLY)
+                  && ((oflag & O_TRUNC) == 0))
+                {
+                  return static_cast<File*> (fLower->open (path,
+                                                           oflag & ~O_CREAT,
+                                                           args));
+                }
+              if (S_ISDIR(st.st_mode))
+                {
+                  errno = EISDIR;
+                  return nullptr;
+                }
+
+              fChanged = true;
+              if (copyUp (path, &st, (oflag & O_TRUNC) == 0) < 0)
+                {
+                  return nullptr;
+                }
+            }
+          else if ((oflag & (O_ACCMODE | O_TRUNC)) != O_RDONLY)
+            {
+              fChanged = true;
+            }
+          return static_cast<File*> (fUpper->open (path, oflag, args));
+        }
+
+      if ((errno != ENOENT) || ((oflag & O_CREAT) == 0))
+        {
+          return nullptr;
+        }
+      if (isReservedPath (path))
+        {
+          errno = EINVAL;
+          return nullptr;
+        }
+
+      char parent[OS_INTEGER_PATH_MAX];
+      const char* dir = parentOf (path, parent, sizeof(parent));
+      if ((dir == nullptr) || (locate (dir, &st) < 0))
+        {
+          return nullptr;
+        }
+      if (!S_ISDIR(st.st_mode))
+        {
+          errno = ENOTDIR;
+          return nullptr;
+        }
+
+      fChanged = true;
+      if (copyUpParents (path) < 0)
+        {
+          return nullptr;
+        }
+
+      char whiteout[OS_INTEGER_PATH_MAX];
+      bool removed = isWhiteout (path)
+          && (fUpper->unlink (whiteoutOf (path, whiteout, sizeof(whiteout)))
+              == 0);
+
+      auto* const file = static_cast<File*> (fUpper->open (path, oflag, args));
+      if ((file == nullptr) && removed)
+        {
+          int err = errno;
+          createWhiteout (path);
+          errno = err;
+        }
+      return file;
+    }
+
+    int
+    OverlayFileSystem::openDirectory (const char* path, Directory** upper,
+                                      Directory** lower)
+    {
+      *upper = nullptr;
+      *lower = nullptr;
+
+      struct stat st;
+      int layer = locate (path, &st);
+      if (layer < 0)
+        {
+          return -1;
+        }
+      if (!S_ISDIR(st.st_mode))
+        {
+          errno = ENOTDIR;
+          return -1;
+        }
+
+      if (layer == UPPER)
+        {
+          *upper = fUpper->opendir (path);
+          if (*upper == nullptr)
+            {
+              return -1;
+            }
+          if (!isMerged (path))
+            {
+              return 0;
+            }
+        }
+
+      *lower = fLower->opendir (path);
+      if (*lower == nullptr)
+        {
+          if (*upper != nullptr)
+            {
+              int err = errno;
+              (*upper)->close ();
+              *upper = nullptr;
+              errno = err;
+            }
+          return -1;
+        }
+      return 0;
+    }
+
+    bool
+    OverlayFileSystem::isShadowed (const char* path, const char* name)
+    {
+      char joined[OS_INTEGER_PATH_MAX];
+      struct stat st;
+      if (isReservedName (name)
+          || (joinName (path, name, joined, sizeof(joined)) == nullptr))
+        {
+          return true;
+        }
+
+      return (fUpper->stat (joined, &st) == 0) || isWhiteout (joined);
+    }
+
+    // ------------------------------------------------------------------------
+
+    OverlayFile::OverlayFile ()
+    {
+      fFile = nullptr;
+    }
+
+    OverlayFile::~OverlayFile ()
+    {
+      fFile = nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    OverlayFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = getOverlayFileSystem ();
+
+      char trimmed[OS_INTEGER_PATH_MAX];
+      path = trimPath (path, trimmed, sizeof(trimmed));
+      if ((path == nullptr) || (fs->enter () < 0))
+        {
+          return -1;
+        }
+
+      fFile = fs->openFile (path, oflag, args);
+
+      fs->leave ();
+      return (fFile != nullptr) ? 0 : -1;
+    }
+
+    int
+    OverlayFile::do_close (void)
+    {
+      int ret = fFile->close ();
+      fFile = nullptr;
+      return ret;
+    }
+
+    ssize_t
+    OverlayFile::do_read (void* buf, std::size_t nbyte)
+    {
+      return fFile->read (buf, nbyte);
+    }
+
+    ssize_t
+    OverlayFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      return fFile->write (buf, nbyte);
+    }
+
+    off_t
+    OverlayFile::do_lseek (off_t offset, int whence)
+    {
+      return fFile->lseek (offset, whence);
+    }
+
+    int
+    OverlayFile::do_ftruncate (off_t length)
+    {
+      return fFile->ftruncate (length);
+    }
+
+    int
+    OverlayFile::do_fsync (void)
+    {
+      return fFile->fsync ();
+    }
+
+    int
+    OverlayFile::do_fallocate (int mode, off_t offset, off_t len)
+    {
+      return fFile->fallocate (mode, offset, len);
+    }
+
+    int
+    OverlayFile::do_fstat (struct stat* buf)
+    {
+      return fFile->fstat (buf);
+    }
+
+    // ------------------------------------------------------------------------
+
+    OverlayDirectory::OverlayDirectory ()
+    {
+      fUpper = nullptr;
+      fLower = nullptr;
+      fUpperDone = false;
+      fDirPath[0] = '\0';
+    }
+
+    OverlayDirectory::~OverlayDirectory ()
+    {
+      fUpper = nullptr;
+      fLower = nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    OverlayDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getOverlayFileSystem ();
+
+      const char* path = trimPath (dirname, fDirPath, sizeof(fDirPath));
+      if (path == nullptr)
+        {
+          return nullptr;
+        }
+      if (path != fDirPath)
+        {
+          std::strcpy (fDirPath, path);
+        }
+
+      if (fs->enter () < 0)
+        {
+          return nullptr;
+        }
+
+      int ret = fs->openDirectory (fDirPath, &fUpper, &fLower);
+
+      fs->leave ();
+
+      fUpperDone = (fUpper == nullptr);
+      return (ret == 0) ? this : nullptr;
+    }
+
+    struct dirent*
+    OverlayDirectory::do_read (void)
+    {
+      struct dirent* entry = nullptr;
+      if (!fUpperDone)
+        {
+          while ((entry = fUpper->read ()) != nullptr)
+            {
+              if (!isReservedName (entry->d_name))
+                {
+                  break;
+                }
+            }
+          fUpperDone = (entry == nullptr);
+        }
+
+      if ((entry == nullptr) && (fLower != nullptr))
+        {
+          auto* fs = getOverlayFileSystem ();
+          while ((entry = fLower->read ()) != nullptr)
+            {
+              if (fUpper == nullptr)
+                {
+                  if (!isReservedName (entry->d_name))
+                    {
+                      break;
+                    }
+                  continue;
+                }
+
+              // Skip the names shown from the upper directory,
+              // and the removed ones.
+              if (fs->enter () < 0)
+                {
+                  return nullptr;
+                }
+              bool shadowed = fs->isShadowed (fDirPath, entry->d_name);
+              fs->leave ();
+              if (!shadowed)
+                {
+                  break;
+                }
+            }
+        }
+
+      // The lookups leave errno set.
+      errno = 0;
+
+      if (entry == nullptr)
+        {
+          return nullptr;
+        }
+
+      auto* const ret = getDirEntry ();
+      ret->d_ino = entry->d_ino;
+      std::strcpy (ret->d_name, entry->d_name);
+      return ret;
+    }
+
+    void
+    OverlayDirectory::do_rewind (void)
+    {
+      if (fUpper != nullptr)
+        {
+          fUpper->rewind ();
+        }
+      if (fLower != nullptr)
+        {
+          fLower->rewind ();
+        }
+      fUpperDone = (fUpper == nullptr);
+    }
+
+    int
+    OverlayDirectory::do_close (void)
+    {
+      int ret = 0;
+      if ((fUpper != nullptr) && (fUpper->close () < 0))
+        {
+          ret = -1;
+        }
+      if ((fLower != nullptr) && (fLower->close () < 0))
+        {
+          ret = -1;
+        }
+      fUpper = nullptr;
+      fLower = nullptr;
+      return ret;
+    }
+
+    void
+    OverlayDirectory::do_release (void)
+    {
+      // If the open failed.
+      fUpper = nullptr;
+      fLower = nullptr;
+
+      Directory::do_release ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
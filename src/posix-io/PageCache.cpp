@@ -0,0 +1,416 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "posix-io/PageCache.h"
+#include "posix-io/MountManager.h"
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the bucket chains and of the LRU list.
+    static constexpr std::size_t noEntry = ~static_cast<std::size_t> (0);
+
+    // ------------------------------------------------------------------------
+
+    std::size_t PageCache::sfSize;
+    std::size_t PageCache::sfPageSize;
+    std::size_t PageCache::sfBucketsMask;
+
+    PageCache::Page* PageCache::sfPagesArray;
+    std::uint8_t* PageCache::sfData;
+    std::size_t* PageCache::sfBucketsArray;
+
+    std::size_t PageCache::sfMru;
+    std::size_t PageCache::sfLru;
+
+    std::size_t PageCache::sfUsed;
+    std::size_t PageCache::sfDirty;
+    std::size_t PageCache::sfHits;
+    std::size_t PageCache::sfMisses;
+
+    std::atomic_flag PageCache::sfLock = ATOMIC_FLAG_INIT;
+
+    // ------------------------------------------------------------------------
+
+    PageCache::PageCache (std::size_t pages, std::size_t pageSize)
+    {
+      assert(pages > 0);
+      assert(pageSize > 0);
+
+      sfSize = pages;
+      sfPageSize = pageSize;
+      sfPagesArray = new Page[pages];
+      sfData = new std::uint8_t[pages * pageSize];
+
+      // Use a power of 2 number of buckets, at least as many as pages.
+      std::size_t buckets = 1;
+      while (buckets < pages)
+        {
+          buckets <<= 1;
+        }
+      sfBucketsMask = buckets - 1;
+      sfBucketsArray = new std::size_t[buckets];
+
+      for (std::size_t i = 0; i < buckets; ++i)
+        {
+          sfBucketsArray[i] = noEntry;
+        }
+
+      // All pages are free and linked in the LRU list.
+      for (std::size_t i = 0; i < pages; ++i)
+        {
+          sfPagesArray[i].data = sfData + i * pageSize;
+          sfPagesArray[i].fs = nullptr;
+          sfPagesArray[i].node = 0;
+          sfPagesArray[i].index = 0;
+          sfPagesArray[i].refs = 0;
+          sfPagesArray[i].dirty = false;
+          sfPagesArray[i].nextInBucket = noEntry;
+          sfPagesArray[i].newer = (i > 0) ? i - 1 : noEntry;
+          sfPagesArray[i].older = (i + 1 < pages) ? i + 1 : noEntry;
+        }
+      sfMru = 0;
+      sfLru = pages - 1;
+
+      sfUsed = 0;
+      sfDirty = 0;
+      sfHits = 0;
+      sfMisses = 0;
+    }
+
+    PageCache::~PageCache ()
+    {
+      delete[] sfPagesArray;
+      delete[] sfData;
+      delete[] sfBucketsArray;
+      sfPagesArray = nullptr;
+      sfData = nullptr;
+      sfBucketsArray = nullptr;
+      sfSize = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    PageCache::Page*
+    PageCache::find (FileSystem* fs, ino_t node, std::uint32_t index)
+    {
+      if (sfSize == 0)
+        {
+          return nullptr;
+        }
+
+      lock ();
+      Page* page = nullptr;
+      auto i = lookup (fs, node, index);
+      if (i != noEntry)
+        {
+          page = &sfPagesArray[i];
+          ++page->refs;
+          unlinkLru (i);
+          linkMru (i);
+          ++sfHits;
+        }
+      else
+        {
+          ++sfMisses;
+        }
+      unlock ();
+      return page;
+    }
+
+    PageCache::Page*
+    PageCache::grab (FileSystem* fs, ino_t node, std::uint32_t index)
+    {
+      if (sfSize == 0)
+        {
+          return nullptr;
+        }
+
+      lock ();
+      assert(lookup (fs, node, index) == noEntry);
+
+      // The oldest page that can be reused; free pages are the oldest.
+      auto i = sfLru;
+      while ((i != noEntry)
+          && ((sfPagesArray[i].refs != 0) || sfPagesArray[i].dirty))
+        {
+          i = sfPagesArray[i].newer;
+        }
+
+      Page* page = nullptr;
+      if (i != noEntry)
+        {
+          page = &sfPagesArray[i];
+          if (page->fs != nullptr)
+            {
+              remove (i);
+            }
+
+          page->fs = fs;
+          page->node = node;
+          page->index = index;
+          page->refs = 1;
+
+          auto bucket = bucketOf (fs, node, index);
+          page->nextInBucket = sfBucketsArray[bucket];
+          sfBucketsArray[bucket] = i;
+          ++sfUsed;
+
+          unlinkLru (i);
+          linkMru (i);
+        }
+      unlock ();
+      return page;
+    }
+
+    void
+    PageCache::release (Page* page)
+    {
+      lock ();
+      assert(page->refs > 0);
+      --page->refs;
+      unlock ();
+    }
+
+    void
+    PageCache::discard (Page* page)
+    {
+      lock ();
+      assert(page->refs > 0);
+      --page->refs;
+      remove (static_cast<std::size_t> (page - sfPagesArray));
+      unlock ();
+    }
+
+    void
+    PageCache::markDirty (Page* page)
+    {
+      lock ();
+      if (!page->dirty)
+        {
+          page->dirty = true;
+          ++sfDirty;
+        }
+      unlock ();
+    }
+
+    void
+    PageCache::markClean (Page* page)
+    {
+      lock ();
+      if (page->dirty)
+        {
+          page->dirty = false;
+          --sfDirty;
+        }
+      unlock ();
+    }
+
+    bool
+    PageCache::nextDirty (FileSystem* fs, ino_t node, std::size_t* cursor,
+                          Page** page)
+    {
+      lock ();
+      bool found = false;
+      for (auto i = *cursor; i < sfSize; ++i)
+        {
+          auto& p = sfPagesArray[i];
+          if (p.dirty && (p.fs == fs) && (p.node == node))
+            {
+              ++p.refs;
+              *page = &p;
+              *cursor = i + 1;
+              found = true;
+              break;
+            }
+        }
+      unlock ();
+      return found;
+    }
+
+    void
+    PageCache::invalidate (FileSystem* fs, ino_t node, std::uint32_t from)
+    {
+      lock ();
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          auto& p = sfPagesArray[i];
+          if ((p.fs != nullptr) && (p.fs == fs) && (p.node == node)
+              && (p.index >= from))
+            {
+              remove (i);
+            }
+        }
+      unlock ();
+    }
+
+    void
+    PageCache::invalidate (FileSystem* fs)
+    {
+      lock ();
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          if ((sfPagesArray[i].fs != nullptr) && (sfPagesArray[i].fs == fs))
+            {
+              remove (i);
+            }
+        }
+      unlock ();
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    PageCache::lookup (FileSystem* fs, ino_t node, std::uint32_t index)
+    {
+      auto i = sfBucketsArray[bucketOf (fs, node, index)];
+      while (i != noEntry)
+        {
+          auto& page = sfPagesArray[i];
+          if ((page.fs == fs) && (page.node == node) && (page.index == index))
+            {
+              return i;
+            }
+          i = page.nextInBucket;
+        }
+      return noEntry;
+    }
+
+    /**
+     * Unlink the page from its bucket and move it to the LRU end,
+     * to be the first reused.
+     */
+    void
+    PageCache::remove (std::size_t index)
+    {
+      auto& page = sfPagesArray[index];
+      assert(page.refs == 0);
+
+      auto* link = &sfBucketsArray[bucketOf (page.fs, page.node, page.index)];
+      while (*link != index)
+        {
+          assert(*link != noEntry);
+          link = &sfPagesArray[*link].nextInBucket;
+        }
+      *link = page.nextInBucket;
+
+      if (page.dirty)
+        {
+          page.dirty = false;
+          --sfDirty;
+        }
+      page.nextInBucket = noEntry;
+      page.fs = nullptr;
+      --sfUsed;
+
+      if (index != sfLru)
+        {
+          unlinkLru (index);
+
+          page.older = noEntry;
+          page.newer = sfLru;
+          sfPagesArray[sfLru].older = index;
+          sfLru = index;
+        }
+    }
+
+    void
+    PageCache::unlinkLru (std::size_t index)
+    {
+      auto& page = sfPagesArray[index];
+
+      if (page.newer != noEntry)
+        {
+          sfPagesArray[page.newer].older = page.older;
+        }
+      else
+        {
+          sfMru = page.older;
+        }
+
+      if (page.older != noEntry)
+        {
+          sfPagesArray[page.older].newer = page.newer;
+        }
+      else
+        {
+          sfLru = page.newer;
+        }
+    }
+
+    void
+    PageCache::linkMru (std::size_t index)
+    {
+      auto& page = sfPagesArray[index];
+
+      page.newer = noEntry;
+      page.older = sfMru;
+      if (sfMru != noEntry)
+        {
+          sfPagesArray[sfMru].newer = index;
+        }
+      sfMru = index;
+
+      if (sfLru == noEntry)
+        {
+          sfLru = index;
+        }
+    }
+
+    std::size_t
+    PageCache::bucketOf (FileSystem* fs, ino_t node, std::uint32_t index)
+    {
+      auto hash = static_cast<std::size_t> (
+          reinterpret_cast<std::uintptr_t> (fs) >> 4);
+      hash ^= static_cast<std::size_t> (node) * 2654435761u;
+      hash ^= static_cast<std::size_t> (index) * 40503u;
+      return (hash ^ (hash >> 16)) & sfBucketsMask;
+    }
+
+    void
+    PageCache::lock (void)
+    {
+      while (sfLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    PageCache::unlock (void)
+    {
+      sfLock.clear (std::memory_order_release);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,483 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/PartitionBlockDevice.h"
+#include "posix-io/hash.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // On disk partition tables are little endian.
+
+    static inline std::uint32_t
+    le32 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint32_t> (p[0])
+          | (static_cast<std::uint32_t> (p[1]) << 8)
+          | (static_cast<std::uint32_t> (p[2]) << 16)
+          | (static_cast<std::uint32_t> (p[3]) << 24);
+    }
+
+    static inline std::uint64_t
+    le64 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint64_t> (le32 (p))
+          | (static_cast<std::uint64_t> (le32 (p + 4)) << 32);
+    }
+
+    // MBR layout.
+    static constexpr std::size_t mbrTableOffset = 446;
+    static constexpr std::size_t mbrEntrySize = 16;
+    static constexpr std::size_t mbrEntries = 4;
+    static constexpr std::uint8_t mbrTypeGpt = 0xEE;
+
+    // Limit the I/O spent on a damaged chain of extended boot records.
+    static constexpr std::size_t mbrLogicalMax = 128;
+
+    // GPT layout.
+    static constexpr std::size_t gptHeaderMin = 92;
+    static constexpr std::size_t gptEntryMin = 128;
+    static constexpr std::size_t gptNameLength = 36; // UTF-16 characters
+
+    static bool
+    isMbr (const std::uint8_t* buf)
+    {
+      return buf[510] == 0x55 && buf[511] == 0xAA;
+    }
+
+    static bool
+    isExtended (std::uint8_t type)
+    {
+      return type == 0x05 || type == 0x0F || type == 0x85;
+    }
+
+    // ------------------------------------------------------------------------
+
+    PartitionBlockDevice::PartitionBlockDevice ()
+    {
+      fParent = nullptr;
+      fFirstBlock = 0;
+      std::memset (fTypeGuid, 0, sizeof(fTypeGuid));
+      fName[0] = '\0';
+      fType = 0;
+    }
+
+    PartitionBlockDevice::~PartitionBlockDevice ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    PartitionBlockDevice::configure (BlockDevice* parent, blockNumber_t first,
+                                     blockNumber_t count)
+    {
+      if (parent == nullptr)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      blockNumber_t blocks = parent->getBlocksCount ();
+      if ((first > blocks) || (count > blocks - first))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      fParent = parent;
+      fFirstBlock = first;
+      std::memset (fTypeGuid, 0, sizeof(fTypeGuid));
+      fName[0] = '\0';
+      fType = 0;
+
+      setGeometry (parent->getBlockSize (), count, parent->getAlignment ());
+      return 0;
+    }
+
+    int
+    PartitionBlockDevice::scan (BlockDevice* device,
+                                PartitionBlockDevice* partitions,
+                                std::size_t count)
+    {
+      if (device == nullptr || (partitions == nullptr && count > 0))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      std::size_t blockSize = device->getBlockSize ();
+      if (blockSize < 512 || device->getBlocksCount () < 2)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      std::uint8_t* buf = new std::uint8_t[blockSize];
+
+      int ret = -1;
+      if (device->read (buf, 0, 1) == 1)
+        {
+          if (!isMbr (buf))
+            {
+              errno = ENODEV;
+            }
+          else
+            {
+              bool protective = false;
+              for (std::size_t i = 0; i < mbrEntries; ++i)
+                {
+                  if (buf[mbrTableOffset + i * mbrEntrySize + 4]
+                      == mbrTypeGpt)
+                    {
+                      protective = true;
+                    }
+                }
+
+              if (protective)
+                {
+                  ret = scanGpt (device, buf, 1, partitions, count);
+                  if (ret < 0 && errno == ENODEV)
+                    {
+                      // The primary header is damaged, try the backup
+                      // one, in the last block of the device.
+                      ret = scanGpt (device, buf,
+                                     device->getBlocksCount () - 1,
+                                     partitions, count);
+                    }
+                }
+              else
+                {
+                  ret = scanMbr (device, buf, partitions, count);
+                }
+            }
+        }
+      else
+        {
+          errno = EIO;
+        }
+
+      delete[] buf;
+      return ret;
+    }
+
+    int
+    PartitionBlockDevice::scanMbr (BlockDevice* device, std::uint8_t* buf,
+                                   PartitionBlockDevice* partitions,
+                                   std::size_t count)
+    {
+      // The buffer is reused for the extended boot records, keep
+      // a copy of the primary table.
+      std::uint8_t table[mbrEntries * mbrEntrySize];
+      std::memcpy (table, buf + mbrTableOffset, sizeof(table));
+
+      std::size_t n = 0;
+
+      // Primary partitions first, in table order.
+      for (std::size_t i = 0; i < mbrEntries && n < count; ++i)
+        {
+          const std::uint8_t* entry = table + i * mbrEntrySize;
+          std::uint8_t type = entry[4];
+          if (type == 0 || isExtended (type))
+            {
+              continue;
+            }
+          if (partitions[n].configure (device, le32 (entry + 8),
+                                       le32 (entry + 12)) == 0
+              && partitions[n].getBlocksCount () > 0)
+            {
+              partitions[n].fType = type;
+              ++n;
+            }
+        }
+
+      // Then the logical partitions, following the chain of extended
+      // boot records; their links are relative to the first one.
+      for (std::size_t i = 0; i < mbrEntries && n < count; ++i)
+        {
+          const std::uint8_t* entry = table + i * mbrEntrySize;
+          if (!isExtended (entry[4]))
+            {
+              continue;
+            }
+
+          blockNumber_t base = le32 (entry + 8);
+          blockNumber_t ebr = base;
+          for (std::size_t j = 0; j < mbrLogicalMax && n < count; ++j)
+            {
+              if (ebr >= device->getBlocksCount ())
+                {
+                  break;
+                }
+              if (device->read (buf, ebr, 1) != 1)
+                {
+                  errno = EIO;
+                  return -1;
+                }
+              if (!isMbr (buf))
+                {
+                  break;
+                }
+
+              const std::uint8_t* logical = buf + mbrTableOffset;
+              std::uint8_t type = logical[4];
+              std::uint32_t start = le32 (logical + 8);
+              if (type != 0 && start <= ~ebr
+                  && partitions[n].configure (device, ebr + start,
+                                              le32 (logical + 12)) == 0
+                  && partitions[n].getBlocksCount () > 0)
+                {
+                  partitions[n].fType = type;
+                  ++n;
+                }
+
+              const std::uint8_t* link = logical + mbrEntrySize;
+              std::uint32_t next = le32 (link + 8);
+              // Links only go forward, which also prevents loops.
+              if (link[4] == 0 || next > ~base || base + next <= ebr)
+                {
+                  break;
+                }
+              ebr = base + next;
+            }
+        }
+
+      return static_cast<int> (n);
+    }
+
+    int
+    PartitionBlockDevice::scanGpt (BlockDevice* device, std::uint8_t* buf,
+                                   blockNumber_t lba,
+                                   PartitionBlockDevice* partitions,
+                                   std::size_t count)
+    {
+      std::size_t blockSize = device->getBlockSize ();
+      blockNumber_t blocks = device->getBlocksCount ();
+
+      if (device->read (buf, lba, 1) != 1)
+        {
+          errno = EIO;
+          return -1;
+        }
+
+      std::size_t headerSize = le32 (buf + 12);
+      if (std::memcmp (buf, "EFI PART", 8) != 0 || headerSize < gptHeaderMin
+          || headerSize > blockSize)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      // The header CRC is computed with its own field cleared.
+      std::uint32_t headerCrc = le32 (buf + 16);
+      std::memset (buf + 16, 0, 4);
+      if (crc32 (buf, headerSize) != headerCrc)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      std::uint64_t entriesLba = le64 (buf + 72);
+      std::size_t entries = le32 (buf + 80);
+      std::size_t entrySize = le32 (buf + 84);
+      std::uint32_t entriesCrc = le32 (buf + 88);
+
+      // Entries do not straddle blocks, which holds for all the usual
+      // sizes (128 bytes entries, 512 or 4096 bytes blocks).
+      if (entrySize < gptEntryMin || entrySize > blockSize
+          || (blockSize % entrySize) != 0)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      std::size_t perBlock = blockSize / entrySize;
+      std::uint64_t entriesBlocks = (entries + perBlock - 1) / perBlock;
+      if (entriesLba >= blocks || entriesBlocks > blocks - entriesLba)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      // First pass, validate the array, such that a damaged primary
+      // table leaves the partitions untouched for the backup one.
+      std::uint32_t crc = 0;
+      for (std::size_t b = 0; b < entriesBlocks; ++b)
+        {
+          if (device->read (buf, static_cast<blockNumber_t> (entriesLba + b),
+                            1) != 1)
+            {
+              errno = EIO;
+              return -1;
+            }
+          std::size_t inBlock = entries - b * perBlock;
+          if (inBlock > perBlock)
+            {
+              inBlock = perBlock;
+            }
+          crc = crc32 (buf, inBlock * entrySize, crc);
+        }
+      if (crc != entriesCrc)
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      // Second pass, configure the used entries.
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < entries && n < count; ++i)
+        {
+          if ((i % perBlock) == 0
+              && device->read (
+                  buf, static_cast<blockNumber_t> (entriesLba + i / perBlock),
+                  1) != 1)
+            {
+              errno = EIO;
+              return -1;
+            }
+
+          const std::uint8_t* entry = buf + (i % perBlock) * entrySize;
+
+          bool used = false;
+          for (std::size_t k = 0; k < 16; ++k)
+            {
+              used = used || (entry[k] != 0);
+            }
+          if (!used)
+            {
+              continue;
+            }
+
+          std::uint64_t first = le64 (entry + 32);
+          std::uint64_t last = le64 (entry + 40);
+          if (last < first || last >= blocks)
+            {
+              continue;
+            }
+
+          PartitionBlockDevice& p = partitions[n];
+          if (p.configure (device, static_cast<blockNumber_t> (first),
+                           static_cast<blockNumber_t> (last - first + 1)) < 0)
+            {
+              continue;
+            }
+
+          std::memcpy (p.fTypeGuid, entry, sizeof(p.fTypeGuid));
+          std::size_t k;
+          for (k = 0; k < gptNameLength; ++k)
+            {
+              std::uint32_t c = static_cast<std::uint32_t> (entry[56 + 2 * k])
+                  | (static_cast<std::uint32_t> (entry[57 + 2 * k]) << 8);
+              if (c == 0)
+                {
+                  break;
+                }
+              p.fName[k] = (c < 0x80) ? static_cast<char> (c) : '?';
+            }
+          p.fName[k] = '\0';
+          ++n;
+        }
+
+      return static_cast<int> (n);
+    }
+
+    // ------------------------------------------------------------------------
+
+    BlockCache*
+    PartitionBlockDevice::getBlockCache (void)
+    {
+      return nullptr;
+    }
+
+    ssize_t
+    PartitionBlockDevice::do_read (void* buf, blockNumber_t block,
+                                   std::size_t count)
+    {
+      return fParent->read (buf, fFirstBlock + block, count);
+    }
+
+    ssize_t
+    PartitionBlockDevice::do_write (const void* buf, blockNumber_t block,
+                                    std::size_t count)
+    {
+      return fParent->write (buf, fFirstBlock + block, count);
+    }
+
+    ssize_t
+    PartitionBlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                                    blockNumber_t block)
+    {
+      return fParent->readv (iov, iovcnt, fFirstBlock + block);
+    }
+
+    ssize_t
+    PartitionBlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                                     blockNumber_t block)
+    {
+      return fParent->writev (iov, iovcnt, fFirstBlock + block);
+    }
+
+    int
+    PartitionBlockDevice::do_flush (void)
+    {
+      return fParent->flush ();
+    }
+
+    int
+    PartitionBlockDevice::do_discard (blockNumber_t block, std::size_t count)
+    {
+      return fParent->discard (fFirstBlock + block, count);
+    }
+
+    int
+    PartitionBlockDevice::do_prefetch (blockNumber_t block, std::size_t count)
+    {
+      return fParent->prefetch (fFirstBlock + block, count);
+    }
+
+    int
+    PartitionBlockDevice::do_submit (BlockRequest* request)
+    {
+      // Already validated against the partition, which is inside
+      // the parent.
+      return forwardRequest (fParent, request, fFirstBlock);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
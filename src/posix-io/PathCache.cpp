@@ -0,0 +1,541 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/PathCache.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/hash.h"
+
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the bucket chains and of the LRU list.
+    static constexpr std::size_t noEntry = ~static_cast<std::size_t> (0);
+
+    // ------------------------------------------------------------------------
+
+    std::size_t PathCache::sfSize;
+    std::size_t PathCache::sfBucketsMask;
+
+    PathCache::Entry* PathCache::sfEntriesArray;
+    std::size_t* PathCache::sfBucketsArray;
+
+    std::size_t PathCache::sfMru;
+    std::size_t PathCache::sfLru;
+
+    std::size_t PathCache::sfHits;
+    std::size_t PathCache::sfMisses;
+
+    std::atomic_flag PathCache::sfLock = ATOMIC_FLAG_INIT;
+    std::atomic<std::uint32_t> PathCache::sfGeneration
+      { 0 };
+
+    // ------------------------------------------------------------------------
+
+    PathCache::PathCache (std::size_t size)
+    {
+      assert(size > 0);
+
+      sfSize = size;
+      sfEntriesArray = new Entry[size];
+
+      // Use a power of 2 number of buckets, at least as many as entries.
+      std::size_t buckets = 1;
+      while (buckets < size)
+        {
+          buckets <<= 1;
+        }
+      sfBucketsMask = buckets - 1;
+      sfBucketsArray = new std::size_t[buckets];
+
+      for (std::size_t i = 0; i < buckets; ++i)
+        {
+          sfBucketsArray[i] = noEntry;
+        }
+
+      // All entries are free and linked in the LRU list.
+      for (std::size_t i = 0; i < size; ++i)
+        {
+          sfEntriesArray[i].fs = nullptr;
+          sfEntriesArray[i].node = nullptr;
+          sfEntriesArray[i].nextInBucket = noEntry;
+          sfEntriesArray[i].newer = (i > 0) ? i - 1 : noEntry;
+          sfEntriesArray[i].older = (i + 1 < size) ? i + 1 : noEntry;
+          sfEntriesArray[i].negative = false;
+        }
+      sfMru = 0;
+      sfLru = size - 1;
+
+      sfHits = 0;
+      sfMisses = 0;
+    }
+
+    PathCache::~PathCache ()
+    {
+      delete[] sfEntriesArray;
+      delete[] sfBucketsArray;
+      sfEntriesArray = nullptr;
+      sfBucketsArray = nullptr;
+      sfSize = 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    PathCache::Result
+    PathCache::lookup (const char* path, FileSystem** fs,
+                       const char** adjustedPath, void** node)
+    {
+      assert(path != nullptr);
+
+      if (sfSize == 0)
+        {
+          return MISS;
+        }
+
+      std::size_t length;
+      auto hash = hashString (path, &length);
+
+      if (!tryLock ())
+        {
+          // Busy; resolved without the cache, and not counted, as
+          // the counters are protected by the lock too.
+          return MISS;
+        }
+      auto index = find (path, hash, length);
+      if (index == noEntry)
+        {
+          ++sfMisses;
+          unlock ();
+          return MISS;
+        }
+
+      ++sfHits;
+
+      unlinkLru (index);
+      linkMru (index);
+
+      auto& entry = sfEntriesArray[index];
+      *fs = entry.fs;
+      *adjustedPath = path + entry.prefix;
+      *node = entry.node;
+      auto result = entry.negative ? NOT_FOUND : FOUND;
+      unlock ();
+
+      return result;
+    }
+
+    PathCache::Result
+    PathCache::resolve (const char* path, FileSystem** fs,
+                        const char** adjustedPath, void** node,
+                        std::uint32_t* generation)
+    {
+      // Before anything is looked up, such that an invalidation after
+      // the lookup is noticed by add().
+      *generation = sfGeneration.load ();
+
+      auto result = lookup (path, fs, adjustedPath, node);
+      if ((result != MISS) && !(*fs)->acquire ())
+        {
+          // Being unmounted, the entry is stale.
+          result = MISS;
+        }
+      if (result == MISS)
+        {
+          *adjustedPath = path;
+          *node = nullptr;
+          *fs = MountManager::acquireFileSystem (adjustedPath);
+        }
+      return result;
+    }
+
+    void
+    PathCache::add (const char* path, FileSystem* fs, const char* adjustedPath,
+                    void* node, std::uint32_t generation)
+    {
+      assert(path != nullptr);
+      assert(fs != nullptr);
+      assert(adjustedPath >= path);
+
+      if (sfSize == 0)
+        {
+          return;
+        }
+
+      std::size_t length;
+      auto hash = hashString (path, &length);
+      if (length >= OS_INTEGER_PATH_CACHE_NAME_MAX)
+        {
+          // Too long to be cached.
+          return;
+        }
+
+      if (!tryLock ())
+        {
+          // Busy; not remembered this time.
+          return;
+        }
+      if (sfGeneration.load () != generation)
+        {
+          // Possibly outdated by an invalidation.
+          unlock ();
+          return;
+        }
+      auto index = find (path, hash, length);
+      if (index == noEntry)
+        {
+          index = insert (path, hash, length);
+        }
+      else
+        {
+          unlinkLru (index);
+          linkMru (index);
+        }
+
+      auto& entry = sfEntriesArray[index];
+      if ((node != nullptr) || entry.negative || (entry.fs != fs))
+        {
+          entry.node = node;
+        }
+      entry.fs = fs;
+      entry.prefix = static_cast<std::uint16_t> (adjustedPath - path);
+      entry.negative = false;
+      unlock ();
+    }
+
+    void
+    PathCache::addNegative (const char* path, FileSystem* fs,
+                            const char* adjustedPath, std::uint32_t generation)
+    {
+      assert(path != nullptr);
+      assert(fs != nullptr);
+      assert(adjustedPath >= path);
+
+      if (sfSize == 0)
+        {
+          return;
+        }
+
+      std::size_t length;
+      auto hash = hashString (path, &length);
+      if (length >= OS_INTEGER_PATH_CACHE_NAME_MAX)
+        {
+          return;
+        }
+
+      if (!tryLock ())
+        {
+          // Busy; not remembered this time.
+          return;
+        }
+      if (sfGeneration.load () != generation)
+        {
+          // Possibly outdated by an invalidation.
+          unlock ();
+          return;
+        }
+      auto index = find (path, hash, length);
+      if (index == noEntry)
+        {
+          index = insert (path, hash, length);
+        }
+      else
+        {
+          unlinkLru (index);
+          linkMru (index);
+        }
+
+      auto& entry = sfEntriesArray[index];
+      entry.fs = fs;
+      entry.node = nullptr;
+      entry.prefix = static_cast<std::uint16_t> (adjustedPath - path);
+      entry.negative = true;
+      unlock ();
+    }
+
+    void
+    PathCache::update (const char* path, FileSystem* fs,
+                       const char* adjustedPath, void* node, int ret,
+                       std::uint32_t generation)
+    {
+      if (ret == 0)
+        {
+          add (path, fs, adjustedPath, node, generation);
+        }
+      else if (errno == ENOENT)
+        {
+          addNegative (path, fs, adjustedPath, generation);
+        }
+    }
+
+    std::uint32_t
+    PathCache::invalidate (const char* path)
+    {
+      assert(path != nullptr);
+
+      if (sfSize == 0)
+        {
+          return sfGeneration.load ();
+        }
+
+      std::size_t length;
+      auto hash = hashString (path, &length);
+      lock ();
+      auto generation = ++sfGeneration;
+      auto index = find (path, hash, length);
+      if (index != noEntry)
+        {
+          remove (index);
+        }
+      unlock ();
+      return generation;
+    }
+
+    std::uint32_t
+    PathCache::invalidatePrefix (const char* path)
+    {
+      assert(path != nullptr);
+
+      auto length = std::strlen (path);
+      if (length == 0)
+        {
+          return sfGeneration.load ();
+        }
+      bool endsWithSlash = (path[length - 1] == '/');
+
+      lock ();
+      auto generation = ++sfGeneration;
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          auto& entry = sfEntriesArray[i];
+          if ((entry.fs == nullptr) || (entry.length < length)
+              || (std::memcmp (entry.path, path, length) != 0))
+            {
+              continue;
+            }
+
+          // Match only full path components.
+          if (endsWithSlash || (entry.length == length)
+              || (entry.path[length] == '/'))
+            {
+              remove (i);
+            }
+        }
+      unlock ();
+      return generation;
+    }
+
+    void
+    PathCache::invalidate (FileSystem* fs)
+    {
+      lock ();
+      ++sfGeneration;
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          if ((sfEntriesArray[i].fs != nullptr)
+              && (sfEntriesArray[i].fs == fs))
+            {
+              remove (i);
+            }
+        }
+      unlock ();
+    }
+
+    void
+    PathCache::clear (void)
+    {
+      lock ();
+      ++sfGeneration;
+      for (std::size_t i = 0; i < sfSize; ++i)
+        {
+          if (sfEntriesArray[i].fs != nullptr)
+            {
+              remove (i);
+            }
+        }
+      unlock ();
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    PathCache::find (const char* path, std::uint32_t hash, std::size_t length)
+    {
+      auto index = sfBucketsArray[bucketOf (hash)];
+      while (index != noEntry)
+        {
+          auto& entry = sfEntriesArray[index];
+          if ((entry.hash == hash) && (entry.length == length)
+              && (std::memcmp (entry.path, path, length) == 0))
+            {
+              return index;
+            }
+          index = entry.nextInBucket;
+        }
+      return noEntry;
+    }
+
+    /**
+     * Recycle the least recently used entry, link it in the bucket
+     * of the new path and make it the most recently used.
+     */
+    std::size_t
+    PathCache::insert (const char* path, std::uint32_t hash,
+                       std::size_t length)
+    {
+      auto index = sfLru;
+      if (sfEntriesArray[index].fs != nullptr)
+        {
+          remove (index);
+        }
+
+      auto& entry = sfEntriesArray[index];
+      entry.hash = hash;
+      entry.length = static_cast<std::uint16_t> (length);
+      std::memcpy (entry.path, path, length);
+      entry.path[length] = '\0';
+      entry.node = nullptr;
+      entry.negative = false;
+
+      auto bucket = bucketOf (hash);
+      entry.nextInBucket = sfBucketsArray[bucket];
+      sfBucketsArray[bucket] = index;
+
+      unlinkLru (index);
+      linkMru (index);
+
+      return index;
+    }
+
+    /**
+     * Unlink the entry from its bucket and move it to the LRU end,
+     * to be the first reused.
+     */
+    void
+    PathCache::remove (std::size_t index)
+    {
+      auto& entry = sfEntriesArray[index];
+
+      auto* link = &sfBucketsArray[bucketOf (entry.hash)];
+      while (*link != index)
+        {
+          assert(*link != noEntry);
+          link = &sfEntriesArray[*link].nextInBucket;
+        }
+      *link = entry.nextInBucket;
+
+      entry.nextInBucket = noEntry;
+      entry.fs = nullptr;
+      entry.node = nullptr;
+      entry.negative = false;
+
+      if (index != sfLru)
+        {
+          unlinkLru (index);
+
+          entry.older = noEntry;
+          entry.newer = sfLru;
+          sfEntriesArray[sfLru].older = index;
+          sfLru = index;
+        }
+    }
+
+    void
+    PathCache::unlinkLru (std::size_t index)
+    {
+      auto& entry = sfEntriesArray[index];
+
+      if (entry.newer != noEntry)
+        {
+          sfEntriesArray[entry.newer].older = entry.older;
+        }
+      else
+        {
+          sfMru = entry.older;
+        }
+
+      if (entry.older != noEntry)
+        {
+          sfEntriesArray[entry.older].newer = entry.newer;
+        }
+      else
+        {
+          sfLru = entry.newer;
+        }
+    }
+
+    void
+    PathCache::linkMru (std::size_t index)
+    {
+      auto& entry = sfEntriesArray[index];
+
+      entry.newer = noEntry;
+      entry.older = sfMru;
+      if (sfMru != noEntry)
+        {
+          sfEntriesArray[sfMru].newer = index;
+        }
+      sfMru = index;
+
+      if (sfLru == noEntry)
+        {
+          sfLru = index;
+        }
+    }
+
+    void
+    PathCache::lock (void)
+    {
+      while (sfLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    bool
+    PathCache::tryLock (void)
+    {
+      return !sfLock.test_and_set (std::memory_order_acquire);
+    }
+
+    void
+    PathCache::unlock (void)
+    {
+      sfLock.clear (std::memory_order_release);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,100 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/RamBlockDevice.h"
+
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    RamBlockDevice::RamBlockDevice (std::size_t blockSize,
+                                    blockNumber_t blocksCount)
+    {
+      fStorage = new std::uint8_t[blockSize * blocksCount];
+      fAllocated = true;
+
+      std::memset (fStorage, 0, blockSize * blocksCount);
+      setGeometry (blockSize, blocksCount);
+    }
+
+    RamBlockDevice::RamBlockDevice (void* storage, std::size_t blockSize,
+                                    blockNumber_t blocksCount)
+    {
+      fStorage = static_cast<std::uint8_t*> (storage);
+      fAllocated = false;
+
+      setGeometry (blockSize, blocksCount);
+    }
+
+    RamBlockDevice::~RamBlockDevice ()
+    {
+      if (fAllocated)
+        {
+          delete[] fStorage;
+        }
+      fStorage = nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+
+    ssize_t
+    RamBlockDevice::do_read (void* buf, blockNumber_t block, std::size_t count)
+    {
+      std::memcpy (buf, &fStorage[block * getBlockSize ()],
+                   count * getBlockSize ());
+      return static_cast<ssize_t> (count);
+    }
+
+    ssize_t
+    RamBlockDevice::do_write (const void* buf, blockNumber_t block,
+                              std::size_t count)
+    {
+      std::memcpy (&fStorage[block * getBlockSize ()], buf,
+                   count * getBlockSize ());
+      return static_cast<ssize_t> (count);
+    }
+
+    int
+    RamBlockDevice::do_discard (blockNumber_t block, std::size_t count)
+    {
+      // Make the undefined content predictable.
+      std::memset (&fStorage[block * getBlockSize ()], 0,
+                   count * getBlockSize ());
+      return 0;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
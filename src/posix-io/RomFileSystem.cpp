@@ -0,0 +1,955 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/RomFileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/hash.h"
+#include "posix-io/lz4.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    constexpr std::uint32_t RomFileSystem::IMAGE_MAGIC;
+    constexpr std::uint32_t RomFileSystem::IMAGE_VERSION;
+    constexpr std::size_t RomFileSystem::HEADER_SIZE;
+    constexpr std::size_t RomFileSystem::NODE_SIZE;
+    constexpr std::uint16_t RomFileSystem::NODE_COMPRESSED;
+
+    static constexpr std::uint32_t rootIndex = 0;
+    static constexpr std::size_t minBlockSize = 64;
+    static constexpr std::size_t maxBlockSize = 65536;
+    static constexpr std::size_t nameMax = 255;
+
+    static inline std::uint32_t
+    get32 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint32_t> (p[0])
+          | (static_cast<std::uint32_t> (p[1]) << 8)
+          | (static_cast<std::uint32_t> (p[2]) << 16)
+          | (static_cast<std::uint32_t> (p[3]) << 24);
+    }
+
+    static inline std::uint16_t
+    get16 (const std::uint8_t* p)
+    {
+      return static_cast<std::uint16_t> (p[0] | (p[1] << 8));
+    }
+
+    // Names sort by their bytes, a prefix first.
+    static int
+    compareNames (const char* a, std::size_t alen, const char* b,
+                  std::size_t blen)
+    {
+      int ret = std::memcmp (a, b, (alen < blen) ? alen : blen);
+      if (ret != 0)
+        {
+          return ret;
+        }
+      return (alen < blen) ? -1 : ((alen > blen) ? 1 : 0);
+    }
+
+    // ------------------------------------------------------------------------
+
+    RomFileSystem::RomFileSystem (Pool* filesPool, Pool* dirsPool,
+                                  const void* image) :
+        FileSystem (filesPool, dirsPool)
+    {
+      fImage = static_cast<const std::uint8_t*> (image);
+      fImageDevice = nullptr;
+      fImageSize = 0;
+      fNodesCount = 0;
+      fNodesOffset = 0;
+      fBlockSize = 0;
+
+      for (auto& entry : fCache)
+        {
+          entry.data = nullptr;
+          entry.file = 0;
+          entry.block = 0;
+          entry.stamp = 0;
+        }
+      fStamp = 0;
+      fCacheHits = 0;
+      fCacheMisses = 0;
+
+      fCompressed = nullptr;
+      fDeviceBlock = nullptr;
+
+      fLock.clear ();
+    }
+
+    RomFileSystem::~RomFileSystem ()
+    {
+      delete[] fCache[0].data;
+      delete[] fCompressed;
+      delete[] fDeviceBlock;
+      delete fImageDevice;
+    }
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    RomFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      lock ();
+      std::uint32_t index;
+      Node node;
+      int ret = find (path, &index, &node);
+      if (ret == 0)
+        {
+          fillStat (index, &node, buf);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    RomFileSystem::do_truncate (const char* path, off_t length)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_unlink (const char* path)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_rmdir (const char* path)
+    {
+      errno = EROFS;
+      return -1;
+    }
+
+    int
+    RomFileSystem::do_mount (unsigned int flags)
+    {
+      auto* device = getBlockDevice ();
+      if ((fImage == nullptr) && (device == nullptr))
+        {
+          errno = ENODEV;
+          return -1;
+        }
+
+      lock ();
+
+      // Not deleted at unmount, it is still used after do_unmount().
+      delete fImageDevice;
+      fImageDevice = nullptr;
+
+      delete[] fCache[0].data;
+      delete[] fCompressed;
+      delete[] fDeviceBlock;
+      fCache[0].data = nullptr;
+      fCompressed = nullptr;
+      fDeviceBlock = nullptr;
+      fBlockSize = 0;
+
+      if (fImage == nullptr)
+        {
+          fDeviceBlock = new std::uint8_t[device->getBlockSize ()];
+        }
+
+      // Enough to read the header.
+      fImageSize = HEADER_SIZE;
+      std::uint8_t header[HEADER_SIZE];
+      Node root;
+      bool valid = (readImage (0, header, sizeof(header)) == 0)
+          && (get32 (&header[0]) == IMAGE_MAGIC)
+          && (get32 (&header[4]) == IMAGE_VERSION)
+          && (get32 (&header[28]) == crc32 (header, 28));
+
+      std::uint32_t imageSize = get32 (&header[8]);
+      std::size_t blockSize = get32 (&header[12]);
+      fNodesCount = get32 (&header[16]);
+      fNodesOffset = get32 (&header[20]);
+
+      valid = valid && (blockSize >= minBlockSize)
+          && (blockSize <= maxBlockSize)
+          && ((blockSize & (blockSize - 1)) == 0) && (fNodesCount != 0)
+          && (fNodesOffset >= HEADER_SIZE)
+          && (fNodesOffset + static_cast<std::uint64_t> (fNodesCount)
+              * NODE_SIZE <= imageSize);
+      if (valid && (fImage == nullptr))
+        {
+          valid = (imageSize
+              <= static_cast<std::uint64_t> (device->getBlocksCount ())
+                  * device->getBlockSize ());
+        }
+      if (valid)
+        {
+          fImageSize = imageSize;
+          valid = (readNode (rootIndex, &root) == 0) && S_ISDIR(root.mode);
+        }
+
+      if (!valid)
+        {
+          delete[] fDeviceBlock;
+          fDeviceBlock = nullptr;
+          fImageSize = 0;
+          unlock ();
+
+          errno = EINVAL;
+          return -1;
+        }
+
+      fBlockSize = blockSize;
+      auto* data = new std::uint8_t[OS_INTEGER_ROMFS_CACHE_BLOCKS * blockSize];
+      for (std::size_t i = 0; i < OS_INTEGER_ROMFS_CACHE_BLOCKS; ++i)
+        {
+          fCache[i].data = data + i * blockSize;
+          fCache[i].file = 0;
+          fCache[i].stamp = 0;
+        }
+      if (fImage == nullptr)
+        {
+          fCompressed = new std::uint8_t[blockSize];
+        }
+      else
+        {
+          // Never written.
+          fImageDevice = new RamBlockDevice (
+              const_cast<std::uint8_t*> (fImage), 1, fImageSize);
+        }
+
+      unlock ();
+
+      if (fImageDevice != nullptr)
+        {
+          setBlockDevice (fImageDevice);
+        }
+      return 0;
+    }
+
+    int
+    RomFileSystem::do_unmount (unsigned int flags)
+    {
+      lock ();
+
+      delete[] fCache[0].data;
+      delete[] fCompressed;
+      delete[] fDeviceBlock;
+      for (auto& entry : fCache)
+        {
+          entry.data = nullptr;
+          entry.file = 0;
+        }
+      fCompressed = nullptr;
+      fDeviceBlock = nullptr;
+      fBlockSize = 0;
+      fImageSize = 0;
+
+      unlock ();
+      return 0;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    void
+    RomFileSystem::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    RomFileSystem::unlock (void)
+    {
+      fLock.clear (std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+
+    const std::uint8_t*
+    RomFileSystem::mapped (std::uint32_t offset, std::size_t nbyte) const
+    {
+      if ((fImage == nullptr)
+          || (static_cast<std::uint64_t> (offset) + nbyte > fImageSize))
+        {
+          return nullptr;
+        }
+      return fImage + offset;
+    }
+
+    int
+    RomFileSystem::readImage (std::uint32_t offset, void* buf,
+                              std::size_t nbyte)
+    {
+      if (static_cast<std::uint64_t> (offset) + nbyte > fImageSize)
+        {
+          // Damaged image.
+          errno = EIO;
+          return -1;
+        }
+
+      if (fImage != nullptr)
+        {
+          std::memcpy (buf, fImage + offset, nbyte);
+          return 0;
+        }
+
+      auto* device = getBlockDevice ();
+      std::size_t blockSize = device->getBlockSize ();
+      auto* p = static_cast<std::uint8_t*> (buf);
+      while (nbyte > 0)
+        {
+          auto block = static_cast<BlockDevice::blockNumber_t> (offset
+              / blockSize);
+          std::size_t in = offset % blockSize;
+          std::size_t n;
+          if ((in == 0) && (nbyte >= blockSize))
+            {
+              // Whole blocks, directly to the buffer.
+              std::size_t count = nbyte / blockSize;
+              if (device->read (p, block, count)
+                  != static_cast<ssize_t> (count))
+                {
+                  return -1;
+                }
+              n = count * blockSize;
+            }
+          else
+            {
+              if (device->read (fDeviceBlock, block, 1) != 1)
+                {
+                  return -1;
+                }
+              n = blockSize - in;
+              if (n > nbyte)
+                {
+                  n = nbyte;
+                }
+              std::memcpy (p, fDeviceBlock + in, n);
+            }
+          p += n;
+          offset += static_cast<std::uint32_t> (n);
+          nbyte -= n;
+        }
+      return 0;
+    }
+
+    int
+    RomFileSystem::readNode (std::uint32_t index, Node* node)
+    {
+      if (index >= fNodesCount)
+        {
+          errno = EIO;
+          return -1;
+        }
+
+      std::uint8_t buf[NODE_SIZE];
+      const std::uint8_t* p = mapped (
+          static_cast<std::uint32_t> (fNodesOffset + index * NODE_SIZE),
+          NODE_SIZE);
+      if (p == nullptr)
+        {
+          if (readImage (
+              static_cast<std::uint32_t> (fNodesOffset + index * NODE_SIZE),
+              buf, NODE_SIZE) < 0)
+            {
+              return -1;
+            }
+          p = buf;
+        }
+
+      node->mode = get32 (&p[0]);
+      node->size = get32 (&p[4]);
+      node->mtime = get32 (&p[8]);
+      node->name = get32 (&p[12]);
+      node->nameLength = get16 (&p[16]);
+      node->flags = get16 (&p[18]);
+      node->first = get32 (&p[20]);
+      node->count = get32 (&p[24]);
+      return 0;
+    }
+
+    int
+    RomFileSystem::lookup (const Node* dir, const char* name, std::size_t len,
+                           std::uint32_t* index, Node* node)
+    {
+      if (len > nameMax)
+        {
+          errno = ENAMETOOLONG;
+          return -1;
+        }
+
+      std::uint32_t low = dir->first;
+      std::uint32_t high = dir->first + dir->count;
+      while (low < high)
+        {
+          std::uint32_t middle = low + (high - low) / 2;
+          if (readNode (middle, node) < 0)
+            {
+              return -1;
+            }
+
+          char buf[nameMax];
+          auto* entry = reinterpret_cast<const char*> (mapped (
+              node->name, node->nameLength));
+          if (entry == nullptr)
+            {
+              if ((node->nameLength > nameMax)
+                  || (readImage (node->name, buf, node->nameLength) < 0))
+                {
+                  errno = EIO;
+                  return -1;
+                }
+              entry = buf;
+            }
+
+          int cmp = compareNames (name, len, entry, node->nameLength);
+          if (cmp == 0)
+            {
+              *index = middle;
+              return 0;
+            }
+          if (cmp < 0)
+            {
+              high = middle;
+            }
+          else
+            {
+              low = middle + 1;
+            }
+        }
+
+      errno = ENOENT;
+      return -1;
+    }
+
+    int
+    RomFileSystem::find (const char* path, std::uint32_t* index, Node* node)
+    {
+      if (fImageSize == 0)
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      *index = rootIndex;
+      if (readNode (rootIndex, node) < 0)
+        {
+          return -1;
+        }
+
+      for (;;)
+        {
+          while (*path == '/')
+            {
+              ++path;
+            }
+          if (*path == '\0')
+            {
+              return 0;
+            }
+
+          if (!S_ISDIR(node->mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+
+          const char* end = path;
+          while ((*end != '\0') && (*end != '/'))
+            {
+              ++end;
+            }
+          Node dir = *node;
+          if (lookup (&dir, path, static_cast<std::size_t> (end - path), index,
+                      node) < 0)
+            {
+              return -1;
+            }
+          path = end;
+        }
+    }
+
+    void
+    RomFileSystem::fillStat (std::uint32_t index, const Node* node,
+                             struct stat* buf)
+    {
+      std::memset (buf, 0, sizeof(*buf));
+      buf->st_ino = static_cast<ino_t> (index + 1);
+      buf->st_mode = static_cast<mode_t> (node->mode);
+      buf->st_nlink = 1;
+      buf->st_blksize = static_cast<blksize_t> (fBlockSize);
+      if (!S_ISDIR(node->mode))
+        {
+          buf->st_size = static_cast<off_t> (node->size);
+          buf->st_blocks = static_cast<blkcnt_t> ((node->size + 511) / 512);
+        }
+      buf->st_atime = buf->st_mtime = buf->st_ctime =
+          static_cast<std::time_t> (node->mtime);
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    RomFileSystem::readData (std::uint32_t index, const Node* node,
+                             std::size_t offset, void* buf, std::size_t nbyte)
+    {
+      if ((node->flags & NODE_COMPRESSED) == 0)
+        {
+          return readImage (static_cast<std::uint32_t> (node->first + offset),
+                            buf, nbyte);
+        }
+
+      auto* p = static_cast<std::uint8_t*> (buf);
+      while (nbyte > 0)
+        {
+          auto block = static_cast<std::uint32_t> (offset / fBlockSize);
+          std::size_t in = offset % fBlockSize;
+          std::size_t n = fBlockSize - in;
+          if (n > nbyte)
+            {
+              n = nbyte;
+            }
+
+          const std::uint8_t* data = loadBlock (index, node, block);
+          if (data == nullptr)
+            {
+              return -1;
+            }
+          std::memcpy (p, data + in, n);
+          p += n;
+          offset += n;
+          nbyte -= n;
+        }
+      return 0;
+    }
+
+    const std::uint8_t*
+    RomFileSystem::loadBlock (std::uint32_t index, const Node* node,
+                              std::uint32_t block)
+    {
+      CacheEntry* victim = &fCache[0];
+      for (auto& entry : fCache)
+        {
+          if ((entry.file == index + 1) && (entry.block == block))
+            {
+              entry.stamp = ++fStamp;
+              ++fCacheHits;
+              return entry.data;
+            }
+          if ((entry.file == 0)
+              || ((victim->file != 0) && (entry.stamp < victim->stamp)))
+            {
+              victim = &entry;
+            }
+        }
+
+      // The offsets of this block and of the next one.
+      std::uint8_t table[8];
+      if (readImage (node->first + block * 4, table, sizeof(table)) < 0)
+        {
+          return nullptr;
+        }
+      std::uint32_t start = get32 (&table[0]);
+      std::uint32_t end = get32 (&table[4]);
+      std::size_t length = node->size - block * fBlockSize;
+      if (length > fBlockSize)
+        {
+          length = fBlockSize;
+        }
+      if ((end < start) || (end - start > length))
+        {
+          errno = EIO;
+          return nullptr;
+        }
+
+      // The entry is reused, forget it in case of errors.
+      victim->file = 0;
+      if (end - start == length)
+        {
+          // Stored as it is, not compressible.
+          if (readImage (start, victim->data, length) < 0)
+            {
+              return nullptr;
+            }
+        }
+      else
+        {
+          const std::uint8_t* src = mapped (start, end - start);
+          if (src == nullptr)
+            {
+              if (readImage (start, fCompressed, end - start) < 0)
+                {
+                  return nullptr;
+                }
+              src = fCompressed;
+            }
+          if (lz4Decompress (src, end - start, victim->data, length)
+              != static_cast<ssize_t> (length))
+            {
+              errno = EIO;
+              return nullptr;
+            }
+        }
+
+      victim->file = index + 1;
+      victim->block = block;
+      victim->stamp = ++fStamp;
+      ++fCacheMisses;
+      return victim->data;
+    }
+
+    // ========================================================================
+
+    RomFile::RomFile ()
+    {
+      std::memset (&fNode, 0, sizeof(fNode));
+      fIndex = 0;
+      fAddress = nullptr;
+      fOffset = 0;
+    }
+
+    RomFile::~RomFile ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    RomFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = getRomFileSystem ();
+
+      fs->lock ();
+      int ret = fs->find (path, &fIndex, &fNode);
+      if (ret < 0)
+        {
+          if ((errno == ENOENT) && ((oflag & O_CREAT) != 0))
+            {
+              errno = EROFS;
+            }
+        }
+      else if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+        {
+          errno = EEXIST;
+          ret = -1;
+        }
+      else if (S_ISDIR(fNode.mode))
+        {
+          errno = EISDIR;
+          ret = -1;
+        }
+      else if (((oflag & O_ACCMODE) != O_RDONLY) || ((oflag & O_TRUNC) != 0))
+        {
+          errno = EROFS;
+          ret = -1;
+        }
+      else
+        {
+          fAddress =
+              ((fNode.flags & RomFileSystem::NODE_COMPRESSED) == 0) ?
+                  fs->mapped (fNode.first, fNode.size) : nullptr;
+          fOffset = 0;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    RomFile::do_close (void)
+    {
+      return 0;
+    }
+
+    ssize_t
+    RomFile::do_read (void* buf, std::size_t nbyte)
+    {
+      if (fOffset >= static_cast<off_t> (fNode.size))
+        {
+          return 0;
+        }
+      auto offset = static_cast<std::size_t> (fOffset);
+      if (nbyte > fNode.size - offset)
+        {
+          nbyte = fNode.size - offset;
+        }
+
+      if (fAddress != nullptr)
+        {
+          // In place.
+          std::memcpy (buf, fAddress + offset, nbyte);
+        }
+      else
+        {
+          auto* fs = getRomFileSystem ();
+
+          fs->lock ();
+          int ret = fs->readData (fIndex, &fNode, offset, buf, nbyte);
+          fs->unlock ();
+
+          if (ret < 0)
+            {
+              return -1;
+            }
+        }
+
+      fOffset += static_cast<off_t> (nbyte);
+      return static_cast<ssize_t> (nbyte);
+    }
+
+    ssize_t
+    RomFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+    off_t
+    RomFile::do_lseek (off_t offset, int whence)
+    {
+      off_t base;
+      switch (whence)
+        {
+        case SEEK_SET:
+          base = 0;
+          break;
+
+        case SEEK_CUR:
+          base = fOffset;
+          break;
+
+        case SEEK_END:
+          base = static_cast<off_t> (fNode.size);
+          break;
+
+        default:
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (base + offset < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      fOffset = base + offset;
+      return fOffset;
+    }
+
+    int
+    RomFile::do_ftruncate (off_t length)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+#pragma GCC diagnostic pop
+
+    int
+    RomFile::do_fsync (void)
+    {
+      return 0;
+    }
+
+    int
+    RomFile::do_fstat (struct stat* buf)
+    {
+      getRomFileSystem ()->fillStat (fIndex, &fNode, buf);
+      return 0;
+    }
+
+    void
+    RomFile::do_release (void)
+    {
+      fIndex = 0;
+      fAddress = nullptr;
+      fOffset = 0;
+
+      File::do_release ();
+    }
+
+    // ========================================================================
+
+    RomDirectory::RomDirectory ()
+    {
+      fFirst = 0;
+      fCount = 0;
+      fCursor = 0;
+    }
+
+    RomDirectory::~RomDirectory ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    RomDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getRomFileSystem ();
+
+      fs->lock ();
+      Directory* ret = nullptr;
+      std::uint32_t index;
+      RomFileSystem::Node node;
+      if (fs->find (dirname, &index, &node) < 0)
+        {
+          ;
+        }
+      else if (!S_ISDIR(node.mode))
+        {
+          errno = ENOTDIR;
+        }
+      else
+        {
+          fFirst = node.first;
+          fCount = node.count;
+          fCursor = 0;
+          ret = this;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    struct dirent*
+    RomDirectory::do_read (void)
+    {
+      // The same, without the status.
+      return do_read_plus (nullptr);
+    }
+
+    struct dirent*
+    RomDirectory::do_read_plus (struct stat* buf)
+    {
+      if (fCursor >= fCount)
+        {
+          return nullptr;
+        }
+
+      auto* fs = getRomFileSystem ();
+
+      fs->lock ();
+      struct dirent* ret = nullptr;
+      std::uint32_t index = fFirst + fCursor;
+      RomFileSystem::Node node;
+      if (fs->readNode (index, &node) == 0)
+        {
+          std::size_t len = node.nameLength;
+          if (len > sizeof(ret->d_name) - 1)
+            {
+              len = sizeof(ret->d_name) - 1;
+            }
+          ret = getDirEntry ();
+          if (fs->readImage (node.name, ret->d_name, len) == 0)
+            {
+              ret->d_name[len] = '\0';
+              ret->d_ino = static_cast<ino_t> (index + 1);
+              if (buf != nullptr)
+                {
+                  fs->fillStat (index, &node, buf);
+                }
+              ++fCursor;
+            }
+          else
+            {
+              ret = nullptr;
+            }
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    void
+    RomDirectory::do_rewind (void)
+    {
+      fCursor = 0;
+    }
+
+    void
+    RomDirectory::do_release (void)
+    {
+      fFirst = 0;
+      fCount = 0;
+      fCursor = 0;
+
+      Directory::do_release ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,335 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/RomImageBuilder.h"
+#include "posix-io/RomFileSystem.h"
+#include "posix-io/hash.h"
+#include "posix-io/lz4.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    static constexpr std::size_t nameMax = 255;
+    // The data of the files not compressed is aligned, for the
+    // applications using it in place.
+    static constexpr std::size_t dataAlignment = 16;
+
+    static inline void
+    put32 (std::uint8_t* p, std::size_t value)
+    {
+      p[0] = static_cast<std::uint8_t> (value);
+      p[1] = static_cast<std::uint8_t> (value >> 8);
+      p[2] = static_cast<std::uint8_t> (value >> 16);
+      p[3] = static_cast<std::uint8_t> (value >> 24);
+    }
+
+    static inline void
+    put16 (std::uint8_t* p, std::size_t value)
+    {
+      p[0] = static_cast<std::uint8_t> (value);
+      p[1] = static_cast<std::uint8_t> (value >> 8);
+    }
+
+    // ------------------------------------------------------------------------
+
+    RomImageBuilder::RomImageBuilder (std::size_t blockSize)
+    {
+      assert(
+          (blockSize >= 64) && (blockSize <= 65536)
+              && ((blockSize & (blockSize - 1)) == 0));
+
+      fBlockSize = blockSize;
+
+      // The root.
+      Entry root;
+      root.parent = 0;
+      root.mode = S_IFDIR | 0755;
+      root.mtime = 0;
+      root.compress = false;
+      fEntries.push_back (root);
+    }
+
+    RomImageBuilder::~RomImageBuilder ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    RomImageBuilder::addDirectory (const char* path, mode_t mode,
+                                   std::time_t mtime)
+    {
+      return (add (path, S_IFDIR | (mode & 07777), mtime) != 0) ? 0 : -1;
+    }
+
+    int
+    RomImageBuilder::addFile (const char* path, const void* data,
+                              std::size_t size, bool compress, mode_t mode,
+                              std::time_t mtime)
+    {
+      std::size_t index = add (path, S_IFREG | (mode & 07777), mtime);
+      if (index == 0)
+        {
+          return -1;
+        }
+
+      Entry& entry = fEntries[index];
+      auto* p = static_cast<const std::uint8_t*> (data);
+      entry.data.assign (p, p + size);
+      entry.compress = compress;
+      return 0;
+    }
+
+    std::size_t
+    RomImageBuilder::add (const char* path, std::uint32_t mode,
+                          std::time_t mtime)
+    {
+      std::size_t dir = 0;
+      for (;;)
+        {
+          while (*path == '/')
+            {
+              ++path;
+            }
+          const char* end = path;
+          while ((*end != '\0') && (*end != '/'))
+            {
+              ++end;
+            }
+          std::string name (path, static_cast<std::size_t> (end - path));
+          if (name.empty () || (name == ".") || (name == ".."))
+            {
+              errno = EINVAL;
+              return 0;
+            }
+          if (name.size () > nameMax)
+            {
+              errno = ENAMETOOLONG;
+              return 0;
+            }
+
+          const char* next = end;
+          while (*next == '/')
+            {
+              ++next;
+            }
+          bool last = (*next == '\0');
+
+          std::size_t index = child (dir, name);
+          if (last && (index != 0))
+            {
+              errno = EEXIST;
+              return 0;
+            }
+          if ((index != 0) && !S_ISDIR(fEntries[index].mode))
+            {
+              errno = ENOTDIR;
+              return 0;
+            }
+
+          if (index == 0)
+            {
+              Entry entry;
+              entry.name = name;
+              entry.parent = dir;
+              entry.mode = last ? mode : (S_IFDIR | 0755);
+              entry.mtime = static_cast<std::uint32_t> (mtime);
+              entry.compress = false;
+              index = fEntries.size ();
+              fEntries.push_back (entry);
+              fEntries[dir].children.push_back (index);
+            }
+
+          if (last)
+            {
+              return index;
+            }
+          dir = index;
+          path = next;
+        }
+    }
+
+    std::size_t
+    RomImageBuilder::child (std::size_t dir, const std::string& name) const
+    {
+      for (std::size_t index : fEntries[dir].children)
+        {
+          if (fEntries[index].name == name)
+            {
+              return index;
+            }
+        }
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    RomImageBuilder::build (void)
+    {
+      // The nodes, breadth first, such that the children of each
+      // directory are consecutive, sorted by name.
+      std::vector<std::size_t> order;
+      std::vector<std::size_t> first (fEntries.size (), 0);
+      order.push_back (0);
+      for (std::size_t i = 0; i < order.size (); ++i)
+        {
+          std::vector<std::size_t> children = fEntries[order[i]].children;
+          std::sort (children.begin (), children.end (),
+                     [this](std::size_t a, std::size_t b)
+                       {
+                         return fEntries[a].name < fEntries[b].name;
+                       });
+          first[order[i]] = order.size ();
+          order.insert (order.end (), children.begin (), children.end ());
+        }
+
+      std::size_t nodesOffset = RomFileSystem::HEADER_SIZE;
+      std::size_t namesOffset = nodesOffset
+          + order.size () * RomFileSystem::NODE_SIZE;
+
+      fImage.assign (namesOffset, 0);
+      for (std::size_t i = 0; i < order.size (); ++i)
+        {
+          const Entry& entry = fEntries[order[i]];
+          std::uint8_t* p = &fImage[nodesOffset + i * RomFileSystem::NODE_SIZE];
+          put32 (&p[0], entry.mode);
+          put32 (&p[4], entry.data.size ());
+          put32 (&p[8], entry.mtime);
+          put32 (&p[12], fImage.size ());
+          put16 (&p[16], entry.name.size ());
+          fImage.insert (fImage.end (), entry.name.begin (), entry.name.end ());
+        }
+
+      for (std::size_t i = 0; i < order.size (); ++i)
+        {
+          const Entry& entry = fEntries[order[i]];
+          std::uint16_t flags = 0;
+          std::size_t start;
+          std::size_t count;
+          if (S_ISDIR(entry.mode))
+            {
+              start = first[order[i]];
+              count = entry.children.size ();
+            }
+          else
+            {
+              start = appendData (entry, &flags);
+              count = 0;
+            }
+
+          if (fImage.size () > 0xFFFFFFFFu)
+            {
+              fImage.clear ();
+              errno = EFBIG;
+              return -1;
+            }
+
+          std::uint8_t* p = &fImage[nodesOffset + i * RomFileSystem::NODE_SIZE];
+          put16 (&p[18], flags);
+          put32 (&p[20], start);
+          put32 (&p[24], count);
+        }
+
+      std::uint8_t* header = &fImage[0];
+      put32 (&header[0], RomFileSystem::IMAGE_MAGIC);
+      put32 (&header[4], RomFileSystem::IMAGE_VERSION);
+      put32 (&header[8], fImage.size ());
+      put32 (&header[12], fBlockSize);
+      put32 (&header[16], order.size ());
+      put32 (&header[20], nodesOffset);
+      put32 (&header[28], crc32 (header, 28));
+      return 0;
+    }
+
+    std::size_t
+    RomImageBuilder::appendData (const Entry& entry, std::uint16_t* flags)
+    {
+      fImage.resize ((fImage.size () + dataAlignment - 1) & ~(dataAlignment - 1),
+                     0);
+      std::size_t offset = fImage.size ();
+      std::size_t size = entry.data.size ();
+
+      if (entry.compress && (size != 0))
+        {
+          std::size_t blocks = (size + fBlockSize - 1) / fBlockSize;
+          std::size_t table = offset;
+          fImage.resize (table + (blocks + 1) * 4, 0);
+
+          bool compressed = false;
+          std::vector<std::uint8_t> buf (fBlockSize);
+          for (std::size_t k = 0; k < blocks; ++k)
+            {
+              const std::uint8_t* src = &entry.data[k * fBlockSize];
+              std::size_t length = std::min (fBlockSize, size - k * fBlockSize);
+
+              // Only if smaller.
+              std::size_t n = lz4Compress (src, length, buf.data (),
+                                           length - 1);
+              put32 (&fImage[table + k * 4], fImage.size ());
+              if (n != 0)
+                {
+                  fImage.insert (fImage.end (), buf.begin (), buf.begin () + n);
+                  compressed = true;
+                }
+              else
+                {
+                  fImage.insert (fImage.end (), src, src + length);
+                }
+            }
+          put32 (&fImage[table + blocks * 4], fImage.size ());
+
+          if (compressed)
+            {
+              *flags = RomFileSystem::NODE_COMPRESSED;
+              return offset;
+            }
+
+          // Nothing gained, store it as it is.
+          fImage.resize (offset);
+        }
+
+      fImage.insert (fImage.end (), entry.data.begin (), entry.data.end ());
+      *flags = 0;
+      return offset;
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
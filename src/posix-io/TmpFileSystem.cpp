@@ -0,0 +1,1627 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/TmpFileSystem.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/Pool.h"
+#include "posix-io/hash.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // Marker for the end of the chains and lists.
+    static constexpr std::size_t noEntry = ~static_cast<std::size_t> (0);
+
+    // The root directory.
+    static constexpr std::size_t rootNode = 0;
+
+    static constexpr mode_t permissionBits = 07777;
+
+    static inline std::size_t
+    bucketOf (std::uint32_t hash, std::size_t dir, std::size_t mask)
+    {
+      return (hash ^ (static_cast<std::uint32_t> (dir) * 0x9E3779B1u)) & mask;
+    }
+
+    static inline bool
+    isDot (const char* name, std::size_t len)
+    {
+      return (len == 1) && (name[0] == '.');
+    }
+
+    static inline bool
+    isDotDot (const char* name, std::size_t len)
+    {
+      return (len == 2) && (name[0] == '.') && (name[1] == '.');
+    }
+
+    // ------------------------------------------------------------------------
+
+    TmpFileSystem::TmpFileSystem (Pool* filesPool, Pool* dirsPool,
+                                  RamBlockDevice* arena,
+                                  std::size_t nodesCount) :
+        FileSystem (filesPool, dirsPool)
+    {
+      assert(arena != nullptr);
+      assert(nodesCount > 0);
+
+      fArena = arena;
+      fStorage = arena->getStorage ();
+      fBlockSize = arena->getBlockSize ();
+      fBlocksCount = arena->getBlocksCount ();
+      fFreeBlocks = 0;
+      fBitmap = new std::uint32_t[(fBlocksCount + 31) / 32];
+
+      fNodes = new Node[nodesCount];
+      fNodesCount = nodesCount;
+      fFreeNodes = 0;
+      fFreeList = noEntry;
+
+      std::size_t buckets = 1;
+      while (buckets < nodesCount)
+        {
+          buckets <<= 1;
+        }
+      fBuckets = new std::size_t[buckets];
+      fBucketsMask = buckets - 1;
+
+      fLock.clear ();
+
+      format ();
+    }
+
+    TmpFileSystem::~TmpFileSystem ()
+    {
+      delete[] fBuckets;
+      delete[] fNodes;
+      delete[] fBitmap;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    TmpFileSystem::do_chmod (const char* path, mode_t mode)
+    {
+      lock ();
+      int ret = -1;
+      std::size_t index = find (rootNode, path);
+      if (index != noEntry)
+        {
+          Node* node = &fNodes[index];
+          node->mode = (node->mode & ~permissionBits) | (mode & permissionBits);
+          node->ctime = std::time (nullptr);
+          ret = 0;
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_stat (const char* path, struct stat* buf)
+    {
+      lock ();
+      int ret = statFrom (rootNode, path, buf);
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_truncate (const char* path, off_t length)
+    {
+      lock ();
+      int ret = -1;
+      std::size_t index = find (rootNode, path);
+      if (index != noEntry)
+        {
+          if (S_ISDIR(fNodes[index].mode))
+            {
+              errno = EISDIR;
+            }
+          else
+            {
+              ret = resize (&fNodes[index], length);
+            }
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_rename (const char* existing, const char* _new)
+    {
+      lock ();
+      int ret = renameFrom (rootNode, existing, rootNode, _new);
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_unlink (const char* path)
+    {
+      lock ();
+      int ret = unlinkFrom (rootNode, path, false);
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_utime (const char* path, const struct utimbuf* times)
+    {
+      lock ();
+      int ret = -1;
+      std::size_t index = find (rootNode, path);
+      if (index != noEntry)
+        {
+          Node* node = &fNodes[index];
+          node->atime = times->actime;
+          node->mtime = times->modtime;
+          node->ctime = std::time (nullptr);
+          ret = 0;
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_mkdir (const char* path, mode_t mode)
+    {
+      lock ();
+      int ret = mkdirFrom (rootNode, path, mode);
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_rmdir (const char* path)
+    {
+      lock ();
+      int ret = unlinkFrom (rootNode, path, true);
+      unlock ();
+      return ret;
+    }
+
+    void
+    TmpFileSystem::do_sync (void)
+    {
+      // Nothing to write.
+      return;
+    }
+
+    int
+    TmpFileSystem::do_statat (Directory* dir, const char* path,
+                              struct stat* buf)
+    {
+      lock ();
+      std::size_t start;
+      int ret = startOf (dir, &start);
+      if (ret == 0)
+        {
+          ret = statFrom (start, path, buf);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_mkdirat (Directory* dir, const char* path, mode_t mode)
+    {
+      lock ();
+      std::size_t start;
+      int ret = startOf (dir, &start);
+      if (ret == 0)
+        {
+          ret = mkdirFrom (start, path, mode);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_unlinkat (Directory* dir, const char* path, int flag)
+    {
+      lock ();
+      std::size_t start;
+      int ret = startOf (dir, &start);
+      if (ret == 0)
+        {
+          ret = unlinkFrom (start, path, (flag & AT_REMOVEDIR) != 0);
+        }
+      unlock ();
+      return ret;
+    }
+
+    int
+    TmpFileSystem::do_renameat (Directory* olddir, const char* existing,
+                                Directory* newdir, const char* _new)
+    {
+      lock ();
+      std::size_t oldstart;
+      std::size_t newstart;
+      int ret = startOf (olddir, &oldstart);
+      if (ret == 0)
+        {
+          ret = startOf (newdir, &newstart);
+        }
+      if (ret == 0)
+        {
+          ret = renameFrom (oldstart, existing, newstart, _new);
+        }
+      unlock ();
+      return ret;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+    int
+    TmpFileSystem::do_mount (unsigned int flags)
+    {
+      lock ();
+      format ();
+      unlock ();
+
+      // The data lives in the arena, whatever device was given.
+      setBlockDevice (fArena);
+      return 0;
+    }
+
+    int
+    TmpFileSystem::do_unmount (unsigned int flags)
+    {
+      return 0;
+    }
+
+#pragma GCC diagnostic pop
+
+    // ------------------------------------------------------------------------
+
+    void
+    TmpFileSystem::lock (void)
+    {
+      while (fLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    TmpFileSystem::unlock (void)
+    {
+      fLock.clear (std::memory_order_release);
+    }
+
+    void
+    TmpFileSystem::format (void)
+    {
+      std::size_t words = (fBlocksCount + 31) / 32;
+      std::memset (fBitmap, 0, words * sizeof(fBitmap[0]));
+      if ((fBlocksCount % 32) != 0)
+        {
+          // The bits past the end are permanently used.
+          fBitmap[words - 1] = ~((1u << (fBlocksCount % 32)) - 1);
+        }
+      fFreeBlocks = fBlocksCount;
+
+      for (std::size_t i = 0; i <= fBucketsMask; ++i)
+        {
+          fBuckets[i] = noEntry;
+        }
+
+      fFreeList = noEntry;
+      for (std::size_t i = fNodesCount; i-- > 1;)
+        {
+          fNodes[i].mode = 0;
+          fNodes[i].hashNext = fFreeList;
+          fFreeList = i;
+        }
+      fFreeNodes = fNodesCount - 1;
+
+      Node* root = &fNodes[rootNode];
+      std::memset (root, 0, sizeof(*root));
+      root->parent = rootNode;
+      root->hashNext = noEntry;
+      root->firstChild = noEntry;
+      root->nextSibling = noEntry;
+      root->prevSibling = noEntry;
+      root->mode = S_IFDIR | 0777;
+      root->atime = root->mtime = root->ctime = std::time (nullptr);
+    }
+
+    std::size_t
+    TmpFileSystem::indexOf (void* node) const
+    {
+      auto* n = static_cast<Node*> (node);
+      if ((n < fNodes) || (n >= fNodes + fNodesCount) || (n->mode == 0)
+          || n->unlinked)
+        {
+          return noEntry;
+        }
+      return static_cast<std::size_t> (n - fNodes);
+    }
+
+    int
+    TmpFileSystem::resolve (std::size_t start, const char* path,
+                            std::size_t* parent, const char** name,
+                            std::size_t* len) const
+    {
+      std::size_t dir = start;
+      const char* p = path;
+      for (;;)
+        {
+          while (*p == '/')
+            {
+              ++p;
+            }
+          if (*p == '\0')
+            {
+              break;
+            }
+
+          const char* e = p;
+          while ((*e != '\0') && (*e != '/'))
+            {
+              ++e;
+            }
+          auto n = static_cast<std::size_t> (e - p);
+
+          const char* q = e;
+          while (*q == '/')
+            {
+              ++q;
+            }
+
+          std::size_t next;
+          if (isDot (p, n))
+            {
+              next = dir;
+            }
+          else if (isDotDot (p, n))
+            {
+              next = fNodes[dir].parent;
+            }
+          else if (n > OS_INTEGER_TMPFS_NAME_MAX)
+            {
+              errno = ENAMETOOLONG;
+              return -1;
+            }
+          else if (*q == '\0')
+            {
+              // The last component.
+              *parent = dir;
+              *name = p;
+              *len = n;
+              return 0;
+            }
+          else
+            {
+              next = lookup (dir, p, n);
+              if (next == noEntry)
+                {
+                  errno = ENOENT;
+                  return -1;
+                }
+            }
+
+          if (!S_ISDIR(fNodes[next].mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          dir = next;
+          p = q;
+        }
+
+      *parent = dir;
+      *name = p;
+      *len = 0;
+      return 0;
+    }
+
+    std::size_t
+    TmpFileSystem::find (std::size_t start, const char* path) const
+    {
+      std::size_t parent;
+      const char* name;
+      std::size_t len;
+      if (resolve (start, path, &parent, &name, &len) < 0)
+        {
+          return noEntry;
+        }
+      if (len == 0)
+        {
+          return parent;
+        }
+
+      std::size_t index = lookup (parent, name, len);
+      if (index == noEntry)
+        {
+          errno = ENOENT;
+        }
+      return index;
+    }
+
+    std::size_t
+    TmpFileSystem::lookup (std::size_t dir, const char* name,
+                           std::size_t len) const
+    {
+      std::uint32_t hash = hashBuffer (name, len);
+      std::size_t index = fBuckets[bucketOf (hash, dir, fBucketsMask)];
+      while (index != noEntry)
+        {
+          const Node* node = &fNodes[index];
+          if ((node->hash == hash) && (node->parent == dir)
+              && (std::memcmp (node->name, name, len) == 0)
+              && (node->name[len] == '\0'))
+            {
+              return index;
+            }
+          index = node->hashNext;
+        }
+      return noEntry;
+    }
+
+    std::size_t
+    TmpFileSystem::create (std::size_t dir, const char* name, std::size_t len,
+                           mode_t mode)
+    {
+      if (fFreeList == noEntry)
+        {
+          errno = ENOSPC;
+          return noEntry;
+        }
+
+      std::size_t index = fFreeList;
+      Node* node = &fNodes[index];
+      fFreeList = node->hashNext;
+      --fFreeNodes;
+
+      std::memset (node, 0, sizeof(*node));
+      node->firstChild = noEntry;
+      node->mode = mode;
+      node->atime = node->mtime = node->ctime = std::time (nullptr);
+      std::memcpy (node->name, name, len);
+      node->name[len] = '\0';
+      node->hash = hashBuffer (name, len);
+
+      attach (dir, index);
+      return index;
+    }
+
+    void
+    TmpFileSystem::attach (std::size_t dir, std::size_t index)
+    {
+      Node* node = &fNodes[index];
+      node->parent = dir;
+
+      std::size_t bucket = bucketOf (node->hash, dir, fBucketsMask);
+      node->hashNext = fBuckets[bucket];
+      fBuckets[bucket] = index;
+
+      Node* d = &fNodes[dir];
+      node->prevSibling = noEntry;
+      node->nextSibling = d->firstChild;
+      if (d->firstChild != noEntry)
+        {
+          fNodes[d->firstChild].prevSibling = index;
+        }
+      d->firstChild = index;
+      d->mtime = d->ctime = node->ctime;
+    }
+
+    void
+    TmpFileSystem::detach (std::size_t index)
+    {
+      Node* node = &fNodes[index];
+      std::size_t dir = node->parent;
+
+      std::size_t* link = &fBuckets[bucketOf (node->hash, dir, fBucketsMask)];
+      while (*link != index)
+        {
+          link = &fNodes[*link].hashNext;
+        }
+      *link = node->hashNext;
+
+      Node* d = &fNodes[dir];
+      if (d->opens > 0)
+        {
+          // Move the streams reading this entry to the next one.
+          Pool* pool = getDirsPool ();
+          for (std::size_t i = 0; (pool != nullptr) && (i < pool->getSize ());
+              ++i)
+            {
+              auto* stream = static_cast<TmpDirectory*> (pool->getObject (i));
+              if (pool->getFlag (i) && (stream->getFileSystem () == this)
+                  && (stream->fIndex == dir) && (stream->fCursor == index))
+                {
+                  stream->fCursor = node->nextSibling;
+                }
+            }
+        }
+
+      if (node->prevSibling != noEntry)
+        {
+          fNodes[node->prevSibling].nextSibling = node->nextSibling;
+        }
+      else
+        {
+          d->firstChild = node->nextSibling;
+        }
+      if (node->nextSibling != noEntry)
+        {
+          fNodes[node->nextSibling].prevSibling = node->prevSibling;
+        }
+
+      d->mtime = d->ctime = std::time (nullptr);
+    }
+
+    void
+    TmpFileSystem::remove (std::size_t index)
+    {
+      detach (index);
+
+      if (fNodes[index].opens > 0)
+        {
+          fNodes[index].unlinked = true;
+        }
+      else
+        {
+          freeNode (index);
+        }
+    }
+
+    void
+    TmpFileSystem::closeNode (std::size_t index)
+    {
+      Node* node = &fNodes[index];
+      assert(node->opens > 0);
+      if ((--node->opens == 0) && node->unlinked)
+        {
+          freeNode (index);
+        }
+    }
+
+    void
+    TmpFileSystem::freeNode (std::size_t index)
+    {
+      Node* node = &fNodes[index];
+      trim (node, 0);
+      node->mode = 0;
+      node->unlinked = false;
+      node->hashNext = fFreeList;
+      fFreeList = index;
+      ++fFreeNodes;
+    }
+
+    void
+    TmpFileSystem::fillStat (std::size_t index, struct stat* buf) const
+    {
+      const Node* node = &fNodes[index];
+
+      std::memset (buf, 0, sizeof(*buf));
+      buf->st_ino = static_cast<ino_t> (index + 1);
+      buf->st_mode = node->mode;
+      buf->st_nlink = node->unlinked ? 0 : (S_ISDIR(node->mode) ? 2 : 1);
+      buf->st_size = node->size;
+      buf->st_blksize = static_cast<blksize_t> (fBlockSize);
+      buf->st_blocks = static_cast<blkcnt_t> (capacity (node) / 512);
+      buf->st_atime = node->atime;
+      buf->st_mtime = node->mtime;
+      buf->st_ctime = node->ctime;
+    }
+
+    int
+    TmpFileSystem::startOf (Directory* dir, std::size_t* start) const
+    {
+      std::size_t index = indexOf (dir->getNode ());
+      if ((index == noEntry) || !S_ISDIR(fNodes[index].mode))
+        {
+          // Removed while open.
+          errno = ENOENT;
+          return -1;
+        }
+
+      *start = index;
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    TmpFileSystem::statFrom (std::size_t start, const char* path,
+                             struct stat* buf)
+    {
+      std::size_t index = find (start, path);
+      if (index == noEntry)
+        {
+          return -1;
+        }
+
+      fillStat (index, buf);
+      return 0;
+    }
+
+    int
+    TmpFileSystem::mkdirFrom (std::size_t start, const char* path,
+                              mode_t mode)
+    {
+      std::size_t parent;
+      const char* name;
+      std::size_t len;
+      if (resolve (start, path, &parent, &name, &len) < 0)
+        {
+          return -1;
+        }
+
+      if ((len == 0) || (lookup (parent, name, len) != noEntry))
+        {
+          errno = EEXIST;
+          return -1;
+        }
+
+      if (create (parent, name, len, S_IFDIR | (mode & permissionBits))
+          == noEntry)
+        {
+          return -1;
+        }
+      return 0;
+    }
+
+    int
+    TmpFileSystem::unlinkFrom (std::size_t start, const char* path,
+                               bool directory)
+    {
+      std::size_t parent;
+      const char* name;
+      std::size_t len;
+      if (resolve (start, path, &parent, &name, &len) < 0)
+        {
+          return -1;
+        }
+
+      if (len == 0)
+        {
+          // The root, or a path ending with `.` or `..`.
+          errno = directory ? EBUSY : EISDIR;
+          return -1;
+        }
+
+      std::size_t index = lookup (parent, name, len);
+      if (index == noEntry)
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      const Node* node = &fNodes[index];
+      if (directory)
+        {
+          if (!S_ISDIR(node->mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if (node->firstChild != noEntry)
+            {
+              errno = ENOTEMPTY;
+              return -1;
+            }
+        }
+      else if (S_ISDIR(node->mode))
+        {
+          errno = EISDIR;
+          return -1;
+        }
+
+      remove (index);
+      return 0;
+    }
+
+    int
+    TmpFileSystem::renameFrom (std::size_t oldstart, const char* existing,
+                               std::size_t newstart, const char* _new)
+    {
+      std::size_t oldparent;
+      const char* oldname;
+      std::size_t oldlen;
+      if (resolve (oldstart, existing, &oldparent, &oldname, &oldlen) < 0)
+        {
+          return -1;
+        }
+
+      std::size_t newparent;
+      const char* newname;
+      std::size_t newlen;
+      if (resolve (newstart, _new, &newparent, &newname, &newlen) < 0)
+        {
+          return -1;
+        }
+
+      if ((oldlen == 0) || (newlen == 0))
+        {
+          errno = EBUSY;
+          return -1;
+        }
+
+      std::size_t index = lookup (oldparent, oldname, oldlen);
+      if (index == noEntry)
+        {
+          errno = ENOENT;
+          return -1;
+        }
+
+      Node* node = &fNodes[index];
+      bool directory = S_ISDIR(node->mode);
+      if (directory)
+        {
+          // A directory cannot be moved below itself.
+          for (std::size_t d = newparent;; d = fNodes[d].parent)
+            {
+              if (d == index)
+                {
+                  errno = EINVAL;
+                  return -1;
+                }
+              if (d == rootNode)
+                {
+                  break;
+                }
+            }
+        }
+
+      std::size_t target = lookup (newparent, newname, newlen);
+      if (target == index)
+        {
+          return 0;
+        }
+
+      if (target != noEntry)
+        {
+          const Node* t = &fNodes[target];
+          if (directory && !S_ISDIR(t->mode))
+            {
+              errno = ENOTDIR;
+              return -1;
+            }
+          if (!directory && S_ISDIR(t->mode))
+            {
+              errno = EISDIR;
+              return -1;
+            }
+          if (t->firstChild != noEntry)
+            {
+              errno = ENOTEMPTY;
+              return -1;
+            }
+          remove (target);
+        }
+
+      detach (index);
+
+      std::memcpy (node->name, newname, newlen);
+      node->name[newlen] = '\0';
+      node->hash = hashBuffer (newname, newlen);
+      node->ctime = std::time (nullptr);
+
+      attach (newparent, index);
+      return 0;
+    }
+
+    // ------------------------------------------------------------------------
+
+    std::size_t
+    TmpFileSystem::capacity (const Node* node) const
+    {
+      std::size_t blocks = 0;
+      for (std::size_t i = 0; i < node->extentsCount; ++i)
+        {
+          blocks += node->extents[i].count;
+        }
+      return blocks * fBlockSize;
+    }
+
+    std::size_t
+    TmpFileSystem::reserve (Node* node, std::size_t length)
+    {
+      std::size_t cap = capacity (node);
+      if (length <= cap)
+        {
+          return cap;
+        }
+
+      auto need = static_cast<blockNumber_t> ((length - cap + fBlockSize - 1)
+          / fBlockSize);
+      while (need > 0)
+        {
+          if (node->extentsCount > 0)
+            {
+              // Grow the last extent in place, if followed by free
+              // blocks.
+              Extent* last = &node->extents[node->extentsCount - 1];
+              blockNumber_t next = last->block + last->count;
+              blockNumber_t n = 0;
+              while ((n < need) && (next + n < fBlocksCount)
+                  && isFree (next + n))
+                {
+                  ++n;
+                }
+              if (n > 0)
+                {
+                  markBlocks (next, n, true);
+                  last->count += n;
+                  need -= n;
+                  continue;
+                }
+            }
+
+          if (node->extentsCount < OS_INTEGER_TMPFS_EXTENTS)
+            {
+              blockNumber_t found;
+              blockNumber_t block = findBlocks (need, &found);
+              if (found == 0)
+                {
+                  break;
+                }
+              markBlocks (block, found, true);
+              node->extents[node->extentsCount].block = block;
+              node->extents[node->extentsCount].count = found;
+              ++node->extentsCount;
+              need -= found;
+              continue;
+            }
+
+          // All extents used, move the file to a single one.
+          auto blocks = static_cast<blockNumber_t> (capacity (node)
+              / fBlockSize);
+          if (!relocate (node, blocks + need))
+            {
+              break;
+            }
+          need = 0;
+        }
+
+      return capacity (node);
+    }
+
+    void
+    TmpFileSystem::trim (Node* node, std::size_t length)
+    {
+      auto keep = static_cast<blockNumber_t> ((length + fBlockSize - 1)
+          / fBlockSize);
+
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < node->extentsCount; ++i)
+        {
+          Extent* extent = &node->extents[i];
+          if (keep >= extent->count)
+            {
+              keep -= extent->count;
+              ++count;
+              continue;
+            }
+
+          markBlocks (extent->block + keep, extent->count - keep, false);
+          extent->count = keep;
+          if (keep > 0)
+            {
+              ++count;
+            }
+          keep = 0;
+        }
+      node->extentsCount = count;
+    }
+
+    int
+    TmpFileSystem::resize (Node* node, off_t length)
+    {
+      auto size = static_cast<std::size_t> (node->size);
+      if (length > node->size)
+        {
+          if (static_cast<std::uint64_t> (length)
+              > static_cast<std::uint64_t> (fBlocksCount) * fBlockSize)
+            {
+              errno = ENOSPC;
+              return -1;
+            }
+
+          auto end = static_cast<std::size_t> (length);
+          if (reserve (node, end) < end)
+            {
+              trim (node, size);
+              errno = ENOSPC;
+              return -1;
+            }
+          transfer (node, size, nullptr, nullptr, end - size);
+        }
+      else
+        {
+          trim (node, static_cast<std::size_t> (length));
+        }
+
+      node->size = length;
+      node->mtime = node->ctime = std::time (nullptr);
+      return 0;
+    }
+
+    bool
+    TmpFileSystem::relocate (Node* node, blockNumber_t blocks)
+    {
+      blockNumber_t found;
+      blockNumber_t block = findBlocks (blocks, &found);
+      if (found < blocks)
+        {
+          return false;
+        }
+      markBlocks (block, blocks, true);
+
+      std::uint8_t* p = fStorage + block * fBlockSize;
+      std::size_t left = static_cast<std::size_t> (node->size);
+      for (std::size_t i = 0; i < node->extentsCount; ++i)
+        {
+          const Extent* extent = &node->extents[i];
+          std::size_t n = extent->count * fBlockSize;
+          if (n > left)
+            {
+              n = left;
+            }
+          std::memcpy (p, fStorage + extent->block * fBlockSize, n);
+          p += n;
+          left -= n;
+
+          markBlocks (extent->block, extent->count, false);
+        }
+
+      node->extents[0].block = block;
+      node->extents[0].count = blocks;
+      node->extentsCount = 1;
+      return true;
+    }
+
+    void
+    TmpFileSystem::transfer (const Node* node, std::size_t offset,
+                             const void* src, void* dst,
+                             std::size_t nbyte) const
+    {
+      auto* s = static_cast<const std::uint8_t*> (src);
+      auto* d = static_cast<std::uint8_t*> (dst);
+
+      std::size_t start = 0;
+      for (std::size_t i = 0; (i < node->extentsCount) && (nbyte > 0); ++i)
+        {
+          const Extent* extent = &node->extents[i];
+          std::size_t bytes = extent->count * fBlockSize;
+          if (offset < start + bytes)
+            {
+              std::size_t in = offset - start;
+              std::size_t n = bytes - in;
+              if (n > nbyte)
+                {
+                  n = nbyte;
+                }
+
+              std::uint8_t* p = fStorage + extent->block * fBlockSize + in;
+              if (s != nullptr)
+                {
+                  std::memcpy (p, s, n);
+                  s += n;
+                }
+              else if (d != nullptr)
+                {
+                  std::memcpy (d, p, n);
+                  d += n;
+                }
+              else
+                {
+                  std::memset (p, 0, n);
+                }
+
+              offset += n;
+              nbyte -= n;
+            }
+          start += bytes;
+        }
+
+      assert(nbyte == 0);
+    }
+
+    // ------------------------------------------------------------------------
+
+    bool
+    TmpFileSystem::isFree (blockNumber_t block) const
+    {
+      return (fBitmap[block / 32] & (1u << (block % 32))) == 0;
+    }
+
+    void
+    TmpFileSystem::markBlocks (blockNumber_t block, blockNumber_t count,
+                               bool used)
+    {
+      for (blockNumber_t b = block; b < block + count; ++b)
+        {
+          if (used)
+            {
+              fBitmap[b / 32] |= (1u << (b % 32));
+            }
+          else
+            {
+              fBitmap[b / 32] &= ~(1u << (b % 32));
+            }
+        }
+
+      if (used)
+        {
+          fFreeBlocks -= count;
+        }
+      else
+        {
+          fFreeBlocks += count;
+        }
+    }
+
+    TmpFileSystem::blockNumber_t
+    TmpFileSystem::findBlocks (blockNumber_t count, blockNumber_t* found) const
+    {
+      blockNumber_t bestStart = 0;
+      blockNumber_t bestLength = 0;
+      blockNumber_t runStart = 0;
+      blockNumber_t runLength = 0;
+
+      for (blockNumber_t b = 0; b < fBlocksCount;)
+        {
+          if (((b % 32) == 0) && (fBitmap[b / 32] == ~0u))
+            {
+              // Skip full words.
+              runLength = 0;
+              b += 32;
+              continue;
+            }
+
+          if (isFree (b))
+            {
+              if (runLength == 0)
+                {
+                  runStart = b;
+                }
+              if (++runLength == count)
+                {
+                  *found = count;
+                  return runStart;
+                }
+              if (runLength > bestLength)
+                {
+                  bestStart = runStart;
+                  bestLength = runLength;
+                }
+            }
+          else
+            {
+              runLength = 0;
+            }
+          ++b;
+        }
+
+      *found = bestLength;
+      return bestStart;
+    }
+
+    // ========================================================================
+
+    TmpFile::TmpFile ()
+    {
+      fIndex = noEntry;
+      fOffset = 0;
+      fFlags = 0;
+    }
+
+    TmpFile::~TmpFile ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    int
+    TmpFile::do_vopen (const char* path, int oflag, std::va_list args)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      std::size_t start = rootNode;
+      std::size_t cached = fs->indexOf (getNode ());
+      if (cached != noEntry)
+        {
+          // Known from the path cache, no walk needed.
+          start = cached;
+          path = "";
+        }
+      int ret = open (start, path, oflag, args);
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    TmpFile::do_vopenat (Directory* dir, const char* path, int oflag,
+                         std::va_list args)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      std::size_t start;
+      int ret = fs->startOf (dir, &start);
+      if (ret == 0)
+        {
+          ret = open (start, path, oflag, args);
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    TmpFile::open (std::size_t start, const char* path, int oflag,
+                   std::va_list args)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      std::size_t parent;
+      const char* name;
+      std::size_t len;
+      if (fs->resolve (start, path, &parent, &name, &len) < 0)
+        {
+          return -1;
+        }
+
+      std::size_t index = (len == 0) ? parent : fs->lookup (parent, name, len);
+      if (index == noEntry)
+        {
+          if ((oflag & O_CREAT) == 0)
+            {
+              errno = ENOENT;
+              return -1;
+            }
+
+          auto mode = static_cast<mode_t> (va_arg(args, int));
+          index = fs->create (parent, name, len,
+                              S_IFREG | (mode & permissionBits));
+          if (index == noEntry)
+            {
+              return -1;
+            }
+        }
+      else if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+        {
+          errno = EEXIST;
+          return -1;
+        }
+
+      auto* node = &fs->fNodes[index];
+      if (S_ISDIR(node->mode))
+        {
+          errno = EISDIR;
+          return -1;
+        }
+
+      if (((oflag & O_TRUNC) != 0) && ((oflag & O_ACCMODE) != O_RDONLY))
+        {
+          fs->resize (node, 0);
+        }
+
+      ++node->opens;
+      fIndex = index;
+      fOffset = 0;
+      fFlags = oflag;
+
+      // To be remembered by the path cache.
+      setNode (node);
+      return 0;
+    }
+
+    int
+    TmpFile::do_close (void)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      fs->closeNode (fIndex);
+      fs->unlock ();
+      return 0;
+    }
+
+    ssize_t
+    TmpFile::do_read (void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_WRONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      auto* node = &fs->fNodes[fIndex];
+      std::size_t n = 0;
+      if (fOffset < node->size)
+        {
+          n = static_cast<std::size_t> (node->size - fOffset);
+          if (n > nbyte)
+            {
+              n = nbyte;
+            }
+          fs->transfer (node, static_cast<std::size_t> (fOffset), nullptr, buf,
+                        n);
+          fOffset += static_cast<off_t> (n);
+        }
+      fs->unlock ();
+
+      return static_cast<ssize_t> (n);
+    }
+
+    ssize_t
+    TmpFile::do_write (const void* buf, std::size_t nbyte)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      if (nbyte == 0)
+        {
+          return 0;
+        }
+
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      auto* node = &fs->fNodes[fIndex];
+      if ((fFlags & O_APPEND) != 0)
+        {
+          fOffset = node->size;
+        }
+
+      auto size = static_cast<std::size_t> (node->size);
+      auto offset = static_cast<std::size_t> (fOffset);
+      std::size_t end = offset + nbyte;
+
+      // The blocks preallocated beyond the size are kept on failure.
+      std::size_t kept = fs->capacity (node);
+      std::size_t cap = fs->reserve (node, end);
+      if (cap < end)
+        {
+          if (cap <= offset)
+            {
+              fs->trim (node, (kept > size) ? kept : size);
+              fs->unlock ();
+
+              errno = ENOSPC;
+              return -1;
+            }
+
+          // Write what fits.
+          end = cap;
+          nbyte = end - offset;
+        }
+
+      if (offset > size)
+        {
+          // The gap reads back as zeros.
+          fs->transfer (node, size, nullptr, nullptr, offset - size);
+        }
+      fs->transfer (node, offset, buf, nullptr, nbyte);
+
+      if (end > size)
+        {
+          node->size = static_cast<off_t> (end);
+        }
+      node->mtime = node->ctime = std::time (nullptr);
+      fOffset = static_cast<off_t> (end);
+      fs->unlock ();
+
+      return static_cast<ssize_t> (nbyte);
+    }
+
+    off_t
+    TmpFile::do_lseek (off_t offset, int whence)
+    {
+      off_t base;
+      switch (whence)
+        {
+        case SEEK_SET:
+          base = 0;
+          break;
+
+        case SEEK_CUR:
+          base = fOffset;
+          break;
+
+        case SEEK_END:
+          {
+            auto* fs = getTmpFileSystem ();
+
+            fs->lock ();
+            base = fs->fNodes[fIndex].size;
+            fs->unlock ();
+          }
+          break;
+
+        default:
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (base + offset < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      fOffset = base + offset;
+      return fOffset;
+    }
+
+    int
+    TmpFile::do_ftruncate (off_t length)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      int ret = fs->resize (&fs->fNodes[fIndex], length);
+      fs->unlock ();
+      return ret;
+    }
+
+    int
+    TmpFile::do_fsync (void)
+    {
+      // Always in memory.
+      return 0;
+    }
+
+    int
+    TmpFile::do_fallocate (int mode, off_t offset, off_t len)
+    {
+      if ((fFlags & O_ACCMODE) == O_RDONLY)
+        {
+          errno = EBADF;
+          return -1;
+        }
+
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      auto* node = &fs->fNodes[fIndex];
+      auto size = static_cast<std::size_t> (node->size);
+      std::size_t cap = fs->capacity (node);
+      auto end = static_cast<std::uint64_t> (offset + len);
+
+      // The blocks are kept beyond the size, until truncated;
+      // reserve() grows the last extent or adds a single new one.
+      if ((end > static_cast<std::uint64_t> (fs->fBlocksCount) * fs->fBlockSize)
+          || (fs->reserve (node, static_cast<std::size_t> (end)) < end))
+        {
+          fs->trim (node, (cap > size) ? cap : size);
+          fs->unlock ();
+
+          errno = ENOSPC;
+          return -1;
+        }
+
+      if (((mode & FALLOC_FL_KEEP_SIZE) == 0) && (end > size))
+        {
+          fs->transfer (node, size, nullptr, nullptr,
+                        static_cast<std::size_t> (end) - size);
+          node->size = static_cast<off_t> (end);
+          node->mtime = node->ctime = std::time (nullptr);
+        }
+      fs->unlock ();
+
+      return 0;
+    }
+
+    int
+    TmpFile::do_fstat (struct stat* buf)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      fs->fillStat (fIndex, buf);
+      fs->unlock ();
+      return 0;
+    }
+
+    void
+    TmpFile::do_release (void)
+    {
+      fIndex = noEntry;
+      fOffset = 0;
+      fFlags = 0;
+
+      File::do_release ();
+    }
+
+    // ========================================================================
+
+    TmpDirectory::TmpDirectory ()
+    {
+      fIndex = noEntry;
+      fCursor = noEntry;
+    }
+
+    TmpDirectory::~TmpDirectory ()
+    {
+      ;
+    }
+
+    // ------------------------------------------------------------------------
+
+    Directory*
+    TmpDirectory::do_vopen (const char* dirname)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      std::size_t index = fs->indexOf (getNode ());
+      if (index == noEntry)
+        {
+          index = fs->find (rootNode, dirname);
+        }
+
+      Directory* ret = nullptr;
+      if (index == noEntry)
+        {
+          ;
+        }
+      else if (!S_ISDIR(fs->fNodes[index].mode))
+        {
+          errno = ENOTDIR;
+        }
+      else
+        {
+          auto* node = &fs->fNodes[index];
+          ++node->opens;
+          fIndex = index;
+          fCursor = node->firstChild;
+          setNode (node);
+          ret = this;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    struct dirent*
+    TmpDirectory::do_read (void)
+    {
+      // The same, without the status.
+      return do_read_plus (nullptr);
+    }
+
+    struct dirent*
+    TmpDirectory::do_read_plus (struct stat* buf)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      struct dirent* ret = nullptr;
+      if (fCursor != noEntry)
+        {
+          const auto* node = &fs->fNodes[fCursor];
+          ret = getDirEntry ();
+          ret->d_ino = static_cast<ino_t> (fCursor + 1);
+          std::strcpy (ret->d_name, node->name);
+          if (buf != nullptr)
+            {
+              fs->fillStat (fCursor, buf);
+            }
+          fCursor = node->nextSibling;
+        }
+      fs->unlock ();
+      return ret;
+    }
+
+    ssize_t
+    TmpDirectory::do_read_batch (void* buf, std::size_t size)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      auto* p = static_cast<char*> (buf);
+      std::size_t used = 0;
+      while (fCursor != noEntry)
+        {
+          const auto* node = &fs->fNodes[fCursor];
+          std::size_t len = packEntry (p + used, size - used,
+                                       static_cast<ino_t> (fCursor + 1),
+                                       S_ISDIR(node->mode) ? DT_DIR : DT_REG,
+                                       node->name);
+          if (len == 0)
+            {
+              break;
+            }
+          used += len;
+          fCursor = node->nextSibling;
+        }
+      bool full = (used == 0) && (fCursor != noEntry);
+      fs->unlock ();
+
+      if (full)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      return static_cast<ssize_t> (used);
+    }
+
+    void
+    TmpDirectory::do_rewind (void)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      fCursor = fs->fNodes[fIndex].firstChild;
+      fs->unlock ();
+    }
+
+    int
+    TmpDirectory::do_close (void)
+    {
+      auto* fs = getTmpFileSystem ();
+
+      fs->lock ();
+      fs->closeNode (fIndex);
+      fs->unlock ();
+      return 0;
+    }
+
+    void
+    TmpDirectory::do_release (void)
+    {
+      fIndex = noEntry;
+      fCursor = noEntry;
+
+      Directory::do_release ();
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
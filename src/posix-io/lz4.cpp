@@ -0,0 +1,276 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/lz4.h"
+
+#include <cstdint>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    // The format limits: a match is at least 4 bytes long, the last 5
+    // bytes are literals, and the last match starts at least 12 bytes
+    // before the end.
+    static constexpr std::size_t minMatch = 4;
+    static constexpr std::size_t lastLiterals = 5;
+    static constexpr std::size_t matchStartLimit = 12;
+    static constexpr std::size_t maxOffset = 65535;
+
+    static constexpr unsigned int hashBits = 12;
+
+    static inline std::uint32_t
+    read32 (const std::uint8_t* p)
+    {
+      std::uint32_t value;
+      std::memcpy (&value, p, sizeof(value));
+      return value;
+    }
+
+    static inline std::size_t
+    hashOf (std::uint32_t sequence)
+    {
+      return (sequence * 2654435761u) >> (32 - hashBits);
+    }
+
+    // Write a length continuing the 4 bits of the token.
+    static inline std::uint8_t*
+    putLength (std::uint8_t* op, std::size_t length)
+    {
+      for (; length >= 255; length -= 255)
+        {
+          *op++ = 255;
+        }
+      *op++ = static_cast<std::uint8_t> (length);
+      return op;
+    }
+
+    static std::uint8_t*
+    putSequence (std::uint8_t* op, const std::uint8_t* opEnd,
+                 const std::uint8_t* literals, std::size_t literalsLength,
+                 std::size_t offset, std::size_t matchLength)
+    {
+      // The worst case size, including the extra length bytes.
+      std::size_t need = 1 + literalsLength + literalsLength / 255 + 1
+          + ((matchLength != 0) ? 2 + matchLength / 255 + 1 : 0);
+      if (need > static_cast<std::size_t> (opEnd - op))
+        {
+          return nullptr;
+        }
+
+      std::uint8_t* token = op++;
+      *token = static_cast<std::uint8_t> (
+          ((literalsLength < 15) ? literalsLength : 15) << 4);
+      if (literalsLength >= 15)
+        {
+          op = putLength (op, literalsLength - 15);
+        }
+      std::memcpy (op, literals, literalsLength);
+      op += literalsLength;
+
+      if (matchLength != 0)
+        {
+          *op++ = static_cast<std::uint8_t> (offset);
+          *op++ = static_cast<std::uint8_t> (offset >> 8);
+          std::size_t length = matchLength - minMatch;
+          *token |= static_cast<std::uint8_t> ((length < 15) ? length : 15);
+          if (length >= 15)
+            {
+              op = putLength (op, length - 15);
+            }
+        }
+      return op;
+    }
+
+    std::size_t
+    lz4Compress (const void* src, std::size_t length, void* dst,
+                 std::size_t capacity)
+    {
+      auto* in = static_cast<const std::uint8_t*> (src);
+      auto* op = static_cast<std::uint8_t*> (dst);
+      const std::uint8_t* opEnd = op + capacity;
+
+      std::uint32_t table[1u << hashBits];
+      for (auto& entry : table)
+        {
+          entry = ~static_cast<std::uint32_t> (0);
+        }
+
+      std::size_t anchor = 0;
+      if (length > matchStartLimit)
+        {
+          const std::size_t matchEnd = length - lastLiterals;
+          std::size_t ip = 0;
+          while (ip < length - matchStartLimit)
+            {
+              std::uint32_t sequence = read32 (in + ip);
+              std::size_t h = hashOf (sequence);
+              std::size_t ref = table[h];
+              table[h] = static_cast<std::uint32_t> (ip);
+
+              if ((ref == ~static_cast<std::uint32_t> (0))
+                  || (ip - ref > maxOffset) || (read32 (in + ref) != sequence))
+                {
+                  ++ip;
+                  continue;
+                }
+
+              std::size_t matchLength = minMatch;
+              while ((ip + matchLength < matchEnd)
+                  && (in[ref + matchLength] == in[ip + matchLength]))
+                {
+                  ++matchLength;
+                }
+              while ((ip > anchor) && (ref > 0) && (in[ip - 1] == in[ref - 1]))
+                {
+                  --ip;
+                  --ref;
+                  ++matchLength;
+                }
+
+              op = putSequence (op, opEnd, in + anchor, ip - anchor, ip - ref,
+                                matchLength);
+              if (op == nullptr)
+                {
+                  return 0;
+                }
+              ip += matchLength;
+              anchor = ip;
+            }
+        }
+
+      op = putSequence (op, opEnd, in + anchor, length - anchor, 0, 0);
+      if (op == nullptr)
+        {
+          return 0;
+        }
+      return static_cast<std::size_t> (op - static_cast<std::uint8_t*> (dst));
+    }
+
+    ssize_t
+    lz4Decompress (const void* src, std::size_t length, void* dst,
+                   std::size_t capacity)
+    {
+      auto* ip = static_cast<const std::uint8_t*> (src);
+      const std::uint8_t* ipEnd = ip + length;
+      auto* op = static_cast<std::uint8_t*> (dst);
+      const std::uint8_t* opEnd = op + capacity;
+
+      for (;;)
+        {
+          if (ip >= ipEnd)
+            {
+              return -1;
+            }
+          std::uint8_t token = *ip++;
+
+          std::size_t literalsLength = token >> 4;
+          if (literalsLength == 15)
+            {
+              std::uint8_t b;
+              do
+                {
+                  if (ip >= ipEnd)
+                    {
+                      return -1;
+                    }
+                  b = *ip++;
+                  literalsLength += b;
+                }
+              while (b == 255);
+            }
+          if ((literalsLength > static_cast<std::size_t> (ipEnd - ip))
+              || (literalsLength > static_cast<std::size_t> (opEnd - op)))
+            {
+              return -1;
+            }
+          std::memcpy (op, ip, literalsLength);
+          ip += literalsLength;
+          op += literalsLength;
+
+          if (ip == ipEnd)
+            {
+              // The last sequence has only literals.
+              break;
+            }
+
+          if (ipEnd - ip < 2)
+            {
+              return -1;
+            }
+          std::size_t offset = ip[0] | (static_cast<std::size_t> (ip[1]) << 8);
+          ip += 2;
+          if ((offset == 0)
+              || (offset
+                  > static_cast<std::size_t> (op
+                      - static_cast<std::uint8_t*> (dst))))
+            {
+              return -1;
+            }
+
+          std::size_t matchLength = token & 0x0F;
+          if (matchLength == 15)
+            {
+              std::uint8_t b;
+              do
+                {
+                  if (ip >= ipEnd)
+                    {
+                      return -1;
+                    }
+                  b = *ip++;
+                  matchLength += b;
+                }
+              while (b == 255);
+            }
+          matchLength += minMatch;
+          if (matchLength > static_cast<std::size_t> (opEnd - op))
+            {
+              return -1;
+            }
+
+          // The match may overlap the output, copy byte by byte.
+          const std::uint8_t* match = op - offset;
+          for (std::size_t i = 0; i < matchLength; ++i)
+            {
+              op[i] = match[i];
+            }
+          op += matchLength;
+        }
+
+      return op - static_cast<std::uint8_t*> (dst);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
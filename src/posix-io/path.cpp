@@ -0,0 +1,241 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/path.h"
+#include "posix-io/MountManager.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+namespace os
+{
+  namespace posix
+  {
+    // ------------------------------------------------------------------------
+
+    static std::atomic_flag currentDirectoryLock = ATOMIC_FLAG_INIT;
+
+    // ------------------------------------------------------------------------
+
+    /**
+     * Append the components of `path` to the first `n` characters of
+     * `buf`, dropping `.` and repeated separators, and removing the
+     * previous component for `..` (never going above the root); add
+     * a trailing separator if `path` ends with one, or with `.` or
+     * `..`, or if the result is empty, and the terminator.
+     */
+    static const char*
+    appendComponents (const char* path, char* buf, std::size_t size,
+                      std::size_t n)
+    {
+      bool trailing = false;
+      const char* p = path;
+      for (;;)
+        {
+          const char* c = p;
+          while (*c == '/')
+            {
+              ++c;
+            }
+          if (*c == '\0')
+            {
+              trailing = (c != p);
+              break;
+            }
+
+          const char* e = c;
+          while ((*e != '\0') && (*e != '/'))
+            {
+              ++e;
+            }
+          std::size_t len = static_cast<std::size_t> (e - c);
+
+          bool dot = ((len == 1) && (c[0] == '.'));
+          bool dotdot = ((len == 2) && (c[0] == '.') && (c[1] == '.'));
+
+          if (dotdot)
+            {
+              // Remove the last component, if any.
+              while ((n > 0) && (buf[n - 1] != '/'))
+                {
+                  --n;
+                }
+              if (n > 0)
+                {
+                  --n;
+                }
+            }
+          else if (!dot)
+            {
+              if (n + 1 + len >= size)
+                {
+                  errno = ENAMETOOLONG;
+                  return nullptr;
+                }
+              buf[n++] = '/';
+              std::memcpy (&buf[n], c, len);
+              n += len;
+            }
+
+          p = e;
+          if (*e == '\0')
+            {
+              // A final `.` or `..` designates a folder.
+              trailing = (dot || dotdot);
+              break;
+            }
+        }
+
+      if ((n == 0) || trailing)
+        {
+          if (n + 2 > size)
+            {
+              errno = ENAMETOOLONG;
+              return nullptr;
+            }
+          buf[n++] = '/';
+        }
+      buf[n] = '\0';
+
+      return buf;
+    }
+
+    /**
+     * The output is built in `buf` only when it differs from the input;
+     * as long as the components are already normalized, only the length
+     * of the normalized prefix of `path` is advanced, so the usual
+     * absolute paths are not copied at all.
+     */
+    const char*
+    normalizePath (const char* path, char* buf, std::size_t size)
+    {
+      std::size_t n = 0;
+      const char* p = path;
+
+      if (*path != '/')
+        {
+          // Relative path, start with the current directory.
+          lockCurrentDirectory ();
+          const char* cwd = getCurrentDirectoryBuffer ();
+          n = std::strlen (cwd);
+          if (n == 1)
+            {
+              // The root, the components add their own '/'.
+              n = 0;
+            }
+          if (n >= size)
+            {
+              unlockCurrentDirectory ();
+              errno = ENAMETOOLONG;
+              return nullptr;
+            }
+          std::memcpy (buf, cwd, n);
+          unlockCurrentDirectory ();
+          return appendComponents (path, buf, size, n);
+        }
+
+      // Skip the components preceded by a single separator, other
+      // than `.` and `..`; they are already normalized.
+      while ((p[0] == '/') && (p[1] != '/') && (p[1] != '\0'))
+        {
+          const char* e = p + 1;
+          while ((*e != '\0') && (*e != '/'))
+            {
+              ++e;
+            }
+          std::size_t len = static_cast<std::size_t> (e - p - 1);
+          if (((len == 1) && (p[1] == '.'))
+              || ((len == 2) && (p[1] == '.') && (p[2] == '.')))
+            {
+              break;
+            }
+          p = e;
+        }
+      n = static_cast<std::size_t> (p - path);
+
+      // Only the trailing separators may differ.
+      if ((p[0] == '\0') || ((p[0] == '/') && (p[1] == '\0')))
+        {
+          return path;
+        }
+
+      if (n >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, path, n);
+      return appendComponents (p, buf, size, n);
+    }
+
+    const char*
+    joinPath (const char* dirpath, const char* path, char* buf,
+              std::size_t size)
+    {
+      std::size_t n = std::strlen (dirpath);
+      while ((n > 0) && (dirpath[n - 1] == '/'))
+        {
+          --n;
+        }
+      if (n >= size)
+        {
+          errno = ENAMETOOLONG;
+          return nullptr;
+        }
+      std::memcpy (buf, dirpath, n);
+      return appendComponents (path, buf, size, n);
+    }
+
+    char* __attribute__((weak))
+    getCurrentDirectoryBuffer (void)
+    {
+      static char cwd[OS_INTEGER_PATH_MAX];
+      return cwd;
+    }
+
+    void
+    lockCurrentDirectory (void)
+    {
+      while (currentDirectoryLock.test_and_set (std::memory_order_acquire))
+        {
+          schedulerYield ();
+        }
+    }
+
+    void
+    unlockCurrentDirectory (void)
+    {
+      currentDirectoryLock.clear (std::memory_order_release);
+    }
+
+  } /* namespace posix */
+} /* namespace os */
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,387 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/IO.h"
+#include "posix-io/File.h"
+#include "posix-io/Directory.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/TPool.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/BlockDevice.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+// The last path received by any file system.
+static char lastPath[OS_INTEGER_PATH_MAX];
+
+class TestFile : public os::posix::File
+{
+public:
+
+  TestFile () = default;
+
+protected:
+
+  virtual int
+  do_vopen (const char* path, int oflag, std::va_list args) override;
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFile::do_vopen (const char* path, int oflag, std::va_list args)
+{
+  std::strcpy (lastPath, path);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------------
+
+class TestDir : public os::posix::Directory
+{
+public:
+
+  TestDir () = default;
+
+protected:
+
+  virtual Directory*
+  do_vopen (const char* dirname) override;
+};
+
+os::posix::Directory*
+TestDir::do_vopen (const char* dirname)
+{
+  std::strcpy (lastPath, dirname);
+
+  // Pretend the file system found the node.
+  setNode (this);
+  return this;
+}
+
+// ----------------------------------------------------------------------------
+
+// Test class, stat() considers all paths ending in "d" as folders.
+// unlinkat() looks up the name in the directory node, all other
+// functions use the default implementations.
+
+class TestFileSystem : public os::posix::FileSystem
+{
+public:
+
+  TestFileSystem (os::posix::Pool* filesPool, os::posix::Pool* dirsPool);
+
+  // Methods used for test purposes only.
+  os::posix::Directory*
+  getUnlinkDir (void);
+
+  const char*
+  getNewPath (void);
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+
+  virtual int
+  do_stat (const char* path, struct stat* buf) override;
+
+  virtual int
+  do_mkdir (const char* path, mode_t mode) override;
+
+  virtual int
+  do_rename (const char* existing, const char* _new) override;
+
+  virtual int
+  do_unlinkat (os::posix::Directory* dir, const char* path, int flag)
+      override;
+
+private:
+
+  os::posix::Directory* fUnlinkDir;
+  char fNewPath[OS_INTEGER_PATH_MAX];
+};
+
+TestFileSystem::TestFileSystem (os::posix::Pool* filesPool,
+                                os::posix::Pool* dirsPool) :
+    os::posix::FileSystem (filesPool, dirsPool)
+{
+  fUnlinkDir = nullptr;
+  fNewPath[0] = '\0';
+}
+
+inline os::posix::Directory*
+TestFileSystem::getUnlinkDir (void)
+{
+  return fUnlinkDir;
+}
+
+inline const char*
+TestFileSystem::getNewPath (void)
+{
+  return fNewPath;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+int
+TestFileSystem::do_mkdir (const char* path, mode_t mode)
+{
+  std::strcpy (lastPath, path);
+  return 0;
+}
+
+int
+TestFileSystem::do_unlinkat (os::posix::Directory* dir, const char* path,
+                             int flag)
+{
+  // The directory node is used directly, no path walk.
+  fUnlinkDir = dir;
+  std::strcpy (lastPath, path);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+int
+TestFileSystem::do_stat (const char* path, struct stat* buf)
+{
+  std::strcpy (lastPath, path);
+
+  std::memset (buf, 0, sizeof(*buf));
+  auto len = std::strlen (path);
+  buf->st_mode =
+      ((len > 0) && (path[len - 1] == 'd' || path[len - 1] == '/')) ?
+          S_IFDIR : S_IFREG;
+  return 0;
+}
+
+int
+TestFileSystem::do_rename (const char* existing, const char* _new)
+{
+  std::strcpy (lastPath, existing);
+  std::strcpy (fNewPath, _new);
+  return 0;
+}
+
+// Required only as a reference, no functionality needed.
+class TestBlockDevice : public os::posix::BlockDevice
+{
+public:
+  TestBlockDevice () = default;
+};
+
+// ----------------------------------------------------------------------------
+
+using TestFilePool = os::posix::TPool<TestFile>;
+
+TestFilePool filesPool
+  { 2 };
+
+using TestDirPool = os::posix::TPool<TestDir>;
+
+TestDirPool dirsPool
+  { 2 };
+
+TestFileSystem root_fs (&filesPool, &dirsPool);
+TestFileSystem fs1 (&filesPool, &dirsPool);
+TestFileSystem fs2 (&filesPool, &dirsPool);
+
+// Static manager
+os::posix::FileDescriptorsManager dm
+  { 8 };
+
+// Static manager
+os::posix::MountManager mm
+  { 2 };
+
+TestBlockDevice dev;
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  assert(os::posix::MountManager::setRoot (&root_fs, &dev, 0) == 0);
+  assert(os::posix::MountManager::mount (&fs1, "/fs1/", &dev, 0) == 0);
+
+  struct stat st;
+
+    {
+      // ----- Directory descriptors -----
+
+      DIR* pdir = __posix_opendir ("/fs1/a/bd/");
+      assert(pdir != nullptr);
+      assert(std::strcmp (lastPath, "/a/bd/") == 0);
+
+      errno = -2;
+      int fd = __posix_dirfd (pdir);
+      assert((fd >= 3) && (errno == 0));
+      // The same descriptor is returned.
+      assert(__posix_dirfd (pdir) == fd);
+      assert(__posix_fdopendir (fd) == pdir);
+
+      auto* dir = reinterpret_cast<os::posix::Directory*> (pdir);
+      assert(dir->getType () == os::posix::IO::Type::DIRECTORY);
+      assert(std::strcmp (dir->getPath (), "/fs1/a/bd") == 0);
+      assert(std::strcmp (dir->getAdjustedPath (), "/a/bd") == 0);
+
+      // fstat() on the directory descriptor.
+      errno = -2;
+      assert((__posix_fstat (fd, &st) == 0) && (errno == 0));
+      assert(S_ISDIR(st.st_mode));
+      assert(std::strcmp (lastPath, "/a/bd/") == 0);
+
+      // ----- Relative to the directory -----
+
+      errno = -2;
+      assert((__posix_fstatat (fd, "c", &st, 0) == 0) && (errno == 0));
+      assert(std::strcmp (lastPath, "/a/bd/c") == 0);
+      assert(S_ISREG(st.st_mode));
+
+      assert(__posix_fstatat (fd, "./x//y", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/a/bd/x/y") == 0);
+
+      errno = -2;
+      assert((__posix_mkdirat (fd, "nd", 0777) == 0) && (errno == 0));
+      assert(std::strcmp (lastPath, "/a/bd/nd") == 0);
+
+      errno = -2;
+      assert((__posix_unlinkat (fd, "f", 0) == 0) && (errno == 0));
+      assert(fs1.getUnlinkDir () == dir);
+      assert(std::strcmp (lastPath, "f") == 0);
+
+      errno = -2;
+      assert((__posix_unlinkat (fd, "f", 0x1234) == -1) && (errno == EINVAL));
+
+      errno = -2;
+      assert((__posix_renameat (fd, "p", fd, "q") == 0) && (errno == 0));
+      assert(std::strcmp (lastPath, "/a/bd/p") == 0);
+      assert(std::strcmp (fs1.getNewPath (), "/a/bd/q") == 0);
+
+      // Mixed with a path relative to the current directory.
+      assert(__posix_chdir ("/fs1/e/") == 0);
+      assert(__posix_renameat (fd, "p", AT_FDCWD, "q") == 0);
+      assert(std::strcmp (lastPath, "/a/bd/p") == 0);
+      assert(std::strcmp (fs1.getNewPath (), "/e/q") == 0);
+      assert(__posix_chdir ("/") == 0);
+
+      errno = -2;
+      int ffd = __posix_openat (fd, "g", O_RDONLY);
+      assert((ffd >= 3) && (errno == 0));
+      assert(std::strcmp (lastPath, "/a/bd/g") == 0);
+
+      // A file descriptor is not a directory.
+      errno = -2;
+      assert((__posix_fstatat (ffd, "c", &st, 0) == -1) && (errno == ENOTDIR));
+      assert(__posix_close (ffd) == 0);
+
+      // ----- Paths not relative to the directory node -----
+
+      // Absolute paths ignore the directory.
+      assert(__posix_fstatat (fd, "/k", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/k") == 0);
+
+      // Relative to the current directory.
+      assert(__posix_fstatat (AT_FDCWD, "fs1/m", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/m") == 0);
+
+      // Going up is resolved from the root.
+      assert(__posix_fstatat (fd, "../z", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/a/z") == 0);
+      assert(__posix_fstatat (fd, "../../../r", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/r") == 0);
+
+      // A file system mounted below the directory.
+      assert(os::posix::MountManager::mount (&fs2, "/fs1/a/bd/m/", &dev, 0) == 0);
+      assert(__posix_fstatat (fd, "m/q", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/q") == 0);
+      assert(os::posix::MountManager::umount ("/fs1/a/bd/m/", 0) == 0);
+      assert(__posix_fstatat (fd, "m/q", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/a/bd/m/q") == 0);
+
+      // Bad descriptor.
+      errno = -2;
+      assert((__posix_fstatat (7, "c", &st, 0) == -1) && (errno == EBADF));
+
+      // Closing the directory frees the descriptor.
+      errno = -2;
+      assert((__posix_closedir (pdir) == 0) && (errno == 0));
+      assert(os::posix::FileDescriptorsManager::getIo (fd) == nullptr);
+      assert(dirsPool.getFlag (0) == false);
+    }
+
+#if defined(O_DIRECTORY)
+    {
+      // ----- Directory descriptors via open() -----
+
+      errno = -2;
+      int fd = __posix_open ("/fs1/hd", O_RDONLY | O_DIRECTORY);
+      assert((fd >= 3) && (errno == 0));
+      assert(std::strcmp (lastPath, "/hd") == 0);
+
+      int sfd = __posix_openat (fd, "sd", O_RDONLY | O_DIRECTORY);
+      assert(sfd >= 3);
+      assert(std::strcmp (lastPath, "/hd/sd") == 0);
+
+      assert(__posix_fstatat (sfd, "c", &st, 0) == 0);
+      assert(std::strcmp (lastPath, "/hd/sd/c") == 0);
+
+      // close() returns the directories to the pool.
+      assert(__posix_close (sfd) == 0);
+      assert(__posix_close (fd) == 0);
+      assert(dirsPool.getFlag (0) == false);
+      assert(dirsPool.getFlag (1) == false);
+    }
+#endif
+
+  trace_puts ("'test-at-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,413 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockCache.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/MountManager.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+
+// RAM device counting the requests that reach it.
+class CountingBlockDevice : public RamBlockDevice
+{
+public:
+
+  CountingBlockDevice (blockNumber_t blocksCount);
+
+  std::size_t readRequests;
+  std::size_t writeRequests;
+  std::size_t flushes;
+
+protected:
+
+  virtual ssize_t
+  do_readv (const struct iovec* iov, int iovcnt, blockNumber_t block)
+      override;
+
+  virtual ssize_t
+  do_writev (const struct iovec* iov, int iovcnt, blockNumber_t block)
+      override;
+
+  virtual ssize_t
+  do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count)
+      override;
+
+  virtual int
+  do_flush (void) override;
+
+private:
+
+  // Set while inside a vectored request, not to count it twice.
+  bool fInVector;
+};
+
+CountingBlockDevice::CountingBlockDevice (blockNumber_t blocksCount) :
+    RamBlockDevice (BLOCK_SIZE, blocksCount)
+{
+  readRequests = 0;
+  writeRequests = 0;
+  flushes = 0;
+  fInVector = false;
+}
+
+ssize_t
+CountingBlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                               blockNumber_t block)
+{
+  ++readRequests;
+  fInVector = true;
+  ssize_t ret = RamBlockDevice::do_readv (iov, iovcnt, block);
+  fInVector = false;
+  return ret;
+}
+
+ssize_t
+CountingBlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                                blockNumber_t block)
+{
+  ++writeRequests;
+  fInVector = true;
+  ssize_t ret = RamBlockDevice::do_writev (iov, iovcnt, block);
+  fInVector = false;
+  return ret;
+}
+
+ssize_t
+CountingBlockDevice::do_read (void* buf, blockNumber_t block,
+                              std::size_t count)
+{
+  if (!fInVector)
+    {
+      ++readRequests;
+    }
+  return RamBlockDevice::do_read (buf, block, count);
+}
+
+ssize_t
+CountingBlockDevice::do_write (const void* buf, blockNumber_t block,
+                               std::size_t count)
+{
+  if (!fInVector)
+    {
+      ++writeRequests;
+    }
+  return RamBlockDevice::do_write (buf, block, count);
+}
+
+int
+CountingBlockDevice::do_flush (void)
+{
+  ++flushes;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// File system that only writes a block when unmounted.
+class TestFileSystem : public FileSystem
+{
+public:
+
+  TestFileSystem ();
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+
+  virtual int
+  do_unmount (unsigned int flags) override;
+};
+
+TestFileSystem::TestFileSystem () :
+    FileSystem (nullptr, nullptr)
+{
+  ;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+int
+TestFileSystem::do_unmount (unsigned int flags)
+{
+  // Mark the volume as cleanly unmounted, through the cache.
+  auto* cache = getBlockDevice ()->getBlockCache ();
+  assert(cache != nullptr);
+
+  auto* p = static_cast<char*> (cache->pin (0));
+  assert(p != nullptr);
+  p[0] = 'C';
+  cache->unpin (0, true);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------------
+
+MountManager mm
+  { 2 };
+
+static void
+fill (char* buf, BlockDevice::blockNumber_t block)
+{
+  std::memset (buf, static_cast<int> (block + 1), BLOCK_SIZE);
+}
+
+static bool
+check (const char* buf, BlockDevice::blockNumber_t block)
+{
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+    {
+      if (buf[i] != static_cast<char> (block + 1))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  char buf[8 * BLOCK_SIZE];
+
+  {
+    CountingBlockDevice dev (64);
+    for (BlockDevice::blockNumber_t b = 0; b < 64; ++b)
+      {
+        fill (buf, b);
+        assert(dev.write (buf, b, 1) == 1);
+      }
+    dev.writeRequests = 0;
+
+    BlockCache cache (&dev, 8);
+    assert(cache.getBlockSize () == BLOCK_SIZE);
+    assert(cache.getBlocksCount () == 64);
+    assert(cache.getBlockCache () == &cache);
+    assert(dev.getBlockCache () == nullptr);
+
+    // Miss, then hit.
+    assert(cache.read (buf, 3, 1) == 1);
+    assert(check (buf, 3));
+    assert(cache.getMisses () == 1);
+    assert(cache.getHits () == 0);
+    assert(dev.readRequests == 1);
+
+    assert(cache.read (buf, 3, 1) == 1);
+    assert(check (buf, 3));
+    assert(cache.getHits () == 1);
+    assert(dev.readRequests == 1);
+
+    // Missing consecutive blocks are read with a single request,
+    // cached ones are not read again.
+    assert(cache.read (buf, 2, 4) == 4);
+    for (BlockDevice::blockNumber_t b = 0; b < 4; ++b)
+      {
+        assert(check (&buf[b * BLOCK_SIZE], 2 + b));
+      }
+    assert(dev.readRequests == 3);
+    assert(cache.getHits () == 2);
+    assert(cache.getMisses () == 4);
+
+    // Out of range.
+    errno = 0;
+    assert(cache.read (buf, 63, 2) == -1);
+    assert(errno == EINVAL);
+  }
+
+  {
+    // Write-back, with consecutive blocks coalesced.
+    CountingBlockDevice dev (64);
+    BlockCache cache (&dev, 8);
+
+    for (BlockDevice::blockNumber_t b = 10; b < 13; ++b)
+      {
+        fill (buf, b);
+        assert(cache.write (buf, b, 1) == 1);
+      }
+    fill (buf, 20);
+    assert(cache.write (buf, 20, 1) == 1);
+
+    // Nothing written yet.
+    assert(dev.writeRequests == 0);
+    assert(dev.readRequests == 0);
+
+    assert(cache.flush () == 0);
+    assert(dev.writeRequests == 2);
+    assert(dev.flushes == 1);
+    assert(cache.getWriteRequests () == 2);
+    assert(cache.getWrittenBlocks () == 4);
+
+    for (BlockDevice::blockNumber_t b = 10; b < 13; ++b)
+      {
+        assert(dev.read (buf, b, 1) == 1);
+        assert(check (buf, b));
+      }
+
+    // Clean blocks are not written again.
+    assert(cache.flush () == 0);
+    assert(dev.writeRequests == 2);
+  }
+
+  {
+    // A dirty block is written when evicted.
+    CountingBlockDevice dev (64);
+    BlockCache cache (&dev, 4);
+
+    fill (buf, 1);
+    assert(cache.write (buf, 1, 1) == 1);
+    for (BlockDevice::blockNumber_t b = 30; b < 40; ++b)
+      {
+        assert(cache.read (buf, b, 1) == 1);
+      }
+    assert(dev.writeRequests == 1);
+    assert(dev.read (buf, 1, 1) == 1);
+    assert(check (buf, 1));
+  }
+
+  {
+    // A block accessed again after eviction is protected from scans.
+    CountingBlockDevice dev (256);
+    BlockCache cache (&dev, 8);
+
+    assert(cache.read (buf, 0, 1) == 1);
+    for (BlockDevice::blockNumber_t b = 100; b < 108; ++b)
+      {
+        assert(cache.read (buf, b, 1) == 1);
+      }
+
+    // Evicted, but remembered.
+    std::size_t requests = dev.readRequests;
+    assert(cache.read (buf, 0, 1) == 1);
+    assert(dev.readRequests == requests + 1);
+
+    // A long scan of blocks read only once.
+    for (BlockDevice::blockNumber_t b = 110; b < 250; ++b)
+      {
+        assert(cache.read (buf, b, 1) == 1);
+      }
+
+    requests = dev.readRequests;
+    assert(cache.read (buf, 0, 1) == 1);
+    assert(dev.readRequests == requests);
+  }
+
+  {
+    // Pinned blocks stay in the cache.
+    CountingBlockDevice dev (64);
+    BlockCache cache (&dev, 4);
+
+    void* pinned[4];
+    for (BlockDevice::blockNumber_t b = 0; b < 4; ++b)
+      {
+        pinned[b] = cache.pin (b);
+        assert(pinned[b] != nullptr);
+      }
+
+    errno = 0;
+    assert(cache.read (buf, 10, 1) == -1);
+    assert(errno == ENOBUFS);
+
+    errno = 0;
+    assert(cache.pin (10) == nullptr);
+    assert(errno == ENOBUFS);
+
+    errno = 0;
+    assert(cache.pin (64) == nullptr);
+    assert(errno == EINVAL);
+
+    // Modify a metadata block in place.
+    std::memset (pinned[2], 0x55, BLOCK_SIZE);
+    for (BlockDevice::blockNumber_t b = 0; b < 4; ++b)
+      {
+        cache.unpin (b, b == 2);
+      }
+
+    assert(cache.read (buf, 10, 1) == 1);
+    assert(cache.flush () == 0);
+    assert(dev.read (buf, 2, 1) == 1);
+    assert(buf[0] == 0x55);
+
+    // Discarded blocks are dropped, even if dirty.
+    fill (buf, 5);
+    assert(cache.write (buf, 5, 1) == 1);
+    std::size_t writes = dev.writeRequests;
+    assert(cache.discard (5, 1) == 0);
+    assert(cache.flush () == 0);
+    assert(dev.writeRequests == writes);
+  }
+
+  {
+    // The cache is flushed by sync() and umount().
+    CountingBlockDevice dev (16);
+    BlockCache cache (&dev, 4);
+    TestFileSystem fs;
+
+    assert(mm.mount (&fs, "/cached/", &cache, 0) == 0);
+
+    fill (buf, 7);
+    assert(cache.write (buf, 7, 1) == 1);
+    assert(dev.writeRequests == 0);
+
+    os::posix::sync ();
+    assert(dev.writeRequests == 1);
+    assert(dev.flushes == 1);
+
+    assert(mm.umount ("/cached/", 0) == 0);
+    assert(dev.read (buf, 0, 1) == 1);
+    assert(buf[0] == 'C');
+  }
+
+  trace_puts ("'test-block-cache-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
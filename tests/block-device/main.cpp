@@ -0,0 +1,195 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockDevice.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/HostFileBlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+// Common checks for any device with 8 or more blocks of 512 bytes.
+static void
+testDevice (BlockDevice& dev)
+{
+  assert(dev.getBlockSize () == 512);
+  assert(dev.getBlocksCount () >= 8);
+
+  char wbuf[3 * 512];
+  char rbuf[3 * 512];
+
+  for (std::size_t i = 0; i < sizeof(wbuf); ++i)
+    {
+      wbuf[i] = static_cast<char> (i * 7 + 1);
+    }
+
+  // Simple write/read.
+  assert(dev.write (wbuf, 2, 3) == 3);
+  std::memset (rbuf, 0, sizeof(rbuf));
+  assert(dev.read (rbuf, 2, 3) == 3);
+  assert(std::memcmp (wbuf, rbuf, sizeof(rbuf)) == 0);
+
+  // Empty transfer.
+  assert(dev.read (rbuf, 0, 0) == 0);
+
+  // Out of range.
+  errno = 0;
+  assert(dev.read (rbuf, dev.getBlocksCount () - 1, 2) == -1);
+  assert(errno == EINVAL);
+
+  errno = 0;
+  assert(dev.write (wbuf, dev.getBlocksCount (), 1) == -1);
+  assert(errno == EINVAL);
+
+  // Null buffer.
+  errno = 0;
+  assert(dev.read (nullptr, 0, 1) == -1);
+  assert(errno == EFAULT);
+
+  // Vectored write, then read back with a different split.
+  struct iovec wiov[2];
+  wiov[0].iov_base = wbuf;
+  wiov[0].iov_len = 512;
+  wiov[1].iov_base = wbuf + 512;
+  wiov[1].iov_len = 2 * 512;
+  assert(dev.writev (wiov, 2, 4) == 3);
+
+  std::memset (rbuf, 0, sizeof(rbuf));
+  struct iovec riov[2];
+  riov[0].iov_base = rbuf;
+  riov[0].iov_len = 2 * 512;
+  riov[1].iov_base = rbuf + 2 * 512;
+  riov[1].iov_len = 512;
+  assert(dev.readv (riov, 2, 4) == 3);
+  assert(std::memcmp (wbuf, rbuf, sizeof(rbuf)) == 0);
+
+  // Buffer length not multiple of the block size.
+  riov[1].iov_len = 100;
+  errno = 0;
+  assert(dev.readv (riov, 2, 4) == -1);
+  assert(errno == EINVAL);
+
+  assert(dev.flush () == 0);
+  assert(dev.discard (2, 1) == 0);
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  {
+    // Default implementations.
+    BlockDevice dev;
+    char buf[512];
+
+    assert(dev.getBlocksCount () == 0);
+
+    errno = 0;
+    assert(dev.read (buf, 0, 1) == -1);
+    assert(errno == EINVAL);
+  }
+
+  {
+    RamBlockDevice dev (512, 16);
+    testDevice (dev);
+
+    // Discarded blocks read as zeros.
+    char buf[512];
+    assert(dev.read (buf, 2, 1) == 1);
+    for (std::size_t i = 0; i < sizeof(buf); ++i)
+      {
+        assert(buf[i] == 0);
+      }
+  }
+
+  {
+    // External storage.
+    static std::uint8_t storage[8 * 512];
+    RamBlockDevice dev (storage, 512, 8);
+    testDevice (dev);
+
+    char buf[512];
+    std::memset (buf, 0x5A, sizeof(buf));
+    assert(dev.write (buf, 7, 1) == 1);
+    assert(storage[7 * 512] == 0x5A);
+  }
+
+  {
+    char path[] = "/tmp/posix-io-bd-XXXXXX";
+    int fd = mkstemp (path);
+    assert(fd >= 0);
+    ::close (fd);
+
+    {
+      HostFileBlockDevice dev;
+
+      errno = 0;
+      assert(dev.close () == -1);
+      assert(errno == EBADF);
+
+      assert(dev.open (path, 32) == 0);
+      assert(dev.getBlocksCount () == 32);
+      testDevice (dev);
+
+      // Already open.
+      errno = 0;
+      assert(dev.open (path) == -1);
+      assert(errno == EBUSY);
+
+      assert(dev.close () == 0);
+    }
+
+    {
+      // Reopen with the size of the existing image.
+      HostFileBlockDevice dev;
+      assert(dev.open (path) == 0);
+      assert(dev.getBlocksCount () == 32);
+
+      char buf[512];
+      assert(dev.read (buf, 5, 1) == 1);
+      assert(buf[0] == static_cast<char> (512 * 7 + 1));
+    }
+
+    ::unlink (path);
+  }
+
+  trace_puts ("'test-block-device-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
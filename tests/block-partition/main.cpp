@@ -0,0 +1,334 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/PartitionBlockDevice.h"
+#include "posix-io/BlockCache.h"
+#include "posix-io/BlockRequest.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/hash.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr BlockDevice::blockNumber_t BLOCKS = 256;
+
+// ----------------------------------------------------------------------------
+
+// File system doing nothing, only to mount partitions.
+class TestFileSystem : public FileSystem
+{
+public:
+
+  TestFileSystem ();
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+};
+
+TestFileSystem::TestFileSystem () :
+    FileSystem (nullptr, nullptr)
+{
+  ;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------------
+
+MountManager mm
+  { 2 };
+
+static void
+put32 (std::uint8_t* p, std::uint32_t v)
+{
+  p[0] = static_cast<std::uint8_t> (v);
+  p[1] = static_cast<std::uint8_t> (v >> 8);
+  p[2] = static_cast<std::uint8_t> (v >> 16);
+  p[3] = static_cast<std::uint8_t> (v >> 24);
+}
+
+static void
+put64 (std::uint8_t* p, std::uint64_t v)
+{
+  put32 (p, static_cast<std::uint32_t> (v));
+  put32 (p + 4, static_cast<std::uint32_t> (v >> 32));
+}
+
+static void
+mbrEntry (std::uint8_t* sector, std::size_t index, std::uint8_t type,
+          std::uint32_t first, std::uint32_t count)
+{
+  std::uint8_t* e = sector + 446 + index * 16;
+  e[4] = type;
+  put32 (e + 8, first);
+  put32 (e + 12, count);
+  sector[510] = 0x55;
+  sector[511] = 0xAA;
+}
+
+// Write a GPT header at `lba`, with its entries at `entriesLba`.
+static void
+gptHeader (BlockDevice& dev, BlockDevice::blockNumber_t lba,
+           BlockDevice::blockNumber_t entriesLba, std::uint32_t entries)
+{
+  std::uint8_t table[4 * BLOCK_SIZE];
+  assert(entries * 128 <= sizeof(table));
+  assert(dev.read (table, entriesLba, 4) == 4);
+
+  std::uint8_t sector[BLOCK_SIZE];
+  std::memset (sector, 0, sizeof(sector));
+  std::memcpy (sector, "EFI PART", 8);
+  put32 (sector + 8, 0x00010000);
+  put32 (sector + 12, 92);
+  put64 (sector + 24, lba);
+  put64 (sector + 72, entriesLba);
+  put32 (sector + 80, entries);
+  put32 (sector + 84, 128);
+  put32 (sector + 88, crc32 (table, entries * 128));
+  put32 (sector + 16, crc32 (sector, 92));
+  assert(dev.write (sector, lba, 1) == 1);
+}
+
+static void
+gptEntry (std::uint8_t* table, std::size_t index, std::uint8_t type,
+          std::uint64_t first, std::uint64_t last, const char* name)
+{
+  std::uint8_t* e = table + index * 128;
+  std::memset (e, type, 16);
+  put64 (e + 32, first);
+  put64 (e + 40, last);
+  for (std::size_t i = 0; name[i] != '\0'; ++i)
+    {
+      e[56 + 2 * i] = static_cast<std::uint8_t> (name[i]);
+    }
+}
+
+static void
+fill (char* buf, std::size_t blocks, char c)
+{
+  std::memset (buf, c, blocks * BLOCK_SIZE);
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  std::uint8_t sector[BLOCK_SIZE];
+  char buf[4 * BLOCK_SIZE];
+
+  {
+    // No partition table.
+    RamBlockDevice dev (BLOCK_SIZE, BLOCKS);
+    PartitionBlockDevice parts[4];
+    assert(PartitionBlockDevice::scan (&dev, parts, 4) == -1);
+    assert(errno == ENODEV);
+
+    // Ranges outside the parent are rejected.
+    assert(parts[0].configure (&dev, BLOCKS - 1, 2) == -1);
+    assert(errno == EINVAL);
+    assert(parts[0].configure (&dev, BLOCKS - 2, 2) == 0);
+    assert(parts[0].getBlocksCount () == 2);
+  }
+
+  {
+    // MBR with two primary and two logical partitions.
+    RamBlockDevice dev (BLOCK_SIZE, BLOCKS);
+
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0x83, 8, 32);
+    mbrEntry (sector, 1, 0x05, 64, 128);
+    mbrEntry (sector, 3, 0x0C, 200, 40);
+    assert(dev.write (sector, 0, 1) == 1);
+
+    // First EBR, with a link to the second one, relative to the
+    // extended partition.
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0x83, 1, 16);
+    mbrEntry (sector, 1, 0x05, 32, 64);
+    assert(dev.write (sector, 64, 1) == 1);
+
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0x82, 2, 8);
+    assert(dev.write (sector, 96, 1) == 1);
+
+    PartitionBlockDevice parts[8];
+    assert(PartitionBlockDevice::scan (&dev, parts, 8) == 4);
+
+    assert(parts[0].getType () == 0x83);
+    assert(parts[0].getFirstBlock () == 8);
+    assert(parts[0].getBlocksCount () == 32);
+    assert(parts[1].getType () == 0x0C);
+    assert(parts[1].getFirstBlock () == 200);
+    assert(parts[2].getFirstBlock () == 65);
+    assert(parts[2].getBlocksCount () == 16);
+    assert(parts[3].getType () == 0x82);
+    assert(parts[3].getFirstBlock () == 98);
+    assert(parts[3].getBlocksCount () == 8);
+    assert(parts[3].getName ()[0] == '\0');
+
+    // Fewer slots than partitions.
+    assert(PartitionBlockDevice::scan (&dev, parts, 1) == 1);
+
+    // Transfers are translated, and limited to the partition.
+    fill (buf, 2, 'a');
+    assert(parts[0].write (buf, 30, 2) == 2);
+    fill (buf, 2, 0);
+    assert(dev.read (buf, 38, 2) == 2);
+    assert(buf[0] == 'a' && buf[2 * BLOCK_SIZE - 1] == 'a');
+    assert(parts[0].write (buf, 31, 2) == -1);
+    assert(errno == EINVAL);
+
+    // An EBR chain looping back ends.
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0x82, 2, 8);
+    mbrEntry (sector, 1, 0x05, 0, 8);
+    assert(dev.write (sector, 96, 1) == 1);
+    assert(PartitionBlockDevice::scan (&dev, parts, 8) == 4);
+  }
+
+  {
+    // GPT, with a damaged primary header.
+    RamBlockDevice dev (BLOCK_SIZE, BLOCKS);
+
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0xEE, 1, BLOCKS - 1);
+    assert(dev.write (sector, 0, 1) == 1);
+
+    std::uint8_t table[4 * BLOCK_SIZE];
+    std::memset (table, 0, sizeof(table));
+    gptEntry (table, 0, 0xA1, 34, 99, "boot");
+    gptEntry (table, 2, 0xB2, 100, 219, "data");
+    assert(dev.write (table, 2, 4) == 4);
+    assert(dev.write (table, BLOCKS - 5, 4) == 4);
+    gptHeader (dev, 1, 2, 16);
+    gptHeader (dev, BLOCKS - 1, BLOCKS - 5, 16);
+
+    PartitionBlockDevice parts[4];
+    assert(PartitionBlockDevice::scan (&dev, parts, 4) == 2);
+    assert(parts[0].getFirstBlock () == 34);
+    assert(parts[0].getBlocksCount () == 66);
+    assert(parts[0].getType () == 0);
+    assert(parts[0].getTypeGuid ()[15] == 0xA1);
+    assert(std::strcmp (parts[0].getName (), "boot") == 0);
+    assert(parts[1].getFirstBlock () == 100);
+    assert(parts[1].getBlocksCount () == 120);
+    assert(std::strcmp (parts[1].getName (), "data") == 0);
+
+    // A corrupted entries array invalidates the primary table, the
+    // backup one is used.
+    gptEntry (table, 0, 0xA1, 34, 49, "boot");
+    assert(dev.write (table, 2, 1) == 1);
+    assert(PartitionBlockDevice::scan (&dev, parts, 4) == 2);
+    assert(parts[0].getBlocksCount () == 66);
+
+    // Both damaged.
+    std::memset (sector, 0, sizeof(sector));
+    assert(dev.write (sector, BLOCKS - 1, 1) == 1);
+    assert(PartitionBlockDevice::scan (&dev, parts, 4) == -1);
+    assert(errno == ENODEV);
+
+    // A valid primary header again.
+    gptHeader (dev, 1, 2, 16);
+    assert(PartitionBlockDevice::scan (&dev, parts, 4) == 2);
+    assert(parts[0].getBlocksCount () == 16);
+  }
+
+  {
+    // Partitions over a shared cache, mounted separately.
+    RamBlockDevice dev (BLOCK_SIZE, BLOCKS);
+    std::memset (sector, 0, sizeof(sector));
+    mbrEntry (sector, 0, 0x83, 16, 64);
+    mbrEntry (sector, 1, 0x83, 80, 64);
+    assert(dev.write (sector, 0, 1) == 1);
+
+    BlockCache cache (&dev, 8);
+    PartitionBlockDevice parts[4];
+    assert(PartitionBlockDevice::scan (&cache, parts, 4) == 2);
+    assert(parts[0].getParent () == &cache);
+    assert(parts[0].getBlockCache () == nullptr);
+
+    TestFileSystem fs0;
+    TestFileSystem fs1;
+    assert(mm.mount (&fs0, "/p0/", &parts[0], 0) == 0);
+    assert(mm.mount (&fs1, "/p1/", &parts[1], 0) == 0);
+
+    fill (buf, 1, 'x');
+    assert(parts[1].write (buf, 0, 1) == 1);
+    fill (buf, 1, 0);
+    assert(dev.read (buf, 80, 1) == 1);
+    assert(buf[0] == 0); // Still in the cache.
+
+    // The same block through the parent is a cache hit.
+    std::size_t hits = cache.getHits ();
+    assert(cache.read (buf, 80, 1) == 1);
+    assert(buf[0] == 'x');
+    assert(cache.getHits () == hits + 1);
+
+    // Asynchronous requests are translated too.
+    fill (buf, 1, 0);
+    BlockRequest request;
+    request.prepareRead (buf, 0, 1);
+    assert(parts[1].execute (&request) == 1);
+    assert(buf[0] == 'x');
+    assert(request.getBlock () == 80);
+
+    os::posix::sync ();
+    fill (buf, 1, 0);
+    assert(dev.read (buf, 80, 1) == 1);
+    assert(buf[0] == 'x');
+
+    assert(mm.umount ("/p0/", 0) == 0);
+    assert(mm.umount ("/p1/", 0) == 0);
+  }
+
+  trace_puts ("'test-block-partition-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
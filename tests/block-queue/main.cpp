@@ -0,0 +1,289 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockRequestQueue.h"
+#include "posix-io/RamBlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+
+// RAM device remembering the write requests that reach it.
+class RecordingBlockDevice : public RamBlockDevice
+{
+public:
+
+  RecordingBlockDevice (blockNumber_t blocksCount);
+
+  // First block and number of blocks of each request.
+  std::vector<blockNumber_t> firstBlocks;
+  std::vector<std::size_t> counts;
+
+protected:
+
+  virtual ssize_t
+  do_writev (const struct iovec* iov, int iovcnt, blockNumber_t block)
+      override;
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count)
+      override;
+
+private:
+
+  bool fInVector;
+};
+
+RecordingBlockDevice::RecordingBlockDevice (blockNumber_t blocksCount) :
+    RamBlockDevice (BLOCK_SIZE, blocksCount)
+{
+  fInVector = false;
+}
+
+ssize_t
+RecordingBlockDevice::do_writev (const struct iovec* iov, int iovcnt,
+                                 blockNumber_t block)
+{
+  std::size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    {
+      total += iov[i].iov_len;
+    }
+  firstBlocks.push_back (block);
+  counts.push_back (total / BLOCK_SIZE);
+
+  fInVector = true;
+  ssize_t ret = RamBlockDevice::do_writev (iov, iovcnt, block);
+  fInVector = false;
+  return ret;
+}
+
+ssize_t
+RecordingBlockDevice::do_write (const void* buf, blockNumber_t block,
+                                std::size_t count)
+{
+  if (!fInVector)
+    {
+      firstBlocks.push_back (block);
+      counts.push_back (count);
+    }
+  return RamBlockDevice::do_write (buf, block, count);
+}
+
+// ----------------------------------------------------------------------------
+
+static void
+fill (char* buf, BlockDevice::blockNumber_t block, char version)
+{
+  std::memset (buf, static_cast<int> (block + 1), BLOCK_SIZE);
+  buf[0] = version;
+}
+
+static bool
+check (const char* buf, BlockDevice::blockNumber_t block, char version)
+{
+  if (buf[0] != version)
+    {
+      return false;
+    }
+  for (std::size_t i = 1; i < BLOCK_SIZE; ++i)
+    {
+      if (buf[i] != static_cast<char> (block + 1))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+constexpr std::size_t THREADS = 4;
+constexpr BlockDevice::blockNumber_t THREAD_BLOCKS = 64;
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  char buf[BLOCK_SIZE];
+
+  {
+    RecordingBlockDevice dev (64);
+    BlockRequestQueue queue (&dev, 8);
+
+    assert(queue.getBlockSize () == BLOCK_SIZE);
+    assert(queue.getBlocksCount () == 64);
+
+    // Not plugged, writes go directly to the device.
+    fill (buf, 1, 'a');
+    assert(queue.write (buf, 1, 1) == 1);
+    assert(dev.counts.size () == 1);
+    assert(queue.getDepth () == 0);
+
+    // Plugged, writes are queued, sorted and merged.
+    queue.plug ();
+    const BlockDevice::blockNumber_t blocks[] =
+      { 5, 3, 4, 11, 10, 3 };
+    char version = 'a';
+    for (auto b : blocks)
+      {
+        fill (buf, b, version++);
+        assert(queue.write (buf, b, 1) == 1);
+      }
+    assert(dev.counts.size () == 1);
+    assert(queue.getDepth () == 5);
+    assert(queue.getMaxDepth () == 5);
+    assert(queue.getQueuedBlocks () == 6);
+    assert(queue.getAbsorbedBlocks () == 1);
+
+    // Nested plug.
+    queue.plug ();
+    assert(queue.unplug () == 0);
+    assert(queue.getDepth () == 5);
+
+    assert(queue.unplug () == 0);
+    assert(queue.getDepth () == 0);
+
+    // Two requests, [3..5] and [10..11], in ascending order.
+    assert(dev.counts.size () == 3);
+    assert(dev.firstBlocks[1] == 3);
+    assert(dev.counts[1] == 3);
+    assert(dev.firstBlocks[2] == 10);
+    assert(dev.counts[2] == 2);
+    assert(queue.getMergedBlocks () == 3);
+
+    // The last write of block 3 won.
+    assert(dev.read (buf, 3, 1) == 1);
+    assert(check (buf, 3, 'f'));
+    assert(dev.read (buf, 11, 1) == 1);
+    assert(check (buf, 11, 'd'));
+
+    // Elevator order, continuing after the last dispatched block.
+    queue.plug ();
+    const BlockDevice::blockNumber_t elevator[] =
+      { 2, 20, 15 };
+    for (auto b : elevator)
+      {
+        fill (buf, b, 'x');
+        assert(queue.write (buf, b, 1) == 1);
+      }
+    assert(queue.unplug () == 0);
+    assert(dev.counts.size () == 6);
+    assert(dev.firstBlocks[3] == 15);
+    assert(dev.firstBlocks[4] == 20);
+    assert(dev.firstBlocks[5] == 2);
+
+    // Reads see the queued writes.
+    queue.plug ();
+    fill (buf, 30, 'r');
+    assert(queue.write (buf, 30, 1) == 1);
+    std::memset (buf, 0, sizeof(buf));
+    assert(queue.read (buf, 30, 1) == 1);
+    assert(check (buf, 30, 'r'));
+    assert(queue.getDepth () == 0);
+
+    // A full queue is dispatched.
+    for (BlockDevice::blockNumber_t b = 40; b < 49; ++b)
+      {
+        fill (buf, b, 'y');
+        assert(queue.write (buf, b, 1) == 1);
+      }
+    assert(queue.getDepth () == 1);
+
+    // Discarded blocks are dropped from the queue.
+    std::size_t requests = dev.counts.size ();
+    assert(queue.discard (48, 1) == 0);
+    assert(queue.getDepth () == 0);
+    assert(queue.unplug () == 0);
+    assert(dev.counts.size () == requests);
+
+    // Flush dispatches.
+    queue.plug ();
+    fill (buf, 50, 'z');
+    assert(queue.write (buf, 50, 1) == 1);
+    assert(queue.flush () == 0);
+    assert(queue.getDepth () == 0);
+    assert(queue.unplug () == 0);
+  }
+
+  {
+    // Several threads writing interleaved blocks during a burst.
+    RecordingBlockDevice dev (THREADS * THREAD_BLOCKS);
+    BlockRequestQueue queue (&dev, THREADS * THREAD_BLOCKS);
+
+    queue.plug ();
+
+    std::thread threads[THREADS];
+    for (std::size_t t = 0; t < THREADS; ++t)
+      {
+        threads[t] = std::thread ([&queue, t]
+          {
+            char tbuf[BLOCK_SIZE];
+            for (BlockDevice::blockNumber_t i = 0; i < THREAD_BLOCKS; ++i)
+              {
+                // Block i * THREADS + t, interleaved with the others.
+                auto b = static_cast<BlockDevice::blockNumber_t> (
+                    i * THREADS + t);
+                fill (tbuf, b, 't');
+                assert(queue.write (tbuf, b, 1) == 1);
+              }
+          });
+      }
+    for (auto& th : threads)
+      {
+        th.join ();
+      }
+
+    assert(queue.unplug () == 0);
+
+    // All blocks are contiguous, written with the maximum run size.
+    std::size_t total = THREADS * THREAD_BLOCKS;
+    assert(dev.counts.size () == total / OS_INTEGER_BLOCK_QUEUE_RUN_MAX);
+    assert(queue.getMergedBlocks () == total - dev.counts.size ());
+
+    for (BlockDevice::blockNumber_t b = 0; b < total; ++b)
+      {
+        assert(dev.read (buf, b, 1) == 1);
+        assert(check (buf, b, 't'));
+      }
+  }
+
+  trace_puts ("'test-block-queue-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
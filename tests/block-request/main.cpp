@@ -0,0 +1,355 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockRequest.h"
+#include "posix-io/BlockCache.h"
+#include "posix-io/RamBlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr std::size_t QUEUE_SIZE = 8;
+
+// RAM device completing the requests from a separate thread, like a
+// DMA controller, only while the gate is open.
+class AsyncBlockDevice : public RamBlockDevice
+{
+public:
+
+  AsyncBlockDevice (blockNumber_t blocksCount);
+
+  ~AsyncBlockDevice ();
+
+  std::atomic<bool> gate;
+  std::atomic<std::size_t> submitted;
+
+protected:
+
+  virtual int
+  do_submit (BlockRequest* request) override;
+
+  // The synchronous functions use the asynchronous path.
+
+  virtual ssize_t
+  do_read (void* buf, blockNumber_t block, std::size_t count) override;
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count)
+      override;
+
+private:
+
+  void
+  run (void);
+
+  std::mutex fMutex;
+  BlockRequest* fQueue[QUEUE_SIZE];
+  std::size_t fCount;
+  std::atomic<bool> fStop;
+  std::thread fThread;
+};
+
+AsyncBlockDevice::AsyncBlockDevice (blockNumber_t blocksCount) :
+    RamBlockDevice (BLOCK_SIZE, blocksCount)
+{
+  gate.store (true);
+  submitted.store (0);
+  fCount = 0;
+  fStop.store (false);
+  fThread = std::thread (&AsyncBlockDevice::run, this);
+}
+
+AsyncBlockDevice::~AsyncBlockDevice ()
+{
+  fStop.store (true);
+  fThread.join ();
+}
+
+int
+AsyncBlockDevice::do_submit (BlockRequest* request)
+{
+  std::lock_guard<std::mutex> lock (fMutex);
+  if (fCount == QUEUE_SIZE)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  fQueue[fCount++] = request;
+  ++submitted;
+  return 0;
+}
+
+ssize_t
+AsyncBlockDevice::do_read (void* buf, blockNumber_t block, std::size_t count)
+{
+  BlockRequest request;
+  request.prepareRead (buf, block, count);
+  return execute (&request);
+}
+
+ssize_t
+AsyncBlockDevice::do_write (const void* buf, blockNumber_t block,
+                            std::size_t count)
+{
+  BlockRequest request;
+  request.prepareWrite (buf, block, count);
+  return execute (&request);
+}
+
+void
+AsyncBlockDevice::run (void)
+{
+  while (!fStop.load ())
+    {
+      BlockRequest* request = nullptr;
+      if (gate.load ())
+        {
+          std::lock_guard<std::mutex> lock (fMutex);
+          if (fCount > 0)
+            {
+              request = fQueue[0];
+              std::memmove (&fQueue[0], &fQueue[1],
+                            (fCount - 1) * sizeof(fQueue[0]));
+              --fCount;
+            }
+        }
+
+      if (request == nullptr)
+        {
+          std::this_thread::yield ();
+          continue;
+        }
+
+      // Transfer with the RAM implementation.
+      ssize_t ret = 0;
+      const struct iovec* iov = request->getIov ();
+      blockNumber_t block = request->getBlock ();
+      for (int i = 0; i < request->getIovcnt (); ++i)
+        {
+          std::size_t count = iov[i].iov_len / BLOCK_SIZE;
+          if (request->getOperation () == BlockRequest::READ)
+            {
+              RamBlockDevice::do_read (iov[i].iov_base, block, count);
+            }
+          else if (request->getOperation () == BlockRequest::WRITE)
+            {
+              RamBlockDevice::do_write (iov[i].iov_base, block, count);
+            }
+          block += static_cast<blockNumber_t> (count);
+          ret += static_cast<ssize_t> (count);
+        }
+      request->complete (ret);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static std::atomic<std::size_t> completions;
+
+static void
+countCompletion (BlockRequest* request, void* arg)
+{
+  assert(arg == &completions);
+  assert(request->getResult () >= 0 || request->getError () != 0);
+  ++completions;
+}
+
+static void
+fill (char* buf, std::size_t size, char c)
+{
+  std::memset (buf, c, size);
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  char buf[4 * BLOCK_SIZE];
+
+  {
+    // The default implementation completes synchronously.
+    RamBlockDevice dev (BLOCK_SIZE, 16);
+    BlockRequest request;
+
+    assert(request.isDone ());
+
+    completions = 0;
+    request.setCallback (countCompletion, &completions);
+
+    fill (buf, 2 * BLOCK_SIZE, 'w');
+    request.prepareWrite (buf, 3, 2);
+    assert(dev.submit (&request) == 0);
+    assert(request.isDone ());
+    assert(completions == 1);
+    assert(request.getCount () == 2);
+    assert(request.wait () == 2);
+
+    std::memset (buf, 0, sizeof(buf));
+    request.prepareRead (buf, 3, 2);
+    assert(dev.execute (&request) == 2);
+    assert(buf[0] == 'w' && buf[2 * BLOCK_SIZE - 1] == 'w');
+    assert(completions == 2);
+
+    // Vectored.
+    struct iovec iov[2];
+    iov[0].iov_base = buf;
+    iov[0].iov_len = BLOCK_SIZE;
+    iov[1].iov_base = buf + BLOCK_SIZE;
+    iov[1].iov_len = 2 * BLOCK_SIZE;
+    request.prepareReadv (iov, 2, 2);
+    assert(dev.execute (&request) == 3);
+
+    request.prepareFlush ();
+    assert(dev.execute (&request) == 0);
+
+    // Invalid requests complete with the error.
+    request.prepareRead (buf, 15, 2);
+    errno = 0;
+    assert(dev.submit (&request) == -1);
+    assert(errno == EINVAL);
+    assert(request.isDone ());
+    assert(request.getError () == EINVAL);
+    errno = 0;
+    assert(request.wait () == -1);
+    assert(errno == EINVAL);
+    assert(completions == 5);
+
+    // Empty request.
+    request.prepareRead (buf, 0, 0);
+    assert(dev.execute (&request) == 0);
+  }
+
+  {
+    // Several transfers in progress at the same time.
+    AsyncBlockDevice dev (64);
+    BlockRequest requests[3];
+    static char data[3][BLOCK_SIZE];
+
+    completions = 0;
+    dev.gate.store (false);
+    for (std::size_t i = 0; i < 3; ++i)
+      {
+        fill (data[i], BLOCK_SIZE, static_cast<char> ('a' + i));
+        requests[i].setCallback (countCompletion, &completions);
+        requests[i].prepareWrite (data[i],
+                                  static_cast<BlockDevice::blockNumber_t> (i),
+                                  1);
+        assert(dev.submit (&requests[i]) == 0);
+      }
+
+    // Nothing completed while the device is busy.
+    std::this_thread::yield ();
+    for (auto& request : requests)
+      {
+        assert(!request.isDone ());
+      }
+
+    dev.gate.store (true);
+    for (auto& request : requests)
+      {
+        assert(request.wait () == 1);
+      }
+    assert(completions == 3);
+
+    // The synchronous functions still work.
+    assert(dev.read (buf, 0, 3) == 3);
+    assert(buf[0] == 'a' && buf[BLOCK_SIZE] == 'b');
+    assert(buf[2 * BLOCK_SIZE] == 'c');
+
+    // Errors from the driver complete the request.
+    BlockRequest many[QUEUE_SIZE + 1];
+    dev.gate.store (false);
+    for (std::size_t i = 0; i < QUEUE_SIZE; ++i)
+      {
+        many[i].prepareRead (buf, 0, 1);
+        assert(dev.submit (&many[i]) == 0);
+      }
+    many[QUEUE_SIZE].prepareRead (buf, 0, 1);
+    errno = 0;
+    assert(dev.submit (&many[QUEUE_SIZE]) == -1);
+    assert(errno == EAGAIN);
+    assert(many[QUEUE_SIZE].isDone ());
+    dev.gate.store (true);
+    for (std::size_t i = 0; i < QUEUE_SIZE; ++i)
+      {
+        assert(many[i].wait () == 1);
+      }
+  }
+
+  {
+    // The cache prefetches without waiting.
+    AsyncBlockDevice dev (64);
+    for (BlockDevice::blockNumber_t b = 0; b < 64; ++b)
+      {
+        fill (buf, BLOCK_SIZE, static_cast<char> (b));
+        assert(dev.write (buf, b, 1) == 1);
+      }
+
+    BlockCache cache (&dev, 32);
+
+    std::size_t submitted = dev.submitted;
+    dev.gate.store (false);
+    assert(cache.prefetch (10, 8) == 0);
+    assert(dev.submitted == submitted + 1);
+    dev.gate.store (true);
+
+    // Served from the prefetched blocks, after waiting for them.
+    for (BlockDevice::blockNumber_t b = 10; b < 18; ++b)
+      {
+        assert(cache.read (buf, b, 1) == 1);
+        assert(buf[0] == static_cast<char> (b));
+      }
+    assert(cache.getHits () == 8);
+    assert(cache.getMisses () == 0);
+    assert(dev.submitted == submitted + 1);
+
+    // Writing a block being prefetched keeps the new content.
+    dev.gate.store (false);
+    assert(cache.prefetch (20, 1) == 0);
+    dev.gate.store (true);
+    fill (buf, BLOCK_SIZE, 'n');
+    assert(cache.write (buf, 20, 1) == 1);
+    assert(cache.read (buf, 20, 1) == 1);
+    assert(buf[0] == 'n');
+  }
+
+  trace_puts ("'test-block-request-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
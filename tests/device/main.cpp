@@ -37,6 +37,7 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
 #include <fcntl.h>
 
 #if defined(__ARM_EABI__)
@@ -145,6 +146,68 @@ TestDevice::do_vopen (const char* path, int oflag, va_list args)
 
 // ----------------------------------------------------------------------------
 
+// Test class, matches all names starting with its own name, like
+// "/dev/tty0", "/dev/tty1".
+
+class TestPatternDevice : public TestDevice
+{
+public:
+
+  TestPatternDevice (const char* deviceName, uint32_t deviceNumber);
+
+  virtual bool
+  matchName (const char* name) const override;
+
+  virtual bool
+  hasNamePattern (void) const override;
+};
+
+TestPatternDevice::TestPatternDevice (const char* deviceName,
+                                      uint32_t deviceNumber) :
+    TestDevice (deviceName, deviceNumber)
+{
+  ;
+}
+
+bool
+TestPatternDevice::matchName (const char* name) const
+{
+  return (std::strncmp (name, getName (), std::strlen (getName ())) == 0);
+}
+
+bool
+TestPatternDevice::hasNamePattern (void) const
+{
+  return true;
+}
+
+// Test class, also matches an alias, without telling the registry.
+
+class TestAliasDevice : public TestDevice
+{
+public:
+
+  TestAliasDevice (const char* deviceName, uint32_t deviceNumber);
+
+  virtual bool
+  matchName (const char* name) const override;
+};
+
+TestAliasDevice::TestAliasDevice (const char* deviceName,
+                                  uint32_t deviceNumber) :
+    TestDevice (deviceName, deviceNumber)
+{
+  ;
+}
+
+bool
+TestAliasDevice::matchName (const char* name) const
+{
+  return TestDevice::matchName (name) || (std::strcmp (name, "alias") == 0);
+}
+
+// ----------------------------------------------------------------------------
+
 #define DESCRIPTORS_ARRAY_SIZE (5)
 os::posix::FileDescriptorsManager descriptorsManager
   { DESCRIPTORS_ARRAY_SIZE };
@@ -157,6 +220,17 @@ os::posix::CharDevicesRegistry devicesRegistry
 TestDevice test
   { "test", 1 };
 
+TestDevice other
+  { "other", 2 };
+
+// This device will be mapped as "/dev/tty*"
+TestPatternDevice tty
+  { "tty", 3 };
+
+// This device will be mapped as "/dev/aliased" and "/dev/alias"
+TestAliasDevice aliased
+  { "aliased", 4 };
+
 // ----------------------------------------------------------------------------
 
 int
@@ -177,6 +251,36 @@ main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
   // Check if first device is registered.
   assert (os::posix::CharDevicesRegistry::getDevice (0) == &test);
 
+    {
+      // Test the name lookup.
+
+      os::posix::CharDevicesRegistry::add (&tty);
+      os::posix::CharDevicesRegistry::add (&other);
+
+      using Registry = os::posix::CharDevicesRegistry;
+      assert (Registry::identifyDevice ("/dev/test") == &test);
+      assert (Registry::identifyDevice ("/dev/other") == &other);
+      assert (Registry::identifyDevice ("/dev/tty0") == &tty);
+      assert (Registry::identifyDevice ("/dev/tty") == &tty);
+      assert (Registry::identifyDevice ("/dev/tes") == nullptr);
+      assert (Registry::identifyDevice ("/dev/test1") == nullptr);
+      assert (Registry::identifyDevice ("/dex/test") == nullptr);
+
+      os::posix::CharDevicesRegistry::remove (&other);
+      assert (Registry::identifyDevice ("/dev/other") == nullptr);
+      os::posix::CharDevicesRegistry::remove (&tty);
+      assert (Registry::identifyDevice ("/dev/tty0") == nullptr);
+      assert (Registry::identifyDevice ("/dev/test") == &test);
+
+      // Overriding only matchName() still matches.
+      os::posix::CharDevicesRegistry::add (&aliased);
+      assert (Registry::identifyDevice ("/dev/aliased") == &aliased);
+      assert (Registry::identifyDevice ("/dev/alias") == &aliased);
+      assert (Registry::identifyDevice ("/dev/alia") == nullptr);
+      os::posix::CharDevicesRegistry::remove (&aliased);
+      assert (Registry::identifyDevice ("/dev/alias") == nullptr);
+    }
+
     {
       // Test C++ API
 
@@ -0,0 +1,304 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/DirectoryIndex.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+static std::uint32_t
+hashName (const char* name)
+{
+  std::uint32_t hash = 2166136261u;
+  for (; *name != '\0'; ++name)
+    {
+      hash ^= static_cast<std::uint8_t> (*name);
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+// All the values of a hash, in any order.
+static bool
+finds (DirectoryIndex& index, std::uint32_t dir, std::uint32_t hash,
+       const std::uint32_t* values, std::size_t count)
+{
+  std::size_t cursor = 0;
+  std::uint32_t value;
+  std::size_t found = 0;
+  while (index.lookup (dir, hash, &cursor, &value))
+    {
+      bool known = false;
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          known = known || (values[i] == value);
+        }
+      if (!known)
+        {
+          return false;
+        }
+      ++found;
+    }
+  return found == count;
+}
+
+constexpr std::size_t NAME_SIZE = 16;
+constexpr std::size_t BENCH_LOOKUPS = 2000;
+
+// A directory of `count` names, searched linearly and with an index.
+static void
+benchmark (std::size_t count)
+{
+  auto* names = new char[count][NAME_SIZE];
+  DirectoryIndex index
+    { count, 1 };
+
+  index.begin (1);
+  for (std::size_t i = 0; i < count; ++i)
+    {
+      std::snprintf (names[i], NAME_SIZE, "name-%u",
+                     static_cast<unsigned int> (i));
+      assert(index.add (1, hashName (names[i]), static_cast<std::uint32_t> (i)));
+    }
+  index.commit (1);
+  assert(index.getUsed () == count);
+
+  char query[NAME_SIZE];
+  std::size_t found = 0;
+
+  auto begin = std::chrono::steady_clock::now ();
+  for (std::size_t n = 0; n < BENCH_LOOKUPS; ++n)
+    {
+      std::snprintf (query, NAME_SIZE, "name-%u",
+                     static_cast<unsigned int> ((n * 7919) % count));
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          if (std::strcmp (names[i], query) == 0)
+            {
+              ++found;
+              break;
+            }
+        }
+    }
+  auto middle = std::chrono::steady_clock::now ();
+  for (std::size_t n = 0; n < BENCH_LOOKUPS; ++n)
+    {
+      std::snprintf (query, NAME_SIZE, "name-%u",
+                     static_cast<unsigned int> ((n * 7919) % count));
+      std::size_t cursor = 0;
+      std::uint32_t value;
+      while (index.lookup (1, hashName (query), &cursor, &value))
+        {
+          if (std::strcmp (names[value], query) == 0)
+            {
+              ++found;
+              break;
+            }
+        }
+    }
+  auto end = std::chrono::steady_clock::now ();
+
+  assert(found == 2 * BENCH_LOOKUPS);
+  // There are as many buckets as entries, the chains are short.
+  assert(index.getLookups () == BENCH_LOOKUPS);
+  assert(index.getCandidates () < 2 * BENCH_LOOKUPS);
+
+  std::chrono::duration<double, std::nano> linear = middle - begin;
+  std::chrono::duration<double, std::nano> indexed = end - middle;
+  trace_printf ("%6u names: linear %.0f ns, indexed %.0f ns per lookup\n",
+                static_cast<unsigned int> (count),
+                linear.count () / BENCH_LOOKUPS,
+                indexed.count () / BENCH_LOOKUPS);
+
+  delete[] names;
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  const std::uint32_t zeroFive[] =
+    { 0, 5 };
+  const std::uint32_t two[] =
+    { 2 };
+  const std::uint32_t four[] =
+    { 4 };
+  const std::uint32_t five[] =
+    { 5 };
+  const std::uint32_t nine[] =
+    { 9 };
+
+  {
+    // Names added while indexing, with a collision.
+    DirectoryIndex index
+      { 16, 4 };
+    assert(index.getSize () == 16);
+    assert(!index.isIndexed (1));
+
+    index.begin (1);
+    assert(index.add (1, 100, 0));
+    assert(index.add (1, 200, 2));
+    assert(index.add (1, 100, 5));
+    // Not complete yet.
+    assert(!index.isIndexed (1));
+    assert(finds (index, 1, 100, nullptr, 0));
+    index.commit (1, 7);
+
+    assert(index.isIndexed (1));
+    assert(index.getUsed () == 3);
+    assert(index.getHint (1) == 7);
+    assert(finds (index, 1, 100, zeroFive, 2));
+    assert(finds (index, 1, 200, two, 1));
+    assert(finds (index, 1, 300, nullptr, 0));
+    // Not in another directory.
+    assert(!index.isIndexed (2));
+    assert(finds (index, 2, 100, nullptr, 0));
+    assert(index.getHint (2) == 0);
+
+    // Kept up to date.
+    index.insert (1, 300, 9);
+    index.remove (1, 100, 0);
+    index.remove (1, 100, 1);
+    assert(index.getUsed () == 3);
+    assert(finds (index, 1, 100, five, 1));
+    assert(finds (index, 1, 300, nine, 1));
+    index.setHint (1, 3);
+    assert(index.getHint (1) == 3);
+
+    // Not indexed, ignored.
+    index.insert (2, 100, 1);
+    assert(index.getUsed () == 3);
+
+    // Indexing again replaces the names.
+    index.begin (1);
+    assert(index.getUsed () == 0);
+    assert(index.add (1, 400, 4));
+    index.commit (1);
+    assert(finds (index, 1, 100, nullptr, 0));
+    assert(finds (index, 1, 400, four, 1));
+
+    index.drop (1);
+    assert(!index.isIndexed (1));
+    assert(index.getUsed () == 0);
+  }
+
+  {
+    // The least recently used directories make room.
+    DirectoryIndex index
+      { 4, 4 };
+
+    index.begin (1);
+    assert(index.add (1, 1, 0));
+    assert(index.add (1, 2, 1));
+    index.commit (1);
+    index.begin (2);
+    assert(index.add (2, 1, 0));
+    assert(index.add (2, 2, 1));
+    index.commit (2);
+    assert(index.getUsed () == 4);
+
+    // Directory 1 is used more recently.
+    assert(index.isIndexed (1));
+    index.begin (3);
+    assert(index.add (3, 1, 0));
+    index.commit (3);
+    assert(index.isIndexed (1));
+    assert(!index.isIndexed (2));
+    assert(index.isIndexed (3));
+    assert(index.getUsed () == 3);
+
+    // Inserting drops another directory.
+    index.insert (3, 5, 5);
+    index.insert (3, 6, 6);
+    assert(!index.isIndexed (1));
+    assert(index.isIndexed (3));
+    assert(index.getUsed () == 3);
+
+    // Larger than the index, not indexed.
+    index.begin (4);
+    assert(index.add (4, 1, 0));
+    assert(index.add (4, 2, 1));
+    assert(index.add (4, 3, 2));
+    assert(index.add (4, 4, 3));
+    assert(!index.add (4, 5, 4));
+    assert(!index.add (4, 6, 5));
+    index.commit (4);
+    assert(!index.isIndexed (4));
+    assert(!index.isIndexed (3));
+    assert(index.getUsed () == 0);
+
+    // An indexed directory growing over the size.
+    index.begin (5);
+    assert(index.add (5, 1, 0));
+    index.commit (5);
+    index.insert (5, 2, 1);
+    index.insert (5, 3, 2);
+    index.insert (5, 4, 3);
+    assert(index.isIndexed (5));
+    index.insert (5, 5, 4);
+    assert(!index.isIndexed (5));
+    assert(index.getUsed () == 0);
+  }
+
+  {
+    // More directories than slots.
+    DirectoryIndex index
+      { 16, 2 };
+    for (std::uint32_t dir = 1; dir <= 3; ++dir)
+      {
+        index.begin (dir);
+        assert(index.add (dir, dir, dir));
+        index.commit (dir);
+      }
+    assert(!index.isIndexed (1));
+    assert(index.isIndexed (2));
+    assert(index.isIndexed (3));
+    assert(index.getUsed () == 2);
+
+    index.clear ();
+    assert(!index.isIndexed (2));
+    assert(!index.isIndexed (3));
+    assert(index.getUsed () == 0);
+  }
+
+  benchmark (10);
+  benchmark (1000);
+  benchmark (100000);
+
+  trace_puts ("'test-directory-index-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
@@ -0,0 +1,1045 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t SECTOR_SIZE = 512;
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 2 };
+
+TPool<FatFile> files
+  { 4 };
+
+TPool<FatDirectory> dirs
+  { 2 };
+
+FatFileSystem fat
+  { &files, &dirs };
+
+DirectoryIndex dirIndex
+  { 4096, 4 };
+
+FatFileSystem indexedFat
+  { &files, &dirs, &dirIndex };
+
+BlockJournal journal
+  { 32, 8 };
+
+FatFileSystem journaledFat
+  { &files, &dirs, nullptr, &journal };
+
+// 1 MiB, FAT12 with 512 bytes clusters.
+RamBlockDevice small
+  { SECTOR_SIZE, 2048 };
+
+// A device that can be cut, as by a power failure: after a number
+// of writes, the last one only half done, nothing else is written.
+class CutDevice : public RamBlockDevice
+{
+public:
+
+  CutDevice (void* storage, blockNumber_t blocksCount) :
+      RamBlockDevice (storage, SECTOR_SIZE, blocksCount)
+  {
+    fCutting = false;
+    fBudget = 0;
+  }
+
+  void
+  cut (std::size_t writes)
+  {
+    fCutting = true;
+    fBudget = writes;
+  }
+
+  bool
+  restore (void)
+  {
+    bool cut = fCutting && (fBudget == 0);
+    fCutting = false;
+    return cut;
+  }
+
+protected:
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count) override
+  {
+    if (fCutting)
+      {
+        if (fBudget == 0)
+          {
+            errno = EIO;
+            return -1;
+          }
+        if (--fBudget == 0)
+          {
+            std::memcpy (getStorage () + block * SECTOR_SIZE, buf,
+                         SECTOR_SIZE / 2);
+            errno = EIO;
+            return -1;
+          }
+      }
+    return RamBlockDevice::do_write (buf, block, count);
+  }
+
+  virtual int
+  do_flush (void) override
+  {
+    if (fCutting && (fBudget == 0))
+      {
+        errno = EIO;
+        return -1;
+      }
+    return 0;
+  }
+
+private:
+
+  bool fCutting;
+  std::size_t fBudget;
+};
+
+static void
+fill (char* buf, std::size_t size, char seed)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      buf[i] = static_cast<char> (seed + static_cast<char> (i % 97));
+    }
+}
+
+static bool
+isZero (const char* buf, std::size_t size)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      if (buf[i] != 0)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+// Check that a directory lists exactly the given names, in any order.
+static bool
+lists (const char* path, const char* const* names, std::size_t count)
+{
+  DIR* pdir = __posix_opendir (path);
+  if (pdir == nullptr)
+    {
+      return false;
+    }
+
+  std::size_t found = 0;
+  struct dirent* de;
+  while ((de = __posix_readdir (pdir)) != nullptr)
+    {
+      bool known = false;
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          known = known || (std::strcmp (de->d_name, names[i]) == 0);
+        }
+      if (!known)
+        {
+          __posix_closedir (pdir);
+          return false;
+        }
+      ++found;
+    }
+
+  __posix_closedir (pdir);
+  return found == count;
+}
+
+static std::size_t
+countEntries (const char* path)
+{
+  DIR* pdir = __posix_opendir (path);
+  assert(pdir != nullptr);
+  std::size_t count = 0;
+  while (__posix_readdir (pdir) != nullptr)
+    {
+      ++count;
+    }
+  __posix_closedir (pdir);
+  return count;
+}
+
+static void
+writeFile (const char* path, const char* data, std::size_t size)
+{
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  assert(fd >= 0);
+  assert(__posix_write (fd, data, size) == static_cast<ssize_t> (size));
+  assert(__posix_close (fd) == 0);
+}
+
+static bool
+tryWriteFile (const char* path, const char* data, std::size_t size)
+{
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0)
+    {
+      return false;
+    }
+  bool ok = (__posix_write (fd, data, size) == static_cast<ssize_t> (size));
+  return (__posix_close (fd) == 0) && ok;
+}
+
+// The clusters used by the files and the empty directories of the root
+// directory, all readable.
+static std::uint32_t
+usedClusters (FatFileSystem& fs)
+{
+  static char buf[4096];
+  char path[8 + OS_INTEGER_FAT_NAME_MAX];
+  std::uint32_t used = 0;
+  DIR* pdir = __posix_opendir ("/fat/");
+  assert(pdir != nullptr);
+  struct dirent* de;
+  while ((de = __posix_readdir (pdir)) != nullptr)
+    {
+      struct stat st;
+      std::snprintf (path, sizeof(path), "/fat/%s", de->d_name);
+      assert(__posix_stat (path, &st) == 0);
+      if (S_ISDIR(st.st_mode))
+        {
+          ++used;
+          continue;
+        }
+      int fd = __posix_open (path, O_RDONLY);
+      assert(fd >= 0);
+      assert(__posix_read (fd, buf, sizeof(buf)) == st.st_size);
+      assert(__posix_close (fd) == 0);
+      used += static_cast<std::uint32_t> ((static_cast<std::size_t> (st.st_size)
+          + fs.getClusterSize () - 1) / fs.getClusterSize ());
+    }
+  __posix_closedir (pdir);
+  return used;
+}
+
+static bool
+readsBack (const char* path, const char* data, std::size_t size)
+{
+  static char buf[4096];
+  int fd = __posix_open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  bool ok = (__posix_read (fd, buf, sizeof(buf))
+      == static_cast<ssize_t> (size)) && (std::memcmp (buf, data, size) == 0);
+  __posix_close (fd);
+  return ok;
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  static char buf[64 * SECTOR_SIZE];
+  static char data[64 * SECTOR_SIZE];
+  struct stat st;
+
+  fill (data, sizeof(data), 'a');
+
+  // A blank device is not mounted.
+  assert(mm.mount (&fat, "/fat/", &small, 0) == -1);
+  assert(errno == EINVAL);
+  assert(fat.getBlockDevice () == nullptr);
+  assert(__posix_stat ("/fat/", &st) == -1);
+
+  assert(FatFileSystem::format (&small) == 0);
+  assert(mm.mount (&fat, "/fat/", &small, 0) == 0);
+  assert(fat.getType () == FatFileSystem::FAT12);
+  assert(fat.getClusterSize () == SECTOR_SIZE);
+  const std::uint32_t total = fat.getFreeClusters ();
+  assert(total == fat.getClustersCount ());
+  assert(countEntries ("/fat/") == 0);
+
+  {
+    // Files.
+    assert(__posix_open ("/fat/f.txt", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+
+    int fd = __posix_open ("/fat/f.txt", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert(__posix_open ("/fat/f.txt", O_CREAT | O_EXCL | O_RDWR, 0644) == -1);
+    assert(errno == EEXIST);
+
+    assert(__posix_write (fd, data, 1000) == 1000);
+    assert(__posix_lseek (fd, 10, SEEK_SET) == 10);
+    assert(__posix_read (fd, buf, 20) == 20);
+    assert(std::memcmp (buf, data + 10, 20) == 0);
+
+    // Writing past the end leaves a gap of zeros.
+    assert(__posix_lseek (fd, 2500, SEEK_SET) == 2500);
+    assert(__posix_write (fd, data, 100) == 100);
+    assert(__posix_lseek (fd, 0, SEEK_END) == 2600);
+    assert(__posix_lseek (fd, 1000, SEEK_SET) == 1000);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 1600);
+    assert(isZero (buf, 1500));
+    assert(std::memcmp (buf + 1500, data, 100) == 0);
+
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(S_ISREG(st.st_mode));
+    assert(st.st_size == 2600);
+    assert(fat.getFreeClusters () == total - 6);
+
+    // Shrink, then grow with zeros.
+    assert(__posix_ftruncate (fd, 100) == 0);
+    assert(fat.getFreeClusters () == total - 1);
+    assert(__posix_ftruncate (fd, 1100) == 0);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 1100);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(isZero (buf + 100, 1000));
+    assert(__posix_close (fd) == 0);
+
+    assert(__posix_stat ("/fat/F.TXT", &st) == 0);
+    assert(st.st_size == 1100);
+
+    // Several opens, also for writing; the writes through one are
+    // read through the others.
+    fd = __posix_open ("/fat/f.txt", O_RDONLY);
+    assert(fd >= 0);
+    int fd2 = __posix_open ("/fat/f.txt", O_WRONLY);
+    assert(fd2 >= 0);
+    int fd3 = __posix_open ("/fat/f.txt", O_WRONLY | O_APPEND);
+    assert(fd3 >= 0);
+    assert(__posix_unlink ("/fat/f.txt") == -1);
+    assert(errno == EBUSY);
+    assert(__posix_write (fd, data, 1) == -1);
+    assert(errno == EBADF);
+
+    assert(__posix_write (fd3, data + 7, 2000) == 2000);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 3100);
+    assert(__posix_lseek (fd2, 0, SEEK_END) == 3100);
+    assert(__posix_lseek (fd2, 200, SEEK_SET) == 200);
+    assert(__posix_write (fd2, data + 3, 1000) == 1000);
+    assert(__posix_lseek (fd, 100, SEEK_SET) == 100);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 3000);
+    assert(isZero (buf, 100));
+    assert(std::memcmp (buf + 100, data + 3, 1000) == 0);
+    assert(std::memcmp (buf + 1100, data + 107, 1900) == 0);
+
+    // Truncated by one, then appended to by another.
+    assert(__posix_ftruncate (fd2, 1100) == 0);
+    assert(fat.getFreeClusters () == total - 3);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 0);
+    assert(__posix_write (fd3, data, 100) == 100);
+    assert(__posix_close (fd3) == 0);
+    assert(__posix_close (fd2) == 0);
+    assert(__posix_lseek (fd, 1100, SEEK_SET) == 1100);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 100);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/fat/F.TXT", &st) == 0);
+    assert(st.st_size == 1200);
+    assert(__posix_truncate ("/fat/f.txt", 1100) == 0);
+
+    fd = __posix_open ("/fat/f.txt", O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 10) == 10);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == 0);
+    assert(st.st_size == 1110);
+
+    fd = __posix_open ("/fat/f.txt", O_WRONLY | O_TRUNC);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == 0);
+    assert(st.st_size == 0);
+    assert(fat.getFreeClusters () == total);
+
+    assert(__posix_truncate ("/fat/f.txt", 700) == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == 0);
+    assert(st.st_size == 700);
+
+    // Times have a 2 seconds resolution, access times are dates.
+    struct utimbuf times =
+      { 1000000000, 1000000002 };
+    assert(__posix_utime ("/fat/f.txt", &times) == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == 0);
+    assert(st.st_mtime == 1000000002);
+    assert(st.st_atime == 1000000000 - (1000000000 % 86400));
+
+    // The read only attribute.
+    assert(__posix_chmod ("/fat/f.txt", 0444) == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == 0);
+    assert((st.st_mode & 0222) == 0);
+    assert(__posix_open ("/fat/f.txt", O_RDWR) == -1);
+    assert(errno == EACCES);
+    assert(__posix_chmod ("/fat/f.txt", 0644) == 0);
+
+    assert(__posix_unlink ("/fat/f.txt") == 0);
+    assert(__posix_stat ("/fat/f.txt", &st) == -1);
+    assert(errno == ENOENT);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // Names: short ones, possibly lower case, and long ones.
+    writeFile ("/fat/readme.txt", data, 10);
+    writeFile ("/fat/MAKEFILE", data, 20);
+    writeFile ("/fat/ReadMe.md", data, 30);
+    writeFile ("/fat/A long file name.text", data, 40);
+    writeFile ("/fat/\xC3\xA9t\xC3\xA9.txt", data, 50);
+
+    const char* names[] =
+      { "readme.txt", "MAKEFILE", "ReadMe.md", "A long file name.text",
+          "\xC3\xA9t\xC3\xA9.txt" };
+    assert(lists ("/fat/", names, 5));
+
+    // Case insensitive, and by the short alias.
+    assert(__posix_stat ("/fat/README.MD", &st) == 0);
+    assert(st.st_size == 30);
+    assert(__posix_stat ("/fat/a LONG file NAME.text", &st) == 0);
+    assert(st.st_size == 40);
+    assert(__posix_stat ("/fat/ALONGF~1.TEX", &st) == 0);
+    assert(st.st_size == 40);
+    assert(__posix_open ("/fat/README.TXT", O_CREAT | O_EXCL | O_WRONLY, 0644)
+        == -1);
+    assert(errno == EEXIST);
+
+    // Invalid characters.
+    assert(__posix_open ("/fat/a?b", O_CREAT | O_WRONLY, 0644) == -1);
+    assert(errno == EINVAL);
+
+    // Aliases are unique.
+    writeFile ("/fat/A long file name.textual", data, 60);
+    assert(__posix_stat ("/fat/ALONGF~2.TEX", &st) == 0);
+    assert(st.st_size == 60);
+
+    for (auto* name : names)
+      {
+        char path[64];
+        std::snprintf (path, sizeof(path), "/fat/%s", name);
+        assert(__posix_unlink (path) == 0);
+      }
+    assert(__posix_unlink ("/fat/A long file name.textual") == 0);
+    assert(countEntries ("/fat/") == 0);
+  }
+
+  {
+    // Directories.
+    assert(__posix_mkdir ("/fat/d", 0777) == 0);
+    assert(__posix_mkdir ("/fat/d", 0777) == -1);
+    assert(errno == EEXIST);
+    assert(__posix_mkdir ("/fat/d/sub", 0777) == 0);
+    assert(__posix_stat ("/fat/d", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert(__posix_open ("/fat/d", O_RDONLY) == -1);
+    assert(errno == EISDIR);
+    assert(__posix_mkdir ("/fat/x/y", 0777) == -1);
+    assert(errno == ENOENT);
+
+    // Enough long names to grow the directory over several clusters.
+    for (int i = 0; i < 40; ++i)
+      {
+        char path[64];
+        std::snprintf (path, sizeof(path), "/fat/d/long name number %d", i);
+        writeFile (path, data + i, 10);
+      }
+    assert(countEntries ("/fat/d") == 41);
+    assert(readsBack ("/fat/d/long name number 39", data + 39, 10));
+    assert(__posix_stat ("/fat/d/f.txt", &st) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_stat ("/fat/d/long name number 0/x", &st) == -1);
+    assert(errno == ENOTDIR);
+
+    assert(__posix_rmdir ("/fat/d") == -1);
+    assert(errno == ENOTEMPTY);
+    assert(__posix_unlink ("/fat/d") == -1);
+    assert(errno == EISDIR);
+    assert(__posix_rmdir ("/fat/d/long name number 1") == -1);
+    assert(errno == ENOTDIR);
+
+    // Rename, within and across directories.
+    assert(__posix_rename ("/fat/d/long name number 0", "/fat/moved") == 0);
+    assert(readsBack ("/fat/moved", data, 10));
+    assert(__posix_rename ("/fat/moved", "/fat/d/long name number 1") == 0);
+    assert(readsBack ("/fat/d/long name number 1", data, 10));
+    assert(countEntries ("/fat/d") == 40);
+    assert(__posix_rename ("/fat/d/long name number 2", "/fat/d/sub") == -1);
+    assert(errno == EISDIR);
+
+    // Not into itself; `..` follows the moved directory.
+    assert(__posix_mkdir ("/fat/e", 0777) == 0);
+    assert(__posix_rename ("/fat/d", "/fat/d/sub/d") == -1);
+    assert(errno == EINVAL);
+    assert(__posix_rename ("/fat/d", "/fat/e/d") == 0);
+    assert(__posix_rename ("/fat/e", "/fat/e/d/sub/e") == -1);
+    assert(errno == EINVAL);
+    assert(readsBack ("/fat/e/d/long name number 39", data + 39, 10));
+
+    for (int i = 1; i < 40; ++i)
+      {
+        char path[64];
+        std::snprintf (path, sizeof(path), "/fat/e/d/long name number %d", i);
+        assert(__posix_unlink (path) == 0);
+      }
+
+    DIR* pdir = __posix_opendir ("/fat/e/d/sub");
+    assert(pdir != nullptr);
+    assert(__posix_rmdir ("/fat/e/d/sub") == -1);
+    assert(errno == EBUSY);
+    assert(__posix_closedir (pdir) == 0);
+
+    assert(__posix_rmdir ("/fat/e/d/sub") == 0);
+    assert(__posix_rmdir ("/fat/e/d") == 0);
+    assert(__posix_rmdir ("/fat/e") == 0);
+    assert(countEntries ("/fat/") == 0);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // Relative to a directory, from its cluster, not from its path.
+    assert(__posix_mkdir ("/fat/a", 0777) == 0);
+    assert(__posix_mkdir ("/fat/a/b", 0777) == 0);
+    writeFile ("/fat/a/b/f", data, 10);
+    DIR* pdir = __posix_opendir ("/fat/a/b");
+    assert(pdir != nullptr);
+    int dfd = __posix_dirfd (pdir);
+    assert(dfd >= 0);
+
+    // The path the directory was opened with is no longer valid.
+    assert(__posix_rename ("/fat/a", "/fat/z") == 0);
+
+    assert(__posix_fstatat (dfd, "f", &st, 0) == 0);
+    assert(st.st_size == 10);
+    assert(__posix_fstatat (dfd, "./f", &st, 0) == 0);
+    assert(st.st_size == 10);
+    struct stat dst;
+    assert(__posix_fstat (dfd, &dst) == 0);
+    assert(S_ISDIR(dst.st_mode));
+    assert(__posix_stat ("/fat/z/b", &st) == 0);
+    assert(st.st_ino == dst.st_ino);
+
+    assert(__posix_mkdirat (dfd, "sub", 0755) == 0);
+    assert(__posix_mkdirat (dfd, "sub", 0755) == -1);
+    assert(errno == EEXIST);
+    int fd = __posix_openat (dfd, "sub/h", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 20) == 20);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_openat (dfd, "sub", O_RDONLY) == -1);
+    assert(errno == EISDIR);
+    assert(__posix_renameat (dfd, "sub/h", dfd, "h") == 0);
+    assert(readsBack ("/fat/z/b/h", data, 20));
+    assert(__posix_unlinkat (dfd, "sub", AT_REMOVEDIR) == 0);
+    assert(__posix_unlinkat (dfd, "h", 0) == 0);
+    assert(__posix_unlinkat (dfd, "f", AT_REMOVEDIR) == -1);
+    assert(errno == ENOTDIR);
+    assert(__posix_unlinkat (dfd, "f", 0) == 0);
+    assert(__posix_closedir (pdir) == 0);
+
+    assert(__posix_rmdir ("/fat/z/b") == 0);
+    assert(__posix_rmdir ("/fat/z") == 0);
+    assert(countEntries ("/fat/") == 0);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // Seeks use the map of the clusters, not the FAT.
+    writeFile ("/fat/big", data, sizeof(data));
+    int fd = __posix_open ("/fat/big", O_RDONLY);
+    assert(fd >= 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == sizeof(buf));
+    assert(std::memcmp (buf, data, sizeof(buf)) == 0);
+
+    std::size_t lookups = fat.getFatLookups ();
+    for (int i = 0; i < 20; ++i)
+      {
+        off_t offset = ((i * 37) % 64) * SECTOR_SIZE + 3;
+        assert(__posix_lseek (fd, offset, SEEK_SET) == offset);
+        assert(__posix_read (fd, buf, 100) == 100);
+        assert(std::memcmp (buf, data + offset, 100) == 0);
+      }
+    assert(fat.getFatLookups () == lookups);
+    assert(__posix_close (fd) == 0);
+
+    // Fragmented files, with more runs than remembered.
+    int fa = __posix_open ("/fat/a", O_CREAT | O_WRONLY, 0644);
+    int fb = __posix_open ("/fat/b", O_CREAT | O_WRONLY, 0644);
+    assert((fa >= 0) && (fb >= 0));
+    for (int i = 0; i < 20; ++i)
+      {
+        assert(__posix_write (fa, data + i * SECTOR_SIZE, SECTOR_SIZE)
+            == SECTOR_SIZE);
+        assert(__posix_write (fb, data + i * 7, SECTOR_SIZE) == SECTOR_SIZE);
+      }
+    assert(__posix_close (fb) == 0);
+    assert(__posix_close (fa) == 0);
+    assert(__posix_unlink ("/fat/big") == 0);
+
+    fd = __posix_open ("/fat/a", O_RDONLY);
+    assert(fd >= 0);
+    for (int i = 19; i >= 0; --i)
+      {
+        off_t offset = static_cast<off_t> (i * SECTOR_SIZE);
+        assert(__posix_lseek (fd, offset, SEEK_SET) == offset);
+        assert(__posix_read (fd, buf, SECTOR_SIZE) == SECTOR_SIZE);
+        assert(std::memcmp (buf, data + i * SECTOR_SIZE, SECTOR_SIZE) == 0);
+      }
+    assert(__posix_close (fd) == 0);
+
+    // Appending keeps the file contiguous in the freed space.
+    fd = __posix_open ("/fat/c", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 4 * SECTOR_SIZE) == 4 * SECTOR_SIZE);
+    assert(__posix_close (fd) == 0);
+
+    assert(__posix_unlink ("/fat/a") == 0);
+    assert(__posix_unlink ("/fat/b") == 0);
+    assert(__posix_unlink ("/fat/c") == 0);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // Full device: short write, then ENOSPC.
+    int fd = __posix_open ("/fat/full", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    std::size_t written = 0;
+    ssize_t n;
+    while ((n = __posix_write (fd, data, sizeof(data) - 100)) > 0)
+      {
+        written += static_cast<std::size_t> (n);
+      }
+    assert(n == -1);
+    assert(errno == ENOSPC);
+    assert(written == total * SECTOR_SIZE);
+    assert(fat.getFreeClusters () == 0);
+    assert(__posix_mkdir ("/fat/nospace", 0777) == -1);
+    assert(errno == ENOSPC);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/fat/full") == 0);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // Two loggers appending in turns: preallocated, the files are
+    // contiguous and seeks are served by the cluster map.
+    fill (data, sizeof(data), 'l');
+    for (int prealloc = 0; prealloc < 2; ++prealloc)
+      {
+        int fa = __posix_open ("/fat/a.log", O_CREAT | O_WRONLY | O_APPEND,
+                               0644);
+        int fb = __posix_open ("/fat/b.log", O_CREAT | O_WRONLY | O_APPEND,
+                               0644);
+        assert((fa >= 0) && (fb >= 0));
+        if (prealloc != 0)
+          {
+            assert(__posix_fallocate (fa, FALLOC_FL_KEEP_SIZE, 0,
+                                      16 * SECTOR_SIZE) == 0);
+            assert(__posix_fallocate (fb, FALLOC_FL_KEEP_SIZE, 0,
+                                      16 * SECTOR_SIZE) == 0);
+            assert(fat.getFreeClusters () == total - 32);
+            assert(__posix_fstat (fa, &st) == 0);
+            assert(st.st_size == 0);
+          }
+        for (int i = 0; i < 16; ++i)
+          {
+            assert(__posix_write (fa, data, SECTOR_SIZE) == SECTOR_SIZE);
+            assert(__posix_write (fb, data, SECTOR_SIZE) == SECTOR_SIZE);
+          }
+        assert(fat.getFreeClusters () == total - 32);
+        assert(__posix_close (fa) == 0);
+        assert(__posix_close (fb) == 0);
+
+        fa = __posix_open ("/fat/a.log", O_RDONLY);
+        assert(fa >= 0);
+        assert(__posix_read (fa, buf, sizeof(buf)) == 16 * SECTOR_SIZE);
+        std::size_t lookups = fat.getFatLookups ();
+        assert(__posix_lseek (fa, 0, SEEK_SET) == 0);
+        assert(__posix_read (fa, buf, sizeof(buf)) == 16 * SECTOR_SIZE);
+        assert(std::memcmp (buf, data, SECTOR_SIZE) == 0);
+        assert((fat.getFatLookups () == lookups) == (prealloc != 0));
+        assert(__posix_close (fa) == 0);
+
+        assert(__posix_unlink ("/fat/a.log") == 0);
+        assert(__posix_unlink ("/fat/b.log") == 0);
+        assert(fat.getFreeClusters () == total);
+      }
+
+    // The reserved clusters are freed at close.
+    int fd = __posix_open ("/fat/r", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 100) == 100);
+    assert(__posix_fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, 8 * SECTOR_SIZE)
+        == 0);
+    assert(fat.getFreeClusters () == total - 8);
+    assert(__posix_close (fd) == 0);
+    assert(fat.getFreeClusters () == total - 1);
+
+    // Growing the size, the new bytes read as zeros.
+    fd = __posix_open ("/fat/r", O_RDWR);
+    assert(fd >= 0);
+    assert(__posix_posix_fallocate (fd, SECTOR_SIZE, 3 * SECTOR_SIZE) == 0);
+    assert(fat.getFreeClusters () == total - 4);
+    assert(__posix_lseek (fd, 0, SEEK_CUR) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 4 * SECTOR_SIZE);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(isZero (buf + 100, 4 * SECTOR_SIZE - 100));
+
+    // No space, nothing kept.
+    assert(__posix_fallocate (fd, FALLOC_FL_KEEP_SIZE, 0,
+                              (total + 1) * SECTOR_SIZE) == -1);
+    assert(errno == ENOSPC);
+    assert(fat.getFreeClusters () == total - 4);
+    assert(__posix_fallocate (fd, 0, 0xFFFFFFFF, 1) == -1);
+    assert(errno == EFBIG);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/fat/r") == 0);
+    assert(fat.getFreeClusters () == total);
+  }
+
+  {
+    // The content survives the unmount.
+    assert(__posix_mkdir ("/fat/keep", 0777) == 0);
+    writeFile ("/fat/keep/Some long name.bin", data, 3000);
+    writeFile ("/fat/short", data + 1, 5);
+
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(mm.mount (&fat, "/fat/", &small, 0) == 0);
+    assert(fat.getFreeClusters () == total - 1 - 6 - 1);
+    assert(readsBack ("/fat/keep/Some long name.bin", data, 3000));
+    assert(readsBack ("/fat/short", data + 1, 5));
+    const char* names[] =
+      { "Some long name.bin" };
+    assert(lists ("/fat/keep", names, 1));
+    assert(mm.umount ("/fat/", 0) == 0);
+  }
+
+  {
+    // FAT16, chosen by the size.
+    RamBlockDevice medium
+      { SECTOR_SIZE, 16 * 1024 };
+    assert(FatFileSystem::format (&medium) == 0);
+    assert(mm.mount (&fat, "/fat/", &medium, 0) == 0);
+    assert(fat.getType () == FatFileSystem::FAT16);
+    writeFile ("/fat/Sixteen bits.dat", data, 4000);
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(mm.mount (&fat, "/fat/", &medium, 0) == 0);
+    assert(readsBack ("/fat/Sixteen bits.dat", data, 4000));
+    assert(mm.umount ("/fat/", 0) == 0);
+  }
+
+  {
+    // FAT32, with small clusters forcing the count.
+    RamBlockDevice large
+      { SECTOR_SIZE, 68 * 1024 };
+    assert(FatFileSystem::format (&large, 1) == 0);
+    assert(mm.mount (&fat, "/fat/", &large, 0) == 0);
+    assert(fat.getType () == FatFileSystem::FAT32);
+    std::uint32_t free32 = fat.getFreeClusters ();
+    assert(__posix_mkdir ("/fat/dir", 0777) == 0);
+    writeFile ("/fat/dir/Thirty two bits.dat", data, 4000);
+    writeFile ("/fat/root.txt", data, 10);
+    assert(fat.getFreeClusters () == free32 - 1 - 8 - 1);
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(mm.mount (&fat, "/fat/", &large, 0) == 0);
+    assert(fat.getFreeClusters () == free32 - 1 - 8 - 1);
+    assert(readsBack ("/fat/dir/Thirty two bits.dat", data, 4000));
+    assert(readsBack ("/fat/root.txt", data, 10));
+    assert(__posix_rename ("/fat/root.txt", "/fat/dir/moved.txt") == 0);
+    assert(readsBack ("/fat/dir/moved.txt", data, 10));
+    assert(mm.umount ("/fat/", 0) == 0);
+  }
+
+  {
+    // A large directory, with an dirIndex.
+    RamBlockDevice large
+      { SECTOR_SIZE, 68 * 1024 };
+    assert(FatFileSystem::format (&large, 1) == 0);
+    assert(mm.mount (&indexedFat, "/fat/", &large, 0) == 0);
+    assert(indexedFat.getDirectoryIndex () == &dirIndex);
+    assert(__posix_mkdir ("/fat/big", 0777) == 0);
+
+    char path[64];
+    constexpr unsigned int count = 1000;
+    for (unsigned int i = 0; i < count; ++i)
+      {
+        std::snprintf (path, sizeof(path), "/fat/big/f%04u.dat", i);
+        writeFile (path, data, 1);
+      }
+    // Long names, with their aliases.
+    writeFile ("/fat/big/A long name.txt", data, 2);
+    writeFile ("/fat/big/A long name, again.txt", data, 3);
+    assert(dirIndex.getUsed () >= count + 2 * 2);
+
+    std::size_t lookups = dirIndex.getLookups ();
+    std::size_t candidates = dirIndex.getCandidates ();
+    for (unsigned int i = 0; i < count; ++i)
+      {
+        std::snprintf (path, sizeof(path), "/fat/big/F%04u.DAT", i);
+        assert(__posix_stat (path, &st) == 0);
+        assert(st.st_size == 1);
+      }
+    // One in the root and one in the directory, mostly with a single
+    // candidate.
+    assert(dirIndex.getLookups () == lookups + 2 * count);
+    assert(dirIndex.getCandidates () - candidates < 3 * count);
+    assert(readsBack ("/fat/big/A long name, again.txt", data, 3));
+    assert(readsBack ("/fat/big/ALONGN~2.TXT", data, 3));
+    assert(__posix_stat ("/fat/big/f1000.dat", &st) == -1);
+    assert(errno == ENOENT);
+
+    // The holes are reused, the directory does not grow.
+    std::uint32_t unused = indexedFat.getFreeClusters ();
+    for (unsigned int i = 0; i < count; i += 2)
+      {
+        std::snprintf (path, sizeof(path), "/fat/big/f%04u.dat", i);
+        assert(__posix_unlink (path) == 0);
+      }
+    assert(__posix_stat ("/fat/big/f0000.dat", &st) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_stat ("/fat/big/f0001.dat", &st) == 0);
+    for (unsigned int i = 0; i < count; i += 2)
+      {
+        std::snprintf (path, sizeof(path), "/fat/big/g%04u.dat", i);
+        writeFile (path, data, 1);
+      }
+    assert(indexedFat.getFreeClusters () == unused);
+    assert(countEntries ("/fat/big") == count + 2);
+    assert(__posix_rename ("/fat/big/g0000.dat", "/fat/big/f0000.dat") == 0);
+    assert(__posix_stat ("/fat/big/g0000.dat", &st) == -1);
+    assert(__posix_stat ("/fat/big/f0000.dat", &st) == 0);
+
+    // A removed directory, its cluster reused by a new one.
+    assert(__posix_mkdir ("/fat/old", 0777) == 0);
+    writeFile ("/fat/old/x", data, 1);
+    assert(__posix_unlink ("/fat/old/x") == 0);
+    assert(__posix_rmdir ("/fat/old") == 0);
+    assert(__posix_mkdir ("/fat/new", 0777) == 0);
+    writeFile ("/fat/new/y", data, 1);
+    const char* names[] =
+      { "y" };
+    assert(lists ("/fat/new", names, 1));
+    assert(__posix_stat ("/fat/new/x", &st) == -1);
+    assert(errno == ENOENT);
+
+    // Linear and indexed lookups of the last name.
+    auto begin = std::chrono::steady_clock::now ();
+    for (unsigned int i = 0; i < 100; ++i)
+      {
+        assert(__posix_stat ("/fat/big/f0999.dat", &st) == 0);
+      }
+    auto middle = std::chrono::steady_clock::now ();
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(dirIndex.getUsed () == 0);
+
+    assert(mm.mount (&fat, "/fat/", &large, 0) == 0);
+    assert(countEntries ("/fat/big") == count + 2);
+    assert(readsBack ("/fat/big/g0998.dat", data, 1));
+    auto again = std::chrono::steady_clock::now ();
+    for (unsigned int i = 0; i < 100; ++i)
+      {
+        assert(__posix_stat ("/fat/big/f0999.dat", &st) == 0);
+      }
+    auto end = std::chrono::steady_clock::now ();
+    assert(mm.umount ("/fat/", 0) == 0);
+
+    std::chrono::duration<double, std::nano> indexed = middle - begin;
+    std::chrono::duration<double, std::nano> linear = end - again;
+    trace_printf ("stat() in %u entries: linear %.0f ns, indexed %.0f ns\n",
+                  count + 2, linear.count () / 100, indexed.count () / 100);
+  }
+
+  {
+    // A journaled volume.
+    static std::uint8_t image[2048 * SECTOR_SIZE];
+    CutDevice device
+      { image, 2048 };
+    assert(FatFileSystem::format (&device, 0, 32) == 0);
+
+    // Without a journal, used as usual.
+    assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+    assert(!fat.isJournaled ());
+    const std::uint32_t clusters = fat.getFreeClusters ();
+    assert(mm.umount ("/fat/", 0) == 0);
+
+    assert(mm.mount (&journaledFat, "/fat/", &device, 0) == 0);
+    assert(journaledFat.isJournaled ());
+    assert(journaledFat.getJournal () == &journal);
+    assert(journal.getReplayed () == 0);
+    assert(journaledFat.getFreeClusters () == clusters);
+
+    // Creating and writing change the volume, closing does not; the
+    // operations are committed 8 at a time, with 2 flushes each.
+    char path[64];
+    constexpr unsigned int count = 64;
+    std::size_t flushes = journal.getFlushes ();
+    std::size_t commits = journal.getCommits ();
+    for (unsigned int i = 0; i < count; ++i)
+      {
+        std::snprintf (path, sizeof(path), "/fat/f%02u.dat", i);
+        writeFile (path, data, 100);
+      }
+    flushes = journal.getFlushes () - flushes;
+    commits = journal.getCommits () - commits;
+    assert(commits <= (2 * count) / 8 + 1);
+    assert(flushes <= 2 * commits);
+    trace_printf ("%u files: %u commits, %.2f flushes per file\n", count,
+                  static_cast<unsigned int> (commits),
+                  static_cast<double> (flushes) / count);
+
+    // The freed clusters are counted at once, but reused after the
+    // commit.
+    for (unsigned int i = 0; i < count; ++i)
+      {
+        std::snprintf (path, sizeof(path), "/fat/f%02u.dat", i);
+        assert(__posix_unlink (path) == 0);
+      }
+    assert(journaledFat.getFreeClusters () == clusters);
+    writeFile ("/fat/big.dat", data, sizeof(data));
+    assert(readsBack ("/fat/big.dat", data, 4096));
+
+    // fsync() commits, and flushes the file data.
+    int fd = __posix_open ("/fat/synced.dat", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 1000) == 1000);
+    commits = journal.getCommits ();
+    assert(__posix_fsync (fd) == 0);
+    assert(journal.getCommits () == commits + 1);
+    assert(__posix_close (fd) == 0);
+
+    // Filled, with the last clusters freed in the same transaction.
+    assert(__posix_unlink ("/fat/big.dat") == 0);
+    std::uint32_t unused = journaledFat.getFreeClusters ();
+    fd = __posix_open ("/fat/full.dat", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    for (std::uint32_t i = 0; i < unused; ++i)
+      {
+        assert(__posix_write (fd, data, SECTOR_SIZE) == SECTOR_SIZE);
+      }
+    assert(__posix_write (fd, data, 1) == -1);
+    assert(errno == ENOSPC);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/fat/full.dat") == 0);
+
+    // Unmounted empty, nothing to replay.
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(!journal.isAttached ());
+    assert(mm.mount (&journaledFat, "/fat/", &device, 0) == 0);
+    assert(journal.getReplayed () == 0);
+    assert(readsBack ("/fat/synced.dat", data, 1000));
+    assert(usedClusters (journaledFat) == 2);
+    assert(mm.umount ("/fat/", 0) == 0);
+
+    // Cut at each write: mounted again, the volume is consistent,
+    // without lost clusters and with all files readable.
+    std::size_t replays = 0;
+    double longest = 0;
+    for (std::size_t writes = 1;; ++writes)
+      {
+        assert(FatFileSystem::format (&device, 0, 32) == 0);
+        assert(mm.mount (&journaledFat, "/fat/", &device, 0) == 0);
+        device.cut (writes);
+        for (unsigned int i = 0; i < 12; ++i)
+          {
+            std::snprintf (path, sizeof(path), "/fat/f%02u.dat", i);
+            if (!tryWriteFile (path, data, 1500))
+              {
+                break;
+              }
+            if ((i % 4) == 0)
+              {
+                std::snprintf (path, sizeof(path), "/fat/d%02u", i);
+                if (__posix_mkdir (path, 0777) < 0)
+                  {
+                    break;
+                  }
+              }
+            if (i >= 4)
+              {
+                std::snprintf (path, sizeof(path), "/fat/f%02u.dat", i - 4);
+                if (__posix_unlink (path) < 0)
+                  {
+                    break;
+                  }
+              }
+          }
+        assert(mm.umount ("/fat/", 0) == 0);
+        bool cut = device.restore ();
+
+        auto begin = std::chrono::steady_clock::now ();
+        assert(mm.mount (&journaledFat, "/fat/", &device, 0) == 0);
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now () - begin;
+        if (journal.getReplayed () != 0)
+          {
+            ++replays;
+            if (elapsed.count () > longest)
+              {
+                longest = elapsed.count ();
+              }
+          }
+        std::uint32_t used = usedClusters (journaledFat);
+        assert(journaledFat.getFreeClusters () == clusters - used);
+        assert(mm.umount ("/fat/", 0) == 0);
+
+        if (!cut)
+          {
+            assert(used == 4 * 3 + 3);
+            break;
+          }
+      }
+    assert(replays != 0);
+    trace_printf ("%u mounts with replay, the longest %.0f us\n",
+                  static_cast<unsigned int> (replays), longest);
+  }
+
+  trace_puts ("'test-fat-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
@@ -0,0 +1,585 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "posix-io/FlashFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr std::size_t BLOCKS_COUNT = 256;
+constexpr std::size_t SEGMENT_BLOCKS = 8;
+
+// Power loss: the writes fail after a number of them, and the last
+// one is torn.
+class CutDevice : public RamBlockDevice
+{
+public:
+
+  CutDevice (void* storage, std::size_t budget) :
+      RamBlockDevice (storage, BLOCK_SIZE, BLOCKS_COUNT)
+  {
+    fBudget = budget;
+  }
+
+  bool
+  isCut (void) const
+  {
+    return fBudget == 0;
+  }
+
+protected:
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count) override
+  {
+    if (fBudget == 0)
+      {
+        errno = EIO;
+        return -1;
+      }
+    if (--fBudget == 0)
+      {
+        std::memcpy (getStorage () + block * BLOCK_SIZE, buf, BLOCK_SIZE / 2);
+        errno = EIO;
+        return -1;
+      }
+    return RamBlockDevice::do_write (buf, block, count);
+  }
+
+  virtual int
+  do_discard (blockNumber_t block, std::size_t count) override
+  {
+    if (fBudget == 0)
+      {
+        errno = EIO;
+        return -1;
+      }
+    if (--fBudget == 0)
+      {
+        std::memset (getStorage () + block * BLOCK_SIZE, 0,
+                     count * BLOCK_SIZE / 2);
+        errno = EIO;
+        return -1;
+      }
+    return RamBlockDevice::do_discard (block, count);
+  }
+
+private:
+
+  std::size_t fBudget;
+};
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 2 };
+
+TPool<FlashFile> files
+  { 4 };
+
+TPool<FlashDirectory> dirs
+  { 2 };
+
+FlashFileSystem flash
+  { &files, &dirs, 16 };
+
+static std::uint8_t image[BLOCKS_COUNT * BLOCK_SIZE];
+static std::uint8_t snapshot[BLOCKS_COUNT * BLOCK_SIZE];
+
+RamBlockDevice ram
+  { image, BLOCK_SIZE, BLOCKS_COUNT };
+
+// Larger, with more objects, for the reuse of the removed ones.
+FlashFileSystem large
+  { &files, &dirs, 32 };
+
+static std::uint8_t largeImage[4096 * BLOCK_SIZE];
+
+RamBlockDevice largeRam
+  { largeImage, BLOCK_SIZE, 4096 };
+
+static void
+fill (char* buf, std::size_t size, char seed)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      buf[i] = static_cast<char> (seed + static_cast<char> (i % 97));
+    }
+}
+
+static bool
+isZero (const char* buf, std::size_t size)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      if (buf[i] != 0)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+// Counted by readdir(), and by posix_getdents() with a small buffer.
+static std::size_t
+countEntries (const char* path)
+{
+  DIR* pdir = __posix_opendir (path);
+  assert(pdir != nullptr);
+  std::size_t count = 0;
+  while (__posix_readdir (pdir) != nullptr)
+    {
+      ++count;
+    }
+
+  __posix_rewinddir (pdir);
+  alignas(struct posix_dent) char buf[40];
+  std::size_t packed = 0;
+  ssize_t n;
+  while ((n = __posix_posix_getdents (__posix_dirfd (pdir), buf, sizeof(buf),
+                                      0)) > 0)
+    {
+      for (ssize_t at = 0; at < n; ++packed)
+        {
+          at += reinterpret_cast<struct posix_dent*> (buf + at)->d_reclen;
+        }
+    }
+  assert((n == 0) && (packed == count));
+  __posix_closedir (pdir);
+  return count;
+}
+
+static int
+writeFile (const char* path, const char* data, std::size_t size)
+{
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  int ret = 0;
+  if ((__posix_write (fd, data, size) != static_cast<ssize_t> (size))
+      || (__posix_fsync (fd) < 0))
+    {
+      ret = -1;
+    }
+  if (__posix_close (fd) < 0)
+    {
+      ret = -1;
+    }
+  return ret;
+}
+
+static bool
+readsBack (const char* path, const char* data, std::size_t size)
+{
+  static char buf[16 * BLOCK_SIZE];
+  int fd = __posix_open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  bool ok = (__posix_read (fd, buf, sizeof(buf))
+      == static_cast<ssize_t> (size)) && (std::memcmp (buf, data, size) == 0);
+  __posix_close (fd);
+  return ok;
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  static char buf[16 * BLOCK_SIZE];
+  static char data[16 * BLOCK_SIZE];
+  static char other[16 * BLOCK_SIZE];
+  struct stat st;
+
+  fill (data, sizeof(data), 'a');
+  fill (other, sizeof(other), 'A');
+
+  // A blank device is not mounted.
+  assert(mm.mount (&flash, "/flash/", &ram, 0) == -1);
+  assert(errno == EINVAL);
+  assert(__posix_stat ("/flash/", &st) == -1);
+
+  assert(FlashFileSystem::format (&ram, SEGMENT_BLOCKS) == 0);
+  assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+  const std::size_t segments = flash.getSegmentsCount ();
+  assert(segments == BLOCKS_COUNT / SEGMENT_BLOCKS);
+  assert(flash.getFreeSegments () == segments);
+  assert(flash.getLiveBlocks () == segments);
+  assert(countEntries ("/flash/") == 0);
+
+  {
+    // Files.
+    assert(__posix_open ("/flash/f", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+
+    int fd = __posix_open ("/flash/f", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert(__posix_open ("/flash/f", O_CREAT | O_EXCL | O_RDWR, 0644) == -1);
+    assert(errno == EEXIST);
+
+    assert(__posix_write (fd, data, 1000) == 1000);
+    assert(__posix_lseek (fd, 10, SEEK_SET) == 10);
+    assert(__posix_read (fd, buf, 20) == 20);
+    assert(std::memcmp (buf, data + 10, 20) == 0);
+
+    // Writing past the end leaves a gap of zeros.
+    assert(__posix_lseek (fd, 2500, SEEK_SET) == 2500);
+    assert(__posix_write (fd, data, 100) == 100);
+    assert(__posix_lseek (fd, 0, SEEK_END) == 2600);
+    assert(__posix_lseek (fd, 1000, SEEK_SET) == 1000);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 1600);
+    assert(isZero (buf, 1500));
+    assert(std::memcmp (buf + 1500, data, 100) == 0);
+
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(S_ISREG(st.st_mode));
+    assert(st.st_size == 2600);
+
+    // Shrink, then grow with zeros.
+    assert(__posix_ftruncate (fd, 100) == 0);
+    assert(__posix_ftruncate (fd, 1100) == 0);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 1100);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(isZero (buf + 100, 1000));
+
+    assert(__posix_unlink ("/flash/f") == -1);
+    assert(errno == EBUSY);
+    assert(__posix_close (fd) == 0);
+
+    fd = __posix_open ("/flash/f", O_RDONLY);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 1) == -1);
+    assert(errno == EBADF);
+    assert(__posix_close (fd) == 0);
+
+    fd = __posix_open ("/flash/f", O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 10) == 10);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/flash/f", &st) == 0);
+    assert(st.st_size == 1110);
+
+    fd = __posix_open ("/flash/f", O_WRONLY | O_TRUNC);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/flash/f", &st) == 0);
+    assert(st.st_size == 0);
+
+    assert(__posix_truncate ("/flash/f", 700) == 0);
+    struct utimbuf times =
+      { 1000000000, 1000000002 };
+    assert(__posix_utime ("/flash/f", &times) == 0);
+    assert(__posix_chmod ("/flash/f", 0600) == 0);
+    assert(__posix_stat ("/flash/f", &st) == 0);
+    assert(st.st_size == 700);
+    assert(st.st_mtime == 1000000002);
+    assert((st.st_mode & 0777) == 0600);
+  }
+
+  {
+    // No preallocation, posix_fallocate() writes zeros.
+    int fd = __posix_open ("/flash/z", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 100) == 100);
+    assert(__posix_fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, 1000) == -1);
+    assert(errno == EOPNOTSUPP);
+    assert(__posix_posix_fallocate (fd, 0, 50) == 0);
+    assert(__posix_posix_fallocate (fd, 500, 1500) == 0);
+    // The offset is kept.
+    assert(__posix_lseek (fd, 0, SEEK_CUR) == 100);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 2000);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 2000);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(isZero (buf + 100, 1900));
+    assert(__posix_close (fd) == 0);
+
+    fd = __posix_open ("/flash/z", O_RDONLY);
+    assert(fd >= 0);
+    assert(__posix_posix_fallocate (fd, 0, 3000) == EBADF);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/flash/z") == 0);
+  }
+
+  {
+    // Directories and rename.
+    assert(__posix_mkdir ("/flash/d", 0777) == 0);
+    assert(__posix_mkdir ("/flash/d", 0777) == -1);
+    assert(errno == EEXIST);
+    assert(__posix_mkdir ("/flash/d/sub", 0777) == 0);
+    assert(__posix_mkdir ("/flash/x/y", 0777) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_open ("/flash/d", O_RDONLY) == -1);
+    assert(errno == EISDIR);
+
+    assert(writeFile ("/flash/d/a", data, 3000) == 0);
+    assert(writeFile ("/flash/d/b", other, 2000) == 0);
+    assert(countEntries ("/flash/d") == 3);
+    assert(__posix_stat ("/flash/d/a/x", &st) == -1);
+    assert(errno == ENOTDIR);
+
+    assert(__posix_rmdir ("/flash/d") == -1);
+    assert(errno == ENOTEMPTY);
+    assert(__posix_unlink ("/flash/d") == -1);
+    assert(errno == EISDIR);
+    assert(__posix_rmdir ("/flash/d/a") == -1);
+    assert(errno == ENOTDIR);
+
+    // Replace an existing file.
+    assert(__posix_rename ("/flash/d/b", "/flash/d/a") == 0);
+    assert(readsBack ("/flash/d/a", other, 2000));
+    assert(__posix_stat ("/flash/d/b", &st) == -1);
+    assert(__posix_rename ("/flash/d/a", "/flash/d/sub") == -1);
+    assert(errno == EISDIR);
+
+    // Not into itself.
+    assert(__posix_rename ("/flash/d", "/flash/d/sub/d") == -1);
+    assert(errno == EINVAL);
+    assert(__posix_mkdir ("/flash/e", 0777) == 0);
+    assert(__posix_rename ("/flash/d", "/flash/e/d") == 0);
+    assert(readsBack ("/flash/e/d/a", other, 2000));
+
+    DIR* pdir = __posix_opendir ("/flash/e/d/sub");
+    assert(pdir != nullptr);
+    assert(__posix_rmdir ("/flash/e/d/sub") == -1);
+    assert(errno == EBUSY);
+    assert(__posix_closedir (pdir) == 0);
+    assert(__posix_rmdir ("/flash/e/d/sub") == 0);
+  }
+
+  {
+    // The content after remount.
+    assert(mm.umount ("/flash/", 0) == 0);
+    assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+
+    assert(__posix_stat ("/flash/f", &st) == 0);
+    assert(st.st_size == 700);
+    assert(st.st_mtime == 1000000002);
+    assert((st.st_mode & 0777) == 0600);
+    assert(readsBack ("/flash/e/d/a", other, 2000));
+    assert(__posix_stat ("/flash/d", &st) == -1);
+    assert(__posix_stat ("/flash/e/d", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert(countEntries ("/flash/") == 2);
+    assert(countEntries ("/flash/e/d") == 1);
+
+    assert(__posix_unlink ("/flash/f") == 0);
+    assert(__posix_unlink ("/flash/e/d/a") == 0);
+    assert(__posix_rmdir ("/flash/e/d") == 0);
+    assert(__posix_rmdir ("/flash/e") == 0);
+    assert(countEntries ("/flash/") == 0);
+    assert(mm.umount ("/flash/", 0) == 0);
+  }
+
+  {
+    // Power loss at each write of a sequence of updates: the file has
+    // either the old or the new content, and the file system is
+    // mounted and usable.
+    assert(FlashFileSystem::format (&ram, SEGMENT_BLOCKS) == 0);
+    assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+    assert(writeFile ("/flash/keep", data, 3000) == 0);
+    for (int i = 0; i < 8; ++i)
+      {
+        char path[16];
+        std::snprintf (path, sizeof(path), "/flash/s%d", i);
+        assert(writeFile (path, data, sizeof(data)) == 0);
+      }
+    assert(mm.umount ("/flash/", 0) == 0);
+    std::memcpy (snapshot, image, sizeof(image));
+
+    bool completed = false;
+    for (std::size_t budget = 1; !completed; ++budget)
+      {
+        std::memcpy (image, snapshot, sizeof(image));
+
+        CutDevice cut
+          { image, budget };
+        assert(mm.mount (&flash, "/flash/", &cut, 0) == 0);
+
+        // Enough updates to go through the garbage collection.
+        bool renamed = false;
+        for (int i = 0; (i < 60) && !cut.isCut (); ++i)
+          {
+            char path[16];
+            std::snprintf (path, sizeof(path), "/flash/t%d", i % 3);
+            writeFile (path, data + i,
+                       700 + 300 * static_cast<std::size_t> (i % 5));
+
+            // Rewrite a chunk of a file with the same content, such
+            // that the collection has live blocks to move.
+            std::snprintf (path, sizeof(path), "/flash/s%d", i % 8);
+            int fd = __posix_open (path, O_WRONLY);
+            if (fd >= 0)
+              {
+                off_t offset = (i * 1000) % 8000;
+                __posix_lseek (fd, offset, SEEK_SET);
+                __posix_write (fd, data + offset, 100);
+                __posix_close (fd);
+              }
+          }
+        if (!cut.isCut ())
+          {
+            writeFile ("/flash/new", other, 2500);
+          }
+        if (!cut.isCut ())
+          {
+            renamed = (__posix_rename ("/flash/new", "/flash/keep") == 0);
+          }
+        if (!cut.isCut ())
+          {
+            __posix_unlink ("/flash/t0");
+          }
+        completed = !cut.isCut ();
+        mm.umount ("/flash/", 0);
+
+        assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+        assert(
+            readsBack ("/flash/keep", other, 2500)
+                || (!renamed && readsBack ("/flash/keep", data, 3000)));
+        assert(readsBack ("/flash/s7", data, sizeof(data)));
+        assert(writeFile ("/flash/after", data, 1000) == 0);
+        assert(mm.umount ("/flash/", 0) == 0);
+
+        assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+        assert(readsBack ("/flash/after", data, 1000));
+        assert(mm.umount ("/flash/", 0) == 0);
+      }
+  }
+
+  {
+    // Wear leveling: a file never changed does not keep its segments
+    // away from the rewrites of another one; the collection is done
+    // in small steps.
+    assert(FlashFileSystem::format (&ram, SEGMENT_BLOCKS) == 0);
+    assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+    assert(writeFile ("/flash/cold", data, sizeof(data)) == 0);
+
+    int fd = __posix_open ("/flash/hot", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    std::size_t maxMoved = 0;
+    for (int i = 0; i < 3000; ++i)
+      {
+        std::size_t moved = flash.getMovedBlocks ();
+        assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+        assert(__posix_write (fd, data + (i % 50), 400) == 400);
+        assert(__posix_fsync (fd) == 0);
+        if (flash.getMovedBlocks () - moved > maxMoved)
+          {
+            maxMoved = flash.getMovedBlocks () - moved;
+          }
+      }
+    assert(__posix_close (fd) == 0);
+
+    assert(flash.getMovedBlocks () > 0);
+    assert(maxMoved <= SEGMENT_BLOCKS);
+    assert(
+        flash.getMaxErases () - flash.getMinErases ()
+            <= 2 * OS_INTEGER_FLASHFS_WEAR_DELTA);
+    assert(readsBack ("/flash/cold", data, sizeof(data)));
+
+    // A full device, with room again after a removal.
+    fd = __posix_open ("/flash/fill", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    while (__posix_write (fd, data, sizeof(data))
+        == static_cast<ssize_t> (sizeof(data)))
+      {
+        ;
+      }
+    assert(__posix_write (fd, data, sizeof(data)) == -1);
+    assert(errno == ENOSPC);
+    __posix_close (fd);
+    assert(__posix_unlink ("/flash/fill") == 0);
+    assert(writeFile ("/flash/more", data, sizeof(data)) == 0);
+    assert(readsBack ("/flash/cold", data, sizeof(data)));
+    assert(mm.umount ("/flash/", 0) == 0);
+
+    assert(mm.mount (&flash, "/flash/", &ram, 0) == 0);
+    assert(readsBack ("/flash/more", data, sizeof(data)));
+    assert(readsBack ("/flash/hot", data + (2999 % 50), 400));
+    assert(mm.umount ("/flash/", 0) == 0);
+  }
+
+  {
+    // The removed objects do not keep their numbers on a device
+    // with plenty of free segments.
+    assert(FlashFileSystem::format (&largeRam, SEGMENT_BLOCKS) == 0);
+    assert(mm.mount (&large, "/large/", &largeRam, 0) == 0);
+    assert(writeFile ("/large/keep", data, 3000) == 0);
+    for (int i = 0; i < 1000; ++i)
+      {
+        int fd = __posix_open ("/large/f", O_CREAT | O_WRONLY, 0644);
+        assert(fd >= 0);
+        assert(__posix_write (fd, data + (i % 50), 1) == 1);
+        assert(__posix_close (fd) == 0);
+        if ((i % 2) == 0)
+          {
+            assert(__posix_unlink ("/large/f") == 0);
+          }
+        else
+          {
+            assert(writeFile ("/large/g", other, 100) == 0);
+            assert(__posix_rename ("/large/g", "/large/f") == 0);
+          }
+      }
+    assert(large.getFreeSegments () > large.getSegmentsCount () / 2);
+    assert(readsBack ("/large/f", other, 100));
+    assert(readsBack ("/large/keep", data, 3000));
+    assert(mm.umount ("/large/", 0) == 0);
+
+    assert(mm.mount (&large, "/large/", &largeRam, 0) == 0);
+    assert(readsBack ("/large/f", other, 100));
+    assert(readsBack ("/large/keep", data, 3000));
+    assert(countEntries ("/large/") == 2);
+    assert(mm.umount ("/large/", 0) == 0);
+  }
+
+  trace_puts ("'test-flash-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
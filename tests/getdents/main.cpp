@@ -0,0 +1,295 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/TmpFileSystem.h"
+#include "posix-io/HostFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/path.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t SECTOR_SIZE = 512;
+constexpr std::size_t BENCH_ENTRIES = 5000;
+
+FileDescriptorsManager dm
+  { 8 };
+
+MountManager mm
+  { 4 };
+
+TPool<FatFile> fatFiles
+  { 2 };
+
+TPool<FatDirectory> fatDirs
+  { 2 };
+
+FatFileSystem fat
+  { &fatFiles, &fatDirs };
+
+TPool<TmpFile> tmpFiles
+  { 2 };
+
+TPool<TmpDirectory> tmpDirs
+  { 2 };
+
+RamBlockDevice arena
+  { SECTOR_SIZE, 64 };
+
+TmpFileSystem tmpfs
+  { &tmpFiles, &tmpDirs, &arena, BENCH_ENTRIES + 8 };
+
+TPool<HostFile> hostFiles
+  { 2 };
+
+TPool<HostDirectory> hostDirs
+  { 2 };
+
+// 1 MiB, FAT12 with 512 bytes clusters.
+RamBlockDevice device
+  { SECTOR_SIZE, 2048 };
+
+static char root[] = "/tmp/posix-io-getdents-XXXXXX";
+
+alignas(struct posix_dent) static std::uint8_t buf[4096];
+
+static void
+writeFile (const char* path)
+{
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  assert(fd >= 0);
+  assert(__posix_close (fd) == 0);
+}
+
+// List a directory with posix_getdents() and a buffer of `size`
+// bytes, checking each entry against stat(); return the number of
+// entries.
+static std::size_t
+list (const char* dirname, std::size_t size, bool knownTypes)
+{
+  DIR* pdir = __posix_opendir (dirname);
+  assert(pdir != nullptr);
+  int fd = __posix_dirfd (pdir);
+  assert(fd >= 0);
+
+  std::size_t count = 0;
+  char path[OS_INTEGER_PATH_MAX];
+  struct stat st;
+  ssize_t n;
+  while ((n = __posix_posix_getdents (fd, buf, size, 0)) > 0)
+    {
+      assert(static_cast<std::size_t> (n) <= size);
+      for (ssize_t at = 0; at < n;)
+        {
+          auto* dent = reinterpret_cast<struct posix_dent*> (buf + at);
+          assert(dent->d_reclen % alignof(struct posix_dent) == 0);
+          assert(joinPath (dirname, dent->d_name, path, sizeof(path))
+                 != nullptr);
+          assert(__posix_stat (path, &st) == 0);
+          assert(dent->d_ino == st.st_ino);
+          if (knownTypes)
+            {
+              assert(dent->d_type == (S_ISDIR(st.st_mode) ? DT_DIR : DT_REG));
+            }
+          else
+            {
+              assert(dent->d_type == DT_UNKNOWN);
+            }
+          at += dent->d_reclen;
+          ++count;
+        }
+    }
+  assert(n == 0);
+  assert(__posix_closedir (pdir) == 0);
+  return count;
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  assert(FatFileSystem::format (&device) == 0);
+  assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+
+  char name[32];
+
+  {
+    // All the entries, with any buffer that holds one.
+    assert(__posix_mkdir ("/fat/d", 0777) == 0);
+    for (int i = 0; i < 40; ++i)
+      {
+        std::snprintf (name, sizeof(name), "/fat/d/A Long Name %d", i);
+        writeFile (name);
+      }
+    assert(__posix_mkdir ("/fat/d/sub", 0777) == 0);
+    assert(list ("/fat/d", sizeof(buf), true) == 41);
+    assert(list ("/fat/d", 40, true) == 41);
+    assert(list ("/fat/d/sub", sizeof(buf), true) == 0);
+
+    // A buffer too small for the next entry; it is not skipped.
+    DIR* pdir = __posix_opendir ("/fat/d");
+    int fd = __posix_dirfd (pdir);
+    errno = 0;
+    assert(__posix_posix_getdents (fd, buf, 20, 0) == -1);
+    assert(errno == EINVAL);
+    assert(__posix_posix_getdents (fd, buf, sizeof(buf), 0) > 0);
+    auto* dent = reinterpret_cast<struct posix_dent*> (buf);
+    assert(std::strcmp (dent->d_name, "A Long Name 0") == 0);
+
+    // Mixed with readdir(), and rewound.
+    struct dirent* entry = __posix_readdir (pdir);
+    assert(entry == nullptr);
+    __posix_rewinddir (pdir);
+    entry = __posix_readdir (pdir);
+    assert(entry != nullptr);
+    assert(std::strcmp (entry->d_name, dent->d_name) == 0);
+    assert(__posix_posix_getdents (fd, buf, 40, 0) > 0);
+    assert(std::strcmp (dent->d_name, "A Long Name 1") == 0);
+
+    // Invalid.
+    errno = 0;
+    assert(__posix_posix_getdents (fd, buf, sizeof(buf), 1) == -1);
+    assert(errno == EINVAL);
+    assert(__posix_posix_getdents (fd, nullptr, sizeof(buf), 0) == -1);
+    assert(errno == EFAULT);
+    assert(__posix_closedir (pdir) == 0);
+    assert(__posix_posix_getdents (fd, buf, sizeof(buf), 0) == -1);
+    assert(errno == EBADF);
+    fd = __posix_open ("/fat/d/A Long Name 0", O_RDONLY);
+    assert(__posix_posix_getdents (fd, buf, sizeof(buf), 0) == -1);
+    assert(errno == ENOTDIR);
+    assert(__posix_close (fd) == 0);
+  }
+
+  {
+    // In memory.
+    assert(mm.mount (&tmpfs, "/mem/", nullptr, 0) == 0);
+    assert(__posix_mkdir ("/mem/d", 0755) == 0);
+    writeFile ("/mem/a");
+    writeFile ("/mem/d/b");
+    assert(list ("/mem/", sizeof(buf), true) == 2);
+    assert(list ("/mem/", 24, true) == 2);
+    assert(list ("/mem/d", sizeof(buf), true) == 1);
+  }
+
+  {
+    // Without a specific implementation, readdir() while there is
+    // room for the longest name.
+    assert(::mkdtemp (root) != nullptr);
+    HostFileSystem host
+      { &hostFiles, &hostDirs, root };
+    assert(mm.mount (&host, "/host/", nullptr, 0) == 0);
+    writeFile ("/host/a");
+    writeFile ("/host/b");
+    assert(__posix_mkdir ("/host/c", 0755) == 0);
+    assert(list ("/host/", sizeof(buf), false) == 3);
+    DIR* pdir = __posix_opendir ("/host/");
+    errno = 0;
+    assert(__posix_posix_getdents (__posix_dirfd (pdir), buf, 100, 0) == -1);
+    assert(errno == EINVAL);
+    assert(__posix_closedir (pdir) == 0);
+
+    assert(__posix_unlink ("/host/a") == 0);
+    assert(__posix_unlink ("/host/b") == 0);
+    assert(__posix_rmdir ("/host/c") == 0);
+    assert(mm.umount ("/host/", 0) == 0);
+    assert(::rmdir (root) == 0);
+  }
+
+  {
+    // A large directory, one entry at a time and in bulk.
+    assert(__posix_mkdir ("/mem/big", 0755) == 0);
+    for (std::size_t i = 0; i < BENCH_ENTRIES; ++i)
+      {
+        std::snprintf (name, sizeof(name), "/mem/big/entry-%u",
+                       static_cast<unsigned int> (i));
+        writeFile (name);
+      }
+
+    DIR* pdir = __posix_opendir ("/mem/big");
+    int fd = __posix_dirfd (pdir);
+    std::size_t one = 0;
+    std::size_t bulk = 0;
+
+    auto begin = std::chrono::steady_clock::now ();
+    while (__posix_readdir (pdir) != nullptr)
+      {
+        ++one;
+      }
+    auto middle = std::chrono::steady_clock::now ();
+    __posix_rewinddir (pdir);
+    ssize_t n;
+    std::size_t calls = 0;
+    while ((n = __posix_posix_getdents (fd, buf, sizeof(buf), 0)) > 0)
+      {
+        ++calls;
+        for (ssize_t at = 0; at < n; ++bulk)
+          {
+            at += reinterpret_cast<struct posix_dent*> (buf + at)->d_reclen;
+          }
+      }
+    auto end = std::chrono::steady_clock::now ();
+    assert(__posix_closedir (pdir) == 0);
+
+    assert((one == BENCH_ENTRIES) && (bulk == one));
+    assert(calls < one / 50);
+
+    std::chrono::duration<double, std::nano> single = middle - begin;
+    std::chrono::duration<double, std::nano> batch = end - middle;
+    trace_printf ("%u entries: readdir() %.0f ns, posix_getdents() %.0f ns "
+                  "per entry, %u calls\n",
+                  static_cast<unsigned int> (one), single.count () / one,
+                  batch.count () / one, static_cast<unsigned int> (calls));
+
+    assert(mm.umount ("/mem/", 0) == 0);
+  }
+
+  assert(mm.umount ("/fat/", 0) == 0);
+
+  trace_puts ("'test-getdents-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
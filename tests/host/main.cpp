@@ -0,0 +1,315 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "posix-io/HostFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 2 };
+
+TPool<HostFile> files
+  { 4 };
+
+TPool<HostDirectory> dirs
+  { 2 };
+
+static char root[] = "/tmp/posix-io-host-XXXXXX";
+
+// The host path of a file in the root directory.
+static const char*
+native (const char* name)
+{
+  static char path[128];
+  std::snprintf (path, sizeof(path), "%s/%s", root, name);
+  return path;
+}
+
+constexpr std::size_t BENCH_ITERATIONS = 20000;
+constexpr std::size_t BENCH_BLOCK = 4096;
+
+template<typename F>
+  static double
+  benchmark (F op)
+  {
+    auto begin = std::chrono::steady_clock::now ();
+
+    for (std::size_t n = 0; n < BENCH_ITERATIONS; ++n)
+      {
+        op (n);
+      }
+
+    auto end = std::chrono::steady_clock::now ();
+    std::chrono::duration<double, std::nano> elapsed = end - begin;
+    return elapsed.count () / BENCH_ITERATIONS;
+  }
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  assert(::mkdtemp (root) != nullptr);
+
+  HostFileSystem host
+    { &files, &dirs, root };
+
+  {
+    // A missing directory is not mounted.
+    HostFileSystem missing
+      { &files, &dirs, "/none/such/directory" };
+    assert(mm.mount (&missing, "/none/", nullptr, 0) == -1);
+    assert(errno == ENOENT);
+  }
+
+  assert(mm.mount (&host, "/host/", nullptr, 0) == 0);
+
+  char buf[BENCH_BLOCK];
+  struct stat st;
+
+  {
+    // Files written through the library are host files.
+    int fd = __posix_open ("/host/a.txt", O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    assert(fd >= 0);
+    assert(__posix_write (fd, "hello ", 6) == 6);
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char*> ("host ");
+    iov[0].iov_len = 5;
+    iov[1].iov_base = const_cast<char*> ("world");
+    iov[1].iov_len = 5;
+    assert(__posix_writev (fd, iov, 2) == 10);
+    assert(__posix_fsync (fd) == 0);
+    assert(__posix_close (fd) == 0);
+
+    int hfd = ::open (native ("a.txt"), O_RDONLY);
+    assert(hfd >= 0);
+    assert(::read (hfd, buf, sizeof(buf)) == 16);
+    assert(std::memcmp (buf, "hello host world", 16) == 0);
+    assert(::fstat (hfd, &st) == 0);
+    assert((st.st_mode & 0777) == 0640);
+    ::close (hfd);
+
+    // And the other way around.
+    hfd = ::open (native ("b.txt"), O_WRONLY | O_CREAT, 0644);
+    assert(hfd >= 0);
+    assert(::write (hfd, "0123456789", 10) == 10);
+    ::close (hfd);
+
+    fd = __posix_open ("/host/b.txt", O_RDWR);
+    assert(fd >= 0);
+    assert(__posix_lseek (fd, 4, SEEK_SET) == 4);
+    assert(__posix_read (fd, buf, 3) == 3);
+    assert(std::memcmp (buf, "456", 3) == 0);
+    assert(__posix_ftruncate (fd, 5) == 0);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 5);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 0);
+    // Allocated by the host, or else written with zeros.
+    assert(__posix_posix_fallocate (fd, 0, 4096) == 0);
+    assert(::stat (native ("b.txt"), &st) == 0);
+    assert(st.st_size == 4096);
+    assert(__posix_ftruncate (fd, 5) == 0);
+    assert(__posix_close (fd) == 0);
+
+    assert(__posix_open ("/host/a.txt", O_WRONLY | O_CREAT | O_EXCL, 0644)
+        == -1);
+    assert(errno == EEXIST);
+    assert(__posix_open ("/host/none", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+  }
+
+  {
+    // Path functions.
+    assert(__posix_stat ("/host/a.txt", &st) == 0);
+    assert(S_ISREG(st.st_mode));
+    assert(st.st_size == 16);
+    assert(__posix_chmod ("/host/a.txt", 0600) == 0);
+    struct utimbuf times;
+    times.actime = 1500000000;
+    times.modtime = 1600000000;
+    assert(__posix_utime ("/host/a.txt", &times) == 0);
+    assert(::stat (native ("a.txt"), &st) == 0);
+    assert((st.st_mode & 0777) == 0600);
+    assert(st.st_mtime == 1600000000);
+    assert(__posix_truncate ("/host/a.txt", 5) == 0);
+    assert(__posix_stat ("/host/a.txt", &st) == 0);
+    assert(st.st_size == 5);
+
+    assert(__posix_mkdir ("/host/d", 0755) == 0);
+    assert(__posix_mkdir ("/host/d", 0755) == -1);
+    assert(errno == EEXIST);
+    assert(__posix_rename ("/host/b.txt", "/host/d/c.txt") == 0);
+    assert(::stat (native ("d/c.txt"), &st) == 0);
+    assert(__posix_rmdir ("/host/d") == -1);
+    assert(errno == ENOTEMPTY);
+
+    // The root lists the host entries, without `.` and `..`.
+    DIR* pdir = __posix_opendir ("/host/");
+    assert(pdir != nullptr);
+    unsigned int found = 0;
+    struct dirent* de;
+    while ((de = __posix_readdir (pdir)) != nullptr)
+      {
+        if (std::strcmp (de->d_name, "a.txt") == 0)
+          {
+            found |= 1;
+          }
+        else if (std::strcmp (de->d_name, "d") == 0)
+          {
+            found |= 2;
+          }
+        else
+          {
+            found |= 4;
+          }
+      }
+    assert(found == 3);
+    __posix_rewinddir (pdir);
+    assert(__posix_readdir (pdir) != nullptr);
+    assert(__posix_closedir (pdir) == 0);
+
+    assert(__posix_opendir ("/host/a.txt") == nullptr);
+    assert(errno == ENOTDIR);
+  }
+
+  {
+    // The *at() functions use the host descriptor of the directory.
+    DIR* pdir = __posix_opendir ("/host/d");
+    assert(pdir != nullptr);
+    int dfd = __posix_dirfd (pdir);
+    assert(dfd >= 0);
+
+    int fd = __posix_openat (dfd, "e.txt", O_WRONLY | O_CREAT, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, "at", 2) == 2);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_fstatat (dfd, "e.txt", &st, 0) == 0);
+    assert(st.st_size == 2);
+    assert(__posix_mkdirat (dfd, "sub", 0755) == 0);
+    assert(__posix_renameat (dfd, "e.txt", dfd, "sub/f.txt") == 0);
+    assert(::stat (native ("d/sub/f.txt"), &st) == 0);
+    assert(__posix_unlinkat (dfd, "sub/f.txt", 0) == 0);
+    assert(__posix_unlinkat (dfd, "sub", AT_REMOVEDIR) == 0);
+    assert(__posix_unlinkat (dfd, "c.txt", 0) == 0);
+    assert(__posix_fstatat (dfd, "c.txt", &st, 0) == -1);
+    assert(errno == ENOENT);
+
+    assert(__posix_closedir (pdir) == 0);
+    assert(__posix_rmdir ("/host/d") == 0);
+  }
+
+  {
+    // ----- Benchmark -----
+
+    // The overhead of the library over the host system calls.
+    static char bench[128];
+    std::strcpy (bench, native ("bench"));
+    int hfd = ::open (bench, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(hfd >= 0);
+    std::memset (buf, 'x', sizeof(buf));
+    for (std::size_t i = 0; i < 64; ++i)
+      {
+        assert(::write (hfd, buf, sizeof(buf)) == sizeof(buf));
+      }
+    ::close (hfd);
+
+    double nativeStat = benchmark ([&st](std::size_t)
+      { assert(::stat (bench, &st) == 0);});
+    double posixStat = benchmark ([&st](std::size_t)
+      { assert(__posix_stat ("/host/bench", &st) == 0);});
+
+    double nativeOpen = benchmark ([](std::size_t)
+      {
+        int f = ::open (bench, O_RDONLY);
+        assert(f >= 0);
+        ::close (f);
+      });
+    double posixOpen = benchmark ([](std::size_t)
+      {
+        int f = __posix_open ("/host/bench", O_RDONLY);
+        assert(f >= 0);
+        __posix_close (f);
+      });
+
+    hfd = ::open (bench, O_RDONLY);
+    int fd = __posix_open ("/host/bench", O_RDONLY);
+    assert((hfd >= 0) && (fd >= 0));
+    double nativeRead = benchmark ([hfd, &buf](std::size_t n)
+      {
+        ::lseek (hfd, static_cast<off_t> ((n % 64) * BENCH_BLOCK), SEEK_SET);
+        assert(::read (hfd, buf, BENCH_BLOCK) == BENCH_BLOCK);
+      });
+    double posixRead = benchmark ([fd, &buf](std::size_t n)
+      {
+        __posix_lseek (fd, static_cast<off_t> ((n % 64) * BENCH_BLOCK), SEEK_SET);
+        assert(__posix_read (fd, buf, BENCH_BLOCK) == BENCH_BLOCK);
+      });
+    ::close (hfd);
+    __posix_close (fd);
+
+    trace_printf ("stat(): native %.0f ns, posix-io %.0f ns\n", nativeStat,
+                  posixStat);
+    trace_printf ("open()/close(): native %.0f ns, posix-io %.0f ns\n",
+                  nativeOpen, posixOpen);
+    trace_printf ("lseek()/read() 4 KiB: native %.0f ns, posix-io %.0f ns\n",
+                  nativeRead, posixRead);
+
+    assert(__posix_unlink ("/host/bench") == 0);
+  }
+
+  assert(__posix_unlink ("/host/a.txt") == 0);
+  assert(mm.umount ("/host/", 0) == 0);
+  assert(::rmdir (root) == 0);
+
+  trace_puts ("'test-host-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
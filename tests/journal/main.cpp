@@ -0,0 +1,379 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/BlockJournal.h"
+#include "posix-io/RamBlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr std::size_t BLOCKS_COUNT = 64;
+
+// The journal region: the header and 9 log blocks.
+constexpr BlockDevice::blockNumber_t START = 1;
+constexpr BlockDevice::blockNumber_t COUNT = 10;
+
+// A device that can be cut, as by a power failure: after a number
+// of writes, the last one only half done, nothing else is written.
+class CutDevice : public RamBlockDevice
+{
+public:
+
+  CutDevice (void* storage) :
+      RamBlockDevice (storage, BLOCK_SIZE, BLOCKS_COUNT)
+  {
+    fCutting = false;
+    fBudget = 0;
+  }
+
+  void
+  cut (std::size_t writes)
+  {
+    fCutting = true;
+    fBudget = writes;
+  }
+
+  void
+  restore (void)
+  {
+    fCutting = false;
+  }
+
+protected:
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count) override
+  {
+    if (fCutting)
+      {
+        if (fBudget == 0)
+          {
+            errno = EIO;
+            return -1;
+          }
+        if (--fBudget == 0)
+          {
+            std::memcpy (getStorage () + block * BLOCK_SIZE, buf,
+                         BLOCK_SIZE / 2);
+            errno = EIO;
+            return -1;
+          }
+      }
+    return RamBlockDevice::do_write (buf, block, count);
+  }
+
+  virtual int
+  do_flush (void) override
+  {
+    if (fCutting && (fBudget == 0))
+      {
+        errno = EIO;
+        return -1;
+      }
+    return 0;
+  }
+
+private:
+
+  bool fCutting;
+  std::size_t fBudget;
+};
+
+static std::uint8_t storage[BLOCKS_COUNT * BLOCK_SIZE];
+
+static void
+fill (std::uint8_t* buf, char seed)
+{
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+    {
+      buf[i] = static_cast<std::uint8_t> (seed + static_cast<char> (i % 13));
+    }
+}
+
+static bool
+has (const std::uint8_t* buf, char seed)
+{
+  std::uint8_t expected[BLOCK_SIZE];
+  fill (expected, seed);
+  return std::memcmp (buf, expected, BLOCK_SIZE) == 0;
+}
+
+// The block on the device.
+static bool
+holds (BlockDevice::blockNumber_t block, char seed)
+{
+  return has (storage + block * BLOCK_SIZE, seed);
+}
+
+static void
+stage (BlockJournal& journal, BlockDevice::blockNumber_t block, char seed)
+{
+  std::uint8_t buf[BLOCK_SIZE];
+  fill (buf, seed);
+  assert(journal.write (buf, block, 1) == 1);
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  CutDevice device
+    { storage };
+
+  std::uint8_t buf[3 * BLOCK_SIZE];
+  std::uint8_t rbuf[4 * BLOCK_SIZE];
+
+  {
+    BlockJournal journal
+      { 8 };
+
+    // Not formatted.
+    errno = 0;
+    assert((journal.attach (&device, START, COUNT) == -1) && (errno == EINVAL));
+    assert(!journal.isAttached ());
+
+    assert(BlockJournal::format (&device, START, COUNT) == 0);
+    // Not the same region.
+    errno = 0;
+    assert(journal.attach (&device, START, COUNT - 1) == -1);
+    assert(errno == EINVAL);
+
+    assert(journal.attach (&device, START, COUNT) == 0);
+    assert(journal.isAttached ());
+    errno = 0;
+    assert((journal.attach (&device, START, COUNT) == -1) && (errno == EBUSY));
+    assert(journal.getCapacity () == 8);
+    assert(journal.getReplayed () == 0);
+
+    // Staged blocks are read back, but are not on the device yet.
+    stage (journal, 20, 'a');
+    fill (buf, 'b');
+    fill (buf + BLOCK_SIZE, 'c');
+    assert(journal.write (buf, 21, 2) == 2);
+    stage (journal, 20, 'd');
+    assert(journal.getStaged () == 3);
+    assert(!holds (20, 'd'));
+
+    assert(journal.read (rbuf, 19, 4) == 4);
+    assert(has (rbuf + BLOCK_SIZE, 'd'));
+    assert(has (rbuf + 2 * BLOCK_SIZE, 'b'));
+    assert(has (rbuf + 3 * BLOCK_SIZE, 'c'));
+
+    // One flush for the log; the home blocks are flushed only before
+    // the log is reused.
+    std::size_t flushes = journal.getFlushes ();
+    assert(journal.commit () == 0);
+    assert(journal.getCommits () == 1);
+    assert(journal.getStaged () == 0);
+    assert(holds (20, 'd') && holds (21, 'b') && holds (22, 'c'));
+    assert(journal.getFlushes () == flushes + 1);
+
+    stage (journal, 23, 'e');
+    assert(journal.commit () == 0);
+    assert(journal.getFlushes () == flushes + 3);
+
+    // Nothing staged, nothing to do.
+    assert(journal.commit () == 0);
+    assert(journal.getCommits () == 2);
+
+    // Blocks written directly drop their staged images.
+    stage (journal, 24, 'f');
+    stage (journal, 25, 'g');
+    assert(journal.release (24, 1) == 0);
+    assert(journal.getStaged () == 1);
+    assert(journal.read (rbuf, 24, 2) == 2);
+    assert(!has (rbuf, 'f'));
+    assert(has (rbuf + BLOCK_SIZE, 'g'));
+    assert(journal.release (25, 1) == 0);
+    assert(journal.getStaged () == 0);
+
+    // And empty the log, if it has them.
+    flushes = journal.getFlushes ();
+    assert(journal.release (30, 4) == 0);
+    assert(journal.getFlushes () == flushes);
+    assert(journal.release (22, 2) == 0);
+    assert(journal.getFlushes () == flushes + 2);
+
+    assert(journal.detach () == 0);
+    assert(!journal.isAttached ());
+    errno = 0;
+    assert((journal.commit () == -1) && (errno == EINVAL));
+
+    assert(journal.attach (&device, START, COUNT) == 0);
+    assert(journal.getReplayed () == 0);
+    assert(journal.detach () == 0);
+  }
+
+  {
+    // Cut after the log is written, while writing home: the
+    // transaction is completed at the next attach.
+    BlockJournal journal
+      { 8 };
+    assert(BlockJournal::format (&device, START, COUNT) == 0);
+    assert(journal.attach (&device, START, COUNT) == 0);
+    stage (journal, 30, 'h');
+    stage (journal, 31, 'i');
+    stage (journal, 33, 'j');
+    stage (journal, 32, 'k');
+
+    // The log, the header, and half of the first block.
+    device.cut (3);
+    assert(journal.commit () == -1);
+    assert(journal.detach () == -1);
+    device.restore ();
+    assert(!holds (30, 'h') && !holds (31, 'i'));
+
+    BlockJournal other
+      { 4 };
+    assert(other.attach (&device, START, COUNT) == 0);
+    assert(other.getReplayed () == 4);
+    assert(holds (30, 'h') && holds (31, 'i') && holds (32, 'k'));
+    assert(holds (33, 'j'));
+    assert(other.detach () == 0);
+
+    // Only once.
+    assert(other.attach (&device, START, COUNT) == 0);
+    assert(other.getReplayed () == 0);
+
+    // A damaged header is an empty journal; the previous transaction
+    // is on the device before a header is written.
+    stage (other, 30, 's');
+    device.cut (3);
+    assert(other.commit () == -1);
+    other.detach ();
+    device.restore ();
+    storage[START * BLOCK_SIZE + 20] ^= 0xFF;
+    assert(other.attach (&device, START, COUNT) == 0);
+    assert(other.getReplayed () == 0);
+    assert(!holds (30, 's'));
+    assert(other.detach () == 0);
+  }
+
+  {
+    // Cut while writing the log: the transaction is lost, the blocks
+    // are unchanged. Cut while writing the header, which is all in
+    // its first half: the transaction is complete.
+    BlockJournal journal
+      { 8 };
+    assert(BlockJournal::format (&device, START, COUNT) == 0);
+    for (std::size_t writes = 1; writes <= 2; ++writes)
+      {
+        assert(journal.attach (&device, START, COUNT) == 0);
+        stage (journal, 40, 'l');
+        assert(journal.commit () == 0);
+        stage (journal, 40, 'm');
+        stage (journal, 41, 'n');
+
+        device.cut (writes);
+        assert(journal.commit () == -1);
+        journal.detach ();
+        device.restore ();
+
+        assert(journal.attach (&device, START, COUNT) == 0);
+        if (writes == 1)
+          {
+            assert(journal.getReplayed () == 0);
+            assert(holds (40, 'l') && !holds (41, 'n'));
+          }
+        else
+          {
+            assert(journal.getReplayed () == 2);
+            assert(holds (40, 'm') && holds (41, 'n'));
+          }
+        assert(journal.detach () == 0);
+      }
+  }
+
+  {
+    // A transaction is at most the capacity, and the region.
+    BlockJournal journal
+      { 4 };
+    assert(BlockJournal::format (&device, START, COUNT) == 0);
+    assert(journal.attach (&device, START, COUNT) == 0);
+    assert(journal.getCapacity () == 4);
+    for (BlockDevice::blockNumber_t b = 50; b < 55; ++b)
+      {
+        stage (journal, b, 'o');
+      }
+    assert(journal.getCommits () == 1);
+    assert(journal.getStaged () == 1);
+    assert(journal.detach () == 0);
+    assert(holds (54, 'o'));
+
+    BlockJournal large
+      { 100 };
+    assert(large.attach (&device, START, COUNT) == 0);
+    assert(large.getCapacity () == COUNT - 1);
+    assert(large.detach () == 0);
+  }
+
+  {
+    // Group commit: once every 4 changing operations, or when more
+    // than half of the room is used.
+    BlockJournal journal
+      { 8, 4 };
+    assert(BlockJournal::format (&device, START, COUNT) == 0);
+    assert(journal.attach (&device, START, COUNT) == 0);
+    for (BlockDevice::blockNumber_t b = 50; b < 53; ++b)
+      {
+        journal.begin ();
+        stage (journal, b, 'p');
+        assert(!journal.end ());
+
+        // Not changing.
+        journal.begin ();
+        assert(journal.read (rbuf, b, 1) == 1);
+        assert(!journal.end ());
+      }
+    journal.begin ();
+    stage (journal, 50, 'q');
+    assert(journal.end ());
+    assert(journal.commit () == 0);
+
+    journal.begin ();
+    for (BlockDevice::blockNumber_t b = 50; b < 55; ++b)
+      {
+        stage (journal, b, 'r');
+      }
+    assert(journal.end ());
+    assert(journal.detach () == 0);
+    assert(holds (52, 'r'));
+  }
+
+  trace_puts ("'test-journal-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
+#include "posix-io/BlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+// Test class, only the mount/unmount/stat calls are implemented.
+
+class TestFileSystem : public os::posix::FileSystem
+{
+public:
+
+  TestFileSystem ();
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+
+  virtual int
+  do_unmount (unsigned int flags) override;
+
+  virtual void
+  do_sync (void) override;
+
+  virtual int
+  do_stat (const char* path, struct stat* buf) override;
+};
+
+TestFileSystem::TestFileSystem () :
+    os::posix::FileSystem (nullptr, nullptr)
+{
+  ;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+int
+TestFileSystem::do_unmount (unsigned int flags)
+{
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+void
+TestFileSystem::do_sync (void)
+{
+  ;
+}
+
+int
+TestFileSystem::do_stat (const char* path, struct stat* buf)
+{
+  // Must never be called after umount() returned.
+  assert(getBlockDevice () != nullptr);
+
+  std::memset (buf, 0, sizeof(*buf));
+  buf->st_size = static_cast<off_t> (std::strlen (path));
+
+  // Make the operation last a bit.
+  std::this_thread::yield ();
+
+  assert(getBlockDevice () != nullptr);
+  return 0;
+}
+
+// Required only as a reference, no functionality needed.
+class TestBlockDevice : public os::posix::BlockDevice
+{
+public:
+  TestBlockDevice () = default;
+};
+
+// ----------------------------------------------------------------------------
+
+constexpr std::size_t MOUNT_ARRAY_SIZE = 8;
+
+// Static manager
+os::posix::MountManager mm
+  { MOUNT_ARRAY_SIZE };
+
+TestFileSystem root_fs;
+TestFileSystem sd_fs;
+TestFileSystem logs_fs;
+TestFileSystem fs[MOUNT_ARRAY_SIZE];
+
+TestBlockDevice dev;
+
+// ----------------------------------------------------------------------------
+
+// The original linear search, first match in table order, kept
+// only as a reference for the benchmark.
+static os::posix::FileSystem*
+linearIdentify (const char** path)
+{
+  for (std::size_t i = 0; i < mm.getSize (); ++i)
+    {
+      auto* const mp = mm.getPath (i);
+      if (mp == nullptr)
+        {
+          continue;
+        }
+
+      auto len = std::strlen (mp);
+      if (std::strncmp (mp, *path, len) == 0)
+        {
+          *path = (*path + len - 1);
+          return mm.getFileSystem (i);
+        }
+    }
+  return mm.getRoot ();
+}
+
+static const char* benchPaths[] =
+  { "/sd/logs/2016/03/log-0001.txt", "/sd/config/settings.ini",
+      "/mnt6/data/samples.bin", "/var/lib/something/else", "/mnt0/a" };
+
+constexpr std::size_t BENCH_PATHS_SIZE = sizeof(benchPaths)
+    / sizeof(benchPaths[0]);
+
+constexpr std::size_t BENCH_ITERATIONS = 200000;
+
+template<typename F>
+  static double
+  benchmark (F identify)
+  {
+    auto begin = std::chrono::steady_clock::now ();
+
+    std::size_t found = 0;
+    for (std::size_t n = 0; n < BENCH_ITERATIONS; ++n)
+      {
+        const char* path = benchPaths[n % BENCH_PATHS_SIZE];
+        if (identify (&path) != nullptr)
+          {
+            ++found;
+          }
+      }
+    assert(found == BENCH_ITERATIONS);
+
+    auto end = std::chrono::steady_clock::now ();
+    std::chrono::duration<double, std::nano> elapsed = end - begin;
+    return elapsed.count () / BENCH_ITERATIONS;
+  }
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+    {
+      // ----- Longest prefix -----
+
+      assert(os::posix::MountManager::setRoot (&root_fs, &dev, 0) == 0);
+
+      // Mount the nested folder first.
+      errno = -2;
+      assert(
+          (os::posix::MountManager::mount (&logs_fs, "/sd/logs/", &dev, 0) == 0) && (errno == 0));
+      errno = -2;
+      assert(
+          (os::posix::MountManager::mount (&sd_fs, "/sd/", &dev, 0) == 0) && (errno == 0));
+
+      const char* path = "/sd/logs/today.txt";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &logs_fs);
+      assert(std::strcmp (path, "/today.txt") == 0);
+
+      path = "/sd/data.bin";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &sd_fs);
+      assert(std::strcmp (path, "/data.bin") == 0);
+
+      // Partial component match must not select the nested mount.
+      path = "/sd/logsx/a";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &sd_fs);
+      assert(std::strcmp (path, "/logsx/a") == 0);
+
+      path = "/sdx";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &root_fs);
+      assert(std::strcmp (path, "/sdx") == 0);
+
+      // Both paths are adjusted with the same prefix.
+      const char* path1 = "/sd/logs/a";
+      const char* path2 = "/sd/logs/b";
+      assert(
+          os::posix::MountManager::identifyFileSystem (&path1, &path2) == &logs_fs);
+      assert(std::strcmp (path1, "/a") == 0);
+      assert(std::strcmp (path2, "/b") == 0);
+
+      // Remove the nested mount, the outer one takes over.
+      assert(os::posix::MountManager::umount ("/sd/logs/", 0) == 0);
+      path = "/sd/logs/today.txt";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &sd_fs);
+      assert(std::strcmp (path, "/logs/today.txt") == 0);
+
+      // Mount it again, now in the reverse order in the table.
+      assert(
+          os::posix::MountManager::mount (&logs_fs, "/sd/logs/", &dev, 0) == 0);
+      path = "/sd/logs/today.txt";
+      assert(os::posix::MountManager::identifyFileSystem (&path) == &logs_fs);
+    }
+
+    {
+      // ----- Benchmark -----
+
+      // Fill the table with more mount points, the nested
+      // ones are already mounted.
+      char names[MOUNT_ARRAY_SIZE][8];
+      for (std::size_t i = 0; i < MOUNT_ARRAY_SIZE - 2; ++i)
+        {
+          std::snprintf (names[i], sizeof(names[i]), "/mnt%u/",
+                         static_cast<unsigned int> (i));
+          assert(
+              os::posix::MountManager::mount (&fs[i], names[i], &dev, 0) == 0);
+        }
+
+      double linear = benchmark (linearIdentify);
+      double trie = benchmark ([](const char** p)
+        { return os::posix::MountManager::identifyFileSystem (p);});
+
+      trace_printf ("identifyFileSystem(): linear %.1f ns, trie %.1f ns\n",
+                    linear, trie);
+
+      for (std::size_t i = 0; i < MOUNT_ARRAY_SIZE - 2; ++i)
+        {
+          assert(os::posix::MountManager::umount (names[i], 0) == 0);
+        }
+    }
+
+    {
+      // ----- Concurrent lookups -----
+
+      // Readers use the file system while it is mounted and
+      // unmounted repeatedly; umount() must wait for them. The
+      // paths go through a path cache, as in the system calls.
+      os::posix::PathCache cache
+        { 4 };
+      std::atomic<bool> done
+        { false };
+      std::atomic<unsigned int> ops
+        { 0 };
+
+      auto reader = [&done, &ops]()
+        {
+          struct stat st;
+          while (!done.load ())
+            {
+              int ret = os::posix::stat ("/hot/file", &st);
+              // Either the mounted file system ("/file"), or the root.
+              assert(ret == 0);
+              assert((st.st_size == 5) || (st.st_size == 9));
+              ops.fetch_add (1);
+            }
+        };
+
+      TestFileSystem hot_fs;
+
+      std::thread t1 (reader);
+      std::thread t2 (reader);
+      std::thread t3 (reader);
+
+      for (int i = 0; i < 2000; ++i)
+        {
+          assert(os::posix::MountManager::mount (&hot_fs, "/hot/", &dev, 0) == 0);
+          std::this_thread::yield ();
+          assert(os::posix::MountManager::umount ("/hot/", 0) == 0);
+          assert(hot_fs.getInFlight () == 0);
+          assert(hot_fs.getBlockDevice () == nullptr);
+        }
+
+      done.store (true);
+      t1.join ();
+      t2.join ();
+      t3.join ();
+
+      assert(ops.load () > 0);
+      assert(os::posix::PathCache::getHits () > 0);
+    }
+
+  trace_puts ("'test-mount-manager-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,333 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/NodeCache.h"
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t SECTOR_SIZE = 512;
+
+FileDescriptorsManager dm
+  { 8 };
+
+MountManager mm
+  { 2 };
+
+TPool<FatFile> files
+  { 4 };
+
+TPool<FatDirectory> dirs
+  { 2 };
+
+NodeCache nodes
+  { 4 };
+
+FatFileSystem fat
+  { &files, &dirs, nullptr, nullptr, &nodes };
+
+// A RAM device that counts the sectors read.
+class CountingDevice : public RamBlockDevice
+{
+public:
+
+  CountingDevice (blockNumber_t blocksCount) :
+      RamBlockDevice (SECTOR_SIZE, blocksCount)
+  {
+    reads = 0;
+  }
+
+  std::size_t reads;
+
+protected:
+
+  virtual ssize_t
+  do_read (void* buf, blockNumber_t block, std::size_t count) override
+  {
+    reads += count;
+    return RamBlockDevice::do_read (buf, block, count);
+  }
+};
+
+// 1 MiB, FAT12 with 512 bytes clusters.
+CountingDevice device
+  { 2048 };
+
+struct Data
+{
+  int value;
+  char name[8];
+};
+
+// All the values of a name, in any order.
+static std::size_t
+count (NodeCache& cache, std::uint32_t dir, std::uint32_t hash)
+{
+  std::size_t cursor = 0;
+  void* data;
+  std::size_t found = 0;
+  while (cache.lookup (dir, hash, &cursor, &data))
+    {
+      ++found;
+    }
+  return found;
+}
+
+static Data*
+add (NodeCache& cache, ino_t id, std::uint32_t dir, std::uint32_t hash,
+     std::uint32_t alias)
+{
+  auto* data = static_cast<Data*> (cache.add (id, dir, hash, alias));
+  if (data != nullptr)
+    {
+      data->value = static_cast<int> (id);
+    }
+  return data;
+}
+
+static void
+writeFile (const char* path, std::size_t size)
+{
+  static char buf[1024];
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  assert(fd >= 0);
+  assert(__posix_write (fd, buf, size) == static_cast<ssize_t> (size));
+  assert(__posix_close (fd) == 0);
+}
+
+// Replace the FAT sector buffer, by reading an unrelated file.
+static void
+evictBuffer (void)
+{
+  char buf[10];
+  int fd = __posix_open ("/fat/other", O_RDONLY);
+  assert(fd >= 0);
+  assert(__posix_read (fd, buf, sizeof(buf)) == sizeof(buf));
+  assert(__posix_close (fd) == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  {
+    NodeCache cache
+      { 3 };
+    cache.setDataSize (sizeof(Data));
+    assert(cache.getSize () == 3);
+
+    // Found by both names, in their directory only.
+    Data* data = add (cache, 10, 1, 100, 101);
+    assert((data != nullptr) && (cache.getUsed () == 1));
+    assert(count (cache, 1, 100) == 1);
+    assert(count (cache, 1, 101) == 1);
+    assert(count (cache, 2, 100) == 0);
+    assert(count (cache, 1, 102) == 0);
+    assert(cache.find (10) == data);
+    assert(cache.find (11) == nullptr);
+
+    // Collisions.
+    add (cache, 11, 1, 100, 100);
+    assert(count (cache, 1, 100) == 2);
+    assert(count (cache, 1, 101) == 1);
+
+    // Added again, under other names.
+    assert(add (cache, 11, 1, 103, 103) != nullptr);
+    assert(cache.getUsed () == 2);
+    assert(count (cache, 1, 100) == 1);
+    assert(count (cache, 1, 103) == 1);
+
+    // The least recently used node is recycled.
+    add (cache, 12, 2, 100, 100);
+    std::size_t cursor = 0;
+    void* found;
+    assert(cache.lookup (1, 100, &cursor, &found));
+    cache.use (found);
+    assert(cache.getHits () == 1);
+    add (cache, 13, 2, 101, 101);
+    assert(cache.find (11) == nullptr);
+    assert(cache.find (10) != nullptr);
+    assert(cache.getUsed () == 3);
+
+    // Referenced nodes are not recycled.
+    assert(cache.acquire (10));
+    assert(cache.acquire (12));
+    assert(cache.acquire (13));
+    assert(!cache.acquire (11));
+    assert(add (cache, 14, 1, 104, 104) == nullptr);
+    cache.release (13);
+    assert(add (cache, 14, 1, 104, 104) != nullptr);
+    assert(cache.find (13) == nullptr);
+    // Still referenced when added again.
+    add (cache, 12, 2, 105, 105);
+    assert(cache.acquire (14));
+    assert(add (cache, 15, 1, 106, 106) == nullptr);
+    cache.release (14);
+
+    // Removed, referenced or not.
+    cache.remove (10);
+    assert(cache.find (10) == nullptr);
+    assert(count (cache, 1, 101) == 0);
+    assert(cache.getUsed () == 2);
+    cache.drop (2);
+    assert(cache.find (12) == nullptr);
+    assert(cache.getUsed () == 1);
+    cache.clear ();
+    assert(cache.getUsed () == 0);
+    assert(cache.getMisses () == 7);
+  }
+
+  // --------------------------------------------------------------------------
+
+  assert(FatFileSystem::format (&device) == 0);
+  assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+  assert(fat.getNodeCache () == &nodes);
+
+  struct stat st;
+  std::size_t reads;
+
+  writeFile ("/fat/other", 100);
+  assert(__posix_mkdir ("/fat/d", 0777) == 0);
+
+  {
+    // A recently created file is known.
+    writeFile ("/fat/d/Long Name.txt", 10);
+    evictBuffer ();
+    reads = device.reads;
+    assert(__posix_stat ("/fat/d/Long Name.txt", &st) == 0);
+    assert(st.st_size == 10);
+    assert(device.reads == reads);
+
+    // By any name.
+    assert(__posix_stat ("/fat/D/LONGNA~1.TXT", &st) == 0);
+    assert(device.reads == reads);
+
+    // Not a cached name.
+    assert(__posix_stat ("/fat/d/none", &st) == -1);
+    assert(device.reads > reads);
+
+    // Kept up to date.
+    writeFile ("/fat/d/Long Name.txt", 700);
+    assert(__posix_chmod ("/fat/d/Long Name.txt", 0444) == 0);
+    struct utimbuf times =
+      { 1000000000, 1000000000 };
+    assert(__posix_utime ("/fat/d/Long Name.txt", &times) == 0);
+    evictBuffer ();
+    reads = device.reads;
+    assert(__posix_stat ("/fat/d/Long Name.txt", &st) == 0);
+    assert(device.reads == reads);
+    assert(st.st_size == 700);
+    assert((st.st_mode & S_IWUSR) == 0);
+    assert(st.st_mtime == 1000000000);
+    assert(__posix_chmod ("/fat/d/Long Name.txt", 0644) == 0);
+
+    // Removed.
+    assert(__posix_unlink ("/fat/d/Long Name.txt") == 0);
+    assert(__posix_stat ("/fat/d/Long Name.txt", &st) == -1);
+    assert(errno == ENOENT);
+    writeFile ("/fat/d/b", 20);
+    assert(__posix_stat ("/fat/d/b", &st) == 0);
+    assert(st.st_size == 20);
+
+    // Moved.
+    assert(__posix_rename ("/fat/d/b", "/fat/c") == 0);
+    assert(__posix_stat ("/fat/d/b", &st) == -1);
+    assert(__posix_stat ("/fat/c", &st) == 0);
+    assert(st.st_size == 20);
+
+    // A directory removed and its cluster reused by another one.
+    assert(__posix_rmdir ("/fat/d") == 0);
+    assert(__posix_stat ("/fat/d/b", &st) == -1);
+    assert(__posix_mkdir ("/fat/e", 0777) == 0);
+    assert(__posix_stat ("/fat/e/b", &st) == -1);
+    assert(errno == ENOENT);
+  }
+
+  {
+    // An open file keeps its node, however many others are used.
+    writeFile ("/fat/e/f", 30);
+    int fd = __posix_open ("/fat/e/f", O_RDWR);
+    assert(fd >= 0);
+    char name[16];
+    for (int i = 0; i < 8; ++i)
+      {
+        std::snprintf (name, sizeof(name), "/fat/e/g%d", i);
+        writeFile (name, 40);
+      }
+    assert(__posix_write (fd, "xyz", 3) == 3);
+    evictBuffer ();
+    reads = device.reads;
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 30);
+    assert(__posix_stat ("/fat/e/f", &st) == 0);
+    assert(device.reads == reads);
+    assert(__posix_close (fd) == 0);
+
+    // The others are recycled.
+    std::size_t misses = nodes.getMisses ();
+    for (int i = 0; i < 8; ++i)
+      {
+        std::snprintf (name, sizeof(name), "/fat/e/g%d", i);
+        assert(__posix_stat (name, &st) == 0);
+        assert(st.st_size == 40);
+      }
+    assert(nodes.getMisses () > misses);
+    assert(nodes.getUsed () <= nodes.getSize ());
+  }
+
+  {
+    // Forgotten at unmount.
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(nodes.getUsed () == 0);
+    assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+    assert(__posix_stat ("/fat/e/f", &st) == 0);
+    assert(st.st_size == 30);
+    assert(mm.umount ("/fat/", 0) == 0);
+  }
+
+  trace_puts ("'test-node-cache-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "posix-io/OverlayFileSystem.h"
+#include "posix-io/RomFileSystem.h"
+#include "posix-io/RomImageBuilder.h"
+#include "posix-io/TmpFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr std::size_t BLOCKS = 128;
+
+// Counts the lookups reaching the lower file system.
+class CountingRomFileSystem : public RomFileSystem
+{
+public:
+
+  using RomFileSystem::RomFileSystem;
+
+  std::size_t lookups = 0;
+
+protected:
+
+  virtual int
+  do_stat (const char* path, struct stat* buf) override
+  {
+    ++lookups;
+    return RomFileSystem::do_stat (path, buf);
+  }
+};
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 3 };
+
+TPool<RomFile> romFiles
+  { 4 };
+
+TPool<RomDirectory> romDirs
+  { 4 };
+
+TPool<TmpFile> tmpFiles
+  { 8 };
+
+TPool<TmpDirectory> tmpDirs
+  { 4 };
+
+TPool<OverlayFile> files
+  { 4 };
+
+TPool<OverlayDirectory> dirs
+  { 2 };
+
+RamBlockDevice arena
+  { BLOCK_SIZE, BLOCKS };
+
+TmpFileSystem tmpfs
+  { &tmpFiles, &tmpDirs, &arena, 32 };
+
+static bool
+reads (const char* path, const char* data)
+{
+  char buf[256];
+  int fd = __posix_open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  ssize_t n = __posix_read (fd, buf, sizeof(buf));
+  __posix_close (fd);
+  return (n == static_cast<ssize_t> (std::strlen (data)))
+      && (std::memcmp (buf, data, static_cast<std::size_t> (n)) == 0);
+}
+
+static bool
+exists (const char* path)
+{
+  struct stat st;
+  return __posix_stat (path, &st) == 0;
+}
+
+// Check that a directory lists exactly the given names, in any order.
+static bool
+lists (const char* path, const char* const* names, std::size_t count)
+{
+  DIR* pdir = __posix_opendir (path);
+  if (pdir == nullptr)
+    {
+      return false;
+    }
+
+  unsigned int seen = 0;
+  std::size_t found = 0;
+  struct dirent* de;
+  bool ok = true;
+  while ((de = __posix_readdir (pdir)) != nullptr)
+    {
+      std::size_t i;
+      for (i = 0; i < count; ++i)
+        {
+          if (std::strcmp (de->d_name, names[i]) == 0)
+            {
+              break;
+            }
+        }
+      // Unknown or listed twice.
+      ok = ok && (i < count) && ((seen & (1u << i)) == 0);
+      seen |= (1u << i);
+      ++found;
+    }
+  ok = ok && (errno == 0);
+
+  __posix_closedir (pdir);
+  return ok && (found == count);
+}
+
+static int
+create (const char* path, const char* data)
+{
+  int fd = __posix_open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  auto len = std::strlen (data);
+  bool ok = __posix_write (fd, data, len) == static_cast<ssize_t> (len);
+  return ((__posix_close (fd) == 0) && ok) ? 0 : -1;
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  // The factory defaults.
+  RomImageBuilder builder
+    { 256 };
+  assert(builder.addFile ("/etc/config", "defaults", 8, true, 0644,
+                          1500000000) == 0);
+  assert(builder.addFile ("/etc/net/ip", "10.0.0.1", 8) == 0);
+  assert(builder.addFile ("/etc/net/mask", "255.0.0.0", 9) == 0);
+  assert(builder.addFile ("/share/readme", "read me", 7) == 0);
+  assert(builder.addFile ("/share/docs/a", "doc a", 5) == 0);
+  assert(builder.addFile ("/share/docs/b", "doc b", 5, true, 0644,
+                          1600000000) == 0);
+  assert(builder.build () == 0);
+
+  static std::uint64_t image[4096 / sizeof(std::uint64_t)];
+  assert(builder.getImageSize () <= sizeof(image));
+  std::memcpy (image, builder.getImage (), builder.getImageSize ());
+
+  CountingRomFileSystem rom
+    { &romFiles, &romDirs, image };
+
+  OverlayFileSystem overlay
+    { &files, &dirs, &rom, &tmpfs };
+
+  // The layers must be mounted first.
+  assert(mm.mount (&overlay, "/sys/", nullptr, 0) == -1);
+  assert(errno == EINVAL);
+
+  assert(mm.mount (&rom, "/.rom/", nullptr, 0) == 0);
+  assert(mm.mount (&tmpfs, "/.data/", nullptr, 0) == 0);
+  assert(mm.mount (&overlay, "/sys/", nullptr, 0) == 0);
+
+  struct stat st;
+  char buf[64];
+
+  {
+    // The lower content, unchanged.
+    assert(reads ("/sys/etc/config", "defaults"));
+    assert(__posix_stat ("/sys/etc/config", &st) == 0);
+    assert(S_ISREG(st.st_mode));
+    assert(st.st_mtime == 1500000000);
+
+    const char* const root[] =
+      { "etc", "share" };
+    assert(lists ("/sys/", root, 2));
+    const char* const docs[] =
+      { "a", "b" };
+    assert(lists ("/sys/share/docs", docs, 2));
+
+    // Nothing written.
+    assert(!exists ("/.data/etc"));
+    assert(overlay.getCopyUps () == 0);
+
+    assert(__posix_open ("/sys/etc/none", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_open ("/sys/etc/config/x", O_RDONLY) == -1);
+    assert(errno == ENOTDIR || errno == ENOENT);
+  }
+
+  {
+    // Copy up at the first write, with the parents.
+    int fd = __posix_open ("/sys/etc/config", O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    auto* file = static_cast<OverlayFile*> (FileDescriptorsManager::getIo (
+        fd));
+    assert(file->getLayerFile ()->getFileSystem () == &tmpfs);
+    assert(__posix_write (fd, "+user", 5) == 5);
+    assert(__posix_close (fd) == 0);
+    assert(overlay.getCopyUps () == 1);
+
+    assert(reads ("/sys/etc/config", "defaults+user"));
+    assert(reads ("/.data/etc/config", "defaults+user"));
+    assert(reads ("/.rom/etc/config", "defaults"));
+    assert(__posix_stat ("/.data/etc", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert(__posix_stat ("/.data/etc/config", &st) == 0);
+    assert((st.st_mode & 0777) == 0644);
+
+    // Found in the upper file system, the lower one is not searched.
+    auto lookups = rom.lookups;
+    assert(reads ("/sys/etc/config", "defaults+user"));
+    assert(__posix_stat ("/sys/etc/config", &st) == 0);
+    assert(rom.lookups == lookups);
+
+    // Reading does not copy up.
+    fd = __posix_open ("/sys/etc/net/ip", O_RDONLY);
+    assert(fd >= 0);
+    file = static_cast<OverlayFile*> (FileDescriptorsManager::getIo (fd));
+    assert(file->getLayerFile ()->getFileSystem () == &rom);
+    assert(__posix_close (fd) == 0);
+    assert(overlay.getCopyUps () == 1);
+
+    // Truncated, the content is not copied.
+    fd = __posix_open ("/sys/share/readme", O_RDWR | O_TRUNC);
+    assert(fd >= 0);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 0);
+    assert(__posix_close (fd) == 0);
+    assert(reads ("/.rom/share/readme", "read me"));
+
+    // Path based changes.
+    assert(__posix_truncate ("/sys/etc/net/mask", 3) == 0);
+    assert(reads ("/sys/etc/net/mask", "255"));
+    assert(__posix_chmod ("/sys/share/docs/b", 0600) == 0);
+    assert(__posix_stat ("/sys/share/docs/b", &st) == 0);
+    assert((st.st_mode & 0777) == 0600);
+    // The times are preserved.
+    assert(st.st_mtime == 1600000000);
+    assert(reads ("/.data/share/docs/b", "doc b"));
+    assert(overlay.getCopyUps () == 4);
+  }
+
+  {
+    // New files in a lower directory; each name listed once.
+    assert(create ("/sys/share/docs/c", "doc c") == 0);
+    const char* const docs[] =
+      { "a", "b", "c" };
+    assert(lists ("/sys/share/docs", docs, 3));
+    assert(create ("/sys/etc/new", "new") == 0);
+    const char* const etc[] =
+      { "config", "net", "new" };
+    assert(lists ("/sys/etc", etc, 3));
+
+    assert(__posix_open ("/sys/etc/new", O_WRONLY | O_CREAT | O_EXCL, 0644)
+        == -1);
+    assert(errno == EEXIST);
+    assert(__posix_open ("/sys/etc/config", O_WRONLY | O_CREAT | O_EXCL,
+                         0644) == -1);
+    assert(errno == EEXIST);
+    assert(__posix_open ("/sys/none/x", O_WRONLY | O_CREAT, 0644) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_open ("/sys/etc/config/x", O_WRONLY | O_CREAT, 0644) == -1);
+    assert(errno == ENOTDIR);
+  }
+
+  {
+    // Whiteouts.
+    assert(__posix_unlink ("/sys/share/docs/a") == 0);
+    assert(exists ("/.data/share/docs/.wh.a"));
+    assert(!exists ("/sys/share/docs/a"));
+    assert(exists ("/.rom/share/docs/a"));
+    assert(__posix_open ("/sys/share/docs/a", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+    const char* const docs[] =
+      { "b", "c" };
+    assert(lists ("/sys/share/docs", docs, 2));
+
+    // The reserved names are neither visible nor accepted.
+    assert(!exists ("/sys/share/docs/.wh.a"));
+    assert(__posix_open ("/sys/.wh.x", O_WRONLY | O_CREAT, 0644) == -1);
+    assert(errno == EINVAL);
+    assert(__posix_mkdir ("/sys/.wh.x", 0755) == -1);
+    assert(errno == EINVAL);
+
+    // Created again, the whiteout goes.
+    assert(create ("/sys/share/docs/a", "new a") == 0);
+    assert(!exists ("/.data/share/docs/.wh.a"));
+    assert(reads ("/sys/share/docs/a", "new a"));
+
+    // A copied up file, removed, stays hidden.
+    assert(__posix_unlink ("/sys/etc/config") == 0);
+    assert(!exists ("/sys/etc/config"));
+    assert(!exists ("/.data/etc/config"));
+
+    // Only in the upper file system, no whiteout.
+    assert(__posix_unlink ("/sys/etc/new") == 0);
+    assert(!exists ("/.data/etc/.wh.new"));
+
+    assert(__posix_unlink ("/sys/etc/net") == -1);
+    assert(errno == EISDIR);
+    assert(__posix_unlink ("/sys/etc/none") == -1);
+    assert(errno == ENOENT);
+  }
+
+  {
+    // Directories.
+    assert(__posix_rmdir ("/sys/etc/net") == -1);
+    assert(errno == ENOTEMPTY);
+    assert(__posix_unlink ("/sys/etc/net/ip") == 0);
+    assert(__posix_unlink ("/sys/etc/net/mask") == 0);
+    assert(__posix_rmdir ("/sys/etc/net") == 0);
+    assert(!exists ("/sys/etc/net"));
+    assert(!exists ("/sys/etc/net/ip"));
+    assert(exists ("/.data/etc/.wh.net"));
+
+    // Created again, the lower content stays hidden.
+    assert(__posix_mkdir ("/sys/etc/net", 0755) == 0);
+    assert(lists ("/sys/etc/net", nullptr, 0));
+    assert(!exists ("/sys/etc/net/ip"));
+    assert(__posix_mkdir ("/sys/etc/net", 0755) == -1);
+    assert(errno == EEXIST);
+    assert(create ("/sys/etc/net/gw", "10.0.0.254") == 0);
+    const char* const net[] =
+      { "gw" };
+    assert(lists ("/sys/etc/net", net, 1));
+    assert(__posix_unlink ("/sys/etc/net/gw") == 0);
+    assert(__posix_rmdir ("/sys/etc/net") == 0);
+    assert(!exists ("/sys/etc/net"));
+
+    // Only in the upper file system.
+    assert(__posix_mkdir ("/sys/var", 0755) == 0);
+    assert(create ("/sys/var/log", "log") == 0);
+    const char* const root[] =
+      { "etc", "share", "var" };
+    assert(lists ("/sys/", root, 3));
+    assert(__posix_rmdir ("/sys/var") == -1);
+    assert(errno == ENOTEMPTY);
+
+    assert(__posix_rmdir ("/sys/") == -1);
+    assert(errno == EBUSY);
+  }
+
+  {
+    // Rename.
+    assert(__posix_rename ("/sys/share/readme", "/sys/share/info") == 0);
+    assert(!exists ("/sys/share/readme"));
+    assert(exists ("/sys/share/info"));
+    assert(exists ("/.data/share/.wh.readme"));
+    assert(__posix_rename ("/sys/share/docs/b", "/sys/var/b") == 0);
+    assert(reads ("/sys/var/b", "doc b"));
+    assert(!exists ("/sys/share/docs/b"));
+    assert(__posix_rename ("/sys/var", "/sys/tmp") == 0);
+    assert(reads ("/sys/tmp/log", "log"));
+
+    // Lower directories cannot be renamed.
+    assert(__posix_rename ("/sys/share/docs", "/sys/docs") == -1);
+    assert(errno == EXDEV);
+
+    // Renamed over a whiteout, the lower content stays hidden.
+    assert(__posix_rename ("/sys/tmp", "/sys/etc/net") == 0);
+    const char* const net[] =
+      { "log", "b" };
+    assert(lists ("/sys/etc/net", net, 2));
+    assert(!exists ("/sys/etc/net/ip"));
+
+    assert(__posix_rename ("/sys/none", "/sys/x") == -1);
+    assert(errno == ENOENT);
+    assert(__posix_rename ("/sys/share/info", "/sys/.wh.x") == -1);
+    assert(errno == EINVAL);
+  }
+
+  {
+    // The changes stay in the upper file system.
+    assert(mm.umount ("/sys/", 0) == 0);
+    assert(mm.mount (&overlay, "/sys/", nullptr, 0) == 0);
+    assert(reads ("/sys/share/docs/a", "new a"));
+    assert(!exists ("/sys/share/docs/b"));
+    assert(!exists ("/sys/etc/config"));
+    const char* const docs[] =
+      { "a", "c" };
+    assert(lists ("/sys/share/docs", docs, 2));
+
+    // Without a layer, the overlay fails.
+    assert(mm.umount ("/.rom/", 0) == 0);
+    assert(__posix_stat ("/sys/share", &st) == -1);
+    assert(errno == EIO);
+    assert(mm.mount (&rom, "/.rom/", nullptr, 0) == 0);
+    assert(__posix_stat ("/sys/share", &st) == 0);
+
+    assert(__posix_read (-1, buf, 1) == -1);
+    assert(mm.umount ("/sys/", 0) == 0);
+  }
+
+  trace_puts ("'test-overlay-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
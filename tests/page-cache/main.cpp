@@ -0,0 +1,357 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/PageCache.h"
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t SECTOR_SIZE = 512;
+
+FileDescriptorsManager dm
+  { 8 };
+
+MountManager mm
+  { 2 };
+
+TPool<FatFile> files
+  { 4 };
+
+TPool<FatDirectory> dirs
+  { 2 };
+
+FatFileSystem fat
+  { &files, &dirs };
+
+// A RAM device that counts the sectors read and written.
+class CountingDevice : public RamBlockDevice
+{
+public:
+
+  CountingDevice (blockNumber_t blocksCount) :
+      RamBlockDevice (SECTOR_SIZE, blocksCount)
+  {
+    reads = 0;
+    writes = 0;
+  }
+
+  std::size_t reads;
+  std::size_t writes;
+
+protected:
+
+  virtual ssize_t
+  do_read (void* buf, blockNumber_t block, std::size_t count) override
+  {
+    reads += count;
+    return RamBlockDevice::do_read (buf, block, count);
+  }
+
+  virtual ssize_t
+  do_write (const void* buf, blockNumber_t block, std::size_t count) override
+  {
+    writes += count;
+    return RamBlockDevice::do_write (buf, block, count);
+  }
+};
+
+// 1 MiB, FAT12 with 512 bytes clusters.
+CountingDevice device
+  { 2048 };
+
+static std::uint8_t buf[8192];
+static std::uint8_t rbuf[8192];
+
+static void
+writeFile (const char* path, char c, std::size_t size)
+{
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  assert(fd >= 0);
+  std::memset (buf, c, size);
+  assert(__posix_write (fd, buf, size) == static_cast<ssize_t> (size));
+  assert(__posix_close (fd) == 0);
+}
+
+static bool
+holds (int fd, char c, std::size_t size)
+{
+  std::memset (rbuf, 0x55, sizeof(rbuf));
+  if (__posix_read (fd, rbuf, sizeof(rbuf)) != static_cast<ssize_t> (size))
+    {
+      return false;
+    }
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      if (rbuf[i] != static_cast<std::uint8_t> (c))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  // Only compared, never used.
+  int one;
+  int two;
+  auto* fs1 = reinterpret_cast<FileSystem*> (&one);
+  auto* fs2 = reinterpret_cast<FileSystem*> (&two);
+
+  // Without a cache, nothing is cached.
+  assert(PageCache::find (fs1, 1, 0) == nullptr);
+  assert(PageCache::grab (fs1, 1, 0) == nullptr);
+
+  {
+    PageCache cache
+      { 4, 64 };
+    assert(PageCache::getSize () == 4);
+    assert(PageCache::getPageSize () == 64);
+
+    assert(PageCache::find (fs1, 1, 0) == nullptr);
+    assert(PageCache::getMisses () == 1);
+
+    for (std::uint32_t i = 0; i < 4; ++i)
+      {
+        PageCache::Page* page = PageCache::grab (fs1, 1, i);
+        assert(page != nullptr);
+        std::memset (page->data, static_cast<int> ('a' + i), 64);
+        PageCache::release (page);
+      }
+    assert(PageCache::getUsed () == 4);
+
+    // Shared, by node and index.
+    PageCache::Page* page = PageCache::find (fs1, 1, 0);
+    assert((page != nullptr) && (page->data[63] == 'a'));
+    assert(PageCache::getHits () == 1);
+    PageCache::release (page);
+    assert(PageCache::find (fs1, 2, 0) == nullptr);
+    assert(PageCache::find (fs2, 1, 0) == nullptr);
+
+    page = PageCache::find (fs1, 1, 1);
+    PageCache::markDirty (page);
+    PageCache::markDirty (page);
+    PageCache::release (page);
+    assert(PageCache::getDirty () == 1);
+
+    // The least recently used clean page is recycled; page 1 is
+    // dirty, page 0 was used recently.
+    page = PageCache::find (fs1, 1, 3);
+    PageCache::release (page);
+    page = PageCache::grab (fs2, 1, 0);
+    assert(page != nullptr);
+    PageCache::release (page);
+    assert(PageCache::find (fs1, 1, 2) == nullptr);
+    assert(PageCache::getUsed () == 4);
+
+    // Referenced pages are not recycled.
+    PageCache::Page* held[4];
+    held[0] = PageCache::find (fs1, 1, 0);
+    held[1] = PageCache::find (fs1, 1, 3);
+    held[2] = PageCache::find (fs2, 1, 0);
+    assert(PageCache::grab (fs1, 1, 2) == nullptr);
+    for (std::size_t i = 0; i < 3; ++i)
+      {
+        PageCache::release (held[i]);
+      }
+
+    // The dirty pages of a node.
+    std::size_t cursor = 0;
+    assert(PageCache::nextDirty (fs1, 1, &cursor, &page));
+    assert((page->index == 1) && (page->data[0] == 'b'));
+    PageCache::markClean (page);
+    PageCache::release (page);
+    assert(!PageCache::nextDirty (fs1, 1, &cursor, &page));
+    cursor = 0;
+    assert(!PageCache::nextDirty (fs2, 1, &cursor, &page));
+    assert(PageCache::getDirty () == 0);
+
+    // Not filled.
+    page = PageCache::grab (fs1, 1, 2);
+    PageCache::discard (page);
+    assert(PageCache::find (fs1, 1, 2) == nullptr);
+
+    // Dropped, dirty or not.
+    page = PageCache::find (fs1, 1, 3);
+    PageCache::markDirty (page);
+    PageCache::release (page);
+    PageCache::invalidate (fs1, 1, 1);
+    assert(PageCache::find (fs1, 1, 3) == nullptr);
+    assert(PageCache::getDirty () == 0);
+    assert(PageCache::getUsed () == 2);
+    PageCache::invalidate (fs2);
+    assert(PageCache::getUsed () == 1);
+    PageCache::invalidate (fs1);
+    assert(PageCache::getUsed () == 0);
+  }
+
+  // --------------------------------------------------------------------------
+
+  assert(FatFileSystem::format (&device) == 0);
+  assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+
+  {
+    PageCache cache
+      { 16, SECTOR_SIZE };
+
+    // Written through the cache, and written back at close.
+    writeFile ("/fat/f", 'a', 2000);
+    assert(PageCache::getDirty () == 0);
+    assert(PageCache::getUsed () == 4);
+
+    // The readers of the file share the pages.
+    int fa = __posix_open ("/fat/f", O_RDONLY);
+    int fb = __posix_open ("/fat/f", O_RDONLY);
+    assert((fa >= 0) && (fb >= 0));
+    std::size_t reads = device.reads;
+    std::size_t hits = PageCache::getHits ();
+    assert(holds (fa, 'a', 2000));
+    assert(holds (fb, 'a', 2000));
+    assert(device.reads == reads);
+    assert(PageCache::getHits () == hits + 8);
+    assert(__posix_close (fa) == 0);
+    assert(__posix_close (fb) == 0);
+
+    // Written back at fsync().
+    int fd = __posix_open ("/fat/f", O_WRONLY);
+    assert(fd >= 0);
+    std::size_t writes = device.writes;
+    assert(__posix_write (fd, "bbb", 3) == 3);
+    assert(PageCache::getDirty () == 1);
+    assert(device.writes == writes);
+    assert(__posix_fsync (fd) == 0);
+    assert(PageCache::getDirty () == 0);
+    assert(device.writes > writes);
+
+    // Cleared past the size, as read back when extended.
+    assert(__posix_ftruncate (fd, 700) == 0);
+    assert(__posix_ftruncate (fd, 1500) == 0);
+    assert(__posix_close (fd) == 0);
+    fd = __posix_open ("/fat/f", O_RDONLY);
+    assert(__posix_read (fd, rbuf, sizeof(rbuf)) == 1500);
+    assert((rbuf[0] == 'b') && (rbuf[3] == 'a') && (rbuf[699] == 'a'));
+    assert((rbuf[700] == 0) && (rbuf[1499] == 0));
+    assert(__posix_close (fd) == 0);
+
+    // Two writers; the writes through one are read through the
+    // other from the shared pages, before they are written back.
+    fa = __posix_open ("/fat/f", O_RDWR);
+    fb = __posix_open ("/fat/f", O_RDWR | O_APPEND);
+    assert((fa >= 0) && (fb >= 0));
+    writes = device.writes;
+    assert(__posix_write (fa, "xyz", 3) == 3);
+    assert(__posix_write (fb, "tail", 4) == 4);
+    assert(device.writes == writes);
+    assert(__posix_lseek (fb, 0, SEEK_SET) == 0);
+    assert(__posix_read (fb, rbuf, sizeof(rbuf)) == 1504);
+    assert(std::memcmp (rbuf, "xyza", 4) == 0);
+    assert(std::memcmp (rbuf + 1500, "tail", 4) == 0);
+    assert(__posix_read (fa, rbuf, sizeof(rbuf)) == 1501);
+    assert(std::memcmp (rbuf + 1497, "tail", 4) == 0);
+
+    // The pages and the size written back by either.
+    assert(__posix_close (fa) == 0);
+    assert(PageCache::getDirty () == 0);
+    assert(__posix_close (fb) == 0);
+    struct stat st;
+    assert(__posix_stat ("/fat/f", &st) == 0);
+    assert(st.st_size == 1504);
+
+    // A removed file leaves no pages.
+    writeFile ("/fat/g", 'c', 1000);
+    std::size_t used = PageCache::getUsed ();
+    assert(__posix_unlink ("/fat/g") == 0);
+    assert(PageCache::getUsed () == used - 2);
+
+    // Its entry is reused.
+    writeFile ("/fat/h", 'd', 100);
+    fd = __posix_open ("/fat/h", O_RDONLY);
+    assert(holds (fd, 'd', 100));
+    assert(__posix_close (fd) == 0);
+
+    // At most half of the pages stay dirty.
+    fd = __posix_open ("/fat/big", O_CREAT | O_WRONLY, 0644);
+    std::memset (buf, 'e', sizeof(buf));
+    for (std::size_t i = 0; i < 4; ++i)
+      {
+        assert(__posix_write (fd, buf, sizeof(buf)) == sizeof(buf));
+        assert(PageCache::getDirty () <= 8);
+      }
+    assert(__posix_close (fd) == 0);
+    assert(PageCache::getDirty () == 0);
+
+    // The data survives the cache.
+    assert(mm.umount ("/fat/", 0) == 0);
+    assert(PageCache::getUsed () == 0);
+    assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+    fd = __posix_open ("/fat/big", O_RDONLY);
+    for (std::size_t i = 0; i < 4; ++i)
+      {
+        assert(holds (fd, 'e', sizeof(rbuf)));
+      }
+    assert(__posix_close (fd) == 0);
+    fd = __posix_open ("/fat/h", O_RDONLY);
+    assert(holds (fd, 'd', 100));
+    assert(__posix_close (fd) == 0);
+  }
+
+  {
+    // Pages larger than a cluster are not used.
+    PageCache large
+      { 4, 4 * SECTOR_SIZE };
+    std::size_t misses = PageCache::getMisses ();
+    int fd = __posix_open ("/fat/h", O_RDONLY);
+    assert(holds (fd, 'd', 100));
+    assert(__posix_close (fd) == 0);
+    assert(PageCache::getMisses () == misses);
+    assert(PageCache::getUsed () == 0);
+  }
+
+  assert(mm.umount ("/fat/", 0) == 0);
+
+  trace_puts ("'test-page-cache-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
@@ -0,0 +1,413 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/IO.h"
+#include "posix-io/File.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/TPool.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/PathCache.h"
+#include "posix-io/BlockDevice.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+// Test classes, the file system knows a single file, "/f1", and "/f2"
+// once created; the node handle is the address of a static variable.
+
+static int theNode;
+
+static unsigned int walksCount;
+
+static std::atomic<bool> f2Exists
+  { false };
+
+// stat() of this path finds it missing, then waits for `resumed`.
+static std::atomic<const char*> pausedPath
+  { nullptr };
+static std::atomic<bool> paused
+  { false };
+static std::atomic<bool> resumed
+  { false };
+
+class TestFile : public os::posix::File
+{
+public:
+
+  TestFile () = default;
+
+  void*
+  getOpenNode (void);
+
+protected:
+
+  virtual int
+  do_vopen (const char* path, int oflag, std::va_list args) override;
+
+private:
+
+  void* fOpenNode;
+};
+
+inline void*
+TestFile::getOpenNode (void)
+{
+  return fOpenNode;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFile::do_vopen (const char* path, int oflag, std::va_list args)
+{
+  // Remember the node passed by the path cache.
+  fOpenNode = getNode ();
+  if (getNode () != nullptr)
+    {
+      return 0;
+    }
+
+  // No node known, walk the path.
+  ++walksCount;
+  if (((oflag & O_CREAT) != 0) && (std::strcmp (path, "/f2") == 0))
+    {
+      f2Exists = true;
+    }
+  else if ((std::strcmp (path, "/f1") != 0)
+      && ((std::strcmp (path, "/f2") != 0) || !f2Exists))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  setNode (&theNode);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+class TestFileSystem : public os::posix::FileSystem
+{
+public:
+
+  TestFileSystem (os::posix::Pool* filesPool);
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+
+  virtual int
+  do_unmount (unsigned int flags) override;
+
+  virtual void
+  do_sync (void) override;
+
+  virtual int
+  do_stat (const char* path, struct stat* buf) override;
+
+  virtual int
+  do_unlink (const char* path) override;
+};
+
+TestFileSystem::TestFileSystem (os::posix::Pool* filesPool) :
+    os::posix::FileSystem (filesPool, nullptr)
+{
+  ;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+int
+TestFileSystem::do_unmount (unsigned int flags)
+{
+  return 0;
+}
+
+int
+TestFileSystem::do_stat (const char* path, struct stat* buf)
+{
+  ++walksCount;
+  if ((std::strcmp (path, "/f1") == 0)
+      || ((std::strcmp (path, "/f2") == 0) && f2Exists))
+    {
+      return 0;
+    }
+
+  const char* pause = pausedPath;
+  if ((pause != nullptr) && (std::strcmp (path, pause) == 0))
+    {
+      // Let another thread change the path, before ENOENT is
+      // returned.
+      paused = true;
+      while (!resumed)
+        {
+          std::this_thread::yield ();
+        }
+    }
+  errno = ENOENT;
+  return -1;
+}
+
+int
+TestFileSystem::do_unlink (const char* path)
+{
+  ++walksCount;
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+void
+TestFileSystem::do_sync (void)
+{
+  ;
+}
+
+// Required only as a reference, no functionality needed.
+class TestBlockDevice : public os::posix::BlockDevice
+{
+public:
+  TestBlockDevice () = default;
+};
+
+// ----------------------------------------------------------------------------
+
+using TestFilePool = os::posix::TPool<TestFile>;
+
+TestFilePool filesPool
+  { 2 };
+
+TestFileSystem fs
+  { &filesPool };
+
+// Mounted over "/fs/m/".
+TestFileSystem inner
+  { &filesPool };
+
+os::posix::FileDescriptorsManager dm
+  { 5 };
+
+os::posix::MountManager mm
+  { 2 };
+
+// Small cache, to exercise the LRU recycling.
+os::posix::PathCache pc
+  { 2 };
+
+TestBlockDevice dev;
+
+// ----------------------------------------------------------------------------
+
+// Run stat() of `path` in another thread, and `change` while it is
+// between finding `adjustedPath` missing and returning ENOENT.
+template<typename F>
+  static void
+  raceStat (const char* path, const char* adjustedPath, F change)
+  {
+    paused = false;
+    resumed = false;
+    pausedPath = adjustedPath;
+
+    std::thread t ([path]
+      {
+        struct stat st;
+        errno = -2;
+        assert((__posix_stat (path, &st) == -1) && (errno == ENOENT));
+      });
+    while (!paused)
+      {
+        std::this_thread::yield ();
+      }
+    change ();
+    resumed = true;
+    t.join ();
+
+    pausedPath = nullptr;
+  }
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  assert(os::posix::MountManager::mount (&fs, "/fs/", &dev, 0) == 0);
+
+    {
+      // ----- Positive entries with node handles -----
+
+      walksCount = 0;
+      int fd = __posix_open ("/fs/f1", 0, 0);
+      assert(fd >= 0);
+      assert(walksCount == 1);
+      auto* file =
+          static_cast<TestFile*> (os::posix::FileDescriptorsManager::getIo (fd));
+      assert(file->getOpenNode () == nullptr);
+      assert(__posix_close (fd) == 0);
+
+      // Second open gets the node from the cache, no walk.
+      fd = __posix_open ("/fs/f1", 0, 0);
+      assert(fd >= 0);
+      assert(walksCount == 1);
+      file =
+          static_cast<TestFile*> (os::posix::FileDescriptorsManager::getIo (fd));
+      assert(file->getOpenNode () == &theNode);
+      assert(__posix_close (fd) == 0);
+    }
+
+    {
+      // ----- Negative entries -----
+
+      walksCount = 0;
+      struct stat st;
+      errno = -2;
+      assert((__posix_stat ("/fs/missing", &st) == -1) && (errno == ENOENT));
+      assert(walksCount == 1);
+
+      // Answered from the cache.
+      errno = -2;
+      assert((__posix_stat ("/fs/missing", &st) == -1) && (errno == ENOENT));
+      assert((__posix_open ("/fs/missing", 0, 0) == -1) && (errno == ENOENT));
+      assert(walksCount == 1);
+
+      // Creation is not prevented by a negative entry.
+      assert((__posix_open ("/fs/missing", O_CREAT, 0) == -1));
+      assert(walksCount == 2);
+    }
+
+    {
+      // ----- Invalidation -----
+
+      walksCount = 0;
+      struct stat st;
+      assert(__posix_stat ("/fs/f1", &st) == 0);
+      assert(__posix_unlink ("/fs/f1") == 0);
+      assert(walksCount == 2);
+
+      // The unlinked file is known to be missing.
+      errno = -2;
+      assert((__posix_stat ("/fs/f1", &st) == -1) && (errno == ENOENT));
+      assert(walksCount == 2);
+
+      // umount() drops all entries of the file system.
+      assert(os::posix::MountManager::umount ("/fs/", 0) == 0);
+      assert(os::posix::MountManager::mount (&fs, "/fs/", &dev, 0) == 0);
+      assert(__posix_stat ("/fs/f1", &st) == 0);
+      assert(walksCount == 3);
+    }
+
+    {
+      // ----- Concurrent use -----
+
+      // Lookups change the LRU list; with several threads adding,
+      // looking up and invalidating paths, the lists stay consistent.
+      auto user = [](const char* path)
+        {
+          auto* other = reinterpret_cast<os::posix::FileSystem*> (&dev);
+          os::posix::FileSystem* found;
+          const char* adjusted;
+          void* node;
+          for (int i = 0; i < 20000; ++i)
+            {
+              os::posix::PathCache::add (
+                  path, other, path + 3, nullptr,
+                  os::posix::PathCache::getGeneration ());
+              auto result = os::posix::PathCache::lookup (path, &found,
+                                                          &adjusted, &node);
+              assert(
+                  (result == os::posix::PathCache::MISS) || (found == other));
+              if ((i % 7) == 0)
+                {
+                  os::posix::PathCache::invalidate (other);
+                }
+            }
+        };
+
+      std::thread t1 (user, "/x/a");
+      std::thread t2 (user, "/x/b");
+      std::thread t3 (user, "/x/c");
+      t1.join ();
+      t2.join ();
+      t3.join ();
+
+      os::posix::PathCache::invalidatePrefix ("/x/");
+      struct stat st;
+      assert(__posix_stat ("/fs/f1", &st) == 0);
+    }
+
+    {
+      // ----- Missing paths racing changes -----
+
+      // The file is created while stat() finds it missing; the
+      // late negative entry is not added.
+      raceStat ("/fs/f2", "/f2", []
+        {
+          int fd = __posix_open ("/fs/f2", O_CREAT, 0);
+          assert(fd >= 0);
+          assert(__posix_close (fd) == 0);
+        });
+      struct stat st;
+      assert(__posix_stat ("/fs/f2", &st) == 0);
+      int fd = __posix_open ("/fs/f2", 0, 0);
+      assert(fd >= 0);
+      assert(__posix_close (fd) == 0);
+
+      // A file system is mounted over the path while the parent one
+      // finds it missing.
+      raceStat ("/fs/m/f1", "/m/f1", []
+        {
+          assert(
+              os::posix::MountManager::mount (&inner, "/fs/m/", &dev, 0)
+                  == 0);
+        });
+      assert(__posix_stat ("/fs/m/f1", &st) == 0);
+      assert(os::posix::MountManager::umount ("/fs/m/", 0) == 0);
+    }
+
+  assert(os::posix::PathCache::getHits () > 0);
+
+  trace_puts ("'test-path-cache-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,273 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FileSystem.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/BlockDevice.h"
+#include "posix-io/path.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+// Test class, all paths ending in "d" are folders, the others are files.
+
+class TestFileSystem : public os::posix::FileSystem
+{
+public:
+
+  TestFileSystem ();
+
+  const char*
+  getPath (void);
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+
+  virtual int
+  do_stat (const char* path, struct stat* buf) override;
+
+  virtual int
+  do_unlink (const char* path) override;
+
+private:
+
+  char fPath[OS_INTEGER_PATH_MAX];
+};
+
+TestFileSystem::TestFileSystem () :
+    os::posix::FileSystem (nullptr, nullptr)
+{
+  fPath[0] = '\0';
+}
+
+inline const char*
+TestFileSystem::getPath (void)
+{
+  return fPath;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+int
+TestFileSystem::do_stat (const char* path, struct stat* buf)
+{
+  std::strcpy (fPath, path);
+
+  std::memset (buf, 0, sizeof(*buf));
+  auto len = std::strlen (path);
+  if ((len > 0) && (path[len - 1] == 'd' || path[len - 1] == '/'))
+    {
+      buf->st_mode = S_IFDIR;
+    }
+  else
+    {
+      buf->st_mode = S_IFREG;
+    }
+  return 0;
+}
+
+int
+TestFileSystem::do_unlink (const char* path)
+{
+  std::strcpy (fPath, path);
+  return 0;
+}
+
+// Required only as a reference, no functionality needed.
+class TestBlockDevice : public os::posix::BlockDevice
+{
+public:
+  TestBlockDevice () = default;
+};
+
+// ----------------------------------------------------------------------------
+
+// Static manager
+os::posix::MountManager mm
+  { 2 };
+
+TestFileSystem root_fs;
+TestFileSystem fs1;
+
+TestBlockDevice dev;
+
+// ----------------------------------------------------------------------------
+
+static void
+checkNormalized (const char* path, const char* expected)
+{
+  char buf[OS_INTEGER_PATH_MAX];
+  const char* ret = os::posix::normalizePath (path, buf, sizeof(buf));
+  assert(ret != nullptr);
+  assert(std::strcmp (ret, expected) == 0);
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+    {
+      // ----- Normalization -----
+
+      char buf[OS_INTEGER_PATH_MAX];
+
+      // Already normalized paths are returned as they are.
+      const char* path = "/a/b/c";
+      assert(os::posix::normalizePath (path, buf, sizeof(buf)) == path);
+      path = "/a/b/";
+      assert(os::posix::normalizePath (path, buf, sizeof(buf)) == path);
+      path = "/";
+      assert(os::posix::normalizePath (path, buf, sizeof(buf)) == path);
+
+      checkNormalized ("//", "/");
+      checkNormalized ("/a//b", "/a/b");
+      checkNormalized ("/a/b//", "/a/b/");
+      checkNormalized ("/a/./b", "/a/b");
+      checkNormalized ("/a/../b", "/b");
+      checkNormalized ("/a/b/..", "/a/");
+      checkNormalized ("/a/b/.", "/a/b/");
+      checkNormalized ("/..", "/");
+      checkNormalized ("/../../a", "/a");
+      checkNormalized ("/a/.b/..c", "/a/.b/..c");
+
+      // Relative to the root.
+      checkNormalized ("a", "/a");
+      checkNormalized (".", "/");
+      checkNormalized ("./a/../b", "/b");
+
+      // Too long.
+      errno = -2;
+      assert(
+          (os::posix::normalizePath ("a/b/c/d", buf, 6) == nullptr) && (errno == ENAMETOOLONG));
+    }
+
+    {
+      // ----- Current directory -----
+
+      assert(os::posix::MountManager::setRoot (&root_fs, &dev, 0) == 0);
+      assert(os::posix::MountManager::mount (&fs1, "/fs1/", &dev, 0) == 0);
+
+      char buf[OS_INTEGER_PATH_MAX];
+      errno = -2;
+      assert((__posix_getcwd (buf, sizeof(buf)) == buf) && (errno == 0));
+      assert(std::strcmp (buf, "/") == 0);
+
+      errno = -2;
+      assert((__posix_chdir ("/fs1/d") == 0) && (errno == 0));
+      assert(std::strcmp (fs1.getPath (), "/d") == 0);
+      assert(__posix_getcwd (buf, sizeof(buf)) == buf);
+      assert(std::strcmp (buf, "/fs1/d") == 0);
+
+      // Not a folder.
+      errno = -2;
+      assert((__posix_chdir ("/fs1/f") == -1) && (errno == ENOTDIR));
+
+      // Relative paths.
+      assert(__posix_unlink ("f") == 0);
+      assert(std::strcmp (fs1.getPath (), "/d/f") == 0);
+      assert(__posix_unlink ("../g") == 0);
+      assert(std::strcmp (fs1.getPath (), "/g") == 0);
+
+      // Up to the root file system.
+      assert(__posix_unlink ("../../h") == 0);
+      assert(std::strcmp (root_fs.getPath (), "/h") == 0);
+
+      assert(__posix_chdir ("../dd/") == 0);
+      assert(__posix_getcwd (buf, sizeof(buf)) == buf);
+      assert(std::strcmp (buf, "/fs1/dd") == 0);
+
+      // Buffer too small.
+      errno = -2;
+      assert((__posix_getcwd (buf, 4) == nullptr) && (errno == ERANGE));
+
+      assert(__posix_chdir ("/") == 0);
+      assert(__posix_getcwd (buf, sizeof(buf)) == buf);
+      assert(std::strcmp (buf, "/") == 0);
+    }
+
+    {
+      // ----- Current directory changed by another thread -----
+
+      // The process wide current directory is read whole, never
+      // partly rewritten.
+      static const char* const shortDir = "/fs1/d";
+      static const char* const longDir = "/fs1/a/much/longer/path/d";
+      assert(__posix_chdir (shortDir) == 0);
+
+      std::atomic<bool> done
+        { false };
+      std::thread reader ([&done]
+        {
+          char cwd[OS_INTEGER_PATH_MAX];
+          char buf[OS_INTEGER_PATH_MAX];
+          while (!done)
+            {
+              assert(__posix_getcwd (cwd, sizeof(cwd)) == cwd);
+              assert((std::strcmp (cwd, shortDir) == 0)
+                  || (std::strcmp (cwd, longDir) == 0));
+
+              const char* p = os::posix::normalizePath ("x", buf,
+                                                        sizeof(buf));
+              assert((std::strcmp (p, "/fs1/d/x") == 0)
+                  || (std::strcmp (p, "/fs1/a/much/longer/path/d/x") == 0));
+            }
+        });
+      for (int i = 0; i < 20000; ++i)
+        {
+          assert(__posix_chdir ((i % 2) ? shortDir : longDir) == 0);
+        }
+      done = true;
+      reader.join ();
+
+      assert(__posix_chdir ("/") == 0);
+    }
+
+  trace_puts ("'test-path-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
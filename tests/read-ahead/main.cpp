@@ -0,0 +1,328 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/IO.h"
+#include "posix-io/File.h"
+#include "posix-io/FileSystem.h"
+#include "posix-io/TPool.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/BlockCache.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr BlockDevice::blockNumber_t BLOCKS_COUNT = 1024;
+
+// RAM device counting the read requests that reach it.
+class CountingBlockDevice : public RamBlockDevice
+{
+public:
+
+  CountingBlockDevice ();
+
+  std::size_t readRequests;
+
+protected:
+
+  virtual ssize_t
+  do_readv (const struct iovec* iov, int iovcnt, blockNumber_t block)
+      override;
+};
+
+CountingBlockDevice::CountingBlockDevice () :
+    RamBlockDevice (BLOCK_SIZE, BLOCKS_COUNT)
+{
+  readRequests = 0;
+}
+
+ssize_t
+CountingBlockDevice::do_readv (const struct iovec* iov, int iovcnt,
+                               blockNumber_t block)
+{
+  ++readRequests;
+  return RamBlockDevice::do_readv (iov, iovcnt, block);
+}
+
+// A single file, stored in the consecutive blocks of the device.
+class TestFile : public File
+{
+public:
+
+  TestFile ();
+
+  std::size_t readAheads;
+  off_t lastOffset;
+  std::size_t lastLength;
+
+protected:
+
+  virtual int
+  do_vopen (const char* path, int oflag, std::va_list args) override;
+
+  virtual int
+  do_close (void) override;
+
+  virtual ssize_t
+  do_read (void* buf, std::size_t nbyte) override;
+
+  virtual off_t
+  do_lseek (off_t offset, int whence) override;
+
+  virtual void
+  do_readahead (off_t offset, std::size_t length) override;
+
+private:
+
+  off_t fOffset;
+};
+
+TestFile::TestFile ()
+{
+  readAheads = 0;
+  lastOffset = 0;
+  lastLength = 0;
+  fOffset = 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFile::do_vopen (const char* path, int oflag, std::va_list args)
+{
+  readAheads = 0;
+  fOffset = 0;
+  return 0;
+}
+
+off_t
+TestFile::do_lseek (off_t offset, int whence)
+{
+  fOffset = offset;
+  return fOffset;
+}
+
+#pragma GCC diagnostic pop
+
+int
+TestFile::do_close (void)
+{
+  return 0;
+}
+
+ssize_t
+TestFile::do_read (void* buf, std::size_t nbyte)
+{
+  readAhead (fOffset, nbyte);
+
+  auto* dev = getFileSystem ()->getBlockDevice ();
+  ssize_t ret = dev->read (
+      buf, static_cast<BlockDevice::blockNumber_t> (fOffset / BLOCK_SIZE),
+      nbyte / BLOCK_SIZE);
+  if (ret < 0)
+    {
+      return -1;
+    }
+
+  fOffset += static_cast<off_t> (nbyte);
+  return static_cast<ssize_t> (nbyte);
+}
+
+void
+TestFile::do_readahead (off_t offset, std::size_t length)
+{
+  ++readAheads;
+  lastOffset = offset;
+  lastLength = length;
+
+  getFileSystem ()->getBlockDevice ()->prefetch (
+      static_cast<BlockDevice::blockNumber_t> (offset / BLOCK_SIZE),
+      (length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+class TestFileSystem : public FileSystem
+{
+public:
+
+  TestFileSystem (Pool* filesPool);
+
+protected:
+
+  virtual int
+  do_mount (unsigned int flags) override;
+};
+
+TestFileSystem::TestFileSystem (Pool* filesPool) :
+    FileSystem (filesPool, nullptr)
+{
+  ;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+int
+TestFileSystem::do_mount (unsigned int flags)
+{
+  return 0;
+}
+
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------------
+
+using TestFilePool = TPool<TestFile>;
+
+TestFilePool filesPool
+  { 2 };
+
+TestFileSystem fs
+  { &filesPool };
+
+FileDescriptorsManager dm
+  { 5 };
+
+MountManager mm
+  { 1 };
+
+CountingBlockDevice dev;
+
+BlockCache cache
+  { &dev, 128 };
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  char buf[BLOCK_SIZE];
+
+  assert(MountManager::setRoot (&fs, &cache, 0) == 0);
+
+  {
+    // Sequential reads in small chunks.
+    auto* file = static_cast<TestFile*> (os::posix::open ("/log", O_RDONLY));
+    assert(file != nullptr);
+
+    constexpr std::size_t READS = 256;
+    for (std::size_t i = 0; i < READS; ++i)
+      {
+        assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+      }
+
+    // The window grew up to the maximum.
+    assert(file->getReadAheadWindow () == OS_INTEGER_FILE_READAHEAD_MAX);
+
+    // Most reads were served from the cache; the device got
+    // a few large requests instead of one per read.
+    assert(dev.readRequests < READS / 8);
+    assert(cache.getHits () > READS - READS / 8);
+
+    // Seek away, the window shrinks.
+    std::size_t window = file->getReadAheadWindow ();
+    std::size_t readAheads = file->readAheads;
+    assert(file->lseek (600 * BLOCK_SIZE, SEEK_SET) >= 0);
+    assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+    assert(file->getReadAheadWindow () == window / 2);
+    assert(file->readAheads == readAheads);
+
+    assert(file->close () == 0);
+  }
+
+  {
+    auto* file = static_cast<TestFile*> (os::posix::open ("/log", O_RDONLY));
+    assert(file != nullptr);
+    int fd = file->getFileDescriptor ();
+
+    // Invalid advice.
+    assert(__posix_posix_fadvise (fd, 0, 0, 1234) == EINVAL);
+    assert(__posix_posix_fadvise (fd, -1, 0, POSIX_FADV_NORMAL) == EINVAL);
+    assert(__posix_posix_fadvise (123, 0, 0, POSIX_FADV_NORMAL) == EBADF);
+
+    // No read-ahead for random access.
+    assert(__posix_posix_fadvise (fd, 0, 0, POSIX_FADV_RANDOM) == 0);
+    for (std::size_t i = 0; i < 16; ++i)
+      {
+        assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+      }
+    assert(file->readAheads == 0);
+
+    // Sequential starts with the largest window.
+    assert(__posix_posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL) == 0);
+    assert(file->lseek (0, SEEK_SET) == 0);
+    assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+    assert(file->readAheads == 1);
+    assert(file->lastOffset == BLOCK_SIZE);
+    assert(file->lastLength == OS_INTEGER_FILE_READAHEAD_MAX);
+
+    // Immediate read-ahead of a range.
+    assert(__posix_posix_fadvise (fd, 800 * BLOCK_SIZE, 4 * BLOCK_SIZE,
+        POSIX_FADV_WILLNEED) == 0);
+    assert(file->readAheads == 2);
+    assert(file->lastOffset == 800 * BLOCK_SIZE);
+    assert(file->lastLength == 4 * BLOCK_SIZE);
+
+    std::size_t requests = dev.readRequests;
+    assert(file->lseek (800 * BLOCK_SIZE, SEEK_SET) >= 0);
+    file->fadvise (0, 0, POSIX_FADV_RANDOM);
+    assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+    assert(dev.readRequests == requests);
+
+    assert(file->close () == 0);
+  }
+
+  {
+    // The access history is not inherited by the next open.
+    auto* file = static_cast<TestFile*> (os::posix::open ("/log", O_RDONLY));
+    assert(file != nullptr);
+    assert(file->getReadAheadWindow () == 0);
+
+    assert(file->read (buf, sizeof(buf)) == sizeof(buf));
+    assert(file->getReadAheadWindow () == OS_INTEGER_FILE_READAHEAD_MIN);
+    assert(file->readAheads == 1);
+
+    assert(file->close () == 0);
+  }
+
+  trace_puts ("'test-read-ahead-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,260 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/FatFileSystem.h"
+#include "posix-io/TmpFileSystem.h"
+#include "posix-io/HostFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/path.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t SECTOR_SIZE = 512;
+
+FileDescriptorsManager dm
+  { 8 };
+
+MountManager mm
+  { 4 };
+
+TPool<FatFile> fatFiles
+  { 2 };
+
+TPool<FatDirectory> fatDirs
+  { 2 };
+
+FatFileSystem fat
+  { &fatFiles, &fatDirs };
+
+TPool<TmpFile> tmpFiles
+  { 2 };
+
+TPool<TmpDirectory> tmpDirs
+  { 2 };
+
+RamBlockDevice arena
+  { SECTOR_SIZE, 64 };
+
+TmpFileSystem tmpfs
+  { &tmpFiles, &tmpDirs, &arena, 16 };
+
+TPool<HostFile> hostFiles
+  { 2 };
+
+TPool<HostDirectory> hostDirs
+  { 2 };
+
+// A RAM device that counts the sectors read.
+class CountingDevice : public RamBlockDevice
+{
+public:
+
+  CountingDevice (blockNumber_t blocksCount) :
+      RamBlockDevice (SECTOR_SIZE, blocksCount)
+  {
+    reads = 0;
+  }
+
+  std::size_t reads;
+
+protected:
+
+  virtual ssize_t
+  do_read (void* buf, blockNumber_t block, std::size_t count) override
+  {
+    reads += count;
+    return RamBlockDevice::do_read (buf, block, count);
+  }
+};
+
+// 1 MiB, FAT12 with 512 bytes clusters.
+CountingDevice device
+  { 2048 };
+
+static char root[] = "/tmp/posix-io-readdir-XXXXXX";
+
+static void
+writeFile (const char* path, std::size_t size)
+{
+  static char buf[1024];
+  int fd = __posix_open (path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  assert(fd >= 0);
+  assert(__posix_write (fd, buf, size) == static_cast<ssize_t> (size));
+  assert(__posix_close (fd) == 0);
+}
+
+static bool
+same (const struct stat* a, const struct stat* b)
+{
+  return (a->st_ino == b->st_ino) && (a->st_mode == b->st_mode)
+      && (a->st_size == b->st_size) && (a->st_mtime == b->st_mtime);
+}
+
+// List a directory with readdir_plus(), compared with stat() of each
+// name; return the number of entries.
+static std::size_t
+list (const char* dirname)
+{
+  DIR* pdir = __posix_opendir (dirname);
+  assert(pdir != nullptr);
+
+  std::size_t count = 0;
+  char path[OS_INTEGER_PATH_MAX];
+  struct stat st;
+  struct stat expected;
+  struct dirent* entry;
+  while ((entry = __posix_readdir_plus (pdir, &st)) != nullptr)
+    {
+      assert(joinPath (dirname, entry->d_name, path, sizeof(path)) != nullptr);
+      assert(__posix_stat (path, &expected) == 0);
+      assert(same (&st, &expected));
+      ++count;
+    }
+  assert(errno == 0);
+  assert(__posix_closedir (pdir) == 0);
+  return count;
+}
+
+// The sectors read by listing a directory.
+static std::size_t
+readsOf (const char* dirname, bool plus)
+{
+  DIR* pdir = __posix_opendir (dirname);
+  assert(pdir != nullptr);
+
+  std::size_t reads = device.reads;
+  struct stat st;
+  while (((plus ? __posix_readdir_plus (pdir, &st) : __posix_readdir (pdir))
+      != nullptr))
+    {
+      ;
+    }
+  reads = device.reads - reads;
+  assert(__posix_closedir (pdir) == 0);
+  return reads;
+}
+
+// ----------------------------------------------------------------------------
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  assert(FatFileSystem::format (&device) == 0);
+  assert(mm.mount (&fat, "/fat/", &device, 0) == 0);
+
+  struct stat st;
+  char name[32];
+
+  {
+    // The status as stat() returns it.
+    assert(__posix_mkdir ("/fat/d", 0777) == 0);
+    for (int i = 0; i < 20; ++i)
+      {
+        std::snprintf (name, sizeof(name), "/fat/d/A Long Name %d", i);
+        writeFile (name, static_cast<std::size_t> (i * 50));
+      }
+    assert(__posix_mkdir ("/fat/d/sub", 0777) == 0);
+    assert(__posix_chmod ("/fat/d/A Long Name 3", 0444) == 0);
+    assert(list ("/fat/d") == 21);
+
+    // Without a lookup per entry: no more sectors read than by
+    // readdir() alone.
+    assert(readsOf ("/fat/d", true) == readsOf ("/fat/d", false));
+
+    // Invalid.
+    DIR* pdir = __posix_opendir ("/fat/d");
+    errno = 0;
+    assert(__posix_readdir_plus (pdir, nullptr) == nullptr);
+    assert(errno == EFAULT);
+    assert(__posix_readdir_plus (nullptr, &st) == nullptr);
+    assert(errno == ENOENT);
+    assert(__posix_closedir (pdir) == 0);
+
+    // Empty.
+    assert(list ("/fat/d/sub") == 0);
+  }
+
+  {
+    // In memory.
+    assert(mm.mount (&tmpfs, "/mem/", nullptr, 0) == 0);
+    assert(__posix_mkdir ("/mem/d", 0755) == 0);
+    writeFile ("/mem/a", 100);
+    writeFile ("/mem/d/b", 200);
+    assert(list ("/mem/") == 2);
+    assert(list ("/mem/d") == 1);
+    assert(mm.umount ("/mem/", 0) == 0);
+  }
+
+  {
+    // A file system mounted on a directory: its root, as stat().
+    assert(__posix_mkdir ("/fat/d/m", 0777) == 0);
+    assert(mm.mount (&tmpfs, "/fat/d/m/", nullptr, 0) == 0);
+    assert(list ("/fat/d") == 22);
+    assert(mm.umount ("/fat/d/m/", 0) == 0);
+  }
+
+  {
+    // Without a specific implementation, stat() of each name.
+    assert(::mkdtemp (root) != nullptr);
+    HostFileSystem host
+      { &hostFiles, &hostDirs, root };
+    assert(mm.mount (&host, "/host/", nullptr, 0) == 0);
+    writeFile ("/host/a", 10);
+    writeFile ("/host/b", 20);
+    assert(__posix_mkdir ("/host/c", 0755) == 0);
+    assert(list ("/host/") == 3);
+
+    assert(__posix_unlink ("/host/a") == 0);
+    assert(__posix_unlink ("/host/b") == 0);
+    assert(__posix_rmdir ("/host/c") == 0);
+    assert(mm.umount ("/host/", 0) == 0);
+    assert(::rmdir (root) == 0);
+  }
+
+  assert(mm.umount ("/fat/", 0) == 0);
+
+  trace_puts ("'test-readdir-plus-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
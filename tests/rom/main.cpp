@@ -0,0 +1,348 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "posix-io/RomFileSystem.h"
+#include "posix-io/RomImageBuilder.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr std::size_t ROM_BLOCK_SIZE = 1024;
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 2 };
+
+TPool<RomFile> files
+  { 4 };
+
+TPool<RomDirectory> dirs
+  { 2 };
+
+static char text[10000];
+static char noise[3000];
+
+static bool
+readsBack (const char* path, const char* data, std::size_t size)
+{
+  static char buf[16384];
+  int fd = __posix_open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  bool ok = (__posix_read (fd, buf, sizeof(buf))
+      == static_cast<ssize_t> (size)) && (std::memcmp (buf, data, size) == 0);
+  __posix_close (fd);
+  return ok;
+}
+
+// Check that a directory lists exactly the given names, in this order.
+static bool
+lists (const char* path, const char* const* names, std::size_t count)
+{
+  DIR* pdir = __posix_opendir (path);
+  if (pdir == nullptr)
+    {
+      return false;
+    }
+
+  std::size_t found = 0;
+  struct dirent* de;
+  bool ok = true;
+  while ((de = __posix_readdir (pdir)) != nullptr)
+    {
+      ok = ok && (found < count) && (std::strcmp (de->d_name, names[found]) == 0);
+      ++found;
+    }
+
+  __posix_closedir (pdir);
+  return ok && (found == count);
+}
+
+// The content of a mounted image, as built in main().
+static void
+check (const char* root, bool mapped)
+{
+  char path[64];
+  char buf[4096];
+  struct stat st;
+
+  std::snprintf (path, sizeof(path), "%s/www/index.html", root);
+  assert(readsBack (path, text, sizeof(text)));
+  assert(__posix_stat (path, &st) == 0);
+  assert(S_ISREG(st.st_mode));
+  assert((st.st_mode & 0777) == 0444);
+  assert(st.st_size == sizeof(text));
+  assert(st.st_mtime == 1500000000);
+
+  {
+    // Reads across the compressed blocks.
+    int fd = __posix_open (path, O_RDONLY);
+    assert(fd >= 0);
+    auto* file = static_cast<RomFile*> (FileDescriptorsManager::getIo (fd));
+    assert(file->getAddress () == nullptr);
+    assert(__posix_lseek (fd, ROM_BLOCK_SIZE - 10, SEEK_SET)
+        == static_cast<off_t> (ROM_BLOCK_SIZE - 10));
+    assert(__posix_read (fd, buf, 2 * ROM_BLOCK_SIZE + 20)
+        == static_cast<ssize_t> (2 * ROM_BLOCK_SIZE + 20));
+    assert(std::memcmp (buf, text + ROM_BLOCK_SIZE - 10,
+                        2 * ROM_BLOCK_SIZE + 20) == 0);
+    assert(__posix_lseek (fd, -5, SEEK_END) == sizeof(text) - 5);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 5);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 0);
+    assert(__posix_write (fd, buf, 1) == -1);
+    assert(errno == EBADF);
+    assert(__posix_ftruncate (fd, 0) == -1);
+    assert(__posix_close (fd) == 0);
+  }
+
+  {
+    // Not compressible, stored as it is.
+    std::snprintf (path, sizeof(path), "%s/www/logo.bin", root);
+    assert(readsBack (path, noise, sizeof(noise)));
+    int fd = __posix_open (path, O_RDONLY);
+    assert(fd >= 0);
+    auto* file = static_cast<RomFile*> (FileDescriptorsManager::getIo (fd));
+    if (mapped)
+      {
+        assert(file->getAddress () != nullptr);
+        assert(
+            std::memcmp (file->getAddress (), noise, sizeof(noise)) == 0);
+        assert(
+            (reinterpret_cast<std::uintptr_t> (file->getAddress ()) % 16) == 0);
+      }
+    else
+      {
+        assert(file->getAddress () == nullptr);
+      }
+    assert(__posix_close (fd) == 0);
+  }
+
+  std::snprintf (path, sizeof(path), "%s/www/app.js", root);
+  assert(readsBack (path, text, 1234));
+  std::snprintf (path, sizeof(path), "%s/a/b/c/empty", root);
+  assert(readsBack (path, text, 0));
+  std::snprintf (path, sizeof(path), "%s/a/b", root);
+  assert(__posix_stat (path, &st) == 0);
+  assert(S_ISDIR(st.st_mode));
+
+  // All the names of a larger directory are found.
+  for (int i = 0; i < 30; ++i)
+    {
+      std::snprintf (path, sizeof(path), "%s/many/f%02d", root, i);
+      assert(readsBack (path, text + i, 10));
+    }
+  std::snprintf (path, sizeof(path), "%s/many/f30", root);
+  assert(__posix_stat (path, &st) == -1);
+  assert(errno == ENOENT);
+  std::snprintf (path, sizeof(path), "%s/many/f", root);
+  assert(__posix_stat (path, &st) == -1);
+  assert(errno == ENOENT);
+  std::snprintf (path, sizeof(path), "%s/many/f000", root);
+  assert(__posix_stat (path, &st) == -1);
+  assert(errno == ENOENT);
+
+  const char* top[] =
+    { "a", "many", "www" };
+  std::snprintf (path, sizeof(path), "%s/", root);
+  assert(lists (path, top, 3));
+  const char* www[] =
+    { "app.js", "css", "index.html", "logo.bin" };
+  std::snprintf (path, sizeof(path), "%s/www", root);
+  assert(lists (path, www, 4));
+
+  // Errors.
+  std::snprintf (path, sizeof(path), "%s/www/index.html/x", root);
+  assert(__posix_stat (path, &st) == -1);
+  assert(errno == ENOTDIR);
+  std::snprintf (path, sizeof(path), "%s/www", root);
+  assert(__posix_open (path, O_RDONLY) == -1);
+  assert(errno == EISDIR);
+  assert(__posix_mkdir (path, 0777) == -1);
+  assert(errno == EROFS);
+  std::snprintf (path, sizeof(path), "%s/www/index.html", root);
+  assert(__posix_open (path, O_RDWR) == -1);
+  assert(errno == EROFS);
+  assert(__posix_open (path, O_CREAT | O_EXCL | O_RDONLY, 0644) == -1);
+  assert(errno == EEXIST);
+  assert(__posix_unlink (path) == -1);
+  assert(errno == EROFS);
+  assert(__posix_chmod (path, 0644) == -1);
+  assert(errno == EROFS);
+  assert(__posix_truncate (path, 0) == -1);
+  assert(errno == EROFS);
+  std::snprintf (path, sizeof(path), "%s/new", root);
+  assert(__posix_open (path, O_CREAT | O_WRONLY, 0644) == -1);
+  assert(errno == EROFS);
+  assert(__posix_open (path, O_RDONLY) == -1);
+  assert(errno == ENOENT);
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  for (std::size_t i = 0; i < sizeof(text); ++i)
+    {
+      text[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44];
+      if (i % 100 == 0)
+        {
+          text[i] = static_cast<char> ('0' + (i / 100) % 10);
+        }
+    }
+  std::srand (1);
+  for (auto& c : noise)
+    {
+      c = static_cast<char> (std::rand ());
+    }
+
+  RomImageBuilder builder
+    { ROM_BLOCK_SIZE };
+  assert(builder.addFile ("/www/index.html", text, sizeof(text), true, 0444,
+                          1500000000) == 0);
+  assert(builder.addFile ("/www/logo.bin", noise, sizeof(noise)) == 0);
+  assert(builder.addFile ("/www/app.js", text, 1234, false) == 0);
+  assert(builder.addDirectory ("/www/css") == 0);
+  assert(builder.addFile ("a/b/c/empty", text, 0) == 0);
+  for (int i = 29; i >= 0; --i)
+    {
+      char path[32];
+      std::snprintf (path, sizeof(path), "/many/f%02d", i);
+      assert(builder.addFile (path, text + i, 10) == 0);
+    }
+
+  assert(builder.addDirectory ("/www") == -1);
+  assert(errno == EEXIST);
+  assert(builder.addFile ("/www/app.js/x", text, 1) == -1);
+  assert(errno == ENOTDIR);
+  assert(builder.addFile ("/", text, 1) == -1);
+  assert(errno == EINVAL);
+  assert(builder.build () == 0);
+
+  // Smaller than the content, the text is compressed.
+  assert(builder.getImageSize () < sizeof(text) + sizeof(noise));
+
+  // The image is aligned like in flash.
+  static std::uint64_t image[32768 / sizeof(std::uint64_t)];
+  assert(builder.getImageSize () <= sizeof(image));
+  std::memcpy (image, builder.getImage (), builder.getImageSize ());
+
+  {
+    // Memory mapped.
+    RomFileSystem rom
+      { &files, &dirs, image };
+    assert(mm.mount (&rom, "/rom/", nullptr, 0) == 0);
+    assert(rom.getBlockSize () == ROM_BLOCK_SIZE);
+    check ("/rom", true);
+
+    // Reading a compressed file sequentially decompresses each
+    // block once.
+    std::size_t misses = rom.getCacheMisses ();
+    int fd = __posix_open ("/rom/www/index.html", O_RDONLY);
+    assert(fd >= 0);
+    char buf[100];
+    while (__posix_read (fd, buf, sizeof(buf)) > 0)
+      {
+        ;
+      }
+    assert(__posix_close (fd) == 0);
+    assert(rom.getCacheMisses () - misses
+        == (sizeof(text) + ROM_BLOCK_SIZE - 1) / ROM_BLOCK_SIZE);
+    assert(rom.getCacheHits () > 90);
+
+    assert(mm.umount ("/rom/", 0) == 0);
+  }
+
+  {
+    // From a block device.
+    static std::uint8_t storage[64 * BLOCK_SIZE];
+    RamBlockDevice ram
+      { storage, BLOCK_SIZE, 64 };
+    RomFileSystem rom
+      { &files, &dirs };
+
+    // Not an image.
+    assert(mm.mount (&rom, "/img/", &ram, 0) == -1);
+    assert(errno == EINVAL);
+
+    std::memcpy (storage, builder.getImage (), builder.getImageSize ());
+    assert(mm.mount (&rom, "/img/", &ram, 0) == 0);
+    check ("/img", false);
+    assert(mm.umount ("/img/", 0) == 0);
+
+    // A damaged header.
+    storage[9] ^= 1;
+    assert(mm.mount (&rom, "/img/", &ram, 0) == -1);
+    assert(errno == EINVAL);
+    storage[9] ^= 1;
+
+    // Damaged blocks are reported, not decoded out of bounds.
+    for (std::size_t i = 0; i < builder.getImageSize (); i += 7)
+      {
+        storage[i] ^= 0x5A;
+      }
+    std::memcpy (storage, builder.getImage (), 32);
+    if (mm.mount (&rom, "/img/", &ram, 0) == 0)
+      {
+        int fd = __posix_open ("/img/www/index.html", O_RDONLY);
+        if (fd >= 0)
+          {
+            char buf[256];
+            while (__posix_read (fd, buf, sizeof(buf)) > 0)
+              {
+                ;
+              }
+            __posix_close (fd);
+          }
+        assert(mm.umount ("/img/", 0) == 0);
+      }
+  }
+
+  trace_puts ("'test-rom-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
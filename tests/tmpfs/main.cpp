@@ -0,0 +1,550 @@
+/*
+ * This file is part of the µOS++ distribution.
+ *   (https://github.com/micro-os-plus)
+ * Copyright (c) 2015 Liviu Ionescu.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "posix-io/TmpFileSystem.h"
+#include "posix-io/FileDescriptorsManager.h"
+#include "posix-io/RamBlockDevice.h"
+#include "posix-io/MountManager.h"
+#include "posix-io/TPool.h"
+#include "posix-io/types.h"
+#include <cmsis-plus/diag/trace.h>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// ----------------------------------------------------------------------------
+
+using namespace os::posix;
+
+constexpr std::size_t BLOCK_SIZE = 512;
+constexpr BlockDevice::blockNumber_t BLOCKS = 64;
+
+FileDescriptorsManager dm
+  { 12 };
+
+MountManager mm
+  { 2 };
+
+TPool<TmpFile> files
+  { 8 };
+
+TPool<TmpDirectory> dirs
+  { 2 };
+
+RamBlockDevice arena
+  { BLOCK_SIZE, BLOCKS };
+
+TmpFileSystem tmpfs
+  { &files, &dirs, &arena, 16 };
+
+static void
+fill (char* buf, std::size_t size, char seed)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      buf[i] = static_cast<char> (seed + static_cast<char> (i % 97));
+    }
+}
+
+static bool
+check (const char* buf, std::size_t size, char seed)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      if (buf[i] != static_cast<char> (seed + static_cast<char> (i % 97)))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+static bool
+isZero (const char* buf, std::size_t size)
+{
+  for (std::size_t i = 0; i < size; ++i)
+    {
+      if (buf[i] != 0)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+// Check that a directory lists exactly the given names, in any order.
+static bool
+lists (const char* path, const char* const* names, std::size_t count)
+{
+  DIR* pdir = __posix_opendir (path);
+  if (pdir == nullptr)
+    {
+      return false;
+    }
+
+  std::size_t found = 0;
+  struct dirent* de;
+  while ((de = __posix_readdir (pdir)) != nullptr)
+    {
+      bool known = false;
+      for (std::size_t i = 0; i < count; ++i)
+        {
+          known = known || (std::strcmp (de->d_name, names[i]) == 0);
+        }
+      if (!known)
+        {
+          __posix_closedir (pdir);
+          return false;
+        }
+      ++found;
+    }
+
+  __posix_closedir (pdir);
+  return found == count;
+}
+
+int
+main (int argc __attribute__((unused)), char* argv[] __attribute__((unused)))
+{
+  char buf[8 * BLOCK_SIZE];
+  char data[8 * BLOCK_SIZE];
+  struct stat st;
+
+  // Any device is replaced by the arena.
+  assert(mm.mount (&tmpfs, "/tmp/", nullptr, 0) == 0);
+  assert(tmpfs.getBlockDevice () == &arena);
+  assert(tmpfs.getFreeBlocks () == BLOCKS);
+  assert(tmpfs.getFreeNodes () == 15);
+
+  {
+    // Files.
+    assert(__posix_open ("/tmp/f", O_RDONLY) == -1);
+    assert(errno == ENOENT);
+
+    int fd = __posix_open ("/tmp/f", O_CREAT | O_RDWR, 0640);
+    assert(fd >= 0);
+    assert(__posix_open ("/tmp/f", O_CREAT | O_EXCL | O_RDWR, 0640) == -1);
+    assert(errno == EEXIST);
+
+    fill (data, 1000, 'a');
+    assert(__posix_write (fd, data, 1000) == 1000);
+    assert(__posix_lseek (fd, 0, SEEK_CUR) == 1000);
+    assert(__posix_lseek (fd, 10, SEEK_SET) == 10);
+    assert(__posix_read (fd, buf, 20) == 20);
+    assert(std::memcmp (buf, data + 10, 20) == 0);
+    assert(__posix_lseek (fd, -1, SEEK_SET) == -1);
+    assert(errno == EINVAL);
+
+    // Writing past the end leaves a gap of zeros.
+    assert(__posix_lseek (fd, 1500, SEEK_SET) == 1500);
+    assert(__posix_write (fd, data, 100) == 100);
+    assert(__posix_lseek (fd, 0, SEEK_END) == 1600);
+    assert(__posix_lseek (fd, 1000, SEEK_SET) == 1000);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 600);
+    assert(isZero (buf, 500));
+    assert(std::memcmp (buf + 500, data, 100) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 0);
+
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(S_ISREG(st.st_mode));
+    assert((st.st_mode & 0777) == 0640);
+    assert(st.st_size == 1600);
+    assert(st.st_blocks == 4);
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 4);
+
+    // Shrink, then grow with zeros.
+    assert(__posix_ftruncate (fd, 100) == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 1);
+    assert(__posix_ftruncate (fd, 700) == 0);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 700);
+    assert(std::memcmp (buf, data, 100) == 0);
+    assert(isZero (buf + 100, 600));
+    assert(__posix_close (fd) == 0);
+
+    // Read only, append and truncate modes.
+    fd = __posix_open ("/tmp/f", O_RDONLY);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 1) == -1);
+    assert(errno == EBADF);
+    assert(__posix_ftruncate (fd, 0) == -1);
+    assert(__posix_close (fd) == 0);
+
+    fd = __posix_open ("/tmp/f", O_WRONLY | O_APPEND);
+    assert(fd >= 0);
+    assert(__posix_write (fd, data, 10) == 10);
+    assert(__posix_read (fd, buf, 1) == -1);
+    assert(errno == EBADF);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/tmp/f", &st) == 0);
+    assert(st.st_size == 710);
+
+    fd = __posix_open ("/tmp/f", O_WRONLY | O_TRUNC);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_stat ("/tmp/f", &st) == 0);
+    assert(st.st_size == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+
+    assert(__posix_truncate ("/tmp/f", 10) == 0);
+    assert(__posix_chmod ("/tmp/f", 0600) == 0);
+    struct utimbuf times =
+      { 1000, 2000 };
+    assert(__posix_utime ("/tmp/f", &times) == 0);
+    assert(__posix_stat ("/tmp/f", &st) == 0);
+    assert(st.st_size == 10);
+    assert(S_ISREG(st.st_mode) && ((st.st_mode & 0777) == 0600));
+    assert(st.st_atime == 1000 && st.st_mtime == 2000);
+
+    assert(__posix_unlink ("/tmp/f") == 0);
+    assert(__posix_stat ("/tmp/f", &st) == -1);
+    assert(errno == ENOENT);
+    assert(tmpfs.getFreeNodes () == 15);
+  }
+
+  {
+    // Directories.
+    assert(__posix_mkdir ("/tmp/d", 0755) == 0);
+    assert(__posix_mkdir ("/tmp/d", 0755) == -1);
+    assert(errno == EEXIST);
+    assert(__posix_mkdir ("/tmp/x/y", 0755) == -1);
+    assert(errno == ENOENT);
+    assert(__posix_mkdir ("/tmp/d/e", 0755) == 0);
+
+    int fd = __posix_open ("/tmp/d/e/f", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+    fd = __posix_open ("/tmp/d/g", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+
+    assert(__posix_open ("/tmp/d", O_RDONLY) == -1);
+    assert(errno == EISDIR);
+    assert(__posix_open ("/tmp/d/g/h", O_CREAT | O_RDWR, 0644) == -1);
+    assert(errno == ENOTDIR);
+    assert(__posix_mkdir ("/tmp/d/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 0755)
+        == -1);
+    assert(errno == ENAMETOOLONG);
+
+    assert(__posix_stat ("/tmp/d/e", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert(__posix_stat ("/tmp/", &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+
+    const char* names[] =
+      { "e", "g" };
+    assert(lists ("/tmp/d", names, 2));
+
+    assert(__posix_rmdir ("/tmp/d") == -1);
+    assert(errno == ENOTEMPTY);
+    assert(__posix_rmdir ("/tmp/d/g") == -1);
+    assert(errno == ENOTDIR);
+    assert(__posix_unlink ("/tmp/d/e") == -1);
+    assert(errno == EISDIR);
+
+    // Entries removed while listing are skipped.
+    for (int i = 0; i < 4; ++i)
+      {
+        char path[20];
+        std::snprintf (path, sizeof(path), "/tmp/d/n%d", i);
+        fd = __posix_open (path, O_CREAT | O_WRONLY, 0644);
+        assert(fd >= 0);
+        assert(__posix_close (fd) == 0);
+      }
+    DIR* pdir = __posix_opendir ("/tmp/d");
+    assert(pdir != nullptr);
+    struct dirent* de = __posix_readdir (pdir);
+    assert(de != nullptr);
+    assert(std::strcmp (de->d_name, "n3") == 0);
+    assert(__posix_unlink ("/tmp/d/n2") == 0);
+    de = __posix_readdir (pdir);
+    assert(de != nullptr);
+    assert(std::strcmp (de->d_name, "n1") == 0);
+    __posix_rewinddir (pdir);
+    std::size_t count = 0;
+    while (__posix_readdir (pdir) != nullptr)
+      {
+        ++count;
+      }
+    assert(count == 5);
+    assert(__posix_closedir (pdir) == 0);
+    assert(__posix_unlink ("/tmp/d/n0") == 0);
+    assert(__posix_unlink ("/tmp/d/n1") == 0);
+    assert(__posix_unlink ("/tmp/d/n3") == 0);
+  }
+
+  {
+    // Rename.
+    assert(__posix_rename ("/tmp/d/g", "/tmp/d/e/g2") == 0);
+    assert(__posix_stat ("/tmp/d/g", &st) == -1);
+    assert(__posix_stat ("/tmp/d/e/g2", &st) == 0);
+
+    // Over an existing file.
+    int fd = __posix_open ("/tmp/r", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    assert(__posix_write (fd, "new", 3) == 3);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_rename ("/tmp/r", "/tmp/d/e/f") == 0);
+    assert(__posix_stat ("/tmp/d/e/f", &st) == 0);
+    assert(st.st_size == 3);
+
+    assert(__posix_rename ("/tmp/d", "/tmp/d/e/z") == -1);
+    assert(errno == EINVAL);
+    assert(__posix_rename ("/tmp/d/e/f", "/tmp/d") == -1);
+    assert(errno == EISDIR);
+    assert(__posix_mkdir ("/tmp/m", 0755) == 0);
+    assert(__posix_rename ("/tmp/m", "/tmp/d") == -1);
+    assert(errno == ENOTEMPTY);
+
+    // A directory moves with its contents.
+    assert(__posix_rename ("/tmp/d/e", "/tmp/m2") == 0);
+    assert(__posix_stat ("/tmp/m2/f", &st) == 0);
+    assert(__posix_rename ("/tmp/m2", "/tmp/m") == 0);
+    const char* names[] =
+      { "f", "g2" };
+    assert(lists ("/tmp/m", names, 2));
+  }
+
+  {
+    // Relative to a directory.
+    DIR* pdir = __posix_opendir ("/tmp/m");
+    assert(pdir != nullptr);
+    int dfd = __posix_dirfd (pdir);
+    assert(dfd >= 0);
+
+    assert(__posix_fstatat (dfd, "f", &st, 0) == 0);
+    assert(st.st_size == 3);
+    assert(__posix_fstat (dfd, &st) == 0);
+    assert(S_ISDIR(st.st_mode));
+    assert(__posix_mkdirat (dfd, "sub", 0755) == 0);
+    int fd = __posix_openat (dfd, "sub/h", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_renameat (dfd, "sub/h", dfd, "h") == 0);
+    assert(__posix_stat ("/tmp/m/h", &st) == 0);
+    assert(__posix_unlinkat (dfd, "sub", AT_REMOVEDIR) == 0);
+    assert(__posix_unlinkat (dfd, "h", 0) == 0);
+    assert(__posix_closedir (pdir) == 0);
+
+    assert(__posix_unlink ("/tmp/m/f") == 0);
+    assert(__posix_unlink ("/tmp/m/g2") == 0);
+    assert(__posix_rmdir ("/tmp/m") == 0);
+    assert(__posix_rmdir ("/tmp/d") == 0);
+    assert(tmpfs.getFreeNodes () == 15);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+  }
+
+  {
+    // Removed while open, freed at close.
+    int fd = __posix_open ("/tmp/u", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    fill (data, 600, 'u');
+    assert(__posix_write (fd, data, 600) == 600);
+    assert(__posix_unlink ("/tmp/u") == 0);
+    assert(__posix_open ("/tmp/u", O_RDONLY) == -1);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 600);
+    assert(check (buf, 600, 'u'));
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_nlink == 0);
+    assert(tmpfs.getFreeNodes () == 14);
+    assert(__posix_close (fd) == 0);
+    assert(tmpfs.getFreeNodes () == 15);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+  }
+
+  {
+    // Fragmented arena: a file growing across the gaps left by other
+    // files uses several extents, then moves to a single one.
+    int fds[8];
+    char path[20];
+    for (int i = 0; i < 8; ++i)
+      {
+        std::snprintf (path, sizeof(path), "/tmp/s%d", i);
+        fds[i] = __posix_open (path, O_CREAT | O_RDWR, 0644);
+        assert(fds[i] >= 0);
+        fill (data, BLOCK_SIZE, static_cast<char> ('0' + i));
+        assert(__posix_write (fds[i], data, BLOCK_SIZE) == BLOCK_SIZE);
+        if (i % 2 == 1)
+          {
+            assert(__posix_write (fds[i], data, BLOCK_SIZE) == BLOCK_SIZE);
+          }
+      }
+    // 12 blocks used; free every other file, leaving 1 block gaps.
+    for (int i = 0; i < 8; i += 2)
+      {
+        assert(__posix_close (fds[i]) == 0);
+        std::snprintf (path, sizeof(path), "/tmp/s%d", i);
+        assert(__posix_unlink (path) == 0);
+      }
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 8);
+
+    int fd = __posix_open ("/tmp/big", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    fill (data, sizeof(data), 'B');
+    for (std::size_t i = 0; i < 4; ++i)
+      {
+        // Each block lands in a different gap.
+        assert(__posix_write (fd, data + i * BLOCK_SIZE, BLOCK_SIZE)
+            == BLOCK_SIZE);
+      }
+    assert(__posix_write (fd, data + 4 * BLOCK_SIZE, 4 * BLOCK_SIZE)
+        == 4 * BLOCK_SIZE);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 8 * BLOCK_SIZE);
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 16);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == sizeof(buf));
+    assert(check (buf, sizeof(buf), 'B'));
+
+    // The others are intact.
+    for (int i = 1; i < 8; i += 2)
+      {
+        assert(__posix_lseek (fds[i], 0, SEEK_SET) == 0);
+        assert(__posix_read (fds[i], buf, sizeof(buf)) == 2 * BLOCK_SIZE);
+        assert(check (buf, BLOCK_SIZE, static_cast<char> ('0' + i)));
+        assert(__posix_close (fds[i]) == 0);
+        std::snprintf (path, sizeof(path), "/tmp/s%d", i);
+        assert(__posix_unlink (path) == 0);
+      }
+
+    // Full: short write, then no space.
+    assert(__posix_ftruncate (fd, (BLOCKS - 1) * BLOCK_SIZE) == 0);
+    assert(__posix_ftruncate (fd, (BLOCKS + 1) * BLOCK_SIZE) == -1);
+    assert(errno == ENOSPC);
+    assert(__posix_lseek (fd, 0, SEEK_END) == (BLOCKS - 1) * BLOCK_SIZE);
+    assert(__posix_write (fd, data, 2 * BLOCK_SIZE) == BLOCK_SIZE);
+    assert(__posix_write (fd, data, 1) == -1);
+    assert(errno == ENOSPC);
+    assert(tmpfs.getFreeBlocks () == 0);
+    assert(__posix_lseek (fd, 0, SEEK_SET) == 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == sizeof(buf));
+    assert(check (buf, sizeof(buf), 'B'));
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/tmp/big") == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+  }
+
+  {
+    // Preallocation: the blocks are reserved beyond the size, and
+    // the appends do not allocate.
+    int fd = __posix_open ("/tmp/log", O_CREAT | O_WRONLY | O_APPEND, 0644);
+    assert(fd >= 0);
+    assert(__posix_fallocate (fd, FALLOC_FL_KEEP_SIZE, 0, 8 * BLOCK_SIZE)
+        == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 8);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 0);
+    assert(st.st_blocks == 8 * BLOCK_SIZE / 512);
+    fill (data, sizeof(data), 'L');
+    for (std::size_t i = 0; i < 8 * BLOCK_SIZE / 64; ++i)
+      {
+        assert(__posix_write (fd, data + i * 64, 64) == 64);
+      }
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 8);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 8 * BLOCK_SIZE);
+
+    // Growing the size, the new bytes read as zeros.
+    assert(__posix_posix_fallocate (fd, 4 * BLOCK_SIZE, 6 * BLOCK_SIZE) == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS - 10);
+    assert(__posix_fstat (fd, &st) == 0);
+    assert(st.st_size == 10 * BLOCK_SIZE);
+    assert(__posix_close (fd) == 0);
+    fd = __posix_open ("/tmp/log", O_RDWR);
+    assert(fd >= 0);
+    assert(__posix_read (fd, buf, sizeof(buf)) == 8 * BLOCK_SIZE);
+    assert(check (buf, 8 * BLOCK_SIZE, 'L'));
+    assert(__posix_read (fd, buf, sizeof(buf)) == 2 * BLOCK_SIZE);
+    assert(isZero (buf, 2 * BLOCK_SIZE));
+
+    // The arguments, and no space.
+    assert(__posix_fallocate (fd, 0, 0, 0) == -1);
+    assert(errno == EINVAL);
+    assert(__posix_fallocate (fd, 0x40, 0, 1) == -1);
+    assert(errno == EOPNOTSUPP);
+    assert(__posix_posix_fallocate (fd, -1, 1) == EINVAL);
+    assert(__posix_fallocate (fd, FALLOC_FL_KEEP_SIZE, 0,
+                              (BLOCKS + 1) * BLOCK_SIZE) == -1);
+    assert(errno == ENOSPC);
+    assert(__posix_posix_fallocate (fd, 0, (BLOCKS - 1) * BLOCK_SIZE)
+        == 0);
+    assert(__posix_posix_fallocate (fd, 0, (BLOCKS + 1) * BLOCK_SIZE)
+        == ENOSPC);
+    assert(tmpfs.getFreeBlocks () == 1);
+    assert(__posix_ftruncate (fd, 0) == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+
+    // A failed write keeps the blocks preallocated beyond the size.
+    int pre = __posix_open ("/tmp/pre", O_CREAT | O_WRONLY, 0644);
+    assert(pre >= 0);
+    assert(__posix_fallocate (pre, FALLOC_FL_KEEP_SIZE, 0, 4 * BLOCK_SIZE)
+        == 0);
+    assert(__posix_posix_fallocate (fd, 0, (BLOCKS - 4) * BLOCK_SIZE) == 0);
+    assert(tmpfs.getFreeBlocks () == 0);
+    assert(__posix_lseek (pre, 6 * BLOCK_SIZE, SEEK_SET) == 6 * BLOCK_SIZE);
+    assert(__posix_write (pre, data, 1) == -1);
+    assert(errno == ENOSPC);
+    assert(tmpfs.getFreeBlocks () == 0);
+    assert(__posix_fstat (pre, &st) == 0);
+    assert(st.st_size == 0);
+    assert(st.st_blocks == 4 * BLOCK_SIZE / 512);
+    assert(__posix_lseek (pre, 0, SEEK_SET) == 0);
+    assert(__posix_write (pre, data, 4 * BLOCK_SIZE) == 4 * BLOCK_SIZE);
+    assert(__posix_close (pre) == 0);
+    assert(__posix_unlink ("/tmp/pre") == 0);
+    assert(__posix_ftruncate (fd, 0) == 0);
+    assert(tmpfs.getFreeBlocks () == BLOCKS);
+    assert(__posix_close (fd) == 0);
+
+    fd = __posix_open ("/tmp/log", O_RDONLY);
+    assert(fd >= 0);
+    assert(__posix_posix_fallocate (fd, 0, BLOCK_SIZE) == EBADF);
+    assert(__posix_close (fd) == 0);
+    assert(__posix_unlink ("/tmp/log") == 0);
+  }
+
+  // A new mount starts empty.
+  int fd = __posix_open ("/tmp/k", O_CREAT | O_RDWR, 0644);
+  assert(fd >= 0);
+  assert(__posix_close (fd) == 0);
+  assert(mm.umount ("/tmp/", 0) == 0);
+  assert(mm.mount (&tmpfs, "/tmp/", nullptr, 0) == 0);
+  assert(__posix_stat ("/tmp/k", &st) == -1);
+  assert(tmpfs.getFreeNodes () == 15);
+
+  trace_puts ("'test-tmpfs-debug' succeeded.");
+
+  // Success!
+  return 0;
+}
+
+// ----------------------------------------------------------------------------